@@ -0,0 +1,693 @@
+#include "async_log.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "time_util.h"
+
+#define WRAP_FLAG 0x80000000u
+#define FLAG_TRUNCATED 0x01
+#define MAX_MESSAGE 1024
+#define MAX_SPEC 32
+
+namespace {
+
+enum ArgKind {
+    ARG_NONE,
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_INTMAX,
+    ARG_SIZE,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_PTR,
+    ARG_STR,
+};
+
+// one printf conversion, from '%' up to and including the conversion char
+struct Spec {
+    const char* begin;
+    const char* end;
+    int stars;
+    ArgKind kind;
+};
+
+struct RecordHeader {
+    uint32_t size;      // whole record incl. header, multiple of 8
+    uint8_t prio;
+    uint8_t flags;
+    uint16_t arg_bytes;
+    int64_t ts;
+    const char* tag;
+    const char* fmt;
+};
+
+inline uint32_t align8(uint32_t v)
+{
+    return (v + 7) & ~7u;
+}
+
+// Finds the next conversion at or after p. Both the capturing and the
+// formatting side walk the format with this, so they agree on the argument
+// layout by construction.
+bool next_spec(const char* p, Spec* spec)
+{
+    p = strchr(p, '%');
+    if (p == NULL)
+        return false;
+
+    spec->begin = p++;
+    spec->stars = 0;
+    spec->kind = ARG_NONE;
+    if (*p == '%') {
+        spec->end = p + 1;
+        return true;
+    }
+
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+        p++;
+    if (*p == '*') {
+        spec->stars++;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9')
+                p++;
+        }
+    }
+
+    ArgKind integer = ARG_INT;
+    bool long_double = false;
+    if (p[0] == 'h') {
+        p += p[1] == 'h' ? 2 : 1;
+    } else if (p[0] == 'l') {
+        integer = p[1] == 'l' ? ARG_LLONG : ARG_LONG;
+        p += p[1] == 'l' ? 2 : 1;
+    } else if (p[0] == 'q') {
+        integer = ARG_LLONG;
+        p++;
+    } else if (p[0] == 'j') {
+        integer = ARG_INTMAX;
+        p++;
+    } else if (p[0] == 'z') {
+        integer = ARG_SIZE;
+        p++;
+    } else if (p[0] == 't') {
+        integer = ARG_PTRDIFF;
+        p++;
+    } else if (p[0] == 'L') {
+        long_double = true;
+        p++;
+    }
+
+    switch (*p) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            spec->kind = integer;
+            break;
+        case 'c':
+            spec->kind = ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->kind = long_double ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+        case 's':
+            spec->kind = ARG_STR;
+            break;
+        case 'p':
+        case 'n':
+            spec->kind = ARG_PTR;
+            break;
+        default:
+            // unknown conversion, printed as is and consumes nothing
+            spec->stars = 0;
+            break;
+    }
+    spec->end = *p != '\0' ? p + 1 : p;
+    return true;
+}
+
+// appends scalars and strings to a record under construction
+struct ArgWriter {
+    uint8_t* pos;
+    uint8_t* end;
+    bool truncated;
+
+    template <typename T>
+    void put(T v)
+    {
+        const uint32_t slot = align8(sizeof(T));
+        if (truncated || pos + slot > end) {
+            truncated = true;
+            return;
+        }
+        memcpy(pos, &v, sizeof(T));
+        pos += slot;
+    }
+
+    void put_str(const char* s)
+    {
+        if (s == NULL)
+            s = "(null)";
+        if (truncated || pos + 8 > end) {
+            truncated = true;
+            return;
+        }
+        uint32_t room = (uint32_t) (end - pos) - 4 - 1;
+        uint32_t len = (uint32_t) strnlen(s, room);
+        memcpy(pos, &len, 4);
+        memcpy(pos + 4, s, len);
+        pos[4 + len] = '\0';
+        pos += align8(4 + len + 1);
+        if (s[len] != '\0')
+            truncated = true;
+    }
+};
+
+struct ArgReader {
+    const uint8_t* pos;
+    const uint8_t* end;
+
+    template <typename T>
+    bool get(T* v)
+    {
+        const uint32_t slot = align8(sizeof(T));
+        if (pos + slot > end)
+            return false;
+        memcpy(v, pos, sizeof(T));
+        pos += slot;
+        return true;
+    }
+
+    bool get_str(const char** s)
+    {
+        uint32_t len;
+        if (pos + 8 > end)
+            return false;
+        memcpy(&len, pos, 4);
+        *s = (const char*) pos + 4;
+        pos += align8(4 + len + 1);
+        return pos <= end;
+    }
+};
+
+template <typename T>
+int format_one(char* out, size_t size, const char* spec, int stars, const int* star_values, T v)
+{
+    switch (stars) {
+        case 0: return snprintf(out, size, spec, v);
+        case 1: return snprintf(out, size, spec, star_values[0], v);
+        default: return snprintf(out, size, spec, star_values[0], star_values[1], v);
+    }
+}
+
+// formats a captured record the way vsnprintf would have
+void format_record(const RecordHeader* rec, char* msg, size_t size)
+{
+    ArgReader args = { (const uint8_t*) (rec + 1), (const uint8_t*) (rec + 1) + rec->arg_bytes };
+    size_t len = 0;
+    const char* p = rec->fmt;
+    Spec spec;
+    bool exhausted = false;
+
+    while (len + 1 < size && !exhausted) {
+        if (!next_spec(p, &spec)) {
+            size_t n = strlen(p);
+            if (n > size - len - 1)
+                n = size - len - 1;
+            memcpy(msg + len, p, n);
+            len += n;
+            break;
+        }
+        size_t literal = (size_t) (spec.begin - p);
+        if (literal > size - len - 1)
+            literal = size - len - 1;
+        memcpy(msg + len, p, literal);
+        len += literal;
+        p = spec.end;
+        if (len + 1 >= size)
+            break;
+
+        size_t spec_len = (size_t) (spec.end - spec.begin);
+        if (spec.kind == ARG_NONE || spec_len >= MAX_SPEC) {
+            // "%%" or something not understood, copy it through
+            bool percent = spec_len == 2 && spec.begin[1] == '%';
+            const char* text = percent ? "%" : spec.begin;
+            size_t n = percent ? 1 : spec_len;
+            if (n > size - len - 1)
+                n = size - len - 1;
+            memcpy(msg + len, text, n);
+            len += n;
+            continue;
+        }
+
+        char fmt[MAX_SPEC];
+        memcpy(fmt, spec.begin, spec_len);
+        fmt[spec_len] = '\0';
+
+        int stars[2] = { 0, 0 };
+        for (int i = 0; i < spec.stars; i++)
+            exhausted |= !args.get(&stars[i]);
+
+        int n = 0;
+        char* out = msg + len;
+        size_t room = size - len;
+        switch (spec.kind) {
+            case ARG_INT: { int v; if ((exhausted |= !args.get(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            case ARG_LONG: { long v; if ((exhausted |= !args.get(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            case ARG_LLONG: { long long v; if ((exhausted |= !args.get(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            case ARG_INTMAX: { intmax_t v; if ((exhausted |= !args.get(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            case ARG_SIZE: { size_t v; if ((exhausted |= !args.get(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            case ARG_PTRDIFF: { ptrdiff_t v; if ((exhausted |= !args.get(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            case ARG_DOUBLE: { double v; if ((exhausted |= !args.get(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            case ARG_LDOUBLE: { long double v; if ((exhausted |= !args.get(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            case ARG_PTR: {
+                void* v;
+                if ((exhausted |= !args.get(&v)))
+                    break;
+                // %n has nothing to write into any more
+                if (spec.end[-1] == 'p')
+                    n = format_one(out, room, fmt, spec.stars, stars, v);
+                break;
+            }
+            case ARG_STR: { const char* v; if ((exhausted |= !args.get_str(&v))) break; n = format_one(out, room, fmt, spec.stars, stars, v); break; }
+            default: break;
+        }
+        if (n > 0)
+            len += (size_t) n < room ? (size_t) n : room - 1;
+    }
+
+    if ((exhausted || (rec->flags & FLAG_TRUNCATED)) && len + 4 < size)
+        len += (size_t) snprintf(msg + len, size - len, "...");
+    msg[len < size ? len : size - 1] = '\0';
+}
+
+const char prio_chars[] = "??VDIWEFS";
+
+char prio_char(int prio)
+{
+    return prio >= 0 && prio < (int) sizeof(prio_chars) - 1 ? prio_chars[prio] : '?';
+}
+
+} // namespace
+
+struct AsyncLogger::ThreadRing {
+    // producer side
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> dropped;
+    uint8_t pad[64];
+    // consumer side
+    std::atomic<uint64_t> tail;
+    std::atomic<bool> orphaned;
+    alignas(8) uint8_t data[RING_SIZE];
+
+    ThreadRing() : head(0), dropped(0), tail(0), orphaned(false) {}
+
+    // next record for the consumer, skipping a wrap marker
+    const RecordHeader* peek()
+    {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (t == h)
+            return NULL;
+        const RecordHeader* rec = (const RecordHeader*) (data + (t & (RING_SIZE - 1)));
+        if (rec->size & WRAP_FLAG) {
+            t += rec->size & ~WRAP_FLAG;
+            tail.store(t, std::memory_order_release);
+            if (t == h)
+                return NULL;
+            rec = (const RecordHeader*) data;
+        }
+        return rec;
+    }
+
+    void pop(const RecordHeader* rec)
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + rec->size, std::memory_order_release);
+    }
+};
+
+// set once the thread's RingOwner is gone; trivial, so it stays readable
+// from thread_local destructors that run after it
+static thread_local bool ring_retired = false;
+
+// marks a thread's ring for the drain thread to free once it is empty
+struct RingOwner {
+    AsyncLogger::ThreadRing* ring = NULL;
+    ~RingOwner()
+    {
+        if (ring != NULL)
+            ring->orphaned.store(true, std::memory_order_release);
+        ring = NULL;
+        ring_retired = true;
+    }
+};
+
+static thread_local RingOwner ring_owner;
+
+void LogcatSink::write(int prio, const char* tag, const char* msg, int64_t)
+{
+    print(prio, tag, "%s", msg);
+}
+
+void StdoutSink::write(int prio, const char* tag, const char* msg, int64_t)
+{
+    fprintf(stdout, "%c/%s: %s\n", prio_char(prio), tag, msg);
+}
+
+void StdoutSink::flush()
+{
+    fflush(stdout);
+}
+
+FileSink::FileSink()
+    : file(NULL)
+{
+}
+
+FileSink::~FileSink()
+{
+    if (file != NULL)
+        fclose(file);
+}
+
+bool FileSink::open(const char* path)
+{
+    file = fopen(path, "ae");
+    return file != NULL;
+}
+
+void FileSink::write(int prio, const char* tag, const char* msg, int64_t realtime_ns)
+{
+    if (file == NULL)
+        return;
+    time_t secs = (time_t) (realtime_ns / 1000000000LL);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    fprintf(file, "%02d-%02d %02d:%02d:%02d.%03d %c/%s: %s\n", tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+            tm.tm_sec, (int) (realtime_ns / 1000000 % 1000), prio_char(prio), tag, msg);
+}
+
+void FileSink::flush()
+{
+    if (file != NULL)
+        fflush(file);
+}
+
+AsyncLogger& AsyncLogger::instance()
+{
+    // never destroyed: threads may still log from atexit handlers and
+    // thread_local destructors
+    static AsyncLogger* logger = new AsyncLogger();
+    return *logger;
+}
+
+AsyncLogger::AsyncLogger()
+    : wake_fd(-1)
+    , sleeping(false)
+    , quitting(false)
+    , record_count(0)
+    , retired_drops(0)
+    , reported_drops(0)
+{
+}
+
+void AsyncLogger::add_sink(std::unique_ptr<LogSink> sink)
+{
+    if (!running())
+        sinks.push_back(std::move(sink));
+}
+
+void AsyncLogger::clear_sinks()
+{
+    if (!running())
+        sinks.clear();
+}
+
+bool AsyncLogger::start()
+{
+    if (running())
+        return true;
+    if (sinks.empty())
+        return false;
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0)
+        return false;
+
+    quitting.store(false);
+    sleeping.store(false);
+    drain_thread = std::thread(&AsyncLogger::drain_loop, this);
+    __log_func = async_log_print;
+    return true;
+}
+
+void AsyncLogger::stop()
+{
+    if (!running())
+        return;
+
+    __log_func = sync_log_func();
+    quitting.store(true);
+    eventfd_write(wake_fd, 1);
+    drain_thread.join();
+    close(wake_fd);
+    wake_fd = -1;
+}
+
+uint64_t AsyncLogger::dropped() const
+{
+    std::lock_guard<std::mutex> l(registry_lock);
+    uint64_t total = retired_drops;
+    for (ThreadRing* r : rings)
+        total += r->dropped.load(std::memory_order_relaxed);
+    return total;
+}
+
+AsyncLogger::ThreadRing* AsyncLogger::thread_ring()
+{
+    // the compiler may drop the store to the dead ring_owner, so ask the flag
+    if (ring_retired)
+        return NULL;
+    if (ring_owner.ring == NULL) {
+        ThreadRing* ring = new ThreadRing();
+        std::lock_guard<std::mutex> l(registry_lock);
+        rings.push_back(ring);
+        ring_owner.ring = ring;
+    }
+    return ring_owner.ring;
+}
+
+int AsyncLogger::vlog(int prio, const char* tag, const char* fmt, va_list args)
+{
+    // a thread_local destructor logging after the ring went to the drain
+    // thread, which may have freed it already
+    ThreadRing* ring = thread_ring();
+    if (ring == NULL) {
+        char msg[MAX_MESSAGE];
+        vsnprintf(msg, sizeof(msg), fmt, args);
+        return sync_log_func()(prio, tag, "%s", msg);
+    }
+
+    alignas(8) uint8_t buf[MAX_RECORD_SIZE];
+    RecordHeader* rec = (RecordHeader*) buf;
+    ArgWriter w = { buf + sizeof(RecordHeader), buf + sizeof(buf), false };
+
+    Spec spec;
+    for (const char* p = fmt; next_spec(p, &spec); p = spec.end) {
+        for (int i = 0; i < spec.stars; i++)
+            w.put(va_arg(args, int));
+        switch (spec.kind) {
+            case ARG_INT: w.put(va_arg(args, int)); break;
+            case ARG_LONG: w.put(va_arg(args, long)); break;
+            case ARG_LLONG: w.put(va_arg(args, long long)); break;
+            case ARG_INTMAX: w.put(va_arg(args, intmax_t)); break;
+            case ARG_SIZE: w.put(va_arg(args, size_t)); break;
+            case ARG_PTRDIFF: w.put(va_arg(args, ptrdiff_t)); break;
+            case ARG_DOUBLE: w.put(va_arg(args, double)); break;
+            case ARG_LDOUBLE: w.put(va_arg(args, long double)); break;
+            case ARG_PTR: w.put(va_arg(args, void*)); break;
+            case ARG_STR: w.put_str(va_arg(args, const char*)); break;
+            default: break;
+        }
+    }
+
+    uint32_t size = (uint32_t) (w.pos - buf);
+    rec->size = size;
+    rec->prio = (uint8_t) prio;
+    rec->flags = w.truncated ? FLAG_TRUNCATED : 0;
+    rec->arg_bytes = (uint16_t) (size - sizeof(RecordHeader));
+    rec->ts = now_ns(CLOCK_REALTIME);
+    rec->tag = tag;
+    rec->fmt = fmt;
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    uint32_t pos = (uint32_t) (head & (RING_SIZE - 1));
+    uint32_t skip = RING_SIZE - pos < size ? RING_SIZE - pos : 0;
+    if (head + skip + size - tail > RING_SIZE) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    if (skip != 0) {
+        uint32_t marker = skip | WRAP_FLAG;
+        memcpy(ring->data + pos, &marker, sizeof(marker));
+        pos = 0;
+    }
+    memcpy(ring->data + pos, buf, size);
+    ring->head.store(head + skip + size, std::memory_order_release);
+    record_count.fetch_add(1, std::memory_order_relaxed);
+
+    // pairs with the fence in drain_loop(): either the drain thread sees
+    // the record before sleeping or this sees it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false))
+        eventfd_write(wake_fd, 1);
+    return 1;
+}
+
+// Formats everything queued, oldest record first across threads.
+bool AsyncLogger::drain_once()
+{
+    std::vector<ThreadRing*> snapshot;
+    {
+        std::lock_guard<std::mutex> l(registry_lock);
+        snapshot = rings;
+    }
+
+    bool any = false;
+    char msg[MAX_MESSAGE];
+    while (true) {
+        ThreadRing* oldest = NULL;
+        const RecordHeader* rec = NULL;
+        for (ThreadRing* r : snapshot) {
+            const RecordHeader* h = r->peek();
+            if (h != NULL && (rec == NULL || h->ts < rec->ts)) {
+                rec = h;
+                oldest = r;
+            }
+        }
+        if (rec == NULL)
+            break;
+
+        format_record(rec, msg, sizeof(msg));
+        for (auto& sink : sinks)
+            sink->write(rec->prio, rec->tag, msg, rec->ts);
+        oldest->pop(rec);
+        any = true;
+    }
+
+    // rings of exited threads go once they are empty
+    std::lock_guard<std::mutex> l(registry_lock);
+    for (size_t i = 0; i < rings.size();) {
+        ThreadRing* r = rings[i];
+        if (r->orphaned.load(std::memory_order_acquire) && r->peek() == NULL) {
+            retired_drops += r->dropped.load(std::memory_order_relaxed);
+            rings[i] = rings.back();
+            rings.pop_back();
+            delete r;
+        } else {
+            i++;
+        }
+    }
+    return any;
+}
+
+void AsyncLogger::report_drops()
+{
+    uint64_t total = dropped();
+    if (total == reported_drops)
+        return;
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%llu log records dropped", (unsigned long long) (total - reported_drops));
+    reported_drops = total;
+    for (auto& sink : sinks)
+        sink->write(ANDROID_LOG_WARN, TAG, msg, now_ns(CLOCK_REALTIME));
+}
+
+void AsyncLogger::drain_loop()
+{
+    // signals belong to the holder's signalfd, never to this thread
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    while (true) {
+        drain_once();
+        report_drops();
+        for (auto& sink : sinks)
+            sink->flush();
+        if (quitting.load())
+            break;
+
+        sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool pending = false;
+        {
+            std::lock_guard<std::mutex> l(registry_lock);
+            for (ThreadRing* r : rings)
+                pending |= r->head.load(std::memory_order_acquire) != r->tail.load(std::memory_order_relaxed);
+        }
+        if (pending || quitting.load()) {
+            sleeping.store(false);
+            continue;
+        }
+
+        eventfd_t value;
+        eventfd_read(wake_fd, &value);
+    }
+    drain_once();
+    for (auto& sink : sinks)
+        sink->flush();
+}
+
+int async_log_print(int prio, const char* tag, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int res = AsyncLogger::instance().vlog(prio, tag, fmt, args);
+    va_end(args);
+    return res;
+}
+
+bool start_async_log(const char* log_file)
+{
+    AsyncLogger& logger = AsyncLogger::instance();
+    if (logger.running())
+        return true;
+
+    logger.clear_sinks();
+    if (log_lib_loaded())
+        logger.add_sink(std::unique_ptr<LogSink>(new LogcatSink(sync_log_func())));
+    else
+        logger.add_sink(std::unique_ptr<LogSink>(new StdoutSink()));
+
+    if (log_file != NULL) {
+        std::unique_ptr<FileSink> file(new FileSink());
+        if (file->open(log_file))
+            logger.add_sink(std::move(file));
+        else
+            __log_func(ANDROID_LOG_ERROR, TAG, "cannot open log file %s: %s", log_file, strerror(errno));
+    }
+    return logger.start();
+}
+
+void stop_async_log()
+{
+    AsyncLogger::instance().stop();
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "holder_log.h"
+
+// Destination of formatted log lines, called from the drain thread only.
+class LogSink {
+public:
+    virtual ~LogSink() {}
+    virtual void write(int prio, const char* tag, const char* msg, int64_t realtime_ns) = 0;
+    virtual void flush() {}
+};
+
+// liblog's __android_log_print
+class LogcatSink : public LogSink {
+public:
+    explicit LogcatSink(__android_log_print_fn fn) : print(fn) {}
+    void write(int prio, const char* tag, const char* msg, int64_t realtime_ns) override;
+
+private:
+    __android_log_print_fn print;
+};
+
+// "P/tag: msg" lines, the format of the synchronous stdout fallback
+class StdoutSink : public LogSink {
+public:
+    void write(int prio, const char* tag, const char* msg, int64_t realtime_ns) override;
+    void flush() override;
+};
+
+// "MM-DD hh:mm:ss.mmm P/tag: msg" lines, buffered, flushed whenever the
+// drain thread runs out of records
+class FileSink : public LogSink {
+public:
+    FileSink();
+    ~FileSink() override;
+
+    bool open(const char* path);
+    void write(int prio, const char* tag, const char* msg, int64_t realtime_ns) override;
+    void flush() override;
+
+private:
+    FILE* file;
+};
+
+// Asynchronous backend for __log_func. Every thread that logs gets its own
+// single-producer ring; a call stores the priority, the tag and format
+// pointers and the raw arguments (strings copied) and returns. A drain
+// thread merges the rings by timestamp, formats and hands the lines to the
+// sinks, so a slow or rate-limited logcat never stalls the logging thread.
+// Records that don't fit are dropped and counted.
+//
+// Tags and format strings must outlive the process' log calls, which string
+// literals do; every __log_func call site passes literals.
+class AsyncLogger {
+public:
+    static const uint32_t RING_SIZE = 32 * 1024;
+    static const uint32_t MAX_RECORD_SIZE = 512;
+
+    // per-thread ring, public for the thread_local that retires it
+    struct ThreadRing;
+
+    static AsyncLogger& instance();
+
+    // sinks can only change while stopped
+    void add_sink(std::unique_ptr<LogSink> sink);
+    void clear_sinks();
+
+    // installs async_log_print() as __log_func
+    bool start();
+    // restores the synchronous __log_func after draining what is queued
+    void stop();
+    bool running() const { return drain_thread.joinable(); }
+
+    int vlog(int prio, const char* tag, const char* fmt, va_list args);
+
+    uint64_t records() const { return record_count.load(std::memory_order_relaxed); }
+    uint64_t dropped() const;
+
+private:
+    AsyncLogger();
+
+    // NULL once the calling thread's ring was retired
+    ThreadRing* thread_ring();
+    void drain_loop();
+    bool drain_once();
+    void report_drops();
+
+    mutable std::mutex registry_lock;
+    std::vector<ThreadRing*> rings;
+    std::vector<std::unique_ptr<LogSink>> sinks;
+
+    std::thread drain_thread;
+    int wake_fd;
+    std::atomic<bool> sleeping;
+    std::atomic<bool> quitting;
+    std::atomic<uint64_t> record_count;
+    // drops of rings already freed, and the total last reported to the sinks
+    uint64_t retired_drops;
+    uint64_t reported_drops;
+};
+
+int async_log_print(int prio, const char* tag, const char* fmt, ...);
+
+// Logs through the drain thread from here on: to logcat when liblog.so is
+// loaded, stdout otherwise, and additionally to log_file when given.
+bool start_async_log(const char* log_file = NULL);
+void stop_async_log();
@@ -0,0 +1,42 @@
+#include "camera/ahb_fns.h"
+
+#include "holder_log.h"
+
+#if defined(__ANDROID__)
+#include <dlfcn.h>
+#endif
+
+const AhbFns& ahb_fns()
+{
+#if defined(__ANDROID__)
+    static const AhbFns fns = []() {
+        AhbFns f = {};
+        void* lib = dlopen("libnativewindow.so", RTLD_NOW);
+        if (lib == NULL) {
+            __log_func(ANDROID_LOG_ERROR, TAG, "dlopen libnativewindow.so failed: %s", dlerror());
+            return f;
+        }
+        f.describe = (decltype(f.describe)) dlsym(lib, "AHardwareBuffer_describe");
+        f.lock = (decltype(f.lock)) dlsym(lib, "AHardwareBuffer_lock");
+        f.lock_planes = (decltype(f.lock_planes)) dlsym(lib, "AHardwareBuffer_lockPlanes");
+        f.unlock = (decltype(f.unlock)) dlsym(lib, "AHardwareBuffer_unlock");
+        f.acquire = (decltype(f.acquire)) dlsym(lib, "AHardwareBuffer_acquire");
+        f.release = (decltype(f.release)) dlsym(lib, "AHardwareBuffer_release");
+        f.send_handle = (decltype(f.send_handle)) dlsym(lib, "AHardwareBuffer_sendHandleToUnixSocket");
+        f.recv_handle = (decltype(f.recv_handle)) dlsym(lib, "AHardwareBuffer_recvHandleFromUnixSocket");
+        return f;
+    }();
+#else
+    static const AhbFns fns = {
+        AHardwareBuffer_describe,
+        AHardwareBuffer_lock,
+        AHardwareBuffer_lockPlanes,
+        AHardwareBuffer_unlock,
+        AHardwareBuffer_acquire,
+        AHardwareBuffer_release,
+        AHardwareBuffer_sendHandleToUnixSocket,
+        AHardwareBuffer_recvHandleFromUnixSocket,
+    };
+#endif
+    return fns;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "qvr/inc/QVRCameraClient.h"
+
+// The NDK AHardwareBuffer calls. AHardwareBuffer_lockPlanes() is API 29 and
+// the app runs from 28, so on Android they are looked up at runtime like
+// liblog's; a missing one stays NULL.
+struct AhbFns {
+    void (*describe)(const AHardwareBuffer*, AHardwareBuffer_Desc*);
+    int (*lock)(AHardwareBuffer*, uint64_t, int32_t, const ARect*, void**);
+    int (*lock_planes)(AHardwareBuffer*, uint64_t, int32_t, const ARect*, AHardwareBuffer_Planes*);
+    int (*unlock)(AHardwareBuffer*, int32_t*);
+    void (*acquire)(AHardwareBuffer*);
+    void (*release)(AHardwareBuffer*);
+    int (*send_handle)(const AHardwareBuffer*, int);
+    int (*recv_handle)(int, AHardwareBuffer**);
+};
+
+const AhbFns& ahb_fns();
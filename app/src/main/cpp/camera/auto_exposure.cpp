@@ -0,0 +1,353 @@
+#include "camera/auto_exposure.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "qvr/inc/QVRCameraDeviceParam.h"
+#include "camera/camera_pipeline.h"
+#include "holder_log.h"
+#include "simd.h"
+
+// samples per pass through the stack buffer of the vector kernel
+#define CHUNK 256
+// what exposure and gain can't reach goes into gamma at this rate per stop
+#define GAMMA_PER_EV 0.5
+// gamma changes smaller than this aren't worth a call
+#define MIN_GAMMA_CHANGE 0.02f
+// errors larger than this are steps the proportional term takes; integrating
+// them too only overshoots once the step is done
+#define MAX_INTEGRATED_EV 1.0f
+
+uint32_t AutoExposure::Histogram::percentile(float p) const
+{
+    uint64_t want = (uint64_t) ceil((double) p * count);
+    uint64_t seen = 0;
+    for (int v = 0; v < BINS; v++) {
+        seen += bins[v];
+        if (seen >= want && seen > 0)
+            return (uint32_t) v;
+    }
+    return BINS - 1;
+}
+
+#if defined(HOLDER_HAVE_SIMD)
+
+// Every step-th (1, 2 or 4) of the n pixels from p into out, adding their
+// sum; 16 at a time while the loads stay within the avail bytes from p.
+static void gather_simd(const uint8_t* p, uint32_t n, uint32_t step, uint32_t avail, uint8_t* out, uint64_t* sum)
+{
+    uint32_t i = 0;
+#if defined(HOLDER_SIMD_NEON)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= n && (i + 16) * step <= avail; i += 16) {
+        const uint8_t* s = p + (size_t) i * step;
+        uint8x16_t v = step == 4 ? vld4q_u8(s).val[0] : step == 2 ? vld2q_u8(s).val[0] : vld1q_u8(s);
+        vst1q_u8(out + i, v);
+        acc = vpadalq_u16(acc, vpaddlq_u8(v));
+    }
+    uint64x2_t wide = vpaddlq_u32(acc);
+    *sum += vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1);
+#else
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    __m128i low_byte32 = _mm_set1_epi32(0xff);
+    __m128i low_byte16 = _mm_set1_epi16(0xff);
+    for (; i + 16 <= n && (i + 16) * step <= avail; i += 16) {
+        const __m128i* s = (const __m128i*) (p + (size_t) i * step);
+        __m128i v;
+        if (step == 4) {
+            // the low byte of each 32 bit lane, packed down twice
+            __m128i ab = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(s), low_byte32),
+                                         _mm_and_si128(_mm_loadu_si128(s + 1), low_byte32));
+            __m128i cd = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(s + 2), low_byte32),
+                                         _mm_and_si128(_mm_loadu_si128(s + 3), low_byte32));
+            v = _mm_packus_epi16(ab, cd);
+        } else if (step == 2) {
+            v = _mm_packus_epi16(_mm_and_si128(_mm_loadu_si128(s), low_byte16),
+                                 _mm_and_si128(_mm_loadu_si128(s + 1), low_byte16));
+        } else {
+            v = _mm_loadu_si128(s);
+        }
+        _mm_storeu_si128((__m128i*) (out + i), v);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    *sum += (uint64_t) _mm_cvtsi128_si32(acc) + (uint64_t) _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+#endif
+    uint32_t tail = 0;
+    for (; i < n; i++) {
+        out[i] = p[(size_t) i * step];
+        tail += out[i];
+    }
+    *sum += tail;
+}
+
+#endif
+
+AutoExposure::AutoExposure()
+    : kernel(KERNEL_SIMD)
+    , camera(NULL)
+    , exposure_cap_ns(0)
+{
+    set_config(Config());
+}
+
+AutoExposure::AutoExposure(const Config& config)
+    : kernel(KERNEL_SIMD)
+    , camera(NULL)
+    , exposure_cap_ns(0)
+{
+    set_config(config);
+}
+
+void AutoExposure::set_config(const Config& config)
+{
+    cfg = config;
+    cfg.step_x = std::max(cfg.step_x, 1u);
+    cfg.step_y = std::max(cfg.step_y, 1u);
+    cfg.min_gain = std::max(cfg.min_gain, 1u);
+    cfg.max_gain = std::max(cfg.max_gain, cfg.min_gain);
+    cfg.min_exposure_ns = std::max(cfg.min_exposure_ns, (uint64_t) 1);
+    cfg.max_exposure_ns = std::max(cfg.max_exposure_ns, cfg.min_exposure_ns);
+    cfg.max_gamma = std::max(cfg.max_gamma, 1.0f);
+    reset();
+}
+
+void AutoExposure::reset()
+{
+    integral_ev = 0.0f;
+    sent = Settings();
+    sent.gamma = 1.0f;
+    have_sent = false;
+    settling = false;
+    settle_count = 0;
+    st = Stats();
+}
+
+bool AutoExposure::simd_available()
+{
+#if defined(HOLDER_HAVE_SIMD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+AutoExposure::Kernel AutoExposure::active_kernel() const
+{
+    return kernel == KERNEL_SIMD && simd_available() ? KERNEL_SIMD : KERNEL_SCALAR;
+}
+
+int32_t AutoExposure::attach(qvrcamera_device_helper_t* cam)
+{
+    if (cam == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    uint8_t device_ae = 0;
+    if (QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT8_AUTO_EXPOSURE, QVRCAMERA_PARAM_NUM_TYPE_UINT8,
+                                    sizeof(device_ae), (char*) &device_ae) == QVR_CAM_SUCCESS &&
+        device_ae != 0)
+        __log_func(ANDROID_LOG_WARN, TAG, "camera auto exposure is on, it may override the client's settings");
+
+    uint32_t rate = CameraPipeline::max_rate_hz(cam);
+    exposure_cap_ns = rate != 0 ? 1000000000ULL / rate : 0;
+    camera = cam;
+    reset();
+    return QVR_CAM_SUCCESS;
+}
+
+void AutoExposure::meter_rows(const ImageView& v, uint32_t* bins, uint64_t* sum, uint32_t* count) const
+{
+    uint32_t x0 = (uint32_t) std::min(std::max(cfg.roi_left, 0.0f) * v.width, (float) v.width);
+    uint32_t x1 = (uint32_t) std::min(std::max(cfg.roi_right, 0.0f) * v.width, (float) v.width);
+    uint32_t y0 = (uint32_t) std::min(std::max(cfg.roi_top, 0.0f) * v.height, (float) v.height);
+    uint32_t y1 = (uint32_t) std::min(std::max(cfg.roi_bottom, 0.0f) * v.height, (float) v.height);
+    if (x1 <= x0 || y1 <= y0)
+        return;
+    uint32_t step = cfg.step_x;
+    uint32_t n = (x1 - x0 + step - 1) / step;
+
+#if defined(HOLDER_HAVE_SIMD)
+    // other steps gain nothing from the buffer
+    if (active_kernel() == KERNEL_SIMD && (step == 1 || step == 2 || step == 4)) {
+        // four sub-histograms keep back to back samples of the same value
+        // from waiting on each other's increments
+        uint32_t sub[3][BINS];
+        memset(sub, 0, sizeof(sub));
+        uint8_t buf[CHUNK];
+        for (uint32_t y = y0; y < y1; y += cfg.step_y) {
+            const uint8_t* row = v.data + (size_t) y * v.pitch + x0;
+            for (uint32_t c = 0; c < n; c += CHUNK) {
+                uint32_t m = std::min(n - c, (uint32_t) CHUNK);
+                gather_simd(row + (size_t) c * step, m, step, v.width - x0 - c * step, buf, sum);
+                uint32_t i = 0;
+                for (; i + 4 <= m; i += 4) {
+                    bins[buf[i]]++;
+                    sub[0][buf[i + 1]]++;
+                    sub[1][buf[i + 2]]++;
+                    sub[2][buf[i + 3]]++;
+                }
+                for (; i < m; i++)
+                    bins[buf[i]]++;
+            }
+            *count += n;
+        }
+        for (int b = 0; b < BINS; b++)
+            bins[b] += sub[0][b] + sub[1][b] + sub[2][b];
+        return;
+    }
+#endif
+    for (uint32_t y = y0; y < y1; y += cfg.step_y) {
+        const uint8_t* row = v.data + (size_t) y * v.pitch;
+        uint32_t row_sum = 0;
+        for (uint32_t x = x0; x < x1; x += step) {
+            bins[row[x]]++;
+            row_sum += row[x];
+        }
+        *sum += row_sum;
+        *count += n;
+    }
+}
+
+bool AutoExposure::meter(const ImageView* views, int count, Histogram* out) const
+{
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < count; i++) {
+        if (views[i].format != QVRCAMERA_FRAME_FORMAT_Y8 && views[i].format != QVRCAMERA_FRAME_FORMAT_YUV420)
+            return false;
+        meter_rows(views[i], out->bins, &out->sum, &out->count);
+    }
+    return out->count > 0;
+}
+
+AutoExposure::Settings AutoExposure::split(double total_ns) const
+{
+    double cap = (double) cfg.max_exposure_ns;
+    if (exposure_cap_ns != 0)
+        cap = std::min(cap, (double) exposure_cap_ns);
+    cap = std::max(cap, (double) cfg.min_exposure_ns);
+
+    // exposure before gain, which adds noise
+    double e = std::min(std::max(total_ns * 100.0 / cfg.min_gain, (double) cfg.min_exposure_ns), cap);
+    // whole flicker periods see the same light whatever the phase; shorter
+    // exposures can't avoid the banding
+    if (cfg.flicker_hz != 0) {
+        double period = 1e9 / cfg.flicker_hz;
+        if (e >= period)
+            e = floor(e / period) * period;
+    }
+
+    Settings s;
+    s.exposure_ns = (uint64_t) llround(e);
+    s.gain = (uint32_t) std::min(std::max(llround(total_ns * 100.0 / e), (long long) cfg.min_gain),
+                                 (long long) cfg.max_gain);
+    s.gamma = 1.0f;
+    return s;
+}
+
+AutoExposure::Settings AutoExposure::update(const Histogram& h, uint64_t exposure_ns, uint32_t gain)
+{
+    float gamma = have_sent ? sent.gamma : 1.0f;
+    double mean = std::max((double) h.mean(), 0.5);
+    // what the sensor gave, before the gamma curve
+    double linear = 255.0 * pow(mean / 255.0, gamma);
+    float err = (float) log2(cfg.target / linear);
+
+    // saturated samples don't tell by how much; the more of them, the
+    // further down
+    uint32_t clipped = 0;
+    for (int v = (int) std::min(cfg.clip_level, (uint32_t) BINS - 1); v < BINS; v++)
+        clipped += h.bins[v];
+    if (h.count != 0 && clipped > cfg.clip_fraction * h.count)
+        err = std::min(err, -0.5f - 1.5f * clipped / h.count);
+    if (fabsf(err) < cfg.deadband_ev)
+        err = 0.0f;
+
+    double total = (double) exposure_ns * gain / 100.0;
+    Settings lo = split(0.0), hi = split(1e18);
+    double min_total = (double) lo.exposure_ns * lo.gain / 100.0;
+    double max_total = (double) hi.exposure_ns * hi.gain / 100.0;
+    // no windup against the limits
+    bool stuck = (err > 0 && total >= max_total * 0.999) || (err < 0 && total <= min_total * 1.001);
+    if (!stuck && fabsf(err) <= MAX_INTEGRATED_EV)
+        integral_ev = std::min(std::max(integral_ev + err, -cfg.max_integral_ev), cfg.max_integral_ev);
+
+    double want = total * exp2(cfg.kp * err + cfg.ki * integral_ev);
+    Settings s = split(want);
+    if (cfg.max_gamma > 1.0f) {
+        double short_ev = want > max_total ? log2(want / max_total) : 0.0;
+        s.gamma = (float) std::min(1.0 + GAMMA_PER_EV * short_ev, (double) cfg.max_gamma);
+    }
+    st.brightness = (float) mean;
+    st.error_ev = err;
+    return s;
+}
+
+bool AutoExposure::process(const ImageView* views, int count, uint64_t exposure_ns, uint32_t gain)
+{
+    st.frames++;
+    if (exposure_ns == 0 || gain == 0) {
+        st.errors++;
+        return false;
+    }
+    if (settling) {
+        // metering frames of the old settings would send them again
+        bool shown = exposure_ns == sent.exposure_ns && gain == sent.gain;
+        if (!shown && ++settle_count <= cfg.settle_frames) {
+            st.settling++;
+            return false;
+        }
+        settling = false;
+    }
+
+    Histogram h;
+    if (!meter(views, count, &h)) {
+        st.errors++;
+        return false;
+    }
+    Settings s = update(h, exposure_ns, gain);
+
+    double now = (double) exposure_ns * gain;
+    double next = (double) s.exposure_ns * s.gain;
+    bool gamma_change = fabsf(s.gamma - sent.gamma) >= MIN_GAMMA_CHANGE;
+    // also the same total split otherwise, as for a new flicker_hz
+    bool exposure_change = fabs(log2(next / now)) >= cfg.min_change_ev ||
+                           fabs(log2((double) s.exposure_ns / exposure_ns)) >= cfg.min_change_ev;
+    if (!exposure_change && !gamma_change) {
+        st.small_changes++;
+        return false;
+    }
+
+    if (camera != NULL && exposure_change) {
+        int32_t res = QVRCameraDevice_SetExposureAndGain(camera, s.exposure_ns, (int) s.gain);
+        if (res != QVR_CAM_SUCCESS) {
+            __log_func(ANDROID_LOG_WARN, TAG, "SetExposureAndGain(%llu ns, %u) failed: %d",
+                       (unsigned long long) s.exposure_ns, s.gain, res);
+            st.errors++;
+            return false;
+        }
+    }
+    if (camera != NULL && gamma_change && QVRCameraDevice_SetGammaCorrectionValue(camera, s.gamma) != QVR_CAM_SUCCESS) {
+        // the exposure went out regardless
+        st.errors++;
+        s.gamma = sent.gamma;
+    }
+    if (!exposure_change) {
+        s.exposure_ns = exposure_ns;
+        s.gain = gain;
+    }
+    st.updates++;
+    sent = s;
+    have_sent = true;
+    settling = exposure_change;
+    settle_count = 0;
+    return true;
+}
+
+bool AutoExposure::process(const FrameViews& views, const qvrcamera_frame_t& frame)
+{
+    ImageView v[FrameViews::MAX_VIEWS];
+    for (int i = 0; i < views.count(); i++)
+        v[i] = views.view(i);
+    return process(v, views.count(), frame.exposure, frame.gain);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "camera/frame_views.h"
+
+// Client side auto exposure through SetExposureAndGain(), for cameras whose
+// own QVR_CAMDEVICE_UINT8_AUTO_EXPOSURE is off or not good enough for
+// tracking. Every frame it meters a grid of samples in a region of the luma
+// into a histogram, runs a PI controller on the brightness error in stops
+// against the exposure x gain the frame reports, and splits the result into
+// an exposure of whole flicker periods (where it is that long) and gain.
+// Settings only go to the camera when they change by min_change_ev, and not
+// again before frames show them. Scenes too dark for max exposure and gain
+// get gamma up to max_gamma.
+//
+// The histogram kernel picks every step_x-th pixel with NEON/SSE2 loads
+// for steps of 1, 2 and 4 and sums them in vector registers; the bins are
+// counted into four interleaved sub-histograms, as neither has a scatter.
+// The scalar kernel gives the same histogram.
+class AutoExposure {
+public:
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SIMD,
+    };
+
+    static const int BINS = 256;
+
+    struct Config {
+        // metering region in fractions of each image, sampled at every
+        // step_x-th pixel of every step_y-th row
+        float roi_left = 0.0f;
+        float roi_top = 0.0f;
+        float roi_right = 1.0f;
+        float roi_bottom = 1.0f;
+        uint32_t step_x = 4;
+        uint32_t step_y = 4;
+        // mean luma wanted, before gamma
+        float target = 110.0f;
+        // more than clip_fraction of the samples at clip_level or above
+        // brings exposure down whatever the mean says
+        float clip_fraction = 0.02f;
+        uint32_t clip_level = 250;
+        // PI gains on the error in stops; errors within deadband_ev count
+        // as none
+        float kp = 0.9f;
+        float ki = 0.1f;
+        float deadband_ev = 0.1f;
+        float max_integral_ev = 2.0f;
+        // settings closer than this to the last ones stay unsent
+        float min_change_ev = 0.1f;
+        uint64_t min_exposure_ns = 50000;
+        // also no longer than a frame at the camera's max rate
+        uint64_t max_exposure_ns = 15000000;
+        // ISO gain, 100 is 1x
+        uint32_t min_gain = 100;
+        uint32_t max_gain = 1600;
+        // light flicker, twice the mains frequency (100 or 120 Hz); 0 off
+        uint32_t flicker_hz = 100;
+        // 1 leaves gamma alone
+        float max_gamma = 1.0f;
+        // frames to wait for new settings to show in the frames, which
+        // SetExposureAndGain() gives up to 6
+        uint32_t settle_frames = 6;
+    };
+
+    struct Histogram {
+        uint32_t bins[BINS];
+        uint32_t count;
+        uint64_t sum;
+
+        float mean() const { return count ? (float) sum / count : 0.0f; }
+        // smallest value with at least fraction p of the samples at or below
+        uint32_t percentile(float p) const;
+    };
+
+    struct Settings {
+        uint64_t exposure_ns;
+        uint32_t gain;
+        float gamma;
+    };
+
+    struct Stats {
+        uint64_t frames;
+        // SetExposureAndGain() or gamma calls made
+        uint64_t updates;
+        // frames whose settings were too close to the last ones to send
+        uint64_t small_changes;
+        // frames skipped while new settings were on their way
+        uint64_t settling;
+        uint64_t errors;
+        // of the last metered frame
+        float brightness;
+        float error_ev;
+    };
+
+    AutoExposure();
+    explicit AutoExposure(const Config& config);
+
+    void set_config(const Config& config);
+    const Config& config() const { return cfg; }
+
+    // KERNEL_SIMD falls back to scalar when the build has no vector unit
+    void set_kernel(Kernel k) { kernel = k; }
+    Kernel active_kernel() const;
+    static bool simd_available();
+
+    // The camera whose exposure process() drives; its max frame rate caps
+    // the exposure. QVR_CAM_SUCCESS or a QVR_CAM_* error.
+    int32_t attach(qvrcamera_device_helper_t* cam);
+    void detach() { camera = NULL; }
+
+    // Meters one frame (Y8 or YUV420 views, the luma) taken with exposure_ns
+    // and gain as the frame reports them, and sends new settings when due.
+    // True when it sent some.
+    bool process(const ImageView* views, int count, uint64_t exposure_ns, uint32_t gain);
+    // process() of a frame's views
+    bool process(const FrameViews& views, const qvrcamera_frame_t& frame);
+
+    // the region of views into out; false for formats other than Y8/YUV420
+    bool meter(const ImageView* views, int count, Histogram* out) const;
+    // Controller step for a frame metered into h: the settings to go to.
+    // Updates the integral, so once per frame.
+    Settings update(const Histogram& h, uint64_t exposure_ns, uint32_t gain);
+    // total exposure (ns at 1x gain) as exposure and gain
+    Settings split(double total_ns) const;
+
+    // last sent
+    const Settings& settings() const { return sent; }
+    const Stats& stats() const { return st; }
+    // forgets the integral and the last settings
+    void reset();
+
+private:
+    void meter_rows(const ImageView& v, uint32_t* bins, uint64_t* sum, uint32_t* count) const;
+
+    Config cfg;
+    Kernel kernel;
+    qvrcamera_device_helper_t* camera;
+    uint64_t exposure_cap_ns;
+    float integral_ev;
+    Settings sent;
+    bool have_sent;
+    // frames seen since settings went out, which don't show them yet
+    bool settling;
+    uint32_t settle_count;
+    Stats st;
+};
@@ -0,0 +1,464 @@
+#include "camera/camera_pipeline.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+#include "holder_log.h"
+#include "time_util.h"
+
+#define DEFAULT_RATE_HZ 30
+// how long close() waits for outstanding handles before it complains
+#define CLOSE_WARN_NS 1000000000LL
+// retry interval while somebody else hasn't started the camera yet
+#define NOT_STARTED_RETRY_US 10000
+
+struct CameraPipeline::Device {
+    int index;
+    std::string name;
+    Config cfg;
+    qvrcamera_device_helper_t* cam;
+    qvrsync_ctrl_t* sync_ctrl;
+    bool started_camera;
+    int64_t period_ns;
+    std::unique_ptr<Slot[]> slots;
+    std::vector<FrameCallback> consumers;
+
+    // acquisition thread only
+    bool have_fn;
+    uint32_t last_fn;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    FrameHandle newest;
+    uint32_t held;
+    bool stopping;
+
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> early_reads;
+    std::atomic<uint64_t> stalls;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> deliveries;
+    std::atomic<int64_t> latency_sum_ns;
+    std::atomic<int64_t> latency_max_ns;
+
+    Device()
+        : index(0)
+        , cam(NULL)
+        , sync_ctrl(NULL)
+        , started_camera(false)
+        , period_ns(0)
+        , have_fn(false)
+        , last_fn(0)
+        , held(0)
+        , stopping(false)
+        , frames(0)
+        , dropped(0)
+        , early_reads(0)
+        , stalls(0)
+        , errors(0)
+        , deliveries(0)
+        , latency_sum_ns(0)
+        , latency_max_ns(0)
+    {
+    }
+};
+
+CameraPipeline::FrameHandle::FrameHandle(const FrameHandle& other)
+    : slot(other.slot)
+{
+    if (slot != NULL)
+        slot->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+CameraPipeline::FrameHandle& CameraPipeline::FrameHandle::operator=(const FrameHandle& other)
+{
+    if (other.slot != NULL)
+        other.slot->refs.fetch_add(1, std::memory_order_relaxed);
+    reset();
+    slot = other.slot;
+    return *this;
+}
+
+CameraPipeline::FrameHandle& CameraPipeline::FrameHandle::operator=(FrameHandle&& other)
+{
+    if (this != &other) {
+        reset();
+        slot = other.slot;
+        other.slot = NULL;
+    }
+    return *this;
+}
+
+void CameraPipeline::FrameHandle::reset()
+{
+    if (slot != NULL && slot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        CameraPipeline::release(slot);
+    slot = NULL;
+}
+
+int CameraPipeline::FrameHandle::device() const
+{
+    return slot->device->index;
+}
+
+// the max fps of "[width] [height] [min fps] [max fps] [fps hard limit]"
+uint32_t CameraPipeline::max_rate_hz(qvrcamera_device_helper_t* cam)
+{
+    char value[128];
+    uint32_t len = sizeof(value);
+    if (QVRCameraDevice_GetParam(cam, QVR_CAMDEVICE_STRING_RESOLUTION, &len, value) != QVR_CAM_SUCCESS)
+        return 0;
+    value[sizeof(value) - 1] = '\0';
+    float w, h, min_fps, max_fps;
+    if (sscanf(value, "%f %f %f %f", &w, &h, &min_fps, &max_fps) != 4 || max_fps < 1.0f)
+        return 0;
+    return (uint32_t) (max_fps + 0.5f);
+}
+
+CameraPipeline::CameraPipeline()
+    : num_devices(0)
+    , quitting(false)
+{
+}
+
+CameraPipeline::~CameraPipeline()
+{
+    close();
+}
+
+int CameraPipeline::attach(qvrcamera_client_helper_t* client, const char* name)
+{
+    return attach(client, name, Config());
+}
+
+int CameraPipeline::attach(qvrcamera_client_helper_t* client, const char* name, const Config& config)
+{
+    if (client == NULL || name == NULL || config.max_held < 2)
+        return QVR_CAM_INVALID_PARAM;
+    if (running() || num_devices == MAX_DEVICES)
+        return QVR_CAM_ERROR;
+
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    if (cam == NULL) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "attach to camera %s failed", name);
+        return QVR_CAM_ERROR;
+    }
+
+    Device* dev = new Device();
+    dev->index = num_devices;
+    dev->name = name;
+    dev->cfg = config;
+    dev->cam = cam;
+    dev->slots.reset(new Slot[config.max_held]);
+    for (uint32_t i = 0; i < config.max_held; i++) {
+        Slot& s = dev->slots[i];
+        memset(&s.frame, 0, sizeof(s.frame));
+        s.acquired_ns = 0;
+        s.device = dev;
+        s.refs.store(0);
+        s.busy = false;
+    }
+
+    uint32_t hz = config.rate_hz != 0 ? config.rate_hz : max_rate_hz(cam);
+    if (hz == 0)
+        hz = DEFAULT_RATE_HZ;
+    dev->period_ns = 1000000000LL / hz;
+
+    devices[num_devices].reset(dev);
+    __log_func(ANDROID_LOG_INFO, TAG, "camera %s attached as device %d, %u Hz", name, dev->index, hz);
+    return num_devices++;
+}
+
+void CameraPipeline::add_consumer(int device, FrameCallback cb)
+{
+    if (device >= 0 && device < num_devices && !running())
+        devices[device]->consumers.push_back(std::move(cb));
+}
+
+bool CameraPipeline::start()
+{
+    if (running() || num_devices == 0)
+        return false;
+
+    quitting.store(false);
+    for (int i = 0; i < num_devices; i++) {
+        Device* dev = devices[i].get();
+        {
+            std::lock_guard<std::mutex> l(dev->lock);
+            dev->stopping = false;
+        }
+        dev->have_fn = false;
+
+        QVRCAMERA_CAMERA_STATUS state = QVRCAMERA_CAMERA_ERROR;
+        QVRCameraDevice_GetCameraState(dev->cam, &state);
+        if (dev->cfg.start && state != QVRCAMERA_CAMERA_STARTED) {
+            int32_t res = QVRCameraDevice_Start(dev->cam);
+            if (res == QVR_CAM_SUCCESS)
+                dev->started_camera = true;
+            else
+                __log_func(ANDROID_LOG_WARN, TAG, "start camera %s failed (%d), waiting for its master",
+                           dev->name.c_str(), res);
+        }
+
+        if (dev->cfg.sync) {
+            dev->sync_ctrl = QVRCameraDevice_GetSyncCtrl(dev->cam, QVR_SYNC_SOURCE_CAMERA_FRAME_CLIENT_READ);
+            if (dev->sync_ctrl == NULL)
+                __log_func(ANDROID_LOG_WARN, TAG, "no sync ctrl for camera %s, blocking reads",
+                           dev->name.c_str());
+        }
+
+        threads.emplace_back(&CameraPipeline::acquire_loop, this, dev);
+    }
+    return true;
+}
+
+void CameraPipeline::stop()
+{
+    if (!running())
+        return;
+
+    quitting.store(true);
+    for (int i = 0; i < num_devices; i++) {
+        std::lock_guard<std::mutex> l(devices[i]->lock);
+        devices[i]->stopping = true;
+        devices[i]->changed.notify_all();
+    }
+    for (std::thread& t : threads)
+        t.join();
+    threads.clear();
+
+    for (int i = 0; i < num_devices; i++) {
+        Device* dev = devices[i].get();
+        FrameHandle newest;
+        {
+            std::lock_guard<std::mutex> l(dev->lock);
+            newest = std::move(dev->newest);
+        }
+        newest.reset();
+
+        if (dev->sync_ctrl != NULL)
+            QVRCameraDevice_ReleaseSyncCtrl(dev->cam, dev->sync_ctrl);
+        dev->sync_ctrl = NULL;
+        if (dev->started_camera)
+            QVRCameraDevice_Stop(dev->cam);
+        dev->started_camera = false;
+    }
+}
+
+void CameraPipeline::close()
+{
+    stop();
+
+    for (int i = 0; i < num_devices; i++) {
+        Device* dev = devices[i].get();
+        std::unique_lock<std::mutex> l(dev->lock);
+        auto idle = [dev]() { return dev->held == 0; };
+        if (!dev->changed.wait_for(l, std::chrono::nanoseconds(CLOSE_WARN_NS), idle)) {
+            __log_func(ANDROID_LOG_ERROR, TAG, "camera %s: %u frames still held at close",
+                       dev->name.c_str(), dev->held);
+            dev->changed.wait(l, idle);
+        }
+        l.unlock();
+
+        QVRCameraDevice_DetachCamera(dev->cam);
+        devices[i].reset();
+    }
+    num_devices = 0;
+}
+
+const char* CameraPipeline::device_name(int device) const
+{
+    return device >= 0 && device < num_devices ? devices[device]->name.c_str() : NULL;
+}
+
+bool CameraPipeline::synced(int device) const
+{
+    return device >= 0 && device < num_devices && devices[device]->sync_ctrl != NULL;
+}
+
+qvrcamera_device_helper_t* CameraPipeline::camera(int device) const
+{
+    return device >= 0 && device < num_devices ? devices[device]->cam : NULL;
+}
+
+CameraPipeline::FrameHandle CameraPipeline::latest(int device)
+{
+    if (device < 0 || device >= num_devices)
+        return FrameHandle();
+    Device* dev = devices[device].get();
+    std::lock_guard<std::mutex> l(dev->lock);
+    return dev->newest;
+}
+
+CameraPipeline::FrameHandle CameraPipeline::wait(int device, uint32_t after_fn, int64_t timeout_ns)
+{
+    if (device < 0 || device >= num_devices)
+        return FrameHandle();
+
+    Device* dev = devices[device].get();
+    std::unique_lock<std::mutex> l(dev->lock);
+    auto ready = [dev, after_fn]() {
+        return dev->stopping || (dev->newest && (int32_t) (dev->newest.fn() - after_fn) > 0);
+    };
+    if (!dev->changed.wait_for(l, std::chrono::nanoseconds(timeout_ns), ready) || dev->stopping)
+        return FrameHandle();
+    FrameHandle h = dev->newest;
+    l.unlock();
+    note_delivery(dev, h);
+    return h;
+}
+
+CameraPipeline::Stats CameraPipeline::stats(int device) const
+{
+    Stats s;
+    memset(&s, 0, sizeof(s));
+    if (device < 0 || device >= num_devices)
+        return s;
+
+    const Device* dev = devices[device].get();
+    s.frames = dev->frames.load();
+    s.dropped = dev->dropped.load();
+    s.early_reads = dev->early_reads.load();
+    s.stalls = dev->stalls.load();
+    s.errors = dev->errors.load();
+    s.deliveries = dev->deliveries.load();
+    s.latency_sum_ns = dev->latency_sum_ns.load();
+    s.latency_max_ns = dev->latency_max_ns.load();
+    return s;
+}
+
+void CameraPipeline::release(Slot* slot)
+{
+    Device* dev = slot->device;
+    int32_t res = QVRCameraDevice_ReleaseFrame(dev->cam, (int32_t) slot->frame.fn);
+    if (res != QVR_CAM_SUCCESS)
+        __log_func(ANDROID_LOG_WARN, TAG, "camera %s: release of frame %u failed (%d)", dev->name.c_str(),
+                   slot->frame.fn, res);
+
+    std::lock_guard<std::mutex> l(dev->lock);
+    slot->busy = false;
+    dev->held--;
+    dev->changed.notify_all();
+}
+
+CameraPipeline::Slot* CameraPipeline::free_slot(Device* dev)
+{
+    std::lock_guard<std::mutex> l(dev->lock);
+    for (uint32_t i = 0; i < dev->cfg.max_held; i++) {
+        Slot* slot = &dev->slots[i];
+        if (!slot->busy) {
+            slot->busy = true;
+            dev->held++;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+void CameraPipeline::note_delivery(Device* dev, const FrameHandle& h)
+{
+    int64_t latency = now_ns() - h.acquired_ns();
+    dev->deliveries.fetch_add(1, std::memory_order_relaxed);
+    dev->latency_sum_ns.fetch_add(latency, std::memory_order_relaxed);
+    int64_t max = dev->latency_max_ns.load(std::memory_order_relaxed);
+    while (latency > max && !dev->latency_max_ns.compare_exchange_weak(max, latency)) {
+    }
+}
+
+void CameraPipeline::deliver(Device* dev, Slot* slot)
+{
+    slot->refs.store(1, std::memory_order_relaxed);
+    FrameHandle h(slot);
+    for (const FrameCallback& cb : dev->consumers) {
+        note_delivery(dev, h);
+        cb(h);
+    }
+
+    FrameHandle previous;
+    {
+        std::lock_guard<std::mutex> l(dev->lock);
+        previous = std::move(dev->newest);
+        dev->newest = std::move(h);
+        dev->changed.notify_all();
+    }
+    // a ReleaseFrame() outside the lock
+    previous.reset();
+}
+
+// true when a frame was delivered
+bool CameraPipeline::acquire_one(Device* dev, Slot* slot)
+{
+    QVRCAMERA_BLOCK_MODE block = dev->sync_ctrl != NULL ? QVRCAMERA_MODE_NON_BLOCKING_SYNC : QVRCAMERA_MODE_BLOCKING;
+    int32_t fn = dev->have_fn ? (int32_t) (dev->last_fn + 1) : 0;
+    int32_t want = fn;
+    int32_t res = QVRCameraDevice_GetFrame(dev->cam, &fn, block, QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &slot->frame);
+    if (res == QVR_CAM_FUTURE_FRAMENUMBER) {
+        // the frame is due about now; skipping to the next read would drop it
+        dev->early_reads.fetch_add(1, std::memory_order_relaxed);
+        fn = want;
+        res = QVRCameraDevice_GetFrame(dev->cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE,
+                                       &slot->frame);
+    }
+    int64_t now = now_ns();
+
+    if (res != QVR_CAM_SUCCESS) {
+        if (res == QVR_CAM_DEVICE_NOT_STARTED) {
+            usleep(NOT_STARTED_RETRY_US);
+        } else {
+            if (dev->errors.fetch_add(1, std::memory_order_relaxed) == 0)
+                __log_func(ANDROID_LOG_WARN, TAG, "camera %s: GetFrame failed (%d)", dev->name.c_str(), res);
+            // blocking reads would spin on a persistent error
+            if (block == QVRCAMERA_MODE_BLOCKING)
+                usleep((useconds_t) (dev->period_ns / 1000));
+        }
+        return false;
+    }
+
+    uint32_t got = slot->frame.fn;
+    if (dev->have_fn && got - dev->last_fn > 1 && got - dev->last_fn < 0x80000000u)
+        dev->dropped.fetch_add(got - dev->last_fn - 1, std::memory_order_relaxed);
+    dev->have_fn = true;
+    dev->last_fn = got;
+    dev->frames.fetch_add(1, std::memory_order_relaxed);
+
+    slot->acquired_ns = now;
+    deliver(dev, slot);
+    return true;
+}
+
+void CameraPipeline::acquire_loop(Device* dev)
+{
+    int64_t next = now_ns();
+    while (!quitting.load(std::memory_order_relaxed)) {
+        if (dev->sync_ctrl != NULL) {
+            // the sync framework wants reads at a steady cadence
+            next += dev->period_ns;
+            int64_t now = now_ns();
+            if (next < now - dev->period_ns)
+                next = now;
+            sleep_until_ns(next);
+        }
+
+        Slot* slot = free_slot(dev);
+        if (slot == NULL) {
+            dev->stalls.fetch_add(1, std::memory_order_relaxed);
+            if (dev->sync_ctrl == NULL) {
+                std::unique_lock<std::mutex> l(dev->lock);
+                dev->changed.wait_for(l, std::chrono::nanoseconds(dev->period_ns),
+                                      [dev]() { return dev->held < dev->cfg.max_held || dev->stopping; });
+            }
+            continue;
+        }
+
+        if (!acquire_one(dev, slot)) {
+            std::lock_guard<std::mutex> l(dev->lock);
+            slot->busy = false;
+            dev->held--;
+        }
+    }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "qvr/inc/QVRCameraClient.h"
+
+// Frame acquisition for up to QVRSERVICE_MAX_CAMERA_DEVICES cameras, one
+// thread per device. With a QVR_SYNC_SOURCE_CAMERA_FRAME_CLIENT_READ sync
+// ctrl the thread calls GetFrame(QVRCAMERA_MODE_NON_BLOCKING_SYNC) at the
+// camera rate, which is the cadence the service shifts the sensor timing to,
+// so frames complete just before they are read; a read that still comes
+// early blocks for that frame. Without a sync ctrl it blocks in
+// GetFrame(QVRCAMERA_MODE_BLOCKING) throughout.
+//
+// Frames reach consumers as refcounted FrameHandles. The buffer stays locked
+// while any handle to it exists and ReleaseFrame() runs when the last one
+// goes, on whichever thread drops it. A device only holds max_held frames at
+// once; while consumers keep all of them, the frames the camera produces
+// meanwhile are dropped.
+class CameraPipeline {
+    struct Device;
+
+    struct Slot {
+        qvrcamera_frame_t frame;
+        // MONOTONIC, when GetFrame returned
+        int64_t acquired_ns;
+        Device* device;
+        std::atomic<uint32_t> refs;
+        // locked in the service, until release() is done; under Device::lock
+        bool busy;
+    };
+
+public:
+    static const int MAX_DEVICES = QVRSERVICE_MAX_CAMERA_DEVICES;
+
+    class FrameHandle {
+    public:
+        FrameHandle() : slot(NULL) {}
+        FrameHandle(const FrameHandle& other);
+        FrameHandle(FrameHandle&& other) : slot(other.slot) { other.slot = NULL; }
+        FrameHandle& operator=(const FrameHandle& other);
+        FrameHandle& operator=(FrameHandle&& other);
+        ~FrameHandle() { reset(); }
+
+        explicit operator bool() const { return slot != NULL; }
+        void reset();
+
+        const qvrcamera_frame_t& frame() const { return slot->frame; }
+        const uint8_t* data() const { return (const uint8_t*) slot->frame.buffer; }
+        uint32_t fn() const { return slot->frame.fn; }
+        int64_t acquired_ns() const { return slot->acquired_ns; }
+        int device() const;
+
+    private:
+        friend class CameraPipeline;
+        // adopts a reference already counted in slot->refs
+        explicit FrameHandle(Slot* slot) : slot(slot) {}
+
+        Slot* slot;
+    };
+
+    // Runs on the device's acquisition thread, which doesn't call GetFrame
+    // again until it returns: keep a copy of the handle and do the work
+    // elsewhere.
+    typedef std::function<void(const FrameHandle&)> FrameCallback;
+
+    struct Config {
+        // GetFrame cadence when synced; 0 takes the max fps of
+        // QVR_CAMDEVICE_STRING_RESOLUTION
+        uint32_t rate_hz = 0;
+        bool sync = true;
+        // Start() the camera unless it already runs, and Stop() it again on stop()
+        bool start = true;
+        // frames locked at once, including the one kept for latest()
+        uint32_t max_held = 4;
+    };
+
+    struct Stats {
+        uint64_t frames;
+        // frame numbers skipped between two acquired frames
+        uint64_t dropped;
+        // synced reads that came before the next frame was complete and
+        // blocked for it
+        uint64_t early_reads;
+        // periods skipped because consumers held max_held frames
+        uint64_t stalls;
+        uint64_t errors;
+        // GetFrame returning to a callback or wait() getting the handle
+        uint64_t deliveries;
+        int64_t latency_sum_ns;
+        int64_t latency_max_ns;
+
+        double drop_rate() const { return frames + dropped ? (double) dropped / (frames + dropped) : 0.0; }
+        double mean_latency_ns() const { return deliveries ? (double) latency_sum_ns / deliveries : 0.0; }
+    };
+
+    CameraPipeline();
+    ~CameraPipeline();
+
+    CameraPipeline(const CameraPipeline&) = delete;
+    CameraPipeline& operator=(const CameraPipeline&) = delete;
+
+    // Attaches to the named camera (QVRSERVICE_CAMERA_NAME_*). Returns the
+    // device index, or a QVR_CAM_* error. Only while stopped.
+    int attach(qvrcamera_client_helper_t* client, const char* name);
+    int attach(qvrcamera_client_helper_t* client, const char* name, const Config& config);
+    // Callbacks are added before start()
+    void add_consumer(int device, FrameCallback cb);
+
+    // Starts the cameras, takes the sync ctrls and spawns the threads
+    bool start();
+    // Joins the threads and undoes start(); handles stay valid
+    void stop();
+    // stop() and detach every device, after waiting for the outstanding
+    // handles: none may outlive close()
+    void close();
+    bool running() const { return !threads.empty(); }
+
+    int device_count() const { return num_devices; }
+    const char* device_name(int device) const;
+    bool synced(int device) const;
+    qvrcamera_device_helper_t* camera(int device) const;
+
+    // newest frame of the device, empty before the first one
+    FrameHandle latest(int device);
+    // newest frame with a number above after_fn, waiting up to timeout_ns;
+    // empty on timeout or stop()
+    FrameHandle wait(int device, uint32_t after_fn, int64_t timeout_ns);
+
+    Stats stats(int device) const;
+
+    // max fps of QVR_CAMDEVICE_STRING_RESOLUTION, 0 when unknown
+    static uint32_t max_rate_hz(qvrcamera_device_helper_t* cam);
+
+private:
+    void acquire_loop(Device* dev);
+    bool acquire_one(Device* dev, Slot* slot);
+    Slot* free_slot(Device* dev);
+    void deliver(Device* dev, Slot* slot);
+    void note_delivery(Device* dev, const FrameHandle& h);
+    static void release(Slot* slot);
+
+    std::unique_ptr<Device> devices[MAX_DEVICES];
+    int num_devices;
+    std::atomic<bool> quitting;
+    std::vector<std::thread> threads;
+};
@@ -0,0 +1,439 @@
+#include "camera/camera_streams.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "camera/camera_pipeline.h"
+#include "holder_log.h"
+#include "time_util.h"
+
+#define DEFAULT_RATE_HZ 30
+// how long close() waits for outstanding handles before it complains
+#define CLOSE_WARN_NS 1000000000LL
+// due time of a stream whose consumers hold max_held frames, until one goes
+#define STALLED_NS LLONG_MAX
+
+struct CameraStreams::Stream {
+    CameraStreams* owner;
+    Resolution res;
+    qvrcamera_stream_handle_t handle;
+    std::unique_ptr<Slot[]> slots;
+    std::vector<FrameCallback> consumers;
+
+    // the worker that claimed the stream only
+    bool have_fn;
+    uint32_t last_fn;
+    // a poll found the next frame missing since the last one
+    bool waited;
+
+    // under CameraStreams::lock
+    bool started;
+    bool claimed;
+    int64_t due_ns;
+    uint32_t held;
+
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> early_polls;
+    std::atomic<uint64_t> stalls;
+    std::atomic<uint64_t> errors;
+
+    Stream()
+        : owner(NULL)
+        , res(RES_FULL)
+        , handle(NULL)
+        , have_fn(false)
+        , last_fn(0)
+        , waited(false)
+        , started(false)
+        , claimed(false)
+        , due_ns(0)
+        , held(0)
+        , frames(0)
+        , dropped(0)
+        , early_polls(0)
+        , stalls(0)
+        , errors(0)
+    {
+    }
+};
+
+CameraStreams::FrameHandle::FrameHandle(const FrameHandle& other)
+    : slot(other.slot)
+{
+    if (slot != NULL)
+        slot->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+CameraStreams::FrameHandle& CameraStreams::FrameHandle::operator=(const FrameHandle& other)
+{
+    if (other.slot != NULL)
+        other.slot->refs.fetch_add(1, std::memory_order_relaxed);
+    reset();
+    slot = other.slot;
+    return *this;
+}
+
+CameraStreams::FrameHandle& CameraStreams::FrameHandle::operator=(FrameHandle&& other)
+{
+    if (this != &other) {
+        reset();
+        slot = other.slot;
+        other.slot = NULL;
+    }
+    return *this;
+}
+
+void CameraStreams::FrameHandle::reset()
+{
+    if (slot != NULL && slot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        CameraStreams::release(slot);
+    slot = NULL;
+}
+
+CameraStreams::Resolution CameraStreams::FrameHandle::resolution() const
+{
+    return slot->stream->res;
+}
+
+const char* CameraStreams::resolution_name(Resolution res)
+{
+    return res == RES_QUARTER ? QVR_CAMDEVICE_RESOLUTION_MODE_QUARTER : QVR_CAMDEVICE_RESOLUTION_MODE_FULL;
+}
+
+CameraStreams::CameraStreams()
+    : CameraStreams(Config())
+{
+}
+
+CameraStreams::CameraStreams(const Config& config)
+    : cfg(config)
+    , cam(NULL)
+    , period_ns(0)
+    , quitting(false)
+{
+}
+
+CameraStreams::~CameraStreams()
+{
+    close();
+}
+
+int32_t CameraStreams::attach(qvrcamera_client_helper_t* client, const char* camera_name)
+{
+    if (client == NULL || camera_name == NULL || cfg.max_held == 0)
+        return QVR_CAM_INVALID_PARAM;
+    if (cam != NULL || running())
+        return QVR_CAM_ERROR;
+
+    cam = QVRCameraClient_AttachCamera(client, camera_name);
+    if (cam == NULL) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "attach to camera %s failed", camera_name);
+        return QVR_CAM_ERROR;
+    }
+    name = camera_name;
+
+    char value[32];
+    uint32_t len = sizeof(value);
+    format.clear();
+    if (QVRCameraDevice_GetParam(cam, QVR_CAMDEVICE_STRING_FRAME_FORMAT, &len, value) == QVR_CAM_SUCCESS) {
+        value[sizeof(value) - 1] = '\0';
+        format = value;
+    }
+
+    uint32_t hz = cfg.rate_hz != 0 ? cfg.rate_hz : CameraPipeline::max_rate_hz(cam);
+    if (hz == 0)
+        hz = DEFAULT_RATE_HZ;
+    period_ns = 1000000000LL / hz;
+    return QVR_CAM_SUCCESS;
+}
+
+std::string CameraStreams::uri(Resolution res) const
+{
+    std::string s;
+    if (!format.empty())
+        s = "format=" + format + "&";
+    return s + "res=" + resolution_name(res);
+}
+
+bool CameraStreams::add_consumer(Resolution res, FrameCallback cb)
+{
+    if (cam == NULL || running() || res < 0 || res >= RES_COUNT)
+        return false;
+
+    if (streams[res] == nullptr) {
+        std::string u = uri(res);
+        qvrcamera_stream_handle_t h = QVRCameraDevice_CreateStream(cam, u.c_str());
+        if (h == NULL) {
+            __log_func(ANDROID_LOG_WARN, TAG, "camera %s: no stream %s", name.c_str(), u.c_str());
+            return false;
+        }
+
+        Stream* st = new Stream();
+        st->owner = this;
+        st->res = res;
+        st->handle = h;
+        st->slots.reset(new Slot[cfg.max_held]);
+        for (uint32_t i = 0; i < cfg.max_held; i++) {
+            Slot& s = st->slots[i];
+            memset(&s.frame, 0, sizeof(s.frame));
+            s.acquired_ns = 0;
+            s.stream = st;
+            s.refs.store(0);
+            s.busy = false;
+        }
+        streams[res].reset(st);
+    }
+    streams[res]->consumers.push_back(std::move(cb));
+    return true;
+}
+
+bool CameraStreams::frame_size(Resolution res, uint32_t* width, uint32_t* height) const
+{
+    if (cam == NULL || res < 0 || res >= RES_COUNT)
+        return false;
+    char value[128];
+    uint32_t len = sizeof(value);
+    const char* param = res == RES_QUARTER ? QVR_CAMDEVICE_STRING_QTR_RESOLUTION : QVR_CAMDEVICE_STRING_RESOLUTION;
+    if (QVRCameraDevice_GetParam(cam, param, &len, value) != QVR_CAM_SUCCESS)
+        return false;
+    value[sizeof(value) - 1] = '\0';
+    float w, h;
+    if (sscanf(value, "%f %f", &w, &h) != 2 || w < 1.0f || h < 1.0f)
+        return false;
+    *width = (uint32_t) w;
+    *height = (uint32_t) h;
+    return true;
+}
+
+bool CameraStreams::start()
+{
+    if (running() || cam == NULL)
+        return false;
+
+    int started = 0;
+    int64_t now = now_ns();
+    for (std::unique_ptr<Stream>& p : streams) {
+        Stream* st = p.get();
+        if (st == NULL)
+            continue;
+        st->have_fn = false;
+        st->waited = false;
+        int32_t res = QVRCameraStream_Start(st->handle);
+        if (res != QVR_CAM_SUCCESS) {
+            __log_func(ANDROID_LOG_WARN, TAG, "camera %s: start of stream %s failed (%d)", name.c_str(),
+                       resolution_name(st->res), res);
+            continue;
+        }
+        std::lock_guard<std::mutex> l(lock);
+        st->started = true;
+        st->due_ns = now;
+        started++;
+    }
+    if (started == 0)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        quitting = false;
+    }
+    uint32_t n = std::max(cfg.workers, 1u);
+    for (uint32_t i = 0; i < n; i++)
+        workers.emplace_back(&CameraStreams::worker_loop, this);
+    __log_func(ANDROID_LOG_INFO, TAG, "camera %s: %d streams on %u workers", name.c_str(), started, n);
+    return true;
+}
+
+void CameraStreams::stop()
+{
+    if (!running())
+        return;
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        quitting = true;
+        changed.notify_all();
+    }
+    for (std::thread& t : workers)
+        t.join();
+    workers.clear();
+
+    for (std::unique_ptr<Stream>& p : streams) {
+        Stream* st = p.get();
+        if (st == NULL)
+            continue;
+        bool started;
+        {
+            std::lock_guard<std::mutex> l(lock);
+            started = st->started;
+            st->started = false;
+        }
+        if (started)
+            QVRCameraStream_Stop(st->handle);
+    }
+}
+
+void CameraStreams::close()
+{
+    stop();
+
+    for (std::unique_ptr<Stream>& p : streams) {
+        Stream* st = p.get();
+        if (st == NULL)
+            continue;
+        std::unique_lock<std::mutex> l(lock);
+        auto idle = [st]() { return st->held == 0; };
+        if (!changed.wait_for(l, std::chrono::nanoseconds(CLOSE_WARN_NS), idle)) {
+            __log_func(ANDROID_LOG_ERROR, TAG, "camera %s: %u %s frames still held at close", name.c_str(),
+                       st->held, resolution_name(st->res));
+            changed.wait(l, idle);
+        }
+        l.unlock();
+
+        QVRCameraDevice_DestroyStream(cam, st->handle);
+        p.reset();
+    }
+
+    if (cam != NULL)
+        QVRCameraDevice_DetachCamera(cam);
+    cam = NULL;
+}
+
+CameraStreams::Stats CameraStreams::stats(Resolution res) const
+{
+    Stats s;
+    memset(&s, 0, sizeof(s));
+    if (res < 0 || res >= RES_COUNT || streams[res] == nullptr)
+        return s;
+
+    const Stream* st = streams[res].get();
+    s.frames = st->frames.load();
+    s.dropped = st->dropped.load();
+    s.early_polls = st->early_polls.load();
+    s.stalls = st->stalls.load();
+    s.errors = st->errors.load();
+    return s;
+}
+
+void CameraStreams::release(Slot* slot)
+{
+    Stream* st = slot->stream;
+    CameraStreams* owner = st->owner;
+    int32_t res = QVRCameraStream_ReleaseFrame(st->handle, (int32_t) slot->frame.fn);
+    if (res != QVR_CAM_SUCCESS)
+        __log_func(ANDROID_LOG_WARN, TAG, "camera %s: release of %s frame %u failed (%d)", owner->name.c_str(),
+                   resolution_name(st->res), slot->frame.fn, res);
+
+    std::lock_guard<std::mutex> l(owner->lock);
+    slot->busy = false;
+    st->held--;
+    if (st->due_ns == STALLED_NS && !st->claimed)
+        st->due_ns = now_ns();
+    owner->changed.notify_all();
+}
+
+CameraStreams::Slot* CameraStreams::free_slot(Stream* st)
+{
+    std::lock_guard<std::mutex> l(lock);
+    for (uint32_t i = 0; i < cfg.max_held; i++) {
+        Slot* slot = &st->slots[i];
+        if (!slot->busy) {
+            slot->busy = true;
+            st->held++;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+void CameraStreams::deliver(Stream* st, Slot* slot)
+{
+    slot->refs.store(1, std::memory_order_relaxed);
+    FrameHandle h(slot);
+    for (const FrameCallback& cb : st->consumers)
+        cb(h);
+    // ReleaseFrame() unless a consumer kept a copy
+}
+
+int64_t CameraStreams::poll(Stream* st)
+{
+    Slot* slot = free_slot(st);
+    if (slot == NULL) {
+        st->stalls.fetch_add(1, std::memory_order_relaxed);
+        return STALLED_NS;
+    }
+
+    int32_t fn = st->have_fn ? (int32_t) (st->last_fn + 1) : 0;
+    int32_t res = QVRCameraStream_GetFrame(st->handle, &fn, QVRCAMERA_MODE_NON_BLOCKING,
+                                           QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &slot->frame);
+    int64_t now = now_ns();
+
+    if (res != QVR_CAM_SUCCESS) {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            slot->busy = false;
+            st->held--;
+        }
+        if (res == QVR_CAM_FUTURE_FRAMENUMBER) {
+            st->early_polls.fetch_add(1, std::memory_order_relaxed);
+            st->waited = true;
+            return now + cfg.poll_us * 1000LL;
+        }
+        if (res != QVR_CAM_DEVICE_NOT_STARTED && st->errors.fetch_add(1, std::memory_order_relaxed) == 0)
+            __log_func(ANDROID_LOG_WARN, TAG, "camera %s: GetFrame of stream %s failed (%d)", name.c_str(),
+                       resolution_name(st->res), res);
+        return now + period_ns;
+    }
+
+    uint32_t got = slot->frame.fn;
+    if (st->have_fn && got - st->last_fn > 1 && got - st->last_fn < 0x80000000u)
+        st->dropped.fetch_add(got - st->last_fn - 1, std::memory_order_relaxed);
+    st->have_fn = true;
+    st->last_fn = got;
+    st->frames.fetch_add(1, std::memory_order_relaxed);
+
+    // a frame there at the first poll may have waited for a while: come a
+    // quarter period earlier until polls find the next one missing again
+    int64_t lead = st->waited ? 2LL * cfg.poll_us * 1000 : period_ns / 4;
+    st->waited = false;
+
+    slot->acquired_ns = now;
+    deliver(st, slot);
+    return now + period_ns - lead;
+}
+
+void CameraStreams::worker_loop()
+{
+    std::unique_lock<std::mutex> l(lock);
+    while (!quitting) {
+        Stream* next = NULL;
+        for (std::unique_ptr<Stream>& p : streams) {
+            Stream* st = p.get();
+            if (st != NULL && st->started && !st->claimed && st->due_ns != STALLED_NS &&
+                (next == NULL || st->due_ns < next->due_ns))
+                next = st;
+        }
+        if (next == NULL) {
+            changed.wait(l);
+            continue;
+        }
+        int64_t now = now_ns();
+        if (next->due_ns > now) {
+            changed.wait_for(l, std::chrono::nanoseconds(next->due_ns - now));
+            continue;
+        }
+
+        next->claimed = true;
+        l.unlock();
+        int64_t due = poll(next);
+        l.lock();
+        next->claimed = false;
+        // a stalled stream waits for release(), unless that came meanwhile
+        next->due_ns = due == STALLED_NS && next->held < cfg.max_held ? now_ns() : due;
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "qvr/inc/beta/QVRCameraStream.h"
+
+// One camera at several resolutions through the beta QVRCameraStream API,
+// so consumers of small frames get them from the camera instead of
+// downscaling whole ones. Every resolution a consumer asks for gets a
+// stream of the camera's format, and a pool of worker threads, which may be
+// fewer than the streams, reads them all: a stream is due when its next
+// frame should be complete, and the first free worker takes the stream due
+// soonest and polls it with non-blocking GetFrame() until the frame is
+// there, then runs the callbacks of that stream. Blocking reads would tie a
+// worker to every stream.
+//
+// Frames reach consumers as refcounted FrameHandles, as with
+// CameraPipeline. A stream locks at most max_held frames at once; while its
+// consumers keep all of them, the frames it produces meanwhile are dropped.
+class CameraStreams {
+    struct Stream;
+
+    struct Slot {
+        qvrcamera_frame_t frame;
+        // MONOTONIC, when GetFrame returned
+        int64_t acquired_ns;
+        Stream* stream;
+        std::atomic<uint32_t> refs;
+        // locked in the service, until release() is done; under lock
+        bool busy;
+    };
+
+public:
+    enum Resolution {
+        RES_FULL,
+        RES_QUARTER,
+        RES_COUNT
+    };
+
+    class FrameHandle {
+    public:
+        FrameHandle() : slot(NULL) {}
+        FrameHandle(const FrameHandle& other);
+        FrameHandle(FrameHandle&& other) : slot(other.slot) { other.slot = NULL; }
+        FrameHandle& operator=(const FrameHandle& other);
+        FrameHandle& operator=(FrameHandle&& other);
+        ~FrameHandle() { reset(); }
+
+        explicit operator bool() const { return slot != NULL; }
+        void reset();
+
+        const qvrcamera_frame_t& frame() const { return slot->frame; }
+        const uint8_t* data() const { return (const uint8_t*) slot->frame.buffer; }
+        uint32_t fn() const { return slot->frame.fn; }
+        int64_t acquired_ns() const { return slot->acquired_ns; }
+        Resolution resolution() const;
+
+    private:
+        friend class CameraStreams;
+        // adopts a reference already counted in slot->refs
+        explicit FrameHandle(Slot* slot) : slot(slot) {}
+
+        Slot* slot;
+    };
+
+    // Runs on a worker, which serves no other stream until it returns: keep
+    // a copy of the handle and do the work elsewhere.
+    typedef std::function<void(const FrameHandle&)> FrameCallback;
+
+    struct Config {
+        // threads reading all the streams
+        uint32_t workers = 2;
+        // frames locked at once per stream
+        uint32_t max_held = 3;
+        // 0 takes the max fps of QVR_CAMDEVICE_STRING_RESOLUTION
+        uint32_t rate_hz = 0;
+        // GetFrame() interval while a due frame isn't there yet
+        uint32_t poll_us = 500;
+    };
+
+    struct Stats {
+        uint64_t frames;
+        // frame numbers skipped between two frames
+        uint64_t dropped;
+        // GetFrame() calls before the frame was complete
+        uint64_t early_polls;
+        // frames due while consumers held max_held frames
+        uint64_t stalls;
+        uint64_t errors;
+
+        double drop_rate() const { return frames + dropped ? (double) dropped / (frames + dropped) : 0.0; }
+    };
+
+    CameraStreams();
+    explicit CameraStreams(const Config& config);
+    ~CameraStreams();
+
+    CameraStreams(const CameraStreams&) = delete;
+    CameraStreams& operator=(const CameraStreams&) = delete;
+
+    // Attaches to the named camera (QVRSERVICE_CAMERA_NAME_*). QVR_CAM_SUCCESS
+    // or a QVR_CAM_* error. Once, while stopped.
+    int32_t attach(qvrcamera_client_helper_t* client, const char* name);
+    // Callbacks are added before start(); the first one of a resolution
+    // creates its stream. False when the camera has no such stream.
+    bool add_consumer(Resolution res, FrameCallback cb);
+
+    // Starts the streams, which start the camera unless it already runs,
+    // and spawns the workers. False when no stream started.
+    bool start();
+    // Joins the workers and stops the streams; handles stay valid
+    void stop();
+    // stop(), then destroys the streams and detaches the camera after
+    // waiting for the outstanding handles: none may outlive close()
+    void close();
+    bool running() const { return !workers.empty(); }
+
+    qvrcamera_device_helper_t* camera() const { return cam; }
+    bool has_stream(Resolution res) const { return streams[res] != nullptr; }
+    // frame size of the stream, from QVR_CAMDEVICE_STRING_(QTR_)RESOLUTION
+    bool frame_size(Resolution res, uint32_t* width, uint32_t* height) const;
+
+    Stats stats(Resolution res) const;
+
+    // "format=..&res=.." for the camera's format at res
+    std::string uri(Resolution res) const;
+    static const char* resolution_name(Resolution res);
+
+private:
+    void worker_loop();
+    // reads the stream once; when it is due again
+    int64_t poll(Stream* st);
+    Slot* free_slot(Stream* st);
+    void deliver(Stream* st, Slot* slot);
+    static void release(Slot* slot);
+
+    Config cfg;
+    qvrcamera_device_helper_t* cam;
+    std::string name;
+    std::string format;
+    int64_t period_ns;
+    std::unique_ptr<Stream> streams[RES_COUNT];
+
+    std::mutex lock;
+    std::condition_variable changed;
+    bool quitting;
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,461 @@
+#include "camera/depth_ops.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "simd.h"
+
+// band_points entry of rows that don't start a band
+#define NO_BAND 0xffffffffu
+
+static inline void sort2(uint16_t& a, uint16_t& b)
+{
+    uint16_t lo = std::min(a, b);
+    b = std::max(a, b);
+    a = lo;
+}
+
+static inline uint16_t median3(uint16_t a, uint16_t b, uint16_t c)
+{
+    return std::max(std::min(a, b), std::min(std::max(a, b), c));
+}
+
+// the median network of N. Devillard, "Fast median search"
+static inline uint16_t median5(uint16_t a, uint16_t b, uint16_t c, uint16_t d, uint16_t e)
+{
+    sort2(a, b);
+    sort2(d, e);
+    sort2(a, d);
+    sort2(b, e);
+    sort2(b, c);
+    sort2(c, d);
+    sort2(b, c);
+    return c;
+}
+
+static uint32_t project_row_scalar(const uint16_t* depth, const float* rx, const float* ry, uint32_t x, uint32_t w,
+                                   uint32_t id0, float lo, float hi, float scale, XrMapPointQTI* out)
+{
+    uint32_t n = 0;
+    for (; x < w; x++) {
+        float z = (float) depth[x];
+        float px = z * rx[x];
+        // NaN rays fail px == px
+        if (z >= lo && z <= hi && px == px) {
+            out[n].position.x = px;
+            out[n].position.y = z * ry[x];
+            out[n].position.z = z * scale;
+            out[n].id = id0 + x;
+            n++;
+        }
+    }
+    return n;
+}
+
+static void median_row_scalar(const uint16_t* const* rows, uint32_t frames, uint32_t x, uint32_t w, uint16_t* out)
+{
+    if (frames == 5) {
+        for (; x < w; x++)
+            out[x] = median5(rows[0][x], rows[1][x], rows[2][x], rows[3][x], rows[4][x]);
+    } else {
+        for (; x < w; x++)
+            out[x] = median3(rows[0][x], rows[1][x], rows[2][x]);
+    }
+}
+
+#if defined(HOLDER_HAVE_SIMD)
+
+// The vector loops below return how far they got; the scalar loops finish
+// the row.
+
+// Four pixels at a time: points for all four go out, each at the slot after
+// the last valid one, so the invalid ones are overwritten
+static uint32_t project_row_simd(const uint16_t* depth, const float* rx, const float* ry, uint32_t w, uint32_t id0,
+                                 float lo, float hi, float scale, XrMapPointQTI* out, uint32_t* count)
+{
+    uint32_t n = 0;
+    uint32_t x = 0;
+    float* o = (float*) out;
+#if defined(HOLDER_SIMD_NEON)
+    float32x4_t vlo = vdupq_n_f32(lo);
+    float32x4_t vhi = vdupq_n_f32(hi);
+    float32x4_t vscale = vdupq_n_f32(scale);
+    const uint32_t lanes[4] = { 0, 1, 2, 3 };
+    uint32x4_t idx = vld1q_u32(lanes);
+    for (; x + 4 <= w; x += 4) {
+        float32x4_t z = vcvtq_f32_u32(vmovl_u16(vld1_u16(depth + x)));
+        float32x4_t px = vmulq_f32(z, vld1q_f32(rx + x));
+        float32x4_t py = vmulq_f32(z, vld1q_f32(ry + x));
+        float32x4_t pz = vmulq_f32(z, vscale);
+        uint32x4_t ok = vandq_u32(vandq_u32(vcgeq_f32(z, vlo), vcleq_f32(z, vhi)), vceqq_f32(px, px));
+        uint32_t m0 = vgetq_lane_u32(ok, 0) & 1, m1 = vgetq_lane_u32(ok, 1) & 1;
+        uint32_t m2 = vgetq_lane_u32(ok, 2) & 1, m3 = vgetq_lane_u32(ok, 3) & 1;
+        if ((m0 | m1 | m2 | m3) == 0)
+            continue;
+        float32x4_t id = vreinterpretq_f32_u32(vaddq_u32(vdupq_n_u32(id0 + x), idx));
+        // x y z id of every pixel
+        float32x4x2_t xz = vzipq_f32(px, pz);
+        float32x4x2_t yi = vzipq_f32(py, id);
+        float32x4x2_t p01 = vzipq_f32(xz.val[0], yi.val[0]);
+        float32x4x2_t p23 = vzipq_f32(xz.val[1], yi.val[1]);
+        vst1q_f32(o + 4 * n, p01.val[0]);
+        n += m0;
+        vst1q_f32(o + 4 * n, p01.val[1]);
+        n += m1;
+        vst1q_f32(o + 4 * n, p23.val[0]);
+        n += m2;
+        vst1q_f32(o + 4 * n, p23.val[1]);
+        n += m3;
+    }
+#else
+    __m128 vlo = _mm_set1_ps(lo);
+    __m128 vhi = _mm_set1_ps(hi);
+    __m128 vscale = _mm_set1_ps(scale);
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i zero = _mm_setzero_si128();
+    for (; x + 4 <= w; x += 4) {
+        __m128i d = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*) (depth + x)), zero);
+        __m128 z = _mm_cvtepi32_ps(d);
+        __m128 px = _mm_mul_ps(z, _mm_loadu_ps(rx + x));
+        __m128 py = _mm_mul_ps(z, _mm_loadu_ps(ry + x));
+        __m128 pz = _mm_mul_ps(z, vscale);
+        __m128 ok = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(z, vlo), _mm_cmple_ps(z, vhi)), _mm_cmpord_ps(px, px));
+        int mask = _mm_movemask_ps(ok);
+        if (mask == 0)
+            continue;
+        __m128 id = _mm_castsi128_ps(_mm_add_epi32(_mm_set1_epi32((int) (id0 + x)), idx));
+        // x y z id of every pixel
+        __m128 t0 = _mm_unpacklo_ps(px, py);
+        __m128 t1 = _mm_unpacklo_ps(pz, id);
+        __m128 t2 = _mm_unpackhi_ps(px, py);
+        __m128 t3 = _mm_unpackhi_ps(pz, id);
+        _mm_storeu_ps(o + 4 * n, _mm_movelh_ps(t0, t1));
+        n += mask & 1;
+        _mm_storeu_ps(o + 4 * n, _mm_movehl_ps(t1, t0));
+        n += (mask >> 1) & 1;
+        _mm_storeu_ps(o + 4 * n, _mm_movelh_ps(t2, t3));
+        n += (mask >> 2) & 1;
+        _mm_storeu_ps(o + 4 * n, _mm_movehl_ps(t3, t2));
+        n += (mask >> 3) & 1;
+    }
+#endif
+    *count = n;
+    return x;
+}
+
+// SSE2 has no unsigned 16 bit min/max: the values go through with the sign
+// bit flipped
+#if defined(HOLDER_SIMD_NEON)
+typedef uint16x8_t u16x8;
+static inline u16x8 load8(const uint16_t* p) { return vld1q_u16(p); }
+static inline void store8(uint16_t* p, u16x8 v) { vst1q_u16(p, v); }
+static inline u16x8 min8(u16x8 a, u16x8 b) { return vminq_u16(a, b); }
+static inline u16x8 max8(u16x8 a, u16x8 b) { return vmaxq_u16(a, b); }
+#else
+typedef __m128i u16x8;
+static inline u16x8 load8(const uint16_t* p)
+{
+    return _mm_xor_si128(_mm_loadu_si128((const __m128i*) p), _mm_set1_epi16((short) 0x8000));
+}
+static inline void store8(uint16_t* p, u16x8 v)
+{
+    _mm_storeu_si128((__m128i*) p, _mm_xor_si128(v, _mm_set1_epi16((short) 0x8000)));
+}
+static inline u16x8 min8(u16x8 a, u16x8 b) { return _mm_min_epi16(a, b); }
+static inline u16x8 max8(u16x8 a, u16x8 b) { return _mm_max_epi16(a, b); }
+#endif
+
+static inline void sort2(u16x8& a, u16x8& b)
+{
+    u16x8 lo = min8(a, b);
+    b = max8(a, b);
+    a = lo;
+}
+
+static uint32_t median_row_simd(const uint16_t* const* rows, uint32_t frames, uint32_t w, uint16_t* out)
+{
+    uint32_t x = 0;
+    if (frames == 5) {
+        for (; x + 8 <= w; x += 8) {
+            u16x8 a = load8(rows[0] + x), b = load8(rows[1] + x), c = load8(rows[2] + x);
+            u16x8 d = load8(rows[3] + x), e = load8(rows[4] + x);
+            sort2(a, b);
+            sort2(d, e);
+            sort2(a, d);
+            sort2(b, e);
+            sort2(b, c);
+            sort2(c, d);
+            sort2(b, c);
+            store8(out + x, c);
+        }
+    } else {
+        for (; x + 8 <= w; x += 8) {
+            u16x8 a = load8(rows[0] + x), b = load8(rows[1] + x), c = load8(rows[2] + x);
+            store8(out + x, max8(min8(a, b), min8(max8(a, b), c)));
+        }
+    }
+    return x;
+}
+
+#endif
+
+DepthOps::DepthOps()
+    : DepthOps(1)
+{
+}
+
+DepthOps::DepthOps(int threads)
+    : DepthOps(threads, Config())
+{
+}
+
+DepthOps::DepthOps(int threads, const Config& config)
+    : cfg(config)
+    , kernel(KERNEL_SIMD)
+    , history_count(0)
+    , history_next(0)
+    , history_width(0)
+    , history_height(0)
+    , pool(threads)
+{
+    build_tables();
+}
+
+bool DepthOps::simd_available()
+{
+#if defined(HOLDER_HAVE_SIMD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+DepthOps::Kernel DepthOps::active_kernel() const
+{
+    return kernel == KERNEL_SIMD && simd_available() ? KERNEL_SIMD : KERNEL_SCALAR;
+}
+
+size_t DepthOps::cloud_size(uint32_t max_points)
+{
+    return sizeof(XrPointCloudQTI) + (size_t) max_points * sizeof(XrMapPointQTI);
+}
+
+void DepthOps::set_config(const Config& config)
+{
+    bool rays = config.depth_scale != cfg.depth_scale;
+    cfg = config;
+    build_tables();
+    if (rays && lens_model.valid())
+        set_lens(lens_model);
+    reset_history();
+}
+
+void DepthOps::build_tables()
+{
+    int r = (int) cfg.fill_radius;
+    float ss = std::max(cfg.fill_sigma_space, 0.1f);
+    float sr = std::max(cfg.fill_sigma_range, 0.1f);
+    space_weights.resize((size_t) (2 * r + 1) * (2 * r + 1));
+    for (int dy = -r; dy <= r; dy++) {
+        for (int dx = -r; dx <= r; dx++)
+            space_weights[(dy + r) * (2 * r + 1) + dx + r] = expf(-(float) (dx * dx + dy * dy) / (2.0f * ss * ss));
+    }
+    // depths more than 3 sigma behind the nearest don't count
+    range_weights.resize((size_t) ceilf(3.0f * sr) + 1);
+    for (size_t d = 0; d < range_weights.size(); d++)
+        range_weights[d] = expf(-(float) (d * d) / (2.0f * sr * sr));
+}
+
+bool DepthOps::set_lens(const LensModel& lens)
+{
+    if (!lens.valid())
+        return false;
+    lens_model = lens;
+    uint32_t w = lens.width(), h = lens.height();
+    ray_x.resize((size_t) w * h);
+    ray_y.resize((size_t) w * h);
+    float scale = cfg.depth_scale;
+    pool.run(h, [&](uint32_t first, uint32_t end) {
+        for (uint32_t y = first; y < end; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                double nx, ny;
+                size_t i = (size_t) y * w + x;
+                if (lens.unproject(x, y, &nx, &ny)) {
+                    ray_x[i] = (float) (nx * scale);
+                    ray_y[i] = (float) (ny * scale);
+                } else {
+                    ray_x[i] = NAN;
+                    ray_y[i] = NAN;
+                }
+            }
+        }
+    });
+    return true;
+}
+
+bool DepthOps::check_view(const ImageView& v) const
+{
+    return v.data != NULL && v.format == QVRCAMERA_FRAME_FORMAT_DEPTH16 && v.width > 0 && v.height > 0 &&
+           v.pitch >= v.width * 2;
+}
+
+bool DepthOps::back_project(const ImageView& depth, XrPointCloudQTI* cloud)
+{
+    uint32_t w = lens_model.width(), h = lens_model.height();
+    if (!check_view(depth) || depth.width != w || depth.height != h || cloud == NULL ||
+        cloud->maxPoints < w * h)
+        return false;
+
+    // every band writes from the start of its rows' share of the points,
+    // then the bands move together
+    band_points.assign(h, NO_BAND);
+    bool simd = active_kernel() == KERNEL_SIMD;
+    float lo = (float) cfg.min_depth, hi = (float) cfg.max_depth, scale = cfg.depth_scale;
+    pool.run(h, [&](uint32_t first, uint32_t end) {
+        XrMapPointQTI* out = cloud->points + (size_t) first * w;
+        uint32_t n = 0;
+        for (uint32_t y = first; y < end; y++) {
+            const uint16_t* row = (const uint16_t*) (depth.data + (size_t) y * depth.pitch);
+            const float* rx = &ray_x[(size_t) y * w];
+            const float* ry = &ray_y[(size_t) y * w];
+            uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+            if (simd) {
+                uint32_t m;
+                x = project_row_simd(row, rx, ry, w, y * w, lo, hi, scale, out + n, &m);
+                n += m;
+            }
+#endif
+            n += project_row_scalar(row, rx, ry, x, w, y * w, lo, hi, scale, out + n);
+        }
+        band_points[first] = n;
+    });
+    (void) simd;
+
+    uint32_t total = 0;
+    for (uint32_t y = 0; y < h; y++) {
+        uint32_t n = band_points[y];
+        if (n == NO_BAND)
+            continue;
+        if (total != y * w)
+            memmove(cloud->points + total, cloud->points + (size_t) y * w, (size_t) n * sizeof(XrMapPointQTI));
+        total += n;
+    }
+    cloud->numPoints = total;
+    return true;
+}
+
+int64_t DepthOps::fill_holes(const ImageView& depth, uint16_t* out, uint32_t out_pitch)
+{
+    if (!check_view(depth) || out == NULL || out_pitch < depth.width * 2)
+        return -1;
+
+    const int r = (int) cfg.fill_radius;
+    const int w = (int) depth.width, h = (int) depth.height;
+    const uint16_t lo = cfg.min_depth, hi = cfg.max_depth;
+    const uint32_t range = (uint32_t) range_weights.size();
+    std::atomic<int64_t> filled(0);
+    pool.run(depth.height, [&](uint32_t first, uint32_t end) {
+        int64_t n = 0;
+        for (int y = (int) first; y < (int) end; y++) {
+            const uint16_t* src = (const uint16_t*) (depth.data + (size_t) y * depth.pitch);
+            uint16_t* dst = (uint16_t*) ((uint8_t*) out + (size_t) y * out_pitch);
+            memcpy(dst, src, (size_t) w * 2);
+            int y0 = std::max(y - r, 0), y1 = std::min(y + r, h - 1);
+            for (int x = 0; x < w; x++) {
+                if (src[x] >= lo && src[x] <= hi)
+                    continue;
+                int x0 = std::max(x - r, 0), x1 = std::min(x + r, w - 1);
+                uint32_t nearest = 0x10000;
+                for (int yy = y0; yy <= y1; yy++) {
+                    const uint16_t* row = (const uint16_t*) (depth.data + (size_t) yy * depth.pitch);
+                    for (int xx = x0; xx <= x1; xx++) {
+                        if (row[xx] >= lo && row[xx] <= hi && row[xx] < nearest)
+                            nearest = row[xx];
+                    }
+                }
+                if (nearest > 0xffff)
+                    continue;
+
+                float sum = 0.0f, weights = 0.0f;
+                uint32_t count = 0;
+                for (int yy = y0; yy <= y1; yy++) {
+                    const uint16_t* row = (const uint16_t*) (depth.data + (size_t) yy * depth.pitch);
+                    const float* ws = &space_weights[(size_t) (yy - y + r) * (2 * r + 1) + r];
+                    for (int xx = x0; xx <= x1; xx++) {
+                        uint32_t v = row[xx];
+                        if (v < lo || v > hi || v - nearest >= range)
+                            continue;
+                        float wt = ws[xx - x] * range_weights[v - nearest];
+                        sum += wt * (float) v;
+                        weights += wt;
+                        count++;
+                    }
+                }
+                if (count >= cfg.fill_min_neighbors) {
+                    dst[x] = (uint16_t) (sum / weights + 0.5f);
+                    n++;
+                }
+            }
+        }
+        filled.fetch_add(n, std::memory_order_relaxed);
+    });
+    return filled.load();
+}
+
+void DepthOps::reset_history()
+{
+    history.clear();
+    history_count = 0;
+    history_next = 0;
+    history_width = 0;
+    history_height = 0;
+}
+
+bool DepthOps::median(const ImageView& depth, uint16_t* out, uint32_t out_pitch)
+{
+    if (!check_view(depth) || out == NULL || out_pitch < depth.width * 2)
+        return false;
+
+    uint32_t frames = cfg.median_frames == 5 ? 5 : 3;
+    uint32_t w = depth.width, h = depth.height;
+    if (history.size() != frames || history_width != w || history_height != h) {
+        history.assign(frames, std::vector<uint16_t>((size_t) w * h));
+        history_count = 0;
+        history_next = 0;
+        history_width = w;
+        history_height = h;
+    }
+    uint16_t* slot = history[history_next].data();
+    bool full = history_count + 1 >= frames;
+    bool simd = active_kernel() == KERNEL_SIMD;
+
+    pool.run(h, [&](uint32_t first, uint32_t end) {
+        const uint16_t* rows[5];
+        for (uint32_t y = first; y < end; y++) {
+            const uint16_t* src = (const uint16_t*) (depth.data + (size_t) y * depth.pitch);
+            uint16_t* dst = (uint16_t*) ((uint8_t*) out + (size_t) y * out_pitch);
+            memcpy(slot + (size_t) y * w, src, (size_t) w * 2);
+            if (!full) {
+                memcpy(dst, src, (size_t) w * 2);
+                continue;
+            }
+            for (uint32_t i = 0; i < frames; i++)
+                rows[i] = history[i].data() + (size_t) y * w;
+            uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+            if (simd)
+                x = median_row_simd(rows, frames, w, dst);
+#endif
+            median_row_scalar(rows, frames, x, w, dst);
+        }
+    });
+    (void) simd;
+
+    history_next = (history_next + 1) % frames;
+    history_count = std::min(history_count + 1, frames);
+    return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "camera/frame_views.h"
+#include "camera/lens_model.h"
+#include "camera/row_pool.h"
+
+// Operations on QVRCAMERA_FRAME_FORMAT_DEPTH16 images of z distances, 0
+// for no depth:
+//
+//  - back_project() turns the pixels with depth into XrMapPointQTI camera
+//    frame points (x right, y down, z forward, in meters at depth_scale),
+//    with the pixel index y * width + x as id, through a ray per pixel that
+//    set_lens() computes once from the lens model. The NEON/SSE2 kernel
+//    scales four rays at a time and writes the points compacted.
+//  - fill_holes() gives holes the bilateral mean of the depths around them,
+//    weighted by distance and by how far each is behind the nearest one, so
+//    holes at edges take the foreground and not a blend.
+//  - median() is the per pixel median over the last median_frames frames
+//    with min/max networks, a hole where most of them have none.
+//
+// With threads > 1 every operation runs in bands of rows on a pool of
+// threads - 1 workers and the calling thread. One call at a time per
+// instance.
+class DepthOps {
+public:
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SIMD,
+    };
+
+    struct Config {
+        // meters per depth unit
+        float depth_scale = 0.001f;
+        // depths outside are holes to back_project()
+        uint16_t min_depth = 1;
+        uint16_t max_depth = 0xffff;
+        // fill_holes() window and weights, in pixels and depth units
+        uint32_t fill_radius = 2;
+        float fill_sigma_space = 1.5f;
+        float fill_sigma_range = 40.0f;
+        // neighbours with depth a hole needs to be filled
+        uint32_t fill_min_neighbors = 3;
+        // median() window, 3 or 5
+        uint32_t median_frames = 3;
+    };
+
+    DepthOps();
+    explicit DepthOps(int threads);
+    DepthOps(int threads, const Config& config);
+
+    DepthOps(const DepthOps&) = delete;
+    DepthOps& operator=(const DepthOps&) = delete;
+
+    int threads() const { return pool.threads(); }
+
+    void set_config(const Config& config);
+    const Config& config() const { return cfg; }
+
+    // KERNEL_SIMD falls back to scalar when the build has no vector unit
+    void set_kernel(Kernel k) { kernel = k; }
+    Kernel active_kernel() const;
+    static bool simd_available();
+
+    // Rays of the pixels of the lens, at its size (scaled() to the frames).
+    // Pixels the model doesn't invert at never give points. False for an
+    // invalid model.
+    bool set_lens(const LensModel& lens);
+    const LensModel& lens() const { return lens_model; }
+
+    // Points of a frame of the lens' size into cloud, whose maxPoints must
+    // hold one per pixel; numPoints says how many there are. The timestamp
+    // is left to the caller.
+    bool back_project(const ImageView& depth, XrPointCloudQTI* cloud);
+    // depth with holes filled into out (out_pitch bytes per row), which
+    // must not overlap it; the number of holes filled, -1 on bad views
+    int64_t fill_holes(const ImageView& depth, uint16_t* out, uint32_t out_pitch);
+    // Adds depth to the history and writes the median over it to out.
+    // Until median_frames frames of its size came, out is depth.
+    bool median(const ImageView& depth, uint16_t* out, uint32_t out_pitch);
+    void reset_history();
+
+    // bytes of an XrPointCloudQTI of max_points points
+    static size_t cloud_size(uint32_t max_points);
+
+private:
+    void build_tables();
+    bool check_view(const ImageView& v) const;
+
+    Config cfg;
+    Kernel kernel;
+    LensModel lens_model;
+    // per pixel x/z and y/z times depth_scale; NaN where there is no ray
+    std::vector<float> ray_x;
+    std::vector<float> ray_y;
+    // fill_holes() weights by offset and by depth behind the nearest
+    std::vector<float> space_weights;
+    std::vector<float> range_weights;
+    // back_project() points of the band starting at each row
+    std::vector<uint32_t> band_points;
+
+    std::vector<std::vector<uint16_t>> history;
+    uint32_t history_count;
+    uint32_t history_next;
+    uint32_t history_width;
+    uint32_t history_height;
+
+    RowPool pool;
+};
@@ -0,0 +1,217 @@
+#include "camera/frame_share_client.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "qvr/inc/QVRTypes.h"
+#include "camera/ahb_fns.h"
+#include "holder_log.h"
+#include "time_util.h"
+#include "vrmode_broker_client.h"
+
+FrameShareClient::FrameShareClient()
+    : sock(-1)
+    , ring(NULL)
+    , ring_size(0)
+    , buffers()
+    , granted(0)
+    , lapped_frames(0)
+{
+}
+
+FrameShareClient::~FrameShareClient()
+{
+    close();
+}
+
+int32_t FrameShareClient::connect(const char* camera, const char* name, uint32_t max_leases, int timeout_ms)
+{
+    close();
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return QVR_ERROR;
+
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_un addr;
+    socklen_t len = broker_address(name, &addr);
+    if (::connect(sock, (struct sockaddr*) &addr, len) != 0) {
+        __log_func(ANDROID_LOG_WARN, TAG, "connect to frame share %s failed: %d", name, errno);
+        close();
+        return QVR_ERROR;
+    }
+
+    qvrholder_frames_msg_t msg = {};
+    msg.version = QVRHOLDER_FRAMES_VERSION;
+    msg.op = QVRHOLDER_FRAMES_OP_SUBSCRIBE;
+    msg.arg = max_leases;
+    strncpy(msg.camera, camera, sizeof(msg.camera) - 1);
+    if (send(sock, &msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t) sizeof(msg)) {
+        close();
+        return QVR_ERROR;
+    }
+
+    // the reply carries the ring fd
+    qvrholder_frames_msg_t rep;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &rep, sizeof(rep) };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    int ring_fd = -1;
+    struct cmsghdr* cmsg = n > 0 ? CMSG_FIRSTHDR(&mh) : NULL;
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&ring_fd, CMSG_DATA(cmsg), sizeof(int));
+    if (n != (ssize_t) sizeof(rep) || rep.op != QVRHOLDER_FRAMES_OP_SUBSCRIBED || rep.result != QVR_SUCCESS ||
+        ring_fd < 0) {
+        int32_t res = n == (ssize_t) sizeof(rep) && rep.result != QVR_SUCCESS ? rep.result : QVR_ERROR;
+        if (ring_fd >= 0)
+            ::close(ring_fd);
+        close();
+        return res;
+    }
+
+    struct stat st;
+    void* base = MAP_FAILED;
+    if (fstat(ring_fd, &st) == 0 && (size_t) st.st_size >= sizeof(qvrholder_frames_ring_t))
+        base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, ring_fd, 0);
+    ::close(ring_fd);
+    if (base == MAP_FAILED) {
+        close();
+        return QVR_ERROR;
+    }
+    ring = (qvrholder_frames_ring_t*) base;
+    ring_size = (size_t) st.st_size;
+    if (ring->magic != QVRHOLDER_FRAMES_RING_MAGIC || ring->version != QVRHOLDER_FRAMES_VERSION ||
+        ring->slot_size < sizeof(qvrholder_frames_slot_t) || ring->num_slots < 2 ||
+        sizeof(qvrholder_frames_ring_t) + (size_t) ring->num_slots * ring->slot_size > ring_size) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "frame share ring layout mismatch: slots %u x %u in %zu",
+                   ring->num_slots, ring->slot_size, ring_size);
+        close();
+        return QVR_ERROR;
+    }
+    granted = rep.arg;
+    return QVR_SUCCESS;
+}
+
+void FrameShareClient::close()
+{
+    if (sock >= 0) {
+        ::close(sock);
+        sock = -1;
+    }
+    if (ring != NULL) {
+        munmap(ring, ring_size);
+        ring = NULL;
+    }
+    const AhbFns& fns = ahb_fns();
+    for (AHardwareBuffer*& buf : buffers) {
+        if (buf != NULL)
+            fns.release(buf);
+        buf = NULL;
+    }
+    granted = 0;
+}
+
+bool FrameShareClient::read_slot(uint32_t seq, qvrholder_frames_slot_t* out) const
+{
+    const uint8_t* slots = (const uint8_t*) (ring + 1);
+    memcpy(out, slots + (size_t) (seq % ring->num_slots) * ring->slot_size, sizeof(*out));
+    // order the copy before the index re-check
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return out->seq == seq && ring_index() - seq < (uint32_t) ring->num_slots - 1;
+}
+
+int32_t FrameShareClient::next(Frame* frame, int timeout_ms)
+{
+    if (sock < 0)
+        return QVR_ERROR;
+
+    const AhbFns& fns = ahb_fns();
+    int64_t deadline = now_ns() + timeout_ms * 1000000LL;
+    for (;;) {
+        int64_t left_ms = (deadline - now_ns() + 999999) / 1000000;
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int res = poll(&pfd, 1, left_ms > 0 ? (int) left_ms : 0);
+        if (res == 0)
+            return QVR_RESULT_PENDING;
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            close();
+            return QVR_ERROR;
+        }
+
+        qvrholder_frames_msg_t msg;
+        if (recv(sock, &msg, sizeof(msg), 0) != (ssize_t) sizeof(msg) || msg.version != QVRHOLDER_FRAMES_VERSION) {
+            close();
+            return QVR_ERROR;
+        }
+
+        if (msg.op == QVRHOLDER_FRAMES_OP_BUFFER) {
+            // the buffer itself is the next packet
+            AHardwareBuffer* buf = NULL;
+            if (msg.arg >= QVRHOLDER_FRAMES_MAX_BUFFER_IDS || fns.recv_handle == NULL ||
+                fns.recv_handle(sock, &buf) != 0) {
+                __log_func(ANDROID_LOG_ERROR, TAG, "frame share: receiving buffer %u failed", msg.arg);
+                close();
+                return QVR_ERROR;
+            }
+            if (buffers[msg.arg] != NULL)
+                fns.release(buffers[msg.arg]);
+            buffers[msg.arg] = buf;
+            continue;
+        }
+        if (msg.op != QVRHOLDER_FRAMES_OP_FRAME)
+            continue;
+
+        frame->lease = msg.lease;
+        bool ok = read_slot(msg.arg, &frame->meta) && frame->meta.lease == msg.lease &&
+                  frame->meta.num_buffers <= QVRHOLDER_FRAMES_MAX_BUFFERS;
+        frame->num_buffers = ok ? frame->meta.num_buffers : 0;
+        for (uint32_t i = 0; i < frame->num_buffers && ok; i++) {
+            uint32_t id = frame->meta.buffer_ids[i];
+            ok = id < QVRHOLDER_FRAMES_MAX_BUFFER_IDS && buffers[id] != NULL;
+            if (ok) {
+                frame->buffers[i].buf = buffers[id];
+                frame->buffers[i].offset.x = frame->meta.buffer_x[i];
+                frame->buffers[i].offset.y = frame->meta.buffer_y[i];
+            }
+        }
+        if (ok)
+            return QVR_SUCCESS;
+        lapped_frames++;
+        release(msg.lease);
+    }
+}
+
+bool FrameShareClient::release(uint32_t lease)
+{
+    if (sock < 0)
+        return false;
+    qvrholder_frames_msg_t msg = {};
+    msg.version = QVRHOLDER_FRAMES_VERSION;
+    msg.op = QVRHOLDER_FRAMES_OP_RELEASE;
+    msg.lease = lease;
+    if (send(sock, &msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t) sizeof(msg)) {
+        close();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "camera/frame_share_protocol.h"
+
+// Blocking client side of the frame share, for analytics processes and the
+// benchmarks. Subscribes to one camera; the leases live as long as the
+// connection does, release() each frame once done with its buffers.
+class FrameShareClient {
+public:
+    static const int DEFAULT_TIMEOUT_MS = 1000;
+
+    struct Frame {
+        uint32_t lease;
+        qvrholder_frames_slot_t meta;
+        // for FrameViews::from_buffers(), valid until close()
+        qvrcamera_hwbuffer_t buffers[QVRHOLDER_FRAMES_MAX_BUFFERS];
+        uint32_t num_buffers;
+    };
+
+    FrameShareClient();
+    ~FrameShareClient();
+
+    FrameShareClient(const FrameShareClient&) = delete;
+    FrameShareClient& operator=(const FrameShareClient&) = delete;
+
+    // QVR_SUCCESS, QVR_INVALID_PARAM for a camera the holder doesn't share,
+    // QVR_ERROR without a service. max_leases 0 takes the service default.
+    int32_t connect(const char* camera, const char* name = QVRHOLDER_FRAMES_NAME, uint32_t max_leases = 0,
+                    int timeout_ms = DEFAULT_TIMEOUT_MS);
+    void close();
+    bool is_connected() const { return sock >= 0; }
+    // readable when a frame may be waiting, for poll loops
+    int fd() const { return sock; }
+    uint32_t max_leases() const { return granted; }
+
+    // Next frame leased to this client: QVR_SUCCESS, QVR_RESULT_PENDING when
+    // none came within timeout_ms, QVR_ERROR when the service went away
+    int32_t next(Frame* frame, int timeout_ms);
+    bool release(uint32_t lease);
+
+    // seq of the newest frame the holder published, leased or not
+    uint32_t ring_index() const { return __atomic_load_n(&ring->index, __ATOMIC_ACQUIRE); }
+    // leases given back at once because their ring slot was rewritten
+    // before the client read it
+    uint64_t lapped() const { return lapped_frames; }
+
+private:
+    bool read_slot(uint32_t seq, qvrholder_frames_slot_t* out) const;
+
+    int sock;
+    qvrholder_frames_ring_t* ring;
+    size_t ring_size;
+    AHardwareBuffer* buffers[QVRHOLDER_FRAMES_MAX_BUFFER_IDS];
+    uint32_t granted;
+    uint64_t lapped_frames;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+// Wire format of the qvrholder camera frame sharing service. Analytics
+// processes connect a SOCK_SEQPACKET socket to the abstract unix address
+// "@qvrholder.frames", subscribe to one camera and get its frames as leases
+// on the holder's locked frames, without copies and without taking a camera
+// client slot each.
+//
+// The SUBSCRIBED reply carries the fd of the camera's metadata ring
+// (SCM_RIGHTS), a shared memory qvrholder_frames_ring_t. The hardware
+// buffers a frame sits in are sent once per connection: a BUFFER message
+// names the id, the next packet is the buffer itself from
+// AHardwareBuffer_sendHandleToUnixSocket(). Each FRAME message is a lease
+// on one frame, whose metadata is in the ring slot of its seq. The holder
+// keeps the frame locked until every peer it went to has sent RELEASE for
+// the lease or closed its connection; a peer holding max_leases frames
+// already misses frames until it releases one.
+
+#include <stdint.h>
+
+#define QVRHOLDER_FRAMES_NAME "qvrholder.frames"
+#define QVRHOLDER_FRAMES_VERSION 1
+
+#define QVRHOLDER_FRAMES_RING_MAGIC 0x46525651u  // "QVRF"
+// hardware buffers per frame, and buffer ids per camera
+#define QVRHOLDER_FRAMES_MAX_BUFFERS 4
+#define QVRHOLDER_FRAMES_MAX_BUFFER_IDS 64
+
+// result of a SUBSCRIBE from a uid the holder doesn't share frames with; the
+// service closes the connection after it
+#define QVRHOLDER_FRAMES_DENIED (-100)
+
+enum QVRHOLDER_FRAMES_OP {
+    // client: camera holds the QVRSERVICE_CAMERA_NAME_*, arg the leases it
+    // wants to hold at once (0 for the service default)
+    QVRHOLDER_FRAMES_OP_SUBSCRIBE = 1,
+    // client: done with lease
+    QVRHOLDER_FRAMES_OP_RELEASE = 2,
+    // service: result of SUBSCRIBE, with the ring fd on success and arg
+    // the leases granted
+    QVRHOLDER_FRAMES_OP_SUBSCRIBED = 3,
+    // service: arg is the id of the hardware buffer in the next packet
+    QVRHOLDER_FRAMES_OP_BUFFER = 4,
+    // service: lease on the frame in ring slot arg
+    QVRHOLDER_FRAMES_OP_FRAME = 5,
+};
+
+struct qvrholder_frames_msg_t {
+    uint16_t version;        // QVRHOLDER_FRAMES_VERSION
+    uint16_t op;             // QVRHOLDER_FRAMES_OP
+    // SUBSCRIBED: QVR_SUCCESS, QVR_INVALID_PARAM for an unknown camera or a
+    // second subscription, QVRHOLDER_FRAMES_DENIED for a uid not allowed
+    int32_t result;
+    uint32_t lease;
+    uint32_t arg;
+    char camera[32];
+};
+
+struct qvrholder_frames_slot_t {
+    // the ring index this slot was written for
+    uint32_t seq;
+    uint32_t lease;
+    uint32_t fn;
+    uint32_t format;         // QVRCAMERA_FRAME_FORMAT
+    uint32_t width;
+    uint32_t height;
+    uint32_t exposure_ns;
+    uint32_t gain;
+    uint64_t start_of_exposure_ns; // BOOTTIME
+    int64_t acquired_ns;     // MONOTONIC, when the holder got the frame
+    int64_t published_ns;    // MONOTONIC
+    uint32_t num_buffers;
+    uint32_t buffer_ids[QVRHOLDER_FRAMES_MAX_BUFFERS];
+    // where each buffer sits in the merged image
+    int32_t buffer_x[QVRHOLDER_FRAMES_MAX_BUFFERS];
+    int32_t buffer_y[QVRHOLDER_FRAMES_MAX_BUFFERS];
+    // the cameras merged into a single buffer and whether they are stacked,
+    // as FrameViews::Layout
+    uint16_t images;
+    uint16_t vertical;
+};
+
+// Header of the metadata ring, the slots follow it. Seqs start at 1, slot
+// seq % num_slots holds seq. The holder writes a slot, then publishes its
+// seq in index (release). A reader copies the slot and checks index again:
+// when it moved num_slots - 1 or more past the seq, the slot may have been
+// rewritten meanwhile.
+struct qvrholder_frames_ring_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t num_slots;
+    uint32_t slot_size;      // sizeof(qvrholder_frames_slot_t)
+    uint32_t index;          // seq of the newest slot, 0 before the first
+};
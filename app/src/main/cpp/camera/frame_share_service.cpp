@@ -0,0 +1,520 @@
+#include "camera/frame_share_service.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include <algorithm>
+
+#include "qvr/inc/QVRTypes.h"
+#include "camera/ahb_fns.h"
+#include "holder_log.h"
+#include "time_util.h"
+#include "vrmode_broker_client.h"
+
+// Android's AID_SYSTEM
+#define SYSTEM_UID 1000
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+// bionic only has memfd_create() from API 30
+static int create_memfd(const char* name)
+{
+    return (int) syscall(__NR_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+}
+
+// one packet of msg with fd attached
+static bool send_with_fd(int sock, const qvrholder_frames_msg_t& msg, int fd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { (void*) &msg, sizeof(msg) };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(sock, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t) sizeof(msg);
+}
+
+static bool send_msg(int sock, const qvrholder_frames_msg_t& msg)
+{
+    return send(sock, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t) sizeof(msg);
+}
+
+FrameShareService::FrameShareService(EventLoop& loop, CameraPipeline& pipeline)
+    : FrameShareService(loop, pipeline, Config())
+{
+}
+
+FrameShareService::FrameShareService(EventLoop& loop, CameraPipeline& pipeline, const Config& config)
+    : loop(loop)
+    , pipeline(pipeline)
+    , cfg(config)
+    , listen_fd(-1)
+    , frames_event(-1)
+    , next_lease(0)
+    , accepting(false)
+    , hooked(false)
+    , published(0)
+    , skipped(0)
+    , buffers_out(0)
+    , refused(0)
+{
+    cfg.max_leases = std::max(cfg.max_leases, 1u);
+    share_uids.push_back(0);
+    share_uids.push_back(SYSTEM_UID);
+    allow_uid(getuid());
+}
+
+void FrameShareService::allow_uid(uid_t uid)
+{
+    if (!may_subscribe(uid))
+        share_uids.push_back(uid);
+}
+
+bool FrameShareService::may_subscribe(uid_t uid) const
+{
+    return std::find(share_uids.begin(), share_uids.end(), uid) != share_uids.end();
+}
+
+FrameShareService::~FrameShareService()
+{
+    stop();
+}
+
+bool FrameShareService::create_ring(Share& share)
+{
+    share.ring_size = sizeof(qvrholder_frames_ring_t) + RING_SLOTS * sizeof(qvrholder_frames_slot_t);
+    int fd = create_memfd("qvrholder.frames");
+    void* addr = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, (off_t) share.ring_size) == 0)
+        addr = mmap(NULL, share.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // A read-only fd alone doesn't stop a peer from opening its
+    // /proc/<pid>/fd link again for writing. The seals do: past our mapping
+    // nobody writes, maps writable or resizes the ring (Linux 5.1).
+    if (addr != MAP_FAILED && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE) != 0) {
+        munmap(addr, share.ring_size);
+        addr = MAP_FAILED;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    share.ring_fd = addr != MAP_FAILED ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd >= 0)
+        close(fd);
+    if (share.ring_fd < 0) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "frame share ring failed: %d", errno);
+        if (addr != MAP_FAILED)
+            munmap(addr, share.ring_size);
+        return false;
+    }
+
+    share.ring = (qvrholder_frames_ring_t*) addr;
+    share.ring->magic = QVRHOLDER_FRAMES_RING_MAGIC;
+    share.ring->version = QVRHOLDER_FRAMES_VERSION;
+    share.ring->num_slots = (uint16_t) RING_SLOTS;
+    share.ring->slot_size = sizeof(qvrholder_frames_slot_t);
+    share.ring->index = 0;
+    return true;
+}
+
+bool FrameShareService::start(const char* name)
+{
+    if (listen_fd >= 0)
+        return false;
+
+    shares.assign(pipeline.device_count(), Share());
+    for (Share& share : shares) {
+        share.ring_fd = -1;
+        share.ring = NULL;
+        share.seq = 0;
+        share.subscribers = 0;
+    }
+    for (int dev = 0; dev < pipeline.device_count(); dev++) {
+        if (!create_ring(shares[dev])) {
+            stop();
+            return false;
+        }
+        shares[dev].layout = FrameViews::query_layout(pipeline.camera(dev));
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "frame share socket failed: %d", errno);
+        stop();
+        return false;
+    }
+    struct sockaddr_un addr;
+    socklen_t len = broker_address(name, &addr);
+    if (bind(listen_fd, (struct sockaddr*) &addr, len) != 0 || listen(listen_fd, 8) != 0) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "frame share bind @%s failed: %d", name, errno);
+        stop();
+        return false;
+    }
+    frames_event = loop.create_event([this]() { on_frames(); });
+    if (frames_event < 0 || !loop.add_fd(listen_fd, EPOLLIN, [this](uint32_t) { on_accept(); })) {
+        stop();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(pending_lock);
+        accepting = true;
+    }
+    if (!hooked) {
+        for (int dev = 0; dev < pipeline.device_count(); dev++) {
+            pipeline.add_consumer(dev, [this, dev](const CameraPipeline::FrameHandle& h) {
+                std::lock_guard<std::mutex> l(pending_lock);
+                if (!accepting)
+                    return;
+                // only the newest frame of a device waits for the loop
+                for (auto& p : pending) {
+                    if (p.first == dev) {
+                        p.second = h;
+                        return;
+                    }
+                }
+                pending.emplace_back(dev, h);
+                EventLoop::signal_event(frames_event);
+            });
+        }
+        hooked = true;
+    }
+    __log_func(ANDROID_LOG_INFO, TAG, "frame share listening on @%s, %d cameras", name, pipeline.device_count());
+    return true;
+}
+
+void FrameShareService::stop()
+{
+    {
+        std::lock_guard<std::mutex> l(pending_lock);
+        accepting = false;
+        pending.clear();
+    }
+    if (listen_fd >= 0) {
+        loop.destroy_fd(listen_fd);
+        listen_fd = -1;
+    }
+    if (frames_event >= 0) {
+        loop.destroy_fd(frames_event);
+        frames_event = -1;
+    }
+
+    for (auto& p : peers)
+        loop.destroy_fd(p.first);
+    peers.clear();
+    leases.clear();
+
+    const AhbFns& fns = ahb_fns();
+    for (Share& share : shares) {
+        for (AHardwareBuffer* buf : share.buffers)
+            fns.release(buf);
+        if (share.ring != NULL)
+            munmap(share.ring, share.ring_size);
+        if (share.ring_fd >= 0)
+            close(share.ring_fd);
+    }
+    shares.clear();
+}
+
+void FrameShareService::on_accept()
+{
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                __log_func(ANDROID_LOG_WARN, TAG, "frame share accept failed: %d", errno);
+            return;
+        }
+        if ((int) peers.size() >= MAX_PEERS) {
+            __log_func(ANDROID_LOG_WARN, TAG, "frame share full, refusing peer");
+            close(fd);
+            continue;
+        }
+
+        Peer p;
+        p.device = -1;
+        p.max_leases = cfg.max_leases;
+        p.known_buffers = 0;
+        // without credentials nothing is allowed to subscribe
+        p.pid = -1;
+        p.uid = (uid_t) -1;
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0) {
+            p.pid = cred.pid;
+            p.uid = cred.uid;
+        }
+        if (!loop.add_fd(fd, EPOLLIN, [this, fd](uint32_t events) { on_peer(fd, events); })) {
+            close(fd);
+            continue;
+        }
+        peers[fd] = p;
+    }
+}
+
+void FrameShareService::on_peer(int fd, uint32_t events)
+{
+    auto it = peers.find(fd);
+    if (it == peers.end())
+        return;
+
+    if (events & EPOLLIN) {
+        qvrholder_frames_msg_t msg;
+        ssize_t n;
+        while ((n = recv(fd, &msg, sizeof(msg), MSG_DONTWAIT)) > 0) {
+            if (n != (ssize_t) sizeof(msg) || msg.version != QVRHOLDER_FRAMES_VERSION) {
+                drop_peer(fd);
+                return;
+            }
+            if (msg.op == QVRHOLDER_FRAMES_OP_RELEASE) {
+                release(it->second, msg.lease);
+            } else if (msg.op == QVRHOLDER_FRAMES_OP_SUBSCRIBE) {
+                subscribe(fd, it->second, msg);
+                // a failed reply drops the peer
+                if (peers.find(fd) == peers.end())
+                    return;
+            }
+        }
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            drop_peer(fd);
+            return;
+        }
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR))
+        drop_peer(fd);
+}
+
+void FrameShareService::subscribe(int fd, Peer& p, const qvrholder_frames_msg_t& msg)
+{
+    qvrholder_frames_msg_t rep = {};
+    rep.version = QVRHOLDER_FRAMES_VERSION;
+    rep.op = QVRHOLDER_FRAMES_OP_SUBSCRIBED;
+    rep.result = QVR_INVALID_PARAM;
+
+    if (!may_subscribe(p.uid)) {
+        refused++;
+        __log_func(ANDROID_LOG_WARN, TAG, "frame share: subscription refused to pid %d uid %d", (int) p.pid,
+                   (int) p.uid);
+        rep.result = QVRHOLDER_FRAMES_DENIED;
+        send_msg(fd, rep);
+        drop_peer(fd);
+        return;
+    }
+
+    char camera[sizeof(msg.camera) + 1];
+    memcpy(camera, msg.camera, sizeof(msg.camera));
+    camera[sizeof(msg.camera)] = '\0';
+    int device = -1;
+    for (int dev = 0; dev < pipeline.device_count() && p.device < 0; dev++) {
+        if (strcmp(pipeline.device_name(dev), camera) == 0)
+            device = dev;
+    }
+    if (device < 0) {
+        if (!send_msg(fd, rep))
+            drop_peer(fd);
+        return;
+    }
+
+    Share& share = shares[device];
+    rep.result = QVR_SUCCESS;
+    rep.arg = msg.arg != 0 ? std::min(msg.arg, cfg.max_leases) : cfg.max_leases;
+    if (!send_with_fd(fd, rep, share.ring_fd)) {
+        drop_peer(fd);
+        return;
+    }
+    p.device = device;
+    p.max_leases = rep.arg;
+    share.subscribers++;
+    __log_func(ANDROID_LOG_INFO, TAG, "frame share: pid %d uid %d subscribed to %s, %u leases", (int) p.pid,
+               (int) p.uid, camera, p.max_leases);
+}
+
+void FrameShareService::release(Peer& p, uint32_t lease)
+{
+    if (p.leases.erase(lease) == 0)
+        return;
+    auto it = leases.find(lease);
+    // the last peer done drops the handle, and ReleaseFrame() runs
+    if (it != leases.end() && --it->second.refs == 0)
+        leases.erase(it);
+}
+
+void FrameShareService::on_frames()
+{
+    std::vector<std::pair<int, CameraPipeline::FrameHandle>> frames;
+    {
+        std::lock_guard<std::mutex> l(pending_lock);
+        frames.swap(pending);
+    }
+    for (auto& f : frames)
+        publish(f.first, f.second);
+}
+
+int FrameShareService::buffer_id(Share& share, AHardwareBuffer* buf)
+{
+    // the cameras cycle through a fixed set of buffers
+    for (size_t i = 0; i < share.buffers.size(); i++) {
+        if (share.buffers[i] == buf)
+            return (int) i;
+    }
+    const AhbFns& fns = ahb_fns();
+    if (share.buffers.size() >= QVRHOLDER_FRAMES_MAX_BUFFER_IDS || fns.acquire == NULL)
+        return -1;
+    // held until stop() so the pointer can't come back as another buffer
+    fns.acquire(buf);
+    share.buffers.push_back(buf);
+    return (int) share.buffers.size() - 1;
+}
+
+bool FrameShareService::send_buffer(int fd, Peer& p, Share& share, uint32_t id)
+{
+    const AhbFns& fns = ahb_fns();
+    qvrholder_frames_msg_t msg = {};
+    msg.version = QVRHOLDER_FRAMES_VERSION;
+    msg.op = QVRHOLDER_FRAMES_OP_BUFFER;
+    msg.arg = id;
+    if (fns.send_handle == NULL || !send_msg(fd, msg) || fns.send_handle(share.buffers[id], fd) != 0)
+        return false;
+    p.known_buffers |= 1ULL << id;
+    buffers_out++;
+    return true;
+}
+
+void FrameShareService::publish(int device, CameraPipeline::FrameHandle& handle)
+{
+    Share& share = shares[device];
+    if (share.subscribers == 0)
+        return;
+
+    qvrcamera_frame_t frame = handle.frame();
+    uint32_t n = 0;
+    qvrcamera_hwbuffer_t* bufs = NULL;
+    int32_t res = QVRCameraDevice_FrameToHardwareBuffer(pipeline.camera(device), &frame, &n, &bufs);
+    if (res != QVR_CAM_SUCCESS || bufs == NULL || n == 0 || n > QVRHOLDER_FRAMES_MAX_BUFFERS) {
+        __log_func(ANDROID_LOG_WARN, TAG, "frame share: no hardware buffers for %s frame %u (%d)",
+                   pipeline.device_name(device), frame.fn, res);
+        return;
+    }
+    int ids[QVRHOLDER_FRAMES_MAX_BUFFERS];
+    for (uint32_t i = 0; i < n; i++) {
+        ids[i] = buffer_id(share, bufs[i].buf);
+        if (ids[i] < 0) {
+            __log_func(ANDROID_LOG_WARN, TAG, "frame share: %s cycles through more than %d buffers",
+                       pipeline.device_name(device), QVRHOLDER_FRAMES_MAX_BUFFER_IDS);
+            return;
+        }
+    }
+
+    uint32_t seq = ++share.seq;
+    if (++next_lease == 0)
+        next_lease = 1;
+    uint32_t lease = next_lease;
+
+    qvrholder_frames_slot_t* slot =
+            (qvrholder_frames_slot_t*) (share.ring + 1) + seq % RING_SLOTS;
+    memset(slot, 0, sizeof(*slot));
+    slot->seq = seq;
+    slot->lease = lease;
+    slot->fn = frame.fn;
+    slot->format = frame.format;
+    slot->width = frame.width;
+    slot->height = frame.height;
+    slot->exposure_ns = frame.exposure;
+    slot->gain = frame.gain;
+    slot->start_of_exposure_ns = frame.start_of_exposure_ts;
+    slot->acquired_ns = handle.acquired_ns();
+    slot->num_buffers = n;
+    for (uint32_t i = 0; i < n; i++) {
+        slot->buffer_ids[i] = (uint32_t) ids[i];
+        slot->buffer_x[i] = bufs[i].offset.x;
+        slot->buffer_y[i] = bufs[i].offset.y;
+    }
+    slot->images = (uint16_t) share.layout.images;
+    slot->vertical = share.layout.vertical ? 1 : 0;
+    slot->published_ns = now_ns();
+    __atomic_store_n(&share.ring->index, seq, __ATOMIC_RELEASE);
+    published++;
+
+    qvrholder_frames_msg_t msg = {};
+    msg.version = QVRHOLDER_FRAMES_VERSION;
+    msg.op = QVRHOLDER_FRAMES_OP_FRAME;
+    msg.lease = lease;
+    msg.arg = seq;
+
+    Lease l;
+    l.refs = 0;
+    std::vector<int> failed;
+    for (auto& it : peers) {
+        Peer& p = it.second;
+        if (p.device != device)
+            continue;
+        if (p.leases.size() >= p.max_leases) {
+            skipped++;
+            continue;
+        }
+        bool ok = true;
+        for (uint32_t i = 0; i < n && ok; i++) {
+            if ((p.known_buffers & (1ULL << ids[i])) == 0)
+                ok = send_buffer(it.first, p, share, (uint32_t) ids[i]);
+        }
+        // a peer that doesn't keep up with its socket goes, like the
+        // broker's clients
+        if (!ok || !send_msg(it.first, msg)) {
+            failed.push_back(it.first);
+            continue;
+        }
+        p.leases.insert(lease);
+        l.refs++;
+    }
+    if (l.refs > 0) {
+        l.handle = std::move(handle);
+        leases.emplace(lease, std::move(l));
+    }
+    for (int fd : failed)
+        drop_peer(fd);
+}
+
+void FrameShareService::drop_peer(int fd)
+{
+    auto it = peers.find(fd);
+    if (it == peers.end())
+        return;
+    Peer& p = it->second;
+    while (!p.leases.empty())
+        release(p, *p.leases.begin());
+    if (p.device >= 0) {
+        shares[p.device].subscribers--;
+        __log_func(ANDROID_LOG_INFO, TAG, "frame share: pid %d left %s", (int) p.pid,
+                   pipeline.device_name(p.device));
+    }
+    peers.erase(it);
+    loop.destroy_fd(fd);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "event_loop.h"
+#include "camera/camera_pipeline.h"
+#include "camera/frame_share_protocol.h"
+#include "camera/frame_views.h"
+
+// Shares the frames of a CameraPipeline with other processes. Every frame
+// of a camera with subscribers goes out as one lease per subscriber on the
+// holder's FrameHandle; the hardware buffers travel once per connection and
+// the metadata through a shared memory ring, so peers map the camera
+// buffers instead of copying frames or attaching cameras of their own. The
+// handle, and with it the locked frame, goes when the last peer released
+// the lease. Runs on the holder's event loop; the pipeline's threads only
+// queue the handles.
+//
+// Any local process can reach the socket, and camera frames are private, so
+// only the peer uids (SO_PEERCRED) on the share list get a subscription:
+// root, system and the holder's own uid, plus those added with allow_uid().
+class FrameShareService {
+public:
+    static const int MAX_PEERS = 16;
+    static const uint32_t RING_SLOTS = 32;
+
+    struct Config {
+        // leases a peer holds at once unless it asks for fewer; the frames
+        // all peers hold count against the pipeline's max_held
+        uint32_t max_leases = 2;
+    };
+
+    FrameShareService(EventLoop& loop, CameraPipeline& pipeline);
+    FrameShareService(EventLoop& loop, CameraPipeline& pipeline, const Config& config);
+    ~FrameShareService();
+
+    FrameShareService(const FrameShareService&) = delete;
+    FrameShareService& operator=(const FrameShareService&) = delete;
+
+    // After the pipeline's attach() and before its start(): the consumers
+    // can't be removed again, so the service has to outlive the pipeline's
+    // threads.
+    bool start(const char* name = QVRHOLDER_FRAMES_NAME);
+    void allow_uid(uid_t uid);
+    void set_uids(const std::vector<uid_t>& uids) { share_uids = uids; }
+    bool may_subscribe(uid_t uid) const;
+    // drops every peer and lease, before the pipeline's close()
+    void stop();
+    bool running() const { return listen_fd >= 0; }
+
+    size_t peer_count() const { return peers.size(); }
+    size_t lease_count() const { return leases.size(); }
+    uint64_t frames_published() const { return published; }
+    // frames a subscriber missed because it held all its leases
+    uint64_t frames_skipped() const { return skipped; }
+    uint64_t buffers_sent() const { return buffers_out; }
+    // subscriptions refused to uids not on the share list
+    uint64_t refused_count() const { return refused; }
+
+private:
+    struct Peer {
+        int device;
+        uint32_t max_leases;
+        // buffer ids this peer has, bit per id
+        uint64_t known_buffers;
+        std::set<uint32_t> leases;
+        pid_t pid;
+        uid_t uid;
+    };
+
+    struct Lease {
+        CameraPipeline::FrameHandle handle;
+        uint32_t refs;
+    };
+
+    struct Share {
+        int ring_fd;
+        qvrholder_frames_ring_t* ring;
+        size_t ring_size;
+        uint32_t seq;
+        uint32_t subscribers;
+        FrameViews::Layout layout;
+        // AHardwareBuffers seen so far, acquired; the index is the id
+        std::vector<AHardwareBuffer*> buffers;
+    };
+
+    bool create_ring(Share& share);
+    void on_accept();
+    void on_peer(int fd, uint32_t events);
+    void on_frames();
+    void subscribe(int fd, Peer& p, const qvrholder_frames_msg_t& msg);
+    void release(Peer& p, uint32_t lease);
+    void publish(int device, CameraPipeline::FrameHandle& handle);
+    // id of buf in share.buffers, -1 when the table is full
+    int buffer_id(Share& share, AHardwareBuffer* buf);
+    bool send_buffer(int fd, Peer& p, Share& share, uint32_t id);
+    void drop_peer(int fd);
+
+    EventLoop& loop;
+    CameraPipeline& pipeline;
+    Config cfg;
+    int listen_fd;
+    int frames_event;
+    std::vector<Share> shares;
+    std::map<int, Peer> peers;
+    std::map<uint32_t, Lease> leases;
+    uint32_t next_lease;
+    std::vector<uid_t> share_uids;
+
+    // handles from the pipeline threads for on_frames()
+    std::mutex pending_lock;
+    std::vector<std::pair<int, CameraPipeline::FrameHandle>> pending;
+    bool accepting;
+    bool hooked;
+
+    uint64_t published;
+    uint64_t skipped;
+    uint64_t buffers_out;
+    uint64_t refused;
+};
@@ -0,0 +1,284 @@
+#include "camera/frame_views.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "camera/ahb_fns.h"
+#include "holder_log.h"
+
+// source bytes per band of copy(), about half of a typical L2
+#define COPY_BAND_BYTES (128 * 1024)
+
+FrameViews::Layout FrameViews::query_layout(qvrcamera_device_helper_t* cam)
+{
+    Layout layout;
+    uint32_t images = 0;
+    if (QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT32_IMAGE_COUNT, QVRCAMERA_PARAM_NUM_TYPE_UINT32,
+                                    sizeof(images), (char*) &images) == QVR_CAM_SUCCESS &&
+        images > 0)
+        layout.images = std::min(images, (uint32_t) MAX_VIEWS);
+
+    char value[32];
+    uint32_t len = sizeof(value);
+    if (QVRCameraDevice_GetParam(cam, QVR_CAMDEVICE_STRING_IMAGE_ARRANGEMENT, &len, value) == QVR_CAM_SUCCESS) {
+        value[sizeof(value) - 1] = '\0';
+        layout.vertical = strcmp(value, QVR_CAMDEVICE_IMAGE_ARRANGEMENT_VERTICAL) == 0;
+    }
+    return layout;
+}
+
+FrameViews::FrameViews()
+    : num_views(0)
+    , num_locked(0)
+{
+}
+
+void FrameViews::reset()
+{
+    const AhbFns& fns = ahb_fns();
+    for (int i = 0; i < num_locked; i++)
+        fns.unlock(locked[i], NULL);
+    num_locked = 0;
+    num_views = 0;
+}
+
+uint32_t FrameViews::row_bytes(uint32_t format, uint32_t width)
+{
+    switch (format) {
+        case QVRCAMERA_FRAME_FORMAT_Y8:
+        case QVRCAMERA_FRAME_FORMAT_YUV420:
+            return width;
+        case QVRCAMERA_FRAME_FORMAT_DEPTH16:
+        case QVRCAMERA_FRAME_FORMAT_RAW16_MONO:
+            return width * 2;
+        case QVRCAMERA_FRAME_FORMAT_RAW10_MONO:
+            return (width + 3) / 4 * 5;
+        default:
+            return 0;
+    }
+}
+
+size_t FrameViews::copy_size(const ImageView& view)
+{
+    size_t rb = row_bytes(view.format, view.width);
+    return rb * view.height + (view.uv != NULL ? rb * (view.height / 2) : 0);
+}
+
+bool FrameViews::split(const ImageView& whole, const Layout& layout)
+{
+    uint32_t n = std::max(layout.images, 1u);
+    if (num_views + n > MAX_VIEWS)
+        return false;
+    if (n == 1) {
+        views[num_views++] = whole;
+        return true;
+    }
+
+    bool yuv = whole.uv != NULL;
+    for (uint32_t i = 0; i < n; i++) {
+        ImageView v = whole;
+        if (layout.vertical) {
+            v.height = whole.height / n;
+            if (yuv && v.height % 2 != 0)
+                return false;
+            v.data += (size_t) i * v.height * whole.pitch;
+            if (yuv)
+                v.uv += (size_t) i * (v.height / 2) * whole.uv_pitch;
+            v.y += (int32_t) (i * v.height);
+        } else {
+            v.width = whole.width / n;
+            // RAW10 can only be split between groups of 4, chroma between pairs
+            if ((whole.format == QVRCAMERA_FRAME_FORMAT_RAW10_MONO && v.width % 4 != 0) || (yuv && v.width % 2 != 0))
+                return false;
+            v.data += row_bytes(whole.format, i * v.width);
+            if (yuv)
+                v.uv += i * v.width;
+            v.x += (int32_t) (i * v.width);
+        }
+        views[num_views++] = v;
+    }
+    return true;
+}
+
+int FrameViews::from_frame(const qvrcamera_frame_t& frame, const Layout& layout)
+{
+    reset();
+    uint32_t rb = row_bytes(frame.format, frame.width);
+    if (rb == 0 || frame.buffer == NULL || frame.height == 0)
+        return 0;
+
+    const uint8_t* data = (const uint8_t*) frame.buffer;
+    bool yuv = frame.format == QVRCAMERA_FRAME_FORMAT_YUV420;
+    ImageView whole = {};
+    whole.data = data;
+    whole.width = frame.width;
+    whole.height = frame.height;
+    whole.format = frame.format;
+
+    if (frame.secondary_width != 0 && frame.secondary_height != 0) {
+        // crops have packed rows; where a YUV420 crop keeps its chroma is
+        // not specified
+        uint32_t rb2 = row_bytes(frame.format, frame.secondary_width);
+        if (yuv || (uint64_t) frame.len < (uint64_t) rb * frame.height + (uint64_t) rb2 * frame.secondary_height)
+            return 0;
+        whole.pitch = rb;
+        views[0] = whole;
+        views[1] = whole;
+        views[1].data = data + (size_t) rb * frame.height;
+        views[1].width = frame.secondary_width;
+        views[1].height = frame.secondary_height;
+        views[1].pitch = rb2;
+        views[1].y = (int32_t) frame.height;
+        num_views = 2;
+        return num_views;
+    }
+
+    whole.pitch = frame.stride >= rb ? frame.stride : rb;
+    uint64_t need = (uint64_t) whole.pitch * (frame.height - 1) + rb;
+    if (yuv) {
+        whole.uv = data + (size_t) whole.pitch * frame.height;
+        whole.uv_pitch = whole.pitch;
+        need = (uint64_t) whole.pitch * (frame.height + frame.height / 2 - 1) + rb;
+    }
+    if (frame.len < need || !split(whole, layout)) {
+        num_views = 0;
+        return 0;
+    }
+    return num_views;
+}
+
+int FrameViews::from_hardware_buffers(qvrcamera_device_helper_t* cam, qvrcamera_frame_t* frame,
+                                      const Layout& layout)
+{
+    reset();
+    uint32_t n = 0;
+    qvrcamera_hwbuffer_t* bufs = NULL;
+    if (QVRCameraDevice_FrameToHardwareBuffer(cam, frame, &n, &bufs) != QVR_CAM_SUCCESS || bufs == NULL)
+        return 0;
+    return from_buffers(bufs, n, frame->format, layout);
+}
+
+int FrameViews::from_buffers(const qvrcamera_hwbuffer_t* bufs, uint32_t n, uint32_t format, const Layout& layout)
+{
+    reset();
+    const AhbFns& fns = ahb_fns();
+    if (fns.lock == NULL || n == 0 || n > MAX_VIEWS)
+        return 0;
+
+    bool yuv = format == QVRCAMERA_FRAME_FORMAT_YUV420;
+    for (uint32_t i = 0; i < n; i++) {
+        AHardwareBuffer_Desc desc;
+        fns.describe(bufs[i].buf, &desc);
+        ImageView v = {};
+        v.width = desc.width;
+        v.height = desc.height;
+        v.format = format;
+        v.x = bufs[i].offset.x;
+        v.y = bufs[i].offset.y;
+
+        int res;
+        if (yuv) {
+            AHardwareBuffer_Planes planes;
+            res = fns.lock_planes != NULL ? fns.lock_planes(bufs[i].buf, AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN, -1,
+                                                            NULL, &planes)
+                                          : -1;
+            if (res == 0) {
+                locked[num_locked++] = bufs[i].buf;
+                const uint8_t* cb = (const uint8_t*) planes.planes[1].data;
+                const uint8_t* cr = (const uint8_t*) planes.planes[2].data;
+                // semi-planar only: the views have no room for 3 planes
+                if (planes.planeCount != 3 || planes.planes[1].pixelStride != 2 || (cb - cr != 1 && cr - cb != 1))
+                    res = -1;
+                v.data = (const uint8_t*) planes.planes[0].data;
+                v.pitch = planes.planes[0].rowStride;
+                v.uv = std::min(cb, cr);
+                v.uv_pitch = planes.planes[1].rowStride;
+            }
+        } else {
+            void* addr = NULL;
+            res = fns.lock(bufs[i].buf, AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN, -1, NULL, &addr);
+            if (res == 0) {
+                locked[num_locked++] = bufs[i].buf;
+                v.data = (const uint8_t*) addr;
+                // the desc stride is in pixels
+                v.pitch = row_bytes(format, desc.stride);
+                if (v.pitch == 0)
+                    res = -1;
+            }
+        }
+        if (res != 0) {
+            __log_func(ANDROID_LOG_WARN, TAG, "locking camera hardware buffer %u/%u failed (%d)", i + 1, n, res);
+            reset();
+            return 0;
+        }
+
+        bool ok = n == 1 ? split(v, layout) : num_views < MAX_VIEWS;
+        if (ok && n > 1)
+            views[num_views++] = v;
+        if (!ok) {
+            reset();
+            return 0;
+        }
+    }
+    return num_views;
+}
+
+int FrameViews::from_hw_buffer_outputs(const XrCameraHwBufferOutputQTI* bufs, uint32_t count, uint32_t format)
+{
+    reset();
+    const AhbFns& fns = ahb_fns();
+    if (fns.describe == NULL || count > MAX_VIEWS)
+        return 0;
+    for (uint32_t i = 0; i < count; i++) {
+        AHardwareBuffer_Desc desc;
+        fns.describe(bufs[i].buf, &desc);
+        ImageView& v = views[i];
+        v = ImageView();
+        v.data = (const uint8_t*) bufs[i].bufVAddr;
+        v.width = desc.width;
+        v.height = desc.height;
+        v.pitch = row_bytes(format, desc.stride);
+        v.format = format;
+        v.x = bufs[i].offset.x;
+        v.y = bufs[i].offset.y;
+        if (v.data == NULL || v.pitch == 0)
+            return 0;
+        if (format == QVRCAMERA_FRAME_FORMAT_YUV420) {
+            v.uv = v.data + (size_t) v.pitch * v.height;
+            v.uv_pitch = v.pitch;
+        }
+    }
+    num_views = (int) count;
+    return num_views;
+}
+
+bool FrameViews::copy(const ImageView* views, int count, uint8_t* const* dst)
+{
+    uint32_t band_bytes = 0;
+    uint32_t max_height = 0;
+    for (int i = 0; i < count; i++) {
+        if (row_bytes(views[i].format, views[i].width) == 0)
+            return false;
+        band_bytes += views[i].pitch;
+        max_height = std::max(max_height, views[i].height);
+    }
+    // whole chroma rows per band
+    uint32_t band = std::max(2u, COPY_BAND_BYTES / std::max(band_bytes, 1u)) & ~1u;
+
+    for (uint32_t y0 = 0; y0 < max_height; y0 += band) {
+        for (int i = 0; i < count; i++) {
+            const ImageView& v = views[i];
+            uint32_t rb = row_bytes(v.format, v.width);
+            uint32_t end = std::min(v.height, y0 + band);
+            for (uint32_t y = y0; y < end; y++)
+                memcpy(dst[i] + (size_t) y * rb, v.data + (size_t) y * v.pitch, rb);
+            if (v.uv == NULL)
+                continue;
+            uint8_t* uv = dst[i] + (size_t) rb * v.height;
+            for (uint32_t y = y0 / 2; y < std::min(v.height / 2, end / 2); y++)
+                memcpy(uv + (size_t) y * rb, v.uv + (size_t) y * v.uv_pitch, rb);
+        }
+    }
+    return true;
+}
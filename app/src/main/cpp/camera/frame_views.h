@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "qvr/inc/QVRCameraClient.h"
+
+// Where one physical camera's image sits in memory
+struct ImageView {
+    const uint8_t* data;
+    // interleaved chroma of YUV420 views, NULL for other formats
+    const uint8_t* uv;
+    uint32_t width;
+    uint32_t height;
+    // bytes from one row to the next
+    uint32_t pitch;
+    uint32_t uv_pitch;
+    // QVRCAMERA_FRAME_FORMAT
+    uint32_t format;
+    // top left corner in the merged image
+    int32_t x;
+    int32_t y;
+};
+
+// Per camera views of a merged frame, without copying. A logical camera of
+// QVR_CAMDEVICE_UINT32_IMAGE_COUNT physical ones merges their images side by
+// side or stacked as QVR_CAMDEVICE_STRING_IMAGE_ARRANGEMENT says; dual-crop
+// frames hold their two crops back to back whatever the arrangement.
+//
+// Views from FrameToHardwareBuffer() keep the AHardwareBuffers locked for
+// CPU reads until reset(), which has to happen before ReleaseFrame(). A
+// single buffer for several cameras (hardware merged) is split like a
+// GetFrame() image.
+class FrameViews {
+public:
+    static const int MAX_VIEWS = 4;
+
+    struct Layout {
+        uint32_t images = 1;
+        bool vertical = false;
+    };
+
+    // from the device params; one image when they are missing
+    static Layout query_layout(qvrcamera_device_helper_t* cam);
+
+    FrameViews();
+    ~FrameViews() { reset(); }
+
+    FrameViews(const FrameViews&) = delete;
+    FrameViews& operator=(const FrameViews&) = delete;
+
+    // Both return the number of views, 0 when the frame doesn't divide up
+    // (format without a known row size, a split inside a RAW10 group)
+    int from_frame(const qvrcamera_frame_t& frame, const Layout& layout);
+    int from_hardware_buffers(qvrcamera_device_helper_t* cam, qvrcamera_frame_t* frame, const Layout& layout);
+    // the same for n buffers of format that came some other way, e.g. from
+    // another process
+    int from_buffers(const qvrcamera_hwbuffer_t* bufs, uint32_t n, uint32_t format, const Layout& layout);
+    // One view per hardware buffer of a GetFrameEx() result, which are
+    // locked already; YUV420 chroma follows the Y rows as in GetFrame()
+    int from_hw_buffer_outputs(const XrCameraHwBufferOutputQTI* bufs, uint32_t count, uint32_t format);
+    // drops the views and unlocks the buffers
+    void reset();
+
+    int count() const { return num_views; }
+    const ImageView& view(int i) const { return views[i]; }
+
+    // bytes of width pixels of one row (of the Y plane for YUV420)
+    static uint32_t row_bytes(uint32_t format, uint32_t width);
+    // bytes a contiguous copy of view takes, chroma included
+    static size_t copy_size(const ImageView& view);
+    // Contiguous copies of count views, dst[i] of copy_size(views[i]) bytes
+    // with packed rows and YUV420 chroma after the Y rows. Goes over the
+    // source in bands of rows that fit the cache, copying every view's rows
+    // of a band together, so views sharing source rows read them once.
+    static bool copy(const ImageView* views, int count, uint8_t* const* dst);
+
+private:
+    // appends the views of a merged image
+    bool split(const ImageView& whole, const Layout& layout);
+
+    ImageView views[MAX_VIEWS];
+    int num_views;
+    AHardwareBuffer* locked[MAX_VIEWS];
+    int num_locked;
+};
@@ -0,0 +1,218 @@
+#include "camera/lens_model.h"
+
+#include <math.h>
+#include <string.h>
+
+// fixed point iterations inverting the radial models, and how close the
+// result has to distort back to the pixel, in normalized units
+#define RADIAL_ITERATIONS 50
+#define UNPROJECT_TOLERANCE 1e-7
+
+LensModel::LensModel()
+{
+    memset(&cal, 0, sizeof(cal));
+}
+
+LensModel::LensModel(const XrIntrinsicCalibrationQTI& calibration)
+    : cal(calibration)
+{
+}
+
+bool LensModel::valid() const
+{
+    return cal.size.width > 0 && cal.size.height > 0 && cal.focalLength.x > 0.0 && cal.focalLength.y > 0.0 &&
+           cal.distortionModel <= XR_DISTORTION_MODEL_QTI_FISHEYE_4_PARAMS;
+}
+
+LensModel LensModel::scaled(uint32_t width, uint32_t height) const
+{
+    LensModel m(cal);
+    if (cal.size.width <= 0 || cal.size.height <= 0)
+        return m;
+    double sx = (double) width / cal.size.width;
+    double sy = (double) height / cal.size.height;
+    // pixel centers stay pixel centers
+    m.cal.size.width = (int32_t) width;
+    m.cal.size.height = (int32_t) height;
+    m.cal.focalLength.x *= sx;
+    m.cal.focalLength.y *= sy;
+    m.cal.skew *= sx;
+    m.cal.principalPoint.x = (cal.principalPoint.x + 0.5) * sx - 0.5;
+    m.cal.principalPoint.y = (cal.principalPoint.y + 0.5) * sy - 0.5;
+    return m;
+}
+
+bool LensModel::radial_scale(double r2, double* scale) const
+{
+    const double* k = cal.radialDistortion;
+    switch (cal.distortionModel) {
+        case XR_DISTORTION_MODEL_QTI_RADIAL_2_PARAMS:
+            *scale = 1.0 + r2 * (k[0] + r2 * k[1]);
+            break;
+        case XR_DISTORTION_MODEL_QTI_RADIAL_3_PARAMS:
+            *scale = 1.0 + r2 * (k[0] + r2 * (k[1] + r2 * k[2]));
+            break;
+        case XR_DISTORTION_MODEL_QTI_RADIAL_6_PARAMS: {
+            double den = 1.0 + r2 * (k[3] + r2 * (k[4] + r2 * k[5]));
+            if (den <= 0.0)
+                return false;
+            *scale = (1.0 + r2 * (k[0] + r2 * (k[1] + r2 * k[2]))) / den;
+            break;
+        }
+        default:
+            return false;
+    }
+    return *scale > 0.0;
+}
+
+bool LensModel::distort(double x, double y, double* xd, double* yd) const
+{
+    const double* k = cal.radialDistortion;
+    double r2 = x * x + y * y;
+    double scale = 1.0;
+
+    switch (cal.distortionModel) {
+        case XR_DISTORTION_MODEL_QTI_LINEAR:
+            break;
+        case XR_DISTORTION_MODEL_QTI_FISHEYE_1_PARAM: {
+            double r = sqrt(r2);
+            double w = k[0];
+            if (r > 1e-12 && fabs(w) > 1e-9)
+                scale = atan(2.0 * r * tan(w / 2.0)) / (w * r);
+            break;
+        }
+        case XR_DISTORTION_MODEL_QTI_FISHEYE_4_PARAMS: {
+            double r = sqrt(r2);
+            if (r > 1e-12) {
+                double t = atan(r);
+                double t2 = t * t;
+                scale = t * (1.0 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3])))) / r;
+            }
+            break;
+        }
+        default: {
+            if (!radial_scale(r2, &scale))
+                return false;
+            double p1 = cal.tangentialDistortion[0];
+            double p2 = cal.tangentialDistortion[1];
+            *xd = x * scale + 2.0 * p1 * x * y + p2 * (r2 + 2.0 * x * x);
+            *yd = y * scale + p1 * (r2 + 2.0 * y * y) + 2.0 * p2 * x * y;
+            return true;
+        }
+    }
+    if (scale <= 0.0)
+        return false;
+    *xd = x * scale;
+    *yd = y * scale;
+    return true;
+}
+
+bool LensModel::project(double x, double y, double* u, double* v) const
+{
+    double xd, yd;
+    if (!distort(x, y, &xd, &yd))
+        return false;
+    *u = cal.focalLength.x * xd + cal.skew * yd + cal.principalPoint.x;
+    *v = cal.focalLength.y * yd + cal.principalPoint.y;
+    return true;
+}
+
+bool LensModel::unproject(double u, double v, double* x, double* y) const
+{
+    double yd = (v - cal.principalPoint.y) / cal.focalLength.y;
+    double xd = (u - cal.principalPoint.x - cal.skew * yd) / cal.focalLength.x;
+    double rd = sqrt(xd * xd + yd * yd);
+    const double* k = cal.radialDistortion;
+
+    switch (cal.distortionModel) {
+        case XR_DISTORTION_MODEL_QTI_LINEAR:
+            *x = xd;
+            *y = yd;
+            return true;
+
+        case XR_DISTORTION_MODEL_QTI_FISHEYE_1_PARAM: {
+            double w = k[0];
+            double scale = 1.0;
+            if (rd > 1e-12 && fabs(w) > 1e-9) {
+                if (rd * fabs(w) >= M_PI / 2.0)
+                    return false;
+                scale = tan(rd * w) / (2.0 * tan(w / 2.0) * rd);
+            }
+            *x = xd * scale;
+            *y = yd * scale;
+            return true;
+        }
+
+        case XR_DISTORTION_MODEL_QTI_FISHEYE_4_PARAMS: {
+            double scale = 1.0;
+            if (rd > 1e-12) {
+                // Newton on t (1 + k1 t^2 + ..) = rd
+                double t = rd;
+                for (int i = 0; i < 20; i++) {
+                    double t2 = t * t;
+                    double f = t * (1.0 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3])))) - rd;
+                    double df = 1.0 + t2 * (3.0 * k[0] + t2 * (5.0 * k[1] + t2 * (7.0 * k[2] + t2 * 9.0 * k[3])));
+                    if (df <= 0.0)
+                        return false;
+                    double step = f / df;
+                    t -= step;
+                    if (fabs(step) < 1e-14)
+                        break;
+                }
+                if (t <= 0.0 || t >= M_PI / 2.0)
+                    return false;
+                scale = tan(t) / rd;
+            }
+            *x = xd * scale;
+            *y = yd * scale;
+            break;
+        }
+
+        default: {
+            // x = (xd - tangential(x)) / radial(x), from the distorted point on
+            double p1 = cal.tangentialDistortion[0];
+            double p2 = cal.tangentialDistortion[1];
+            double ux = xd, uy = yd;
+            for (int i = 0; i < RADIAL_ITERATIONS; i++) {
+                double r2 = ux * ux + uy * uy;
+                double scale;
+                if (!radial_scale(r2, &scale))
+                    return false;
+                double nx = (xd - 2.0 * p1 * ux * uy - p2 * (r2 + 2.0 * ux * ux)) / scale;
+                double ny = (yd - p1 * (r2 + 2.0 * uy * uy) - 2.0 * p2 * ux * uy) / scale;
+                bool done = fabs(nx - ux) + fabs(ny - uy) < 1e-15;
+                ux = nx;
+                uy = ny;
+                if (done)
+                    break;
+            }
+            *x = ux;
+            *y = uy;
+            break;
+        }
+    }
+
+    double cx, cy;
+    if (!distort(*x, *y, &cx, &cy))
+        return false;
+    return fabs(cx - xd) + fabs(cy - yd) < UNPROJECT_TOLERANCE;
+}
+
+int32_t LensModel::query(qvrcamera_device_helper_t* cam, uint32_t image, XrIntrinsicCalibrationQTI* out)
+{
+    XrCameraDevicePropertiesQTI props;
+    memset(&props, 0, sizeof(props));
+    props.base.type = XR_TYPE_QTI_CAM_DEVICE_PROPS;
+    int32_t res = QVRCameraDevice_GetProperties(cam, &props);
+    if (res != QVR_CAM_SUCCESS)
+        return res;
+    if (props.base.components == NULL || image >= props.base.componentCount)
+        return QVR_CAM_INVALID_PARAM;
+
+    // the components are the XrCameraSensorPropertiesQTI of the sensors
+    if (props.base.components[0].type != XR_TYPE_QTI_CAM_SENSOR_PROPS)
+        return QVR_CAM_ERROR;
+    const XrCameraSensorPropertiesQTI* sensors = (const XrCameraSensorPropertiesQTI*) props.base.components;
+    *out = sensors[image].calibrationInfo.intrinsics;
+    return QVR_CAM_SUCCESS;
+}
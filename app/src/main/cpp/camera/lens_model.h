@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "qvr/inc/QVRCameraClient.h"
+
+// Pinhole projection plus the lens distortion of an XrIntrinsicCalibrationQTI,
+// for every XrDistortionModelQTI. Normalized coordinates are x = X/Z and
+// y = Y/Z in the camera frame (x right, y down, z forward); pixels are the
+// calibration's, or a frame's of another resolution after scaled().
+//
+//   RADIAL_2/3  x (1 + k1 r^2 + k2 r^4 [+ k3 r^6]) plus tangential p1, p2
+//   RADIAL_6    x (1 + k1 r^2 + k2 r^4 + k3 r^6) / (1 + k4 r^2 + k5 r^4 + k6 r^6)
+//               plus tangential
+//   FISHEYE_1   FOV model, r_d = atan(2 r tan(w / 2)) / w with w = k1
+//   FISHEYE_4   equidistant, r_d = t (1 + k1 t^2 + k2 t^4 + k3 t^6 + k4 t^8),
+//               t = atan(r)
+class LensModel {
+public:
+    LensModel();
+    explicit LensModel(const XrIntrinsicCalibrationQTI& calibration);
+
+    bool valid() const;
+    const XrIntrinsicCalibrationQTI& calibration() const { return cal; }
+    uint32_t width() const { return (uint32_t) cal.size.width; }
+    uint32_t height() const { return (uint32_t) cal.size.height; }
+
+    // The model for frames of width x height of the same field of view,
+    // e.g. binned or quarter resolution streams
+    LensModel scaled(uint32_t width, uint32_t height) const;
+
+    // pixel of normalized (x, y); false behind the lens or past the field of
+    // view the model covers
+    bool project(double x, double y, double* u, double* v) const;
+    // normalized (x, y) of pixel (u, v); false where the model doesn't invert
+    bool unproject(double u, double v, double* x, double* y) const;
+
+    // The calibration of the sensor behind image (0 left, 1 right) of a
+    // camera, from QVRCameraDevice_GetProperties(). QVR_CAM_SUCCESS or a
+    // QVR_CAM_* error.
+    static int32_t query(qvrcamera_device_helper_t* cam, uint32_t image, XrIntrinsicCalibrationQTI* out);
+
+private:
+    // 1 + k1 r^2 + .. of the RADIAL models
+    bool radial_scale(double r2, double* scale) const;
+    // normalized undistorted to distorted
+    bool distort(double x, double y, double* xd, double* yd) const;
+
+    XrIntrinsicCalibrationQTI cal;
+};
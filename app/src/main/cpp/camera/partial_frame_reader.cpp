@@ -0,0 +1,423 @@
+#include "camera/partial_frame_reader.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include "camera/camera_pipeline.h"
+#include "holder_log.h"
+#include "time_util.h"
+
+#define DEFAULT_RATE_HZ 30
+
+#define NOT_STARTED_RETRY_US 10000
+
+static uint32_t frame_format(const char* name)
+{
+    static const struct {
+        const char* name;
+        uint32_t format;
+    } formats[] = {
+        { QVR_CAMDEVICE_FRAME_FORMAT_Y8, QVRCAMERA_FRAME_FORMAT_Y8 },
+        { QVR_CAMDEVICE_FRAME_FORMAT_YUV420, QVRCAMERA_FRAME_FORMAT_YUV420 },
+        { QVR_CAMDEVICE_FRAME_FORMAT_RAW10, QVRCAMERA_FRAME_FORMAT_RAW10_MONO },
+        { QVR_CAMDEVICE_FRAME_FORMAT_RAW16, QVRCAMERA_FRAME_FORMAT_RAW16_MONO },
+        { QVR_CAMDEVICE_FRAME_FORMAT_DEPTH16, QVRCAMERA_FRAME_FORMAT_DEPTH16 },
+    };
+    for (const auto& f : formats) {
+        if (strcmp(name, f.name) == 0)
+            return f.format;
+    }
+    return QVRCAMERA_FRAME_FORMAT_UNKNOWN;
+}
+
+PartialFrameReader::PartialFrameReader()
+    : cam(NULL)
+    , sync_ctrl(NULL)
+    , started_camera(false)
+    , partial_reads(false)
+    , num_bands(0)
+    , have_fn(false)
+    , last_fn(0)
+    , quitting(false)
+    , frames(0)
+    , dropped(0)
+    , bands(0)
+    , late_bands(0)
+    , complete_frames(0)
+    , errors(0)
+{
+    memset(&time, 0, sizeof(time));
+}
+
+PartialFrameReader::~PartialFrameReader()
+{
+    close();
+}
+
+int PartialFrameReader::attach(qvrcamera_client_helper_t* client, const char* name)
+{
+    return attach(client, name, Config());
+}
+
+int PartialFrameReader::attach(qvrcamera_client_helper_t* client, const char* name, const Config& config)
+{
+    if (client == NULL || name == NULL || config.bands == 0 || config.bands > MAX_BANDS)
+        return QVR_CAM_INVALID_PARAM;
+    if (cam != NULL)
+        return QVR_CAM_ERROR;
+
+    cam = QVRCameraClient_AttachCamera(client, name);
+    if (cam == NULL) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "attach to camera %s failed", name);
+        return QVR_CAM_ERROR;
+    }
+    this->name = name;
+    cfg = config;
+
+    memset(&time, 0, sizeof(time));
+    char value[32];
+    uint32_t len = sizeof(value);
+    if (QVRCameraDevice_GetParam(cam, QVR_CAMDEVICE_STRING_FRAME_FORMAT, &len, value) == QVR_CAM_SUCCESS) {
+        value[sizeof(value) - 1] = '\0';
+        time.format = frame_format(value);
+    }
+    uint8_t enabled = 0;
+    int16_t fill_us = 0;
+    int16_t offset_us = 0;
+    uint64_t line_ns = 0;
+    uint16_t height = 0;
+    QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT8_ENABLE_PARTIAL_FRAME_READ, QVRCAMERA_PARAM_NUM_TYPE_UINT8,
+                                sizeof(enabled), (char*) &enabled);
+    QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_INT16_CAMERA_BUFFER_FILL_TIME_US, QVRCAMERA_PARAM_NUM_TYPE_INT16,
+                                sizeof(fill_us), (char*) &fill_us);
+    QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_INT16_CAMERA_BUFFER_FILL_TO_SOF_OFFSET_US,
+                                QVRCAMERA_PARAM_NUM_TYPE_INT16, sizeof(offset_us), (char*) &offset_us);
+    QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT64_LINE_READOUT_TIME, QVRCAMERA_PARAM_NUM_TYPE_UINT64,
+                                sizeof(line_ns), (char*) &line_ns);
+    QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT16_CAMERA_FRAME_HEIGHT, QVRCAMERA_PARAM_NUM_TYPE_UINT16,
+                                sizeof(height), (char*) &height);
+    time.fill_time_ns = (int64_t) fill_us * 1000;
+    time.fill_to_sof_offset_ns = (int64_t) offset_us * 1000;
+    // the buffer fill time spread over the rows where the sensor doesn't
+    // give its line time
+    time.line_ns = line_ns != 0 ? (int64_t) line_ns : height != 0 ? time.fill_time_ns / height : 0;
+    time.partial = enabled != 0 && cam->cam->api_version >= QVRCAMERACLIENT_API_VERSION_8 &&
+                   time.format != QVRCAMERA_FRAME_FORMAT_UNKNOWN && time.line_ns > 0;
+
+    uint32_t hz = CameraPipeline::max_rate_hz(cam);
+    time.period_ns = 1000000000LL / (hz != 0 ? hz : DEFAULT_RATE_HZ);
+
+    // band b ends at the fill level of (b + 1) / bands, rounded up to 5%
+    uint32_t n = time.partial ? cfg.bands : 1;
+    for (uint32_t b = 0; b < n; b++) {
+        uint32_t pct = (100 * (b + 1) + n - 1) / n;
+        band_fill[b] = (pct + 4) / 5 * 5;
+    }
+    partial_reads.store(time.partial);
+    num_bands.store(n);
+
+    __log_func(ANDROID_LOG_INFO, TAG, "camera %s: %s, %u bands, line %lld ns, fill offset %lld us", name,
+               time.partial ? "partial frame reads" : "full frame reads", n, (long long) time.line_ns,
+               (long long) offset_us);
+    return QVR_CAM_SUCCESS;
+}
+
+bool PartialFrameReader::start()
+{
+    if (cam == NULL || running())
+        return false;
+
+    quitting.store(false);
+    have_fn = false;
+    QVRCAMERA_CAMERA_STATUS state = QVRCAMERA_CAMERA_ERROR;
+    QVRCameraDevice_GetCameraState(cam, &state);
+    if (cfg.start && state != QVRCAMERA_CAMERA_STARTED) {
+        int32_t res = QVRCameraDevice_Start(cam);
+        if (res == QVR_CAM_SUCCESS)
+            started_camera = true;
+        else
+            __log_func(ANDROID_LOG_WARN, TAG, "start camera %s failed (%d), waiting for its master", name.c_str(),
+                       res);
+    }
+    if (cfg.sync) {
+        sync_ctrl = QVRCameraDevice_GetSyncCtrl(cam, QVR_SYNC_SOURCE_CAMERA_FRAME_CLIENT_READ);
+        if (sync_ctrl == NULL)
+            __log_func(ANDROID_LOG_WARN, TAG, "no sync ctrl for camera %s, blocking reads", name.c_str());
+    }
+    thread = std::thread(&PartialFrameReader::read_loop, this);
+    return true;
+}
+
+void PartialFrameReader::stop()
+{
+    if (!running())
+        return;
+
+    quitting.store(true);
+    thread.join();
+    if (sync_ctrl != NULL)
+        QVRCameraDevice_ReleaseSyncCtrl(cam, sync_ctrl);
+    sync_ctrl = NULL;
+    if (started_camera)
+        QVRCameraDevice_Stop(cam);
+    started_camera = false;
+}
+
+void PartialFrameReader::close()
+{
+    stop();
+    if (cam != NULL)
+        QVRCameraDevice_DetachCamera(cam);
+    cam = NULL;
+}
+
+PartialFrameReader::Stats PartialFrameReader::stats() const
+{
+    Stats s;
+    s.frames = frames.load();
+    s.dropped = dropped.load();
+    s.bands = bands.load();
+    s.late_bands = late_bands.load();
+    s.complete_frames = complete_frames.load();
+    s.errors = errors.load();
+    return s;
+}
+
+PartialFrameReader::Timing PartialFrameReader::timing() const
+{
+    Timing t = time;
+    t.partial = partial_reads.load(std::memory_order_relaxed);
+    return t;
+}
+
+uint32_t PartialFrameReader::band_end(uint32_t band, uint32_t height) const
+{
+    if (band + 1 >= num_bands.load(std::memory_order_relaxed))
+        return height;
+    uint32_t end = height * band_fill[band] / 100;
+    // whole chroma rows
+    return time.format == QVRCAMERA_FRAME_FORMAT_YUV420 ? end & ~1u : end;
+}
+
+void PartialFrameReader::read_loop()
+{
+    int64_t next = now_ns();
+    while (!quitting.load(std::memory_order_relaxed)) {
+        if (sync_ctrl != NULL) {
+            // the sync framework wants reads at a steady cadence
+            next += time.period_ns;
+            int64_t now = now_ns();
+            if (next < now - time.period_ns)
+                next = now;
+            sleep_until_ns(next);
+        }
+        if (partial_reads.load(std::memory_order_relaxed))
+            read_partial(sync_ctrl != NULL ? XR_CAMERA_BLOCK_MODE_QTI_NON_BLOCKING_SYNC
+                                           : XR_CAMERA_BLOCK_MODE_QTI_BLOCKING);
+        else
+            read_full(sync_ctrl != NULL ? QVRCAMERA_MODE_NON_BLOCKING_SYNC : QVRCAMERA_MODE_BLOCKING);
+    }
+}
+
+void PartialFrameReader::count_frame(uint32_t fn)
+{
+    if (have_fn && fn - last_fn > 1 && fn - last_fn < 0x80000000u)
+        dropped.fetch_add(fn - last_fn - 1, std::memory_order_relaxed);
+    have_fn = true;
+    last_fn = fn;
+    frames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PartialFrameReader::note_error(int32_t res, const char* call, bool blocking)
+{
+    if (res == QVR_CAM_DEVICE_NOT_STARTED) {
+        usleep(NOT_STARTED_RETRY_US);
+        return;
+    }
+    if (errors.fetch_add(1, std::memory_order_relaxed) == 0)
+        __log_func(ANDROID_LOG_WARN, TAG, "camera %s: %s failed (%d)", name.c_str(), call, res);
+    // blocking reads would spin on a persistent error
+    if (blocking)
+        usleep((useconds_t) (time.period_ns / 1000));
+}
+
+int32_t PartialFrameReader::confirm(uint32_t fn, uint32_t fill, XrCameraBlockModeQTI block, uint32_t* filled)
+{
+    XrCameraPartialFrameRequestInfoInputQTI partial_in;
+    partial_in.type = XR_TYPE_QTI_CAM_PARTIAL_FRAME_REQ_INFO_INPUT;
+    partial_in.next = NULL;
+    partial_in.fillPercentage = fill;
+    XrCameraFrameRequestInfoInputQTI in;
+    in.type = XR_TYPE_QTI_CAM_FRAME_REQ_INFO_INPUT;
+    in.next = (XrBaseStructQTI*) &partial_in;
+    in.frameNum = (int) fn;
+    in.blockMode = block;
+    in.dropMode = XR_CAMERA_DROP_MODE_QTI_EXPLICIT_FRAME_NUMBER;
+
+    XrCameraPartialFrameRequestInfoOutputQTI partial_out;
+    memset(&partial_out, 0, sizeof(partial_out));
+    partial_out.type = XR_TYPE_QTI_CAM_PARTIAL_FRAME_REQ_INFO_OUTPUT;
+    XrCameraHwBufferOutputQTI hw[FrameViews::MAX_VIEWS];
+    memset(hw, 0, sizeof(hw));
+    XrCameraFrameRequestInfoOutputQTI out;
+    memset(&out, 0, sizeof(out));
+    out.type = XR_TYPE_QTI_CAM_FRAME_REQ_INFO_OUTPUT;
+    out.next = (XrBaseStructQTI*) &partial_out;
+    out.hwBufferInfo.type = XR_TYPE_QTI_CAM_HW_FRAME_BUFFER_INFO_OUTPUT;
+    out.hwBufferInfo.hwBufferCapacityIn = FrameViews::MAX_VIEWS;
+    out.hwBufferInfo.hwBuffers = hw;
+
+    int32_t res = QVRCameraDevice_GetFrameEx(cam, &in, &out);
+    if (res != QVR_CAM_SUCCESS)
+        return res;
+    QVRCameraDevice_ReleaseFrame(cam, (int32_t) out.frameNum);
+    *filled = partial_out.frameType == XR_CAMERA_PARTIAL_FRAME_TYPE_QTI_REGULAR ? 100 : partial_out.fillPercentage;
+    return QVR_CAM_SUCCESS;
+}
+
+bool PartialFrameReader::read_partial(XrCameraBlockModeQTI block)
+{
+    XrCameraPartialFrameRequestInfoInputQTI partial_in;
+    partial_in.type = XR_TYPE_QTI_CAM_PARTIAL_FRAME_REQ_INFO_INPUT;
+    partial_in.next = NULL;
+    partial_in.fillPercentage = band_fill[0];
+    XrCameraFrameRequestInfoInputQTI in;
+    in.type = XR_TYPE_QTI_CAM_FRAME_REQ_INFO_INPUT;
+    in.next = (XrBaseStructQTI*) &partial_in;
+    in.frameNum = have_fn ? (int) (last_fn + 1) : 0;
+    in.blockMode = block;
+    in.dropMode = XR_CAMERA_DROP_MODE_QTI_NEWER_IF_AVAILABLE;
+
+    XrCameraPartialFrameRequestInfoOutputQTI partial_out;
+    memset(&partial_out, 0, sizeof(partial_out));
+    partial_out.type = XR_TYPE_QTI_CAM_PARTIAL_FRAME_REQ_INFO_OUTPUT;
+    XrCameraHwBufferOutputQTI hw[FrameViews::MAX_VIEWS];
+    memset(hw, 0, sizeof(hw));
+    for (XrCameraHwBufferOutputQTI& h : hw)
+        h.type = XR_TYPE_QTI_CAM_HW_BUFFER_OUTPUT;
+    XrCameraFrameRequestInfoOutputQTI out;
+    memset(&out, 0, sizeof(out));
+    out.type = XR_TYPE_QTI_CAM_FRAME_REQ_INFO_OUTPUT;
+    out.next = (XrBaseStructQTI*) &partial_out;
+    out.frameInfo.type = XR_TYPE_QTI_CAM_FRAME_INFO_OUTPUT;
+    out.bufferInfo.type = XR_TYPE_QTI_CAM_FRAME_BUFFER_INFO_OUTPUT;
+    out.hwBufferInfo.type = XR_TYPE_QTI_CAM_HW_FRAME_BUFFER_INFO_OUTPUT;
+    out.hwBufferInfo.hwBufferCapacityIn = FrameViews::MAX_VIEWS;
+    out.hwBufferInfo.hwBuffers = hw;
+
+    int32_t res = QVRCameraDevice_GetFrameEx(cam, &in, &out);
+    if (res == QVR_CAM_FUTURE_FRAMENUMBER && block == XR_CAMERA_BLOCK_MODE_QTI_NON_BLOCKING_SYNC) {
+        // the band is due about now; skipping to the next read would drop
+        // the frame
+        in.blockMode = XR_CAMERA_BLOCK_MODE_QTI_BLOCKING;
+        res = QVRCameraDevice_GetFrameEx(cam, &in, &out);
+    }
+    if (res == QVR_CAM_PARTIAL_FRAME_NOT_ENABLED || res == QVR_CAM_API_NOT_SUPPORTED) {
+        __log_func(ANDROID_LOG_WARN, TAG, "camera %s: no partial frame reads (%d), reading full frames",
+                   name.c_str(), res);
+        num_bands.store(1, std::memory_order_relaxed);
+        partial_reads.store(false, std::memory_order_relaxed);
+        return false;
+    }
+    if (res != QVR_CAM_SUCCESS) {
+        note_error(res, "GetFrameEx", block == XR_CAMERA_BLOCK_MODE_QTI_BLOCKING);
+        return false;
+    }
+
+    uint32_t fn = out.frameNum;
+    count_frame(fn);
+    uint32_t filled = partial_out.frameType == XR_CAMERA_PARTIAL_FRAME_TYPE_QTI_REGULAR ? 100
+                                                                                        : partial_out.fillPercentage;
+    if (filled == 100)
+        complete_frames.fetch_add(1, std::memory_order_relaxed);
+
+    bool ok = views.from_hw_buffer_outputs(hw, out.hwBufferInfo.hwBufferCount, time.format) > 0;
+    if (ok) {
+        int64_t boot_offset = now_ns(CLOCK_BOOTTIME) - now_ns();
+        int64_t fill_start = (int64_t) out.frameInfo.startOfExposureNs - boot_offset + time.fill_to_sof_offset_ns;
+        uint32_t height = views.view(0).height;
+        uint32_t first = 0;
+        uint32_t count = num_bands.load(std::memory_order_relaxed);
+        for (uint32_t b = 0; b < count && ok && !quitting.load(std::memory_order_relaxed); b++) {
+            uint32_t end = band_end(b, height);
+            int64_t due = fill_start + (int64_t) end * time.line_ns;
+            if (filled < band_fill[b]) {
+                sleep_until_ns(due);
+                res = confirm(fn, band_fill[b], XR_CAMERA_BLOCK_MODE_QTI_NON_BLOCKING, &filled);
+                if (res == QVR_CAM_FUTURE_FRAMENUMBER) {
+                    late_bands.fetch_add(1, std::memory_order_relaxed);
+                    res = confirm(fn, band_fill[b], XR_CAMERA_BLOCK_MODE_QTI_BLOCKING, &filled);
+                }
+                if (res != QVR_CAM_SUCCESS) {
+                    note_error(res, "GetFrameEx", false);
+                    ok = false;
+                    break;
+                }
+            }
+
+            Band band;
+            band.fn = fn;
+            band.index = b;
+            band.count = count;
+            band.first_row = first;
+            band.end_row = end;
+            band.views = &views;
+            band.sof_ns = out.frameInfo.startOfExposureNs;
+            band.due_ns = due;
+            band.delivered_ns = now_ns();
+            band.partial = filled < 100;
+            if (callback)
+                callback(band);
+            bands.fetch_add(1, std::memory_order_relaxed);
+            first = end;
+        }
+    } else {
+        note_error(QVR_CAM_ERROR, "hardware buffer views", false);
+    }
+    views.reset();
+    QVRCameraDevice_ReleaseFrame(cam, (int32_t) fn);
+    return ok;
+}
+
+bool PartialFrameReader::read_full(QVRCAMERA_BLOCK_MODE block)
+{
+    qvrcamera_frame_t frame;
+    int32_t want = have_fn ? (int32_t) (last_fn + 1) : 0;
+    int32_t fn = want;
+    int32_t res = QVRCameraDevice_GetFrame(cam, &fn, block, QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &frame);
+    if (res == QVR_CAM_FUTURE_FRAMENUMBER && block == QVRCAMERA_MODE_NON_BLOCKING_SYNC) {
+        fn = want;
+        res = QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &frame);
+    }
+    if (res != QVR_CAM_SUCCESS) {
+        note_error(res, "GetFrame", block == QVRCAMERA_MODE_BLOCKING);
+        return false;
+    }
+
+    count_frame(frame.fn);
+    complete_frames.fetch_add(1, std::memory_order_relaxed);
+    bool ok = views.from_frame(frame, FrameViews::Layout()) > 0;
+    if (ok) {
+        int64_t boot_offset = now_ns(CLOCK_BOOTTIME) - now_ns();
+        Band band;
+        band.fn = frame.fn;
+        band.index = 0;
+        band.count = 1;
+        band.first_row = 0;
+        band.end_row = frame.height;
+        band.views = &views;
+        band.sof_ns = frame.start_of_exposure_ts;
+        band.due_ns = (int64_t) frame.start_of_exposure_ts - boot_offset + time.fill_to_sof_offset_ns +
+                      time.fill_time_ns;
+        band.delivered_ns = now_ns();
+        band.partial = false;
+        if (callback)
+            callback(band);
+        bands.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        note_error(QVR_CAM_ERROR, "frame views", false);
+    }
+    views.reset();
+    QVRCameraDevice_ReleaseFrame(cam, fn);
+    return ok;
+}
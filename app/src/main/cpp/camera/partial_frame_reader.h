@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "camera/frame_views.h"
+#include "qvr/inc/QVRCameraClient.h"
+
+// Reads one camera's frames band by band while the sensor reads them out.
+// With QVR_CAMDEVICE_UINT8_ENABLE_PARTIAL_FRAME_READ, GetFrameEx() hands out
+// a frame once its buffer is filled to the first band; the rest of the rows
+// land at the line rate, starting FILL_TO_SOF_OFFSET_US after start of
+// exposure. The reader sleeps until each band is due by that timing, then
+// confirms it with a GetFrameEx() for the band's fill level, which returns
+// at once when the timing holds, and passes the band on. Work on the top of
+// the image so starts about a readout before GetFrame() would give the frame.
+//
+// Cameras without partial reads (or API < 8) are read with GetFrame() and
+// give one band of all rows per frame.
+class PartialFrameReader {
+public:
+    // fill levels come in steps of 5%
+    static const uint32_t MAX_BANDS = 20;
+
+    struct Band {
+        uint32_t fn;
+        uint32_t index;
+        uint32_t count;
+        // rows valid in every view, chroma rows [first_row / 2, end_row / 2)
+        // of YUV420; the rows before first_row came with the earlier bands
+        uint32_t first_row;
+        uint32_t end_row;
+        // one view per hardware buffer, or the GetFrame() image
+        const FrameViews* views;
+        // BOOTTIME start of exposure from the frame info, the same for
+        // every band of the frame
+        uint64_t sof_ns;
+        // MONOTONIC, when the rows were due by the readout timing and when
+        // the band went out
+        int64_t due_ns;
+        int64_t delivered_ns;
+        // the frame was still filling
+        bool partial;
+    };
+
+    // Runs on the reader thread, which reads on once it returns. The views
+    // are valid during the call only.
+    typedef std::function<void(const Band&)> BandCallback;
+
+    struct Config {
+        // bands per frame, up to MAX_BANDS
+        uint32_t bands = 4;
+        // read the first band with XR_CAMERA_BLOCK_MODE_QTI_NON_BLOCKING_SYNC
+        // at the camera rate, so the service times it to the reads
+        bool sync = true;
+        bool start = true;
+    };
+
+    // from the camera params at attach()
+    struct Timing {
+        // false too once the camera refused a partial read
+        bool partial;
+        uint32_t format;
+        // start of exposure to the first row landing, and the rows landing
+        int64_t fill_to_sof_offset_ns;
+        int64_t fill_time_ns;
+        int64_t line_ns;
+        int64_t period_ns;
+    };
+
+    struct Stats {
+        uint64_t frames;
+        uint64_t dropped;
+        uint64_t bands;
+        // bands whose rows weren't there yet at their due time
+        uint64_t late_bands;
+        // partial reads that got a complete frame
+        uint64_t complete_frames;
+        uint64_t errors;
+    };
+
+    PartialFrameReader();
+    ~PartialFrameReader();
+
+    PartialFrameReader(const PartialFrameReader&) = delete;
+    PartialFrameReader& operator=(const PartialFrameReader&) = delete;
+
+    // QVR_CAM_SUCCESS or a QVR_CAM_* error
+    int attach(qvrcamera_client_helper_t* client, const char* name);
+    int attach(qvrcamera_client_helper_t* client, const char* name, const Config& config);
+    // before start()
+    void set_callback(BandCallback cb) { callback = std::move(cb); }
+
+    bool start();
+    void stop();
+    // stop() and detach
+    void close();
+    bool running() const { return thread.joinable(); }
+
+    // a copy, the reader thread may fall back to full frames meanwhile
+    Timing timing() const;
+    bool synced() const { return sync_ctrl != NULL; }
+    qvrcamera_device_helper_t* camera() const { return cam; }
+    Stats stats() const;
+
+private:
+    void read_loop();
+    bool read_partial(XrCameraBlockModeQTI block);
+    bool read_full(QVRCAMERA_BLOCK_MODE block);
+    // GetFrameEx() of frame fn filled to fill percent, the lock released
+    // again; filled gets the level reached
+    int32_t confirm(uint32_t fn, uint32_t fill, XrCameraBlockModeQTI block, uint32_t* filled);
+    void count_frame(uint32_t fn);
+    void note_error(int32_t res, const char* call, bool blocking);
+    // row band ends at, the rows filled at band_fill[band]
+    uint32_t band_end(uint32_t band, uint32_t height) const;
+
+    std::string name;
+    Config cfg;
+    qvrcamera_device_helper_t* cam;
+    qvrsync_ctrl_t* sync_ctrl;
+    bool started_camera;
+    Timing time;
+    BandCallback callback;
+    FrameViews views;
+    uint32_t band_fill[MAX_BANDS];
+    // the reader thread drops to one band of full frames when partial reads
+    // fail; timing() reads partial_reads from other threads
+    std::atomic<bool> partial_reads;
+    std::atomic<uint32_t> num_bands;
+
+    bool have_fn;
+    uint32_t last_fn;
+
+    std::atomic<bool> quitting;
+    std::thread thread;
+
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> bands;
+    std::atomic<uint64_t> late_bands;
+    std::atomic<uint64_t> complete_frames;
+    std::atomic<uint64_t> errors;
+};
@@ -0,0 +1,377 @@
+#include "camera/raw_unpacker.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "simd.h"
+
+// the gamma LUT takes this many of the top bits of a value
+#define LUT_BITS 10
+#define LUT_SIZE (1 << LUT_BITS)
+// pixels per pass through the stack buffer for the LUT and float paths
+#define CHUNK 512
+
+static inline uint32_t raw10_offset(uint32_t x)
+{
+    return x / 4 * 5;
+}
+
+static inline uint16_t raw16_at(const uint8_t* in, uint32_t x)
+{
+    uint16_t v;
+    memcpy(&v, in + 2 * x, sizeof(v));
+    return v;
+}
+
+#if defined(HOLDER_HAVE_SIMD)
+
+// The vector loops take 16 pixels (4 groups, 20 bytes) at a time with 8 byte
+// loads that reach 3 bytes past the last group, and leave the rest of the
+// row to the scalar loops. They return the pixels done.
+static uint32_t raw10_to_y8_simd(const uint8_t* in, uint32_t n, uint32_t in_bytes, uint8_t* out)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= n && raw10_offset(x) + 23 <= in_bytes; x += 16) {
+        const uint8_t* p = in + raw10_offset(x);
+#if defined(HOLDER_SIMD_NEON)
+        uint32x2x2_t ab = vzip_u32(vreinterpret_u32_u8(vld1_u8(p)), vreinterpret_u32_u8(vld1_u8(p + 5)));
+        uint32x2x2_t cd = vzip_u32(vreinterpret_u32_u8(vld1_u8(p + 10)), vreinterpret_u32_u8(vld1_u8(p + 15)));
+        vst1q_u8(out + x, vreinterpretq_u8_u32(vcombine_u32(ab.val[0], cd.val[0])));
+#else
+        // 32 bit interleave puts the upper bytes of two groups side by side
+        __m128i ab = _mm_unpacklo_epi32(_mm_loadl_epi64((const __m128i*) p), _mm_loadl_epi64((const __m128i*) (p + 5)));
+        __m128i cd = _mm_unpacklo_epi32(_mm_loadl_epi64((const __m128i*) (p + 10)),
+                                        _mm_loadl_epi64((const __m128i*) (p + 15)));
+        _mm_storeu_si128((__m128i*) (out + x), _mm_unpacklo_epi64(ab, cd));
+#endif
+    }
+    return x;
+}
+
+static uint32_t raw10_to_u16_simd(const uint8_t* in, uint32_t n, uint32_t in_bytes, uint16_t* out)
+{
+    uint32_t x = 0;
+#if defined(HOLDER_SIMD_NEON)
+    static const int16_t shifts[8] = { 0, -2, -4, -6, 0, -2, -4, -6 };
+    int16x8_t shift = vld1q_s16(shifts);
+    uint16x8_t three = vdupq_n_u16(3);
+#else
+    __m128i mul = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+    __m128i three = _mm_set1_epi16(3);
+    __m128i low_byte = _mm_set1_epi32(0xff);
+    __m128i zero = _mm_setzero_si128();
+#endif
+    for (; x + 16 <= n && raw10_offset(x) + 23 <= in_bytes; x += 16) {
+        const uint8_t* p = in + raw10_offset(x);
+#if defined(HOLDER_SIMD_NEON)
+        uint32x2x2_t ab = vzip_u32(vreinterpret_u32_u8(vld1_u8(p)), vreinterpret_u32_u8(vld1_u8(p + 5)));
+        uint32x2x2_t cd = vzip_u32(vreinterpret_u32_u8(vld1_u8(p + 10)), vreinterpret_u32_u8(vld1_u8(p + 15)));
+        uint8x16_t hi = vreinterpretq_u8_u32(vcombine_u32(ab.val[0], cd.val[0]));
+        // fifth byte of each group, repeated for its 4 pixels
+        uint16x4_t lo = vmovn_u32(vandq_u32(vcombine_u32(ab.val[1], cd.val[1]), vdupq_n_u32(0xff)));
+        uint16x4x2_t pairs = vzip_u16(lo, lo);
+        uint16x4x2_t lo01 = vzip_u16(pairs.val[0], pairs.val[0]);
+        uint16x4x2_t lo23 = vzip_u16(pairs.val[1], pairs.val[1]);
+        uint16x8_t low0 = vandq_u16(vshlq_u16(vcombine_u16(lo01.val[0], lo01.val[1]), shift), three);
+        uint16x8_t low1 = vandq_u16(vshlq_u16(vcombine_u16(lo23.val[0], lo23.val[1]), shift), three);
+        vst1q_u16(out + x, vorrq_u16(vshlq_n_u16(vmovl_u8(vget_low_u8(hi)), 2), low0));
+        vst1q_u16(out + x + 8, vorrq_u16(vshlq_n_u16(vmovl_u8(vget_high_u8(hi)), 2), low1));
+#else
+        __m128i ab = _mm_unpacklo_epi32(_mm_loadl_epi64((const __m128i*) p), _mm_loadl_epi64((const __m128i*) (p + 5)));
+        __m128i cd = _mm_unpacklo_epi32(_mm_loadl_epi64((const __m128i*) (p + 10)),
+                                        _mm_loadl_epi64((const __m128i*) (p + 15)));
+        __m128i hi = _mm_unpacklo_epi64(ab, cd);
+        // fifth byte of each group, repeated for its 4 pixels; lane i of a
+        // group shifts it by 6 - 2i up, then all by 6 down
+        __m128i lo = _mm_and_si128(_mm_unpackhi_epi64(ab, cd), low_byte);
+        lo = _mm_or_si128(lo, _mm_slli_epi32(lo, 16));
+        __m128i low0 = _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi32(lo, lo), mul), 6), three);
+        __m128i low1 = _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi32(lo, lo), mul), 6), three);
+        _mm_storeu_si128((__m128i*) (out + x), _mm_or_si128(_mm_slli_epi16(_mm_unpacklo_epi8(hi, zero), 2), low0));
+        _mm_storeu_si128((__m128i*) (out + x + 8), _mm_or_si128(_mm_slli_epi16(_mm_unpackhi_epi8(hi, zero), 2), low1));
+#endif
+    }
+    return x;
+}
+
+static uint32_t raw16_to_y8_simd(const uint8_t* in, uint32_t n, uint32_t shift, uint8_t* out)
+{
+    uint32_t x = 0;
+#if defined(HOLDER_SIMD_NEON)
+    int16x8_t s = vdupq_n_s16(-(int16_t) shift);
+    for (; x + 16 <= n; x += 16) {
+        uint16x8_t v0 = vshlq_u16(vreinterpretq_u16_u8(vld1q_u8(in + 2 * x)), s);
+        uint16x8_t v1 = vshlq_u16(vreinterpretq_u16_u8(vld1q_u8(in + 2 * x + 16)), s);
+        vst1q_u8(out + x, vcombine_u8(vqmovn_u16(v0), vqmovn_u16(v1)));
+    }
+#else
+    // shift >= 2 keeps the values positive for the signed saturation
+    __m128i s = _mm_cvtsi32_si128((int) shift);
+    for (; x + 16 <= n; x += 16) {
+        __m128i v0 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*) (in + 2 * x)), s);
+        __m128i v1 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*) (in + 2 * x + 16)), s);
+        _mm_storeu_si128((__m128i*) (out + x), _mm_packus_epi16(v0, v1));
+    }
+#endif
+    return x;
+}
+
+// little endian 16 bit values, unaligned
+static uint32_t u16_to_float_simd(const uint8_t* in, uint32_t n, float scale, float* out)
+{
+    uint32_t x = 0;
+#if defined(HOLDER_SIMD_NEON)
+    float32x4_t k = vdupq_n_f32(scale);
+    for (; x + 8 <= n; x += 8) {
+        uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(in + 2 * x));
+        vst1q_f32(out + x, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))), k));
+        vst1q_f32(out + x + 4, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))), k));
+    }
+#else
+    __m128 k = _mm_set1_ps(scale);
+    __m128i zero = _mm_setzero_si128();
+    for (; x + 8 <= n; x += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + 2 * x));
+        _mm_storeu_ps(out + x, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), k));
+        _mm_storeu_ps(out + x + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), k));
+    }
+#endif
+    return x;
+}
+
+#endif
+
+// n pixels of a RAW10 row starting at a group, in_bytes readable from in
+static void raw10_to_y8(const uint8_t* in, uint32_t n, uint32_t in_bytes, uint8_t* out, bool simd)
+{
+    uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+    if (simd)
+        x = raw10_to_y8_simd(in, n, in_bytes, out);
+#else
+    (void) in_bytes;
+    (void) simd;
+#endif
+    for (; x < n; x++)
+        out[x] = in[raw10_offset(x) + x % 4];
+}
+
+static void raw10_to_u16(const uint8_t* in, uint32_t n, uint32_t in_bytes, uint16_t* out, bool simd)
+{
+    uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+    if (simd)
+        x = raw10_to_u16_simd(in, n, in_bytes, out);
+#else
+    (void) in_bytes;
+    (void) simd;
+#endif
+    for (; x < n; x++) {
+        const uint8_t* g = in + raw10_offset(x);
+        out[x] = (uint16_t) ((g[x % 4] << 2) | ((g[4] >> (2 * (x % 4))) & 3));
+    }
+}
+
+static void u16_to_float(const uint8_t* in, uint32_t n, float scale, float* out, bool simd)
+{
+    uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+    if (simd)
+        x = u16_to_float_simd(in, n, scale, out);
+#else
+    (void) simd;
+#endif
+    for (; x < n; x++)
+        out[x] = (float) raw16_at(in, x) * scale;
+}
+
+RawUnpacker::RawUnpacker()
+    : kernel(KERNEL_SIMD)
+{
+    set_config(Config());
+}
+
+RawUnpacker::RawUnpacker(const Config& config)
+    : kernel(KERNEL_SIMD)
+{
+    set_config(config);
+}
+
+void RawUnpacker::set_config(const Config& config)
+{
+    cfg = config;
+    cfg.raw16_bits = std::max(10u, std::min(16u, cfg.raw16_bits));
+    use_lut = cfg.gamma > 0.0f && fabsf(cfg.gamma - 1.0f) > 1e-6f;
+    lut8.clear();
+    lut16.clear();
+    lutf.clear();
+    if (!use_lut)
+        return;
+
+    float inv_gamma = 1.0f / cfg.gamma;
+    for (int i = 0; i < LUT_SIZE; i++) {
+        float v = powf((float) i / (LUT_SIZE - 1), inv_gamma);
+        if (cfg.output == OUTPUT_Y8)
+            lut8.push_back((uint8_t) (v * 255.0f + 0.5f));
+        else if (cfg.output == OUTPUT_Y16)
+            lut16.push_back((uint16_t) (v * 65535.0f + 0.5f));
+        else
+            lutf.push_back(v);
+    }
+}
+
+bool RawUnpacker::simd_available()
+{
+#if defined(HOLDER_HAVE_SIMD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+RawUnpacker::Kernel RawUnpacker::active_kernel() const
+{
+    return kernel == KERNEL_SIMD && simd_available() ? KERNEL_SIMD : KERNEL_SCALAR;
+}
+
+uint32_t RawUnpacker::row_bytes(uint32_t format, uint32_t width)
+{
+    if (format == QVRCAMERA_FRAME_FORMAT_RAW10_MONO)
+        return (width + 3) / 4 * 5;
+    if (format == QVRCAMERA_FRAME_FORMAT_RAW16_MONO)
+        return width * 2;
+    return 0;
+}
+
+size_t RawUnpacker::output_size(Output output)
+{
+    switch (output) {
+        case OUTPUT_Y8:
+            return 1;
+        case OUTPUT_Y16:
+            return 2;
+        default:
+            return sizeof(float);
+    }
+}
+
+int RawUnpacker::split(const qvrcamera_frame_t& frame, Image out[MAX_IMAGES])
+{
+    uint32_t rb = row_bytes(frame.format, frame.width);
+    if (rb == 0 || frame.buffer == NULL || frame.height == 0)
+        return 0;
+
+    const uint8_t* data = (const uint8_t*) frame.buffer;
+    bool dual = frame.secondary_width != 0 && frame.secondary_height != 0;
+    out[0].data = data;
+    out[0].width = frame.width;
+    out[0].height = frame.height;
+    out[0].pitch = !dual && frame.stride >= rb ? frame.stride : rb;
+    out[0].format = frame.format;
+    uint64_t need = (uint64_t) out[0].pitch * (frame.height - 1) + rb;
+    if (!dual)
+        return frame.len >= need ? 1 : 0;
+
+    uint32_t rb2 = row_bytes(frame.format, frame.secondary_width);
+    out[1].data = data + (size_t) rb * frame.height;
+    out[1].width = frame.secondary_width;
+    out[1].height = frame.secondary_height;
+    out[1].pitch = rb2;
+    out[1].format = frame.format;
+    need = (uint64_t) rb * frame.height + (uint64_t) rb2 * frame.secondary_height;
+    return frame.len >= need ? 2 : 0;
+}
+
+bool RawUnpacker::unpack(const Image& in, void* out, size_t out_pitch) const
+{
+    uint32_t rb = row_bytes(in.format, in.width);
+    if (rb == 0 || in.pitch < rb || out_pitch < in.width * output_size(cfg.output))
+        return false;
+
+    for (uint32_t y = 0; y < in.height; y++) {
+        const uint8_t* src = in.data + (size_t) y * in.pitch;
+        void* dst = (uint8_t*) out + y * out_pitch;
+        if (in.format == QVRCAMERA_FRAME_FORMAT_RAW10_MONO)
+            row_raw10(src, in.width, dst);
+        else
+            row_raw16(src, in.width, dst);
+    }
+    return true;
+}
+
+void RawUnpacker::apply_lut(const uint16_t* v, uint32_t n, uint32_t shift, void* out) const
+{
+    if (cfg.output == OUTPUT_Y8) {
+        uint8_t* o = (uint8_t*) out;
+        for (uint32_t x = 0; x < n; x++)
+            o[x] = lut8[std::min(v[x] >> shift, LUT_SIZE - 1)];
+    } else if (cfg.output == OUTPUT_Y16) {
+        uint16_t* o = (uint16_t*) out;
+        for (uint32_t x = 0; x < n; x++)
+            o[x] = lut16[std::min(v[x] >> shift, LUT_SIZE - 1)];
+    } else {
+        float* o = (float*) out;
+        for (uint32_t x = 0; x < n; x++)
+            o[x] = lutf[std::min(v[x] >> shift, LUT_SIZE - 1)];
+    }
+}
+
+void RawUnpacker::row_raw10(const uint8_t* in, uint32_t width, void* out) const
+{
+    bool simd = active_kernel() == KERNEL_SIMD;
+    uint32_t in_bytes = row_bytes(QVRCAMERA_FRAME_FORMAT_RAW10_MONO, width);
+    if (!use_lut && cfg.output == OUTPUT_Y8) {
+        raw10_to_y8(in, width, in_bytes, (uint8_t*) out, simd);
+        return;
+    }
+    if (!use_lut && cfg.output == OUTPUT_Y16) {
+        raw10_to_u16(in, width, in_bytes, (uint16_t*) out, simd);
+        return;
+    }
+
+    // through native values a chunk at a time; CHUNK is whole groups
+    uint16_t v[CHUNK];
+    size_t px = output_size(cfg.output);
+    for (uint32_t x = 0; x < width; x += CHUNK) {
+        uint32_t n = std::min((uint32_t) CHUNK, width - x);
+        raw10_to_u16(in + raw10_offset(x), n, in_bytes - raw10_offset(x), v, simd);
+        void* o = (uint8_t*) out + x * px;
+        if (use_lut)
+            apply_lut(v, n, 0, o);
+        else
+            u16_to_float((const uint8_t*) v, n, 1.0f / 1023.0f, (float*) o, simd);
+    }
+}
+
+void RawUnpacker::row_raw16(const uint8_t* in, uint32_t width, void* out) const
+{
+    bool simd = active_kernel() == KERNEL_SIMD;
+    uint32_t bits = cfg.raw16_bits;
+    if (use_lut) {
+        uint16_t v[CHUNK];
+        size_t px = output_size(cfg.output);
+        for (uint32_t x = 0; x < width; x += CHUNK) {
+            uint32_t n = std::min((uint32_t) CHUNK, width - x);
+            memcpy(v, in + 2 * x, n * 2);
+            apply_lut(v, n, bits - LUT_BITS, (uint8_t*) out + x * px);
+        }
+        return;
+    }
+
+    if (cfg.output == OUTPUT_Y16) {
+        memcpy(out, in, width * 2);
+    } else if (cfg.output == OUTPUT_FLOAT) {
+        u16_to_float(in, width, 1.0f / (float) ((1u << bits) - 1), (float*) out, simd);
+    } else {
+        uint8_t* o = (uint8_t*) out;
+        uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+        if (simd)
+            x = raw16_to_y8_simd(in, width, bits - 8, o);
+#endif
+        for (; x < width; x++)
+            o[x] = (uint8_t) std::min(raw16_at(in, x) >> (bits - 8), 255);
+    }
+}
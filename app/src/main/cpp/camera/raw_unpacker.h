@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "qvr/inc/QVRCameraClient.h"
+
+// Converts QVRCAMERA_FRAME_FORMAT_RAW10_MONO and RAW16_MONO frames to Y8,
+// 16-bit or float images. RAW10 is MIPI packed: every 5 bytes hold 4
+// pixels, the first 4 bytes their upper 8 bits and the fifth byte the low 2
+// bits of each, pixel 0 in bits 0-1.
+//
+// Without a gamma curve Y8 is the upper 8 bits, Y16 the sensor value as is
+// (0-1023 for RAW10) and float the value scaled to 0-1. A gamma curve maps
+// the top 10 bits of the value through a LUT instead, to the full range of
+// the output (0-65535 for Y16).
+class RawUnpacker {
+public:
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SIMD,
+    };
+
+    enum Output {
+        OUTPUT_Y8,
+        OUTPUT_Y16,
+        OUTPUT_FLOAT,
+    };
+
+    static const int MAX_IMAGES = 2;
+
+    // one crop of a frame
+    struct Image {
+        const uint8_t* data;
+        uint32_t width;
+        uint32_t height;
+        // bytes from one row to the next
+        uint32_t pitch;
+        // QVRCAMERA_FRAME_FORMAT
+        uint32_t format;
+    };
+
+    struct Config {
+        Output output = OUTPUT_Y8;
+        // out = in^(1/gamma); 1 skips the LUT
+        float gamma = 1.0f;
+        // significant bits of RAW16 samples, 10-16
+        uint32_t raw16_bits = 16;
+    };
+
+    RawUnpacker();
+    explicit RawUnpacker(const Config& config);
+
+    void set_config(const Config& config);
+    const Config& config() const { return cfg; }
+
+    // KERNEL_SIMD falls back to scalar when the build has no vector unit
+    void set_kernel(Kernel k) { kernel = k; }
+    Kernel active_kernel() const;
+    static bool simd_available();
+
+    // Splits a frame into its crops, returns how many (0 for formats other
+    // than RAW10/RAW16 or a buffer shorter than the layout). A single image
+    // has rows stride bytes apart when the frame sets one; dual crops are
+    // back to back with packed rows, as the stride reported for them spans
+    // both widths.
+    static int split(const qvrcamera_frame_t& frame, Image out[MAX_IMAGES]);
+    // packed bytes of one row
+    static uint32_t row_bytes(uint32_t format, uint32_t width);
+    static size_t output_size(Output output);
+
+    // in to out, rows out_pitch bytes apart; false for unsupported formats
+    bool unpack(const Image& in, void* out, size_t out_pitch) const;
+
+private:
+    void row_raw10(const uint8_t* in, uint32_t width, void* out) const;
+    void row_raw16(const uint8_t* in, uint32_t width, void* out) const;
+    // native values, shifted down to LUT_BITS, through the gamma LUT
+    void apply_lut(const uint16_t* v, uint32_t n, uint32_t shift, void* out) const;
+
+    Config cfg;
+    Kernel kernel;
+    bool use_lut;
+    std::vector<uint8_t> lut8;
+    std::vector<uint16_t> lut16;
+    std::vector<float> lutf;
+};
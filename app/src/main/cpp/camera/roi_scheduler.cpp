@@ -0,0 +1,447 @@
+#include "camera/roi_scheduler.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "qvr/inc/QVRCameraDeviceParam.h"
+#include "holder_log.h"
+
+// sent crops frames may still not show, oldest dropped first
+#define MAX_PENDING 4
+
+namespace {
+
+typedef RoiScheduler::Rect Rect;
+typedef RoiScheduler::Mapping Mapping;
+
+uint64_t area(const Rect& r)
+{
+    return (uint64_t) r.width * r.height;
+}
+
+Rect unite(const Rect& a, const Rect& b)
+{
+    Rect r;
+    r.x = std::min(a.x, b.x);
+    r.y = std::min(a.y, b.y);
+    r.width = std::max(a.x + a.width, b.x + b.width) - r.x;
+    r.height = std::max(a.y + a.height, b.y + b.height) - r.y;
+    return r;
+}
+
+bool overlap(const Rect& a, const Rect& b)
+{
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+bool contains(const Rect& outer, const Rect& inner)
+{
+    return inner.x >= outer.x && inner.y >= outer.y && inner.x + inner.width <= outer.x + outer.width &&
+           inner.y + inner.height <= outer.y + outer.height;
+}
+
+bool same_sizes(const Mapping& a, const Mapping& b)
+{
+    if (a.num_crops != b.num_crops)
+        return false;
+    for (uint32_t i = 0; i < a.num_crops; i++) {
+        if (a.crops[i].width != b.crops[i].width || a.crops[i].height != b.crops[i].height)
+            return false;
+    }
+    return true;
+}
+
+// bytes per pixel of the formats crops suit, 0 for others
+uint32_t pixel_bytes(uint32_t format)
+{
+    switch (format) {
+        case QVRCAMERA_FRAME_FORMAT_Y8:
+            return 1;
+        case QVRCAMERA_FRAME_FORMAT_DEPTH16:
+        case QVRCAMERA_FRAME_FORMAT_RAW16_MONO:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+}
+
+RoiScheduler::RoiScheduler()
+    : camera(NULL)
+    , frame_width(0)
+    , frame_height(0)
+    , rois()
+    , used()
+    , changed(false)
+    , current()
+    , sent()
+    , st()
+{
+}
+
+RoiScheduler::RoiScheduler(const Config& config)
+    : RoiScheduler()
+{
+    set_config(config);
+}
+
+void RoiScheduler::set_config(const Config& config)
+{
+    cfg = config;
+    cfg.align_x = std::max(cfg.align_x, 1u);
+    cfg.align_y = std::max(cfg.align_y, 1u);
+    std::lock_guard<std::mutex> l(lock);
+    changed = true;
+}
+
+int32_t RoiScheduler::attach(qvrcamera_device_helper_t* cam)
+{
+    if (cam == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    uint16_t width = 0, height = 0;
+    int32_t res = QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT16_CAMERA_FRAME_WIDTH,
+                                              QVRCAMERA_PARAM_NUM_TYPE_UINT16, sizeof(width), (char*) &width);
+    if (res == QVR_CAM_SUCCESS)
+        res = QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT16_CAMERA_FRAME_HEIGHT,
+                                          QVRCAMERA_PARAM_NUM_TYPE_UINT16, sizeof(height), (char*) &height);
+    if (res != QVR_CAM_SUCCESS || width == 0 || height == 0) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "roi scheduler: no frame size: %d", res);
+        return res != QVR_CAM_SUCCESS ? res : QVR_CAM_ERROR;
+    }
+
+    camera = cam;
+    frame_width = width;
+    frame_height = height;
+    current = Mapping();
+    sent = Mapping();
+    pending.clear();
+    st = Stats();
+    std::lock_guard<std::mutex> l(lock);
+    for (int i = 0; i < MAX_ROIS; i++) {
+        if (used[i])
+            rois[i] = clip(rois[i]);
+    }
+    changed = true;
+    return QVR_CAM_SUCCESS;
+}
+
+void RoiScheduler::detach()
+{
+    if (camera != NULL && (sent.num_crops != 0 || !pending.empty()))
+        QVRCameraDevice_SetCropRegion(camera, 0, 0, 0, 0, 0, 0, 0, 0);
+    camera = NULL;
+    pending.clear();
+}
+
+RoiScheduler::Rect RoiScheduler::clip(const Rect& roi) const
+{
+    if (frame_width == 0)
+        return roi;
+    Rect r;
+    r.x = std::min(roi.x, frame_width);
+    r.y = std::min(roi.y, frame_height);
+    r.width = std::min(roi.width, frame_width - r.x);
+    r.height = std::min(roi.height, frame_height - r.y);
+    return r;
+}
+
+int RoiScheduler::add(const Rect& roi)
+{
+    std::lock_guard<std::mutex> l(lock);
+    for (int i = 0; i < MAX_ROIS; i++) {
+        if (!used[i]) {
+            used[i] = true;
+            rois[i] = clip(roi);
+            changed = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool RoiScheduler::move(int id, const Rect& roi)
+{
+    std::lock_guard<std::mutex> l(lock);
+    if (id < 0 || id >= MAX_ROIS || !used[id])
+        return false;
+    rois[id] = clip(roi);
+    changed = true;
+    return true;
+}
+
+void RoiScheduler::remove(int id)
+{
+    std::lock_guard<std::mutex> l(lock);
+    if (id < 0 || id >= MAX_ROIS || !used[id])
+        return;
+    used[id] = false;
+    changed = true;
+}
+
+bool RoiScheduler::roi(int id, Rect* out) const
+{
+    std::lock_guard<std::mutex> l(lock);
+    if (id < 0 || id >= MAX_ROIS || !used[id])
+        return false;
+    *out = rois[id];
+    return true;
+}
+
+int RoiScheduler::plan(const Rect* in, int n, uint32_t width, uint32_t height, Rect out[MAX_CROPS]) const
+{
+    Rect boxes[MAX_ROIS];
+    int m = 0;
+    for (int i = 0; i < n && m < MAX_ROIS; i++) {
+        const Rect& r = in[i];
+        if (r.width == 0 || r.height == 0 || r.x >= width || r.y >= height)
+            continue;
+        // the margin around it, corners out to the alignment
+        uint32_t x0 = r.x > cfg.margin ? r.x - cfg.margin : 0;
+        uint32_t y0 = r.y > cfg.margin ? r.y - cfg.margin : 0;
+        uint32_t x1 = std::min(r.x + r.width + cfg.margin, width);
+        uint32_t y1 = std::min(r.y + r.height + cfg.margin, height);
+        x0 -= x0 % cfg.align_x;
+        y0 -= y0 % cfg.align_y;
+        x1 = std::min((x1 + cfg.align_x - 1) / cfg.align_x * cfg.align_x, width);
+        y1 = std::min((y1 + cfg.align_y - 1) / cfg.align_y * cfg.align_y, height);
+        boxes[m++] = { x0, y0, x1 - x0, y1 - y0 };
+    }
+    if (m == 0)
+        return 0;
+
+    // merge the two boxes whose union adds the least area until the crops
+    // can take them
+    while (m > MAX_CROPS) {
+        int best_i = 0, best_j = 1;
+        int64_t best = INT64_MAX;
+        for (int i = 0; i < m; i++) {
+            for (int j = i + 1; j < m; j++) {
+                int64_t extra = (int64_t) area(unite(boxes[i], boxes[j])) - (int64_t) area(boxes[i]) -
+                                (int64_t) area(boxes[j]);
+                if (extra < best) {
+                    best = extra;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+        boxes[best_i] = unite(boxes[best_i], boxes[best_j]);
+        boxes[best_j] = boxes[--m];
+    }
+    // overlapping crops would carry those rows twice
+    if (m == 2) {
+        Rect u = unite(boxes[0], boxes[1]);
+        if (overlap(boxes[0], boxes[1]) ||
+            (double) (area(boxes[0]) + area(boxes[1])) > (1.0 - cfg.min_split_saving) * area(u)) {
+            boxes[0] = u;
+            m = 1;
+        }
+    }
+
+    uint64_t covered = 0;
+    for (int i = 0; i < m; i++)
+        covered += area(boxes[i]);
+    if ((double) covered > cfg.max_coverage * ((double) width * height))
+        return 0;
+    if (m == 2 && (boxes[1].y < boxes[0].y || (boxes[1].y == boxes[0].y && boxes[1].x < boxes[0].x)))
+        std::swap(boxes[0], boxes[1]);
+    for (int i = 0; i < m; i++)
+        out[i] = boxes[i];
+    return m;
+}
+
+bool RoiScheduler::due(const Rect* in, int n, const Mapping& next) const
+{
+    if (next.num_crops != sent.num_crops)
+        return true;
+    if (sent.num_crops == 0)
+        return false;
+    // every region still half its margin within the crops, as new ones
+    // take a few frames to show...
+    uint32_t m = cfg.margin / 2;
+    for (int i = 0; i < n; i++) {
+        const Rect& r = in[i];
+        uint32_t x0 = r.x > m ? r.x - m : 0;
+        uint32_t y0 = r.y > m ? r.y - m : 0;
+        Rect near = { x0, y0, std::min(r.x + r.width + m, frame_width) - x0,
+                      std::min(r.y + r.height + m, frame_height) - y0 };
+        bool inside = r.width == 0 || r.height == 0;
+        for (uint32_t c = 0; c < sent.num_crops && !inside; c++)
+            inside = contains(sent.crops[c], near);
+        if (!inside)
+            return true;
+    }
+    // ...and the crops not much larger than they need to be
+    for (uint32_t c = 0; c < sent.num_crops; c++) {
+        const Rect& a = sent.crops[c];
+        const Rect& b = next.crops[c];
+        uint32_t d = std::max(std::max(a.x > b.x ? a.x - b.x : b.x - a.x, a.y > b.y ? a.y - b.y : b.y - a.y),
+                              std::max(a.width > b.width ? a.width - b.width : b.width - a.width,
+                                       a.height > b.height ? a.height - b.height : b.height - a.height));
+        if (d > cfg.hysteresis)
+            return true;
+    }
+    return false;
+}
+
+bool RoiScheduler::grow(Mapping& m, uint32_t i) const
+{
+    const Rect& c = m.crops[i];
+    const Rect options[] = {
+        { c.x, c.y, c.width, c.height + cfg.align_y },
+        { c.x, c.y - cfg.align_y, c.width, c.height + cfg.align_y },
+        { c.x, c.y, c.width + cfg.align_x, c.height },
+        { c.x - cfg.align_x, c.y, c.width + cfg.align_x, c.height },
+    };
+    const bool fits[] = {
+        c.y + c.height + cfg.align_y <= frame_height,
+        c.y >= cfg.align_y,
+        c.x + c.width + cfg.align_x <= frame_width,
+        c.x >= cfg.align_x,
+    };
+    // the rows of both crops would go out twice
+    for (int k = 0; k < 4; k++) {
+        if (fits[k] && (m.num_crops < 2 || !overlap(options[k], m.crops[1 - i]))) {
+            m.crops[i] = options[k];
+            return true;
+        }
+    }
+    return false;
+}
+
+int32_t RoiScheduler::send(const Mapping& m)
+{
+    Mapping next = m;
+    // frames tell crops apart by size only: moved crops grow a little
+    for (int tries = 0; tries < 4 && next.num_crops != 0; tries++) {
+        bool clash = same_sizes(next, current);
+        for (const Mapping& p : pending)
+            clash = clash || same_sizes(next, p);
+        if (!clash || !(grow(next, 0) || (next.num_crops > 1 && grow(next, 1))))
+            break;
+    }
+
+    const Rect none = {};
+    const Rect& c0 = next.num_crops > 0 ? next.crops[0] : none;
+    const Rect& c1 = next.num_crops > 1 ? next.crops[1] : none;
+    int32_t res = QVRCameraDevice_SetCropRegion(camera, c0.y, c0.x, c0.width, c0.height, c1.y, c1.x, c1.width,
+                                                c1.height);
+    if (res != QVR_CAM_SUCCESS) {
+        __log_func(ANDROID_LOG_WARN, TAG, "SetCropRegion(%u crops) failed: %d", next.num_crops, res);
+        st.errors++;
+        return res;
+    }
+    sent = next;
+    pending.push_back(next);
+    if (pending.size() > MAX_PENDING)
+        pending.erase(pending.begin());
+    st.updates++;
+    return QVR_CAM_SUCCESS;
+}
+
+bool RoiScheduler::on_frame(const qvrcamera_frame_t& frame, Mapping* out)
+{
+    st.frames++;
+    if (camera == NULL)
+        return false;
+
+    Rect in[MAX_ROIS];
+    int n = 0;
+    bool replan;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        for (int i = 0; i < MAX_ROIS; i++) {
+            if (used[i])
+                in[n++] = rois[i];
+        }
+        replan = changed;
+        changed = false;
+    }
+
+    // which of the sent crops the frame shows, the newest first
+    auto shows = [&](const Mapping& m) {
+        if (m.num_crops == 0)
+            return frame.width == frame_width && frame.height == frame_height && frame.secondary_width == 0;
+        const Rect& c1 = m.crops[1];
+        return frame.width == m.crops[0].width && frame.height == m.crops[0].height &&
+               frame.secondary_width == (m.num_crops > 1 ? c1.width : 0) &&
+               frame.secondary_height == (m.num_crops > 1 ? c1.height : 0);
+    };
+    bool known = false;
+    for (size_t i = pending.size(); i-- > 0 && !known;) {
+        if (shows(pending[i])) {
+            current = pending[i];
+            pending.erase(pending.begin(), pending.begin() + i + 1);
+            known = true;
+        }
+    }
+    known = known || shows(current);
+    if (known) {
+        *out = current;
+        st.frame_bytes += frame.len;
+        if (current.num_crops != 0)
+            st.cropped_frames++;
+    } else {
+        st.unknown_frames++;
+    }
+
+    if (replan || (!known && pending.empty())) {
+        Mapping next = {};
+        next.num_crops = (uint32_t) plan(in, n, frame_width, frame_height, next.crops);
+        // crops nobody sent need replacing whatever the regions
+        if ((!known && pending.empty()) || due(in, n, next)) {
+            if (send(next) != QVR_CAM_SUCCESS) {
+                std::lock_guard<std::mutex> l(lock);
+                changed = true;
+            }
+        }
+    }
+    return known;
+}
+
+bool RoiScheduler::roi_view(const qvrcamera_frame_t& frame, const Mapping& m, int id, ImageView* out) const
+{
+    Rect r;
+    return roi(id, &r) && roi_view(frame, m, r, out);
+}
+
+bool RoiScheduler::roi_view(const qvrcamera_frame_t& frame, const Mapping& m, const Rect& roi, ImageView* out)
+{
+    uint32_t bpp = pixel_bytes(frame.format);
+    if (bpp == 0 || frame.buffer == NULL || roi.width == 0 || roi.height == 0)
+        return false;
+
+    const uint8_t* base = (const uint8_t*) frame.buffer;
+    Rect within = { 0, 0, frame.width, frame.height };
+    uint32_t pitch = std::max(frame.stride, frame.width * bpp);
+    size_t end = (size_t) pitch * (frame.height - 1) + (size_t) frame.width * bpp;
+    if (m.num_crops != 0) {
+        // crops back to back with packed rows
+        uint32_t c = 0;
+        while (c < m.num_crops && !contains(m.crops[c], roi)) {
+            base += (size_t) m.crops[c].width * bpp * m.crops[c].height;
+            c++;
+        }
+        if (c == m.num_crops)
+            return false;
+        within = m.crops[c];
+        pitch = within.width * bpp;
+        end = (size_t) (base - (const uint8_t*) frame.buffer) + (size_t) pitch * within.height;
+    } else if (!contains(within, roi)) {
+        return false;
+    }
+    if (end > frame.len)
+        return false;
+
+    memset(out, 0, sizeof(*out));
+    out->data = base + (size_t) (roi.y - within.y) * pitch + (size_t) (roi.x - within.x) * bpp;
+    out->width = roi.width;
+    out->height = roi.height;
+    out->pitch = pitch;
+    out->format = frame.format;
+    out->x = (int32_t) roi.x;
+    out->y = (int32_t) roi.y;
+    return true;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "camera/frame_views.h"
+
+// Hardware crops for the regions of interest of a camera's consumers, so
+// frames carry the regions instead of the whole sensor. Consumers add and
+// move regions in pixels of the whole (merged) frame from any thread; the
+// thread reading the camera calls on_frame() for every frame, which packs
+// the regions into at most the two crops of SetCropRegion() and sends them
+// when they changed by more than the hysteresis, and says which crops the
+// frame holds. roi_view() then finds a region in a frame, cropped or not,
+// with its corner in whole frame pixels, so consumers keep their
+// coordinates.
+//
+// Frames tell their crops only by size: crops that move without resizing
+// grow by align_y rows (or align_x columns where the frame edge or the other
+// crop is in the way), so the frames that show them can be told from the
+// ones before. Frames of sizes none of the sent crops have (crops another
+// client set) give false. Crops only suit formats of whole bytes per pixel
+// (Y8, DEPTH16, RAW16).
+class RoiScheduler {
+public:
+    static const int MAX_ROIS = 16;
+    static const int MAX_CROPS = 2;
+
+    struct Rect {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct Config {
+        // pixels around every region, so a tracked object moving a little
+        // stays within the crops
+        uint32_t margin = 16;
+        // crop corners and sizes in multiples of these
+        uint32_t align_x = 16;
+        uint32_t align_y = 2;
+        // two crops instead of one box around everything only when that
+        // saves this fraction of its area
+        float min_split_saving = 0.2f;
+        // whole frames once the crops would cover more of it than this
+        float max_coverage = 0.6f;
+        // crops only go out again when a region came within half the
+        // margin of their edges or an edge moved by more than this
+        uint32_t hysteresis = 32;
+    };
+
+    // The crops of a frame in whole frame pixels, crop i in the frame
+    // buffer after crops 0..i-1; none for a whole frame
+    struct Mapping {
+        uint32_t num_crops;
+        Rect crops[MAX_CROPS];
+    };
+
+    struct Stats {
+        uint64_t frames;
+        // SetCropRegion() calls
+        uint64_t updates;
+        uint64_t cropped_frames;
+        // frames of a size none of the sent crops have
+        uint64_t unknown_frames;
+        // bytes of the frames, to set against whole ones
+        uint64_t frame_bytes;
+        uint64_t errors;
+    };
+
+    RoiScheduler();
+    explicit RoiScheduler(const Config& config);
+
+    void set_config(const Config& config);
+    const Config& config() const { return cfg; }
+
+    // The camera to crop, whole frames until there are regions.
+    // QVR_CAM_SUCCESS or a QVR_CAM_* error.
+    int32_t attach(qvrcamera_device_helper_t* cam);
+    // back to whole frames
+    void detach();
+
+    // A region, clipped to the frame; its id or -1 when MAX_ROIS are in use
+    int add(const Rect& roi);
+    bool move(int id, const Rect& roi);
+    void remove(int id);
+    bool roi(int id, Rect* out) const;
+
+    // For every frame, from the thread reading the camera: the frame's crops
+    // into *out, false when they aren't known. Sends new crops when due.
+    bool on_frame(const qvrcamera_frame_t& frame, Mapping* out);
+
+    // Region id, as it is now, in frame with crops m; x/y of the view are its
+    // corner in the whole frame. False when the frame doesn't hold all of it,
+    // e.g. before the crops for a new region show.
+    bool roi_view(const qvrcamera_frame_t& frame, const Mapping& m, int id, ImageView* out) const;
+    static bool roi_view(const qvrcamera_frame_t& frame, const Mapping& m, const Rect& roi, ImageView* out);
+
+    // Packs n regions into crops of a width x height frame, with margin and
+    // alignment; the number of crops, 0 for whole frames
+    int plan(const Rect* rois, int n, uint32_t width, uint32_t height, Rect out[MAX_CROPS]) const;
+
+    const Stats& stats() const { return st; }
+    // the crops last sent, which frames may not show yet; from the thread
+    // reading the camera
+    const Mapping& sent_crops() const { return sent; }
+
+private:
+    // roi within the frame
+    Rect clip(const Rect& roi) const;
+    // whether sent crops need to change for regions n
+    bool due(const Rect* rois, int n, const Mapping& next) const;
+    // crop i of m a step of the alignment larger, within the frame and off
+    // the other crop; false when it can't grow
+    bool grow(Mapping& m, uint32_t i) const;
+    int32_t send(const Mapping& m);
+
+    Config cfg;
+    qvrcamera_device_helper_t* camera;
+    uint32_t frame_width;
+    uint32_t frame_height;
+
+    mutable std::mutex lock;
+    Rect rois[MAX_ROIS];
+    bool used[MAX_ROIS];
+    bool changed;
+
+    // crops of the frames now, and the ones sent that frames don't show yet
+    Mapping current;
+    Mapping sent;
+    std::vector<Mapping> pending;
+    Stats st;
+};
@@ -0,0 +1,81 @@
+#include "camera/row_pool.h"
+
+#include <algorithm>
+
+// bands per thread, so a slow thread doesn't hold up the call
+#define BANDS_PER_THREAD 4
+
+RowPool::RowPool(int threads)
+    : job(NULL)
+    , job_rows(0)
+    , band_rows(0)
+    , bands(0)
+    , next_band(0)
+    , generation(0)
+    , active(0)
+    , quitting(false)
+{
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&RowPool::worker, this);
+}
+
+RowPool::~RowPool()
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        quitting = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers)
+        t.join();
+}
+
+void RowPool::worker()
+{
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> l(lock);
+            wake.wait(l, [&]() { return quitting || generation != seen; });
+            if (quitting)
+                return;
+            seen = generation;
+        }
+        run_bands();
+        std::lock_guard<std::mutex> l(lock);
+        if (--active == 0)
+            done.notify_one();
+    }
+}
+
+void RowPool::run_bands()
+{
+    uint32_t b;
+    while ((b = next_band.fetch_add(1)) < bands)
+        (*job)(b * band_rows, std::min(job_rows, (b + 1) * band_rows));
+}
+
+void RowPool::run(uint32_t rows, const RowFn& fn)
+{
+    if (workers.empty() || rows < 2) {
+        fn(0, rows);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        job = &fn;
+        job_rows = rows;
+        uint32_t n = std::min(rows, (uint32_t) threads() * BANDS_PER_THREAD);
+        band_rows = (rows + n - 1) / n;
+        bands = (rows + band_rows - 1) / band_rows;
+        next_band = 0;
+        active = (int) workers.size();
+        generation++;
+    }
+    wake.notify_all();
+    run_bands();
+    std::unique_lock<std::mutex> l(lock);
+    done.wait(l, [&]() { return active == 0; });
+    job = NULL;
+}
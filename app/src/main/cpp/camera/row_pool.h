@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a function over the rows of an image in bands, on threads - 1
+// workers and the calling thread; the image operations (YuvOps, DepthOps)
+// keep one each. One run() at a time per instance.
+class RowPool {
+public:
+    typedef std::function<void(uint32_t first, uint32_t end)> RowFn;
+
+    explicit RowPool(int threads);
+    ~RowPool();
+
+    RowPool(const RowPool&) = delete;
+    RowPool& operator=(const RowPool&) = delete;
+
+    int threads() const { return (int) workers.size() + 1; }
+
+    // fn over [0, rows) in bands, all on the caller without workers
+    void run(uint32_t rows, const RowFn& fn);
+
+private:
+    void run_bands();
+    void worker();
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const RowFn* job;
+    uint32_t job_rows;
+    uint32_t band_rows;
+    uint32_t bands;
+    std::atomic<uint32_t> next_band;
+    uint64_t generation;
+    int active;
+    bool quitting;
+};
@@ -0,0 +1,178 @@
+#include "camera/undistort_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "camera/lens_model.h"
+#include "holder_log.h"
+
+UndistortCache::UndistortCache()
+    : UndistortCache(Config())
+{
+}
+
+UndistortCache::UndistortCache(const Config& config)
+    : cfg(config)
+    , uses(0)
+    , num_images(0)
+{
+    for (Image& img : image_maps) {
+        memset(&img.calibration, 0, sizeof(img.calibration));
+        img.key = 0;
+    }
+}
+
+std::string UndistortCache::path_of(uint64_t key) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/undistort-%016llx.map", (unsigned long long) key);
+    return cfg.dir + name;
+}
+
+int32_t UndistortCache::attach(qvrcamera_device_helper_t* cam)
+{
+    XrIntrinsicCalibrationQTI cal[MAX_IMAGES];
+    uint32_t n = 0;
+    while (n < MAX_IMAGES) {
+        int32_t res = LensModel::query(cam, n, &cal[n]);
+        if (res == QVR_CAM_INVALID_PARAM && n > 0)
+            break;
+        if (res != QVR_CAM_SUCCESS)
+            return res;
+        n++;
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+    for (uint32_t i = 0; i < n; i++) {
+        Image& img = image_maps[i];
+        memset(&img.calibration, 0, sizeof(img.calibration));
+        img.calibration.intrinsics = cal[i];
+        img.key = UndistortMap::key_of(cal[i], UndistortMap::pinhole(cal[i], cfg.zoom), NULL);
+        img.map.reset();
+    }
+    num_images = n;
+    return QVR_CAM_SUCCESS;
+}
+
+uint32_t UndistortCache::update(const XrCameraFrameCalibrationInfoOutputQTI& info)
+{
+    if (info.calibrations == NULL)
+        return 0;
+    uint32_t changed = 0;
+    std::lock_guard<std::mutex> l(lock);
+    uint32_t n = std::min(std::min(info.calibrationCount, info.calibrationCapacityIn), num_images);
+    for (uint32_t i = 0; i < n; i++) {
+        const XrCameraSensorCalibrationQTI& c = info.calibrations[i];
+        if ((c.flags & XR_CAMERA_SENSOR_CALIBRATION_DYNAMIC_BIT) == 0)
+            continue;
+        Image& img = image_maps[i];
+        uint64_t key = UndistortMap::key_of(c.intrinsics, UndistortMap::pinhole(c.intrinsics, cfg.zoom), NULL);
+        if (key == img.key)
+            continue;
+        // an earlier dynamic calibration is of no further use
+        if (img.calibration.flags & XR_CAMERA_SENSOR_CALIBRATION_DYNAMIC_BIT)
+            drop_locked(img.key);
+        img.calibration = c;
+        img.key = key;
+        img.map.reset();
+        st.invalidations++;
+        changed++;
+    }
+    return changed;
+}
+
+std::shared_ptr<const UndistortMap> UndistortCache::map(uint32_t image)
+{
+    std::lock_guard<std::mutex> l(lock);
+    if (image >= num_images)
+        return NULL;
+    Image& img = image_maps[image];
+    if (img.map == NULL) {
+        bool dynamic = (img.calibration.flags & XR_CAMERA_SENSOR_CALIBRATION_DYNAMIC_BIT) != 0;
+        img.map = get_locked(img.calibration.intrinsics, !dynamic);
+    }
+    return img.map;
+}
+
+std::shared_ptr<const UndistortMap> UndistortCache::get(const XrIntrinsicCalibrationQTI& calibration, bool persist)
+{
+    std::lock_guard<std::mutex> l(lock);
+    return get_locked(calibration, persist);
+}
+
+std::shared_ptr<const UndistortMap> UndistortCache::get_locked(const XrIntrinsicCalibrationQTI& calibration,
+                                                              bool persist)
+{
+    XrIntrinsicCalibrationQTI target = UndistortMap::pinhole(calibration, cfg.zoom);
+    uint64_t key = UndistortMap::key_of(calibration, target, NULL);
+    for (Entry& e : entries) {
+        if (e.key == key) {
+            e.last_use = ++uses;
+            st.hits++;
+            return e.map;
+        }
+    }
+
+    std::shared_ptr<UndistortMap> m = std::make_shared<UndistortMap>();
+    std::string path = path_of(key);
+    bool disk = persist && !cfg.dir.empty();
+    if (disk && m->load(path.c_str(), key)) {
+        st.loads++;
+    } else {
+        if (disk && access(path.c_str(), F_OK) == 0) {
+            __log_func(ANDROID_LOG_WARN, TAG, "undistort cache: %s doesn't load, rebuilding", path.c_str());
+            st.disk_errors++;
+        }
+        if (!m->build(LensModel(calibration), target, NULL))
+            return NULL;
+        st.builds++;
+        if (disk) {
+            if (m->save(path.c_str())) {
+                st.saves++;
+            } else {
+                __log_func(ANDROID_LOG_WARN, TAG, "undistort cache: saving %s failed", path.c_str());
+                st.disk_errors++;
+            }
+        }
+    }
+
+    if (entries.size() >= std::max(cfg.max_maps, 1u)) {
+        std::vector<Entry>::iterator oldest = entries.begin();
+        for (std::vector<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+            if (it->last_use < oldest->last_use)
+                oldest = it;
+        }
+        entries.erase(oldest);
+    }
+    Entry e;
+    e.key = key;
+    e.last_use = ++uses;
+    e.map = m;
+    entries.push_back(e);
+    return m;
+}
+
+void UndistortCache::drop_locked(uint64_t key)
+{
+    for (std::vector<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        if (it->key == key) {
+            entries.erase(it);
+            return;
+        }
+    }
+}
+
+uint32_t UndistortCache::images() const
+{
+    std::lock_guard<std::mutex> l(lock);
+    return num_images;
+}
+
+UndistortCache::Stats UndistortCache::stats() const
+{
+    std::lock_guard<std::mutex> l(lock);
+    return st;
+}
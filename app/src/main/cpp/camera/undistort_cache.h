@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "camera/undistort_map.h"
+
+// UndistortMaps of a camera's images, built once per calibration. Maps are
+// found by UndistortMap::key_of() in memory, then in dir, where factory
+// calibrations persist across runs so later starts load a map instead of
+// building it. Online recalibrations, flagged
+// XR_CAMERA_SENSOR_CALIBRATION_DYNAMIC_BIT in the
+// XrCameraFrameCalibrationInfoOutputQTI GetFrameEx() fills in, replace the
+// image's map once update() sees them; their maps stay in memory only.
+//
+// Maps are shared: a consumer keeps remapping with the map it got while the
+// cache moves on. Thread safe.
+class UndistortCache {
+public:
+    static const int MAX_IMAGES = 2;
+
+    struct Config {
+        // where maps persist, nowhere when empty
+        std::string dir;
+        // focal length of the undistorted images over the lens'
+        double zoom = 1.0;
+        // maps kept in memory, least recently used first to go
+        uint32_t max_maps = 8;
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t builds = 0;
+        uint64_t loads = 0;
+        uint64_t saves = 0;
+        // files that didn't load or save
+        uint64_t disk_errors = 0;
+        // images whose calibration changed
+        uint64_t invalidations = 0;
+    };
+
+    UndistortCache();
+    explicit UndistortCache(const Config& config);
+
+    UndistortCache(const UndistortCache&) = delete;
+    UndistortCache& operator=(const UndistortCache&) = delete;
+
+    const Config& config() const { return cfg; }
+
+    // The calibrations of the images of cam from
+    // QVRCameraDevice_GetProperties(). QVR_CAM_SUCCESS or a QVR_CAM_* error.
+    int32_t attach(qvrcamera_device_helper_t* cam);
+    // Calibrations of a frame; dynamic ones unlike the image's current one
+    // make it current and drop the old map. The number of images changed.
+    uint32_t update(const XrCameraFrameCalibrationInfoOutputQTI& info);
+    // the map of image's current calibration, NULL before attach() or when
+    // the calibration doesn't build
+    std::shared_ptr<const UndistortMap> map(uint32_t image);
+    // the map of any calibration, saved when persist and there is a dir
+    std::shared_ptr<const UndistortMap> get(const XrIntrinsicCalibrationQTI& calibration, bool persist = true);
+
+    uint32_t images() const;
+    Stats stats() const;
+    // file a map of key persists in
+    std::string path_of(uint64_t key) const;
+
+private:
+    struct Entry {
+        uint64_t key;
+        uint64_t last_use;
+        std::shared_ptr<const UndistortMap> map;
+    };
+
+    struct Image {
+        XrCameraSensorCalibrationQTI calibration;
+        uint64_t key;
+        std::shared_ptr<const UndistortMap> map;
+    };
+
+    std::shared_ptr<const UndistortMap> get_locked(const XrIntrinsicCalibrationQTI& calibration, bool persist);
+    void drop_locked(uint64_t key);
+
+    Config cfg;
+    mutable std::mutex lock;
+    std::vector<Entry> entries;
+    uint64_t uses;
+    Image image_maps[MAX_IMAGES];
+    uint32_t num_images;
+    Stats st;
+};
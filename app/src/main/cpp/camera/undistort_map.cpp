@@ -0,0 +1,378 @@
+#include "camera/undistort_map.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "simd.h"
+
+#define UNDISTORT_MAP_MAGIC 0x4d445551u // "QUDM"
+#define UNDISTORT_MAP_VERSION 1
+// larger maps in a file are taken for corruption
+#define MAX_MAP_PIXELS (1u << 26)
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+struct UndistortMapHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t key;
+    uint32_t width;
+    uint32_t height;
+    uint32_t source_width;
+    uint32_t source_height;
+    uint32_t outside;
+    uint32_t reserved;
+    // of map_x, map_y and the outside pixels, a word at a time
+    uint64_t checksum;
+};
+
+static const int32_t ONE = 1 << UndistortMap::FRAC_BITS;
+static const int32_t FRAC_MASK = ONE - 1;
+
+static uint64_t fnv_bytes(uint64_t h, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * FNV_PRIME;
+    return h;
+}
+
+static uint64_t fnv_words(uint64_t h, const uint32_t* words, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        h = (h ^ words[i]) * FNV_PRIME;
+    return h;
+}
+
+// field by field, as the struct has padding
+static uint64_t hash_calibration(uint64_t h, const XrIntrinsicCalibrationQTI& c)
+{
+    h = fnv_bytes(h, &c.size.width, sizeof(c.size.width));
+    h = fnv_bytes(h, &c.size.height, sizeof(c.size.height));
+    h = fnv_bytes(h, &c.principalPoint.x, sizeof(c.principalPoint.x));
+    h = fnv_bytes(h, &c.principalPoint.y, sizeof(c.principalPoint.y));
+    h = fnv_bytes(h, &c.focalLength.x, sizeof(c.focalLength.x));
+    h = fnv_bytes(h, &c.focalLength.y, sizeof(c.focalLength.y));
+    h = fnv_bytes(h, &c.skew, sizeof(c.skew));
+    h = fnv_bytes(h, c.radialDistortion, sizeof(c.radialDistortion));
+    h = fnv_bytes(h, c.tangentialDistortion, sizeof(c.tangentialDistortion));
+    int32_t model = (int32_t) c.distortionModel;
+    return fnv_bytes(h, &model, sizeof(model));
+}
+
+static void remap_row_scalar(const uint8_t* src, uint32_t pitch, const int32_t* mx, const int32_t* my, uint32_t x,
+                             uint32_t w, uint8_t* out)
+{
+    for (; x < w; x++) {
+        const uint8_t* p = src + (size_t) (my[x] >> UndistortMap::FRAC_BITS) * pitch + (mx[x] >> UndistortMap::FRAC_BITS);
+        int32_t fx = mx[x] & FRAC_MASK;
+        int32_t fy = my[x] & FRAC_MASK;
+        int32_t top = p[0] * (ONE - fx) + p[1] * fx;
+        int32_t bottom = p[pitch] * (ONE - fx) + p[pitch + 1] * fx;
+        out[x] = (uint8_t) ((top * (ONE - fy) + bottom * fy + (1 << (2 * UndistortMap::FRAC_BITS - 1))) >>
+                            (2 * UndistortMap::FRAC_BITS));
+    }
+}
+
+static void remap_row_nearest(const uint8_t* src, uint32_t pitch, const int32_t* mx, const int32_t* my, uint32_t w,
+                              uint16_t* out)
+{
+    for (uint32_t x = 0; x < w; x++) {
+        int32_t sx = (mx[x] + ONE / 2) >> UndistortMap::FRAC_BITS;
+        int32_t sy = (my[x] + ONE / 2) >> UndistortMap::FRAC_BITS;
+        out[x] = ((const uint16_t*) (src + (size_t) sy * pitch))[sx];
+    }
+}
+
+#if defined(HOLDER_HAVE_SIMD)
+
+// Eight pixels at a time: the source pairs of the top and bottom rows are
+// gathered into arrays, then weighted horizontally and vertically in 16 bit
+// lanes; returns how far it got
+static uint32_t remap_row_simd(const uint8_t* src, uint32_t pitch, const int32_t* mx, const int32_t* my, uint32_t w,
+                               uint8_t* out)
+{
+    uint32_t x = 0;
+    uint16_t top[8], bottom[8];
+#if defined(HOLDER_SIMD_NEON)
+    uint32x4_t mask = vdupq_n_u32(FRAC_MASK);
+    uint8x8_t one8 = vdup_n_u8(ONE);
+    uint16x8_t one16 = vdupq_n_u16(ONE);
+#else
+    __m128i mask = _mm_set1_epi32(FRAC_MASK);
+    __m128i one = _mm_set1_epi32(ONE);
+    __m128i round = _mm_set1_epi32(1 << (2 * UndistortMap::FRAC_BITS - 1));
+    __m128i zero = _mm_setzero_si128();
+#endif
+    for (; x + 8 <= w; x += 8) {
+        for (int k = 0; k < 8; k++) {
+            const uint8_t* p =
+                src + (size_t) (my[x + k] >> UndistortMap::FRAC_BITS) * pitch + (mx[x + k] >> UndistortMap::FRAC_BITS);
+            memcpy(&top[k], p, 2);
+            memcpy(&bottom[k], p + pitch, 2);
+        }
+#if defined(HOLDER_SIMD_NEON)
+        uint8x8x2_t t = vld2_u8((const uint8_t*) top);
+        uint8x8x2_t b = vld2_u8((const uint8_t*) bottom);
+        uint16x8_t fx16 = vcombine_u16(vmovn_u32(vandq_u32(vreinterpretq_u32_s32(vld1q_s32(mx + x)), mask)),
+                                       vmovn_u32(vandq_u32(vreinterpretq_u32_s32(vld1q_s32(mx + x + 4)), mask)));
+        uint16x8_t fy = vcombine_u16(vmovn_u32(vandq_u32(vreinterpretq_u32_s32(vld1q_s32(my + x)), mask)),
+                                     vmovn_u32(vandq_u32(vreinterpretq_u32_s32(vld1q_s32(my + x + 4)), mask)));
+        uint8x8_t fx = vmovn_u16(fx16);
+        uint8x8_t wx = vsub_u8(one8, fx);
+        uint16x8_t tp = vmlal_u8(vmull_u8(t.val[0], wx), t.val[1], fx);
+        uint16x8_t bt = vmlal_u8(vmull_u8(b.val[0], wx), b.val[1], fx);
+        uint16x8_t wy = vsubq_u16(one16, fy);
+        uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(tp), vget_low_u16(wy)), vget_low_u16(bt), vget_low_u16(fy));
+        uint32x4_t hi =
+            vmlal_u16(vmull_u16(vget_high_u16(tp), vget_high_u16(wy)), vget_high_u16(bt), vget_high_u16(fy));
+        uint16x8_t r = vcombine_u16(vrshrn_n_u32(lo, 2 * UndistortMap::FRAC_BITS),
+                                    vrshrn_n_u32(hi, 2 * UndistortMap::FRAC_BITS));
+        vst1_u8(out + x, vmovn_u16(r));
+#else
+        __m128i t = _mm_loadu_si128((const __m128i*) top);
+        __m128i b = _mm_loadu_si128((const __m128i*) bottom);
+        // (1 - fx, fx) and (1 - fy, fy) word pairs per pixel
+        __m128i fx0 = _mm_and_si128(_mm_loadu_si128((const __m128i*) (mx + x)), mask);
+        __m128i fx1 = _mm_and_si128(_mm_loadu_si128((const __m128i*) (mx + x + 4)), mask);
+        __m128i fy0 = _mm_and_si128(_mm_loadu_si128((const __m128i*) (my + x)), mask);
+        __m128i fy1 = _mm_and_si128(_mm_loadu_si128((const __m128i*) (my + x + 4)), mask);
+        __m128i wx0 = _mm_or_si128(_mm_sub_epi32(one, fx0), _mm_slli_epi32(fx0, 16));
+        __m128i wx1 = _mm_or_si128(_mm_sub_epi32(one, fx1), _mm_slli_epi32(fx1, 16));
+        __m128i wy0 = _mm_or_si128(_mm_sub_epi32(one, fy0), _mm_slli_epi32(fy0, 16));
+        __m128i wy1 = _mm_or_si128(_mm_sub_epi32(one, fy1), _mm_slli_epi32(fy1, 16));
+        __m128i t0 = _mm_madd_epi16(_mm_unpacklo_epi8(t, zero), wx0);
+        __m128i t1 = _mm_madd_epi16(_mm_unpackhi_epi8(t, zero), wx1);
+        __m128i b0 = _mm_madd_epi16(_mm_unpacklo_epi8(b, zero), wx0);
+        __m128i b1 = _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), wx1);
+        // top and bottom fit 15 bits
+        __m128i v0 = _mm_madd_epi16(_mm_or_si128(t0, _mm_slli_epi32(b0, 16)), wy0);
+        __m128i v1 = _mm_madd_epi16(_mm_or_si128(t1, _mm_slli_epi32(b1, 16)), wy1);
+        v0 = _mm_srai_epi32(_mm_add_epi32(v0, round), 2 * UndistortMap::FRAC_BITS);
+        v1 = _mm_srai_epi32(_mm_add_epi32(v1, round), 2 * UndistortMap::FRAC_BITS);
+        __m128i r = _mm_packs_epi32(v0, v1);
+        _mm_storel_epi64((__m128i*) (out + x), _mm_packus_epi16(r, r));
+#endif
+    }
+    return x;
+}
+
+#endif
+
+UndistortMap::UndistortMap()
+    : map_key(0)
+    , map_width(0)
+    , map_height(0)
+    , src_width(0)
+    , src_height(0)
+{
+}
+
+bool UndistortMap::simd_available()
+{
+#if defined(HOLDER_HAVE_SIMD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+XrIntrinsicCalibrationQTI UndistortMap::pinhole(const XrIntrinsicCalibrationQTI& source, double zoom)
+{
+    XrIntrinsicCalibrationQTI c;
+    memset(&c, 0, sizeof(c));
+    c.size = source.size;
+    c.principalPoint = source.principalPoint;
+    c.focalLength.x = source.focalLength.x * zoom;
+    c.focalLength.y = source.focalLength.y * zoom;
+    c.distortionModel = XR_DISTORTION_MODEL_QTI_LINEAR;
+    return c;
+}
+
+uint64_t UndistortMap::key_of(const XrIntrinsicCalibrationQTI& source, const XrIntrinsicCalibrationQTI& target,
+                              const double* rotation)
+{
+    static const double identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    uint32_t version = UNDISTORT_MAP_VERSION;
+    uint64_t h = fnv_bytes(FNV_OFFSET, &version, sizeof(version));
+    h = hash_calibration(h, source);
+    h = hash_calibration(h, target);
+    return fnv_bytes(h, rotation != NULL ? rotation : identity, sizeof(identity));
+}
+
+bool UndistortMap::build(const LensModel& source, const XrIntrinsicCalibrationQTI& target, const double* rotation)
+{
+    static const double identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    LensModel ideal(target);
+    if (!source.valid() || !ideal.valid() || target.distortionModel != XR_DISTORTION_MODEL_QTI_LINEAR ||
+        source.width() < 2 || source.height() < 2)
+        return false;
+
+    const double* r = rotation != NULL ? rotation : identity;
+    uint32_t w = ideal.width(), h = ideal.height();
+    double sw = source.width(), sh = source.height();
+    // x0 + 1 and y0 + 1 have to be on the image
+    int32_t max_x = (int32_t) (source.width() - 1) << FRAC_BITS;
+    int32_t max_y = (int32_t) (source.height() - 1) << FRAC_BITS;
+    map_x.assign((size_t) w * h, 0);
+    map_y.assign((size_t) w * h, 0);
+    outside_pixels.clear();
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            size_t i = (size_t) y * w + x;
+            double nx, ny, u, v;
+            ideal.unproject(x, y, &nx, &ny);
+            double X = r[0] * nx + r[1] * ny + r[2];
+            double Y = r[3] * nx + r[4] * ny + r[5];
+            double Z = r[6] * nx + r[7] * ny + r[8];
+            bool ok = Z > 0.0 && source.project(X / Z, Y / Z, &u, &v) && u >= 0.0 && v >= 0.0 && u < sw && v < sh;
+            int32_t fx = ok ? (int32_t) lround(u * ONE) : 0;
+            int32_t fy = ok ? (int32_t) lround(v * ONE) : 0;
+            if (ok && fx < max_x && fy < max_y) {
+                map_x[i] = fx;
+                map_y[i] = fy;
+            } else {
+                outside_pixels.push_back((uint32_t) i);
+            }
+        }
+    }
+    map_key = key_of(source.calibration(), target, rotation);
+    map_width = w;
+    map_height = h;
+    src_width = source.width();
+    src_height = source.height();
+    return true;
+}
+
+size_t UndistortMap::bytes() const
+{
+    return (map_x.size() + map_y.size() + outside_pixels.size()) * 4;
+}
+
+bool UndistortMap::remap(const ImageView& src, uint8_t* out, uint32_t out_pitch, Kernel kernel, uint16_t border) const
+{
+    if (!valid() || src.data == NULL || out == NULL || src.width != src_width || src.height != src_height)
+        return false;
+    bool depth = src.format == QVRCAMERA_FRAME_FORMAT_DEPTH16;
+    if (!depth && src.format != QVRCAMERA_FRAME_FORMAT_Y8 && src.format != QVRCAMERA_FRAME_FORMAT_YUV420)
+        return false;
+    if (out_pitch < map_width * (depth ? 2 : 1) || src.pitch < src_width * (depth ? 2 : 1))
+        return false;
+
+    bool simd = kernel == KERNEL_SIMD && simd_available();
+    for (uint32_t y = 0; y < map_height; y++) {
+        const int32_t* mx = &map_x[(size_t) y * map_width];
+        const int32_t* my = &map_y[(size_t) y * map_width];
+        uint8_t* row = out + (size_t) y * out_pitch;
+        if (depth) {
+            remap_row_nearest(src.data, src.pitch, mx, my, map_width, (uint16_t*) row);
+            continue;
+        }
+        uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+        if (simd)
+            x = remap_row_simd(src.data, src.pitch, mx, my, map_width, row);
+#endif
+        remap_row_scalar(src.data, src.pitch, mx, my, x, map_width, row);
+    }
+    (void) simd;
+
+    for (uint32_t i : outside_pixels) {
+        uint8_t* row = out + (size_t) (i / map_width) * out_pitch;
+        if (depth)
+            ((uint16_t*) row)[i % map_width] = border;
+        else
+            row[i % map_width] = (uint8_t) border;
+    }
+    return true;
+}
+
+bool UndistortMap::save(const char* path) const
+{
+    if (!valid() || path == NULL)
+        return false;
+    UndistortMapHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = UNDISTORT_MAP_MAGIC;
+    hdr.version = UNDISTORT_MAP_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.key = map_key;
+    hdr.width = map_width;
+    hdr.height = map_height;
+    hdr.source_width = src_width;
+    hdr.source_height = src_height;
+    hdr.outside = (uint32_t) outside_pixels.size();
+    uint64_t h = fnv_words(FNV_OFFSET, (const uint32_t*) map_x.data(), map_x.size());
+    h = fnv_words(h, (const uint32_t*) map_y.data(), map_y.size());
+    hdr.checksum = fnv_words(h, outside_pixels.data(), outside_pixels.size());
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int) getpid());
+    FILE* f = fopen(tmp, "wbe");
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(map_x.data(), 4, map_x.size(), f) == map_x.size() &&
+              fwrite(map_y.data(), 4, map_y.size(), f) == map_y.size() &&
+              fwrite(outside_pixels.data(), 4, outside_pixels.size(), f) == outside_pixels.size();
+    ok = fclose(f) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+        unlink(tmp);
+    return ok;
+}
+
+bool UndistortMap::load(const char* path, uint64_t key)
+{
+    FILE* f = path != NULL ? fopen(path, "rbe") : NULL;
+    if (f == NULL)
+        return false;
+
+    UndistortMapHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1 && hdr.magic == UNDISTORT_MAP_MAGIC &&
+              hdr.version == UNDISTORT_MAP_VERSION && hdr.header_size == sizeof(hdr) && hdr.key == key &&
+              hdr.width > 0 && hdr.height > 0 && hdr.source_width >= 2 && hdr.source_height >= 2 &&
+              (uint64_t) hdr.width * hdr.height <= MAX_MAP_PIXELS && hdr.outside <= hdr.width * hdr.height;
+    size_t n = ok ? (size_t) hdr.width * hdr.height : 0;
+    std::vector<int32_t> xs(n), ys(n);
+    std::vector<uint32_t> outside(ok ? hdr.outside : 0);
+    ok = ok && fread(xs.data(), 4, n, f) == n && fread(ys.data(), 4, n, f) == n &&
+         fread(outside.data(), 4, outside.size(), f) == outside.size() && fgetc(f) == EOF;
+    fclose(f);
+    if (ok) {
+        uint64_t h = fnv_words(FNV_OFFSET, (const uint32_t*) xs.data(), n);
+        h = fnv_words(h, (const uint32_t*) ys.data(), n);
+        ok = fnv_words(h, outside.data(), outside.size()) == hdr.checksum;
+    }
+    // whatever the checksum says, no sample may read off the image
+    int32_t max_x = (int32_t) (hdr.source_width - 1) << FRAC_BITS;
+    int32_t max_y = (int32_t) (hdr.source_height - 1) << FRAC_BITS;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = xs[i] >= 0 && ys[i] >= 0 && xs[i] < max_x && ys[i] < max_y;
+    for (size_t i = 0; ok && i < outside.size(); i++)
+        ok = outside[i] < n;
+    if (!ok)
+        return false;
+
+    map_key = key;
+    map_width = hdr.width;
+    map_height = hdr.height;
+    src_width = hdr.source_width;
+    src_height = hdr.source_height;
+    map_x.swap(xs);
+    map_y.swap(ys);
+    outside_pixels.swap(outside);
+    return true;
+}
+
+bool UndistortMap::operator==(const UndistortMap& o) const
+{
+    return map_key == o.map_key && map_width == o.map_width && map_height == o.map_height &&
+           src_width == o.src_width && src_height == o.src_height && map_x == o.map_x && map_y == o.map_y &&
+           outside_pixels == o.outside_pixels;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "camera/frame_views.h"
+#include "camera/lens_model.h"
+
+// Remap table from a distorted lens to an ideal pinhole camera, for
+// undistorting frames and, with a rotation, rectifying stereo pairs.
+//
+// Every output pixel keeps the source position it samples as fixed point
+// x and y with FRAC_BITS fraction bits. Y8 (and YUV420 luma) is bilinear
+// with 7 bit weights, which keeps the NEON/SSE2 kernel in 16 bit lanes:
+// the source pairs are gathered with scalar loads and weighted eight
+// pixels at a time, with the same results as the scalar loop. DEPTH16 takes
+// the nearest sample, as blending depths across an edge makes up surfaces.
+// Output pixels whose source lies off the image are set to border.
+//
+// Maps save to and load from files of a fixed little endian layout, with
+// the key they were built for and a checksum of the table.
+class UndistortMap {
+public:
+    static const int FRAC_BITS = 7;
+
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SIMD,
+    };
+
+    UndistortMap();
+
+    // Samples source for every pixel of the LINEAR calibration target;
+    // rotation is row major from the target camera frame to the source's,
+    // NULL for none. False for invalid models.
+    bool build(const LensModel& source, const XrIntrinsicCalibrationQTI& target, const double* rotation);
+    // the pinhole camera of the size and principal point of source, with its
+    // focal length times zoom
+    static XrIntrinsicCalibrationQTI pinhole(const XrIntrinsicCalibrationQTI& source, double zoom);
+    // what build() of these makes, to find maps by
+    static uint64_t key_of(const XrIntrinsicCalibrationQTI& source, const XrIntrinsicCalibrationQTI& target,
+                           const double* rotation);
+
+    bool valid() const { return map_width > 0; }
+    uint64_t key() const { return map_key; }
+    uint32_t width() const { return map_width; }
+    uint32_t height() const { return map_height; }
+    uint32_t source_width() const { return src_width; }
+    uint32_t source_height() const { return src_height; }
+    // output pixels without a source
+    uint32_t outside() const { return (uint32_t) outside_pixels.size(); }
+    size_t bytes() const;
+
+    // src of the source size (Y8, YUV420 luma or DEPTH16) into out, width x
+    // height of the same format with out_pitch bytes per row
+    bool remap(const ImageView& src, uint8_t* out, uint32_t out_pitch, Kernel kernel = KERNEL_SIMD,
+               uint16_t border = 0) const;
+    static bool simd_available();
+
+    // Writes through a temporary file renamed into place, so readers never
+    // see half a map. load() fails on files of another key or that don't
+    // check out, and leaves the map as it was.
+    bool save(const char* path) const;
+    bool load(const char* path, uint64_t key);
+
+    bool operator==(const UndistortMap& o) const;
+
+private:
+    uint64_t map_key;
+    uint32_t map_width;
+    uint32_t map_height;
+    uint32_t src_width;
+    uint32_t src_height;
+    // fixed point source x and y of every output pixel, row major; pixels
+    // without one sample (0, 0) and are in outside_pixels
+    std::vector<int32_t> map_x;
+    std::vector<int32_t> map_y;
+    std::vector<uint32_t> outside_pixels;
+};
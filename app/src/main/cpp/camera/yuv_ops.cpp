@@ -0,0 +1,425 @@
+#include "camera/yuv_ops.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "simd.h"
+
+static inline uint8_t clamp8(int v)
+{
+    return (uint8_t) (v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// BT.601 video range in 6 bit fixed point, small enough for 16 bit lanes:
+//   c = 74.5 (y - 16), d = u - 128, e = v - 128
+//   r = (c + 102 e) / 64, g = (c - 25 d - 52 e) / 64, b = (c + 129 d) / 64
+// The vector kernels saturate c + 129 d, which only happens above 255.
+static inline void yuv_to_rgba(int y, int u, int v, uint8_t* o)
+{
+    int c = 74 * (y - 16) + ((y - 16) >> 1) + 32;
+    int d = u - 128;
+    int e = v - 128;
+    o[0] = clamp8((c + 102 * e) >> 6);
+    o[1] = clamp8((c - 25 * d - 52 * e) >> 6);
+    o[2] = clamp8((c + 129 * d) >> 6);
+    o[3] = 255;
+}
+
+#if defined(HOLDER_HAVE_SIMD)
+
+// The vector loops below return how far they got; the scalar loops finish
+// the row.
+
+static uint32_t deinterleave_simd(const uint8_t* uv, uint32_t pairs, uint8_t* u, uint8_t* v)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= pairs; x += 16) {
+#if defined(HOLDER_SIMD_NEON)
+        uint8x16x2_t p = vld2q_u8(uv + 2 * x);
+        vst1q_u8(u + x, p.val[0]);
+        vst1q_u8(v + x, p.val[1]);
+#else
+        __m128i lo = _mm_loadu_si128((const __m128i*) (uv + 2 * x));
+        __m128i hi = _mm_loadu_si128((const __m128i*) (uv + 2 * x + 16));
+        __m128i mask = _mm_set1_epi16(0xff);
+        _mm_storeu_si128((__m128i*) (u + x), _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+        _mm_storeu_si128((__m128i*) (v + x), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+#endif
+    }
+    return x;
+}
+
+static uint32_t swap_pairs_simd(uint8_t* uv, uint32_t pairs)
+{
+    uint32_t x = 0;
+    for (; x + 8 <= pairs; x += 8) {
+#if defined(HOLDER_SIMD_NEON)
+        vst1q_u8(uv + 2 * x, vrev16q_u8(vld1q_u8(uv + 2 * x)));
+#else
+        __m128i p = _mm_loadu_si128((const __m128i*) (uv + 2 * x));
+        _mm_storeu_si128((__m128i*) (uv + 2 * x), _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8)));
+#endif
+    }
+    return x;
+}
+
+// 2x2 means of rows r0 and r1, 16 outputs at a time
+static uint32_t box2_simd(const uint8_t* r0, const uint8_t* r1, uint32_t n, uint8_t* out)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+#if defined(HOLDER_SIMD_NEON)
+        uint16x8_t s0 = vpadalq_u8(vpaddlq_u8(vld1q_u8(r0 + 2 * x)), vld1q_u8(r1 + 2 * x));
+        uint16x8_t s1 = vpadalq_u8(vpaddlq_u8(vld1q_u8(r0 + 2 * x + 16)), vld1q_u8(r1 + 2 * x + 16));
+        vst1q_u8(out + x, vcombine_u8(vrshrn_n_u16(s0, 2), vrshrn_n_u16(s1, 2)));
+#else
+        __m128i mask = _mm_set1_epi16(0xff);
+        __m128i s[2];
+        for (int h = 0; h < 2; h++) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (r0 + 2 * x + 16 * h));
+            __m128i b = _mm_loadu_si128((const __m128i*) (r1 + 2 * x + 16 * h));
+            s[h] = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)),
+                                 _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8)));
+            s[h] = _mm_srli_epi16(_mm_add_epi16(s[h], _mm_set1_epi16(2)), 2);
+        }
+        _mm_storeu_si128((__m128i*) (out + x), _mm_packus_epi16(s[0], s[1]));
+#endif
+    }
+    return x;
+}
+
+// 4x4 means of rows r[0..3], 8 outputs at a time
+static uint32_t box4_simd(const uint8_t* const r[4], uint32_t n, uint8_t* out)
+{
+    uint32_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+#if defined(HOLDER_SIMD_NEON)
+        uint16x8_t s0 = vpaddlq_u8(vld1q_u8(r[0] + 4 * x));
+        uint16x8_t s1 = vpaddlq_u8(vld1q_u8(r[0] + 4 * x + 16));
+        for (int k = 1; k < 4; k++) {
+            s0 = vpadalq_u8(s0, vld1q_u8(r[k] + 4 * x));
+            s1 = vpadalq_u8(s1, vld1q_u8(r[k] + 4 * x + 16));
+        }
+        uint16x8_t s = vcombine_u16(vpadd_u16(vget_low_u16(s0), vget_high_u16(s0)),
+                                    vpadd_u16(vget_low_u16(s1), vget_high_u16(s1)));
+        vst1_u8(out + x, vrshrn_n_u16(s, 4));
+#else
+        __m128i mask = _mm_set1_epi16(0xff);
+        __m128i s0 = _mm_setzero_si128();
+        __m128i s1 = _mm_setzero_si128();
+        for (int k = 0; k < 4; k++) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (r[k] + 4 * x));
+            __m128i b = _mm_loadu_si128((const __m128i*) (r[k] + 4 * x + 16));
+            s0 = _mm_add_epi16(s0, _mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)));
+            s1 = _mm_add_epi16(s1, _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8)));
+        }
+        // neighbouring pair sums; at most 16 * 255, so the packs don't clip
+        __m128i one = _mm_set1_epi16(1);
+        __m128i s = _mm_packs_epi32(_mm_madd_epi16(s0, one), _mm_madd_epi16(s1, one));
+        s = _mm_srli_epi16(_mm_add_epi16(s, _mm_set1_epi16(8)), 4);
+        _mm_storel_epi64((__m128i*) (out + x), _mm_packus_epi16(s, s));
+#endif
+    }
+    return x;
+}
+
+// means of pixels 1 and 2 of each group of 4 in rows r1 and r2, 16 outputs
+// at a time
+static uint32_t center4_simd(const uint8_t* r1, const uint8_t* r2, uint32_t n, uint8_t* out)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+#if defined(HOLDER_SIMD_NEON)
+        uint32x4_t mask = vdupq_n_u32(0xff);
+        uint16x4_t q[4];
+        for (int k = 0; k < 4; k++) {
+            uint32x4_t a = vreinterpretq_u32_u8(vld1q_u8(r1 + 4 * x + 16 * k));
+            uint32x4_t b = vreinterpretq_u32_u8(vld1q_u8(r2 + 4 * x + 16 * k));
+            uint32x4_t s = vaddq_u32(vandq_u32(vshrq_n_u32(a, 8), mask), vandq_u32(vshrq_n_u32(a, 16), mask));
+            s = vaddq_u32(s, vaddq_u32(vandq_u32(vshrq_n_u32(b, 8), mask), vandq_u32(vshrq_n_u32(b, 16), mask)));
+            q[k] = vmovn_u32(s);
+        }
+        vst1q_u8(out + x, vcombine_u8(vrshrn_n_u16(vcombine_u16(q[0], q[1]), 2),
+                                      vrshrn_n_u16(vcombine_u16(q[2], q[3]), 2)));
+#else
+        __m128i mask = _mm_set1_epi32(0xff);
+        __m128i s[4];
+        for (int k = 0; k < 4; k++) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (r1 + 4 * x + 16 * k));
+            __m128i b = _mm_loadu_si128((const __m128i*) (r2 + 4 * x + 16 * k));
+            s[k] = _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask), _mm_and_si128(_mm_srli_epi32(a, 16), mask));
+            s[k] = _mm_add_epi32(s[k], _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(b, 8), mask),
+                                                     _mm_and_si128(_mm_srli_epi32(b, 16), mask)));
+            s[k] = _mm_srli_epi32(_mm_add_epi32(s[k], _mm_set1_epi32(2)), 2);
+        }
+        _mm_storeu_si128((__m128i*) (out + x),
+                         _mm_packus_epi16(_mm_packs_epi32(s[0], s[1]), _mm_packs_epi32(s[2], s[3])));
+#endif
+    }
+    return x;
+}
+
+// one row of 16 pixels at a time, chroma from the pairs of uv; swap for
+// CrCb
+static uint32_t rgba_row_simd(const uint8_t* y, const uint8_t* uv, uint32_t n, bool swap, uint8_t* out)
+{
+    uint32_t x = 0;
+#if defined(HOLDER_SIMD_NEON)
+    for (; x + 16 <= n; x += 16) {
+        uint8x8x2_t p = vld2_u8(uv + x);
+        uint8x8_t u8 = swap ? p.val[1] : p.val[0];
+        uint8x8_t v8 = swap ? p.val[0] : p.val[1];
+        uint8x8x2_t uu = vzip_u8(u8, u8);
+        uint8x8x2_t vv = vzip_u8(v8, v8);
+        uint8x16_t yv = vld1q_u8(y + x);
+        int16x8_t r[2], g[2], b[2];
+        for (int h = 0; h < 2; h++) {
+            int16x8_t yy = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(h ? vget_high_u8(yv) : vget_low_u8(yv))),
+                                     vdupq_n_s16(16));
+            int16x8_t c = vaddq_s16(vaddq_s16(vmulq_n_s16(yy, 74), vshrq_n_s16(yy, 1)), vdupq_n_s16(32));
+            int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uu.val[h])), vdupq_n_s16(128));
+            int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vv.val[h])), vdupq_n_s16(128));
+            r[h] = vshrq_n_s16(vqaddq_s16(c, vmulq_n_s16(e, 102)), 6);
+            g[h] = vshrq_n_s16(vsubq_s16(vsubq_s16(c, vmulq_n_s16(d, 25)), vmulq_n_s16(e, 52)), 6);
+            b[h] = vshrq_n_s16(vqaddq_s16(c, vmulq_n_s16(d, 129)), 6);
+        }
+        uint8x16x4_t o;
+        o.val[0] = vcombine_u8(vqmovun_s16(r[0]), vqmovun_s16(r[1]));
+        o.val[1] = vcombine_u8(vqmovun_s16(g[0]), vqmovun_s16(g[1]));
+        o.val[2] = vcombine_u8(vqmovun_s16(b[0]), vqmovun_s16(b[1]));
+        o.val[3] = vdupq_n_u8(255);
+        vst4q_u8(out + 4 * x, o);
+    }
+#else
+    __m128i zero = _mm_setzero_si128();
+    __m128i mask = _mm_set1_epi16(0xff);
+    __m128i k16 = _mm_set1_epi16(16);
+    __m128i k128 = _mm_set1_epi16(128);
+    __m128i k32 = _mm_set1_epi16(32);
+    __m128i alpha = _mm_set1_epi8((char) 0xff);
+    for (; x + 16 <= n; x += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i*) (uv + x));
+        __m128i first = _mm_sub_epi16(_mm_and_si128(p, mask), k128);
+        __m128i second = _mm_sub_epi16(_mm_srli_epi16(p, 8), k128);
+        __m128i d8 = swap ? second : first;
+        __m128i e8 = swap ? first : second;
+        __m128i yv = _mm_loadu_si128((const __m128i*) (y + x));
+        __m128i r[2], g[2], b[2];
+        for (int h = 0; h < 2; h++) {
+            __m128i yy = _mm_sub_epi16(h ? _mm_unpackhi_epi8(yv, zero) : _mm_unpacklo_epi8(yv, zero), k16);
+            __m128i d = h ? _mm_unpackhi_epi16(d8, d8) : _mm_unpacklo_epi16(d8, d8);
+            __m128i e = h ? _mm_unpackhi_epi16(e8, e8) : _mm_unpacklo_epi16(e8, e8);
+            __m128i c = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(yy, _mm_set1_epi16(74)), _mm_srai_epi16(yy, 1)), k32);
+            r[h] = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(102))), 6);
+            g[h] = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(25))),
+                                                _mm_mullo_epi16(e, _mm_set1_epi16(52))), 6);
+            b[h] = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(129))), 6);
+        }
+        __m128i rr = _mm_packus_epi16(r[0], r[1]);
+        __m128i gg = _mm_packus_epi16(g[0], g[1]);
+        __m128i bb = _mm_packus_epi16(b[0], b[1]);
+        __m128i rg_lo = _mm_unpacklo_epi8(rr, gg);
+        __m128i rg_hi = _mm_unpackhi_epi8(rr, gg);
+        __m128i ba_lo = _mm_unpacklo_epi8(bb, alpha);
+        __m128i ba_hi = _mm_unpackhi_epi8(bb, alpha);
+        __m128i* o = (__m128i*) (out + 4 * x);
+        _mm_storeu_si128(o, _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(o + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(o + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128(o + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+#endif
+    return x;
+}
+
+#endif
+
+YuvOps::YuvOps()
+    : YuvOps(1)
+{
+}
+
+YuvOps::YuvOps(int threads)
+    : kernel(KERNEL_SIMD)
+    , pool(threads)
+{
+}
+
+bool YuvOps::simd_available()
+{
+#if defined(HOLDER_HAVE_SIMD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+YuvOps::Kernel YuvOps::active_kernel() const
+{
+    return kernel == KERNEL_SIMD && simd_available() ? KERNEL_SIMD : KERNEL_SCALAR;
+}
+
+bool YuvOps::from_frame(const qvrcamera_frame_t& frame, int32_t arrangement, YuvImage* out)
+{
+    if (frame.format != QVRCAMERA_FRAME_FORMAT_YUV420 || frame.buffer == NULL || frame.width < 2 ||
+        frame.height < 2)
+        return false;
+    uint32_t pitch = frame.stride >= frame.width ? frame.stride : frame.width;
+    uint32_t width = frame.width & ~1u;
+    uint32_t height = frame.height & ~1u;
+    if ((uint64_t) frame.len < (uint64_t) pitch * (frame.height + height / 2 - 1) + width)
+        return false;
+
+    out->y = (uint8_t*) frame.buffer;
+    out->uv = out->y + (size_t) pitch * frame.height;
+    out->width = width;
+    out->height = height;
+    out->y_pitch = pitch;
+    out->uv_pitch = pitch;
+    out->arrangement = arrangement;
+    return true;
+}
+
+int32_t YuvOps::frame_arrangement(qvrcamera_device_helper_t* cam, qvrcamera_frame_t* frame)
+{
+    int32_t value = QVRCAMERA_FRAME_FORMAT_YUV420_NV12;
+    if (QVRCameraDevice_GetFrameParamNum(cam, frame, QVRCAMERA_FRAME_PARAM_I32_YUV420_COLOR_ARRANGEMENT,
+                                         sizeof(value), &value) != QVR_CAM_SUCCESS ||
+        value != QVRCAMERA_FRAME_FORMAT_YUV420_NV21)
+        return QVRCAMERA_FRAME_FORMAT_YUV420_NV12;
+    return QVRCAMERA_FRAME_FORMAT_YUV420_NV21;
+}
+
+bool YuvOps::deinterleave(const YuvImage& in, const Plane& u, const Plane& v)
+{
+    uint32_t w = in.width / 2;
+    uint32_t h = in.height / 2;
+    if (u.width < w || u.height < h || v.width < w || v.height < h)
+        return false;
+
+    bool simd = active_kernel() == KERNEL_SIMD;
+    bool swap = in.arrangement == QVRCAMERA_FRAME_FORMAT_YUV420_NV21;
+    pool.run(h, [&](uint32_t first, uint32_t end) {
+        for (uint32_t y = first; y < end; y++) {
+            const uint8_t* src = in.uv + (size_t) y * in.uv_pitch;
+            uint8_t* cb = (swap ? v : u).data + (size_t) y * (swap ? v : u).pitch;
+            uint8_t* cr = (swap ? u : v).data + (size_t) y * (swap ? u : v).pitch;
+            uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+            if (simd)
+                x = deinterleave_simd(src, w, cb, cr);
+#endif
+            for (; x < w; x++) {
+                cb[x] = src[2 * x];
+                cr[x] = src[2 * x + 1];
+            }
+        }
+    });
+    (void) simd;
+    return true;
+}
+
+bool YuvOps::to_nv12(YuvImage* image)
+{
+    if (image->arrangement != QVRCAMERA_FRAME_FORMAT_YUV420_NV21)
+        return image->arrangement == QVRCAMERA_FRAME_FORMAT_YUV420_NV12;
+
+    bool simd = active_kernel() == KERNEL_SIMD;
+    uint32_t w = image->width / 2;
+    pool.run(image->height / 2, [&](uint32_t first, uint32_t end) {
+        for (uint32_t y = first; y < end; y++) {
+            uint8_t* uv = image->uv + (size_t) y * image->uv_pitch;
+            uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+            if (simd)
+                x = swap_pairs_simd(uv, w);
+#endif
+            for (; x < w; x++)
+                std::swap(uv[2 * x], uv[2 * x + 1]);
+        }
+    });
+    (void) simd;
+    image->arrangement = QVRCAMERA_FRAME_FORMAT_YUV420_NV12;
+    return true;
+}
+
+bool YuvOps::downscale(const Plane& src, const Plane& dst, uint32_t factor, Filter filter)
+{
+    if (factor != 2 && factor != 4)
+        return false;
+    uint32_t w = src.width / factor;
+    uint32_t h = src.height / factor;
+    if (dst.width < w || dst.height < h)
+        return false;
+
+    bool simd = active_kernel() == KERNEL_SIMD;
+    pool.run(h, [&](uint32_t first, uint32_t end) {
+        for (uint32_t y = first; y < end; y++) {
+            const uint8_t* r[4];
+            for (uint32_t k = 0; k < factor; k++)
+                r[k] = src.data + (size_t) (y * factor + k) * src.pitch;
+            uint8_t* out = dst.data + (size_t) y * dst.pitch;
+            uint32_t x = 0;
+            if (factor == 2) {
+#if defined(HOLDER_HAVE_SIMD)
+                if (simd)
+                    x = box2_simd(r[0], r[1], w, out);
+#endif
+                for (; x < w; x++)
+                    out[x] = (uint8_t) ((r[0][2 * x] + r[0][2 * x + 1] + r[1][2 * x] + r[1][2 * x + 1] + 2) >> 2);
+            } else if (filter == FILTER_BOX) {
+#if defined(HOLDER_HAVE_SIMD)
+                if (simd)
+                    x = box4_simd(r, w, out);
+#endif
+                for (; x < w; x++) {
+                    uint32_t s = 8;
+                    for (int k = 0; k < 4; k++)
+                        s += r[k][4 * x] + r[k][4 * x + 1] + r[k][4 * x + 2] + r[k][4 * x + 3];
+                    out[x] = (uint8_t) (s >> 4);
+                }
+            } else {
+#if defined(HOLDER_HAVE_SIMD)
+                if (simd)
+                    x = center4_simd(r[1], r[2], w, out);
+#endif
+                for (; x < w; x++)
+                    out[x] = (uint8_t) ((r[1][4 * x + 1] + r[1][4 * x + 2] + r[2][4 * x + 1] + r[2][4 * x + 2] + 2) >> 2);
+            }
+        }
+    });
+    (void) simd;
+    return true;
+}
+
+bool YuvOps::to_rgba(const YuvImage& in, uint8_t* rgba, size_t pitch)
+{
+    if (pitch < (size_t) in.width * 4)
+        return false;
+
+    bool simd = active_kernel() == KERNEL_SIMD;
+    bool swap = in.arrangement == QVRCAMERA_FRAME_FORMAT_YUV420_NV21;
+    // bands of chroma rows, two luma rows each
+    pool.run(in.height / 2, [&](uint32_t first, uint32_t end) {
+        for (uint32_t cy = first; cy < end; cy++) {
+            const uint8_t* uv = in.uv + (size_t) cy * in.uv_pitch;
+            for (uint32_t y = 2 * cy; y < 2 * cy + 2; y++) {
+                const uint8_t* row = in.y + (size_t) y * in.y_pitch;
+                uint8_t* out = rgba + y * pitch;
+                uint32_t x = 0;
+#if defined(HOLDER_HAVE_SIMD)
+                if (simd)
+                    x = rgba_row_simd(row, uv, in.width, swap, out);
+#endif
+                for (; x < in.width; x++) {
+                    int cb = uv[(x & ~1u) + (swap ? 1 : 0)];
+                    int cr = uv[(x & ~1u) + (swap ? 0 : 1)];
+                    yuv_to_rgba(row[x], cb, cr, out + 4 * x);
+                }
+            }
+        }
+    });
+    (void) simd;
+    return true;
+}
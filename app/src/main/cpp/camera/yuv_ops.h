@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "camera/row_pool.h"
+
+struct Plane {
+    uint8_t* data;
+    uint32_t width;
+    uint32_t height;
+    // bytes from one row to the next
+    uint32_t pitch;
+};
+
+// Semi-planar YUV420: a full size Y plane and a half size plane of
+// interleaved chroma pairs, CbCr for NV12 and CrCb for NV21
+struct YuvImage {
+    uint8_t* y;
+    uint8_t* uv;
+    uint32_t width;
+    uint32_t height;
+    uint32_t y_pitch;
+    uint32_t uv_pitch;
+    // QVRCAMERA_FRAME_FORMAT_YUV420_ARRANGEMENT
+    int32_t arrangement;
+};
+
+// Operations on QVRCAMERA_FRAME_FORMAT_YUV420 frames, with NEON/SSE2
+// kernels and the same results from the scalar ones. With threads > 1 every
+// operation splits the image into bands of rows and runs them on a pool of
+// threads - 1 workers and the calling thread, which pays off from 2560x720
+// merged stereo frames on. One call at a time per instance.
+class YuvOps {
+public:
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SIMD,
+    };
+
+    enum Filter {
+        FILTER_BOX,
+        // samples at the destination pixel centers; the same as the box
+        // filter for 2x, the center 2x2 of each block for 4x
+        FILTER_BILINEAR,
+    };
+
+    YuvOps();
+    explicit YuvOps(int threads);
+
+    YuvOps(const YuvOps&) = delete;
+    YuvOps& operator=(const YuvOps&) = delete;
+
+    int threads() const { return pool.threads(); }
+
+    // KERNEL_SIMD falls back to scalar when the build has no vector unit
+    void set_kernel(Kernel k) { kernel = k; }
+    Kernel active_kernel() const;
+    static bool simd_available();
+
+    // The planes of a YUV420 frame: chroma follows the Y plane at the same
+    // stride. arrangement comes from frame_arrangement().
+    static bool from_frame(const qvrcamera_frame_t& frame, int32_t arrangement, YuvImage* out);
+    // QVRCAMERA_FRAME_PARAM_I32_YUV420_COLOR_ARRANGEMENT of a frame held by
+    // cam, NV12 where the service doesn't report it (API < 7)
+    static int32_t frame_arrangement(qvrcamera_device_helper_t* cam, qvrcamera_frame_t* frame);
+
+    // chroma into separate Cb (u) and Cr (v) planes of width/2 x height/2
+    bool deinterleave(const YuvImage& in, const Plane& u, const Plane& v);
+    // swaps the chroma pairs of an NV21 image in place; NV12 is left as is
+    bool to_nv12(YuvImage* image);
+    // src by 2 or 4 in both directions into dst, which is at least
+    // src / factor; odd edge pixels are dropped
+    bool downscale(const Plane& src, const Plane& dst, uint32_t factor, Filter filter);
+    // BT.601 video range to RGBA8888, alpha 255
+    bool to_rgba(const YuvImage& in, uint8_t* rgba, size_t pitch);
+
+private:
+    Kernel kernel;
+    RowPool pool;
+};
@@ -0,0 +1,182 @@
+#include "clock_domain.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "qvr/inc/QVRCameraClient.h"
+#include "qvr/inc/QVRCameraDeviceParam.h"
+#include "holder_log.h"
+#include "time_util.h"
+
+// a GetParam that took longer than this says little about when the offset
+// was read
+#define MAX_SAMPLE_CALL_NS 2000000LL
+// anything beyond 100 ppm is a bad sample, not a crystal
+#define MAX_DRIFT 100e-6
+
+ClockDomain::ClockDomain()
+    : service(NULL)
+    , camera(NULL)
+    , loop(NULL)
+    , timer_fd(-1)
+    , idle_interval(DEFAULT_IDLE_INTERVAL_NS)
+    , idle(false)
+    , sample_count(0)
+    , failure_count(0)
+    , residual(0)
+    , current_fit { 0, 0, 0 }
+    , fit_start(0)
+    , fit_end(0)
+{
+}
+
+ClockDomain::~ClockDomain()
+{
+    stop();
+}
+
+bool ClockDomain::read_offset(int64_t* offset_ns)
+{
+    char value[32];
+    uint32_t len = sizeof(value);
+    int32_t res;
+    if (service != NULL)
+        res = QVRServiceClient_GetParam(service, QVRSERVICE_TRACKER_ANDROID_OFFSET_NS, &len, value);
+    else if (camera != NULL)
+        res = QVRCameraClient_GetParam(camera, QVR_CAMCLIENT_QTIME_TO_ANDROID_BOOT_NS, &len, value);
+    else
+        return false;
+    if (res != 0)
+        return false;
+
+    value[sizeof(value) - 1] = '\0';
+    char* end = NULL;
+    errno = 0;
+    long long v = strtoll(value, &end, 10);
+    if (errno != 0 || end == value)
+        return false;
+    *offset_ns = v;
+    return true;
+}
+
+bool ClockDomain::sample()
+{
+    int64_t before = now_ns(CLOCK_BOOTTIME);
+    int64_t offset;
+    bool ok = read_offset(&offset);
+    int64_t after = now_ns(CLOCK_BOOTTIME);
+
+    if (!ok || after - before > MAX_SAMPLE_CALL_NS) {
+        failure_count++;
+        return false;
+    }
+
+    int slot = (int) (sample_count % MAX_SAMPLES);
+    sample_boot[slot] = before + (after - before) / 2;
+    sample_offset[slot] = offset;
+    sample_count++;
+    refit();
+    return true;
+}
+
+// least squares over the stored samples, centred on the newest one so the
+// doubles only hold small differences
+void ClockDomain::refit()
+{
+    int n = (int) std::min<uint64_t>(sample_count, MAX_SAMPLES);
+    int newest = (int) ((sample_count - 1) % MAX_SAMPLES);
+    int64_t x0 = sample_boot[newest];
+    int64_t y0 = sample_offset[newest];
+
+    double mx = 0, my = 0;
+    for (int i = 0; i < n; i++) {
+        mx += (double) (sample_boot[i] - x0);
+        my += (double) (sample_offset[i] - y0);
+    }
+    mx /= n;
+    my /= n;
+
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < n; i++) {
+        double dx = (double) (sample_boot[i] - x0) - mx;
+        sxx += dx * dx;
+        sxy += dx * ((double) (sample_offset[i] - y0) - my);
+    }
+    double slope = sxx > 0 ? sxy / sxx : 0;
+    slope = std::max(-MAX_DRIFT, std::min(MAX_DRIFT, slope));
+
+    ClockFit next;
+    next.base_boot_ns = x0;
+    next.offset_ns = y0 + (int64_t) (my - slope * mx);
+    next.slope_q32 = (int64_t) (slope * 4294967296.0);
+
+    int64_t worst = 0;
+    for (int i = 0; i < n; i++)
+        worst = std::max(worst, std::abs(next.offset_at(sample_boot[i]) - sample_offset[i]));
+    residual = worst;
+
+    // fields word-wise atomic, so racing readers retry rather than tear
+    uint64_t seq = fit_end.load(std::memory_order_relaxed) + 1;
+    fit_start.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    __atomic_store_n(&current_fit.base_boot_ns, next.base_boot_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&current_fit.offset_ns, next.offset_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&current_fit.slope_q32, next.slope_q32, __ATOMIC_RELAXED);
+    fit_end.store(seq, std::memory_order_release);
+}
+
+ClockFit ClockDomain::fit() const
+{
+    ClockFit f;
+    while (true) {
+        uint64_t end = fit_end.load(std::memory_order_acquire);
+        f.base_boot_ns = __atomic_load_n(&current_fit.base_boot_ns, __ATOMIC_RELAXED);
+        f.offset_ns = __atomic_load_n(&current_fit.offset_ns, __ATOMIC_RELAXED);
+        f.slope_q32 = __atomic_load_n(&current_fit.slope_q32, __ATOMIC_RELAXED);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (fit_start.load(std::memory_order_relaxed) == end)
+            return f;
+    }
+}
+
+double ClockDomain::drift_ppm() const
+{
+    return (double) fit().slope_q32 / 4294967296.0 * 1e6;
+}
+
+void ClockDomain::on_timer()
+{
+    if (sample() && !idle && sample_count >= MAX_SAMPLES) {
+        loop->arm_timer(timer_fd, idle_interval, idle_interval);
+        idle = true;
+    }
+}
+
+bool ClockDomain::start(EventLoop& l, int64_t interval_ns, int64_t idle_interval_ns)
+{
+    if (timer_fd >= 0)
+        return true;
+    if (service == NULL && camera == NULL)
+        return false;
+
+    if (!sample())
+        __log_func(ANDROID_LOG_WARN, TAG, "clock domain: first offset sample failed");
+
+    loop = &l;
+    idle_interval = std::max(idle_interval_ns, interval_ns);
+    idle = false;
+    timer_fd = loop->create_timer([this]() { on_timer(); });
+    if (timer_fd < 0)
+        return false;
+    return loop->arm_timer(timer_fd, interval_ns, interval_ns);
+}
+
+void ClockDomain::stop()
+{
+    if (timer_fd >= 0 && loop != NULL)
+        loop->destroy_fd(timer_fd);
+    timer_fd = -1;
+    loop = NULL;
+}
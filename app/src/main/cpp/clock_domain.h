@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "event_loop.h"
+
+struct qvrcamera_client_helper_t;
+
+// offset(boot) = boot - qtimer, as a line anchored at base_boot_ns with the
+// slope in 32.32 fixed point. Conversions are a few integer ops with no
+// branches, so hot loops can take one snapshot and convert freely.
+struct ClockFit {
+    int64_t base_boot_ns;
+    int64_t offset_ns;
+    int64_t slope_q32;
+
+    int64_t offset_at(int64_t boot_ns) const
+    {
+        return offset_ns + (((boot_ns - base_boot_ns) * slope_q32) >> 32);
+    }
+
+    // the slope term is evaluated at q + offset_ns instead of the exact boot
+    // time; with drift in ppm the error is far below a nanosecond
+    int64_t qtimer_to_boot(int64_t qtimer_ns) const
+    {
+        return qtimer_ns + offset_at(qtimer_ns + offset_ns);
+    }
+
+    int64_t boot_to_qtimer(int64_t boot_ns) const
+    {
+        return boot_ns - offset_at(boot_ns);
+    }
+};
+
+// Tracks the QTimer -> Android BOOTTIME offset. Poses are stamped in QTimer
+// time while eye data and camera frames use BOOTTIME; the service only hands
+// out the offset as a string param, so it is sampled periodically here and
+// fitted linearly over the last samples to follow drift.
+class ClockDomain {
+public:
+    static const int64_t DEFAULT_INTERVAL_NS = 1000000000LL;
+    static const int64_t DEFAULT_IDLE_INTERVAL_NS = 16000000000LL;
+    static const int MAX_SAMPLES = 16;
+
+    ClockDomain();
+    ~ClockDomain();
+
+    // QVRSERVICE_TRACKER_ANDROID_OFFSET_NS is used when a service client is
+    // set, QVR_CAMCLIENT_QTIME_TO_ANDROID_BOOT_NS otherwise
+    void set_service_client(qvrservice_client_helper_t* client) { service = client; }
+    void set_camera_client(qvrcamera_client_helper_t* client) { camera = client; }
+
+    // One GetParam round trip and a refit.
+    bool sample();
+
+    // Samples every interval_ns on the loop's thread until MAX_SAMPLES are
+    // in, then every idle_interval_ns: drift changes slowly, and an idle
+    // holder shouldn't wake for it every second.
+    bool start(EventLoop& loop, int64_t interval_ns = DEFAULT_INTERVAL_NS,
+               int64_t idle_interval_ns = DEFAULT_IDLE_INTERVAL_NS);
+    void stop();
+
+    bool valid() const { return fit_end.load(std::memory_order_acquire) != 0; }
+
+    // a consistent copy of the latest fit, retried while refit() writes it
+    ClockFit fit() const;
+    int64_t qtimer_to_boot(int64_t qtimer_ns) const { return fit().qtimer_to_boot(qtimer_ns); }
+    int64_t boot_to_qtimer(int64_t boot_ns) const { return fit().boot_to_qtimer(boot_ns); }
+
+    double drift_ppm() const;
+    int64_t max_residual_ns() const { return residual; }
+    uint64_t samples() const { return sample_count; }
+    uint64_t failures() const { return failure_count; }
+
+private:
+    bool read_offset(int64_t* offset_ns);
+    void refit();
+    void on_timer();
+
+    qvrservice_client_helper_t* service;
+    qvrcamera_client_helper_t* camera;
+    EventLoop* loop;
+    int timer_fd;
+    int64_t idle_interval;
+    bool idle;
+
+    // boot time at the middle of the GetParam call, and the offset read
+    int64_t sample_boot[MAX_SAMPLES];
+    int64_t sample_offset[MAX_SAMPLES];
+    uint64_t sample_count;
+    uint64_t failure_count;
+    int64_t residual;
+
+    // sequence lock: refit() bumps fit_start, writes the fields and sets
+    // fit_end to match; a copy taken while the two differ is retried.
+    // fit_end also counts the fits.
+    ClockFit current_fit;
+    std::atomic<uint64_t> fit_start;
+    std::atomic<uint64_t> fit_end;
+};
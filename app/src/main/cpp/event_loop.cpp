@@ -0,0 +1,184 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "holder_log.h"
+
+#define MAX_EVENTS 16
+
+EventLoop::EventLoop()
+    : epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+    , running(false)
+    , exit_code(0)
+    , wakeup_count(0)
+{
+    if (epoll_fd < 0)
+        __log_func(ANDROID_LOG_ERROR, TAG, "epoll_create1 failed: %d", errno);
+}
+
+EventLoop::~EventLoop()
+{
+    for (auto& h : handlers)
+        close(h.first);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+}
+
+bool EventLoop::add_fd(int fd, uint32_t events, FdHandler handler)
+{
+    if (fd < 0 || epoll_fd < 0)
+        return false;
+
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "epoll add fd %d failed: %d", fd, errno);
+        return false;
+    }
+    handlers[fd] = std::move(handler);
+    return true;
+}
+
+void EventLoop::remove_fd(int fd)
+{
+    if (handlers.erase(fd) == 0)
+        return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+void EventLoop::destroy_fd(int fd)
+{
+    remove_fd(fd);
+    close(fd);
+}
+
+int EventLoop::create_event(Handler handler)
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    bool ok = add_fd(fd, EPOLLIN, [fd, handler](uint32_t) {
+        uint64_t count;
+        if (read(fd, &count, sizeof(count)) == sizeof(count))
+            handler();
+    });
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void EventLoop::signal_event(int event_fd)
+{
+    uint64_t one = 1;
+    ssize_t res = write(event_fd, &one, sizeof(one));
+    (void) res;
+}
+
+int EventLoop::create_timer(Handler handler)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    bool ok = add_fd(fd, EPOLLIN, [fd, handler](uint32_t) {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+            handler();
+    });
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static struct timespec ns_to_timespec(int64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    return ts;
+}
+
+bool EventLoop::arm_timer(int timer_fd, int64_t delay_ns, int64_t interval_ns)
+{
+    struct itimerspec spec;
+    // a zero it_value would disarm the timer instead of firing right away
+    spec.it_value = ns_to_timespec(delay_ns > 0 ? delay_ns : 1);
+    spec.it_interval = ns_to_timespec(interval_ns);
+    return timerfd_settime(timer_fd, 0, &spec, NULL) == 0;
+}
+
+void EventLoop::disarm_timer(int timer_fd)
+{
+    struct itimerspec spec = {};
+    timerfd_settime(timer_fd, 0, &spec, NULL);
+}
+
+bool EventLoop::watch_signals(const int* signals, int count, std::function<void(int)> handler)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int i = 0; i < count; i++)
+        sigaddset(&mask, signals[i]);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+        return false;
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool ok = add_fd(fd, EPOLLIN, [fd, handler](uint32_t) {
+        struct signalfd_siginfo info;
+        while (read(fd, &info, sizeof(info)) == sizeof(info))
+            handler((int) info.ssi_signo);
+    });
+    if (!ok) {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+int EventLoop::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    running = true;
+    while (running) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            __log_func(ANDROID_LOG_ERROR, TAG, "epoll_wait failed: %d", errno);
+            return -1;
+        }
+
+        wakeup_count++;
+        for (int i = 0; i < n && running; i++) {
+            auto it = handlers.find(events[i].data.fd);
+            // copy, the handler may remove itself
+            if (it != handlers.end()) {
+                FdHandler handler = it->second;
+                handler(events[i].events);
+            }
+        }
+    }
+    return exit_code;
+}
+
+void EventLoop::quit(int code)
+{
+    exit_code = code;
+    running = false;
+}
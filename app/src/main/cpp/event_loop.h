@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <signal.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+
+// Single threaded epoll loop. The owning thread blocks in epoll_wait until an
+// fd becomes ready, a timerfd deadline expires, an eventfd is signalled from
+// another thread or one of the watched signals arrives; nothing polls.
+class EventLoop {
+public:
+    typedef std::function<void(uint32_t events)> FdHandler;
+    typedef std::function<void()> Handler;
+
+    EventLoop();
+    ~EventLoop();
+
+    bool valid() const { return epoll_fd >= 0; }
+
+    bool add_fd(int fd, uint32_t events, FdHandler handler);
+    void remove_fd(int fd);
+    // remove_fd() and close()
+    void destroy_fd(int fd);
+
+    // eventfd, handler runs on the loop thread after signal_event()
+    int create_event(Handler handler);
+    // safe from any thread and from signal handlers
+    static void signal_event(int event_fd);
+
+    // one-shot or periodic CLOCK_MONOTONIC timerfd, created disarmed
+    int create_timer(Handler handler);
+    bool arm_timer(int timer_fd, int64_t delay_ns, int64_t interval_ns = 0);
+    void disarm_timer(int timer_fd);
+
+    // blocks the signals for the whole process and delivers them through a
+    // signalfd; call before any other thread is spawned
+    bool watch_signals(const int* signals, int count, std::function<void(int)> handler);
+
+    int run();
+    void quit(int code = 0);
+
+    uint64_t wakeups() const { return wakeup_count; }
+
+private:
+    int epoll_fd;
+    bool running;
+    int exit_code;
+    uint64_t wakeup_count;
+    std::map<int, FdHandler> handlers;
+};
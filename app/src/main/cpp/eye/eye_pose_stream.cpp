@@ -0,0 +1,235 @@
+#include "eye/eye_pose_stream.h"
+
+#include <math.h>
+
+#include "holder_log.h"
+
+#define MAX_READ_ATTEMPTS 4
+
+// Elements after cursor up to latest. The service index is either a free
+// running counter or a slot number below n; both wrap.
+static uint32_t pending_after(uint32_t cursor, uint32_t latest, uint32_t n)
+{
+    if (latest < n && cursor < n)
+        return (latest + n - cursor) % n;
+    return latest - cursor;
+}
+
+static int16_t to_tenth_mm(float m)
+{
+    float v = roundf(m * 10000.0f);
+    if (v > 32767.0f)
+        return 32767;
+    if (v < -32768.0f)
+        return -32768;
+    return (int16_t) v;
+}
+
+EyePoseStream::EyePoseStream()
+    : qvr_client(NULL)
+    , sync_ctrl(NULL)
+    , caps(0)
+    , cursor(0)
+    , last_ts(0)
+    , sample_count(0)
+    , dropped_count(0)
+    , torn_count(0)
+{
+}
+
+EyePoseStream::~EyePoseStream()
+{
+    close();
+}
+
+int32_t EyePoseStream::open(qvrservice_client_helper_t* client, bool sync)
+{
+    close();
+    if (client == NULL)
+        return QVR_INVALID_PARAM;
+
+    uint32_t mode = QVRSERVICE_EYE_TRACKING_MODE_NONE;
+    if (QVRServiceClient_GetEyeTrackingMode(client, &mode, NULL) == QVR_SUCCESS &&
+        mode == QVRSERVICE_EYE_TRACKING_MODE_NONE)
+        __log_func(ANDROID_LOG_WARN, TAG, "eye tracking mode is NONE, no eye poses until it is set");
+
+    // API < 6: unknown, to_gaze() then judges the foveated gaze by its value
+    if (QVRServiceClient_GetEyeTrackingCapabilities(client, &caps) != QVR_SUCCESS)
+        caps = 0;
+
+    int32_t res = ring.map(client, RING_BUFFER_EYE_POSE, sizeof(qvrservice_eye_tracking_data_t));
+    if (res != QVR_SUCCESS)
+        __log_func(ANDROID_LOG_WARN, TAG, "eye pose ring unavailable (%d), one sample per call", res);
+
+    if (sync) {
+        sync_ctrl = QVRServiceClient_GetSyncCtrl(client, QVR_SYNC_SOURCE_EYE_POSE_CLIENT_READ);
+        if (sync_ctrl == NULL)
+            __log_func(ANDROID_LOG_WARN, TAG, "no eye pose sync ctrl, eye poses run on the service's own timing");
+    }
+
+    qvr_client = client;
+    cursor = ring.mapped() ? ring.index() : 0;
+    last_ts = 0;
+    return QVR_SUCCESS;
+}
+
+void EyePoseStream::close()
+{
+    if (sync_ctrl != NULL)
+        QVRServiceClient_ReleaseSyncCtrl(qvr_client, sync_ctrl);
+    sync_ctrl = NULL;
+    ring.unmap();
+    qvr_client = NULL;
+    caps = 0;
+}
+
+const qvrservice_eye_tracking_data_t* EyePoseStream::fetch(qvr_eye_tracking_data_flags_t flags)
+{
+    qvrservice_eye_tracking_data_t* data = NULL;
+    int32_t res = QVRServiceClient_GetEyeTrackingDataWithFlags(qvr_client, &data, 0, flags);
+    if (res == QVR_API_NOT_SUPPORTED)
+        res = QVRServiceClient_GetEyeTrackingData(qvr_client, &data, 0);
+    return res == QVR_SUCCESS ? data : NULL;
+}
+
+EyePoseStream::Range EyePoseStream::poll(uint32_t max)
+{
+    if (qvr_client == NULL || !ring.mapped())
+        return Range(&ring, 0, 0);
+
+    // the sync framework only sees calls, the data comes from the ring
+    if (sync_ctrl != NULL)
+        fetch(QVR_EYE_TRACKING_DATA_ENABLE_SYNC);
+
+    uint32_t n = ring.num_elements();
+    uint32_t latest = ring.index();
+    uint32_t count = pending_after(cursor, latest, n);
+    if (count > n - 2) {
+        // lapped, keep what the writer can't be touching
+        dropped_count += count - (n - 2);
+        cursor += count - (n - 2);
+        count = n - 2;
+    }
+    if (count > max)
+        count = max;
+
+    uint32_t first = cursor + 1;
+    cursor += count;
+    if (latest < n)
+        cursor %= n;
+    sample_count += count;
+    return Range(&ring, first, count);
+}
+
+uint32_t EyePoseStream::read(GazeSample* out, uint32_t max)
+{
+    if (qvr_client == NULL || max == 0)
+        return 0;
+
+    if (!ring.mapped()) {
+        const qvrservice_eye_tracking_data_t* data =
+            fetch(sync_ctrl != NULL ? QVR_EYE_TRACKING_DATA_ENABLE_SYNC : 0);
+        if (data == NULL || !to_gaze(*data, caps, out) || out->ts <= last_ts)
+            return 0;
+        last_ts = out->ts;
+        sample_count++;
+        return 1;
+    }
+
+    uint32_t n = 0;
+    Range range = poll(max);
+    for (Iterator it = range.begin(); it != range.end(); ++it) {
+        GazeSample* s = &out[n];
+        if (!to_gaze(*it, caps, s))
+            continue;
+        // order the loads before the lap check
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!intact(it)) {
+            torn_count++;
+            continue;
+        }
+        if (s->ts <= last_ts)
+            continue;
+        last_ts = s->ts;
+        n++;
+    }
+    return n;
+}
+
+bool EyePoseStream::read_latest(GazeSample* out)
+{
+    if (qvr_client == NULL)
+        return false;
+
+    if (!ring.mapped()) {
+        // without ENABLE_SYNC, this read must not count toward the cadence
+        const qvrservice_eye_tracking_data_t* data = fetch(0);
+        return data != NULL && to_gaze(*data, caps, out);
+    }
+
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        uint32_t latest = ring.index();
+        bool ok = to_gaze(*(const qvrservice_eye_tracking_data_t*) ring.element(latest), caps, out);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!ring.overrun(latest, ring.index()))
+            return ok;
+        torn_count++;
+    }
+    return false;
+}
+
+bool EyePoseStream::to_gaze(const qvrservice_eye_tracking_data_t& data, qvr_capabilities_flags_t caps,
+                            GazeSample* out)
+{
+    if (data.timestamp == 0)
+        return false;
+
+    uint8_t flags = 0;
+    out->ts = data.timestamp;
+    out->state = QVRSERVICE_FOVEATED_GAZE_TRACKING_STATE_LAST_KNOWN;
+
+    const float* fov = data.foveatedGazeDirection;
+    float fov_len2 = fov[0] * fov[0] + fov[1] * fov[1] + fov[2] * fov[2];
+    if ((caps == 0 || (caps & QVR_CAPABILITY_GAZE_FOVEATED_GAZE)) && fov_len2 > 0.25f) {
+        out->direction[0] = fov[0];
+        out->direction[1] = fov[1];
+        out->direction[2] = fov[2];
+        out->state = (uint8_t) data.foveatedGazeTrackingState;
+        flags |= GAZE_DIRECTION_VALID | GAZE_FOVEATED;
+    } else if (data.flags & QVR_GAZE_DIRECTION_COMBINED_VALID) {
+        out->direction[0] = data.gazeDirectionCombined[0];
+        out->direction[1] = data.gazeDirectionCombined[1];
+        out->direction[2] = data.gazeDirectionCombined[2];
+        out->state = QVRSERVICE_FOVEATED_GAZE_TRACKING_STATE_TRACKING;
+        flags |= GAZE_DIRECTION_VALID;
+    } else {
+        out->direction[0] = 0.0f;
+        out->direction[1] = 0.0f;
+        out->direction[2] = -1.0f;
+    }
+
+    if (data.flags & QVR_GAZE_ORIGIN_COMBINED_VALID) {
+        out->origin[0] = to_tenth_mm(data.gazeOriginCombined[0]);
+        out->origin[1] = to_tenth_mm(data.gazeOriginCombined[1]);
+        out->origin[2] = to_tenth_mm(data.gazeOriginCombined[2]);
+        flags |= GAZE_ORIGIN_VALID;
+    } else {
+        out->origin[0] = out->origin[1] = out->origin[2] = 0;
+    }
+
+    if (data.flags & QVR_GAZE_CONVERGENCE_DISTANCE_VALID) {
+        out->convergence = data.gazeConvergenceDistance;
+        flags |= GAZE_CONVERGENCE_VALID;
+    } else {
+        out->convergence = 0.0f;
+    }
+
+    const qvrservice_gaze_per_eye_t& left = data.eye[QVR_EYE_LEFT];
+    const qvrservice_gaze_per_eye_t& right = data.eye[QVR_EYE_RIGHT];
+    if ((left.flags & QVR_GAZE_PER_EYE_BLINK_VALID) && (right.flags & QVR_GAZE_PER_EYE_BLINK_VALID) &&
+        left.blink != 0 && right.blink != 0)
+        flags |= GAZE_BLINK;
+
+    out->flags = flags;
+    return true;
+}
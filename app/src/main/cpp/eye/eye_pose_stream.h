@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "pose/shared_ring.h"
+
+enum GazeFlags {
+    GAZE_DIRECTION_VALID = 0x01,
+    // direction is foveatedGazeDirection, state says how fresh it is
+    GAZE_FOVEATED = 0x02,
+    GAZE_ORIGIN_VALID = 0x04,
+    GAZE_CONVERGENCE_VALID = 0x08,
+    // both eyes reported closed
+    GAZE_BLINK = 0x10,
+};
+
+// What a foveated renderer needs from the 640 byte
+// qvrservice_eye_tracking_data_t, two samples per cache line.
+struct GazeSample {
+    int64_t ts;           // eye data timestamp, BOOTTIME ns
+    float direction[3];   // unit vector, HMD center-eye space
+    int16_t origin[3];    // combined gaze origin, 0.1 mm
+    uint8_t state;        // QVRSERVICE_FOVEATED_GAZE_TRACKING_STATE
+    uint8_t flags;        // GazeFlags
+    float convergence;    // m
+};
+
+static_assert(sizeof(GazeSample) == 32, "GazeSample must stay 32 bytes");
+
+// Streams eye poses out of RING_BUFFER_EYE_POSE. A cursor remembers the last
+// element handed out, so every sample the service writes is seen once and in
+// order instead of GetEyeTrackingData() sampling whatever is latest.
+//
+// With a QVR_SYNC_SOURCE_EYE_POSE_CLIENT_READ sync ctrl, every poll also
+// makes one GetEyeTrackingDataWithFlags(QVR_EYE_TRACKING_DATA_ENABLE_SYNC)
+// call: that is the read cadence the service times eye pose generation to,
+// so poll once per frame. Services without the ring fall back to that call
+// for the data too.
+class EyePoseStream {
+public:
+    class Iterator {
+    public:
+        Iterator(const SharedRing* ring, uint32_t index) : ring(ring), pos(index) {}
+
+        const qvrservice_eye_tracking_data_t& operator*() const
+        {
+            return *(const qvrservice_eye_tracking_data_t*) ring->element(pos);
+        }
+        const qvrservice_eye_tracking_data_t* operator->() const { return &**this; }
+        Iterator& operator++()
+        {
+            pos++;
+            return *this;
+        }
+        bool operator!=(const Iterator& other) const { return pos != other.pos; }
+        uint32_t index() const { return pos; }
+
+    private:
+        const SharedRing* ring;
+        uint32_t pos;
+    };
+
+    // elements straight in the mapped ring, oldest first
+    class Range {
+    public:
+        Range(const SharedRing* ring, uint32_t first, uint32_t count) : ring(ring), first(first), count(count) {}
+
+        Iterator begin() const { return Iterator(ring, first); }
+        Iterator end() const { return Iterator(ring, first + count); }
+        uint32_t size() const { return count; }
+
+    private:
+        const SharedRing* ring;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    EyePoseStream();
+    ~EyePoseStream();
+
+    EyePoseStream(const EyePoseStream&) = delete;
+    EyePoseStream& operator=(const EyePoseStream&) = delete;
+
+    // Eye tracking has to be in QVRSERVICE_EYE_TRACKING_MODE_DUAL for samples
+    // to arrive; the stream doesn't change the mode itself.
+    int32_t open(qvrservice_client_helper_t* client, bool sync = true);
+    void close();
+    bool is_open() const { return qvr_client != NULL; }
+    bool ring_mapped() const { return ring.mapped(); }
+    bool synced() const { return sync_ctrl != NULL; }
+    qvr_capabilities_flags_t capabilities() const { return caps; }
+
+    // Samples written since the previous poll, at most max, and moves the
+    // cursor past them. Empty without the ring. The elements stay valid
+    // until the writer laps them; check intact() after using one.
+    Range poll(uint32_t max = UINT32_MAX);
+    bool intact(const Iterator& it) const { return !ring.overrun(it.index(), ring.index()); }
+
+    // poll() converted to GazeSamples; torn samples are dropped, as are
+    // samples not newer than the last one returned. Returns the count.
+    uint32_t read(GazeSample* out, uint32_t max);
+
+    // newest sample without moving the cursor
+    bool read_latest(GazeSample* out);
+
+    static bool to_gaze(const qvrservice_eye_tracking_data_t& data, qvr_capabilities_flags_t caps,
+                        GazeSample* out);
+
+    uint64_t samples() const { return sample_count; }
+    // samples overwritten before a poll reached them
+    uint64_t dropped() const { return dropped_count; }
+    uint64_t torn_reads() const { return torn_count; }
+
+private:
+    const qvrservice_eye_tracking_data_t* fetch(qvr_eye_tracking_data_flags_t flags);
+
+    qvrservice_client_helper_t* qvr_client;
+    qvrsync_ctrl_t* sync_ctrl;
+    qvr_capabilities_flags_t caps;
+    SharedRing ring;
+    uint32_t cursor;
+    int64_t last_ts;
+
+    uint64_t sample_count;
+    uint64_t dropped_count;
+    uint64_t torn_count;
+};
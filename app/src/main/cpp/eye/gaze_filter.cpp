@@ -0,0 +1,299 @@
+#include "eye/gaze_filter.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "simd.h"
+
+#define RAD_TO_DEG 57.2957795f
+#define TWO_PI 6.28318531f
+
+GazeFilter::GazeFilter()
+    : kernel(KERNEL_SIMD)
+{
+    set_config(Config());
+}
+
+GazeFilter::GazeFilter(const Config& config)
+    : kernel(KERNEL_SIMD)
+{
+    set_config(config);
+}
+
+void GazeFilter::set_config(const Config& config)
+{
+    cfg = config;
+    horizon_s = (float) cfg.horizon_ns * 1e-9f;
+    max_gap_s = (float) cfg.max_gap_ns * 1e-9f;
+    reset();
+}
+
+void GazeFilter::reset()
+{
+    active = false;
+    run = 0;
+    memset(prev_ts, 0, sizeof(prev_ts));
+    memset(prev_dir, 0, sizeof(prev_dir));
+    memset(x_hat, 0, sizeof(x_hat));
+    x_hat[2] = -1.0f;
+    phase = GAZE_PHASE_LOST;
+    saccades = 0;
+    restarts = 0;
+}
+
+bool GazeFilter::simd_available()
+{
+#if defined(HOLDER_HAVE_SIMD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+GazeFilter::Kernel GazeFilter::active_kernel() const
+{
+    return kernel == KERNEL_SIMD && simd_available() ? KERNEL_SIMD : KERNEL_SCALAR;
+}
+
+void GazeFilter::process(const GazeSample* in, size_t count, FilteredGaze* out)
+{
+    bool simd = active_kernel() == KERNEL_SIMD;
+    for (size_t i = 0; i < count; i += 4) {
+        size_t n = count - i < 4 ? count - i : 4;
+        Terms t;
+        Lanes o;
+        if (simd && n == 4)
+            terms_simd(in + i, &t);
+        else
+            terms_scalar(in + i, n, &t);
+
+        for (size_t l = 0; l < n; l++)
+            step(in[i + l], t, (int) l, &o, &out[i + l]);
+
+        if (simd && n == 4)
+            store_simd(o, out + i);
+        else
+            store_scalar(o, n, out + i);
+    }
+}
+
+// the sample back (1 or 2) before in[l], from the filter state for the
+// first lanes
+#define BACK_TS(back) (l >= (back) ? in[l - (back)].ts : prev_ts[(back) - 1 - l])
+#define BACK_DIR(back) (l >= (back) ? in[l - (back)].direction : prev_dir[(back) - 1 - l])
+
+void GazeFilter::terms_scalar(const GazeSample* in, size_t n, Terms* t) const
+{
+    for (size_t l = 0; l < n; l++) {
+        const float* back = BACK_DIR(2);
+        float dt = (float) (in[l].ts - BACK_TS(1)) * 1e-9f;
+        float dt2 = (float) (in[l].ts - BACK_TS(2)) * 1e-9f;
+        float inv_dt2 = 1.0f / (dt2 > 1e-6f ? dt2 : 1e-6f);
+
+        float len2 = 0.0f;
+        for (int a = 0; a < 3; a++) {
+            float d = (in[l].direction[a] - back[a]) * inv_dt2;
+            t->d[a][l] = d;
+            len2 += d * d;
+        }
+        float speed = sqrtf(len2) * RAD_TO_DEG;
+        float k = (dt > 0.0f ? dt : 0.0f) * TWO_PI * (cfg.min_cutoff_hz + cfg.beta * speed);
+        t->dt[l] = dt;
+        t->speed[l] = speed;
+        t->alpha[l] = k / (k + 1.0f);
+    }
+}
+
+void GazeFilter::step(const GazeSample& s, const Terms& t, int l, Lanes* o, FilteredGaze* out)
+{
+    bool valid = (s.flags & GAZE_DIRECTION_VALID) && !(s.flags & GAZE_BLINK) &&
+                 s.state != QVRSERVICE_FOVEATED_GAZE_TRACKING_STATE_LAST_KNOWN;
+    float speed = t.speed[l];
+    float dt = t.dt[l];
+
+    if (!valid) {
+        phase = (s.flags & GAZE_BLINK) ? GAZE_PHASE_BLINK : GAZE_PHASE_LOST;
+        speed = 0.0f;
+        run = 0;
+    } else if (!active || run == 0 || dt <= 0.0f || dt > max_gap_s) {
+        // (re)start on the sample itself
+        for (int a = 0; a < 3; a++)
+            x_hat[a] = s.direction[a];
+        if (active)
+            restarts++;
+        active = true;
+        phase = GAZE_PHASE_FIXATION;
+        speed = 0.0f;
+        run = 1;
+    } else if (run == 1) {
+        // no two-sample speed yet
+        float k = dt * TWO_PI * cfg.min_cutoff_hz;
+        float alpha = k / (k + 1.0f);
+        for (int a = 0; a < 3; a++)
+            x_hat[a] += alpha * (s.direction[a] - x_hat[a]);
+        speed = 0.0f;
+        run = 2;
+    } else {
+        float alpha = t.alpha[l];
+        for (int a = 0; a < 3; a++)
+            x_hat[a] += alpha * (s.direction[a] - x_hat[a]);
+
+        if (phase != GAZE_PHASE_SACCADE && speed > cfg.saccade_on_dps) {
+            phase = GAZE_PHASE_SACCADE;
+            saccades++;
+        } else if (phase == GAZE_PHASE_SACCADE && speed < cfg.saccade_off_dps) {
+            // landed: whatever lag the filter built up is stale now
+            for (int a = 0; a < 3; a++)
+                x_hat[a] = s.direction[a];
+            phase = GAZE_PHASE_FIXATION;
+        }
+        run++;
+    }
+
+    prev_ts[1] = prev_ts[0];
+    prev_ts[0] = s.ts;
+    for (int a = 0; a < 3; a++) {
+        prev_dir[1][a] = prev_dir[0][a];
+        prev_dir[0][a] = s.direction[a];
+    }
+
+    bool saccade = phase == GAZE_PHASE_SACCADE;
+    for (int a = 0; a < 3; a++) {
+        o->dir[a][l] = x_hat[a];
+        o->pred[a][l] = saccade ? s.direction[a] + t.d[a][l] * horizon_s : x_hat[a];
+    }
+    out->ts = s.ts;
+    out->speed = speed;
+    out->phase = phase;
+    out->flags = s.flags;
+    out->reserved = 0;
+}
+
+void GazeFilter::store_scalar(const Lanes& o, size_t n, FilteredGaze* out)
+{
+    for (size_t l = 0; l < n; l++) {
+        float d2 = o.dir[0][l] * o.dir[0][l] + o.dir[1][l] * o.dir[1][l] + o.dir[2][l] * o.dir[2][l];
+        float p2 = o.pred[0][l] * o.pred[0][l] + o.pred[1][l] * o.pred[1][l] + o.pred[2][l] * o.pred[2][l];
+        float di = 1.0f / sqrtf(d2 > 1e-12f ? d2 : 1e-12f);
+        float pi = 1.0f / sqrtf(p2 > 1e-12f ? p2 : 1e-12f);
+        for (int a = 0; a < 3; a++) {
+            out[l].direction[a] = o.dir[a][l] * di;
+            out[l].predicted[a] = o.pred[a][l] * pi;
+        }
+    }
+}
+
+#if defined(HOLDER_HAVE_SIMD)
+
+#if defined(HOLDER_SIMD_NEON)
+typedef float32x4_t vf;
+static inline vf vf_set1(float x) { return vdupq_n_f32(x); }
+static inline vf vf_load(const float* x) { return vld1q_f32(x); }
+static inline void vf_store(float* p, vf x) { vst1q_f32(p, x); }
+static inline vf vf_add(vf a, vf b) { return vaddq_f32(a, b); }
+static inline vf vf_sub(vf a, vf b) { return vsubq_f32(a, b); }
+static inline vf vf_mul(vf a, vf b) { return vmulq_f32(a, b); }
+static inline vf vf_max(vf a, vf b) { return vmaxq_f32(a, b); }
+// a + b * c
+static inline vf vf_madd(vf a, vf b, vf c) { return vmlaq_f32(a, b, c); }
+// estimates refined by two Newton steps, armv7 has no vector divide
+static inline vf vf_recip(vf x)
+{
+    vf r = vrecpeq_f32(x);
+    r = vmulq_f32(r, vrecpsq_f32(x, r));
+    return vmulq_f32(r, vrecpsq_f32(x, r));
+}
+static inline vf vf_rsqrt(vf x)
+{
+    vf r = vrsqrteq_f32(x);
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(x, r), r));
+    return vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(x, r), r));
+}
+#else
+typedef __m128 vf;
+static inline vf vf_set1(float x) { return _mm_set1_ps(x); }
+static inline vf vf_load(const float* x) { return _mm_loadu_ps(x); }
+static inline void vf_store(float* p, vf x) { _mm_storeu_ps(p, x); }
+static inline vf vf_add(vf a, vf b) { return _mm_add_ps(a, b); }
+static inline vf vf_sub(vf a, vf b) { return _mm_sub_ps(a, b); }
+static inline vf vf_mul(vf a, vf b) { return _mm_mul_ps(a, b); }
+static inline vf vf_max(vf a, vf b) { return _mm_max_ps(a, b); }
+static inline vf vf_madd(vf a, vf b, vf c) { return _mm_add_ps(a, _mm_mul_ps(b, c)); }
+static inline vf vf_recip(vf x) { return _mm_div_ps(_mm_set1_ps(1.0f), x); }
+static inline vf vf_rsqrt(vf x) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(x)); }
+#endif
+
+static inline vf vf_len2(vf x, vf y, vf z)
+{
+    return vf_madd(vf_madd(vf_mul(x, x), y, y), z, z);
+}
+
+// Four consecutive samples, one lane each; the samples before the first
+// lanes come from the filter state.
+void GazeFilter::terms_simd(const GazeSample* in, Terms* t) const
+{
+    float cur[3][4];
+    float back[3][4];
+    float dt2s[4];
+    for (int l = 0; l < 4; l++) {
+        const float* b = BACK_DIR(2);
+        t->dt[l] = (float) (in[l].ts - BACK_TS(1)) * 1e-9f;
+        dt2s[l] = (float) (in[l].ts - BACK_TS(2)) * 1e-9f;
+        for (int a = 0; a < 3; a++) {
+            cur[a][l] = in[l].direction[a];
+            back[a][l] = b[a];
+        }
+    }
+
+    // dt <= 0 restarts the filter, the terms only have to stay finite
+    vf inv_dt2 = vf_recip(vf_max(vf_load(dt2s), vf_set1(1e-6f)));
+    vf d[3];
+    for (int a = 0; a < 3; a++) {
+        d[a] = vf_mul(vf_sub(vf_load(cur[a]), vf_load(back[a])), inv_dt2);
+        vf_store(t->d[a], d[a]);
+    }
+    vf len2 = vf_max(vf_len2(d[0], d[1], d[2]), vf_set1(1e-30f));
+    vf speed = vf_mul(vf_mul(len2, vf_rsqrt(len2)), vf_set1(RAD_TO_DEG));
+    vf_store(t->speed, speed);
+
+    vf cutoff = vf_madd(vf_set1(cfg.min_cutoff_hz), vf_set1(cfg.beta), speed);
+    vf k = vf_mul(vf_mul(vf_max(vf_load(t->dt), vf_set1(0.0f)), vf_set1(TWO_PI)), cutoff);
+    vf_store(t->alpha, vf_mul(k, vf_recip(vf_add(k, vf_set1(1.0f)))));
+}
+
+void GazeFilter::store_simd(const Lanes& o, FilteredGaze* out)
+{
+    vf dir[3], pred[3];
+    for (int a = 0; a < 3; a++) {
+        dir[a] = vf_load(o.dir[a]);
+        pred[a] = vf_load(o.pred[a]);
+    }
+    vf di = vf_rsqrt(vf_max(vf_len2(dir[0], dir[1], dir[2]), vf_set1(1e-12f)));
+    vf pi = vf_rsqrt(vf_max(vf_len2(pred[0], pred[1], pred[2]), vf_set1(1e-12f)));
+
+    float nd[3][4], np[3][4];
+    for (int a = 0; a < 3; a++) {
+        vf_store(nd[a], vf_mul(dir[a], di));
+        vf_store(np[a], vf_mul(pred[a], pi));
+    }
+    for (int l = 0; l < 4; l++) {
+        for (int a = 0; a < 3; a++) {
+            out[l].direction[a] = nd[a][l];
+            out[l].predicted[a] = np[a][l];
+        }
+    }
+}
+
+#else
+
+void GazeFilter::terms_simd(const GazeSample* in, Terms* t) const
+{
+    terms_scalar(in, 4, t);
+}
+
+void GazeFilter::store_simd(const Lanes& o, FilteredGaze* out)
+{
+    store_scalar(o, 4, out);
+}
+
+#endif
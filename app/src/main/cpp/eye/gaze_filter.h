@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eye/eye_pose_stream.h"
+
+enum GazePhase {
+    GAZE_PHASE_FIXATION,
+    GAZE_PHASE_SACCADE,
+    // held at the last direction
+    GAZE_PHASE_BLINK,
+    GAZE_PHASE_LOST,
+};
+
+struct FilteredGaze {
+    int64_t ts;
+    float direction[3];   // filtered, unit
+    float predicted[3];   // expected at ts + horizon, unit
+    float speed;          // angular speed of the raw gaze, deg/s
+    uint8_t phase;        // GazePhase
+    uint8_t flags;        // GazeFlags of the sample
+    uint16_t reserved;
+};
+
+// Streaming gaze processor for the foveation center. A One-Euro filter
+// (cutoff = min_cutoff + beta * speed) keeps the gaze still during
+// fixations without lagging saccades; a velocity threshold (I-VT) with
+// hysteresis splits saccades from fixations, and the filter snaps to the
+// landing point when a saccade ends. During a saccade the prediction
+// extrapolates the angular velocity over the horizon, otherwise it is the
+// filtered direction.
+//
+// Speed comes from a two-sample difference rather than the usual low-passed
+// one-sample derivative: it halves the velocity noise I-VT sees, and it
+// keeps everything but the final EMA out of the recursion, so velocity,
+// speed and cutoff vectorize across samples.
+//
+// Blinks, invalid and LAST_KNOWN samples hold the last output; the filter
+// restarts on the next tracked sample, as it does after a gap.
+class GazeFilter {
+public:
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SIMD,
+    };
+
+    struct Config {
+        float min_cutoff_hz = 1.0f;
+        // Hz per deg/s of gaze speed
+        float beta = 0.05f;
+        // deg/s; a saccade starts above on and ends below off
+        float saccade_on_dps = 100.0f;
+        float saccade_off_dps = 40.0f;
+        int64_t horizon_ns = 20000000LL;
+        int64_t max_gap_ns = 100000000LL;
+    };
+
+    GazeFilter();
+    explicit GazeFilter(const Config& config);
+
+    void set_config(const Config& config);
+    const Config& config() const { return cfg; }
+    void reset();
+
+    // KERNEL_SIMD falls back to scalar when the build has no vector unit
+    void set_kernel(Kernel k) { kernel = k; }
+    Kernel active_kernel() const;
+    static bool simd_available();
+
+    // count samples in time order into out[count], continuing from the
+    // previous call. Nothing is allocated; the SIMD kernel does the per
+    // sample terms and the normalization four samples at a time.
+    void process(const GazeSample* in, size_t count, FilteredGaze* out);
+
+    uint64_t saccade_count() const { return saccades; }
+    uint64_t restart_count() const { return restarts; }
+
+private:
+    // per sample terms that don't depend on the filter state
+    struct Terms {
+        float dt[4];      // s since the previous sample
+        float d[3][4];    // angular velocity over two samples, rad/s
+        float speed[4];   // |d|, deg/s
+        float alpha[4];   // One-Euro smoothing factor
+    };
+
+    // filter output before normalization, one lane per sample
+    struct Lanes {
+        float dir[3][4];
+        float pred[3][4];
+    };
+
+    void terms_scalar(const GazeSample* in, size_t n, Terms* t) const;
+    void terms_simd(const GazeSample* in, Terms* t) const;
+    void step(const GazeSample& s, const Terms& t, int l, Lanes* o, FilteredGaze* out);
+    static void store_scalar(const Lanes& o, size_t n, FilteredGaze* out);
+    static void store_simd(const Lanes& o, FilteredGaze* out);
+
+    Config cfg;
+    Kernel kernel;
+    float horizon_s;
+    float max_gap_s;
+
+    // filter state
+    bool active;
+    // tracked samples in a row, up to the current one
+    uint32_t run;
+    int64_t prev_ts[2];
+    float prev_dir[2][3];
+    float x_hat[3];
+    uint8_t phase;
+
+    uint64_t saccades;
+    uint64_t restarts;
+};
@@ -0,0 +1,66 @@
+#include "holder_log.h"
+#include "async_log.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <iostream>
+
+// global
+void* pLogDll = NULL;
+__android_log_print_fn __log_func = NULL;
+static __android_log_print_fn liblog_print = NULL;
+
+// used when liblog.so is not around, e.g. host builds against the mock service
+static int stdout_log_print(int prio, const char* tag, const char* fmt, ...)
+{
+    static const char prio_chars[] = "??VDIWEFS";
+    char p = prio >= 0 && prio < (int) sizeof(prio_chars) - 1 ? prio_chars[prio] : '?';
+
+    va_list args;
+    va_start(args, fmt);
+    flockfile(stdout);
+    fprintf(stdout, "%c/%s: ", p, tag);
+    int res = vfprintf(stdout, fmt, args);
+    fputc('\n', stdout);
+    funlockfile(stdout);
+    fflush(stdout);
+    va_end(args);
+    return res;
+}
+
+void load_log_lib()
+{
+    pLogDll = dlopen( LOG_LIB, RTLD_NOW);
+    std::cout << "log: " << pLogDll << std::endl;
+
+    if (pLogDll != NULL)
+        liblog_print = (__android_log_print_fn)dlsym(pLogDll, "__android_log_print");
+    __log_func = sync_log_func();
+
+    __log_func(ANDROID_LOG_VERBOSE, TAG, "init logs");
+}
+
+void close_log_lib()
+{
+    // the drain thread may still be writing to liblog
+    stop_async_log();
+
+    if (pLogDll == NULL)
+        return ;
+
+    // keep later log calls (atexit handlers) away from the unmapped library
+    liblog_print = NULL;
+    __log_func = stdout_log_print;
+    dlclose(pLogDll);
+    pLogDll = NULL;
+}
+
+__android_log_print_fn sync_log_func()
+{
+    return liblog_print != NULL ? liblog_print : stdout_log_print;
+}
+
+bool log_lib_loaded()
+{
+    return liblog_print != NULL;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <android/log.h>
+
+#define LOG_LIB "liblog.so"
+#define TAG "QvrHolder"
+
+typedef int (*__android_log_print_fn)(int prio, const char* tag, const char* fmt, ...);
+
+// set by load_log_lib(), never NULL afterwards
+extern __android_log_print_fn __log_func;
+
+void load_log_lib();
+void close_log_lib();
+
+// the synchronous backend: liblog's __android_log_print, or the stdout
+// fallback when liblog.so could not be loaded
+__android_log_print_fn sync_log_func();
+bool log_lib_loaded();
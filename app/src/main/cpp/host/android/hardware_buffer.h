@@ -0,0 +1,217 @@
+#pragma once
+
+// Host build stand-in for the NDK header. The qvr headers only pass
+// AHardwareBuffer around as an opaque pointer; on the host it is plain
+// memory the mock camera hands out, and locking just returns the mapping.
+// Buffers backed by a memfd go over unix sockets like the real ones: the fd
+// with SCM_RIGHTS, the receiver maps it read only.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    AHARDWAREBUFFER_FORMAT_BLOB = 0x21,
+    AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420 = 0x23,
+    AHARDWAREBUFFER_FORMAT_R8_UNORM = 0x38,
+    AHARDWAREBUFFER_FORMAT_R16_UINT = 0x39,
+};
+
+enum {
+    AHARDWAREBUFFER_USAGE_CPU_READ_RARELY = 2UL,
+    AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN = 3UL,
+};
+
+typedef struct ARect ARect;
+
+typedef struct AHardwareBuffer_Desc {
+    uint32_t width;
+    uint32_t height;
+    uint32_t layers;
+    uint32_t format;
+    uint64_t usage;
+    uint32_t stride;
+    uint32_t rfu0;
+    uint64_t rfu1;
+} AHardwareBuffer_Desc;
+
+typedef struct AHardwareBuffer_Plane {
+    void* data;
+    uint32_t pixelStride;
+    uint32_t rowStride;
+} AHardwareBuffer_Plane;
+
+typedef struct AHardwareBuffer_Planes {
+    uint32_t planeCount;
+    AHardwareBuffer_Plane planes[4];
+} AHardwareBuffer_Planes;
+
+typedef struct AHardwareBuffer {
+    AHardwareBuffer_Desc desc;
+    // host only: the mapping, bytes per row, and the CbCr plane of
+    // Y8Cb8Cr8_420 buffers
+    uint8_t* data;
+    uint32_t row_bytes;
+    uint8_t* chroma;
+    // the memfd data and chroma sit in, -1 for buffers that can't be sent;
+    // base is its mapping of map_size bytes
+    int fd;
+    uint8_t* base;
+    uint64_t map_size;
+    // received buffers are freed by the last release, others never
+    int refs;
+    int received;
+} AHardwareBuffer;
+
+// what goes with the fd
+typedef struct AHardwareBuffer_HostHandle {
+    AHardwareBuffer_Desc desc;
+    uint32_t row_bytes;
+    uint64_t map_size;
+    uint64_t data_offset;
+    // ~0 without chroma
+    uint64_t chroma_offset;
+} AHardwareBuffer_HostHandle;
+
+static inline void AHardwareBuffer_describe(const AHardwareBuffer* buffer, AHardwareBuffer_Desc* outDesc)
+{
+    *outDesc = buffer->desc;
+}
+
+static inline int AHardwareBuffer_lock(AHardwareBuffer* buffer, uint64_t usage, int32_t fence, const ARect* rect,
+                                       void** outVirtualAddress)
+{
+    (void) usage;
+    (void) fence;
+    (void) rect;
+    if (buffer == NULL || buffer->data == NULL)
+        return -22;
+    *outVirtualAddress = buffer->data;
+    return 0;
+}
+
+// Y8Cb8Cr8_420 only, chroma interleaved CbCr
+static inline int AHardwareBuffer_lockPlanes(AHardwareBuffer* buffer, uint64_t usage, int32_t fence,
+                                             const ARect* rect, AHardwareBuffer_Planes* outPlanes)
+{
+    (void) usage;
+    (void) fence;
+    (void) rect;
+    if (buffer == NULL || buffer->data == NULL || buffer->chroma == NULL)
+        return -22;
+    outPlanes->planeCount = 3;
+    outPlanes->planes[0].data = buffer->data;
+    outPlanes->planes[0].pixelStride = 1;
+    outPlanes->planes[0].rowStride = buffer->row_bytes;
+    for (int i = 1; i < 3; i++) {
+        outPlanes->planes[i].data = buffer->chroma + i - 1;
+        outPlanes->planes[i].pixelStride = 2;
+        outPlanes->planes[i].rowStride = buffer->row_bytes;
+    }
+    return 0;
+}
+
+static inline int AHardwareBuffer_unlock(AHardwareBuffer* buffer, int32_t* fence)
+{
+    if (fence != NULL)
+        *fence = -1;
+    return buffer != NULL ? 0 : -22;
+}
+
+static inline void AHardwareBuffer_acquire(AHardwareBuffer* buffer)
+{
+    __atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+static inline void AHardwareBuffer_release(AHardwareBuffer* buffer)
+{
+    if (__atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) > 0 || !buffer->received)
+        return;
+    munmap(buffer->base, buffer->map_size);
+    close(buffer->fd);
+    free(buffer);
+}
+
+static inline int AHardwareBuffer_sendHandleToUnixSocket(const AHardwareBuffer* buffer, int socketFd)
+{
+    if (buffer == NULL || buffer->fd < 0)
+        return -EINVAL;
+    AHardwareBuffer_HostHandle h;
+    memset(&h, 0, sizeof(h));
+    h.desc = buffer->desc;
+    h.row_bytes = buffer->row_bytes;
+    h.map_size = buffer->map_size;
+    h.data_offset = (uint64_t) (buffer->data - buffer->base);
+    h.chroma_offset = buffer->chroma != NULL ? (uint64_t) (buffer->chroma - buffer->base) : ~0ULL;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { &h, sizeof(h) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &buffer->fd, sizeof(int));
+    return sendmsg(socketFd, &msg, MSG_NOSIGNAL) == (ssize_t) sizeof(h) ? 0 : -errno;
+}
+
+static inline int AHardwareBuffer_recvHandleFromUnixSocket(int socketFd, AHardwareBuffer** outBuffer)
+{
+    AHardwareBuffer_HostHandle h;
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &h, sizeof(h) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(socketFd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0)
+        return -errno;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+        return -EINVAL;
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    void* base = n == (ssize_t) sizeof(h) && h.data_offset < h.map_size &&
+                         (h.chroma_offset == ~0ULL || h.chroma_offset < h.map_size)
+                     ? mmap(NULL, h.map_size, PROT_READ, MAP_SHARED, fd, 0)
+                     : MAP_FAILED;
+    AHardwareBuffer* buffer = base != MAP_FAILED ? (AHardwareBuffer*) calloc(1, sizeof(AHardwareBuffer)) : NULL;
+    if (buffer == NULL) {
+        if (base != MAP_FAILED)
+            munmap(base, h.map_size);
+        close(fd);
+        return -EINVAL;
+    }
+    buffer->desc = h.desc;
+    buffer->row_bytes = h.row_bytes;
+    buffer->fd = fd;
+    buffer->base = (uint8_t*) base;
+    buffer->map_size = h.map_size;
+    buffer->data = buffer->base + h.data_offset;
+    buffer->chroma = h.chroma_offset != ~0ULL ? buffer->base + h.chroma_offset : NULL;
+    buffer->refs = 1;
+    buffer->received = 1;
+    *outBuffer = buffer;
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
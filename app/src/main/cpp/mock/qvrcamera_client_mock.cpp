@@ -0,0 +1,2034 @@
+// Stand-in for libqvrcamera_client.so on hosts without qvrservice. Every
+// camera runs its own capture thread while started and writes synthetic
+// frames into a small pool of buffers; GetFrame() locks a buffer until the
+// client calls ReleaseFrame(), and a frame that finds every buffer locked is
+// lost, as with the real camera's buffer queue.
+//
+// Cameras, frames merged side by side where there are two sensors:
+//   tracking      Y8       1280x480  (2x 640x480)   30 Hz
+//   rgb           YUV420   2560x720  (2x 1280x720)  30 Hz, NV12
+//   depth         DEPTH16  640x480                  30 Hz
+//   eye-tracking  Y8       800x400   (2x 400x400)   60 Hz
+// stride is in bytes. The scene is a gradient and checker background with a
+// bright bar sweeping across each image; depth frames are a slanted plane
+// with sparse holes (0) and a nearer bar.
+//
+// A client holding a QVR_SYNC_SOURCE_CAMERA_FRAME_CLIENT_READ sync ctrl that
+// calls GetFrame(QVRCAMERA_MODE_NON_BLOCKING_SYNC) at a steady rate gets the
+// sensor timing slewed, at most 1/8 of a frame per frame, until frames
+// complete shortly before its reads.
+//
+// Rows land in the buffer over the 8 ms readout in 5% steps, and
+// GetFrameEx() with XrCameraPartialFrameRequestInfoInputQTI hands out a frame
+// once it is filled to the requested level; synced partial reads get the
+// sensor slewed so that level is reached shortly before them.
+//
+// The default exposure and gain render the background as is. Other settings,
+// scene light and flicker scale its luma (not the bar), SetExposureAndGain()
+// shows from the third frame on and gamma right away.
+//
+// SetCropRegion() takes two rectangles in pixels of the merged frame, the
+// second one empty for a single crop and both for whole frames again; they
+// show from the second frame on. Cropped frames hold the crops back to back
+// with packed rows, and only go out through GetFrame(). YUV420 cameras
+// don't crop.
+//
+// GetClassHandle(CLASS_ID_STREAMS_BETA) creates QVRCameraStream streams of
+// the camera's own format, at full resolution or a quarter (half width and
+// height, 2x2 box filtered, every 2x2 block's top left sample for depth).
+// Full streams hand out the camera's buffers; quarter frames are made from
+// whole frames into a pool of their own while a quarter stream is started,
+// and not while the camera crops.
+//
+// GetProperties() describes a sensor per image: components points at an
+// array of XrCameraSensorPropertiesQTI owned by the mock, whose intrinsics
+// use a FISHEYE_4 lens for tracking, RADIAL_3 for rgb and depth and
+// FISHEYE_1 for eye tracking. Full frame GetFrameEx() calls return the
+// calibration a frame was captured with through a chained
+// XrCameraFrameCalibrationInfoOutputQTI; qvrcammock_set_calibration() stands
+// in for online recalibration.
+//
+// Environment:
+//   QVRCAMMOCK_FPS          per camera frame rate, e.g. "tracking=60,rgb=15"
+//   QVRCAMMOCK_LATENCY_US   per op latency, e.g. "GetFrame=80,ReleaseFrame=20"
+//   QVRCAMMOCK_FAIL         fail the first N calls of an op, e.g. "Start=2"
+//   QVRCAMMOCK_API_VERSION  api_version reported to the helpers, default 8
+
+#include "mock/qvrcamera_mock.h"
+#include "qvr/inc/beta/QVRCameraStream.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// opaque to clients
+struct qvrsync_ctrl_t {
+    void* client;
+    QVR_SYNC_SOURCE source;
+};
+
+namespace {
+
+#define CAM_BUFFERS 8
+// exposure end to the frame being complete in memory
+#define CAM_READOUT_NS 8000000LL
+#define CAM_DEFAULT_EXPOSURE_NS 4000000ULL
+#define CAM_DEFAULT_GAIN 100
+// synced frames complete this long before the expected client read
+#define CAM_SYNC_LEAD_NS 2000000LL
+// readout goes into the buffer in this many steps, the partial fill levels
+#define CAM_FILL_STEPS 20
+#define CAM_BAR_WIDTH 24
+// frames from SetExposureAndGain() until frames show the new settings
+#define CAM_EXPOSURE_DELAY_FRAMES 3
+// frames from SetCropRegion() until frames come cropped
+#define CAM_CROP_DELAY_FRAMES 2
+
+int64_t mock_now_ns(clockid_t clock = CLOCK_MONOTONIC)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void sleep_until_ns(int64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+const char* op_names[QVRCAMMOCK_OP_MAX] = {
+    "AttachCamera",
+    "Start",
+    "Stop",
+    "GetFrame",
+    "ReleaseFrame",
+    "GetFrameEx",
+    "SetExposureAndGain",
+    "SetGammaCorrectionValue",
+    "SetCropRegion",
+    "StreamGetFrame",
+};
+
+int op_from_name(const std::string& name)
+{
+    for (int i = 0; i < QVRCAMMOCK_OP_MAX; i++) {
+        if (name == op_names[i])
+            return i;
+    }
+    return -1;
+}
+
+struct CameraSpec {
+    const char* name;
+    QVRCAMERA_FRAME_FORMAT format;
+    const char* format_name;
+    uint32_t width;
+    uint32_t height;
+    uint32_t images;
+    uint32_t fps;
+    // lens of every image: focal length in pixels and radial coefficients
+    XrDistortionModelQTI lens;
+    double focal;
+    double radial[4];
+};
+
+const CameraSpec camera_specs[] = {
+    { QVRSERVICE_CAMERA_NAME_TRACKING, QVRCAMERA_FRAME_FORMAT_Y8, QVR_CAMDEVICE_FRAME_FORMAT_Y8, 1280, 480, 2, 30,
+      XR_DISTORTION_MODEL_QTI_FISHEYE_4_PARAMS, 280.0, { 0.02, -0.005, 0.001, 0.0 } },
+    { QVRSERVICE_CAMERA_NAME_RGB, QVRCAMERA_FRAME_FORMAT_YUV420, QVR_CAMDEVICE_FRAME_FORMAT_YUV420, 2560, 720, 2, 30,
+      XR_DISTORTION_MODEL_QTI_RADIAL_3_PARAMS, 900.0, { -0.08, 0.03, -0.004, 0.0 } },
+    { QVRSERVICE_CAMERA_NAME_DEPTH, QVRCAMERA_FRAME_FORMAT_DEPTH16, QVR_CAMDEVICE_FRAME_FORMAT_DEPTH16, 640, 480, 1, 30,
+      XR_DISTORTION_MODEL_QTI_RADIAL_3_PARAMS, 520.0, { -0.12, 0.05, -0.01, 0.0 } },
+    { QVRSERVICE_CAMERA_NAME_EYE_TRACKING, QVRCAMERA_FRAME_FORMAT_Y8, QVR_CAMDEVICE_FRAME_FORMAT_Y8, 800, 400, 2, 60,
+      XR_DISTORTION_MODEL_QTI_FISHEYE_1_PARAM, 300.0, { 0.9, 0.0, 0.0, 0.0 } },
+};
+
+#define NUM_CAMERAS ((int) (sizeof(camera_specs) / sizeof(camera_specs[0])))
+
+struct CropRect {
+    uint32_t left;
+    uint32_t top;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct FrameBuffer {
+    uint8_t* data;
+    int fd;
+    uint32_t fn;
+    uint64_t sof_ts;
+    uint32_t exposure;
+    uint32_t gain;
+    uint32_t locks;
+    bool valid;
+    // rows in memory while the readout goes on, valid once complete
+    bool filling;
+    uint32_t filled_rows;
+    // what FrameToHardwareBuffer() hands out, pointing into data
+    AHardwareBuffer ahb[2];
+    qvrcamera_hwbuffer_t hw[2];
+    uint32_t num_hw;
+    // crops the frame holds, 0 for a whole frame
+    CropRect crops[2];
+    uint32_t num_crops;
+    // what GetFrameEx() reports in XrCameraFrameCalibrationInfoOutputQTI
+    XrCameraSensorCalibrationQTI calibration[2];
+};
+
+struct MockCamClient;
+struct MockCamStream;
+
+struct MockCamDevice {
+    MockCamClient* client;
+    int camera;
+    qvrsync_ctrl_t* sync;
+    // frame numbers this device has locked, one entry per GetFrame
+    std::vector<uint32_t> held;
+    std::vector<MockCamStream*> streams;
+};
+
+struct MockCamStream {
+    // first, the handle points at it
+    qvrservice_class_t cls;
+    MockCamDevice* device;
+    bool quarter;
+    bool started;
+    // Start() of the stream started the camera
+    bool started_camera;
+    std::vector<uint32_t> held;
+};
+
+struct MockCamClient {
+    std::vector<MockCamDevice*> devices;
+};
+
+struct MockCamera {
+    const CameraSpec* spec;
+    uint32_t stride;
+    uint32_t len;
+    std::vector<uint8_t> background;
+
+    std::mutex lock;
+    std::condition_variable frame_ready;
+    QVRCAMERA_CAMERA_STATUS state;
+    MockCamDevice* master;
+    FrameBuffer buffers[CAM_BUFFERS];
+    uint32_t next_buffer;
+    uint32_t latest_fn;
+    uint64_t exposure_ns;
+    uint32_t gain;
+    // SetExposureAndGain() settings waiting for frame apply_fn
+    uint64_t pending_exposure_ns;
+    uint32_t pending_gain;
+    uint32_t apply_fn;
+    float gamma;
+    uint32_t light_pct;
+    uint32_t flicker_pct;
+    uint32_t mains_hz;
+    // SetCropRegion() crops, taking effect with frame crop_apply_fn
+    CropRect crops[2];
+    uint32_t num_crops;
+    CropRect pending_crops[2];
+    uint32_t pending_num_crops;
+    uint32_t crop_apply_fn;
+    // whole frames to cut the crops from
+    std::vector<uint8_t> scratch;
+    // what GetProperties() points components at
+    XrCameraSensorPropertiesQTI sensors[2];
+    // calibration of the frames captured from now on, the sensors' until
+    // qvrcammock_set_calibration()
+    XrCameraSensorCalibrationQTI calibration[2];
+    // frames of the quarter resolution streams, while any is started
+    FrameBuffer quarter[CAM_BUFFERS];
+    uint32_t next_quarter;
+    uint32_t quarter_streams;
+    uint32_t quarter_stride;
+    uint32_t quarter_len;
+
+    qvrsync_ctrl_t* sync;
+    int64_t last_read_ns;
+    int64_t read_period_ns;
+    // filtered time of the last synced read; the reads jitter by more than
+    // the lead
+    int64_t read_phase_ns;
+    // fill level in percent the synced reader asks for, 100 with GetFrame()
+    uint32_t read_fill;
+    bool partial_read;
+
+    std::atomic<uint32_t> fps;
+    std::atomic<uint64_t> produced;
+    std::atomic<uint64_t> lost;
+};
+
+uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// left edge of the bar in each image of frame fn
+uint32_t bar_x(const CameraSpec* spec, uint32_t fn)
+{
+    return (fn * 6) % (spec->width / spec->images - CAM_BAR_WIDTH);
+}
+
+class MockCameraService {
+public:
+    static MockCameraService& get()
+    {
+        static MockCameraService* service = new MockCameraService();
+        return *service;
+    }
+
+    // latency and failure injection, returns the injected error or 0
+    int32_t enter(QVRCAMMOCK_OP op)
+    {
+        call_counts[op]++;
+        uint32_t us = latency_us[op].load(std::memory_order_relaxed);
+        if (us != 0)
+            usleep(us);
+
+        uint32_t n = fail_count[op].load(std::memory_order_relaxed);
+        while (n != 0) {
+            if (fail_count[op].compare_exchange_weak(n, n - 1))
+                return fail_error[op];
+        }
+        return 0;
+    }
+
+    int find_camera(const char* name)
+    {
+        for (int i = 0; name != NULL && i < NUM_CAMERAS; i++) {
+            if (strcmp(name, camera_specs[i].name) == 0)
+                return i;
+        }
+        return -1;
+    }
+
+    MockCamera* camera(int i) { return &cameras[i]; }
+
+    MockCamClient* create_client()
+    {
+        MockCamClient* c = new MockCamClient();
+        std::lock_guard<std::mutex> l(clients_lock);
+        clients.push_back(c);
+        return c;
+    }
+
+    void destroy_client(MockCamClient* c)
+    {
+        std::vector<MockCamDevice*> devices;
+        {
+            std::lock_guard<std::mutex> l(clients_lock);
+            devices = c->devices;
+            clients.erase(std::remove(clients.begin(), clients.end(), c), clients.end());
+        }
+        for (MockCamDevice* d : devices)
+            detach(d);
+        delete c;
+    }
+
+    MockCamDevice* attach(MockCamClient* c, const char* name)
+    {
+        int i = find_camera(name);
+        if (i < 0)
+            return NULL;
+
+        MockCamDevice* d = new MockCamDevice();
+        d->client = c;
+        d->camera = i;
+        d->sync = NULL;
+        std::lock_guard<std::mutex> l(clients_lock);
+        c->devices.push_back(d);
+        return d;
+    }
+
+    void detach(MockCamDevice* d)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::vector<MockCamStream*> streams;
+        {
+            std::lock_guard<std::mutex> l(cam->lock);
+            streams = d->streams;
+        }
+        for (MockCamStream* st : streams)
+            destroy_stream(st);
+        {
+            std::lock_guard<std::mutex> l(cam->lock);
+            for (uint32_t fn : d->held)
+                unlock_frame_locked(cam->buffers, fn);
+            d->held.clear();
+            release_sync_locked(cam, d);
+            // the camera goes down with its master
+            if (cam->master == d) {
+                cam->master = NULL;
+                if (cam->state == QVRCAMERA_CAMERA_STARTED)
+                    cam->state = QVRCAMERA_CAMERA_READY;
+                cam->frame_ready.notify_all();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> l(clients_lock);
+            std::vector<MockCamDevice*>& v = d->client->devices;
+            v.erase(std::remove(v.begin(), v.end(), d), v.end());
+        }
+        delete d;
+    }
+
+    int32_t start(MockCamDevice* d)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (cam->state != QVRCAMERA_CAMERA_READY)
+            return QVR_CAM_ERROR;
+        cam->master = d;
+        cam->state = QVRCAMERA_CAMERA_STARTED;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t stop(MockCamDevice* d)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (cam->state != QVRCAMERA_CAMERA_STARTED)
+            return QVR_CAM_DEVICE_NOT_STARTED;
+        if (cam->master != d)
+            return QVR_CAM_ERROR;
+        cam->master = NULL;
+        cam->state = QVRCAMERA_CAMERA_READY;
+        cam->frame_ready.notify_all();
+        return QVR_CAM_SUCCESS;
+    }
+
+    QVRCAMERA_CAMERA_STATUS state(MockCamDevice* d)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        return cam->state;
+    }
+
+    int32_t current_frame_number(MockCamDevice* d, int32_t* fn)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        *fn = (int32_t) cam->latest_fn;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t set_exposure_and_gain(MockCamDevice* d, uint64_t exposure_ns, int gain)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (cam->master != d)
+            return QVR_CAM_ERROR;
+        if (exposure_ns == 0 || gain <= 0)
+            return QVR_CAM_INVALID_PARAM;
+        // the sensor takes them a few frames later, like the ISP pipeline
+        cam->pending_exposure_ns = exposure_ns;
+        cam->pending_gain = (uint32_t) gain;
+        cam->apply_fn = cam->latest_fn + CAM_EXPOSURE_DELAY_FRAMES;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t set_gamma(MockCamDevice* d, float gamma)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (cam->master != d)
+            return QVR_CAM_ERROR;
+        if (!(gamma > 0.0f))
+            return QVR_CAM_INVALID_PARAM;
+        cam->gamma = gamma;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t set_crop_region(MockCamDevice* d, const CropRect* rects)
+    {
+        MockCamera* cam = camera(d->camera);
+        const CameraSpec* spec = cam->spec;
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < 2; i++) {
+            const CropRect& r = rects[i];
+            if (r.width == 0 || r.height == 0)
+                continue;
+            // an empty first crop with a second one isn't a layout
+            if (n != i || r.left + r.width > spec->width || r.top + r.height > spec->height)
+                return QVR_CAM_INVALID_PARAM;
+            n++;
+        }
+        if (n != 0 && spec->format == QVRCAMERA_FRAME_FORMAT_YUV420)
+            return QVR_CAM_API_NOT_SUPPORTED;
+
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (cam->master != d)
+            return QVR_CAM_ERROR;
+        cam->pending_crops[0] = rects[0];
+        cam->pending_crops[1] = rects[1];
+        cam->pending_num_crops = n;
+        cam->crop_apply_fn = cam->latest_fn + CAM_CROP_DELAY_FRAMES;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t set_scene_light(MockCamera* cam, uint32_t level_pct, uint32_t flicker_pct, uint32_t mains_hz)
+    {
+        if (flicker_pct > 100)
+            return QVR_CAM_INVALID_PARAM;
+        std::lock_guard<std::mutex> l(cam->lock);
+        cam->light_pct = level_pct;
+        cam->flicker_pct = flicker_pct;
+        cam->mains_hz = mains_hz;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t set_calibration(MockCamera* cam, uint32_t image, const XrIntrinsicCalibrationQTI* intrinsics)
+    {
+        if (image >= cam->spec->images || intrinsics == NULL)
+            return QVR_CAM_INVALID_PARAM;
+        std::lock_guard<std::mutex> l(cam->lock);
+        cam->calibration[image].intrinsics = *intrinsics;
+        cam->calibration[image].flags |= XR_CAMERA_SENSOR_CALIBRATION_DYNAMIC_BIT;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t get_frame(MockCamDevice* d, int32_t* fn, QVRCAMERA_BLOCK_MODE block, QVRCAMERA_DROP_MODE drop,
+                      qvrcamera_frame_t* frame)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::unique_lock<std::mutex> l(cam->lock);
+        if (block == QVRCAMERA_MODE_NON_BLOCKING_SYNC) {
+            if (d->sync == NULL)
+                return QVR_CAM_INVALID_PARAM;
+            note_sync_read_locked(cam, d->sync, 100);
+        }
+
+        FrameBuffer* buf = NULL;
+        int32_t res = wait_frame_locked(cam, l, cam->buffers, (uint32_t) *fn, block == QVRCAMERA_MODE_BLOCKING,
+                                        drop == QVRCAMERA_MODE_EXPLICIT_FRAME_NUMBER, 100, &buf);
+        if (res != QVR_CAM_SUCCESS)
+            return res;
+        buf->locks++;
+        d->held.push_back(buf->fn);
+        fill_frame(cam, buf, frame);
+        *fn = (int32_t) buf->fn;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t get_frame_ex(MockCamDevice* d, const XrCameraFrameRequestInfoInputQTI* in,
+                         XrCameraFrameRequestInfoOutputQTI* out)
+    {
+        const XrCameraPartialFrameRequestInfoInputQTI* partial = NULL;
+        if (in->next != NULL) {
+            if (in->next->type != XR_TYPE_QTI_CAM_PARTIAL_FRAME_REQ_INFO_INPUT)
+                return QVR_CAM_INVALID_PARAM;
+            partial = (const XrCameraPartialFrameRequestInfoInputQTI*) in->next;
+            if (partial->fillPercentage < 5 || partial->fillPercentage > 100 || partial->fillPercentage % 5 != 0)
+                return QVR_CAM_INVALID_PARAM;
+        }
+        XrCameraPartialFrameRequestInfoOutputQTI* partial_out = NULL;
+        XrCameraFrameCalibrationInfoOutputQTI* calibration_out = NULL;
+        for (const XrBaseStructQTI* n = out->next; n != NULL; n = n->next) {
+            if (n->type == XR_TYPE_QTI_CAM_PARTIAL_FRAME_REQ_INFO_OUTPUT)
+                partial_out = (XrCameraPartialFrameRequestInfoOutputQTI*) n;
+            else if (n->type == XR_TYPE_QTI_CAM_FRAME_CALIBRATION_INFO)
+                calibration_out = (XrCameraFrameCalibrationInfoOutputQTI*) n;
+        }
+        if (partial != NULL && partial_out == NULL)
+            return QVR_CAM_INVALID_PARAM;
+
+        MockCamera* cam = camera(d->camera);
+        uint32_t images = cam->spec->images;
+        if (calibration_out != NULL && calibration_out->calibrationCapacityIn != 0 &&
+            (calibration_out->calibrationCapacityIn < images || calibration_out->calibrations == NULL)) {
+            calibration_out->calibrationCount = images;
+            return QVR_CAM_SIZE_INSUFFICIENT;
+        }
+        // partial reads get the hardware buffers, full ones the merged image
+        uint32_t num_hw = cam->buffers[0].num_hw;
+        {
+            std::lock_guard<std::mutex> l(cam->lock);
+            if (cam->num_crops != 0 || cam->crop_apply_fn != 0)
+                return QVR_CAM_ERROR;
+        }
+        if (partial != NULL && (out->hwBufferInfo.hwBufferCapacityIn < num_hw || out->hwBufferInfo.hwBuffers == NULL)) {
+            out->hwBufferInfo.hwBufferCount = num_hw;
+            return QVR_CAM_SIZE_INSUFFICIENT;
+        }
+        if (partial == NULL && (out->bufferInfo.bufferCapacityIn < 1 || out->bufferInfo.buffers == NULL)) {
+            out->bufferInfo.bufferCount = 1;
+            return QVR_CAM_SIZE_INSUFFICIENT;
+        }
+
+        std::unique_lock<std::mutex> l(cam->lock);
+        if (partial != NULL && !cam->partial_read)
+            return QVR_CAM_PARTIAL_FRAME_NOT_ENABLED;
+        uint32_t fill = partial != NULL ? partial->fillPercentage : 100;
+        if (in->blockMode == XR_CAMERA_BLOCK_MODE_QTI_NON_BLOCKING_SYNC) {
+            if (d->sync == NULL)
+                return QVR_CAM_INVALID_PARAM;
+            note_sync_read_locked(cam, d->sync, fill);
+        }
+
+        FrameBuffer* buf = NULL;
+        int32_t res = wait_frame_locked(cam, l, cam->buffers, (uint32_t) in->frameNum,
+                                        in->blockMode == XR_CAMERA_BLOCK_MODE_QTI_BLOCKING, in->dropMode == XR_CAMERA_DROP_MODE_QTI_EXPLICIT_FRAME_NUMBER, fill, &buf);
+        if (res != QVR_CAM_SUCCESS)
+            return res;
+        buf->locks++;
+        d->held.push_back(buf->fn);
+
+        bool yuv = cam->spec->format == QVRCAMERA_FRAME_FORMAT_YUV420;
+        out->flags = buf->valid ? 0 : XR_CAMERA_REQUEST_INFO_OUTPUT_QTI_SETTINGS_ESTIMATED_BIT;
+        out->frameNum = buf->fn;
+        out->peerFrameNum = 0;
+        out->frameInfo.flags = 0;
+        out->frameInfo.startOfExposureNs = buf->sof_ts;
+        out->frameInfo.exposureNs = buf->exposure;
+        out->frameInfo.gain = buf->gain;
+        out->frameInfo.rollingShutterSkewNs = CAM_READOUT_NS;
+        out->frameInfo.targetRollingShutterSkewNs = CAM_READOUT_NS;
+        out->frameInfo.autoExposureMode = 0;
+        if (partial != NULL) {
+            out->hwBufferInfo.hwBufferCount = num_hw;
+            for (uint32_t i = 0; i < num_hw; i++) {
+                XrCameraHwBufferOutputQTI* hw = &out->hwBufferInfo.hwBuffers[i];
+                hw->flags = XR_CAMERA_HW_BUFFER_INFO_OUTPUT_QTI_BUFFER_LOCKED_BIT |
+                            (yuv ? XR_CAMERA_HW_BUFFER_INFO_OUTPUT_QTI_YUV420NV12_VALID_BIT : 0);
+                hw->buf = buf->hw[i].buf;
+                hw->offset = buf->hw[i].offset;
+                hw->bufVAddr = buf->ahb[i].data;
+            }
+            partial_out->fillPercentage = buf->valid ? 100 : buf->filled_rows * 100 / cam->spec->height;
+            partial_out->frameType =
+                buf->valid ? XR_CAMERA_PARTIAL_FRAME_TYPE_QTI_REGULAR : XR_CAMERA_PARTIAL_FRAME_TYPE_QTI_PARTIAL;
+        } else {
+            XrCameraFrameBufferOutputQTI* b = &out->bufferInfo.buffers[0];
+            out->flags |= XR_CAMERA_REQUEST_INFO_OUTPUT_QTI_BUFFER_INFO_VALID_BIT;
+            out->bufferInfo.bufferCount = 1;
+            b->flags = yuv ? XR_CAMERA_FRAME_BUFFER_INFO_OUTPUT_QTI_YUV420NV12_VALID_BIT : 0;
+            b->format = cam->spec->format;
+            b->len = cam->len;
+            b->width = cam->spec->width;
+            b->height = cam->spec->height;
+            b->stride = cam->stride;
+            b->offset.x = 0;
+            b->offset.y = 0;
+            b->bufVAddr = buf->data;
+        }
+        // a size request only gets the count
+        if (calibration_out != NULL) {
+            calibration_out->calibrationCount = images;
+            for (uint32_t i = 0; i < images && calibration_out->calibrationCapacityIn != 0; i++)
+                calibration_out->calibrations[i] = buf->calibration[i];
+        }
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t release_frame(MockCamDevice* d, int32_t fn)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        std::vector<uint32_t>::iterator it = std::find(d->held.begin(), d->held.end(), (uint32_t) fn);
+        if (it == d->held.end())
+            return QVR_CAM_INVALID_PARAM;
+        d->held.erase(it);
+        unlock_frame_locked(cam->buffers, (uint32_t) fn);
+        return QVR_CAM_SUCCESS;
+    }
+
+    // A stream for uri "format=..&res=..", NULL for formats other than the
+    // camera's and unknown properties
+    MockCamStream* create_stream(MockCamDevice* d, const char* uri, qvrcamera_stream_ops_t* ops)
+    {
+        MockCamera* cam = camera(d->camera);
+        bool quarter = false;
+        std::string s(uri != NULL ? uri : "");
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t end = s.find('&', pos);
+            if (end == std::string::npos)
+                end = s.size();
+            std::string item = s.substr(pos, end - pos);
+            size_t eq = item.find('=');
+            std::string key = item.substr(0, eq);
+            std::string value = eq != std::string::npos ? item.substr(eq + 1) : "";
+            if (key == "format") {
+                if (value != cam->spec->format_name)
+                    return NULL;
+            } else if (key == "res") {
+                if (value == QVR_CAMDEVICE_RESOLUTION_MODE_QUARTER)
+                    quarter = true;
+                else if (value == QVR_CAMDEVICE_RESOLUTION_MODE_FULL)
+                    quarter = false;
+                else
+                    return NULL;
+            } else if (!item.empty()) {
+                return NULL;
+            }
+            pos = end + 1;
+        }
+
+        MockCamStream* st = new MockCamStream();
+        st->cls.api_version = QVRSTREAMS_API_VERSION_BETA_1;
+        // there is no structure type for streams
+        st->cls.type = XR_TYPE_QTI_MAX_ENUM;
+        st->cls.ops = ops;
+        st->device = d;
+        st->quarter = quarter;
+        st->started = false;
+        st->started_camera = false;
+        std::lock_guard<std::mutex> l(cam->lock);
+        d->streams.push_back(st);
+        return st;
+    }
+
+    void destroy_stream(MockCamStream* st)
+    {
+        MockCamDevice* d = st->device;
+        MockCamera* cam = camera(d->camera);
+        stop_stream(st);
+        std::lock_guard<std::mutex> l(cam->lock);
+        for (uint32_t fn : st->held)
+            unlock_frame_locked(st->quarter ? cam->quarter : cam->buffers, fn);
+        d->streams.erase(std::remove(d->streams.begin(), d->streams.end(), st), d->streams.end());
+        delete st;
+    }
+
+    // starts the camera too when it isn't running, with the stream's device
+    // as its master
+    int32_t start_stream(MockCamStream* st)
+    {
+        MockCamDevice* d = st->device;
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (st->started)
+            return QVR_CAM_SUCCESS;
+        if (cam->state == QVRCAMERA_CAMERA_READY) {
+            cam->master = d;
+            cam->state = QVRCAMERA_CAMERA_STARTED;
+            st->started_camera = true;
+        } else if (cam->state != QVRCAMERA_CAMERA_STARTED) {
+            return QVR_CAM_ERROR;
+        }
+        st->started = true;
+        if (st->quarter)
+            cam->quarter_streams++;
+        return QVR_CAM_SUCCESS;
+    }
+
+    // stops the camera with the last started stream of the device that
+    // started it
+    int32_t stop_stream(MockCamStream* st)
+    {
+        MockCamDevice* d = st->device;
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (!st->started)
+            return QVR_CAM_DEVICE_NOT_STARTED;
+        st->started = false;
+        if (st->quarter)
+            cam->quarter_streams--;
+        if (st->started_camera) {
+            st->started_camera = false;
+            MockCamStream* heir = NULL;
+            for (MockCamStream* other : d->streams) {
+                if (other->started)
+                    heir = other;
+            }
+            if (heir != NULL) {
+                heir->started_camera = true;
+            } else if (cam->master == d && cam->state == QVRCAMERA_CAMERA_STARTED) {
+                cam->master = NULL;
+                cam->state = QVRCAMERA_CAMERA_READY;
+            }
+        }
+        cam->frame_ready.notify_all();
+        return QVR_CAM_SUCCESS;
+    }
+
+    QVRCAMERA_CAMERA_STATUS stream_state(MockCamStream* st)
+    {
+        MockCamera* cam = camera(st->device->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        return st->started ? cam->state : QVRCAMERA_CAMERA_READY;
+    }
+
+    int32_t stream_get_frame(MockCamStream* st, int32_t* fn, QVRCAMERA_BLOCK_MODE block, QVRCAMERA_DROP_MODE drop,
+                             qvrcamera_frame_t* frame)
+    {
+        // streams have no sync ctrl
+        if (block == QVRCAMERA_MODE_NON_BLOCKING_SYNC)
+            return QVR_CAM_INVALID_PARAM;
+
+        MockCamera* cam = camera(st->device->camera);
+        std::unique_lock<std::mutex> l(cam->lock);
+        if (!st->started)
+            return QVR_CAM_DEVICE_NOT_STARTED;
+        FrameBuffer* buf = NULL;
+        int32_t res = wait_frame_locked(cam, l, st->quarter ? cam->quarter : cam->buffers, (uint32_t) *fn,
+                                        block == QVRCAMERA_MODE_BLOCKING, drop == QVRCAMERA_MODE_EXPLICIT_FRAME_NUMBER,
+                                        100, &buf);
+        if (res != QVR_CAM_SUCCESS)
+            return res;
+        buf->locks++;
+        st->held.push_back(buf->fn);
+        fill_frame(cam, buf, frame);
+        if (st->quarter) {
+            frame->width = cam->spec->width / 2;
+            frame->height = cam->spec->height / 2;
+            frame->stride = cam->quarter_stride;
+            frame->len = cam->quarter_len;
+        }
+        *fn = (int32_t) buf->fn;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t stream_release_frame(MockCamStream* st, int32_t fn)
+    {
+        MockCamera* cam = camera(st->device->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        std::vector<uint32_t>::iterator it = std::find(st->held.begin(), st->held.end(), (uint32_t) fn);
+        if (it == st->held.end())
+            return QVR_CAM_INVALID_PARAM;
+        st->held.erase(it);
+        unlock_frame_locked(st->quarter ? cam->quarter : cam->buffers, (uint32_t) fn);
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t properties(MockCamDevice* d, XrCameraDevicePropertiesQTI* props)
+    {
+        MockCamera* cam = camera(d->camera);
+        const CameraSpec* spec = cam->spec;
+        memset(props, 0, sizeof(*props));
+        props->base.type = XR_TYPE_QTI_CAM_DEVICE_PROPS;
+        props->base.deviceType = XR_HW_DEVICE_TYPE_QTI_CAMERA;
+        props->base.handle = (XrHandleQTI) (d->camera + 1);
+        snprintf(props->base.deviceName, sizeof(props->base.deviceName), "%s", spec->name);
+        props->base.componentCount = spec->images;
+        props->base.components = &cam->sensors[0].base;
+        props->fullResExtent.width = (int32_t) spec->width;
+        props->fullResExtent.height = (int32_t) spec->height;
+        return QVR_CAM_SUCCESS;
+    }
+
+    int32_t frame_to_hardware_buffer(MockCamDevice* d, qvrcamera_frame_t* frame, uint32_t* num,
+                                     qvrcamera_hwbuffer_t** bufs)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        // only frames this device holds
+        if (std::find(d->held.begin(), d->held.end(), (uint32_t) frame->fn) == d->held.end())
+            return QVR_CAM_INVALID_PARAM;
+        for (FrameBuffer& b : cam->buffers) {
+            if (b.valid && b.fn == (uint32_t) frame->fn && b.locks > 0 && b.data == frame->buffer && b.num_crops == 0) {
+                *num = b.num_hw;
+                *bufs = b.hw;
+                return QVR_CAM_SUCCESS;
+            }
+        }
+        return QVR_CAM_INVALID_PARAM;
+    }
+
+    qvrsync_ctrl_t* get_sync_ctrl(MockCamDevice* d, QVR_SYNC_SOURCE source)
+    {
+        if (source != QVR_SYNC_SOURCE_CAMERA_FRAME_CLIENT_READ)
+            return NULL;
+
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (d->sync == NULL) {
+            d->sync = new qvrsync_ctrl_t();
+            d->sync->client = d;
+            d->sync->source = source;
+        }
+        // the newest reader drives the sensor timing
+        cam->sync = d->sync;
+        cam->last_read_ns = 0;
+        cam->read_period_ns = 0;
+        cam->read_phase_ns = 0;
+        return d->sync;
+    }
+
+    int32_t release_sync_ctrl(MockCamDevice* d, qvrsync_ctrl_t* ctrl)
+    {
+        MockCamera* cam = camera(d->camera);
+        std::lock_guard<std::mutex> l(cam->lock);
+        if (ctrl == NULL || d->sync != ctrl)
+            return QVR_CAM_INVALID_PARAM;
+        release_sync_locked(cam, d);
+        return QVR_CAM_SUCCESS;
+    }
+
+    bool partial_read(MockCamera* cam)
+    {
+        std::lock_guard<std::mutex> l(cam->lock);
+        return cam->partial_read;
+    }
+
+    void set_partial_read(MockCamera* cam, bool enable)
+    {
+        std::lock_guard<std::mutex> l(cam->lock);
+        cam->partial_read = enable;
+    }
+
+    uint64_t exposure_ns(MockCamera* cam)
+    {
+        std::lock_guard<std::mutex> l(cam->lock);
+        return cam->exposure_ns;
+    }
+
+    int64_t qtime_to_boot_ns() const
+    {
+        return mock_now_ns(CLOCK_BOOTTIME) - mock_now_ns(CLOCK_MONOTONIC);
+    }
+
+    std::atomic<uint32_t> latency_us[QVRCAMMOCK_OP_MAX];
+    std::atomic<uint32_t> fail_count[QVRCAMMOCK_OP_MAX];
+    int32_t fail_error[QVRCAMMOCK_OP_MAX];
+    std::atomic<uint64_t> call_counts[QVRCAMMOCK_OP_MAX];
+    int api_version;
+
+private:
+    MockCameraService()
+        : api_version(QVRCAMERACLIENT_API_VERSION_8)
+    {
+        for (int i = 0; i < QVRCAMMOCK_OP_MAX; i++) {
+            latency_us[i] = 0;
+            fail_count[i] = 0;
+            fail_error[i] = QVR_CAM_ERROR;
+            call_counts[i] = 0;
+        }
+
+        for (int i = 0; i < NUM_CAMERAS; i++) {
+            MockCamera* cam = &cameras[i];
+            const CameraSpec* spec = &camera_specs[i];
+            cam->spec = spec;
+            cam->stride = spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16 ? spec->width * 2 : spec->width;
+            cam->len = spec->format == QVRCAMERA_FRAME_FORMAT_YUV420 ? cam->stride * spec->height * 3 / 2
+                                                                      : cam->stride * spec->height;
+            cam->state = QVRCAMERA_CAMERA_READY;
+            cam->master = NULL;
+            for (FrameBuffer& b : cam->buffers) {
+                memset(&b, 0, sizeof(b));
+                // in a memfd so the hardware buffers can be sent to other
+                // processes; page aligned suits the vector kernels too
+                b.fd = memfd_create("qvrcammock", MFD_CLOEXEC);
+                void* p = MAP_FAILED;
+                if (b.fd >= 0 && ftruncate(b.fd, cam->len) == 0)
+                    p = mmap(NULL, cam->len, PROT_READ | PROT_WRITE, MAP_SHARED, b.fd, 0);
+                if (p != MAP_FAILED)
+                    b.data = (uint8_t*) p;
+                setup_hardware_buffers(cam, &b);
+            }
+            uint32_t bpp = spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16 ? 2 : 1;
+            cam->quarter_stride = spec->width / 2 * bpp;
+            cam->quarter_len = spec->format == QVRCAMERA_FRAME_FORMAT_YUV420
+                                   ? cam->quarter_stride * (spec->height / 2) * 3 / 2
+                                   : cam->quarter_stride * (spec->height / 2);
+            for (FrameBuffer& b : cam->quarter) {
+                memset(&b, 0, sizeof(b));
+                b.fd = -1;
+                void* p = mmap(NULL, cam->quarter_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p != MAP_FAILED)
+                    b.data = (uint8_t*) p;
+            }
+            cam->next_quarter = 0;
+            setup_sensors(cam);
+            cam->quarter_streams = 0;
+            cam->next_buffer = 0;
+            cam->latest_fn = 0;
+            cam->exposure_ns = CAM_DEFAULT_EXPOSURE_NS;
+            cam->gain = CAM_DEFAULT_GAIN;
+            cam->apply_fn = 0;
+            cam->gamma = 1.0f;
+            cam->light_pct = 100;
+            cam->flicker_pct = 0;
+            cam->mains_hz = 50;
+            memset(cam->crops, 0, sizeof(cam->crops));
+            cam->num_crops = 0;
+            cam->pending_num_crops = 0;
+            cam->crop_apply_fn = 0;
+            cam->sync = NULL;
+            cam->last_read_ns = 0;
+            cam->read_period_ns = 0;
+            cam->read_phase_ns = 0;
+            cam->read_fill = 100;
+            cam->partial_read = true;
+            cam->fps = spec->fps;
+            cam->produced = 0;
+            cam->lost = 0;
+            render_background(cam);
+        }
+        parse_env();
+
+        for (int i = 0; i < NUM_CAMERAS; i++)
+            std::thread(&MockCameraService::capture_loop, this, &cameras[i]).detach();
+    }
+
+    void parse_op_list(const char* env, bool latency)
+    {
+        const char* value = getenv(env);
+        if (value == NULL)
+            return;
+
+        std::string s(value);
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t end = s.find(',', pos);
+            if (end == std::string::npos)
+                end = s.size();
+            std::string item = s.substr(pos, end - pos);
+            size_t eq = item.find('=');
+            int op = eq != std::string::npos ? op_from_name(item.substr(0, eq)) : -1;
+            if (op < 0) {
+                fprintf(stderr, "qvrcammock: bad %s entry '%s'\n", env, item.c_str());
+            } else if (latency) {
+                latency_us[op] = (uint32_t) strtoul(item.c_str() + eq + 1, NULL, 0);
+            } else {
+                fail_count[op] = (uint32_t) strtoul(item.c_str() + eq + 1, NULL, 0);
+            }
+            pos = end + 1;
+        }
+    }
+
+    void parse_env()
+    {
+        parse_op_list("QVRCAMMOCK_LATENCY_US", true);
+        parse_op_list("QVRCAMMOCK_FAIL", false);
+
+        const char* version = getenv("QVRCAMMOCK_API_VERSION");
+        if (version != NULL)
+            api_version = atoi(version);
+
+        const char* value = getenv("QVRCAMMOCK_FPS");
+        if (value == NULL)
+            return;
+        std::string s(value);
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t end = s.find(',', pos);
+            if (end == std::string::npos)
+                end = s.size();
+            std::string item = s.substr(pos, end - pos);
+            size_t eq = item.find('=');
+            int i = eq != std::string::npos ? find_camera(item.substr(0, eq).c_str()) : -1;
+            uint32_t fps = i >= 0 ? (uint32_t) strtoul(item.c_str() + eq + 1, NULL, 0) : 0;
+            if (fps == 0)
+                fprintf(stderr, "qvrcammock: bad QVRCAMMOCK_FPS entry '%s'\n", item.c_str());
+            else
+                cameras[i].fps = fps;
+            pos = end + 1;
+        }
+    }
+
+    void render_background(MockCamera* cam)
+    {
+        const CameraSpec* spec = cam->spec;
+        uint32_t image_w = spec->width / spec->images;
+        cam->background.assign(cam->len, 0);
+        uint8_t* p = cam->background.data();
+
+        if (spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16) {
+            for (uint32_t y = 0; y < spec->height; y++) {
+                uint16_t* row = (uint16_t*) (p + (size_t) y * cam->stride);
+                for (uint32_t x = 0; x < spec->width; x++) {
+                    // 1.5 m at the top, 3 m at the bottom, full confidence
+                    uint16_t mm = (uint16_t) (1500 + y * 1500 / spec->height);
+                    row[x] = (hash32(y * spec->width + x) & 31) == 0 ? 0 : mm;
+                }
+            }
+            return;
+        }
+
+        for (uint32_t y = 0; y < spec->height; y++) {
+            uint8_t* row = p + (size_t) y * cam->stride;
+            for (uint32_t x = 0; x < spec->width; x++) {
+                uint32_t ix = x % image_w;
+                int v = 40 + (int) (ix * 140 / image_w);
+                v += (((ix / 40) ^ (y / 40)) & 1) ? 24 : -24;
+                row[x] = (uint8_t) v;
+            }
+        }
+        if (spec->format == QVRCAMERA_FRAME_FORMAT_YUV420) {
+            uint8_t* uv = p + (size_t) cam->stride * spec->height;
+            for (uint32_t y = 0; y < spec->height / 2; y++) {
+                uint8_t* row = uv + (size_t) y * cam->stride;
+                for (uint32_t x = 0; x < spec->width / 2; x++) {
+                    row[2 * x] = (uint8_t) (96 + (x % (image_w / 2)) * 64 / (image_w / 2));
+                    row[2 * x + 1] = (uint8_t) (96 + y * 64 / (spec->height / 2));
+                }
+            }
+        }
+    }
+
+    // Luma of the background through exposure, gain, light and gamma; false
+    // when that leaves it as is
+    bool exposure_lut(MockCamera* cam, uint64_t exposure, uint32_t gain, uint64_t sof_ts, uint8_t lut[256])
+    {
+        float gamma;
+        double light;
+        {
+            std::lock_guard<std::mutex> l(cam->lock);
+            gamma = cam->gamma;
+            light = cam->light_pct / 100.0;
+            // mean of 1 + a sin(wt) over the exposure
+            if (cam->flicker_pct != 0 && cam->mains_hz != 0) {
+                double w = 2.0 * M_PI * 2.0 * cam->mains_hz;
+                double period_ns = 1e9 / (2.0 * cam->mains_hz);
+                double t0 = fmod((double) sof_ts, period_ns) * 1e-9;
+                double e = (double) exposure * 1e-9;
+                light *= 1.0 + cam->flicker_pct / 100.0 * (cos(w * t0) - cos(w * (t0 + e))) / (w * e);
+            }
+        }
+        double scale = (double) exposure / CAM_DEFAULT_EXPOSURE_NS * gain / CAM_DEFAULT_GAIN * light;
+        if (fabs(scale - 1.0) < 1e-6 && gamma == 1.0f)
+            return false;
+        for (int v = 0; v < 256; v++) {
+            double x = std::min(v * scale / 255.0, 1.0);
+            lut[v] = (uint8_t) lrint(255.0 * pow(x, 1.0 / gamma));
+        }
+        return true;
+    }
+
+    // rows [y0, y1) of the background plus a bar sweeping across every
+    // image, and the chroma rows that go with them; lut maps the background
+    // luma, the bar stays as is
+    void render(MockCamera* cam, uint8_t* dst, uint32_t fn, uint32_t y0, uint32_t y1, const uint8_t* lut)
+    {
+        const CameraSpec* spec = cam->spec;
+        const uint32_t bar = CAM_BAR_WIDTH;
+        uint32_t image_w = spec->width / spec->images;
+        uint32_t bx = bar_x(spec, fn);
+        memcpy(dst + (size_t) y0 * cam->stride, cam->background.data() + (size_t) y0 * cam->stride,
+               (size_t) (y1 - y0) * cam->stride);
+        if (spec->format == QVRCAMERA_FRAME_FORMAT_YUV420) {
+            size_t uv = (size_t) cam->stride * spec->height;
+            memcpy(dst + uv + (size_t) (y0 / 2) * cam->stride, cam->background.data() + uv + (size_t) (y0 / 2) * cam->stride,
+                   (size_t) (y1 / 2 - y0 / 2) * cam->stride);
+        }
+
+        for (uint32_t y = y0; y < y1; y++) {
+            uint8_t* row = dst + (size_t) y * cam->stride;
+            if (lut != NULL && spec->format != QVRCAMERA_FRAME_FORMAT_DEPTH16) {
+                for (uint32_t x = 0; x < spec->width; x++)
+                    row[x] = lut[row[x]];
+            }
+            for (uint32_t i = 0; i < spec->images; i++) {
+                uint32_t x0 = i * image_w + bx;
+                if (spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16) {
+                    uint16_t* d = (uint16_t*) row;
+                    for (uint32_t x = x0; x < x0 + bar; x++)
+                        d[x] = 800;
+                } else {
+                    memset(row + x0, 230, bar);
+                }
+            }
+        }
+    }
+
+    void setup_sensors(MockCamera* cam)
+    {
+        const CameraSpec* spec = cam->spec;
+        uint32_t image_w = spec->width / spec->images;
+        memset(cam->sensors, 0, sizeof(cam->sensors));
+        for (uint32_t i = 0; i < spec->images; i++) {
+            XrCameraSensorPropertiesQTI* s = &cam->sensors[i];
+            s->base.type = XR_TYPE_QTI_CAM_SENSOR_PROPS;
+            s->base.componentType = XR_HW_COMP_TYPE_QTI_CAMERA_SENSOR;
+            s->base.handle = (XrHandleQTI) (i + 1);
+            snprintf(s->base.componentName, sizeof(s->base.componentName), "%s-%u", spec->name, i);
+            s->base.flags = XR_HARDWARE_COMPONENT_EXTRINSIC_VALID_BIT;
+            s->base.extrinsic.orientation.w = 1.0;
+            // stereo pairs 10 cm apart
+            s->base.extrinsic.position.x = spec->images > 1 ? (i == 0 ? -0.05 : 0.05) : 0.0;
+            s->frameOffset.x = (int32_t) (i * image_w);
+            XrIntrinsicCalibrationQTI* c = &s->calibrationInfo.intrinsics;
+            c->size.width = (int32_t) image_w;
+            c->size.height = (int32_t) spec->height;
+            // the right lens of a pair a little off the left one
+            c->principalPoint.x = (image_w - 1) / 2.0 + i * 2.0;
+            c->principalPoint.y = (spec->height - 1) / 2.0 - i * 1.5;
+            c->focalLength.x = spec->focal * (1.0 + i * 0.004);
+            c->focalLength.y = spec->focal * (1.0 + i * 0.004);
+            for (int k = 0; k < 4; k++)
+                c->radialDistortion[k] = spec->radial[k];
+            c->distortionModel = spec->lens;
+            s->calibrationInfo.lineTime = spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16 ? 0
+                                                                                         : CAM_READOUT_NS / spec->height;
+            cam->calibration[i] = s->calibrationInfo;
+        }
+    }
+
+    // The YUV stream comes off a MIPI combiner as one buffer; the other
+    // stereo pairs are software merged, with a buffer per camera image
+    void setup_hardware_buffers(MockCamera* cam, FrameBuffer* buf)
+    {
+        const CameraSpec* spec = cam->spec;
+        bool yuv = spec->format == QVRCAMERA_FRAME_FORMAT_YUV420;
+        uint32_t bpp = spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16 ? 2 : 1;
+        buf->num_hw = yuv ? 1 : spec->images;
+        uint32_t w = spec->width / buf->num_hw;
+        for (uint32_t i = 0; i < buf->num_hw; i++) {
+            AHardwareBuffer* ahb = &buf->ahb[i];
+            memset(ahb, 0, sizeof(*ahb));
+            ahb->desc.width = w;
+            ahb->desc.height = spec->height;
+            ahb->desc.layers = 1;
+            ahb->desc.format = yuv ? AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420
+                                   : bpp == 2 ? AHARDWAREBUFFER_FORMAT_R16_UINT : AHARDWAREBUFFER_FORMAT_R8_UNORM;
+            ahb->desc.usage = AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN;
+            ahb->desc.stride = cam->stride / bpp;
+            ahb->row_bytes = cam->stride;
+            ahb->fd = -1;
+            if (buf->data != NULL) {
+                ahb->data = buf->data + i * w * bpp;
+                if (yuv)
+                    ahb->chroma = buf->data + (size_t) cam->stride * spec->height + i * w;
+                ahb->fd = buf->fd;
+                ahb->base = buf->data;
+                ahb->map_size = cam->len;
+            }
+            buf->hw[i].buf = ahb;
+            buf->hw[i].offset.x = (int32_t) (i * w);
+            buf->hw[i].offset.y = 0;
+        }
+    }
+
+    // The frame matching want that is complete, or filled to fill percent,
+    // the newest one where several match
+    int32_t wait_frame_locked(MockCamera* cam, std::unique_lock<std::mutex>& l, FrameBuffer* pool, uint32_t want,
+                              bool block, bool explicit_fn, uint32_t fill, FrameBuffer** out)
+    {
+        while (true) {
+            if (cam->state != QVRCAMERA_CAMERA_STARTED)
+                return QVR_CAM_DEVICE_NOT_STARTED;
+
+            FrameBuffer* buf = NULL;
+            uint32_t oldest = 0;
+            for (uint32_t i = 0; i < CAM_BUFFERS; i++) {
+                FrameBuffer& b = pool[i];
+                if (b.valid && (oldest == 0 || (int32_t) (b.fn - oldest) < 0))
+                    oldest = b.fn;
+                if (!b.valid && !(b.filling && b.filled_rows * 100 >= fill * cam->spec->height))
+                    continue;
+                bool match = explicit_fn ? b.fn == want : (int32_t) (b.fn - want) >= 0;
+                if (match && (buf == NULL || (int32_t) (b.fn - buf->fn) > 0))
+                    buf = &b;
+            }
+
+            if (buf != NULL) {
+                *out = buf;
+                return QVR_CAM_SUCCESS;
+            }
+
+            if (explicit_fn && cam->latest_fn != 0 && (int32_t) (want - cam->latest_fn) <= 0)
+                return oldest == 0 || (int32_t) (want - oldest) < 0 ? QVR_CAM_EXPIRED_FRAMENUMBER
+                                                                    : QVR_CAM_DROPPED_FRAMENUMBER;
+            if (!block)
+                return QVR_CAM_FUTURE_FRAMENUMBER;
+            cam->frame_ready.wait(l);
+        }
+    }
+
+    void fill_frame(MockCamera* cam, const FrameBuffer* buf, qvrcamera_frame_t* frame)
+    {
+        memset(frame, 0, sizeof(*frame));
+        frame->fn = buf->fn;
+        frame->start_of_exposure_ts = buf->sof_ts;
+        frame->exposure = buf->exposure;
+        frame->buffer = buf->data;
+        frame->len = cam->len;
+        frame->width = cam->spec->width;
+        frame->height = cam->spec->height;
+        frame->gain = buf->gain;
+        frame->stride = cam->stride;
+        frame->format = cam->spec->format;
+        if (buf->num_crops != 0) {
+            uint32_t bpp = cam->spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16 ? 2 : 1;
+            const CropRect& c0 = buf->crops[0];
+            const CropRect& c1 = buf->crops[1];
+            bool dual = buf->num_crops == 2;
+            frame->width = c0.width;
+            frame->height = c0.height;
+            frame->secondary_width = dual ? c1.width : 0;
+            frame->secondary_height = dual ? c1.height : 0;
+            frame->len = (c0.width * c0.height + frame->secondary_width * frame->secondary_height) * bpp;
+            frame->stride = (c0.width + frame->secondary_width) * bpp;
+        }
+    }
+
+    // the crops of the whole frame in scratch into buf, back to back
+    void cut_crops(MockCamera* cam, FrameBuffer* buf)
+    {
+        uint32_t bpp = cam->spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16 ? 2 : 1;
+        uint8_t* dst = buf->data;
+        for (uint32_t i = 0; i < buf->num_crops; i++) {
+            const CropRect& c = buf->crops[i];
+            for (uint32_t y = 0; y < c.height; y++) {
+                memcpy(dst, cam->scratch.data() + (size_t) (c.top + y) * cam->stride + c.left * bpp, c.width * bpp);
+                dst += c.width * bpp;
+            }
+        }
+    }
+
+    void unlock_frame_locked(FrameBuffer* pool, uint32_t fn)
+    {
+        for (uint32_t i = 0; i < CAM_BUFFERS; i++) {
+            FrameBuffer& b = pool[i];
+            if ((b.valid || b.filling) && b.fn == fn && b.locks > 0) {
+                b.locks--;
+                return;
+            }
+        }
+    }
+
+    // the whole frame in src at half width and height into dst: 2x2 boxes,
+    // the top left sample of each for depth
+    void downscale_quarter(MockCamera* cam, const uint8_t* src, uint8_t* dst)
+    {
+        const CameraSpec* spec = cam->spec;
+        uint32_t w = spec->width / 2;
+        uint32_t h = spec->height / 2;
+        if (spec->format == QVRCAMERA_FRAME_FORMAT_DEPTH16) {
+            for (uint32_t y = 0; y < h; y++) {
+                const uint16_t* s = (const uint16_t*) (src + (size_t) 2 * y * cam->stride);
+                uint16_t* d = (uint16_t*) (dst + (size_t) y * cam->quarter_stride);
+                for (uint32_t x = 0; x < w; x++)
+                    d[x] = s[2 * x];
+            }
+            return;
+        }
+
+        for (uint32_t y = 0; y < h; y++) {
+            const uint8_t* s0 = src + (size_t) 2 * y * cam->stride;
+            const uint8_t* s1 = s0 + cam->stride;
+            uint8_t* d = dst + (size_t) y * cam->quarter_stride;
+            for (uint32_t x = 0; x < w; x++)
+                d[x] = (uint8_t) ((s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1] + 2) >> 2);
+        }
+        if (spec->format == QVRCAMERA_FRAME_FORMAT_YUV420) {
+            const uint8_t* uv = src + (size_t) cam->stride * spec->height;
+            uint8_t* quv = dst + (size_t) cam->quarter_stride * h;
+            for (uint32_t y = 0; y < h / 2; y++) {
+                const uint8_t* s0 = uv + (size_t) 2 * y * cam->stride;
+                const uint8_t* s1 = s0 + cam->stride;
+                uint8_t* d = quv + (size_t) y * cam->quarter_stride;
+                for (uint32_t x = 0; x < w; x++) {
+                    // x runs over the interleaved Cb Cr bytes
+                    uint32_t sx = (x & ~1u) * 2 + (x & 1);
+                    d[x] = (uint8_t) ((s0[sx] + s0[sx + 2] + s1[sx] + s1[sx + 2] + 2) >> 2);
+                }
+            }
+        }
+    }
+
+    void release_sync_locked(MockCamera* cam, MockCamDevice* d)
+    {
+        if (d->sync == NULL)
+            return;
+        if (cam->sync == d->sync) {
+            cam->sync = NULL;
+            cam->read_period_ns = 0;
+        }
+        delete d->sync;
+        d->sync = NULL;
+    }
+
+    void note_sync_read_locked(MockCamera* cam, qvrsync_ctrl_t* ctrl, uint32_t fill)
+    {
+        if (ctrl != cam->sync)
+            return;
+        cam->read_fill = fill;
+        int64_t now = mock_now_ns();
+        int64_t dt = now - cam->last_read_ns;
+        cam->last_read_ns = now;
+        // read rates outside 8-200 Hz are not followed
+        if (dt < 5000000LL || dt > 125000000LL)
+            return;
+        if (cam->read_period_ns == 0) {
+            cam->read_period_ns = dt;
+            cam->read_phase_ns = now;
+            return;
+        }
+        cam->read_period_ns += (dt - cam->read_period_ns) / 8;
+        int64_t expected = cam->read_phase_ns + cam->read_period_ns;
+        while (expected < now - cam->read_period_ns / 2)
+            expected += cam->read_period_ns;
+        cam->read_phase_ns = expected + (now - expected) / 4;
+    }
+
+    // one frame period on, slewed toward the synced reader's phase
+    int64_t next_frame_time(MockCamera* cam, int64_t prev, int64_t period)
+    {
+        int64_t next = prev + period;
+        std::lock_guard<std::mutex> l(cam->lock);
+        int64_t now = mock_now_ns();
+        int64_t read_period = cam->read_period_ns;
+        if (cam->sync == NULL || read_period == 0 || cam->read_phase_ns == 0 ||
+            now - cam->last_read_ns > 4 * read_period)
+            return next;
+
+        // the expected read closest to next, plus the readout still to come
+        // at the fill level it asks for
+        int64_t target = cam->read_phase_ns + read_period - CAM_SYNC_LEAD_NS +
+                         CAM_READOUT_NS * (100 - (int64_t) cam->read_fill) / 100;
+        while (target < next - read_period / 2)
+            target += read_period;
+        while (target > next + read_period / 2)
+            target -= read_period;
+        int64_t err = std::max(-period / 8, std::min(period / 8, target - next));
+        return next + err;
+    }
+
+    void capture_loop(MockCamera* cam)
+    {
+        int64_t next = mock_now_ns();
+        uint32_t fn = 0;
+        while (true) {
+            QVRCAMERA_CAMERA_STATUS state;
+            {
+                std::lock_guard<std::mutex> l(cam->lock);
+                state = cam->state;
+            }
+            if (state != QVRCAMERA_CAMERA_STARTED) {
+                usleep(1000);
+                next = mock_now_ns();
+                continue;
+            }
+
+            // next is when the frame is complete in memory
+            int64_t period = 1000000000LL / std::max(cam->fps.load(), 1u);
+            fn++;
+            cam->produced++;
+
+            FrameBuffer* buf = NULL;
+            FrameBuffer* quarter = NULL;
+            uint64_t exposure;
+            uint32_t gain;
+            {
+                std::lock_guard<std::mutex> l(cam->lock);
+                for (uint32_t i = 0; i < CAM_BUFFERS && buf == NULL; i++) {
+                    FrameBuffer* b = &cam->buffers[(cam->next_buffer + i) % CAM_BUFFERS];
+                    if (b->locks == 0) {
+                        buf = b;
+                        cam->next_buffer = (cam->next_buffer + i + 1) % CAM_BUFFERS;
+                    }
+                }
+                if (buf != NULL) {
+                    buf->valid = false;
+                    buf->filling = false;
+                }
+                if (cam->apply_fn != 0 && fn >= cam->apply_fn) {
+                    cam->exposure_ns = cam->pending_exposure_ns;
+                    cam->gain = cam->pending_gain;
+                    cam->apply_fn = 0;
+                }
+                exposure = cam->exposure_ns;
+                gain = cam->gain;
+                if (cam->crop_apply_fn != 0 && fn >= cam->crop_apply_fn) {
+                    cam->crops[0] = cam->pending_crops[0];
+                    cam->crops[1] = cam->pending_crops[1];
+                    cam->num_crops = cam->pending_num_crops;
+                    cam->crop_apply_fn = 0;
+                }
+                if (buf != NULL) {
+                    buf->crops[0] = cam->crops[0];
+                    buf->crops[1] = cam->crops[1];
+                    buf->num_crops = cam->num_crops;
+                    buf->calibration[0] = cam->calibration[0];
+                    buf->calibration[1] = cam->calibration[1];
+                }
+                // quarter frames only come from whole ones
+                for (uint32_t i = 0; i < CAM_BUFFERS && buf != NULL && buf->num_crops == 0 &&
+                                     cam->quarter_streams != 0 && quarter == NULL; i++) {
+                    FrameBuffer* b = &cam->quarter[(cam->next_quarter + i) % CAM_BUFFERS];
+                    if (b->locks == 0 && b->data != NULL) {
+                        quarter = b;
+                        quarter->valid = false;
+                        cam->next_quarter = (cam->next_quarter + i + 1) % CAM_BUFFERS;
+                    }
+                }
+            }
+
+            if (buf == NULL || buf->data == NULL) {
+                sleep_until_ns(next);
+                cam->lost++;
+            } else {
+                // the rows land over the readout that ends at next
+                int64_t fill_start = next - CAM_READOUT_NS;
+                int64_t boot_offset = qtime_to_boot_ns();
+                {
+                    std::lock_guard<std::mutex> l(cam->lock);
+                    buf->fn = fn;
+                    buf->sof_ts = (uint64_t) (fill_start + boot_offset - (int64_t) exposure);
+                    buf->exposure = (uint32_t) exposure;
+                    buf->gain = gain;
+                    buf->filled_rows = 0;
+                    // cropped frames are cut from a whole one once it is
+                    // read out, and can't be read partially
+                    buf->filling = buf->num_crops == 0;
+                }
+                uint8_t lut[256];
+                bool mapped = exposure_lut(cam, exposure, gain, buf->sof_ts, lut);
+                uint32_t height = cam->spec->height;
+                bool cropped = buf->num_crops != 0;
+                if (cropped)
+                    cam->scratch.resize(cam->len);
+                for (uint32_t step = 1; step <= CAM_FILL_STEPS; step++) {
+                    uint32_t y0 = height * (step - 1) / CAM_FILL_STEPS;
+                    uint32_t y1 = height * step / CAM_FILL_STEPS;
+                    sleep_until_ns(fill_start + CAM_READOUT_NS * step / CAM_FILL_STEPS);
+                    render(cam, cropped ? cam->scratch.data() : buf->data, fn, y0, y1, mapped ? lut : NULL);
+                    if (cropped && step == CAM_FILL_STEPS)
+                        cut_crops(cam, buf);
+                    if (quarter != NULL && step == CAM_FILL_STEPS)
+                        downscale_quarter(cam, buf->data, quarter->data);
+                    std::lock_guard<std::mutex> l(cam->lock);
+                    buf->filled_rows = cropped ? 0 : y1;
+                    if (step == CAM_FILL_STEPS) {
+                        buf->filling = false;
+                        buf->valid = true;
+                        cam->latest_fn = fn;
+                        if (quarter != NULL) {
+                            quarter->fn = fn;
+                            quarter->sof_ts = buf->sof_ts;
+                            quarter->exposure = buf->exposure;
+                            quarter->gain = buf->gain;
+                            quarter->valid = true;
+                        }
+                    }
+                    cam->frame_ready.notify_all();
+                }
+            }
+
+            next = next_frame_time(cam, next, period);
+            // don't try to catch up after a stall
+            if (next < mock_now_ns() - period)
+                next = mock_now_ns();
+        }
+    }
+
+    MockCamera cameras[NUM_CAMERAS];
+    std::mutex clients_lock;
+    std::vector<MockCamClient*> clients;
+};
+
+MockCameraService& service()
+{
+    return MockCameraService::get();
+}
+
+MockCamClient* to_client(qvrcamera_client_handle_t handle)
+{
+    return (MockCamClient*) handle;
+}
+
+MockCamDevice* to_device(qvrcamera_device_handle_t handle)
+{
+    return (MockCamDevice*) handle;
+}
+
+#define MOCK_ENTER(op)                          \
+    do {                                        \
+        int32_t injected = service().enter(op); \
+        if (injected != 0)                      \
+            return injected;                    \
+    } while (0)
+
+qvrcamera_client_handle_t mock_create()
+{
+    return service().create_client();
+}
+
+qvrcamera_client_handle_t mock_create_with_key(const char*)
+{
+    return service().create_client();
+}
+
+void mock_destroy(qvrcamera_client_handle_t client)
+{
+    service().destroy_client(to_client(client));
+}
+
+qvrcamera_device_handle_t mock_attach_camera(qvrcamera_client_handle_t client, const char* pCameraName)
+{
+    if (service().enter(QVRCAMMOCK_OP_ATTACH_CAMERA) != 0)
+        return NULL;
+    return service().attach(to_client(client), pCameraName);
+}
+
+qvrcamera_device_handle_t mock_attach_camera_with_params(qvrcamera_client_handle_t client, const char* pCameraName,
+                                                         qvr_plugin_param_t[], int32_t)
+{
+    return mock_attach_camera(client, pCameraName);
+}
+
+int32_t copy_string_param(const char* value, uint32_t* pLen, char* pValue)
+{
+    uint32_t len = (uint32_t) strlen(value) + 1;
+    if (pValue == NULL) {
+        *pLen = len;
+        return QVR_CAM_SUCCESS;
+    }
+    if (*pLen < len)
+        return QVR_CAM_SIZE_INSUFFICIENT;
+    memcpy(pValue, value, len);
+    return QVR_CAM_SUCCESS;
+}
+
+int32_t mock_client_get_param(qvrcamera_client_handle_t, const char* pName, uint32_t* pLen, char* pValue)
+{
+    if (pName == NULL || pLen == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    if (strcmp(pName, QVR_CAMCLIENT_QTIME_TO_ANDROID_BOOT_NS) != 0)
+        return QVR_CAM_INVALID_PARAM;
+    char value[32];
+    snprintf(value, sizeof(value), "%lld", (long long) service().qtime_to_boot_ns());
+    return copy_string_param(value, pLen, pValue);
+}
+
+int32_t mock_client_set_param(qvrcamera_client_handle_t, const char* pName, const char* pValue)
+{
+    return pName != NULL && pValue != NULL ? QVR_CAM_SUCCESS : QVR_CAM_INVALID_PARAM;
+}
+
+void mock_detach_camera(qvrcamera_device_handle_t camera)
+{
+    service().detach(to_device(camera));
+}
+
+int32_t mock_get_camera_state(qvrcamera_device_handle_t camera, QVRCAMERA_CAMERA_STATUS* pState)
+{
+    if (pState == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    *pState = service().state(to_device(camera));
+    return QVR_CAM_SUCCESS;
+}
+
+int32_t mock_device_get_param(qvrcamera_device_handle_t camera, const char* pName, uint32_t* pLen, char* pValue)
+{
+    if (pName == NULL || pLen == NULL)
+        return QVR_CAM_INVALID_PARAM;
+
+    MockCamera* cam = service().camera(to_device(camera)->camera);
+    const CameraSpec* spec = cam->spec;
+    char value[96];
+    if (strcmp(pName, QVR_CAMDEVICE_STRING_CAMERA_NAME) == 0) {
+        snprintf(value, sizeof(value), "%s", spec->name);
+    } else if (strcmp(pName, QVR_CAMDEVICE_STRING_FRAME_FORMAT) == 0) {
+        snprintf(value, sizeof(value), "%s", spec->format_name);
+    } else if (strcmp(pName, QVR_CAMDEVICE_STRING_RESOLUTION) == 0) {
+        uint32_t fps = cam->fps.load();
+        snprintf(value, sizeof(value), "%u %u 1 %u %u", spec->width, spec->height, fps, fps);
+    } else if (strcmp(pName, QVR_CAMDEVICE_STRING_QTR_RESOLUTION) == 0) {
+        uint32_t fps = cam->fps.load();
+        snprintf(value, sizeof(value), "%u %u 1 %u %u", spec->width / 2, spec->height / 2, fps, fps);
+    } else if (strcmp(pName, QVR_CAMDEVICE_STRING_IMAGE_ARRANGEMENT) == 0) {
+        snprintf(value, sizeof(value), "%s",
+                 spec->images > 1 ? QVR_CAMDEVICE_IMAGE_ARRANGEMENT_HORIZONTAL : QVR_CAMDEVICE_IMAGE_ARRANGEMENT_NONE);
+    } else {
+        return QVR_CAM_INVALID_PARAM;
+    }
+    return copy_string_param(value, pLen, pValue);
+}
+
+int32_t mock_device_set_param(qvrcamera_device_handle_t, const char* pName, const char* pValue)
+{
+    return pName != NULL && pValue != NULL ? QVR_CAM_SUCCESS : QVR_CAM_INVALID_PARAM;
+}
+
+int32_t mock_get_param_num(qvrcamera_device_handle_t camera, const char* pName, QVRCAMERA_PARAM_NUM_TYPE type,
+                           uint8_t size, char* pValue)
+{
+    if (pName == NULL || pValue == NULL)
+        return QVR_CAM_INVALID_PARAM;
+
+    MockCamera* cam = service().camera(to_device(camera)->camera);
+    if (strcmp(pName, QVR_CAMDEVICE_UINT32_IMAGE_COUNT) == 0) {
+        if (type != QVRCAMERA_PARAM_NUM_TYPE_UINT32 || size < sizeof(uint32_t))
+            return QVR_CAM_INVALID_PARAM;
+        uint32_t images = cam->spec->images;
+        memcpy(pValue, &images, sizeof(images));
+        return QVR_CAM_SUCCESS;
+    }
+    if (strcmp(pName, QVR_CAMDEVICE_UINT8_ENABLE_PARTIAL_FRAME_READ) == 0) {
+        if (type != QVRCAMERA_PARAM_NUM_TYPE_UINT8 || size < sizeof(uint8_t))
+            return QVR_CAM_INVALID_PARAM;
+        *pValue = service().partial_read(cam) ? 1 : 0;
+        return QVR_CAM_SUCCESS;
+    }
+    if (strcmp(pName, QVR_CAMDEVICE_UINT64_LINE_READOUT_TIME) == 0) {
+        if (type != QVRCAMERA_PARAM_NUM_TYPE_UINT64 || size < sizeof(uint64_t))
+            return QVR_CAM_INVALID_PARAM;
+        // ns
+        uint64_t line = CAM_READOUT_NS / cam->spec->height;
+        memcpy(pValue, &line, sizeof(line));
+        return QVR_CAM_SUCCESS;
+    }
+
+    int16_t i16;
+    if (strcmp(pName, QVR_CAMDEVICE_INT16_CAMERA_BUFFER_FILL_TIME_US) == 0) {
+        i16 = (int16_t) (CAM_READOUT_NS / 1000);
+    } else if (strcmp(pName, QVR_CAMDEVICE_INT16_CAMERA_BUFFER_FILL_TO_SOF_OFFSET_US) == 0) {
+        // the first row is read out when its exposure ends
+        i16 = (int16_t) std::min<uint64_t>(service().exposure_ns(cam) / 1000, INT16_MAX);
+    } else {
+        i16 = 0;
+    }
+    if (i16 != 0) {
+        if (type != QVRCAMERA_PARAM_NUM_TYPE_INT16 || size < sizeof(i16))
+            return QVR_CAM_INVALID_PARAM;
+        memcpy(pValue, &i16, sizeof(i16));
+        return QVR_CAM_SUCCESS;
+    }
+
+    uint16_t v16;
+    if (strcmp(pName, QVR_CAMDEVICE_UINT16_CAMERA_FRAME_WIDTH) == 0)
+        v16 = (uint16_t) cam->spec->width;
+    else if (strcmp(pName, QVR_CAMDEVICE_UINT16_CAMERA_FRAME_HEIGHT) == 0)
+        v16 = (uint16_t) cam->spec->height;
+    else if (strcmp(pName, QVR_CAMDEVICE_UINT16_CAMERA_FRAME_YSTRIDE) == 0)
+        v16 = (uint16_t) cam->stride;
+    else
+        return QVR_CAM_INVALID_PARAM;
+    if (type != QVRCAMERA_PARAM_NUM_TYPE_UINT16 || size < sizeof(v16))
+        return QVR_CAM_INVALID_PARAM;
+    memcpy(pValue, &v16, sizeof(v16));
+    return QVR_CAM_SUCCESS;
+}
+
+int32_t mock_start(qvrcamera_device_handle_t camera)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_START);
+    return service().start(to_device(camera));
+}
+
+int32_t mock_stop(qvrcamera_device_handle_t camera)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_STOP);
+    return service().stop(to_device(camera));
+}
+
+int32_t mock_get_current_frame_number(qvrcamera_device_handle_t camera, int32_t* fn)
+{
+    if (fn == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    return service().current_frame_number(to_device(camera), fn);
+}
+
+int32_t mock_set_exposure_and_gain(qvrcamera_device_handle_t camera, uint64_t exposure_ns, int iso_gain)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_SET_EXPOSURE_AND_GAIN);
+    return service().set_exposure_and_gain(to_device(camera), exposure_ns, iso_gain);
+}
+
+int32_t mock_set_gamma_correction_value(qvrcamera_device_handle_t camera, float gamma)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_SET_GAMMA);
+    return service().set_gamma(to_device(camera), gamma);
+}
+
+int32_t mock_set_crop_region(qvrcamera_device_handle_t camera, uint32_t l_top, uint32_t l_left, uint32_t l_width,
+                             uint32_t l_height, uint32_t r_top, uint32_t r_left, uint32_t r_width, uint32_t r_height)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_SET_CROP_REGION);
+    CropRect rects[2] = { { l_left, l_top, l_width, l_height }, { r_left, r_top, r_width, r_height } };
+    return service().set_crop_region(to_device(camera), rects);
+}
+
+int32_t mock_get_frame(qvrcamera_device_handle_t camera, int32_t* fn, QVRCAMERA_BLOCK_MODE block,
+                       QVRCAMERA_DROP_MODE drop, qvrcamera_frame_t* pframe)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_GET_FRAME);
+    if (fn == NULL || pframe == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    return service().get_frame(to_device(camera), fn, block, drop, pframe);
+}
+
+int32_t mock_release_frame(qvrcamera_device_handle_t camera, int32_t fn)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_RELEASE_FRAME);
+    return service().release_frame(to_device(camera), fn);
+}
+
+int32_t mock_frame_to_hardware_buffer(qvrcamera_device_handle_t camera, qvrcamera_frame_t* pFrame,
+                                      uint32_t* pNumHwBufs, qvrcamera_hwbuffer_t** ppHwBuf)
+{
+    if (pFrame == NULL || pNumHwBufs == NULL || ppHwBuf == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    return service().frame_to_hardware_buffer(to_device(camera), pFrame, pNumHwBufs, ppHwBuf);
+}
+
+int32_t mock_get_frame_ex(qvrcamera_device_handle_t camera, const XrCameraFrameRequestInfoInputQTI* getFrameExInput,
+                          XrCameraFrameRequestInfoOutputQTI* getFrameExOutput)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_GET_FRAME_EX);
+    if (getFrameExInput == NULL || getFrameExOutput == NULL ||
+        getFrameExInput->type != XR_TYPE_QTI_CAM_FRAME_REQ_INFO_INPUT ||
+        getFrameExOutput->type != XR_TYPE_QTI_CAM_FRAME_REQ_INFO_OUTPUT)
+        return QVR_CAM_INVALID_PARAM;
+    return service().get_frame_ex(to_device(camera), getFrameExInput, getFrameExOutput);
+}
+
+int32_t mock_get_properties(qvrcamera_device_handle_t camera, XrCameraDevicePropertiesQTI* pProperties)
+{
+    if (pProperties == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    return service().properties(to_device(camera), pProperties);
+}
+
+qvrsync_ctrl_t* mock_get_sync_ctrl(qvrcamera_device_handle_t camera, QVR_SYNC_SOURCE syncSrc)
+{
+    return service().get_sync_ctrl(to_device(camera), syncSrc);
+}
+
+int32_t mock_release_sync_ctrl(qvrcamera_device_handle_t camera, qvrsync_ctrl_t* pSyncCtrl)
+{
+    return service().release_sync_ctrl(to_device(camera), pSyncCtrl);
+}
+
+MockCamStream* to_stream(qvrcamera_stream_handle_t handle)
+{
+    return (MockCamStream*) handle;
+}
+
+int32_t mock_stream_start(qvrcamera_stream_handle_t stream)
+{
+    return service().start_stream(to_stream(stream));
+}
+
+int32_t mock_stream_stop(qvrcamera_stream_handle_t stream)
+{
+    return service().stop_stream(to_stream(stream));
+}
+
+int32_t mock_stream_get_current_frame_number(qvrcamera_stream_handle_t stream, int32_t* fn)
+{
+    if (fn == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    return service().current_frame_number(to_stream(stream)->device, fn);
+}
+
+int32_t mock_stream_get_frame(qvrcamera_stream_handle_t stream, int32_t* fn, QVRCAMERA_BLOCK_MODE block,
+                              QVRCAMERA_DROP_MODE drop, qvrcamera_frame_t* frame)
+{
+    MOCK_ENTER(QVRCAMMOCK_OP_STREAM_GET_FRAME);
+    if (fn == NULL || frame == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    return service().stream_get_frame(to_stream(stream), fn, block, drop, frame);
+}
+
+int32_t mock_stream_release_frame(qvrcamera_stream_handle_t stream, int32_t fn)
+{
+    return service().stream_release_frame(to_stream(stream), fn);
+}
+
+int32_t mock_stream_get_state(qvrcamera_stream_handle_t stream, QVRCAMERA_CAMERA_STATUS* pState)
+{
+    if (pState == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    *pState = service().stream_state(to_stream(stream));
+    return QVR_CAM_SUCCESS;
+}
+
+qvrcamera_stream_ops_t make_stream_ops()
+{
+    qvrcamera_stream_ops_t ops = {};
+    ops.Start = mock_stream_start;
+    ops.Stop = mock_stream_stop;
+    ops.GetCurrentFrameNumber = mock_stream_get_current_frame_number;
+    ops.GetFrame = mock_stream_get_frame;
+    ops.ReleaseFrame = mock_stream_release_frame;
+    ops.GetStreamState = mock_stream_get_state;
+    return ops;
+}
+
+qvrcamera_stream_ops_t mock_stream_ops = make_stream_ops();
+
+qvrservice_class_t* mock_get_class_handle(qvrcamera_device_handle_t camera, uint32_t classId, const char* uri)
+{
+    if (classId != CLASS_ID_STREAMS_BETA)
+        return NULL;
+    MockCamStream* st = service().create_stream(to_device(camera), uri, &mock_stream_ops);
+    return st != NULL ? &st->cls : NULL;
+}
+
+void mock_release_class_handle(qvrcamera_device_handle_t, qvrservice_class_t* handle)
+{
+    if (handle != NULL && handle->ops == &mock_stream_ops)
+        service().destroy_stream((MockCamStream*) handle);
+}
+
+qvrcamera_client_ops_t make_client_ops()
+{
+    qvrcamera_client_ops_t ops = {};
+    ops.Create = mock_create;
+    ops.Destroy = mock_destroy;
+    ops.AttachCamera = mock_attach_camera;
+    ops.CreateWithKey = mock_create_with_key;
+    ops.GetParam = mock_client_get_param;
+    ops.SetParam = mock_client_set_param;
+    ops.AttachCameraWithParams = mock_attach_camera_with_params;
+    return ops;
+}
+
+qvrcamera_ops_t make_device_ops()
+{
+    qvrcamera_ops_t ops = {};
+    ops.DetachCamera = mock_detach_camera;
+    ops.GetCameraState = mock_get_camera_state;
+    ops.GetParam = mock_device_get_param;
+    ops.SetParam = mock_device_set_param;
+    ops.GetParamNum = mock_get_param_num;
+    ops.Start = mock_start;
+    ops.Stop = mock_stop;
+    ops.GetCurrentFrameNumber = mock_get_current_frame_number;
+    ops.SetExposureAndGain = mock_set_exposure_and_gain;
+    ops.SetGammaCorrectionValue = mock_set_gamma_correction_value;
+    ops.SetCropRegion = mock_set_crop_region;
+    ops.GetFrame = mock_get_frame;
+    ops.ReleaseFrame = mock_release_frame;
+    ops.GetSyncCtrl = mock_get_sync_ctrl;
+    ops.ReleaseSyncCtrl = mock_release_sync_ctrl;
+    ops.FrameToHardwareBuffer = mock_frame_to_hardware_buffer;
+    ops.GetFrameEx = mock_get_frame_ex;
+    ops.GetProperties = mock_get_properties;
+    ops.GetClassHandle = mock_get_class_handle;
+    ops.ReleaseClassHandle = mock_release_class_handle;
+    return ops;
+}
+
+qvrcamera_client_ops_t mock_client_ops = make_client_ops();
+qvrcamera_ops_t mock_device_ops = make_device_ops();
+qvrcamera_client_t mock_client = { QVRCAMERACLIENT_API_VERSION_8, &mock_client_ops };
+qvrcamera_device_t mock_device = { QVRCAMERACLIENT_API_VERSION_8, &mock_device_ops };
+
+MockCamera* camera_by_name(const char* name)
+{
+    int i = service().find_camera(name);
+    return i >= 0 ? service().camera(i) : NULL;
+}
+
+} // namespace
+
+extern "C" {
+
+__attribute__((visibility("default")))
+qvrcamera_client_t* getQvrCameraClientInstance(void)
+{
+    mock_client.api_version = (QVRCAMERA_API_VERSION) service().api_version;
+    return &mock_client;
+}
+
+__attribute__((visibility("default")))
+qvrcamera_device_t* getQvrCameraDeviceInstance(void)
+{
+    mock_device.api_version = (QVRCAMERA_API_VERSION) service().api_version;
+    return &mock_device;
+}
+
+const char* qvrcammock_op_name(QVRCAMMOCK_OP op)
+{
+    return op >= 0 && op < QVRCAMMOCK_OP_MAX ? op_names[op] : "unknown";
+}
+
+void qvrcammock_set_latency_us(QVRCAMMOCK_OP op, uint32_t us)
+{
+    if (op >= 0 && op < QVRCAMMOCK_OP_MAX)
+        service().latency_us[op] = us;
+}
+
+void qvrcammock_fail_next(QVRCAMMOCK_OP op, uint32_t count, int32_t error)
+{
+    if (op < 0 || op >= QVRCAMMOCK_OP_MAX)
+        return;
+    service().fail_error[op] = error != 0 ? error : QVR_CAM_ERROR;
+    service().fail_count[op] = count;
+}
+
+uint64_t qvrcammock_call_count(QVRCAMMOCK_OP op)
+{
+    return op >= 0 && op < QVRCAMMOCK_OP_MAX ? service().call_counts[op].load() : 0;
+}
+
+int32_t qvrcammock_set_fps(const char* camera, uint32_t fps)
+{
+    MockCamera* cam = camera_by_name(camera);
+    if (cam == NULL || fps == 0)
+        return QVR_CAM_INVALID_PARAM;
+    cam->fps = fps;
+    return QVR_CAM_SUCCESS;
+}
+
+uint64_t qvrcammock_frames_produced(const char* camera)
+{
+    MockCamera* cam = camera_by_name(camera);
+    return cam != NULL ? cam->produced.load() : 0;
+}
+
+uint64_t qvrcammock_frames_lost(const char* camera)
+{
+    MockCamera* cam = camera_by_name(camera);
+    return cam != NULL ? cam->lost.load() : 0;
+}
+
+int32_t qvrcammock_set_partial_frame_read(const char* camera, int enable)
+{
+    MockCamera* cam = camera_by_name(camera);
+    if (cam == NULL)
+        return QVR_CAM_INVALID_PARAM;
+    service().set_partial_read(cam, enable != 0);
+    return QVR_CAM_SUCCESS;
+}
+
+uint32_t qvrcammock_bar_x(const char* camera, uint32_t fn)
+{
+    MockCamera* cam = camera_by_name(camera);
+    return cam != NULL ? bar_x(cam->spec, fn) : 0;
+}
+
+int32_t qvrcammock_set_scene_light(const char* camera, uint32_t level_pct, uint32_t flicker_pct, uint32_t mains_hz)
+{
+    MockCamera* cam = camera_by_name(camera);
+    return cam != NULL ? service().set_scene_light(cam, level_pct, flicker_pct, mains_hz) : QVR_CAM_INVALID_PARAM;
+}
+
+int32_t qvrcammock_set_calibration(const char* camera, uint32_t image, const XrIntrinsicCalibrationQTI* intrinsics)
+{
+    MockCamera* cam = camera_by_name(camera);
+    return cam != NULL ? service().set_calibration(cam, image, intrinsics) : QVR_CAM_INVALID_PARAM;
+}
+
+uint32_t qvrcammock_locked_buffers(const char* camera)
+{
+    MockCamera* cam = camera_by_name(camera);
+    if (cam == NULL)
+        return 0;
+    std::lock_guard<std::mutex> l(cam->lock);
+    uint32_t n = 0;
+    for (const FrameBuffer& b : cam->buffers)
+        n += b.locks > 0;
+    return n;
+}
+
+} // extern "C"
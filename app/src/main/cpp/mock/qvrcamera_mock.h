@@ -0,0 +1,73 @@
+#pragma once
+
+// Control interface of the mock libqvrcamera_client.so, looked up with
+// dlsym() on qvrcamera_client_helper_t::libHandle like the qvrservice mock's.
+
+#include <stdint.h>
+
+#include "qvr/inc/QVRCameraClient.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum QVRCAMMOCK_OP {
+    QVRCAMMOCK_OP_ATTACH_CAMERA = 0,
+    QVRCAMMOCK_OP_START,
+    QVRCAMMOCK_OP_STOP,
+    QVRCAMMOCK_OP_GET_FRAME,
+    QVRCAMMOCK_OP_RELEASE_FRAME,
+    QVRCAMMOCK_OP_GET_FRAME_EX,
+    QVRCAMMOCK_OP_SET_EXPOSURE_AND_GAIN,
+    QVRCAMMOCK_OP_SET_GAMMA,
+    QVRCAMMOCK_OP_SET_CROP_REGION,
+    QVRCAMMOCK_OP_STREAM_GET_FRAME,
+    QVRCAMMOCK_OP_MAX
+} QVRCAMMOCK_OP;
+
+// name as used in QVRCAMMOCK_LATENCY_US / QVRCAMMOCK_FAIL, e.g. "GetFrame"
+const char* qvrcammock_op_name(QVRCAMMOCK_OP op);
+
+// every call of op sleeps for us before doing its work
+void qvrcammock_set_latency_us(QVRCAMMOCK_OP op, uint32_t us);
+
+// the next count calls of op return error without side effects
+void qvrcammock_fail_next(QVRCAMMOCK_OP op, uint32_t count, int32_t error);
+
+uint64_t qvrcammock_call_count(QVRCAMMOCK_OP op);
+
+// frame rate of the named camera, applied from its next frame on
+int32_t qvrcammock_set_fps(const char* camera, uint32_t fps);
+
+// frames the named camera produced since library load, and how many of
+// them were lost because every buffer was locked by clients
+uint64_t qvrcammock_frames_produced(const char* camera);
+uint64_t qvrcammock_frames_lost(const char* camera);
+
+// QVR_CAMDEVICE_UINT8_ENABLE_PARTIAL_FRAME_READ of the named camera, on by
+// default; without it partial GetFrameEx() calls fail with
+// QVR_CAM_PARTIAL_FRAME_NOT_ENABLED
+int32_t qvrcammock_set_partial_frame_read(const char* camera, int enable);
+
+// left edge of the bar in every row of frame fn, in pixels from the left of
+// each image
+uint32_t qvrcammock_bar_x(const char* camera, uint32_t fn);
+
+// Light on the scene of the named camera: level in percent of the light the
+// default exposure and gain render the scene right in, and a flicker of
+// flicker_pct percent at twice mains_hz, as from lamps on 50 or 60 Hz mains.
+// Frames come out as bright as exposure x gain x light, averaged over the
+// exposure, then through the gamma correction.
+int32_t qvrcammock_set_scene_light(const char* camera, uint32_t level_pct, uint32_t flicker_pct, uint32_t mains_hz);
+
+// Intrinsics of image (0 left, 1 right) of the frames the named camera
+// captures from now on, flagged XR_CAMERA_SENSOR_CALIBRATION_DYNAMIC_BIT in
+// what GetFrameEx() returns; GetProperties() keeps the factory calibration
+int32_t qvrcammock_set_calibration(const char* camera, uint32_t image, const XrIntrinsicCalibrationQTI* intrinsics);
+
+// buffers of the named camera currently locked by GetFrame()
+uint32_t qvrcammock_locked_buffers(const char* camera);
+
+#ifdef __cplusplus
+}
+#endif
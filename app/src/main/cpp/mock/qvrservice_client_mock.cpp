@@ -0,0 +1,1865 @@
+// Stand-in for libqvrservice_client.so on hosts without qvrservice. It keeps
+// a single in-process VR mode state machine shared by all clients, delivers
+// notifications from its own thread like the binder callbacks of the real
+// client, and publishes synthetic head poses through shared memory rings
+// laid out like the ones described by qvrservice_ring_buffer_desc_t.
+//
+// Environment:
+//   QVRMOCK_STOP_EVERY_MS  force VRMODE_STOPPED periodically, as if another
+//                          app stopped VR mode
+//   QVRMOCK_SCRIPT         timed actions relative to library load, e.g.
+//                          "500:stop;900:pause;1200:resume;2000:tracking=0x1;
+//                           2500:tracking=0x4;3000:disconnect;
+//                           4000:subsystem=0/5;9000:subsystem=1"
+//                          subsystem=<error state>[/<seconds>] sends a
+//                          tracking NOTIFICATION_SUBSYSTEM_ERROR
+//   QVRMOCK_LATENCY_US     per op latency, e.g. "StartVRMode=2000,GetParam=50"
+//   QVRMOCK_FAIL           fail the first N calls of an op,
+//                          e.g. "StartVRMode=3"
+//   QVRMOCK_POSE_HZ        pose ring writer rate, default 1000
+//   QVRMOCK_EYE_HZ         eye pose ring writer rate, default 90
+//   QVRMOCK_API_VERSION    api_version reported to the helpers, default 8
+//   QVRMOCK_CLOCK_DRIFT_PPB drift of the reported tracker-android offset
+//   QVRMOCK_TRACKING_INIT_MS time 6DoF tracking stays UNINITIALIZED after
+//                          every StartVRMode (not ResumeVRMode), default 0
+//
+// Tracking follows the service: a StartVRMode re-initializes it, which also
+// clears a FATAL_ERROR tracking state; outside TRACKING_MODE_POSITIONAL the
+// tracking_state reads UNINITIALIZED; and a service that comes back after a
+// disconnect is in its default TRACKING_MODE_ROTATIONAL.
+//
+// Eye poses (fixations with saccades between them) are only written while
+// VR mode is started and the eye tracking mode is DUAL. A client holding a
+// QVR_SYNC_SOURCE_EYE_POSE_CLIENT_READ sync ctrl that calls
+// GetEyeTrackingDataWithFlags(QVR_EYE_TRACKING_DATA_ENABLE_SYNC) at a steady
+// rate gets eye poses generated at that rate, shortly before each read.
+//
+// GetPointCloud() returns a tracker map that grows while VR mode is started:
+// every cloud adds points, by default 200 up to 20000, on the walls, floor
+// and ceiling of a 6 x 3 x 6 m room, and holds the 2000 newest in no
+// particular order. Each point is off its true place by an error that
+// shrinks with every cloud showing it. Clouds are malloc()ed per call and
+// freed by ReleasePointCloud() or when their client goes.
+//
+// With QVRMOCK_STOP_EVERY_MS or QVRMOCK_SCRIPT set, the time from a forced
+// stop until a client calls StartVRMode again is printed to stderr.
+
+#include "mock/qvrservice_mock.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// opaque to clients
+struct qvrsync_ctrl_t {
+    void* client;
+    QVR_SYNC_SOURCE source;
+};
+
+namespace {
+
+#define POSE_RING_ELEMENTS 256
+#define PREDICTED_POSE_SLOTS 8
+// slots are recycled this long after their target time passed
+#define PREDICTED_SLOT_LINGER_NS 1000000000LL
+#define RING_HEADER_SIZE 64
+// at least 0.5 s of eye poses at up to 120 Hz
+#define EYE_RING_ELEMENTS 64
+// synced eye poses are written this long before the expected client read
+#define EYE_SYNC_LEAD_NS 1000000LL
+
+int64_t mock_now_ns(clockid_t clock = CLOCK_MONOTONIC)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void sleep_until_ns(int64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+const char* op_names[QVRMOCK_OP_MAX] = {
+    "StartVRMode",
+    "StopVRMode",
+    "PauseVRMode",
+    "ResumeVRMode",
+    "GetVRMode",
+    "SetTrackingMode",
+    "GetHeadTrackingData",
+    "GetHistoricalHeadTrackingData",
+    "GetFramePose",
+    "GetRingBufferDescriptor",
+    "GetParam",
+    "Create",
+    "ActivatePredictedHeadTrackingPoseElement",
+    "GetEyeTrackingData",
+    "GetPointCloud",
+};
+
+int op_from_name(const std::string& name)
+{
+    for (int i = 0; i < QVRMOCK_OP_MAX; i++) {
+        if (name == op_names[i])
+            return i;
+    }
+    return -1;
+}
+
+// fd backed ring, index at offset 0, elements from RING_HEADER_SIZE on
+struct MockRing {
+    int fd;
+    uint8_t* base;
+    uint32_t size;
+    uint32_t element_size;
+    uint32_t num_elements;
+
+    bool create(const char* name, uint32_t elem_size, uint32_t count)
+    {
+        element_size = elem_size;
+        num_elements = count;
+        size = RING_HEADER_SIZE + elem_size * count;
+        fd = memfd_create(name, MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, size) != 0)
+            return false;
+        base = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        return base != MAP_FAILED;
+    }
+
+    std::atomic<uint32_t>* index() { return (std::atomic<uint32_t>*) base; }
+    void* element(uint32_t i) { return base + RING_HEADER_SIZE + (size_t) (i % num_elements) * element_size; }
+
+    void describe(qvrservice_ring_buffer_desc_t* desc)
+    {
+        memset(desc, 0, sizeof(*desc));
+        desc->fd = dup(fd);
+        desc->size = size;
+        desc->index_offset = 0;
+        desc->ring_offset = RING_HEADER_SIZE;
+        desc->element_size = element_size;
+        desc->num_elements = num_elements;
+    }
+};
+
+struct MockClient {
+    notification_callback_fn callbacks[NOTIFICATION_MAX];
+    void* contexts[NOTIFICATION_MAX];
+    client_status_callback_fn status_cb;
+    void* status_ctx;
+    bool disconnected;
+    qvrservice_head_tracking_data_t head_pose;
+    XrFramePoseQTI frame_pose;
+    qvrservice_sensor_data_raw_t raw;
+    qvrservice_ts_t vsync_ts;
+    qvrservice_eye_tracking_data_t eye_data;
+    qvrsync_ctrl_t* eye_sync;
+    // GetPointCloud() results not released yet
+    std::vector<XrPointCloudQTI*> clouds;
+};
+
+struct MockNotification {
+    QVRSERVICE_CLIENT_NOTIFICATION type;
+    qvrservice_state_notify_payload_t state;
+    qvrservice_subsystem_error_notify_payload_t subsystem;
+};
+
+struct ScriptStep {
+    int64_t at_ms;
+    std::string action;
+    std::string arg;
+};
+
+class MockService {
+public:
+    static MockService& get()
+    {
+        static MockService* service = new MockService();
+        return *service;
+    }
+
+    // latency and failure injection, returns the injected error or 0
+    int32_t enter(QVRMOCK_OP op)
+    {
+        call_counts[op]++;
+        uint32_t us = latency_us[op].load(std::memory_order_relaxed);
+        if (us != 0)
+            usleep(us);
+
+        uint32_t n = fail_count[op].load(std::memory_order_relaxed);
+        while (n != 0) {
+            if (fail_count[op].compare_exchange_weak(n, n - 1))
+                return fail_error[op];
+        }
+        return 0;
+    }
+
+    MockClient* create_client()
+    {
+        MockClient* c = new MockClient();
+        std::lock_guard<std::mutex> l(lock);
+        clients.push_back(c);
+        return c;
+    }
+
+    void destroy_client(MockClient* c)
+    {
+        std::unique_lock<std::mutex> l(lock);
+        if (owner == c && state != VRMODE_STOPPED)
+            stop_locked();
+        if (c->eye_sync != NULL)
+            release_sync_ctrl(c, c->eye_sync);
+        {
+            std::lock_guard<std::mutex> cl(cloud_lock);
+            for (XrPointCloudQTI* pc : c->clouds)
+                free(pc);
+            clouds_held -= (uint32_t) c->clouds.size();
+            c->clouds.clear();
+        }
+        clients.erase(std::remove(clients.begin(), clients.end(), c), clients.end());
+        // a callback may still be running on the dispatch thread
+        if (std::this_thread::get_id() != dispatch_id)
+            idle.wait(l, [this]() { return !dispatching; });
+        delete c;
+    }
+
+    bool alive(MockClient* c)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        return !c->disconnected;
+    }
+
+    QVRSERVICE_VRMODE_STATE get_state()
+    {
+        std::lock_guard<std::mutex> l(lock);
+        return state;
+    }
+
+    int32_t start(MockClient* c)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (c->disconnected || state != VRMODE_STOPPED)
+            return QVR_ERROR;
+
+        if (stopped_at != 0 && report_restarts) {
+            fprintf(stderr, "qvrmock: vrmode restarted %.3f ms after stop\n",
+                    (mock_now_ns() - stopped_at) / 1000000.0);
+        }
+        stopped_at = 0;
+        owner = c;
+        // a fresh session re-initializes tracking
+        uint32_t bits = tracking_bits.load();
+        if (bits & 0x8)
+            tracking_bits.store((bits & 0xffff0000u) | 0x4);
+        tracking_ready_at.store(mock_now_ns() + tracking_init_ns.load());
+        set_state_locked(VRMODE_STARTING);
+        set_state_locked(VRMODE_STARTED);
+        return QVR_SUCCESS;
+    }
+
+    int32_t stop(MockClient* c)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (c->disconnected)
+            return QVR_ERROR;
+        if (state == VRMODE_STOPPED)
+            return QVR_SUCCESS;
+        if (owner != c && owner != NULL)
+            return QVR_ERROR;
+        stop_locked();
+        return QVR_SUCCESS;
+    }
+
+    int32_t pause(MockClient* c)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (c->disconnected || state != VRMODE_STARTED || owner != c)
+            return QVR_ERROR;
+        set_state_locked(VRMODE_PAUSING);
+        set_state_locked(VRMODE_PAUSED);
+        return QVR_SUCCESS;
+    }
+
+    int32_t resume(MockClient* c)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (c->disconnected || state != VRMODE_PAUSED || owner != c)
+            return QVR_ERROR;
+        set_state_locked(VRMODE_RESUMING);
+        set_state_locked(VRMODE_STARTED);
+        return QVR_SUCCESS;
+    }
+
+    void force_state(QVRSERVICE_VRMODE_STATE target)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (state == target)
+            return;
+
+        switch (target) {
+            case VRMODE_STOPPED:
+                stop_locked();
+                stopped_at = mock_now_ns();
+                break;
+            case VRMODE_PAUSED:
+                set_state_locked(VRMODE_PAUSING);
+                set_state_locked(VRMODE_PAUSED);
+                break;
+            case VRMODE_STARTED:
+                set_state_locked(state == VRMODE_PAUSED ? VRMODE_RESUMING : VRMODE_STARTING);
+                set_state_locked(VRMODE_STARTED);
+                break;
+            default:
+                set_state_locked(target);
+                break;
+        }
+    }
+
+    void disconnect()
+    {
+        std::lock_guard<std::mutex> l(lock);
+        for (MockClient* c : clients)
+            c->disconnected = true;
+
+        MockNotification n = {};
+        n.type = NOTIFICATION_DISCONNECTED;
+        queue.push_back(n);
+        pending.notify_all();
+
+        // the restarted service comes back stopped, without notifying the
+        // clients that just lost their connection
+        state = VRMODE_STOPPED;
+        owner = NULL;
+        stopped_at = mock_now_ns();
+        tracking_mode.store(TRACKING_MODE_ROTATIONAL);
+        eye_mode.store(QVRSERVICE_EYE_TRACKING_MODE_NONE);
+        std::lock_guard<std::mutex> sl(sync_lock);
+        eye_sync = NULL;
+        eye_read_period_ns = 0;
+    }
+
+    void subsystem_error(QVRSERVICE_SUBSYSTEM_TYPE type, QVRSERVICE_SUBSYSTEM_ERROR_STATE error_state,
+                         uint64_t param)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        MockNotification n = {};
+        n.type = NOTIFICATION_SUBSYSTEM_ERROR;
+        n.subsystem.subsystem_type = type;
+        n.subsystem.error_state = error_state;
+        n.subsystem.param = param;
+        queue.push_back(n);
+        pending.notify_all();
+    }
+
+    int32_t register_notification(MockClient* c, QVRSERVICE_CLIENT_NOTIFICATION n,
+                                  notification_callback_fn cb, void* ctx)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (c->disconnected)
+            return QVR_ERROR;
+        c->callbacks[n] = cb;
+        c->contexts[n] = ctx;
+        return QVR_SUCCESS;
+    }
+
+    int32_t set_status_callback(MockClient* c, client_status_callback_fn cb, void* ctx)
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (c->disconnected)
+            return QVR_ERROR;
+        c->status_cb = cb;
+        c->status_ctx = ctx;
+        return QVR_SUCCESS;
+    }
+
+    int32_t get_tracking_mode(QVRSERVICE_TRACKING_MODE* mode, uint32_t* supported)
+    {
+        if (mode != NULL)
+            *mode = (QVRSERVICE_TRACKING_MODE) tracking_mode.load();
+        if (supported != NULL)
+            *supported = TRACKING_MODE_ROTATIONAL | TRACKING_MODE_POSITIONAL;
+        return QVR_SUCCESS;
+    }
+
+    int32_t set_tracking_mode(QVRSERVICE_TRACKING_MODE mode)
+    {
+        if (mode != TRACKING_MODE_NONE && mode != TRACKING_MODE_ROTATIONAL &&
+            mode != TRACKING_MODE_POSITIONAL)
+            return QVR_INVALID_PARAM;
+        if (get_state() != VRMODE_STOPPED)
+            return QVR_ERROR;
+        tracking_mode.store(mode);
+        return QVR_SUCCESS;
+    }
+
+    bool streaming()
+    {
+        return get_state() == VRMODE_STARTED && tracking_mode.load() != TRACKING_MODE_NONE;
+    }
+
+    int32_t latest_head_pose(qvrservice_head_tracking_data_t* out)
+    {
+        if (!streaming())
+            return QVR_ERROR;
+        uint32_t idx = pose_ring.index()->load(std::memory_order_acquire);
+        memcpy(out, pose_ring.element(idx), sizeof(*out));
+        return QVR_SUCCESS;
+    }
+
+    int32_t historical_head_pose(qvrservice_head_tracking_data_t* out, int64_t ts)
+    {
+        if (ts == 0)
+            return latest_head_pose(out);
+        if (!streaming())
+            return QVR_ERROR;
+
+        uint32_t idx = pose_ring.index()->load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < pose_ring.num_elements - 1; i++) {
+            qvrservice_head_tracking_data_t* p =
+                (qvrservice_head_tracking_data_t*) pose_ring.element(idx - i);
+            if (p->ts != 0 && (int64_t) p->ts <= ts) {
+                memcpy(out, p, sizeof(*out));
+                return QVR_SUCCESS;
+            }
+        }
+        return QVR_ERROR;
+    }
+
+    int32_t latest_frame_pose(XrFramePoseQTI* out)
+    {
+        if (!streaming())
+            return QVR_ERROR;
+        uint32_t idx = frame_ring.index()->load(std::memory_order_acquire);
+        memcpy(out, frame_ring.element(idx), sizeof(*out));
+        return QVR_SUCCESS;
+    }
+
+    int32_t get_eye_mode(uint32_t* mode, uint32_t* supported)
+    {
+        if (mode != NULL)
+            *mode = eye_mode.load();
+        if (supported != NULL)
+            *supported = QVRSERVICE_EYE_TRACKING_MODE_DUAL;
+        return QVR_SUCCESS;
+    }
+
+    int32_t set_eye_mode(uint32_t mode)
+    {
+        if (mode != QVRSERVICE_EYE_TRACKING_MODE_NONE && mode != QVRSERVICE_EYE_TRACKING_MODE_DUAL)
+            return QVR_INVALID_PARAM;
+        eye_mode.store(mode);
+        return QVR_SUCCESS;
+    }
+
+    bool eye_streaming()
+    {
+        return eye_mode.load() == QVRSERVICE_EYE_TRACKING_MODE_DUAL && get_state() == VRMODE_STARTED;
+    }
+
+    // timestamp_ns is QTimer time like in the real client, 0 for the latest
+    int32_t eye_pose(MockClient* c, qvrservice_eye_tracking_data_t* out, int64_t timestamp_ns,
+                     qvr_eye_tracking_data_flags_t flags)
+    {
+        if (flags & QVR_EYE_TRACKING_DATA_ENABLE_SYNC) {
+            if (c->eye_sync == NULL)
+                return QVR_INVALID_PARAM;
+            note_sync_read(c->eye_sync);
+        }
+        if (!eye_streaming())
+            return QVR_ERROR;
+
+        uint32_t idx = eye_ring.index()->load(std::memory_order_acquire);
+        if (timestamp_ns == 0) {
+            memcpy(out, eye_ring.element(idx), sizeof(*out));
+            return out->timestamp != 0 ? QVR_SUCCESS : QVR_ERROR;
+        }
+
+        int64_t boot_ts = timestamp_ns + tracker_android_offset();
+        for (uint32_t i = 0; i < eye_ring.num_elements - 1; i++) {
+            qvrservice_eye_tracking_data_t* p = (qvrservice_eye_tracking_data_t*) eye_ring.element(idx - i);
+            if (p->timestamp != 0 && p->timestamp <= boot_ts) {
+                memcpy(out, p, sizeof(*out));
+                return QVR_SUCCESS;
+            }
+        }
+        return QVR_ERROR;
+    }
+
+    qvrsync_ctrl_t* get_sync_ctrl(MockClient* c, QVR_SYNC_SOURCE source)
+    {
+        // camera frame and vsync sync sources are not simulated
+        if (source != QVR_SYNC_SOURCE_EYE_POSE_CLIENT_READ || !alive(c))
+            return NULL;
+
+        std::lock_guard<std::mutex> l(sync_lock);
+        if (c->eye_sync == NULL) {
+            c->eye_sync = new qvrsync_ctrl_t();
+            c->eye_sync->client = c;
+            c->eye_sync->source = source;
+        }
+        // the newest reader drives the eye pose timing
+        eye_sync = c->eye_sync;
+        eye_last_read_ns = 0;
+        eye_read_period_ns = 0;
+        return c->eye_sync;
+    }
+
+    int32_t release_sync_ctrl(MockClient* c, qvrsync_ctrl_t* ctrl)
+    {
+        std::lock_guard<std::mutex> l(sync_lock);
+        if (ctrl == NULL || c->eye_sync != ctrl)
+            return QVR_INVALID_PARAM;
+        if (eye_sync == ctrl) {
+            eye_sync = NULL;
+            eye_read_period_ns = 0;
+        }
+        c->eye_sync = NULL;
+        delete ctrl;
+        return QVR_SUCCESS;
+    }
+
+    int32_t describe_ring(QVRSERVICE_RING_BUFFER_ID id, qvrservice_ring_buffer_desc_t* desc)
+    {
+        switch (id) {
+            case RING_BUFFER_POSE:
+                pose_ring.describe(desc);
+                return QVR_SUCCESS;
+            case RING_BUFFER_EYE_POSE:
+                eye_ring.describe(desc);
+                return QVR_SUCCESS;
+            case RING_BUFFER_FRAME_POSE:
+                frame_ring.describe(desc);
+                return QVR_SUCCESS;
+            case RING_BUFFER_PREDICTED_HEAD_POSE:
+                predicted_ring.describe(desc);
+                return QVR_SUCCESS;
+            default:
+                return QVR_API_NOT_SUPPORTED;
+        }
+    }
+
+    int32_t activate_predicted(int16_t* element_id, int64_t target_ns)
+    {
+        typedef qvrservice_predicted_head_tracking_data_t slot_t;
+
+        if (element_id == NULL)
+            return QVR_INVALID_PARAM;
+        if (!streaming())
+            return QVR_ERROR;
+
+        std::lock_guard<std::mutex> l(predicted_lock);
+        int16_t id = *element_id;
+        if (id == -1) {
+            for (int16_t i = 0; i < PREDICTED_POSE_SLOTS && id == -1; i++) {
+                if (((slot_t*) predicted_ring.element(i))->slot_status == QVRSERVICE_LATE_LATCHING_SLOT_UNUSED)
+                    id = i;
+            }
+            if (id == -1)
+                return QVR_NO_AVAILABLE_BUFFERS;
+        } else if (id < 0 || id >= PREDICTED_POSE_SLOTS) {
+            return QVR_INVALID_PARAM;
+        }
+
+        slot_t* slot = (slot_t*) predicted_ring.element(id);
+        bool fresh = slot->slot_status == QVRSERVICE_LATE_LATCHING_SLOT_UNUSED;
+        write_predicted_slot(slot, target_ns, fresh);
+        *element_id = id;
+        return QVR_SUCCESS;
+    }
+
+    int64_t tracker_android_offset() const
+    {
+        int64_t since = mock_now_ns(CLOCK_BOOTTIME) - android_offset_base_ns;
+        return android_offset_ns + since / 1000 * clock_drift_ppb.load() / 1000000;
+    }
+
+    void set_clock_drift_ppb(int32_t ppb)
+    {
+        // keep the offset continuous across drift changes
+        android_offset_ns = tracker_android_offset();
+        android_offset_base_ns = mock_now_ns(CLOCK_BOOTTIME);
+        clock_drift_ppb.store(ppb);
+    }
+
+    void set_tracking_state(uint16_t state_bits, uint16_t warnings)
+    {
+        tracking_bits.store(state_bits | ((uint32_t) warnings << 16));
+    }
+
+    void set_tracking_init_ms(uint32_t ms)
+    {
+        tracking_init_ns.store((int64_t) ms * 1000000LL);
+    }
+
+    void set_pose_rate(uint32_t hz)
+    {
+        pose_hz.store(hz);
+    }
+
+    void set_latch_rate(uint32_t hz)
+    {
+        latch_hz.store(hz);
+    }
+
+    uint64_t latch_update_count() const
+    {
+        return latch_updates.load();
+    }
+
+    void set_eye_rate(uint32_t hz)
+    {
+        eye_hz.store(hz);
+    }
+
+    void set_point_cloud(uint32_t growth, uint32_t window, uint32_t max_points)
+    {
+        std::lock_guard<std::mutex> l(cloud_lock);
+        cloud_growth = growth;
+        cloud_window = window;
+        cloud_max = max_points;
+        clouds_made = 0;
+    }
+
+    // where map point id really is
+    static void map_point(uint32_t id, float* xyz)
+    {
+        uint32_t h = hash32(id);
+        uint32_t g = hash32(id ^ 0x9e3779b9u);
+        float u = (h & 0xffff) / 65535.0f;
+        float v = (g & 0xffff) / 65535.0f;
+        switch ((h >> 16) % 6) {
+            case 0:
+            case 1:
+                xyz[0] = (h >> 16) % 6 == 0 ? -3.0f : 3.0f;
+                xyz[1] = 3.0f * v;
+                xyz[2] = 6.0f * u - 3.0f;
+                break;
+            case 2:
+            case 3:
+                xyz[0] = 6.0f * u - 3.0f;
+                xyz[1] = (h >> 16) % 6 == 2 ? 0.0f : 3.0f;
+                xyz[2] = 6.0f * v - 3.0f;
+                break;
+            default:
+                xyz[0] = 6.0f * u - 3.0f;
+                xyz[1] = 3.0f * v;
+                xyz[2] = (h >> 16) % 6 == 4 ? -3.0f : 3.0f;
+                break;
+        }
+    }
+
+    int32_t get_point_cloud(MockClient* c, XrPointCloudQTI** out)
+    {
+        if (!streaming())
+            return QVR_ERROR;
+        std::lock_guard<std::mutex> l(cloud_lock);
+        uint32_t made = ++clouds_made;
+        uint32_t known = (uint32_t) std::min((uint64_t) made * cloud_growth, (uint64_t) cloud_max);
+        uint32_t first = known > cloud_window ? known - cloud_window + 1 : 1;
+        uint32_t n = known >= first ? known - first + 1 : 0;
+        XrPointCloudQTI* pc = (XrPointCloudQTI*) malloc(sizeof(XrPointCloudQTI) + (size_t) n * sizeof(XrMapPointQTI));
+        if (pc == NULL)
+            return QVR_ERROR;
+        pc->timestamp = (uint64_t) mock_now_ns(CLOCK_BOOTTIME);
+        pc->maxPoints = n;
+        pc->numPoints = n;
+        // a prime stride walks the window out of order
+        uint32_t stride = n % 7919 != 0 ? 7919 : 1;
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t id = first + (uint32_t) ((uint64_t) i * stride % n);
+            // clouds that showed the point, this one included
+            uint32_t seen = made - (id - 1) / std::max(cloud_growth, 1u);
+            float error = 0.02f / (float) seen;
+            float xyz[3];
+            map_point(id, xyz);
+            uint32_t h = hash32(id * 2654435761u ^ made);
+            XrMapPointQTI& p = pc->points[i];
+            p.id = id;
+            p.position.x = xyz[0] + error * ((h & 0x3ff) / 511.5f - 1.0f);
+            p.position.y = xyz[1] + error * (((h >> 10) & 0x3ff) / 511.5f - 1.0f);
+            p.position.z = xyz[2] + error * (((h >> 20) & 0x3ff) / 511.5f - 1.0f);
+        }
+        c->clouds.push_back(pc);
+        clouds_held++;
+        *out = pc;
+        return QVR_SUCCESS;
+    }
+
+    int32_t release_point_cloud(MockClient* c, XrPointCloudQTI* pc)
+    {
+        std::lock_guard<std::mutex> l(cloud_lock);
+        std::vector<XrPointCloudQTI*>::iterator it = std::find(c->clouds.begin(), c->clouds.end(), pc);
+        if (it == c->clouds.end())
+            return QVR_INVALID_PARAM;
+        c->clouds.erase(it);
+        clouds_held--;
+        free(pc);
+        return QVR_SUCCESS;
+    }
+
+    uint32_t point_clouds_held()
+    {
+        std::lock_guard<std::mutex> l(cloud_lock);
+        return clouds_held;
+    }
+
+    std::atomic<uint32_t> latency_us[QVRMOCK_OP_MAX];
+    std::atomic<uint32_t> fail_count[QVRMOCK_OP_MAX];
+    int32_t fail_error[QVRMOCK_OP_MAX];
+    std::atomic<uint64_t> call_counts[QVRMOCK_OP_MAX];
+    int api_version;
+
+private:
+    MockService()
+        : api_version(QVRSERVICECLIENT_API_VERSION_8)
+        , state(VRMODE_STOPPED)
+        , owner(NULL)
+        , stopped_at(0)
+        , dispatching(false)
+        , report_restarts(false)
+        , tracking_mode(TRACKING_MODE_POSITIONAL)
+        , tracking_bits(0x4)
+        , tracking_init_ns(0)
+        , tracking_ready_at(0)
+        , pose_hz(1000)
+        , latch_hz(0)
+        , latch_updates(0)
+        , eye_mode(QVRSERVICE_EYE_TRACKING_MODE_NONE)
+        , eye_hz(90)
+        , eye_sync(NULL)
+        , eye_last_read_ns(0)
+        , eye_read_period_ns(0)
+        , cloud_growth(200)
+        , cloud_window(2000)
+        , cloud_max(20000)
+        , clouds_made(0)
+        , clouds_held(0)
+        , created_at(mock_now_ns())
+        , android_offset_ns(mock_now_ns(CLOCK_BOOTTIME) - mock_now_ns(CLOCK_MONOTONIC))
+        , android_offset_base_ns(mock_now_ns(CLOCK_BOOTTIME))
+        , clock_drift_ppb(0)
+    {
+        for (int i = 0; i < QVRMOCK_OP_MAX; i++) {
+            latency_us[i] = 0;
+            fail_count[i] = 0;
+            fail_error[i] = QVR_ERROR;
+            call_counts[i] = 0;
+        }
+        parse_env();
+
+        pose_ring.create("qvrmock-pose", sizeof(qvrservice_head_tracking_data_t), POSE_RING_ELEMENTS);
+        frame_ring.create("qvrmock-frame-pose", sizeof(XrFramePoseQTI), POSE_RING_ELEMENTS);
+        predicted_ring.create("qvrmock-predicted-pose", sizeof(qvrservice_predicted_head_tracking_data_t),
+                              PREDICTED_POSE_SLOTS);
+        eye_ring.create("qvrmock-eye-pose", sizeof(qvrservice_eye_tracking_data_t), EYE_RING_ELEMENTS);
+
+        std::thread dispatcher(&MockService::dispatch_loop, this);
+        dispatch_id = dispatcher.get_id();
+        dispatcher.detach();
+
+        std::thread(&MockService::pose_loop, this).detach();
+        std::thread(&MockService::latch_loop, this).detach();
+        std::thread(&MockService::eye_loop, this).detach();
+
+        const char* stop_every = getenv("QVRMOCK_STOP_EVERY_MS");
+        if (stop_every != NULL && atoi(stop_every) > 0) {
+            report_restarts = true;
+            std::thread(&MockService::stop_loop, this, atoi(stop_every)).detach();
+        }
+
+        if (!script.empty()) {
+            report_restarts = true;
+            std::thread(&MockService::script_loop, this).detach();
+        }
+    }
+
+    void parse_op_list(const char* env, bool latency)
+    {
+        const char* value = getenv(env);
+        if (value == NULL)
+            return;
+
+        std::string s(value);
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t end = s.find(',', pos);
+            if (end == std::string::npos)
+                end = s.size();
+            std::string item = s.substr(pos, end - pos);
+            size_t eq = item.find('=');
+            int op = eq != std::string::npos ? op_from_name(item.substr(0, eq)) : -1;
+            if (op < 0) {
+                fprintf(stderr, "qvrmock: bad %s entry '%s'\n", env, item.c_str());
+            } else if (latency) {
+                latency_us[op] = (uint32_t) strtoul(item.c_str() + eq + 1, NULL, 0);
+            } else {
+                fail_count[op] = (uint32_t) strtoul(item.c_str() + eq + 1, NULL, 0);
+            }
+            pos = end + 1;
+        }
+    }
+
+    void parse_env()
+    {
+        parse_op_list("QVRMOCK_LATENCY_US", true);
+        parse_op_list("QVRMOCK_FAIL", false);
+
+        const char* hz = getenv("QVRMOCK_POSE_HZ");
+        if (hz != NULL)
+            pose_hz = (uint32_t) strtoul(hz, NULL, 0);
+
+        const char* eye_rate = getenv("QVRMOCK_EYE_HZ");
+        if (eye_rate != NULL)
+            eye_hz = (uint32_t) strtoul(eye_rate, NULL, 0);
+
+        const char* version = getenv("QVRMOCK_API_VERSION");
+        if (version != NULL)
+            api_version = atoi(version);
+
+        const char* drift = getenv("QVRMOCK_CLOCK_DRIFT_PPB");
+        if (drift != NULL)
+            clock_drift_ppb = atoi(drift);
+
+        const char* init_ms = getenv("QVRMOCK_TRACKING_INIT_MS");
+        if (init_ms != NULL)
+            set_tracking_init_ms((uint32_t) strtoul(init_ms, NULL, 0));
+
+        const char* value = getenv("QVRMOCK_SCRIPT");
+        if (value == NULL)
+            return;
+
+        std::string s(value);
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t end = s.find(';', pos);
+            if (end == std::string::npos)
+                end = s.size();
+            std::string item = s.substr(pos, end - pos);
+            size_t colon = item.find(':');
+            if (colon != std::string::npos) {
+                ScriptStep step;
+                step.at_ms = strtoll(item.c_str(), NULL, 0);
+                step.action = item.substr(colon + 1);
+                size_t eq = step.action.find('=');
+                if (eq != std::string::npos) {
+                    step.arg = step.action.substr(eq + 1);
+                    step.action.resize(eq);
+                }
+                script.push_back(step);
+            }
+            pos = end + 1;
+        }
+        std::stable_sort(script.begin(), script.end(),
+                         [](const ScriptStep& a, const ScriptStep& b) { return a.at_ms < b.at_ms; });
+    }
+
+    void stop_locked()
+    {
+        set_state_locked(VRMODE_STOPPING);
+        set_state_locked(VRMODE_STOPPED);
+        owner = NULL;
+    }
+
+    void set_state_locked(QVRSERVICE_VRMODE_STATE new_state)
+    {
+        MockNotification n;
+        n.type = NOTIFICATION_STATE_CHANGED;
+        n.state.previous_state = state;
+        n.state.new_state = new_state;
+        state = new_state;
+        queue.push_back(n);
+        pending.notify_all();
+    }
+
+    void dispatch_loop()
+    {
+        std::unique_lock<std::mutex> l(lock);
+        while (true) {
+            pending.wait(l, [this]() { return !queue.empty(); });
+            MockNotification n = queue.front();
+            queue.pop_front();
+
+            dispatching = true;
+            std::vector<MockClient*> targets = clients;
+            for (MockClient* c : targets) {
+                // disconnected clients only get to hear about the disconnect
+                if (c->disconnected && n.type != NOTIFICATION_DISCONNECTED)
+                    continue;
+
+                notification_callback_fn cb = c->callbacks[n.type];
+                void* ctx = c->contexts[n.type];
+                client_status_callback_fn status_cb = c->status_cb;
+                void* status_ctx = c->status_ctx;
+
+                l.unlock();
+                if (cb != NULL) {
+                    void* payload = NULL;
+                    uint32_t len = 0;
+                    if (n.type == NOTIFICATION_STATE_CHANGED) {
+                        payload = &n.state;
+                        len = sizeof(n.state);
+                    } else if (n.type == NOTIFICATION_SUBSYSTEM_ERROR) {
+                        payload = &n.subsystem;
+                        len = sizeof(n.subsystem);
+                    }
+                    cb(ctx, n.type, payload, len);
+                } else if (status_cb != NULL && n.type == NOTIFICATION_STATE_CHANGED) {
+                    status_cb(status_ctx, STATUS_STATE_CHANGED, n.state.new_state, n.state.previous_state);
+                } else if (status_cb != NULL && n.type == NOTIFICATION_DISCONNECTED) {
+                    status_cb(status_ctx, STATUS_DISCONNECTED, 0, 0);
+                }
+                l.lock();
+            }
+            dispatching = false;
+            idle.notify_all();
+        }
+    }
+
+    // slow yaw plus a lateral sway, enough to exercise readers and predictors
+    void synth_pose(int64_t ts, qvrservice_head_tracking_data_t* p)
+    {
+        const double yaw_rate = 0.5;
+        const double sway_hz = 0.5;
+        const double sway_amp = 0.1;
+        double t = (ts - created_at) / 1e9;
+        double half = yaw_rate * t / 2.0;
+        double w = 2.0 * M_PI * sway_hz;
+
+        memset(p, 0, sizeof(*p));
+        p->rotation[1] = (float) sin(half);
+        p->rotation[3] = (float) cos(half);
+        if (tracking_mode.load() == TRACKING_MODE_POSITIONAL)
+            p->translation[0] = (float) (sway_amp * sin(w * t));
+        p->ts = (uint64_t) ts;
+
+        // angular velocity (rad/s) and linear velocity/acceleration (m/s, m/s^2)
+        p->prediction_coff_s[1] = (float) yaw_rate;
+        p->prediction_coff_ts[0] = (float) (sway_amp * w * cos(w * t));
+        p->prediction_coff_tb[0] = (float) (-sway_amp * w * w * sin(w * t));
+
+        uint32_t bits = tracking_bits.load();
+        if (tracking_mode.load() != TRACKING_MODE_POSITIONAL || ts < tracking_ready_at.load())
+            bits &= 0xffff0000u;
+        p->tracking_state = (uint16_t) bits;
+        p->tracking_warning_flags = (uint16_t) (bits >> 16);
+        p->pose_quality = (p->tracking_state & 0x4) ? 1.0f : 0.0f;
+    }
+
+    static void pose_to_mat44(const qvrservice_head_tracking_data_t& p, float m[16])
+    {
+        float x = p.rotation[0], y = p.rotation[1], z = p.rotation[2], w = p.rotation[3];
+        m[0] = 1 - 2 * (y * y + z * z);
+        m[1] = 2 * (x * y - z * w);
+        m[2] = 2 * (x * z + y * w);
+        m[3] = p.translation[0];
+        m[4] = 2 * (x * y + z * w);
+        m[5] = 1 - 2 * (x * x + z * z);
+        m[6] = 2 * (y * z - x * w);
+        m[7] = p.translation[1];
+        m[8] = 2 * (x * z - y * w);
+        m[9] = 2 * (y * z + x * w);
+        m[10] = 1 - 2 * (x * x + y * y);
+        m[11] = p.translation[2];
+        m[12] = m[13] = m[14] = 0.0f;
+        m[15] = 1.0f;
+    }
+
+    // writer side of the start/end sequence lock, caller holds predicted_lock
+    void write_predicted_slot(qvrservice_predicted_head_tracking_data_t* slot, int64_t target_ns, bool fresh)
+    {
+        int64_t now = mock_now_ns();
+        qvrservice_head_tracking_data_t predicted;
+        // the synthetic motion is analytic, so the "prediction" is exact
+        synth_pose(std::max(target_ns, now), &predicted);
+
+        uint64_t seq = slot->end + 1;
+        __atomic_store_n(&slot->start, seq, __ATOMIC_RELAXED);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot->prediction_target_ns = (uint64_t) target_ns;
+        slot->last_update_ts_ns = (uint64_t) now;
+        slot->forward_pred_delay_ms = target_ns > now ? (uint32_t) ((target_ns - now) / 1000000) : 0;
+        pose_to_mat44(predicted, slot->curPredictedPoseMat44F);
+        if (fresh) {
+            memcpy(slot->originalPredictedPoseMat44F, slot->curPredictedPoseMat44F,
+                   sizeof(slot->originalPredictedPoseMat44F));
+            slot->slot_status = QVRSERVICE_LATE_LATCHING_SLOT_INITIATED;
+        } else {
+            slot->slot_status = QVRSERVICE_LATE_LATCHING_SLOT_TRACKED;
+        }
+
+        __atomic_store_n(&slot->end, seq, __ATOMIC_RELEASE);
+    }
+
+    void update_predicted_slots()
+    {
+        typedef qvrservice_predicted_head_tracking_data_t slot_t;
+
+        std::lock_guard<std::mutex> l(predicted_lock);
+        int64_t now = mock_now_ns();
+        for (int i = 0; i < PREDICTED_POSE_SLOTS; i++) {
+            slot_t* slot = (slot_t*) predicted_ring.element(i);
+            if (slot->slot_status == QVRSERVICE_LATE_LATCHING_SLOT_UNUSED)
+                continue;
+
+            int64_t target = (int64_t) slot->prediction_target_ns;
+            if (now < target) {
+                write_predicted_slot(slot, target, false);
+            } else if (now > target + PREDICTED_SLOT_LINGER_NS) {
+                uint64_t seq = slot->end + 1;
+                __atomic_store_n(&slot->start, seq, __ATOMIC_RELAXED);
+                std::atomic_thread_fence(std::memory_order_release);
+                slot->slot_status = QVRSERVICE_LATE_LATCHING_SLOT_UNUSED;
+                __atomic_store_n(&slot->end, seq, __ATOMIC_RELEASE);
+            }
+        }
+    }
+
+    void pose_loop()
+    {
+        int64_t next = mock_now_ns();
+        uint32_t idx = 0;
+        while (true) {
+            uint32_t hz = pose_hz.load();
+            if (hz == 0 || !streaming()) {
+                // short enough not to dominate the time to the first pose
+                usleep(1000);
+                next = mock_now_ns();
+                continue;
+            }
+
+            qvrservice_head_tracking_data_t pose;
+            synth_pose(mock_now_ns(), &pose);
+
+            idx++;
+            memcpy(pose_ring.element(idx), &pose, sizeof(pose));
+            pose_ring.index()->store(idx, std::memory_order_release);
+
+            XrFramePoseQTI frame = {};
+            frame.pose.orientation.x = pose.rotation[0];
+            frame.pose.orientation.y = pose.rotation[1];
+            frame.pose.orientation.z = pose.rotation[2];
+            frame.pose.orientation.w = pose.rotation[3];
+            frame.pose.position.x = pose.translation[0];
+            frame.pose.position.y = pose.translation[1];
+            frame.pose.position.z = pose.translation[2];
+            frame.tracking_state = pose.tracking_state;
+            frame.tracking_warning_flags = pose.tracking_warning_flags;
+            frame.ts = pose.ts;
+            frame.pose_quality = pose.pose_quality;
+            memcpy(frame_ring.element(idx), &frame, sizeof(frame));
+            frame_ring.index()->store(idx, std::memory_order_release);
+
+            // unless latch_loop() has taken the slots over
+            if (latch_hz.load() == 0)
+                update_predicted_slots();
+
+            next += 1000000000LL / hz;
+            sleep_until_ns(next);
+        }
+    }
+
+    // Rewrites the predicted slots on its own at latch_hz. Rates like 100 kHz
+    // are far below what clock_nanosleep() wakes up for, so it spins to the
+    // next update instead of sleeping.
+    void latch_loop()
+    {
+        int64_t next = mock_now_ns();
+        while (true) {
+            uint32_t hz = latch_hz.load();
+            if (hz == 0 || !streaming()) {
+                usleep(1000);
+                next = mock_now_ns();
+                continue;
+            }
+
+            update_predicted_slots();
+            latch_updates.fetch_add(1, std::memory_order_relaxed);
+
+            int64_t period = 1000000000LL / hz;
+            next += period;
+            int64_t now = mock_now_ns();
+            // after a preemption carry on at the rate instead of catching up
+            // in a burst
+            if (now > next + period)
+                next = now;
+            while (now < next && latch_hz.load(std::memory_order_relaxed) == hz)
+                now = mock_now_ns();
+        }
+    }
+
+    static uint32_t hash32(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    // yaw/pitch in rad of the gaze target of fixation k, within +-15 deg
+    static void fixation_target(uint32_t k, double* yaw, double* pitch)
+    {
+        const double range = 15.0 * M_PI / 180.0;
+        uint32_t h = hash32(k + 1);
+        *yaw = ((h & 0xffff) / 32767.5 - 1.0) * range;
+        *pitch = ((h >> 16) / 32767.5 - 1.0) * range;
+    }
+
+    // 250 ms fixations joined by 40 ms saccades, plus a little tremor
+    void synth_gaze(int64_t mono_ts, uint32_t frame, qvrservice_eye_tracking_data_t* d)
+    {
+        const int64_t fixation_ns = 250000000LL;
+        const int64_t saccade_ns = 40000000LL;
+        const double tremor = 0.1 * M_PI / 180.0;
+        const float half_ipd = 0.032f;
+
+        int64_t t = mono_ts - created_at;
+        uint32_t k = (uint32_t) (t / (fixation_ns + saccade_ns));
+        int64_t in = t % (fixation_ns + saccade_ns);
+        double yaw, pitch;
+        fixation_target(k, &yaw, &pitch);
+        if (in < saccade_ns) {
+            double prev_yaw, prev_pitch;
+            fixation_target(k - 1, &prev_yaw, &prev_pitch);
+            double a = (double) in / saccade_ns;
+            a = a * a * (3.0 - 2.0 * a);
+            yaw = prev_yaw + (yaw - prev_yaw) * a;
+            pitch = prev_pitch + (pitch - prev_pitch) * a;
+        }
+        uint32_t h = hash32(frame);
+        yaw += ((h & 0xffff) / 32767.5 - 1.0) * tremor;
+        pitch += ((h >> 16) / 32767.5 - 1.0) * tremor;
+
+        float dir[3] = {
+            (float) (sin(yaw) * cos(pitch)),
+            (float) sin(pitch),
+            (float) (-cos(yaw) * cos(pitch)),
+        };
+        int64_t boot_ts = mock_now_ns(CLOCK_BOOTTIME);
+
+        memset(d, 0, sizeof(*d));
+        d->timestamp = boot_ts;
+        d->flags = QVR_GAZE_ORIGIN_COMBINED_VALID | QVR_GAZE_DIRECTION_COMBINED_VALID |
+                   QVR_GAZE_CONVERGENCE_DISTANCE_VALID;
+        for (int e = 0; e < QVR_EYE_MAX; e++) {
+            qvrservice_gaze_per_eye_t& eye = d->eye[e];
+            eye.flags = QVR_GAZE_PER_EYE_GAZE_ORIGIN_VALID | QVR_GAZE_PER_EYE_GAZE_DIRECTION_VALID |
+                        QVR_GAZE_PER_EYE_EYE_OPENNESS_VALID | QVR_GAZE_PER_EYE_BLINK_VALID;
+            eye.gazeOrigin[0] = e == QVR_EYE_LEFT ? -half_ipd : half_ipd;
+            memcpy(eye.gazeDirection, dir, sizeof(dir));
+            eye.eyeOpenness = 1.0f;
+        }
+        memcpy(d->gazeDirectionCombined, dir, sizeof(dir));
+        d->gazeConvergenceDistance = 1.0f;
+        d->timingFlags = QVR_TIMING_CAMERA_DATA_VALID;
+        d->timing.camera.frameNumber = frame;
+        d->timing.camera.exposureNs = 2000000;
+        d->timing.camera.startOfExposureNs = (uint64_t) (boot_ts - 4000000);
+        memcpy(d->foveatedGazeDirection, dir, sizeof(dir));
+        d->foveatedGazeTrackingState = QVRSERVICE_FOVEATED_GAZE_TRACKING_STATE_TRACKING;
+    }
+
+    void note_sync_read(qvrsync_ctrl_t* ctrl)
+    {
+        std::lock_guard<std::mutex> l(sync_lock);
+        if (ctrl != eye_sync)
+            return;
+        int64_t now = mock_now_ns();
+        int64_t dt = now - eye_last_read_ns;
+        eye_last_read_ns = now;
+        // read rates outside 8-200 Hz are not followed
+        if (dt < 5000000LL || dt > 125000000LL)
+            return;
+        eye_read_period_ns = eye_read_period_ns == 0 ? dt : eye_read_period_ns + (dt - eye_read_period_ns) / 8;
+    }
+
+    // free running at eye_hz, or just ahead of the synced reader's next read
+    int64_t next_eye_time(int64_t prev, uint32_t hz)
+    {
+        int64_t next = prev + 1000000000LL / hz;
+        std::lock_guard<std::mutex> l(sync_lock);
+        int64_t now = mock_now_ns();
+        if (eye_sync == NULL || eye_read_period_ns == 0 || now - eye_last_read_ns > 4 * eye_read_period_ns)
+            return next;
+        int64_t t = eye_last_read_ns + eye_read_period_ns - EYE_SYNC_LEAD_NS;
+        while (t <= now)
+            t += eye_read_period_ns;
+        return t;
+    }
+
+    void eye_loop()
+    {
+        int64_t next = mock_now_ns();
+        uint32_t idx = 0;
+        while (true) {
+            uint32_t hz = eye_hz.load();
+            if (hz == 0 || !eye_streaming()) {
+                usleep(1000);
+                next = mock_now_ns();
+                continue;
+            }
+
+            qvrservice_eye_tracking_data_t data;
+            synth_gaze(mock_now_ns(), idx + 1, &data);
+            idx++;
+            memcpy(eye_ring.element(idx), &data, sizeof(data));
+            eye_ring.index()->store(idx, std::memory_order_release);
+
+            next = next_eye_time(next, hz);
+            sleep_until_ns(next);
+        }
+    }
+
+    void stop_loop(int period_ms)
+    {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(period_ms));
+
+            std::lock_guard<std::mutex> l(lock);
+            if (state != VRMODE_STARTED)
+                continue;
+            stop_locked();
+            stopped_at = mock_now_ns();
+        }
+    }
+
+    void script_loop()
+    {
+        for (const ScriptStep& step : script) {
+            sleep_until_ns(created_at + step.at_ms * 1000000LL);
+
+            if (step.action == "stop") {
+                force_state(VRMODE_STOPPED);
+            } else if (step.action == "pause") {
+                force_state(VRMODE_PAUSED);
+            } else if (step.action == "resume" || step.action == "start") {
+                force_state(VRMODE_STARTED);
+            } else if (step.action == "headless") {
+                force_state(VRMODE_HEADLESS);
+            } else if (step.action == "disconnect") {
+                disconnect();
+            } else if (step.action == "tracking") {
+                uint32_t bits = (uint32_t) strtoul(step.arg.c_str(), NULL, 0);
+                set_tracking_state((uint16_t) bits, (uint16_t) (tracking_bits.load() >> 16));
+            } else if (step.action == "warnings") {
+                uint32_t bits = (uint32_t) strtoul(step.arg.c_str(), NULL, 0);
+                set_tracking_state((uint16_t) tracking_bits.load(), (uint16_t) bits);
+            } else if (step.action == "subsystem") {
+                size_t sep = step.arg.find('/');
+                uint64_t seconds = sep != std::string::npos ? strtoull(step.arg.c_str() + sep + 1, NULL, 0) : 0;
+                subsystem_error(QVRSERVICE_SUBSYSTEM_TYPE_TRACKING,
+                                (QVRSERVICE_SUBSYSTEM_ERROR_STATE) atoi(step.arg.c_str()), seconds);
+            } else if (step.action == "latency") {
+                size_t sep = step.arg.find('/');
+                int op = op_from_name(step.arg.substr(0, sep));
+                if (op >= 0 && sep != std::string::npos)
+                    latency_us[op] = (uint32_t) strtoul(step.arg.c_str() + sep + 1, NULL, 0);
+            } else if (step.action == "fail") {
+                size_t sep = step.arg.find('/');
+                int op = op_from_name(step.arg.substr(0, sep));
+                if (op >= 0 && sep != std::string::npos)
+                    fail_count[op] = (uint32_t) strtoul(step.arg.c_str() + sep + 1, NULL, 0);
+            } else {
+                fprintf(stderr, "qvrmock: unknown script action '%s'\n", step.action.c_str());
+            }
+        }
+    }
+
+    std::mutex lock;
+    std::condition_variable pending;
+    std::condition_variable idle;
+    std::deque<MockNotification> queue;
+    std::vector<MockClient*> clients;
+    QVRSERVICE_VRMODE_STATE state;
+    MockClient* owner;
+    int64_t stopped_at;
+    bool dispatching;
+    std::thread::id dispatch_id;
+    bool report_restarts;
+
+    std::atomic<int> tracking_mode;
+    std::atomic<uint32_t> tracking_bits;
+    std::atomic<int64_t> tracking_init_ns;
+    std::atomic<int64_t> tracking_ready_at;
+    std::atomic<uint32_t> pose_hz;
+    std::atomic<uint32_t> latch_hz;
+    std::atomic<uint64_t> latch_updates;
+    MockRing pose_ring;
+    MockRing frame_ring;
+    MockRing predicted_ring;
+    std::mutex predicted_lock;
+
+    std::atomic<uint32_t> eye_mode;
+    std::atomic<uint32_t> eye_hz;
+    MockRing eye_ring;
+    std::mutex sync_lock;
+    qvrsync_ctrl_t* eye_sync;
+    int64_t eye_last_read_ns;
+    int64_t eye_read_period_ns;
+
+    std::mutex cloud_lock;
+    uint32_t cloud_growth;
+    uint32_t cloud_window;
+    uint32_t cloud_max;
+    uint32_t clouds_made;
+    uint32_t clouds_held;
+
+    std::vector<ScriptStep> script;
+    int64_t created_at;
+    int64_t android_offset_ns;
+    int64_t android_offset_base_ns;
+    std::atomic<int32_t> clock_drift_ppb;
+};
+
+MockService& service()
+{
+    return MockService::get();
+}
+
+MockClient* to_client(qvrservice_client_handle_t handle)
+{
+    return (MockClient*) handle;
+}
+
+#define MOCK_ENTER(op)                          \
+    do {                                        \
+        int32_t injected = service().enter(op); \
+        if (injected != 0)                      \
+            return injected;                    \
+    } while (0)
+
+#define MOCK_CHECK_ALIVE(c)             \
+    do {                                \
+        if (!service().alive(c))        \
+            return QVR_ERROR;           \
+    } while (0)
+
+qvrservice_client_handle_t mock_create()
+{
+    if (service().enter(QVRMOCK_OP_CREATE) != 0)
+        return NULL;
+    return service().create_client();
+}
+
+void mock_destroy(qvrservice_client_handle_t client)
+{
+    service().destroy_client(to_client(client));
+}
+
+int32_t mock_set_client_status_callback(qvrservice_client_handle_t client,
+                                        client_status_callback_fn cb, void* pCtx)
+{
+    return service().set_status_callback(to_client(client), cb, pCtx);
+}
+
+QVRSERVICE_VRMODE_STATE mock_get_vrmode(qvrservice_client_handle_t client)
+{
+    if (service().enter(QVRMOCK_OP_GET_VRMODE) != 0 || !service().alive(to_client(client)))
+        return VRMODE_UNSUPPORTED;
+    return service().get_state();
+}
+
+int32_t mock_start_vrmode(qvrservice_client_handle_t client)
+{
+    MOCK_ENTER(QVRMOCK_OP_START_VRMODE);
+    return service().start(to_client(client));
+}
+
+int32_t mock_stop_vrmode(qvrservice_client_handle_t client)
+{
+    MOCK_ENTER(QVRMOCK_OP_STOP_VRMODE);
+    return service().stop(to_client(client));
+}
+
+int32_t mock_get_tracking_mode(qvrservice_client_handle_t client,
+                               QVRSERVICE_TRACKING_MODE* pCurrentMode, uint32_t* pSupportedModes)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    return service().get_tracking_mode(pCurrentMode, pSupportedModes);
+}
+
+int32_t mock_set_tracking_mode(qvrservice_client_handle_t client, QVRSERVICE_TRACKING_MODE mode)
+{
+    MOCK_ENTER(QVRMOCK_OP_SET_TRACKING_MODE);
+    MOCK_CHECK_ALIVE(to_client(client));
+    return service().set_tracking_mode(mode);
+}
+
+int32_t mock_set_display_interrupt_config(qvrservice_client_handle_t client,
+                                          QVRSERVICE_DISP_INTERRUPT_ID id, void* pCfg, uint32_t cfgSize)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    if (id >= DISP_INTERRUPT_MAX || pCfg == NULL)
+        return QVR_INVALID_PARAM;
+    disp_interrupt_callback_fn cb = id == DISP_INTERRUPT_VSYNC
+        ? ((qvrservice_vsync_interrupt_config_t*) pCfg)->cb
+        : ((qvrservice_lineptr_interrupt_config_t*) pCfg)->cb;
+    (void) cfgSize;
+    return cb != NULL ? QVR_CALLBACK_NOT_SUPPORTED : QVR_SUCCESS;
+}
+
+int32_t mock_set_thread_priority(qvrservice_client_handle_t client, int, int, int)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    return QVR_SUCCESS;
+}
+
+int32_t mock_get_param(qvrservice_client_handle_t client, const char* pName,
+                       uint32_t* pLen, char* pValue)
+{
+    MOCK_ENTER(QVRMOCK_OP_GET_PARAM);
+    MOCK_CHECK_ALIVE(to_client(client));
+    if (pName == NULL || pLen == NULL)
+        return QVR_INVALID_PARAM;
+
+    char value[64];
+    if (strcmp(pName, QVRSERVICE_SERVICE_VERSION) == 0 || strcmp(pName, QVRSERVICE_CLIENT_VERSION) == 0) {
+        snprintf(value, sizeof(value), "%d.0-mock", service().api_version);
+    } else if (strcmp(pName, QVRSERVICE_TRACKER_ANDROID_OFFSET_NS) == 0) {
+        snprintf(value, sizeof(value), "%lld", (long long) service().tracker_android_offset());
+    } else if (strcmp(pName, QVRSERVICE_DEVICE_MODE) == 0) {
+        snprintf(value, sizeof(value), "%s", QVRSERVICE_DEVICE_MODE_STANDALONE);
+    } else {
+        return QVR_INVALID_PARAM;
+    }
+
+    uint32_t len = (uint32_t) strlen(value) + 1;
+    if (pValue == NULL) {
+        *pLen = len;
+        return QVR_SUCCESS;
+    }
+    if (*pLen == 0)
+        return QVR_INVALID_PARAM;
+    uint32_t n = std::min(len, *pLen);
+    memcpy(pValue, value, n - 1);
+    pValue[n - 1] = '\0';
+    return QVR_SUCCESS;
+}
+
+int32_t mock_set_param(qvrservice_client_handle_t client, const char* pName, const char* pValue)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    if (pName == NULL || pValue == NULL)
+        return QVR_INVALID_PARAM;
+    return QVR_SUCCESS;
+}
+
+int32_t mock_get_sensor_raw_data(qvrservice_client_handle_t client, qvrservice_sensor_data_raw_t** ppData)
+{
+    MockClient* c = to_client(client);
+    MOCK_CHECK_ALIVE(c);
+    if (ppData == NULL)
+        return QVR_INVALID_PARAM;
+
+    memset(&c->raw, 0, sizeof(c->raw));
+    c->raw.gts = c->raw.ats = c->raw.mts = (uint64_t) mock_now_ns();
+    c->raw.gy = 0.5f;
+    c->raw.az = 9.81f;
+    *ppData = &c->raw;
+    return QVR_SUCCESS;
+}
+
+int32_t mock_get_head_tracking_data(qvrservice_client_handle_t client, qvrservice_head_tracking_data_t** ppData)
+{
+    MOCK_ENTER(QVRMOCK_OP_GET_HEAD_TRACKING_DATA);
+    MockClient* c = to_client(client);
+    MOCK_CHECK_ALIVE(c);
+    if (ppData == NULL)
+        return QVR_INVALID_PARAM;
+
+    int32_t res = service().latest_head_pose(&c->head_pose);
+    if (res == QVR_SUCCESS)
+        *ppData = &c->head_pose;
+    return res;
+}
+
+int32_t mock_get_ring_buffer_descriptor(qvrservice_client_handle_t client,
+                                        QVRSERVICE_RING_BUFFER_ID id, qvrservice_ring_buffer_desc_t* pDesc)
+{
+    MOCK_ENTER(QVRMOCK_OP_GET_RING_BUFFER_DESCRIPTOR);
+    MOCK_CHECK_ALIVE(to_client(client));
+    if (pDesc == NULL)
+        return QVR_INVALID_PARAM;
+    return service().describe_ring(id, pDesc);
+}
+
+int32_t mock_get_historical_head_tracking_data(qvrservice_client_handle_t client,
+                                               qvrservice_head_tracking_data_t** ppData, int64_t timestampNs)
+{
+    MOCK_ENTER(QVRMOCK_OP_GET_HISTORICAL_HEAD_TRACKING_DATA);
+    MockClient* c = to_client(client);
+    MOCK_CHECK_ALIVE(c);
+    if (ppData == NULL)
+        return QVR_INVALID_PARAM;
+
+    int32_t res = service().historical_head_pose(&c->head_pose, timestampNs);
+    if (res == QVR_SUCCESS)
+        *ppData = &c->head_pose;
+    return res;
+}
+
+int32_t mock_set_display_interrupt_capture(qvrservice_client_handle_t client,
+                                           QVRSERVICE_DISP_INTERRUPT_ID id, uint32_t)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    return id < DISP_INTERRUPT_MAX ? QVR_SUCCESS : QVR_INVALID_PARAM;
+}
+
+int32_t mock_get_display_interrupt_timestamp(qvrservice_client_handle_t client,
+                                             QVRSERVICE_DISP_INTERRUPT_ID id, qvrservice_ts_t** ppTs)
+{
+    MockClient* c = to_client(client);
+    MOCK_CHECK_ALIVE(c);
+    if (id >= DISP_INTERRUPT_MAX || ppTs == NULL)
+        return QVR_INVALID_PARAM;
+
+    // 60 Hz vsync grid on BOOTTIME
+    const int64_t period = 1000000000LL / 60;
+    int64_t now = mock_now_ns(CLOCK_BOOTTIME);
+    c->vsync_ts.ts = (uint64_t) (now - now % period);
+    c->vsync_ts.count = (uint32_t) (now / period);
+    *ppTs = &c->vsync_ts;
+    return QVR_SUCCESS;
+}
+
+int32_t mock_register_for_notification(qvrservice_client_handle_t client,
+                                       QVRSERVICE_CLIENT_NOTIFICATION notification,
+                                       notification_callback_fn cb, void* pCtx)
+{
+    if (notification < 0 || notification >= NOTIFICATION_MAX)
+        return QVR_INVALID_PARAM;
+    return service().register_notification(to_client(client), notification, cb, pCtx);
+}
+
+int32_t mock_set_thread_attributes_by_type(qvrservice_client_handle_t client, int, QVRSERVICE_THREAD_TYPE type)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    return type < MAX_THREAD_TYPE ? QVR_SUCCESS : QVR_INVALID_PARAM;
+}
+
+int32_t mock_set_operating_level(qvrservice_client_handle_t client, qvrservice_perf_level_t*,
+                                 uint32_t, char*, uint32_t*)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    return service().get_state() == VRMODE_STARTED ? QVR_SUCCESS : QVR_ERROR;
+}
+
+int32_t mock_get_eye_tracking_mode(qvrservice_client_handle_t client, uint32_t* pCurrentMode,
+                                   uint32_t* pSupportedModes)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    return service().get_eye_mode(pCurrentMode, pSupportedModes);
+}
+
+int32_t mock_set_eye_tracking_mode(qvrservice_client_handle_t client, uint32_t mode)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    return service().set_eye_mode(mode);
+}
+
+int32_t mock_get_eye_tracking_data_with_flags(qvrservice_client_handle_t client,
+                                              qvrservice_eye_tracking_data_t** ppData, int64_t timestampNs,
+                                              qvr_eye_tracking_data_flags_t flags)
+{
+    MOCK_ENTER(QVRMOCK_OP_GET_EYE_TRACKING_DATA);
+    MockClient* c = to_client(client);
+    MOCK_CHECK_ALIVE(c);
+    if (ppData == NULL)
+        return QVR_INVALID_PARAM;
+
+    int32_t res = service().eye_pose(c, &c->eye_data, timestampNs, flags);
+    if (res == QVR_SUCCESS)
+        *ppData = &c->eye_data;
+    return res;
+}
+
+int32_t mock_get_eye_tracking_data(qvrservice_client_handle_t client, qvrservice_eye_tracking_data_t** ppData,
+                                   int64_t timestampNs)
+{
+    return mock_get_eye_tracking_data_with_flags(client, ppData, timestampNs, 0);
+}
+
+int32_t mock_activate_predicted_head_tracking_pose_element(qvrservice_client_handle_t client,
+                                                           int16_t* element_id, int64_t target_prediction_timestamp_ns)
+{
+    MOCK_ENTER(QVRMOCK_OP_ACTIVATE_PREDICTED_POSE);
+    MOCK_CHECK_ALIVE(to_client(client));
+    return service().activate_predicted(element_id, target_prediction_timestamp_ns);
+}
+
+int32_t mock_set_transformation_matrix(qvrservice_client_handle_t client,
+                                       QVRSERVICE_TRANSFORMATION_MATRIX_TYPE type, float*)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    return type < QVRSERVICE_MAX_TRANSFORMATION_MAT ? QVR_SUCCESS : QVR_INVALID_PARAM;
+}
+
+int32_t mock_get_hw_transforms(qvrservice_client_handle_t client, uint32_t* pNumTransforms,
+                               qvrservice_hw_transform_t*)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    if (pNumTransforms == NULL)
+        return QVR_INVALID_PARAM;
+    *pNumTransforms = 0;
+    return QVR_SUCCESS;
+}
+
+qvrplugin_data_t* mock_get_plugin_data_handle(qvrservice_client_handle_t, const char*)
+{
+    return NULL;
+}
+
+void mock_release_plugin_data_handle(qvrservice_client_handle_t, qvrplugin_data_t*)
+{
+}
+
+int32_t mock_get_point_cloud(qvrservice_client_handle_t client, XrPointCloudQTI** point_cloud)
+{
+    MOCK_ENTER(QVRMOCK_OP_GET_POINT_CLOUD);
+    MockClient* c = to_client(client);
+    MOCK_CHECK_ALIVE(c);
+    if (point_cloud == NULL)
+        return QVR_INVALID_PARAM;
+    return service().get_point_cloud(c, point_cloud);
+}
+
+int32_t mock_release_point_cloud(qvrservice_client_handle_t client, XrPointCloudQTI* point_cloud)
+{
+    MockClient* c = to_client(client);
+    MOCK_CHECK_ALIVE(c);
+    return service().release_point_cloud(c, point_cloud);
+}
+
+int32_t mock_get_frame_pose(qvrservice_client_handle_t client, XrFramePoseQTI** ppData)
+{
+    MOCK_ENTER(QVRMOCK_OP_GET_FRAME_POSE);
+    MockClient* c = to_client(client);
+    MOCK_CHECK_ALIVE(c);
+    if (ppData == NULL)
+        return QVR_INVALID_PARAM;
+
+    int32_t res = service().latest_frame_pose(&c->frame_pose);
+    if (res == QVR_SUCCESS)
+        *ppData = &c->frame_pose;
+    return res;
+}
+
+int32_t mock_get_eye_tracking_capabilities(qvrservice_client_handle_t client, qvr_capabilities_flags_t* pCapabilities)
+{
+    MOCK_CHECK_ALIVE(to_client(client));
+    if (pCapabilities == NULL)
+        return QVR_INVALID_PARAM;
+    *pCapabilities = QVR_CAPABILITY_GAZE_COMBINED_GAZE | QVR_CAPABILITY_GAZE_CONVERGENCE_DISTANCE |
+                     QVR_CAPABILITY_GAZE_FOVEATED_GAZE | QVR_CAPABILITY_GAZE_PER_EYE_GAZE_ORIGIN |
+                     QVR_CAPABILITY_GAZE_PER_EYE_GAZE_DIRECTION | QVR_CAPABILITY_GAZE_PER_EYE_EYE_OPENNESS |
+                     QVR_CAPABILITY_GAZE_PER_EYE_BLINK;
+    return QVR_SUCCESS;
+}
+
+qvrsync_ctrl_t* mock_get_sync_ctrl(qvrservice_client_handle_t client, QVR_SYNC_SOURCE syncSrc)
+{
+    return service().get_sync_ctrl(to_client(client), syncSrc);
+}
+
+int32_t mock_release_sync_ctrl(qvrservice_client_handle_t client, qvrsync_ctrl_t* pSyncCtrl)
+{
+    return service().release_sync_ctrl(to_client(client), pSyncCtrl);
+}
+
+qvrservice_class_t* mock_get_class_handle(qvrservice_client_handle_t, uint32_t, const char*)
+{
+    return NULL;
+}
+
+void mock_release_class_handle(qvrservice_client_handle_t, qvrservice_class_t*)
+{
+}
+
+int32_t mock_pause_vrmode(qvrservice_client_handle_t client)
+{
+    MOCK_ENTER(QVRMOCK_OP_PAUSE_VRMODE);
+    return service().pause(to_client(client));
+}
+
+int32_t mock_resume_vrmode(qvrservice_client_handle_t client)
+{
+    MOCK_ENTER(QVRMOCK_OP_RESUME_VRMODE);
+    return service().resume(to_client(client));
+}
+
+qvrservice_client_ops_t make_ops()
+{
+    qvrservice_client_ops_t ops = {};
+    ops.Create = mock_create;
+    ops.Destroy = mock_destroy;
+    ops.SetClientStatusCallback = mock_set_client_status_callback;
+    ops.GetVRMode = mock_get_vrmode;
+    ops.StartVRMode = mock_start_vrmode;
+    ops.StopVRMode = mock_stop_vrmode;
+    ops.GetTrackingMode = mock_get_tracking_mode;
+    ops.SetTrackingMode = mock_set_tracking_mode;
+    ops.SetDisplayInterruptConfig = mock_set_display_interrupt_config;
+    ops.SetThreadPriority = mock_set_thread_priority;
+    ops.GetParam = mock_get_param;
+    ops.SetParam = mock_set_param;
+    ops.GetSensorRawData = mock_get_sensor_raw_data;
+    ops.GetHeadTrackingData = mock_get_head_tracking_data;
+    ops.GetRingBufferDescriptor = mock_get_ring_buffer_descriptor;
+    ops.GetHistoricalHeadTrackingData = mock_get_historical_head_tracking_data;
+    ops.SetDisplayInterruptCapture = mock_set_display_interrupt_capture;
+    ops.GetDisplayInterruptTimestamp = mock_get_display_interrupt_timestamp;
+    ops.RegisterForNotification = mock_register_for_notification;
+    ops.SetThreadAttributesByType = mock_set_thread_attributes_by_type;
+    ops.SetOperatingLevel = mock_set_operating_level;
+    ops.GetEyeTrackingMode = mock_get_eye_tracking_mode;
+    ops.SetEyeTrackingMode = mock_set_eye_tracking_mode;
+    ops.GetEyeTrackingData = mock_get_eye_tracking_data;
+    ops.ActivatePredictedHeadTrackingPoseElement = mock_activate_predicted_head_tracking_pose_element;
+    ops.SetTransformationMatrix = mock_set_transformation_matrix;
+    ops.GetHwTransforms = mock_get_hw_transforms;
+    ops.GetPluginDataHandle = mock_get_plugin_data_handle;
+    ops.ReleasePluginDataHandle = mock_release_plugin_data_handle;
+    ops.GetEyeTrackingDataWithFlags = mock_get_eye_tracking_data_with_flags;
+    ops.GetPointCloud = mock_get_point_cloud;
+    ops.ReleasePointCloud = mock_release_point_cloud;
+    ops.GetFramePose = mock_get_frame_pose;
+    ops.GetEyeTrackingCapabilities = mock_get_eye_tracking_capabilities;
+    ops.GetSyncCtrl = mock_get_sync_ctrl;
+    ops.ReleaseSyncCtrl = mock_release_sync_ctrl;
+    ops.GetClassHandle = mock_get_class_handle;
+    ops.ReleaseClassHandle = mock_release_class_handle;
+    ops.PauseVRMode = mock_pause_vrmode;
+    ops.ResumeVRMode = mock_resume_vrmode;
+    return ops;
+}
+
+qvrservice_client_ops_t mock_ops = make_ops();
+qvrservice_client_t mock_client = { QVRSERVICECLIENT_API_VERSION_8, &mock_ops };
+
+} // namespace
+
+extern "C" {
+
+__attribute__((visibility("default")))
+qvrservice_client_t* getQvrServiceClientInstance(void)
+{
+    mock_client.api_version = service().api_version;
+    return &mock_client;
+}
+
+const char* qvrmock_op_name(QVRMOCK_OP op)
+{
+    return op >= 0 && op < QVRMOCK_OP_MAX ? op_names[op] : "unknown";
+}
+
+void qvrmock_set_vrmode(QVRSERVICE_VRMODE_STATE state)
+{
+    service().force_state(state);
+}
+
+void qvrmock_disconnect(void)
+{
+    service().disconnect();
+}
+
+void qvrmock_set_latency_us(QVRMOCK_OP op, uint32_t us)
+{
+    if (op >= 0 && op < QVRMOCK_OP_MAX)
+        service().latency_us[op] = us;
+}
+
+void qvrmock_fail_next(QVRMOCK_OP op, uint32_t count, int32_t error)
+{
+    if (op < 0 || op >= QVRMOCK_OP_MAX)
+        return;
+    service().fail_error[op] = error != 0 ? error : QVR_ERROR;
+    service().fail_count[op] = count;
+}
+
+uint64_t qvrmock_call_count(QVRMOCK_OP op)
+{
+    return op >= 0 && op < QVRMOCK_OP_MAX ? service().call_counts[op].load() : 0;
+}
+
+void qvrmock_set_tracking_state(uint16_t state, uint16_t warnings)
+{
+    service().set_tracking_state(state, warnings);
+}
+
+void qvrmock_subsystem_error(QVRSERVICE_SUBSYSTEM_TYPE type, QVRSERVICE_SUBSYSTEM_ERROR_STATE state,
+                             uint64_t param)
+{
+    service().subsystem_error(type, state, param);
+}
+
+void qvrmock_set_tracking_init_ms(uint32_t ms)
+{
+    service().set_tracking_init_ms(ms);
+}
+
+void qvrmock_set_pose_rate(uint32_t hz)
+{
+    service().set_pose_rate(hz);
+}
+
+void qvrmock_set_latch_rate(uint32_t hz)
+{
+    service().set_latch_rate(hz);
+}
+
+uint64_t qvrmock_latch_updates(void)
+{
+    return service().latch_update_count();
+}
+
+void qvrmock_set_eye_rate(uint32_t hz)
+{
+    service().set_eye_rate(hz);
+}
+
+void qvrmock_set_point_cloud(uint32_t growth, uint32_t window, uint32_t max_points)
+{
+    service().set_point_cloud(growth, window, max_points);
+}
+
+void qvrmock_map_point(uint32_t id, float* xyz)
+{
+    MockService::map_point(id, xyz);
+}
+
+uint32_t qvrmock_point_clouds_held(void)
+{
+    return service().point_clouds_held();
+}
+
+void qvrmock_set_clock_drift_ppb(int32_t ppb)
+{
+    service().set_clock_drift_ppb(ppb);
+}
+
+int64_t qvrmock_tracker_android_offset(void)
+{
+    return service().tracker_android_offset();
+}
+
+} // extern "C"
@@ -0,0 +1,99 @@
+#pragma once
+
+// Control interface of the mock libqvrservice_client.so. Drivers living in
+// the same process look these up with dlsym() on the handle that
+// QVRServiceClient_Create() returned in qvrservice_client_helper_t::libHandle.
+
+#include <stdint.h>
+
+#include "qvr/inc/QVRServiceClient.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum QVRMOCK_OP {
+    QVRMOCK_OP_START_VRMODE = 0,
+    QVRMOCK_OP_STOP_VRMODE,
+    QVRMOCK_OP_PAUSE_VRMODE,
+    QVRMOCK_OP_RESUME_VRMODE,
+    QVRMOCK_OP_GET_VRMODE,
+    QVRMOCK_OP_SET_TRACKING_MODE,
+    QVRMOCK_OP_GET_HEAD_TRACKING_DATA,
+    QVRMOCK_OP_GET_HISTORICAL_HEAD_TRACKING_DATA,
+    QVRMOCK_OP_GET_FRAME_POSE,
+    QVRMOCK_OP_GET_RING_BUFFER_DESCRIPTOR,
+    QVRMOCK_OP_GET_PARAM,
+    QVRMOCK_OP_CREATE,
+    QVRMOCK_OP_ACTIVATE_PREDICTED_POSE,
+    // GetEyeTrackingData and GetEyeTrackingDataWithFlags
+    QVRMOCK_OP_GET_EYE_TRACKING_DATA,
+    QVRMOCK_OP_GET_POINT_CLOUD,
+    QVRMOCK_OP_MAX
+} QVRMOCK_OP;
+
+// name as used in QVRMOCK_LATENCY_US / QVRMOCK_FAIL, e.g. "StartVRMode"
+const char* qvrmock_op_name(QVRMOCK_OP op);
+
+// forces a transition as if another client (or the service) caused it;
+// VRMODE_STOPPED passes through VRMODE_STOPPING, VRMODE_PAUSED through
+// VRMODE_PAUSING, VRMODE_STARTED through VRMODE_STARTING
+void qvrmock_set_vrmode(QVRSERVICE_VRMODE_STATE state);
+
+// sends NOTIFICATION_DISCONNECTED, every existing client fails from then on;
+// the service comes back stopped and in TRACKING_MODE_ROTATIONAL
+void qvrmock_disconnect(void);
+
+// every call of op sleeps for us before doing its work
+void qvrmock_set_latency_us(QVRMOCK_OP op, uint32_t us);
+
+// the next count calls of op return error without side effects
+void qvrmock_fail_next(QVRMOCK_OP op, uint32_t count, int32_t error);
+
+uint64_t qvrmock_call_count(QVRMOCK_OP op);
+
+// tracking_state / tracking_warning_flags of the generated poses
+void qvrmock_set_tracking_state(uint16_t state, uint16_t warnings);
+
+// sends NOTIFICATION_SUBSYSTEM_ERROR to every registered client
+void qvrmock_subsystem_error(QVRSERVICE_SUBSYSTEM_TYPE type, QVRSERVICE_SUBSYSTEM_ERROR_STATE state,
+                             uint64_t param);
+
+// tracking_state stays UNINITIALIZED for ms after each StartVRMode
+void qvrmock_set_tracking_init_ms(uint32_t ms);
+
+// rate of the pose ring writer thread, 0 stops it; the same thread rewrites
+// the activated RING_BUFFER_PREDICTED_HEAD_POSE slots on every tick unless
+// qvrmock_set_latch_rate() hands them to a thread of their own
+void qvrmock_set_pose_rate(uint32_t hz);
+
+// rate of a dedicated thread rewriting the activated predicted slots, which
+// spins between updates so it holds rates well past the sleep granularity;
+// 0 gives the slots back to the pose ring writer
+void qvrmock_set_latch_rate(uint32_t hz);
+
+// slot rewrite passes of that thread so far
+uint64_t qvrmock_latch_updates(void);
+
+// rate of the eye pose ring writer while nobody drives it through a sync
+// ctrl, 0 stops it
+void qvrmock_set_eye_rate(uint32_t hz);
+
+// GetPointCloud() adds growth map points per cloud up to max_points and
+// returns the window newest; starts the map over
+void qvrmock_set_point_cloud(uint32_t growth, uint32_t window, uint32_t max_points);
+
+// where map point id really is, x y z in meters
+void qvrmock_map_point(uint32_t id, float* xyz);
+
+// clouds from GetPointCloud() not released yet
+uint32_t qvrmock_point_clouds_held(void);
+
+// QVRSERVICE_TRACKER_ANDROID_OFFSET_NS drifts by ppb from now on, and its
+// current true value
+void qvrmock_set_clock_drift_ppb(int32_t ppb);
+int64_t qvrmock_tracker_android_offset(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,268 @@
+#include "pose/point_cloud_map.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "holder_log.h"
+
+#define MIN_TABLE_SIZE 1024
+// voxel coordinates are packed 21 bits an axis, offset to be unsigned
+#define VOXEL_BITS 21
+#define VOXEL_MAX ((1 << VOXEL_BITS) - 1)
+
+static uint32_t hash_id(uint32_t id, uint32_t mask)
+{
+    // ids tend to be sequential; the multiply spreads them over the table
+    uint32_t h = id * 2654435761u;
+    return (h ^ (h >> 16)) & mask;
+}
+
+static uint32_t hash_key(uint64_t key, uint32_t mask)
+{
+    uint64_t h = key * 0x9e3779b97f4a7c15ull;
+    return (uint32_t) (h >> 32) & mask;
+}
+
+static uint64_t voxel_coord(float v, float inv_size)
+{
+    double c = floor((double) v * inv_size) + (1 << (VOXEL_BITS - 1));
+    if (c < 0)
+        c = 0;
+    if (c > VOXEL_MAX)
+        c = VOXEL_MAX;
+    return (uint64_t) c;
+}
+
+PointCloudMap::PointCloudMap()
+    : PointCloudMap(Config())
+{
+}
+
+PointCloudMap::PointCloudMap(const Config& config)
+    : cfg(config)
+    , table(MIN_TABLE_SIZE, 0)
+    , current_version(0)
+    , last_timestamp(0)
+{
+}
+
+uint32_t PointCloudMap::slot_locked(uint32_t id) const
+{
+    uint32_t mask = (uint32_t) table.size() - 1;
+    uint32_t slot = hash_id(id, mask);
+    while (table[slot] != 0 && ids[table[slot] - 1] != id)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+void PointCloudMap::grow_locked()
+{
+    std::vector<uint32_t> old;
+    old.swap(table);
+    table.assign(old.size() * 2, 0);
+    uint32_t mask = (uint32_t) table.size() - 1;
+    for (uint32_t v : old) {
+        if (v == 0)
+            continue;
+        uint32_t slot = hash_id(ids[v - 1], mask);
+        while (table[slot] != 0)
+            slot = (slot + 1) & mask;
+        table[slot] = v;
+    }
+}
+
+int32_t PointCloudMap::fetch(qvrservice_client_helper_t* client)
+{
+    XrPointCloudQTI* cloud = NULL;
+    int32_t res = QVRServiceClient_GetPointCloud(client, &cloud);
+    if (res != QVR_SUCCESS || cloud == NULL) {
+        __log_func(ANDROID_LOG_WARN, TAG, "point cloud: GetPointCloud failed: %d", res);
+        std::lock_guard<std::mutex> l(lock);
+        st.errors++;
+        return res != QVR_SUCCESS ? res : QVR_ERROR;
+    }
+    merge(*cloud);
+    // the service holds every cloud it handed out until it is released
+    res = QVRServiceClient_ReleasePointCloud(client, cloud);
+    if (res != QVR_SUCCESS) {
+        __log_func(ANDROID_LOG_WARN, TAG, "point cloud: ReleasePointCloud failed: %d", res);
+        std::lock_guard<std::mutex> l(lock);
+        st.errors++;
+    }
+    return QVR_SUCCESS;
+}
+
+void PointCloudMap::merge(const XrPointCloudQTI& cloud)
+{
+    uint32_t n = cloud.numPoints;
+    if (n > cloud.maxPoints) {
+        __log_func(ANDROID_LOG_WARN, TAG, "point cloud: %u points in a cloud of %u", n, cloud.maxPoints);
+        n = cloud.maxPoints;
+    }
+    float min_move2 = cfg.min_move * cfg.min_move;
+
+    std::lock_guard<std::mutex> l(lock);
+    uint64_t next = current_version + 1;
+    bool changed = false;
+    st.clouds++;
+    st.points += n;
+    last_timestamp = cloud.timestamp;
+    for (uint32_t i = 0; i < n; i++) {
+        const XrMapPointQTI& p = cloud.points[i];
+        uint32_t slot = slot_locked(p.id);
+        if (table[slot] != 0) {
+            uint32_t k = table[slot] - 1;
+            float dx = p.position.x - xs[k];
+            float dy = p.position.y - ys[k];
+            float dz = p.position.z - zs[k];
+            if (dx * dx + dy * dy + dz * dz <= min_move2)
+                continue;
+            xs[k] = p.position.x;
+            ys[k] = p.position.y;
+            zs[k] = p.position.z;
+            versions[k] = next;
+            st.moved++;
+            changed = true;
+            continue;
+        }
+        if (ids.size() >= cfg.max_points) {
+            st.dropped++;
+            continue;
+        }
+        // load factor of at most a half keeps the probes short
+        if ((ids.size() + 1) * 2 > table.size()) {
+            grow_locked();
+            slot = slot_locked(p.id);
+        }
+        table[slot] = (uint32_t) ids.size() + 1;
+        ids.push_back(p.id);
+        xs.push_back(p.position.x);
+        ys.push_back(p.position.y);
+        zs.push_back(p.position.z);
+        versions.push_back(next);
+        st.added++;
+        changed = true;
+    }
+    if (changed)
+        current_version = next;
+}
+
+void PointCloudMap::clear()
+{
+    std::lock_guard<std::mutex> l(lock);
+    ids.clear();
+    xs.clear();
+    ys.clear();
+    zs.clear();
+    versions.clear();
+    std::fill(table.begin(), table.end(), 0);
+    // versions keep going up so no consumer mistakes new points for ones it has
+    current_version++;
+}
+
+uint32_t PointCloudMap::size() const
+{
+    std::lock_guard<std::mutex> l(lock);
+    return (uint32_t) ids.size();
+}
+
+uint64_t PointCloudMap::version() const
+{
+    std::lock_guard<std::mutex> l(lock);
+    return current_version;
+}
+
+uint64_t PointCloudMap::timestamp() const
+{
+    std::lock_guard<std::mutex> l(lock);
+    return last_timestamp;
+}
+
+bool PointCloudMap::find(uint32_t id, XrVector3fQTI* position) const
+{
+    std::lock_guard<std::mutex> l(lock);
+    uint32_t v = table[slot_locked(id)];
+    if (v == 0)
+        return false;
+    if (position != NULL) {
+        position->x = xs[v - 1];
+        position->y = ys[v - 1];
+        position->z = zs[v - 1];
+    }
+    return true;
+}
+
+uint64_t PointCloudMap::export_changes(uint64_t since, std::vector<XrMapPointQTI>* out) const
+{
+    std::lock_guard<std::mutex> l(lock);
+    if (since >= current_version)
+        return current_version;
+    size_t n = ids.size();
+    for (size_t i = 0; i < n; i++) {
+        if (versions[i] <= since)
+            continue;
+        XrMapPointQTI p;
+        p.position.x = xs[i];
+        p.position.y = ys[i];
+        p.position.z = zs[i];
+        p.id = ids[i];
+        out->push_back(p);
+    }
+    return current_version;
+}
+
+uint64_t PointCloudMap::export_voxels(std::vector<XrMapPointQTI>* out) const
+{
+    std::lock_guard<std::mutex> l(lock);
+    out->clear();
+    size_t n = ids.size();
+    float inv_size = cfg.voxel_size > 0 ? 1.0f / cfg.voxel_size : 1.0f;
+
+    uint32_t size = MIN_TABLE_SIZE;
+    while (size < n * 2)
+        size <<= 1;
+    voxel_table.assign(size, 0);
+    voxels.clear();
+    uint32_t mask = size - 1;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = voxel_coord(xs[i], inv_size)
+                     | voxel_coord(ys[i], inv_size) << VOXEL_BITS
+                     | voxel_coord(zs[i], inv_size) << (2 * VOXEL_BITS);
+        uint32_t slot = hash_key(key, mask);
+        while (voxel_table[slot] != 0 && voxels[voxel_table[slot] - 1].key != key)
+            slot = (slot + 1) & mask;
+        if (voxel_table[slot] == 0) {
+            Voxel v;
+            v.key = key;
+            v.sum[0] = v.sum[1] = v.sum[2] = 0;
+            v.count = 0;
+            v.id = ids[i];
+            voxels.push_back(v);
+            voxel_table[slot] = (uint32_t) voxels.size();
+        }
+        Voxel& v = voxels[voxel_table[slot] - 1];
+        v.sum[0] += xs[i];
+        v.sum[1] += ys[i];
+        v.sum[2] += zs[i];
+        v.count++;
+        v.id = std::min(v.id, ids[i]);
+    }
+
+    out->resize(voxels.size());
+    for (size_t i = 0; i < voxels.size(); i++) {
+        const Voxel& v = voxels[i];
+        XrMapPointQTI& p = (*out)[i];
+        p.position.x = (float) (v.sum[0] / v.count);
+        p.position.y = (float) (v.sum[1] / v.count);
+        p.position.z = (float) (v.sum[2] / v.count);
+        p.id = v.id;
+    }
+    return current_version;
+}
+
+PointCloudMap::Stats PointCloudMap::stats() const
+{
+    std::lock_guard<std::mutex> l(lock);
+    return st;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include "qvr/inc/QVRServiceClient.h"
+
+// The tracker's map points gathered from successive
+// QVRServiceClient_GetPointCloud() clouds, which each hold only the points
+// the tracker currently sees. Points merge by XrMapPointQTI::id: new ids
+// are added, known ones take the newer position when it moved by more than
+// min_move, so refinements in the noise don't count as changes.
+//
+// Positions are kept as separate x, y and z arrays in the order points came,
+// found by id through an open addressing table. Consumers keep their copy
+// of the map current with export_changes(), which hands out only the points
+// added or moved since the version they had, or take a voxel grid
+// downsampled map from export_voxels(). Thread safe.
+class PointCloudMap {
+public:
+    struct Config {
+        // meters a known point has to move to take the new position
+        float min_move = 0.001f;
+        // edge of the export_voxels() voxels, meters
+        float voxel_size = 0.05f;
+        // points kept; new ids past it are dropped
+        uint32_t max_points = 1u << 20;
+    };
+
+    struct Stats {
+        uint64_t clouds = 0;
+        uint64_t points = 0;
+        uint64_t added = 0;
+        uint64_t moved = 0;
+        // new ids past max_points
+        uint64_t dropped = 0;
+        // GetPointCloud() / ReleasePointCloud() failures
+        uint64_t errors = 0;
+    };
+
+    PointCloudMap();
+    explicit PointCloudMap(const Config& config);
+
+    PointCloudMap(const PointCloudMap&) = delete;
+    PointCloudMap& operator=(const PointCloudMap&) = delete;
+
+    const Config& config() const { return cfg; }
+
+    // GetPointCloud(), merge() and ReleasePointCloud(); QVR_SUCCESS or the
+    // error of GetPointCloud()
+    int32_t fetch(qvrservice_client_helper_t* client);
+    void merge(const XrPointCloudQTI& cloud);
+    // drops every point; consumers start over from export_changes(0)
+    void clear();
+
+    uint32_t size() const;
+    // goes up with every merge() that added or moved points
+    uint64_t version() const;
+    // of the last cloud merged
+    uint64_t timestamp() const;
+    bool find(uint32_t id, XrVector3fQTI* position) const;
+
+    // Appends the points added or moved after version since, all of them
+    // for 0, and returns the version they bring the consumer to
+    uint64_t export_changes(uint64_t since, std::vector<XrMapPointQTI>* out) const;
+    // Replaces out with a point per occupied voxel at the mean of the
+    // points in it, with the lowest of their ids; returns the version
+    uint64_t export_voxels(std::vector<XrMapPointQTI>* out) const;
+
+    Stats stats() const;
+
+private:
+    struct Voxel {
+        uint64_t key;
+        double sum[3];
+        uint32_t count;
+        uint32_t id;
+    };
+
+    // table slot of id, or of the empty slot it would go in
+    uint32_t slot_locked(uint32_t id) const;
+    void grow_locked();
+
+    Config cfg;
+    mutable std::mutex lock;
+    std::vector<uint32_t> ids;
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<float> zs;
+    // version of the merge that last added or moved each point
+    std::vector<uint64_t> versions;
+    // index of the point + 1, 0 for an empty slot; a power of two in size
+    std::vector<uint32_t> table;
+    uint64_t current_version;
+    uint64_t last_timestamp;
+    Stats st;
+    // export_voxels() scratch, kept for its capacity
+    mutable std::vector<Voxel> voxels;
+    mutable std::vector<uint32_t> voxel_table;
+};
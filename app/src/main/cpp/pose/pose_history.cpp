@@ -0,0 +1,180 @@
+#include "pose/pose_history.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "holder_log.h"
+
+#define MAX_LOOKUP_ATTEMPTS 4
+// below this angle slerp weights lose precision, nlerp is exact enough
+#define SLERP_DOT_THRESHOLD 0.9995f
+
+static uint32_t round_up_pow2(uint32_t v)
+{
+    uint32_t p = 2;
+    while (p < v && p < (1u << 30))
+        p <<= 1;
+    return p;
+}
+
+static void interpolate(const HistoryPose& a, const HistoryPose& b, float t, HistoryPose* out)
+{
+    float dot = 0;
+    for (int i = 0; i < 4; i++)
+        dot += a.rotation[i] * b.rotation[i];
+    // q and -q are the same rotation, take the short way round
+    float sign = dot < 0 ? -1.0f : 1.0f;
+    dot *= sign;
+
+    float wa, wb;
+    if (dot > SLERP_DOT_THRESHOLD) {
+        wa = 1.0f - t;
+        wb = t;
+    } else {
+        float theta = acosf(dot);
+        float inv_sin = 1.0f / sinf(theta);
+        wa = sinf((1.0f - t) * theta) * inv_sin;
+        wb = sinf(t * theta) * inv_sin;
+    }
+    wb *= sign;
+
+    float norm = 0;
+    for (int i = 0; i < 4; i++) {
+        out->rotation[i] = wa * a.rotation[i] + wb * b.rotation[i];
+        norm += out->rotation[i] * out->rotation[i];
+    }
+    norm = 1.0f / sqrtf(norm);
+    for (int i = 0; i < 4; i++)
+        out->rotation[i] *= norm;
+
+    for (int i = 0; i < 3; i++)
+        out->translation[i] = a.translation[i] + t * (b.translation[i] - a.translation[i]);
+
+    const HistoryPose& nearest = t < 0.5f ? a : b;
+    out->tracking_state = nearest.tracking_state;
+    out->tracking_warning_flags = nearest.tracking_warning_flags;
+}
+
+PoseHistory::PoseHistory(uint32_t cap)
+    : mask(round_up_pow2(cap) - 1)
+    , stamps(mask + 1, 0)
+    , samples(mask + 1)
+    , head(0)
+    , gap_count(0)
+{
+}
+
+void PoseHistory::clear()
+{
+    head.store(0, std::memory_order_release);
+    gap_count = 0;
+}
+
+uint64_t PoseHistory::size() const
+{
+    uint64_t h = head.load(std::memory_order_acquire);
+    return h - first_valid(h);
+}
+
+int64_t PoseHistory::oldest_ts() const
+{
+    uint64_t h = head.load(std::memory_order_acquire);
+    return h == 0 ? 0 : ts_at(first_valid(h));
+}
+
+int64_t PoseHistory::newest_ts() const
+{
+    uint64_t h = head.load(std::memory_order_acquire);
+    return h == 0 ? 0 : ts_at(h - 1);
+}
+
+void PoseHistory::append(const qvrservice_head_tracking_data_t& pose)
+{
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h != 0 && (int64_t) pose.ts <= ts_at(h - 1))
+        return;
+
+    HistoryPose& s = samples[h & mask];
+    s.ts = (int64_t) pose.ts;
+    memcpy(s.rotation, pose.rotation, sizeof(s.rotation));
+    memcpy(s.translation, pose.translation, sizeof(s.translation));
+    s.tracking_state = pose.tracking_state;
+    s.tracking_warning_flags = pose.tracking_warning_flags;
+    __atomic_store_n(&stamps[h & mask], (int64_t) pose.ts, __ATOMIC_RELAXED);
+    head.store(h + 1, std::memory_order_release);
+}
+
+uint32_t PoseHistory::sync(PoseRingReader& reader)
+{
+    if (!reader.is_open())
+        return 0;
+
+    uint32_t depth = reader.capacity() - 1;
+    if (scratch.size() < depth)
+        scratch.resize(depth);
+
+    // walk back from the latest element to the newest one already copied;
+    // from one latest_index(), or a write during the walk shifts every
+    // later step and copies a pose twice
+    int64_t newest = newest_ts();
+    uint32_t latest = reader.latest_index();
+    uint32_t n = 0;
+    bool reached = newest == 0;
+    while (n < depth && reader.read_back(latest, n, &scratch[n])) {
+        if ((int64_t) scratch[n].ts <= newest) {
+            reached = true;
+            break;
+        }
+        n++;
+    }
+    if (!reached && n > 0) {
+        gap_count++;
+        __log_func(ANDROID_LOG_WARN, TAG, "pose history: ring wrapped since last sync, %lld ms lost",
+                   (long long) ((int64_t) scratch[n - 1].ts - newest) / 1000000);
+    }
+
+    for (uint32_t i = n; i > 0; i--)
+        append(scratch[i - 1]);
+    return n;
+}
+
+bool PoseHistory::lookup(int64_t ts, HistoryPose* out) const
+{
+    for (int attempt = 0; attempt < MAX_LOOKUP_ATTEMPTS; attempt++) {
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (h == 0)
+            return false;
+        uint64_t lo = first_valid(h);
+        if (ts < ts_at(lo) || ts > ts_at(h - 1))
+            return false;
+
+        // first index in [lo, h) with a timestamp > ts; the check above
+        // guarantees it is past lo
+        uint64_t base = lo;
+        uint64_t len = h - lo;
+        while (len > 1) {
+            uint64_t half = len / 2;
+            base = ts_at(base + half) <= ts ? base + half : base;
+            len -= half;
+        }
+        uint64_t i = base;
+
+        HistoryPose a = samples[i & mask];
+        HistoryPose b = i + 1 < h ? samples[(i + 1) & mask] : a;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (i < first_valid(head.load(std::memory_order_relaxed)))
+            continue;
+
+        if (a.ts == ts || b.ts == a.ts) {
+            *out = a;
+            return true;
+        }
+        if (b.ts - a.ts > MAX_INTERP_GAP_NS)
+            return false;
+
+        interpolate(a, b, (float) ((double) (ts - a.ts) / (double) (b.ts - a.ts)), out);
+        out->ts = ts;
+        return true;
+    }
+    return false;
+}
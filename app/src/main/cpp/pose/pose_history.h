@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "pose/pose_ring_reader.h"
+
+struct HistoryPose {
+    int64_t ts;
+    float rotation[4];    // x, y, z, w
+    float translation[3];
+    uint16_t tracking_state;
+    uint16_t tracking_warning_flags;
+};
+
+// Process-owned pose history, several seconds deep where the service ring
+// only guarantees ~80 ms. sync() copies whatever the ring gained since the
+// last call, so it has to run more often than the ring wraps (every 40 ms is
+// plenty). Lookups binary-search a dense timestamp array and interpolate
+// between the neighbouring samples.
+//
+// One thread calls sync(), any number may call lookup(): a reader that was
+// lapped by the writer while searching retries instead of returning a mix.
+class PoseHistory {
+public:
+    // ~8 s at the 1 kHz pose rate
+    static const uint32_t DEFAULT_CAPACITY = 8192;
+    // lookups don't interpolate across tracking dropouts longer than this
+    static const int64_t MAX_INTERP_GAP_NS = 50000000LL;
+
+    explicit PoseHistory(uint32_t capacity = DEFAULT_CAPACITY);
+
+    // number of samples appended
+    uint32_t sync(PoseRingReader& reader);
+    void append(const qvrservice_head_tracking_data_t& pose);
+    void clear();
+
+    // Pose at ts (QTimer ns), slerp/lerp between the samples around it.
+    // false when ts is outside [oldest_ts(), newest_ts()] or falls in a gap.
+    bool lookup(int64_t ts, HistoryPose* out) const;
+
+    int64_t oldest_ts() const;
+    int64_t newest_ts() const;
+    uint32_t capacity() const { return mask + 1; }
+    uint64_t size() const;
+
+    // times sync() found the ring had wrapped past the last copied sample
+    uint64_t gaps() const { return gap_count; }
+
+private:
+    int64_t ts_at(uint64_t i) const { return __atomic_load_n(&stamps[i & mask], __ATOMIC_RELAXED); }
+    uint64_t first_valid(uint64_t head) const { return head > mask ? head - mask : 0; }
+
+    uint32_t mask;
+    std::vector<int64_t> stamps;
+    std::vector<HistoryPose> samples;
+    std::atomic<uint64_t> head;
+    std::vector<qvrservice_head_tracking_data_t> scratch;
+    uint64_t gap_count;
+};
@@ -0,0 +1,455 @@
+#include "pose/pose_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "holder_log.h"
+
+// tag + channel + eight 10 byte varints
+#define MAX_RECORD_SIZE 82
+#define HEADER_SIZE sizeof(PoseLogBlockHeader)
+// drops noticed by the writer itself, as opposed to a recorder channel
+#define CHANNEL_WRITER POSE_LOG_CHANNEL_MAX
+
+static_assert(sizeof(PoseLogBlockHeader) == 32, "block header layout is part of the file format");
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t) ((v >> 1) ^ (~(v & 1) + 1));
+}
+
+static inline uint8_t* put_varint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+    return p;
+}
+
+static inline bool get_varint(const uint8_t** p, const uint8_t* end, uint64_t* v)
+{
+    uint64_t result = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        uint8_t b = *(*p)++;
+        result |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PoseLogChannel::reset()
+{
+    memset(prev, 0, sizeof(prev));
+    memset(prev_delta, 0, sizeof(prev_delta));
+}
+
+PoseLogWriter::PoseLogWriter()
+    : fd(-1)
+    , direct(false)
+    , blocks(NULL)
+    , current(-1)
+    , used(0)
+    , current_records(0)
+    , sequence(0)
+    , queue_head(0)
+    , queue_len(0)
+    , free_len(0)
+    , stopping(false)
+    , record_total(0)
+    , dropped_total(0)
+    , pending_drops(0)
+    , written_total(0)
+    , write_failed(false)
+{
+}
+
+PoseLogWriter::~PoseLogWriter()
+{
+    close();
+}
+
+bool PoseLogWriter::open(const char* path)
+{
+    if (fd >= 0)
+        return false;
+
+    direct = true;
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL) {
+        // tmpfs and some fuse mounts refuse O_DIRECT
+        direct = false;
+        fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "pose log: open %s failed: %s", path, strerror(errno));
+        return false;
+    }
+
+    void* mem = NULL;
+    if (posix_memalign(&mem, 4096, (size_t) BLOCK_COUNT * POSE_LOG_BLOCK_SIZE) != 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    blocks = (uint8_t*) mem;
+    memset(blocks, 0, (size_t) BLOCK_COUNT * POSE_LOG_BLOCK_SIZE);
+
+    for (int i = 0; i < BLOCK_COUNT; i++)
+        free_list[i] = BLOCK_COUNT - 1 - i;
+    free_len = BLOCK_COUNT;
+    queue_head = queue_len = 0;
+    stopping = false;
+    write_failed = false;
+    current = -1;
+    sequence = 0;
+
+    writer = std::thread(&PoseLogWriter::writer_loop, this);
+    return true;
+}
+
+void PoseLogWriter::close()
+{
+    if (fd < 0)
+        return;
+
+    flush();
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+    }
+    cond.notify_all();
+    writer.join();
+
+    ::close(fd);
+    fd = -1;
+    free(blocks);
+    blocks = NULL;
+    current = -1;
+}
+
+bool PoseLogWriter::acquire_block()
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (free_len == 0)
+            return false;
+        current = free_list[--free_len];
+    }
+    used = HEADER_SIZE;
+    current_records = 0;
+    for (PoseLogChannel& c : channels)
+        c.reset();
+
+    if (pending_drops != 0) {
+        uint8_t* p = blocks + (size_t) current * POSE_LOG_BLOCK_SIZE + used;
+        *p++ = POSE_LOG_TAG_DROPPED;
+        *p++ = CHANNEL_WRITER;
+        p = put_varint(p, pending_drops);
+        pending_drops = 0;
+        commit(p);
+    }
+    return true;
+}
+
+void PoseLogWriter::seal()
+{
+    uint8_t* base = blocks + (size_t) current * POSE_LOG_BLOCK_SIZE;
+    PoseLogBlockHeader header;
+    header.magic = POSE_LOG_MAGIC;
+    header.version = POSE_LOG_VERSION;
+    header.header_size = HEADER_SIZE;
+    header.used = (uint32_t) (used - HEADER_SIZE);
+    header.record_count = current_records;
+    header.sequence = sequence++;
+    header.reserved = 0;
+    memcpy(base, &header, sizeof(header));
+    memset(base + used, 0, POSE_LOG_BLOCK_SIZE - used);
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        queue[(queue_head + queue_len) % BLOCK_COUNT] = current;
+        queue_len++;
+    }
+    cond.notify_one();
+    current = -1;
+}
+
+uint8_t* PoseLogWriter::reserve(size_t max_size)
+{
+    if (fd < 0)
+        return NULL;
+    if (current >= 0 && used + max_size > POSE_LOG_BLOCK_SIZE)
+        seal();
+    if (current < 0 && !acquire_block()) {
+        dropped_total++;
+        pending_drops++;
+        return NULL;
+    }
+    return blocks + (size_t) current * POSE_LOG_BLOCK_SIZE + used;
+}
+
+void PoseLogWriter::commit(uint8_t* end)
+{
+    used = (size_t) (end - (blocks + (size_t) current * POSE_LOG_BLOCK_SIZE));
+    current_records++;
+    record_total++;
+}
+
+void PoseLogWriter::write_pose(POSE_LOG_CHANNEL channel, int64_t ts, const float rotation[4],
+                               const float translation[3])
+{
+    uint8_t* p = reserve(MAX_RECORD_SIZE);
+    if (p == NULL)
+        return;
+
+    int64_t values[PoseLogChannel::FIELDS];
+    values[0] = ts;
+    for (int i = 0; i < 4; i++)
+        values[1 + i] = llrint(rotation[i] * POSE_LOG_ROTATION_SCALE);
+    for (int i = 0; i < 3; i++)
+        values[5 + i] = llrint(translation[i] * POSE_LOG_TRANSLATION_SCALE);
+
+    *p++ = channel == POSE_LOG_CHANNEL_HEAD ? POSE_LOG_TAG_HEAD_POSE : POSE_LOG_TAG_FRAME_POSE;
+    PoseLogChannel& c = channels[channel];
+    for (int i = 0; i < PoseLogChannel::FIELDS; i++) {
+        // wrapping arithmetic, the decoder wraps the same way
+        int64_t delta = (int64_t) ((uint64_t) values[i] - (uint64_t) c.prev[i]);
+        p = put_varint(p, zigzag((int64_t) ((uint64_t) delta - (uint64_t) c.prev_delta[i])));
+        c.prev[i] = values[i];
+        c.prev_delta[i] = delta;
+    }
+    commit(p);
+}
+
+void PoseLogWriter::write_tracking(POSE_LOG_CHANNEL channel, int64_t ts, uint16_t state, uint16_t warnings,
+                                   float pose_quality)
+{
+    uint8_t* p = reserve(MAX_RECORD_SIZE);
+    if (p == NULL)
+        return;
+
+    *p++ = POSE_LOG_TAG_TRACKING;
+    *p++ = (uint8_t) channel;
+    p = put_varint(p, (uint64_t) ts);
+    p = put_varint(p, state);
+    p = put_varint(p, warnings);
+    p = put_varint(p, (uint64_t) lrintf(fmaxf(pose_quality, 0.0f) * 1000.0f));
+    commit(p);
+}
+
+void PoseLogWriter::write_dropped(POSE_LOG_CHANNEL channel, uint64_t count)
+{
+    uint8_t* p = reserve(MAX_RECORD_SIZE);
+    if (p == NULL)
+        return;
+
+    *p++ = POSE_LOG_TAG_DROPPED;
+    *p++ = (uint8_t) channel;
+    p = put_varint(p, count);
+    commit(p);
+}
+
+void PoseLogWriter::flush()
+{
+    if (current >= 0 && current_records > 0)
+        seal();
+}
+
+void PoseLogWriter::writer_loop()
+{
+    while (true) {
+        int block;
+        {
+            std::unique_lock<std::mutex> l(lock);
+            cond.wait(l, [this]() { return queue_len > 0 || stopping; });
+            if (queue_len == 0)
+                break;
+            block = queue[queue_head];
+            queue_head = (queue_head + 1) % BLOCK_COUNT;
+            queue_len--;
+        }
+
+        const uint8_t* data = blocks + (size_t) block * POSE_LOG_BLOCK_SIZE;
+        size_t left = POSE_LOG_BLOCK_SIZE;
+        while (left > 0 && !write_failed) {
+            ssize_t n = ::write(fd, data, left);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                __log_func(ANDROID_LOG_ERROR, TAG, "pose log: write failed: %s", strerror(errno));
+                write_failed = true;
+                break;
+            }
+            data += n;
+            left -= (size_t) n;
+        }
+        if (!write_failed)
+            written_total.fetch_add(POSE_LOG_BLOCK_SIZE, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> l(lock);
+        free_list[free_len++] = block;
+    }
+}
+
+PoseLogReader::PoseLogReader()
+    : fd(-1)
+    , block(NULL)
+    , pos(NULL)
+    , end(NULL)
+    , block_count(0)
+    , bad_block_count(0)
+{
+}
+
+PoseLogReader::~PoseLogReader()
+{
+    close();
+}
+
+bool PoseLogReader::open(const char* path)
+{
+    close();
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    block = (uint8_t*) malloc(POSE_LOG_BLOCK_SIZE);
+    pos = end = NULL;
+    block_count = bad_block_count = 0;
+    return block != NULL;
+}
+
+void PoseLogReader::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    free(block);
+    block = NULL;
+}
+
+bool PoseLogReader::load_block()
+{
+    while (fd >= 0) {
+        size_t got = 0;
+        while (got < POSE_LOG_BLOCK_SIZE) {
+            ssize_t n = ::read(fd, block + got, POSE_LOG_BLOCK_SIZE - got);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            got += (size_t) n;
+        }
+        if (got < POSE_LOG_BLOCK_SIZE) {
+            if (got != 0)
+                bad_block_count++;
+            return false;
+        }
+
+        PoseLogBlockHeader header;
+        memcpy(&header, block, sizeof(header));
+        if (header.magic != POSE_LOG_MAGIC || header.version != POSE_LOG_VERSION
+                || header.header_size != HEADER_SIZE || header.used > POSE_LOG_BLOCK_SIZE - HEADER_SIZE) {
+            bad_block_count++;
+            continue;
+        }
+
+        block_count++;
+        pos = block + HEADER_SIZE;
+        end = pos + header.used;
+        for (PoseLogChannel& c : channels)
+            c.reset();
+        return true;
+    }
+    return false;
+}
+
+bool PoseLogReader::decode_pose(uint8_t tag, PoseLogRecord* out)
+{
+    int channel = tag == POSE_LOG_TAG_HEAD_POSE ? POSE_LOG_CHANNEL_HEAD : POSE_LOG_CHANNEL_FRAME;
+    PoseLogChannel& c = channels[channel];
+    int64_t values[PoseLogChannel::FIELDS];
+    for (int i = 0; i < PoseLogChannel::FIELDS; i++) {
+        uint64_t v;
+        if (!get_varint(&pos, end, &v))
+            return false;
+        int64_t delta = (int64_t) ((uint64_t) c.prev_delta[i] + (uint64_t) unzigzag(v));
+        values[i] = (int64_t) ((uint64_t) c.prev[i] + (uint64_t) delta);
+        c.prev[i] = values[i];
+        c.prev_delta[i] = delta;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->tag = tag;
+    out->channel = (uint8_t) channel;
+    out->ts = values[0];
+    for (int i = 0; i < 4; i++)
+        out->rotation[i] = (float) (values[1 + i] / POSE_LOG_ROTATION_SCALE);
+    for (int i = 0; i < 3; i++)
+        out->translation[i] = (float) (values[5 + i] / POSE_LOG_TRANSLATION_SCALE);
+    return true;
+}
+
+bool PoseLogReader::next(PoseLogRecord* out)
+{
+    while (true) {
+        if (pos >= end && !load_block())
+            return false;
+
+        uint8_t tag = *pos++;
+        bool ok = false;
+        uint64_t v[4];
+        switch (tag) {
+            case POSE_LOG_TAG_HEAD_POSE:
+            case POSE_LOG_TAG_FRAME_POSE:
+                ok = decode_pose(tag, out);
+                break;
+            case POSE_LOG_TAG_TRACKING:
+                if (pos >= end)
+                    break;
+                memset(out, 0, sizeof(*out));
+                out->channel = *pos++;
+                ok = get_varint(&pos, end, &v[0]) && get_varint(&pos, end, &v[1])
+                        && get_varint(&pos, end, &v[2]) && get_varint(&pos, end, &v[3]);
+                out->tag = tag;
+                if (ok) {
+                    out->ts = (int64_t) v[0];
+                    out->tracking_state = (uint16_t) v[1];
+                    out->tracking_warning_flags = (uint16_t) v[2];
+                    out->pose_quality = (float) v[3] / 1000.0f;
+                }
+                break;
+            case POSE_LOG_TAG_DROPPED:
+                if (pos >= end)
+                    break;
+                memset(out, 0, sizeof(*out));
+                out->channel = *pos++;
+                ok = get_varint(&pos, end, &v[0]);
+                out->tag = tag;
+                if (ok)
+                    out->dropped = v[0];
+                break;
+            default:
+                break;
+        }
+        if (ok)
+            return true;
+
+        // corrupt record, the rest of the block can't be trusted
+        bad_block_count++;
+        pos = end;
+    }
+}
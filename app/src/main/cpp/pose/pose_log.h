@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "qvr/inc/QVRServiceClient.h"
+
+// Binary pose telemetry log.
+//
+// The file is a sequence of fixed size blocks so it can be written with
+// O_DIRECT. Every block starts with a PoseLogBlockHeader and is decodable on
+// its own: the delta state of all channels resets at each block boundary, so
+// a file cut short by a crash loses at most its last block.
+//
+// Records are a tag byte followed by LEB128 varints. Poses are stored as
+// zigzag second differences (delta of delta) of
+//   ts (ns), rotation x/y/z/w * 2^30, translation x/y/z * 10^7 (0.1 um)
+// per channel, which is one or two bytes per field for smooth motion.
+// Tracking state changes and drop markers are plain varints.
+//
+// All integers are little endian, like every target this runs on.
+
+#define POSE_LOG_MAGIC 0x424c5051u // "QPLB"
+#define POSE_LOG_VERSION 1
+#define POSE_LOG_BLOCK_SIZE (16 * 1024)
+
+#define POSE_LOG_ROTATION_SCALE 1073741824.0 // 2^30
+#define POSE_LOG_TRANSLATION_SCALE 10000000.0
+
+enum POSE_LOG_TAG {
+    POSE_LOG_TAG_HEAD_POSE = 1,
+    POSE_LOG_TAG_FRAME_POSE = 2,
+    // source channel, ts, tracking_state, tracking_warning_flags, pose_quality
+    POSE_LOG_TAG_TRACKING = 3,
+    // source channel, number of samples lost before this point
+    POSE_LOG_TAG_DROPPED = 4,
+};
+
+// POSE_LOG_CHANNEL_MAX in a drop record means the writer itself ran out of
+// blocks
+enum POSE_LOG_CHANNEL {
+    POSE_LOG_CHANNEL_HEAD = 0,
+    POSE_LOG_CHANNEL_FRAME = 1,
+    POSE_LOG_CHANNEL_MAX
+};
+
+struct PoseLogBlockHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t used;           // payload bytes after the header
+    uint32_t record_count;
+    uint64_t sequence;
+    uint64_t reserved;
+};
+
+struct PoseLogRecord {
+    uint8_t tag;             // POSE_LOG_TAG
+    uint8_t channel;         // POSE_LOG_CHANNEL
+    uint16_t tracking_state;
+    uint16_t tracking_warning_flags;
+    float pose_quality;
+    int64_t ts;
+    float rotation[4];
+    float translation[3];
+    uint64_t dropped;
+};
+
+// delta-of-delta state of one pose channel
+struct PoseLogChannel {
+    static const int FIELDS = 8;
+    int64_t prev[FIELDS];
+    int64_t prev_delta[FIELDS];
+    void reset();
+};
+
+// Encodes records into preallocated blocks and hands full blocks to a writer
+// thread. Nothing is allocated after open(); when the disk falls behind and
+// every block is queued, records are dropped and counted instead of
+// blocking the caller.
+class PoseLogWriter {
+public:
+    static const int BLOCK_COUNT = 8;
+
+    PoseLogWriter();
+    ~PoseLogWriter();
+
+    bool open(const char* path);
+    // writes the partial block and waits for the writer thread
+    void close();
+    bool is_open() const { return fd >= 0; }
+
+    void write_pose(POSE_LOG_CHANNEL channel, int64_t ts, const float rotation[4], const float translation[3]);
+    void write_tracking(POSE_LOG_CHANNEL channel, int64_t ts, uint16_t state, uint16_t warnings,
+                        float pose_quality);
+    void write_dropped(POSE_LOG_CHANNEL channel, uint64_t count);
+
+    // queue the current block even if it is not full
+    void flush();
+
+    uint64_t records() const { return record_total; }
+    uint64_t dropped_records() const { return dropped_total; }
+    uint64_t bytes_written() const { return written_total.load(std::memory_order_relaxed); }
+    bool direct_io() const { return direct; }
+
+private:
+    uint8_t* reserve(size_t max_size);
+    void commit(uint8_t* end);
+    void seal();
+    bool acquire_block();
+    void writer_loop();
+
+    int fd;
+    bool direct;
+    uint8_t* blocks;
+
+    // block being filled by the caller, -1 when none is free
+    int current;
+    size_t used;
+    uint32_t current_records;
+    uint64_t sequence;
+    PoseLogChannel channels[POSE_LOG_CHANNEL_MAX];
+
+    std::mutex lock;
+    std::condition_variable cond;
+    int queue[BLOCK_COUNT];
+    int queue_head;
+    int queue_len;
+    int free_list[BLOCK_COUNT];
+    int free_len;
+    bool stopping;
+    std::thread writer;
+
+    uint64_t record_total;
+    uint64_t dropped_total;
+    // reported in a POSE_LOG_TAG_DROPPED record once a block frees up
+    uint64_t pending_drops;
+    std::atomic<uint64_t> written_total;
+    bool write_failed;
+};
+
+// Sequential decoder; blocks that fail validation (torn writes, zero fill)
+// are skipped and counted.
+class PoseLogReader {
+public:
+    PoseLogReader();
+    ~PoseLogReader();
+
+    bool open(const char* path);
+    void close();
+
+    // false at end of file
+    bool next(PoseLogRecord* out);
+
+    uint64_t blocks() const { return block_count; }
+    uint64_t bad_blocks() const { return bad_block_count; }
+
+private:
+    bool load_block();
+    bool decode_pose(uint8_t tag, PoseLogRecord* out);
+
+    int fd;
+    uint8_t* block;
+    const uint8_t* pos;
+    const uint8_t* end;
+    PoseLogChannel channels[POSE_LOG_CHANNEL_MAX];
+    uint64_t block_count;
+    uint64_t bad_block_count;
+};
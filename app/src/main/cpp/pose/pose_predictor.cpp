@@ -0,0 +1,232 @@
+#include "pose/pose_predictor.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "simd.h"
+
+#if defined(HOLDER_SIMD_SSE)
+#include <xmmintrin.h>
+#endif
+
+// cos(x) and sin(x)/x as polynomials in x^2, accurate to float precision for
+// |x| <= pi/2, i.e. up to pi of rotation inside the prediction horizon
+#define COS_C1 (-1.0f / 2)
+#define COS_C2 (1.0f / 24)
+#define COS_C3 (-1.0f / 720)
+#define COS_C4 (1.0f / 40320)
+#define SINC_C1 (-1.0f / 6)
+#define SINC_C2 (1.0f / 120)
+#define SINC_C3 (-1.0f / 5040)
+#define SINC_C4 (1.0f / 362880)
+
+PosePredictor::PosePredictor()
+    : has_pose(false)
+    , kernel(KERNEL_SIMD)
+    , base_ts(0)
+{
+    memset(q, 0, sizeof(q));
+    memset(p, 0, sizeof(p));
+    memset(c1, 0, sizeof(c1));
+    memset(c2, 0, sizeof(c2));
+    memset(c3, 0, sizeof(c3));
+    memset(c4, 0, sizeof(c4));
+    memset(v, 0, sizeof(v));
+    memset(a2, 0, sizeof(a2));
+    q[3] = 1.0f;
+}
+
+void PosePredictor::update(const qvrservice_head_tracking_data_t& pose)
+{
+    for (int i = 0; i < 4; i++)
+        q[i] = pose.rotation[i];
+    for (int i = 0; i < 3; i++) {
+        p[i] = pose.translation[i];
+        c1[i] = pose.prediction_coff_s[i];
+        c2[i] = pose.prediction_coff_b[i] / 2;
+        c3[i] = pose.prediction_coff_bdt[i] / 6;
+        c4[i] = pose.prediction_coff_bdt2[i] / 24;
+        v[i] = pose.prediction_coff_ts[i];
+        a2[i] = pose.prediction_coff_tb[i] / 2;
+    }
+    base_ts = pose.ts;
+    has_pose = true;
+}
+
+bool PosePredictor::simd_available()
+{
+#if defined(HOLDER_HAVE_SIMD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+PosePredictor::Kernel PosePredictor::active_kernel() const
+{
+    return kernel == KERNEL_SIMD && simd_available() ? KERNEL_SIMD : KERNEL_SCALAR;
+}
+
+float PosePredictor::horizon_s(int64_t target_ns) const
+{
+    int64_t dt = target_ns - (int64_t) base_ts;
+    if (dt > MAX_HORIZON_NS)
+        dt = MAX_HORIZON_NS;
+    else if (dt < -MAX_HORIZON_NS)
+        dt = -MAX_HORIZON_NS;
+    return (float) dt * 1e-9f;
+}
+
+bool PosePredictor::predict(int64_t target_ns, PosePrediction* out) const
+{
+    if (!has_pose || out == NULL)
+        return false;
+    predict_scalar(&target_ns, 1, out);
+    return true;
+}
+
+bool PosePredictor::predict_batch(const int64_t* target_ns, size_t count, PosePrediction* out) const
+{
+    if (!has_pose || target_ns == NULL || out == NULL)
+        return false;
+    if (active_kernel() == KERNEL_SIMD)
+        predict_simd(target_ns, count, out);
+    else
+        predict_scalar(target_ns, count, out);
+    return true;
+}
+
+void PosePredictor::predict_scalar(const int64_t* target_ns, size_t count, PosePrediction* out) const
+{
+    for (size_t n = 0; n < count; n++) {
+        float dt = horizon_s(target_ns[n]);
+
+        float r[3];
+        for (int i = 0; i < 3; i++)
+            r[i] = dt * (c1[i] + dt * (c2[i] + dt * (c3[i] + dt * c4[i])));
+
+        float angle = sqrtf(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+        float s = 0.5f;
+        float dw = 1.0f;
+        if (angle > 1e-6f) {
+            s = sinf(angle * 0.5f) / angle;
+            dw = cosf(angle * 0.5f);
+        }
+        float dx = r[0] * s, dy = r[1] * s, dz = r[2] * s;
+
+        PosePrediction& o = out[n];
+        o.rotation[0] = q[3] * dx + q[0] * dw + q[1] * dz - q[2] * dy;
+        o.rotation[1] = q[3] * dy - q[0] * dz + q[1] * dw + q[2] * dx;
+        o.rotation[2] = q[3] * dz + q[0] * dy - q[1] * dx + q[2] * dw;
+        o.rotation[3] = q[3] * dw - q[0] * dx - q[1] * dy - q[2] * dz;
+        for (int i = 0; i < 3; i++)
+            o.translation[i] = p[i] + dt * (v[i] + dt * a2[i]);
+        o.reserved = 0;
+    }
+}
+
+#if defined(HOLDER_HAVE_SIMD)
+
+#if defined(HOLDER_SIMD_NEON)
+typedef float32x4_t vf;
+static inline vf vf_set1(float x) { return vdupq_n_f32(x); }
+static inline vf vf_load(const float* x) { return vld1q_f32(x); }
+static inline vf vf_add(vf a, vf b) { return vaddq_f32(a, b); }
+static inline vf vf_sub(vf a, vf b) { return vsubq_f32(a, b); }
+static inline vf vf_mul(vf a, vf b) { return vmulq_f32(a, b); }
+// a + b * c
+static inline vf vf_madd(vf a, vf b, vf c) { return vmlaq_f32(a, b, c); }
+
+// x, y, z, w lanes -> four (x, y, z, w) rows
+static inline void vf_store_rows(vf x, vf y, vf z, vf w, float* r0, float* r1, float* r2, float* r3)
+{
+    float32x4x2_t xz = vzipq_f32(x, z);
+    float32x4x2_t yw = vzipq_f32(y, w);
+    float32x4x2_t lo = vzipq_f32(xz.val[0], yw.val[0]);
+    float32x4x2_t hi = vzipq_f32(xz.val[1], yw.val[1]);
+    vst1q_f32(r0, lo.val[0]);
+    vst1q_f32(r1, lo.val[1]);
+    vst1q_f32(r2, hi.val[0]);
+    vst1q_f32(r3, hi.val[1]);
+}
+#else
+typedef __m128 vf;
+static inline vf vf_set1(float x) { return _mm_set1_ps(x); }
+static inline vf vf_load(const float* x) { return _mm_loadu_ps(x); }
+static inline vf vf_add(vf a, vf b) { return _mm_add_ps(a, b); }
+static inline vf vf_sub(vf a, vf b) { return _mm_sub_ps(a, b); }
+static inline vf vf_mul(vf a, vf b) { return _mm_mul_ps(a, b); }
+static inline vf vf_madd(vf a, vf b, vf c) { return _mm_add_ps(a, _mm_mul_ps(b, c)); }
+
+static inline void vf_store_rows(vf x, vf y, vf z, vf w, float* r0, float* r1, float* r2, float* r3)
+{
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(r0, x);
+    _mm_storeu_ps(r1, y);
+    _mm_storeu_ps(r2, z);
+    _mm_storeu_ps(r3, w);
+}
+#endif
+
+// Four targets per iteration, one lane each; the base pose and coefficients
+// are broadcast. Results are transposed back into PosePrediction rows.
+void PosePredictor::predict_simd(const int64_t* target_ns, size_t count, PosePrediction* out) const
+{
+    size_t n = 0;
+    for (; n + 4 <= count; n += 4) {
+        float dts[4];
+        for (int l = 0; l < 4; l++)
+            dts[l] = horizon_s(target_ns[n + l]);
+        vf dt = vf_load(dts);
+
+        vf r[3];
+        for (int i = 0; i < 3; i++) {
+            vf t = vf_madd(vf_set1(c3[i]), dt, vf_set1(c4[i]));
+            t = vf_madd(vf_set1(c2[i]), dt, t);
+            t = vf_madd(vf_set1(c1[i]), dt, t);
+            r[i] = vf_mul(dt, t);
+        }
+
+        // half angle squared, no sqrt needed for cos(h) and sin(h)/h
+        vf h2 = vf_mul(vf_set1(0.25f),
+                       vf_madd(vf_madd(vf_mul(r[0], r[0]), r[1], r[1]), r[2], r[2]));
+        vf cosv = vf_madd(vf_set1(COS_C3), h2, vf_set1(COS_C4));
+        cosv = vf_madd(vf_set1(COS_C2), h2, cosv);
+        cosv = vf_madd(vf_set1(COS_C1), h2, cosv);
+        cosv = vf_madd(vf_set1(1.0f), h2, cosv);
+        vf sinc = vf_madd(vf_set1(SINC_C3), h2, vf_set1(SINC_C4));
+        sinc = vf_madd(vf_set1(SINC_C2), h2, sinc);
+        sinc = vf_madd(vf_set1(SINC_C1), h2, sinc);
+        sinc = vf_madd(vf_set1(1.0f), h2, sinc);
+
+        // exp(r) = (r/|r| sin(|r|/2), cos(|r|/2)) = (r * sinc/2, cos)
+        vf s = vf_mul(sinc, vf_set1(0.5f));
+        vf dx = vf_mul(r[0], s), dy = vf_mul(r[1], s), dz = vf_mul(r[2], s), dw = cosv;
+
+        vf qx = vf_set1(q[0]), qy = vf_set1(q[1]), qz = vf_set1(q[2]), qw = vf_set1(q[3]);
+        vf ox = vf_sub(vf_madd(vf_madd(vf_mul(qw, dx), qx, dw), qy, dz), vf_mul(qz, dy));
+        vf oy = vf_madd(vf_madd(vf_sub(vf_mul(qw, dy), vf_mul(qx, dz)), qy, dw), qz, dx);
+        vf oz = vf_madd(vf_sub(vf_madd(vf_mul(qw, dz), qx, dy), vf_mul(qy, dx)), qz, dw);
+        vf ow = vf_sub(vf_sub(vf_sub(vf_mul(qw, dw), vf_mul(qx, dx)), vf_mul(qy, dy)), vf_mul(qz, dz));
+
+        vf t[3];
+        for (int i = 0; i < 3; i++)
+            t[i] = vf_madd(vf_set1(p[i]), dt, vf_madd(vf_set1(v[i]), dt, vf_set1(a2[i])));
+
+        PosePrediction* o = out + n;
+        vf_store_rows(ox, oy, oz, ow, o[0].rotation, o[1].rotation, o[2].rotation, o[3].rotation);
+        // the zero lane lands in reserved
+        vf_store_rows(t[0], t[1], t[2], vf_set1(0.0f), o[0].translation, o[1].translation, o[2].translation,
+                      o[3].translation);
+    }
+    predict_scalar(target_ns + n, count - n, out + n);
+}
+
+#else
+
+void PosePredictor::predict_simd(const int64_t* target_ns, size_t count, PosePrediction* out) const
+{
+    predict_scalar(target_ns, count, out);
+}
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "qvr/inc/QVRServiceClient.h"
+
+struct PosePrediction {
+    float rotation[4];    // x, y, z, w
+    float translation[3];
+    uint32_t reserved;
+};
+
+// Forward prediction from the coefficients the tracker publishes with every
+// head pose. For dt = target - pose.ts (seconds) the body-frame rotation
+// vector and the position are taken as
+//   r(dt) = s*dt + b*dt^2/2 + bdt*dt^3/6 + bdt2*dt^4/24
+//   p(dt) = p0 + ts*dt + tb*dt^2/2
+// and the predicted orientation is q * exp(r(dt)). dt is clamped to
+// +-MAX_HORIZON_NS so a stale pose cannot be extrapolated without bound.
+class PosePredictor {
+public:
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SIMD,
+    };
+
+    static const int64_t MAX_HORIZON_NS = 100000000LL;
+
+    PosePredictor();
+
+    void update(const qvrservice_head_tracking_data_t& pose);
+    bool valid() const { return has_pose; }
+    uint64_t pose_ts() const { return base_ts; }
+
+    // KERNEL_SIMD falls back to scalar when the build has no vector unit
+    void set_kernel(Kernel k) { kernel = k; }
+    Kernel active_kernel() const;
+    static bool simd_available();
+
+    bool predict(int64_t target_ns, PosePrediction* out) const;
+
+    // count target times (QTimer ns) into out[count], four at a time on the
+    // SIMD kernel
+    bool predict_batch(const int64_t* target_ns, size_t count, PosePrediction* out) const;
+
+private:
+    void predict_scalar(const int64_t* target_ns, size_t count, PosePrediction* out) const;
+    void predict_simd(const int64_t* target_ns, size_t count, PosePrediction* out) const;
+    float horizon_s(int64_t target_ns) const;
+
+    bool has_pose;
+    Kernel kernel;
+    uint64_t base_ts;
+    float q[4];
+    float p[3];
+    // Horner form of r(dt) / dt: c1 + dt*(c2 + dt*(c3 + dt*c4))
+    float c1[3];
+    float c2[3];
+    float c3[3];
+    float c4[3];
+    // p(dt) - p0 = dt*(v + dt*a2)
+    float v[3];
+    float a2[3];
+};
@@ -0,0 +1,158 @@
+#include "pose/pose_recorder.h"
+
+#include "holder_log.h"
+
+static inline void pose_of(const qvrservice_head_tracking_data_t& p, float r[4], float t[3])
+{
+    for (int i = 0; i < 4; i++)
+        r[i] = p.rotation[i];
+    for (int i = 0; i < 3; i++)
+        t[i] = p.translation[i];
+}
+
+static inline void pose_of(const XrFramePoseQTI& p, float r[4], float t[3])
+{
+    r[0] = p.pose.orientation.x;
+    r[1] = p.pose.orientation.y;
+    r[2] = p.pose.orientation.z;
+    r[3] = p.pose.orientation.w;
+    t[0] = p.pose.position.x;
+    t[1] = p.pose.position.y;
+    t[2] = p.pose.position.z;
+}
+
+PoseRecorder::PoseRecorder(EventLoop& l)
+    : loop(l)
+    , client(NULL)
+    , timer_fd(-1)
+{
+}
+
+PoseRecorder::~PoseRecorder()
+{
+    stop();
+}
+
+bool PoseRecorder::start(qvrservice_client_helper_t* c, const char* path, int64_t interval_ns)
+{
+    if (timer_fd >= 0)
+        return false;
+    if (!writer.open(path))
+        return false;
+
+    client = c;
+    for (Stream& s : streams) {
+        s.last_ts = 0;
+        s.have_state = false;
+        s.samples = 0;
+        s.lost = 0;
+    }
+
+    timer_fd = loop.create_timer([this]() { poll(); });
+    if (timer_fd < 0 || !loop.arm_timer(timer_fd, interval_ns, interval_ns)) {
+        stop();
+        return false;
+    }
+    __log_func(ANDROID_LOG_INFO, TAG, "recording poses to %s%s", path, writer.direct_io() ? " (O_DIRECT)" : "");
+    return true;
+}
+
+void PoseRecorder::stop()
+{
+    if (timer_fd >= 0) {
+        loop.destroy_fd(timer_fd);
+        timer_fd = -1;
+        // whatever arrived since the last tick
+        poll();
+    }
+    for (Stream& s : streams)
+        s.reader.close();
+    writer.close();
+}
+
+void PoseRecorder::set_client(qvrservice_client_helper_t* c)
+{
+    for (Stream& s : streams)
+        s.reader.close();
+    client = c;
+}
+
+void PoseRecorder::poll()
+{
+    if (client == NULL)
+        return;
+
+    // the rings only exist once the service has them, keep trying
+    Stream& head = streams[POSE_LOG_CHANNEL_HEAD];
+    Stream& frame = streams[POSE_LOG_CHANNEL_FRAME];
+    if (!head.reader.is_open() && head.reader.open(client, RING_BUFFER_POSE) == QVR_SUCCESS)
+        head_scratch.resize(head.reader.capacity());
+    if (!frame.reader.is_open() && frame.reader.open(client, RING_BUFFER_FRAME_POSE) == QVR_SUCCESS)
+        frame_scratch.resize(frame.reader.capacity());
+
+    if (head.reader.is_open())
+        drain(POSE_LOG_CHANNEL_HEAD, head_scratch);
+    if (frame.reader.is_open())
+        drain(POSE_LOG_CHANNEL_FRAME, frame_scratch);
+}
+
+template <typename T>
+void PoseRecorder::record(POSE_LOG_CHANNEL channel, const T& sample)
+{
+    Stream& s = streams[channel];
+    float r[4], t[3];
+    pose_of(sample, r, t);
+    writer.write_pose(channel, (int64_t) sample.ts, r, t);
+
+    if (!s.have_state || sample.tracking_state != s.tracking_state
+            || sample.tracking_warning_flags != s.tracking_warning_flags
+            || sample.pose_quality != s.pose_quality) {
+        writer.write_tracking(channel, (int64_t) sample.ts, sample.tracking_state,
+                              sample.tracking_warning_flags, sample.pose_quality);
+        s.tracking_state = sample.tracking_state;
+        s.tracking_warning_flags = sample.tracking_warning_flags;
+        s.pose_quality = sample.pose_quality;
+        s.have_state = true;
+    }
+    s.last_ts = (int64_t) sample.ts;
+    s.samples++;
+}
+
+// Walks back from the newest element to the last one recorded, then writes
+// the new ones oldest first.
+template <typename T>
+void PoseRecorder::drain(POSE_LOG_CHANNEL channel, std::vector<T>& scratch)
+{
+    Stream& s = streams[channel];
+    uint32_t depth = (uint32_t) scratch.size() - 1;
+    uint32_t n = 0;
+    bool reached = s.last_ts == 0;
+    // one snapshot, or the writer moving on mid-walk shifts the elements
+    // under it and the same sample comes up twice
+    uint32_t latest = s.reader.latest_index();
+    while (n < depth && s.reader.read_back(latest, n, &scratch[n])) {
+        if ((int64_t) scratch[n].ts <= s.last_ts) {
+            reached = true;
+            break;
+        }
+        n++;
+    }
+    if (n == 0)
+        return;
+
+    if (!reached) {
+        // estimate the hole from the rate of what did arrive
+        int64_t span = (int64_t) scratch[0].ts - (int64_t) scratch[n - 1].ts;
+        int64_t period = n > 1 ? span / (n - 1) : 0;
+        // a walk cut short by a torn or empty element may stop less than a
+        // period after last_ts, with nothing lost
+        int64_t gap = period > 0 ? ((int64_t) scratch[n - 1].ts - s.last_ts) / period - 1 : 1;
+        if (gap > 0) {
+            writer.write_dropped(channel, (uint64_t) gap);
+            s.lost += (uint64_t) gap;
+        }
+    }
+
+    for (uint32_t i = n; i > 0; i--)
+        record(channel, scratch[i - 1]);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "event_loop.h"
+#include "pose/pose_log.h"
+#include "pose/pose_ring_reader.h"
+
+// Recorder mode of the holder: drains every head pose and frame pose from
+// the shared rings into a PoseLogWriter, plus a record whenever the
+// tracking state or warnings change. Runs off a timer on the holder's event
+// loop; one wakeup per interval copies everything the rings gained, so the
+// interval only has to stay below the ring depth (~80 ms).
+class PoseRecorder {
+public:
+    static const int64_t DEFAULT_INTERVAL_NS = 20000000LL;
+
+    explicit PoseRecorder(EventLoop& loop);
+    ~PoseRecorder();
+
+    bool start(qvrservice_client_helper_t* client, const char* path,
+               int64_t interval_ns = DEFAULT_INTERVAL_NS);
+    void stop();
+    // after the holder re-created its client; the rings are reopened from
+    // the new one on the next tick, NULL pauses recording
+    void set_client(qvrservice_client_helper_t* client);
+    bool recording() const { return timer_fd >= 0; }
+
+    uint64_t head_samples() const { return streams[POSE_LOG_CHANNEL_HEAD].samples; }
+    uint64_t frame_samples() const { return streams[POSE_LOG_CHANNEL_FRAME].samples; }
+    uint64_t lost_samples() const
+    {
+        return streams[POSE_LOG_CHANNEL_HEAD].lost + streams[POSE_LOG_CHANNEL_FRAME].lost;
+    }
+    const PoseLogWriter& log() const { return writer; }
+
+private:
+    struct Stream {
+        PoseRingReader reader;
+        int64_t last_ts;
+        uint16_t tracking_state;
+        uint16_t tracking_warning_flags;
+        float pose_quality;
+        bool have_state;
+        uint64_t samples;
+        uint64_t lost;
+    };
+
+    void poll();
+    template <typename T>
+    void drain(POSE_LOG_CHANNEL channel, std::vector<T>& scratch);
+    template <typename T>
+    void record(POSE_LOG_CHANNEL channel, const T& sample);
+
+    EventLoop& loop;
+    qvrservice_client_helper_t* client;
+    int timer_fd;
+    PoseLogWriter writer;
+    Stream streams[POSE_LOG_CHANNEL_MAX];
+    std::vector<qvrservice_head_tracking_data_t> head_scratch;
+    std::vector<XrFramePoseQTI> frame_scratch;
+};
@@ -0,0 +1,91 @@
+#include "pose/pose_ring_reader.h"
+
+// a slot can only be torn if the writer lapped the whole ring during one
+// memcpy, so a second attempt practically always succeeds
+#define MAX_READ_ATTEMPTS 4
+
+PoseRingReader::PoseRingReader()
+    : id(RING_BUFFER_POSE)
+    , read_count(0)
+    , torn_count(0)
+{
+}
+
+int32_t PoseRingReader::open(qvrservice_client_helper_t* client, QVRSERVICE_RING_BUFFER_ID ring_id)
+{
+    uint32_t size;
+    if (ring_id == RING_BUFFER_POSE)
+        size = sizeof(qvrservice_head_tracking_data_t);
+    else if (ring_id == RING_BUFFER_FRAME_POSE)
+        size = sizeof(XrFramePoseQTI);
+    else
+        return QVR_INVALID_PARAM;
+
+    id = ring_id;
+    return ring.map(client, ring_id, size);
+}
+
+void PoseRingReader::close()
+{
+    ring.unmap();
+}
+
+bool PoseRingReader::read_at(uint32_t back, void* out, uint32_t size)
+{
+    if (!ring.mapped() || back >= ring.num_elements() - 1)
+        return false;
+
+    read_count++;
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        uint32_t latest = ring.index();
+        uint32_t index = latest >= back ? latest - back : latest + ring.num_elements() - back;
+        if (ring.copy(index, out, size))
+            return true;
+        torn_count++;
+    }
+    return false;
+}
+
+bool PoseRingReader::read_from(uint32_t latest, uint32_t back, void* out, uint32_t size)
+{
+    if (!ring.mapped() || back >= ring.num_elements() - 1)
+        return false;
+
+    read_count++;
+    uint32_t index = latest >= back ? latest - back : latest + ring.num_elements() - back;
+    // the slot only gets newer from here, another attempt won't help
+    if (ring.copy(index, out, size))
+        return true;
+    torn_count++;
+    return false;
+}
+
+bool PoseRingReader::read_latest(qvrservice_head_tracking_data_t* out)
+{
+    return id == RING_BUFFER_POSE && read_at(0, out, sizeof(*out)) && out->ts != 0;
+}
+
+bool PoseRingReader::read_latest(XrFramePoseQTI* out)
+{
+    return id == RING_BUFFER_FRAME_POSE && read_at(0, out, sizeof(*out)) && out->ts != 0;
+}
+
+bool PoseRingReader::read_back(uint32_t back, qvrservice_head_tracking_data_t* out)
+{
+    return id == RING_BUFFER_POSE && read_at(back, out, sizeof(*out)) && out->ts != 0;
+}
+
+bool PoseRingReader::read_back(uint32_t back, XrFramePoseQTI* out)
+{
+    return id == RING_BUFFER_FRAME_POSE && read_at(back, out, sizeof(*out)) && out->ts != 0;
+}
+
+bool PoseRingReader::read_back(uint32_t latest, uint32_t back, qvrservice_head_tracking_data_t* out)
+{
+    return id == RING_BUFFER_POSE && read_from(latest, back, out, sizeof(*out)) && out->ts != 0;
+}
+
+bool PoseRingReader::read_back(uint32_t latest, uint32_t back, XrFramePoseQTI* out)
+{
+    return id == RING_BUFFER_FRAME_POSE && read_from(latest, back, out, sizeof(*out)) && out->ts != 0;
+}
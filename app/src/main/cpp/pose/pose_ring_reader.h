@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "pose/shared_ring.h"
+
+// Reads head poses (RING_BUFFER_POSE) or frame poses (RING_BUFFER_FRAME_POSE)
+// straight out of the service's shared memory. The descriptor is fetched once
+// in open(); reads afterwards are a couple of loads and a memcpy, no calls
+// into the client library.
+class PoseRingReader {
+public:
+    PoseRingReader();
+
+    int32_t open(qvrservice_client_helper_t* client, QVRSERVICE_RING_BUFFER_ID id = RING_BUFFER_POSE);
+    void close();
+    bool is_open() const { return ring.mapped(); }
+
+    QVRSERVICE_RING_BUFFER_ID ring_id() const { return id; }
+
+    // Latest element; false if the ring is empty, of the other pose type, or
+    // every attempt raced with the writer.
+    bool read_latest(qvrservice_head_tracking_data_t* out);
+    bool read_latest(XrFramePoseQTI* out);
+
+    // Element `back` samples before the latest one, back < capacity() - 1.
+    bool read_back(uint32_t back, qvrservice_head_tracking_data_t* out);
+    bool read_back(uint32_t back, XrFramePoseQTI* out);
+    // The same, back from latest, a latest_index() taken once so a walk
+    // back doesn't shift as the writer moves on; false once it has lapped
+    // the element.
+    bool read_back(uint32_t latest, uint32_t back, qvrservice_head_tracking_data_t* out);
+    bool read_back(uint32_t latest, uint32_t back, XrFramePoseQTI* out);
+
+    uint32_t latest_index() const { return ring.index(); }
+    uint32_t capacity() const { return ring.num_elements(); }
+    const SharedRing& shared_ring() const { return ring; }
+
+    uint64_t reads() const { return read_count; }
+    uint64_t torn_reads() const { return torn_count; }
+
+private:
+    bool read_at(uint32_t back, void* out, uint32_t size);
+    bool read_from(uint32_t latest, uint32_t back, void* out, uint32_t size);
+
+    SharedRing ring;
+    QVRSERVICE_RING_BUFFER_ID id;
+    uint64_t read_count;
+    uint64_t torn_count;
+};
@@ -0,0 +1,134 @@
+#include "pose/predicted_pose_reader.h"
+
+#include <sched.h>
+#include <stddef.h>
+
+#include <atomic>
+
+#include "holder_log.h"
+
+// a slot update is a few hundred bytes, so one retry normally clears it
+#define MAX_READ_ATTEMPTS 8
+// past this many spins the writer was most likely preempted mid-update
+#define SPIN_ATTEMPTS 4
+
+static inline void backoff(int attempt)
+{
+    if (attempt >= SPIN_ATTEMPTS) {
+        sched_yield();
+        return;
+    }
+#if defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+    asm volatile("pause" ::: "memory");
+#endif
+}
+
+// word-wise relaxed loads: racing with the writer is expected, the sequence
+// check decides whether the result is kept
+static inline void copy_words(uint64_t* dst, const uint64_t* src, size_t words)
+{
+    for (size_t i = 0; i < words; i++)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+// Seqlock copy of one slot.
+template <size_t Offset, size_t Size>
+static inline bool seq_copy(const uint8_t* slot, uint8_t* out)
+{
+    typedef qvrservice_predicted_head_tracking_data_t slot_t;
+    static_assert(Offset % 8 == 0 && Size % 8 == 0, "slot copy must be 8 byte granular");
+
+    const uint64_t* start = (const uint64_t*) (slot + offsetof(slot_t, start));
+    const uint64_t* end = (const uint64_t*) (slot + offsetof(slot_t, end));
+
+    uint64_t e = __atomic_load_n(end, __ATOMIC_ACQUIRE);
+    copy_words((uint64_t*) (out + Offset), (const uint64_t*) (slot + Offset), Size / 8);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t s = __atomic_load_n(start, __ATOMIC_RELAXED);
+
+    ((slot_t*) out)->start = s;
+    ((slot_t*) out)->end = e;
+    return s == e;
+}
+
+PredictedPoseReader::PredictedPoseReader()
+    : client(NULL)
+    , read_count(0)
+    , retry_count(0)
+    , torn_count(0)
+{
+}
+
+int32_t PredictedPoseReader::open(qvrservice_client_helper_t* c)
+{
+    client = c;
+    return ring.map(client, RING_BUFFER_PREDICTED_HEAD_POSE,
+                    sizeof(qvrservice_predicted_head_tracking_data_t));
+}
+
+void PredictedPoseReader::close()
+{
+    ring.unmap();
+    client = NULL;
+}
+
+int32_t PredictedPoseReader::activate(int16_t* element_id, int64_t target_ns)
+{
+    if (element_id == NULL)
+        return QVR_INVALID_PARAM;
+
+    int32_t res = QVRServiceClient_ActivatePredictedHeadTrackingPoseElement(client, element_id, target_ns);
+    if (res != QVR_SUCCESS)
+        __log_func(ANDROID_LOG_ERROR, TAG, "activate predicted pose element failed: %d", res);
+    return res;
+}
+
+bool PredictedPoseReader::read(int16_t element_id, qvrservice_predicted_head_tracking_data_t* out)
+{
+    typedef qvrservice_predicted_head_tracking_data_t slot_t;
+    const size_t body = offsetof(slot_t, prediction_target_ns);
+
+    if (!ring.mapped() || element_id < 0 || (uint32_t) element_id >= ring.num_elements())
+        return false;
+
+    const uint8_t* slot = ring.element((uint32_t) element_id);
+    read_count++;
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        if (seq_copy<body, offsetof(slot_t, end) - body>(slot, (uint8_t*) out))
+            return true;
+        retry_count++;
+        backoff(attempt);
+    }
+    torn_count++;
+    return false;
+}
+
+bool PredictedPoseReader::read_pose(int16_t element_id, float mat[16], uint64_t* update_ts)
+{
+    typedef qvrservice_predicted_head_tracking_data_t slot_t;
+    // last_update_ts_ns up to the end of curPredictedPoseMat44F
+    const size_t first = offsetof(slot_t, last_update_ts_ns);
+    const size_t last = offsetof(slot_t, curPredictedPoseMat44F) + sizeof(float) * 16;
+
+    if (!ring.mapped() || element_id < 0 || (uint32_t) element_id >= ring.num_elements())
+        return false;
+
+    const uint8_t* slot = ring.element((uint32_t) element_id);
+    slot_t copy;
+    read_count++;
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        if (seq_copy<first, last - first>(slot, (uint8_t*) &copy)) {
+            for (int i = 0; i < 16; i++)
+                mat[i] = copy.curPredictedPoseMat44F[i];
+            if (update_ts != NULL)
+                *update_ts = copy.last_update_ts_ns;
+            return true;
+        }
+        retry_count++;
+        backoff(attempt);
+    }
+    torn_count++;
+    return false;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "pose/shared_ring.h"
+
+// Late-latching reader for RING_BUFFER_PREDICTED_HEAD_POSE. The tracker keeps
+// rewriting an activated slot with the pose predicted for its target time;
+// readers take a consistent copy by treating the start/end words as a
+// sequence lock (end is loaded before the copy, start after it).
+class PredictedPoseReader {
+public:
+    PredictedPoseReader();
+
+    int32_t open(qvrservice_client_helper_t* client);
+    void close();
+    bool is_open() const { return ring.mapped(); }
+
+    // *element_id == -1 activates a new slot and returns its id, otherwise
+    // only the target of that slot is moved. target_ns is QTimer time.
+    int32_t activate(int16_t* element_id, int64_t target_ns);
+
+    // Consistent copy of a slot; false when the id is out of range or every
+    // attempt within the retry budget overlapped a write.
+    bool read(int16_t element_id, qvrservice_predicted_head_tracking_data_t* out);
+
+    // Only the current predicted pose, row-major 4x4.
+    bool read_pose(int16_t element_id, float mat[16], uint64_t* update_ts = NULL);
+
+    uint64_t reads() const { return read_count; }
+    uint64_t retries() const { return retry_count; }
+    uint64_t torn_reads() const { return torn_count; }
+
+private:
+    qvrservice_client_helper_t* client;
+    SharedRing ring;
+    uint64_t read_count;
+    uint64_t retry_count;
+    uint64_t torn_count;
+};
@@ -0,0 +1,77 @@
+#include "pose/shared_ring.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "holder_log.h"
+
+SharedRing::SharedRing()
+    : desc()
+    , base(NULL)
+    , index_ptr(NULL)
+    , ring(NULL)
+{
+    desc.fd = -1;
+}
+
+SharedRing::~SharedRing()
+{
+    unmap();
+}
+
+int32_t SharedRing::map(qvrservice_client_helper_t* client, QVRSERVICE_RING_BUFFER_ID id,
+                        uint32_t min_element_size, bool writable)
+{
+    unmap();
+
+    int32_t res = QVRServiceClient_GetRingBufferDescriptor(client, id, &desc);
+    if (res != QVR_SUCCESS) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "get ring buffer %d descriptor failed: %d", id, res);
+        desc.fd = -1;
+        return res;
+    }
+
+    if (desc.element_size < min_element_size || desc.num_elements < 2 ||
+        desc.index_offset + sizeof(uint32_t) > desc.size ||
+        desc.ring_offset + (uint64_t) desc.element_size * desc.num_elements > desc.size) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "ring buffer %d layout mismatch: size %u elem %u x %u",
+                   id, desc.size, desc.element_size, desc.num_elements);
+        unmap();
+        return QVR_ERROR;
+    }
+
+    int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+    void* addr = mmap(NULL, desc.size, prot, MAP_SHARED, desc.fd, 0);
+    if (addr == MAP_FAILED) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "mmap ring buffer %d failed", id);
+        unmap();
+        return QVR_ERROR;
+    }
+
+    base = (uint8_t*) addr;
+    index_ptr = (uint32_t*) (base + desc.index_offset);
+    ring = base + desc.ring_offset;
+    return QVR_SUCCESS;
+}
+
+void SharedRing::unmap()
+{
+    if (base != NULL)
+        munmap(base, desc.size);
+    if (desc.fd >= 0)
+        close(desc.fd);
+
+    base = NULL;
+    index_ptr = NULL;
+    ring = NULL;
+    desc.fd = -1;
+}
+
+bool SharedRing::copy(uint32_t index, void* out, uint32_t size) const
+{
+    memcpy(out, element(index), size < desc.element_size ? size : desc.element_size);
+    // order the copy before the index re-check
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !overrun(index, this->index());
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "qvr/inc/QVRServiceClient.h"
+
+// Read-only mapping of one of the qvrservice shared memory rings described by
+// QVRServiceClient_GetRingBufferDescriptor(). The service publishes the slot
+// of the latest element as a 4-byte index at index_offset.
+class SharedRing {
+public:
+    SharedRing();
+    ~SharedRing();
+
+    SharedRing(const SharedRing&) = delete;
+    SharedRing& operator=(const SharedRing&) = delete;
+
+    // min_element_size guards against a service built with a different
+    // struct layout
+    int32_t map(qvrservice_client_helper_t* client, QVRSERVICE_RING_BUFFER_ID id,
+                uint32_t min_element_size, bool writable = false);
+    void unmap();
+
+    bool mapped() const { return base != NULL; }
+    uint32_t element_size() const { return desc.element_size; }
+    uint32_t num_elements() const { return desc.num_elements; }
+
+    uint32_t index() const
+    {
+        return __atomic_load_n(index_ptr, __ATOMIC_ACQUIRE);
+    }
+
+    const uint8_t* element(uint32_t index) const
+    {
+        return ring + (size_t) (index % desc.num_elements) * desc.element_size;
+    }
+
+    uint8_t* mutable_element(uint32_t index) const
+    {
+        return (uint8_t*) element(index);
+    }
+
+    // Copies size bytes of the element at index. Returns false when the
+    // writer may have lapped the slot during the copy.
+    bool copy(uint32_t index, void* out, uint32_t size) const;
+
+    // true when the writer, now at current, may be writing the slot of index
+    bool overrun(uint32_t index, uint32_t current) const
+    {
+        uint32_t n = desc.num_elements;
+        uint32_t slots = (current % n + n - index % n) % n;
+        if (slots >= n - 1)
+            return true;
+        // monotonic counters also catch whole laps
+        return current >= index && current - index >= n - 1;
+    }
+
+private:
+    qvrservice_ring_buffer_desc_t desc;
+    uint8_t* base;
+    uint32_t* index_ptr;
+    uint8_t* ring;
+};
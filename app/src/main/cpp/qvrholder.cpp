@@ -1,61 +1,22 @@
 #include <iostream>
-#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/resource.h>
 
 #include "qvr/inc/QVRServiceClient.h"
-#include <android/log.h>
+#include "holder_log.h"
+#include "async_log.h"
+#include "event_loop.h"
+#include "vrmode_holder.h"
+#include "vrmode_broker.h"
+#include "clock_domain.h"
+#include "pose/pose_recorder.h"
+#include "camera/camera_pipeline.h"
+#include "camera/frame_share_service.h"
+#include "time_util.h"
 
-#define LOG_LIB "liblog.so"
-#define TAG "QvrHolder"
-
-// global
-typedef int (*__android_log_print_fn)(int prio, const char* tag, const char* fmt, ...);
-void* pLogDll = NULL;
-__android_log_print_fn __log_func = NULL;
-
-
-const char* status_to_string(QVRSERVICE_CLIENT_STATUS status)
-{
-    switch (status) {
-        case STATUS_DISCONNECTED:
-            return "STATUS_DISCONNECTED";
-        case STATUS_STATE_CHANGED:
-            return "STATUS_STATE_CHANGED";
-        case STATUS_SENSOR_ERROR:
-            return "STATUS_SENSOR_ERROR";
-        case STATUS_MAX:
-        default:
-            return "STATUS_MAX";
-    }
-}
-
-//void (*client_status_callback_fn)(void *pCtx,
-//                                  QVRSERVICE_CLIENT_STATUS status, uint32_t arg1, uint32_t arg2);
-// arg2 : prev vrmode state
-// arg1 : new vrmode state
-void client_status_callback (void *pCtx, QVRSERVICE_CLIENT_STATUS status, uint32_t arg1, uint32_t arg2)
-{
-    __log_func(ANDROID_LOG_VERBOSE, TAG, "client status: %s | arg1: %s | arg2: %s", status_to_string(status)
-            , QVRServiceClient_StateToName((QVRSERVICE_VRMODE_STATE) arg1)
-            , QVRServiceClient_StateToName((QVRSERVICE_VRMODE_STATE) arg2));
-}
-
-void load_log_lib()
-{
-    pLogDll = dlopen( LOG_LIB, RTLD_NOW);
-    std::cout << "log: " << pLogDll << std::endl;
-
-    __log_func = (__android_log_print_fn)dlsym(pLogDll, "__android_log_print");
-    __log_func(ANDROID_LOG_VERBOSE, TAG, "init logs");
-}
-
-void close_log_lib()
-{
-    if (pLogDll == NULL)
-        return ;
-
-    dlclose(pLogDll);
-    pLogDll = NULL;
-}
 
 void atexit_handler()
 {
@@ -74,45 +35,176 @@ void init()
     }
 }
 
-int main() {
-
-    init();
-
-    load_log_lib();
-
-    qvrservice_client_helper_t* qvr_client = QVRServiceClient_Create();
-    __log_func(ANDROID_LOG_VERBOSE, TAG, "api version: %d", qvr_client->client->api_version);
-
-    QVRSERVICE_VRMODE_STATE vrstate = QVRServiceClient_GetVRMode(qvr_client);
-    __log_func(ANDROID_LOG_VERBOSE, TAG, "vrmode state: %s", QVRServiceClient_StateToName(vrstate));
-
-    int32_t res = QVRServiceClient_StartVRMode(qvr_client);
-    vrstate = QVRServiceClient_GetVRMode(qvr_client);
-    __log_func(ANDROID_LOG_VERBOSE, TAG, "start vrmode res: %d | curr vrmode: %s", res, QVRServiceClient_StateToName(vrstate));
+void log_stats(EventLoop& loop, VrModeHolder& holder, VrModeBroker& broker, ClockDomain& clock,
+               PoseRecorder& recorder, FrameShareService& share)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    __log_func(ANDROID_LOG_INFO, TAG, "wakeups: %llu | restarts: %llu | last recovery: %.3f ms | cpu: %ld.%06ld s user, %ld.%06ld s sys"
+            , (unsigned long long) loop.wakeups()
+            , (unsigned long long) holder.restart_count()
+            , holder.last_recovery_ns() / 1000000.0
+            , (long) usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec
+            , (long) usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec);
+    __log_func(ANDROID_LOG_INFO, TAG, "health: %s | outages: %llu | time to 6dof: %.3f ms last, %.3f ms max | tracking restarts: %llu | reconnects: %llu"
+            , VrModeHolder::health_name(holder.health())
+            , (unsigned long long) holder.outage_count()
+            , holder.last_time_to_6dof_ns() / 1000000.0
+            , holder.max_time_to_6dof_ns() / 1000000.0
+            , (unsigned long long) holder.tracking_restart_count()
+            , (unsigned long long) holder.reconnect_count());
+    if (broker.running()) {
+        __log_func(ANDROID_LOG_INFO, TAG, "broker: %zu clients | %u pause leases | %u stop leases | %llu requests | %llu denied"
+                , broker.client_count()
+                , broker.pause_lease_count()
+                , broker.stop_lease_count()
+                , (unsigned long long) broker.request_count()
+                , (unsigned long long) broker.denied_count());
+        broker.log_leases();
+    }
+    if (clock.valid())
+        __log_func(ANDROID_LOG_INFO, TAG, "tracker-android offset: %lld ns | drift: %.3f ppm | residual: %lld ns | samples: %llu"
+                , (long long) clock.fit().offset_at(now_ns(CLOCK_BOOTTIME))
+                , clock.drift_ppm()
+                , (long long) clock.max_residual_ns()
+                , (unsigned long long) clock.samples());
+    if (recorder.recording())
+        __log_func(ANDROID_LOG_INFO, TAG, "recorded: %llu head | %llu frame | %llu lost | %llu records dropped | %llu KiB"
+                , (unsigned long long) recorder.head_samples()
+                , (unsigned long long) recorder.frame_samples()
+                , (unsigned long long) recorder.lost_samples()
+                , (unsigned long long) recorder.log().dropped_records()
+                , (unsigned long long) recorder.log().bytes_written() / 1024);
+    if (share.running())
+        __log_func(ANDROID_LOG_INFO, TAG, "frame share: %zu peers | %zu leases | %llu published | %llu skipped | %llu buffers sent | %llu refused"
+                , share.peer_count()
+                , share.lease_count()
+                , (unsigned long long) share.frames_published()
+                , (unsigned long long) share.frames_skipped()
+                , (unsigned long long) share.buffers_sent()
+                , (unsigned long long) share.refused_count());
+}
 
-    QVRServiceClient_SetClientStatusCallback(qvr_client, client_status_callback, NULL);
+// Attaches the comma separated cameras and shares their frames, the holder
+// reads them for every peer
+bool start_frame_share(const char* cameras, qvrcamera_client_helper_t** client, CameraPipeline& pipeline,
+                       FrameShareService& share)
+{
+    *client = QVRCameraClient_Create();
+    if (*client == NULL) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "frame share: no camera client");
+        return false;
+    }
+    std::string list(cameras);
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string name = list.substr(pos, end - pos);
+        if (!name.empty() && pipeline.attach(*client, name.c_str()) < 0)
+            __log_func(ANDROID_LOG_WARN, TAG, "frame share: attaching camera %s failed", name.c_str());
+        pos = end + 1;
+    }
+    return pipeline.device_count() > 0 && share.start() && pipeline.start();
+}
 
-    XrFramePoseQTI* framePos = new XrFramePoseQTI();
-    while (true)
-    {
-        int32_t frameRes = QVRServiceClient_GetFramePose(qvr_client, &framePos);
+// qvrholder [--record <file>] [--log-file <file>] [--sync-log] [--broker <name> | --no-broker]
+//           [--stop-uid <uid>]... [--share-cameras <name>[,<name>...]] [--share-uid <uid>]...
+int main(int argc, char** argv) {
 
-        if (frameRes < 0) {
-            __log_func(ANDROID_LOG_ERROR, TAG, "get qvr frame pos failed !!!");
-            break;
-        }
+    load_log_lib();
 
-//        __log_func(ANDROID_LOG_DEBUG, TAG, "get frame pos res: %d | pos: {%f, %f, %f}", frameRes
-//                , framePos->pose.position.x
-//                , framePos->pose.position.y
-//                , framePos->pose.position.z);
+    init();
 
-        unsigned int microseconds = 1000 * 1000; // 1 sec
-        usleep(microseconds);
+    EventLoop loop;
+    if (!loop.valid())
+        return -1;
+
+    VrModeHolder holder(loop);
+    VrModeBroker broker(loop, holder);
+    ClockDomain clock;
+    PoseRecorder recorder(loop);
+    CameraPipeline cameras;
+    FrameShareService share(loop, cameras);
+    qvrcamera_client_helper_t* camera_client = NULL;
+
+    const char* record_path = NULL;
+    const char* share_cameras = NULL;
+    const char* log_path = NULL;
+    bool sync_log = false;
+    const char* broker_name = QVRHOLDER_BROKER_NAME;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record_path = argv[++i];
+        else if (strcmp(argv[i], "--log-file") == 0 && i + 1 < argc)
+            log_path = argv[++i];
+        else if (strcmp(argv[i], "--sync-log") == 0)
+            sync_log = true;
+        else if (strcmp(argv[i], "--broker") == 0 && i + 1 < argc)
+            broker_name = argv[++i];
+        else if (strcmp(argv[i], "--no-broker") == 0)
+            broker_name = NULL;
+        else if (strcmp(argv[i], "--stop-uid") == 0 && i + 1 < argc)
+            broker.allow_stop_uid((uid_t) strtoul(argv[++i], NULL, 10));
+        else if (strcmp(argv[i], "--share-cameras") == 0 && i + 1 < argc)
+            share_cameras = argv[++i];
+        else if (strcmp(argv[i], "--share-uid") == 0 && i + 1 < argc)
+            share.allow_uid((uid_t) strtoul(argv[++i], NULL, 10));
     }
 
-    delete framePos;
-    close_log_lib();
-
-    return 0;
+    // must happen before the qvr client spawns its binder threads so they
+    // inherit the blocked mask
+    const int signals[] = { SIGINT, SIGTERM, SIGUSR1 };
+    loop.watch_signals(signals, sizeof(signals) / sizeof(signals[0]), [&](int sig) {
+        if (sig == SIGUSR1) {
+            log_stats(loop, holder, broker, clock, recorder, share);
+            return;
+        }
+        __log_func(ANDROID_LOG_INFO, TAG, "signal %d, exiting", sig);
+        loop.quit(0);
+    });
+
+    // logcat rate limiting must not stall the loop thread
+    if (!sync_log && !start_async_log(log_path))
+        __log_func(ANDROID_LOG_WARN, TAG, "async logging unavailable, logging synchronously");
+
+    // everything holding the service client follows the holder across
+    // reconnects
+    holder.set_client_listener([&](qvrservice_client_helper_t* client) {
+        clock.set_service_client(client);
+        recorder.set_client(client);
+    });
+    if (!holder.start())
+        return -1;
+
+    // without the broker the holder still works, it just never lets go
+    if (broker_name != NULL)
+        broker.start(broker_name);
+
+    clock.set_service_client(holder.client());
+    clock.start(loop);
+
+    if (record_path != NULL && !recorder.start(holder.client(), record_path))
+        return -1;
+
+    // analytics processes get the frames through the holder instead of
+    // each taking camera slots of their own
+    if (share_cameras != NULL && !start_frame_share(share_cameras, &camera_client, cameras, share))
+        __log_func(ANDROID_LOG_WARN, TAG, "frame share unavailable");
+
+    int res = loop.run();
+
+    log_stats(loop, holder, broker, clock, recorder, share);
+    share.stop();
+    cameras.close();
+    if (camera_client != NULL)
+        QVRCameraClient_Destroy(camera_client);
+    recorder.stop();
+    clock.stop();
+    broker.stop();
+    holder.stop();
+
+    return res;
 }
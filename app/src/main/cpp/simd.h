@@ -0,0 +1,20 @@
+#pragma once
+
+// Which vector unit the SIMD kernels are built for. arm64 always has NEON,
+// armeabi-v7a builds with -mfpu=neon; x86/x86_64 ABIs guarantee SSE2 (SSSE3
+// on Android). Kernels keep a scalar path for anything else.
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOLDER_SIMD_NEON 1
+#define HOLDER_SIMD_NAME "neon"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HOLDER_SIMD_SSE 1
+#define HOLDER_SIMD_NAME "sse2"
+#else
+#define HOLDER_SIMD_NAME "none"
+#endif
+
+#if defined(HOLDER_SIMD_NEON) || defined(HOLDER_SIMD_SSE)
+#define HOLDER_HAVE_SIMD 1
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t now_ns(clockid_t clock = CLOCK_MONOTONIC)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline double ns_to_ms(int64_t ns)
+{
+    return (double) ns / 1000000.0;
+}
+
+static inline void sleep_until_ns(int64_t deadline, clockid_t clock = CLOCK_MONOTONIC)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t) (deadline / 1000000000LL);
+    ts.tv_nsec = (long) (deadline % 1000000000LL);
+    while (clock_nanosleep(clock, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "time_util.h"
+
+// latency samples in ns, printed as percentiles
+class Samples {
+public:
+    explicit Samples(size_t reserve = 0) { values.reserve(reserve); }
+
+    void add(double ns) { values.push_back(ns); }
+    size_t size() const { return values.size(); }
+
+    double percentile(double p)
+    {
+        if (values.empty())
+            return 0;
+        std::sort(values.begin(), values.end());
+        size_t i = (size_t) (p / 100.0 * (double) (values.size() - 1) + 0.5);
+        return values[std::min(i, values.size() - 1)];
+    }
+
+    void report(const char* name)
+    {
+        printf("%-32s n=%-8zu p50=%10.1f ns  p99=%10.1f ns  max=%10.1f ns\n", name, values.size(),
+               percentile(50), percentile(99), percentile(100));
+    }
+
+private:
+    std::vector<double> values;
+};
+
+// per-op cost of fn averaged over batches of ops calls, for paths too cheap
+// to time one by one
+template <typename Fn>
+static inline Samples time_batches(int batches, int ops, Fn fn)
+{
+    Samples samples(batches);
+    for (int b = 0; b < batches; b++) {
+        int64_t t0 = now_ns();
+        for (int i = 0; i < ops; i++)
+            fn();
+        samples.add((double) (now_ns() - t0) / ops);
+    }
+    return samples;
+}
+
+// keeps the optimizer from dropping benchmarked work
+template <typename T>
+static inline void do_not_optimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
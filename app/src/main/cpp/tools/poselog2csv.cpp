@@ -0,0 +1,65 @@
+// Decodes a pose log written by `qvrholder --record` to CSV:
+//   poselog2csv <file> [out.csv]
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pose/pose_log.h"
+
+static const char* channel_name(uint8_t channel)
+{
+    switch (channel) {
+        case POSE_LOG_CHANNEL_HEAD: return "head";
+        case POSE_LOG_CHANNEL_FRAME: return "frame";
+        case POSE_LOG_CHANNEL_MAX: return "writer";
+        default: return "?";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file> [out.csv]\n", argv[0]);
+        return 1;
+    }
+
+    PoseLogReader reader;
+    if (!reader.open(argv[1])) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    FILE* out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "cannot create %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "type,channel,ts,qx,qy,qz,qw,tx,ty,tz,tracking_state,tracking_warning_flags,pose_quality,dropped\n");
+    PoseLogRecord r;
+    uint64_t count = 0;
+    while (reader.next(&r)) {
+        const char* ch = channel_name(r.channel);
+        switch (r.tag) {
+            case POSE_LOG_TAG_HEAD_POSE:
+            case POSE_LOG_TAG_FRAME_POSE:
+                fprintf(out, "pose,%s,%lld,%.9f,%.9f,%.9f,%.9f,%.7f,%.7f,%.7f,,,,\n", ch, (long long) r.ts,
+                        r.rotation[0], r.rotation[1], r.rotation[2], r.rotation[3],
+                        r.translation[0], r.translation[1], r.translation[2]);
+                break;
+            case POSE_LOG_TAG_TRACKING:
+                fprintf(out, "tracking,%s,%lld,,,,,,,,0x%x,0x%x,%.3f,\n", ch, (long long) r.ts,
+                        r.tracking_state, r.tracking_warning_flags, r.pose_quality);
+                break;
+            case POSE_LOG_TAG_DROPPED:
+                fprintf(out, "dropped,%s,,,,,,,,,,,,%llu\n", ch, (unsigned long long) r.dropped);
+                break;
+        }
+        count++;
+    }
+
+    if (out != stdout)
+        fclose(out);
+    fprintf(stderr, "%llu records, %llu blocks, %llu bad blocks\n", (unsigned long long) count,
+            (unsigned long long) reader.blocks(), (unsigned long long) reader.bad_blocks());
+    return 0;
+}
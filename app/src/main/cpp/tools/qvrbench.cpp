@@ -0,0 +1,2518 @@
+// Host benchmarks for the holder components, run against the mock
+// libqvrservice_client.so:
+//   LD_LIBRARY_PATH=<build dir> qvrbench <name> [options]
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "mock/qvrservice_mock.h"
+#include "mock/qvrcamera_mock.h"
+#include "tools/bench_util.h"
+#include "simd.h"
+#include "holder_log.h"
+#include "async_log.h"
+#include "event_loop.h"
+#include "vrmode_holder.h"
+#include "vrmode_broker.h"
+#include "vrmode_broker_client.h"
+#include "clock_domain.h"
+#include "pose/pose_ring_reader.h"
+#include "pose/predicted_pose_reader.h"
+#include "pose/pose_predictor.h"
+#include "pose/pose_history.h"
+#include "pose/point_cloud_map.h"
+#include "eye/eye_pose_stream.h"
+#include "eye/gaze_filter.h"
+#include "camera/camera_pipeline.h"
+#include "camera/raw_unpacker.h"
+#include "camera/yuv_ops.h"
+#include "camera/frame_views.h"
+#include "camera/partial_frame_reader.h"
+#include "camera/frame_share_service.h"
+#include "camera/frame_share_client.h"
+#include "camera/auto_exposure.h"
+#include "camera/roi_scheduler.h"
+#include "camera/camera_streams.h"
+#include "camera/lens_model.h"
+#include "camera/depth_ops.h"
+#include "camera/undistort_map.h"
+#include "camera/undistort_cache.h"
+
+#define MOCK_FN(name) ((decltype(&name)) mock_symbol(#name))
+
+static void* mock_lib = NULL;
+
+static void* mock_symbol(const char* name)
+{
+    void* sym = mock_lib != NULL ? dlsym(mock_lib, name) : NULL;
+    if (sym == NULL) {
+        fprintf(stderr, "%s not found, is the mock qvrservice client on LD_LIBRARY_PATH?\n", name);
+        exit(1);
+    }
+    return sym;
+}
+
+// holder state logs would dominate the measured paths
+static int quiet_log(int prio, const char* tag, const char* fmt, ...)
+{
+    if (prio < ANDROID_LOG_WARN)
+        return 0;
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: ", tag);
+    int res = vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    return res;
+}
+
+static int arg_int(int argc, char** argv, const char* name, int def)
+{
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0)
+            return atoi(argv[i + 1]);
+    }
+    return def;
+}
+
+// Time from an external VRMODE_STOPPED until the holder has VR mode started
+// again, through the real QVRServiceClient helpers and the holder event loop.
+static int bench_recovery(int argc, char** argv)
+{
+    int iterations = arg_int(argc, argv, "-n", 200);
+    int start_latency_us = arg_int(argc, argv, "--start-latency-us", 0);
+    int start_failures = arg_int(argc, argv, "--start-failures", 0);
+
+    EventLoop loop;
+    VrModeHolder holder(loop);
+    if (!holder.start())
+        return 1;
+    mock_lib = holder.client()->libHandle;
+
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    qvrservice_client_helper_t* observer = QVRServiceClient_Create();
+    Samples samples(iterations);
+
+    MOCK_FN(qvrmock_set_latency_us)(QVRMOCK_OP_START_VRMODE, start_latency_us);
+    for (int i = 0; i < iterations; i++) {
+        while (QVRServiceClient_GetVRMode(observer) != VRMODE_STARTED)
+            usleep(100);
+
+        if (start_failures > 0)
+            MOCK_FN(qvrmock_fail_next)(QVRMOCK_OP_START_VRMODE, start_failures, QVR_ERROR);
+
+        int64_t t0 = now_ns();
+        MOCK_FN(qvrmock_set_vrmode)(VRMODE_STOPPED);
+        while (QVRServiceClient_GetVRMode(observer) != VRMODE_STARTED)
+            ;
+        samples.add(now_ns() - t0);
+    }
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    QVRServiceClient_Destroy(observer);
+
+    samples.report("stop -> started");
+    printf("holder restarts: %llu\n", (unsigned long long) holder.restart_count());
+    return 0;
+}
+
+static qvrservice_client_helper_t* start_client()
+{
+    qvrservice_client_helper_t* client = QVRServiceClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRServiceClient_Create failed\n");
+        return NULL;
+    }
+    mock_lib = client->libHandle;
+    QVRServiceClient_StartVRMode(client);
+    // let the pose writer fill the rings
+    usleep(300 * 1000);
+    return client;
+}
+
+// GetHeadTrackingData through the client library vs. the mapped pose ring
+static int bench_pose_read(int argc, char** argv)
+{
+    int batches = arg_int(argc, argv, "-n", 200);
+    const int ops = 1000;
+
+    qvrservice_client_helper_t* client = start_client();
+    if (client == NULL)
+        return 1;
+
+    PoseRingReader reader;
+    if (reader.open(client, RING_BUFFER_POSE) != QVR_SUCCESS)
+        return 1;
+
+    qvrservice_head_tracking_data_t pose;
+    Samples api = time_batches(batches, ops, [&]() {
+        qvrservice_head_tracking_data_t* p = NULL;
+        if (QVRServiceClient_GetHeadTrackingData(client, &p) == QVR_SUCCESS)
+            pose = *p;
+        do_not_optimize(pose);
+    });
+    Samples ring = time_batches(batches, ops, [&]() {
+        reader.read_latest(&pose);
+        do_not_optimize(pose);
+    });
+
+    api.report("GetHeadTrackingData");
+    ring.report("PoseRingReader::read_latest");
+    printf("torn reads: %llu / %llu\n", (unsigned long long) reader.torn_reads(),
+           (unsigned long long) reader.reads());
+
+    reader.close();
+    QVRServiceClient_Destroy(client);
+    return 0;
+}
+
+// a consistent copy of the mock's predicted pose is a rigid transform
+static bool rigid_transform(const float m[16])
+{
+    const float eps = 1e-3f;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            float dot = m[i * 4] * m[j * 4] + m[i * 4 + 1] * m[j * 4 + 1] + m[i * 4 + 2] * m[j * 4 + 2];
+            if (fabsf(dot - (i == j ? 1.0f : 0.0f)) > eps)
+                return false;
+        }
+    }
+    return m[12] == 0.0f && m[13] == 0.0f && m[14] == 0.0f && m[15] == 1.0f;
+}
+
+// from this writer rate on the reads must have run into the writer
+#define LATE_LATCH_STRESS_HZ 10000
+
+// Late-latch reads of one predicted slot while a dedicated mock writer
+// rewrites it at --rate-hz; every copy is timed and checked for tearing.
+static int bench_late_latch(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 2);
+    int rate_hz = arg_int(argc, argv, "--rate-hz", 100000);
+
+    qvrservice_client_helper_t* client = start_client();
+    if (client == NULL)
+        return 1;
+
+    PredictedPoseReader reader;
+    if (reader.open(client) != QVR_SUCCESS)
+        return 1;
+
+    int16_t slot = -1;
+    int64_t deadline = now_ns() + (int64_t) seconds * 1000000000LL;
+    // keep the target ahead of the run so the slot stays tracked throughout
+    if (reader.activate(&slot, deadline + 1000000000LL) != QVR_SUCCESS)
+        return 1;
+    uint64_t writer_start = MOCK_FN(qvrmock_latch_updates)();
+    int64_t start = now_ns();
+    MOCK_FN(qvrmock_set_latch_rate)(rate_hz);
+
+    Samples full(1 << 20);
+    Samples pose_only(1 << 20);
+    qvrservice_predicted_head_tracking_data_t copy;
+    float mat[16];
+    uint64_t bad = 0;
+    uint64_t last_update = 0;
+    uint64_t updates_seen = 0;
+    while (now_ns() < deadline) {
+        int64_t t0 = now_ns();
+        bool ok = reader.read(slot, &copy);
+        int64_t t1 = now_ns();
+        full.add((double) (t1 - t0));
+        if (ok) {
+            if (!rigid_transform(copy.curPredictedPoseMat44F))
+                bad++;
+            if (copy.last_update_ts_ns != last_update) {
+                last_update = copy.last_update_ts_ns;
+                updates_seen++;
+            }
+        }
+
+        t0 = now_ns();
+        ok = reader.read_pose(slot, mat);
+        pose_only.add((double) (now_ns() - t0));
+        if (ok && !rigid_transform(mat))
+            bad++;
+    }
+
+    MOCK_FN(qvrmock_set_latch_rate)(0);
+    double elapsed = (double) (now_ns() - start) / 1e9;
+    uint64_t writer_updates = MOCK_FN(qvrmock_latch_updates)() - writer_start;
+    full.report("read (slot)");
+    pose_only.report("read_pose (matrix)");
+    printf("writer: %llu updates, %.0f Hz of %d requested, %llu observed\n",
+           (unsigned long long) writer_updates, writer_updates / elapsed, rate_hz,
+           (unsigned long long) updates_seen);
+    if (std::thread::hardware_concurrency() < 2)
+        printf("(one CPU: the spinning writer only runs while the reader is preempted)\n");
+    printf("retries: %llu, torn: %llu / %llu, inconsistent copies: %llu\n",
+           (unsigned long long) reader.retries(), (unsigned long long) reader.torn_reads(),
+           (unsigned long long) reader.reads(), (unsigned long long) bad);
+
+    reader.close();
+    QVRServiceClient_Destroy(client);
+    if (bad != 0)
+        return 1;
+    // a stress run that never raced the writer proved nothing about the
+    // sequence lock
+    if (rate_hz >= LATE_LATCH_STRESS_HZ && reader.retries() + reader.torn_reads() == 0) {
+        printf("FAIL: no retries or torn reads at %d Hz\n", rate_hz);
+        return 1;
+    }
+    return 0;
+}
+
+// Scalar vs SIMD prediction kernels on batches of targets spread over the
+// next 50 ms, from the latest pose in the ring.
+static int bench_predict(int argc, char** argv)
+{
+    int batches = arg_int(argc, argv, "-n", 2000);
+    int batch_size = arg_int(argc, argv, "--batch", 16);
+    if (batch_size <= 0)
+        return 1;
+
+    qvrservice_client_helper_t* client = start_client();
+    if (client == NULL)
+        return 1;
+    QVRServiceClient_SetTrackingMode(client, TRACKING_MODE_POSITIONAL);
+    usleep(50 * 1000);
+
+    PoseRingReader reader;
+    qvrservice_head_tracking_data_t pose;
+    if (reader.open(client, RING_BUFFER_POSE) != QVR_SUCCESS || !reader.read_latest(&pose))
+        return 1;
+
+    PosePredictor predictor;
+    predictor.update(pose);
+
+    std::vector<int64_t> targets(batch_size);
+    for (int i = 0; i < batch_size; i++)
+        targets[i] = (int64_t) pose.ts + 50000000LL * i / batch_size;
+    std::vector<PosePrediction> scalar(batch_size), simd(batch_size);
+
+    predictor.set_kernel(PosePredictor::KERNEL_SCALAR);
+    Samples scalar_time = time_batches(batches, 1, [&]() {
+        predictor.predict_batch(targets.data(), targets.size(), scalar.data());
+        do_not_optimize(scalar[0]);
+    });
+    predictor.set_kernel(PosePredictor::KERNEL_SIMD);
+    Samples simd_time = time_batches(batches, 1, [&]() {
+        predictor.predict_batch(targets.data(), targets.size(), simd.data());
+        do_not_optimize(simd[0]);
+    });
+
+    float max_diff = 0;
+    for (int i = 0; i < batch_size; i++) {
+        for (int k = 0; k < 4; k++)
+            max_diff = std::max(max_diff, fabsf(scalar[i].rotation[k] - simd[i].rotation[k]));
+        for (int k = 0; k < 3; k++)
+            max_diff = std::max(max_diff, fabsf(scalar[i].translation[k] - simd[i].translation[k]));
+    }
+
+    printf("batch of %d targets, simd: %s\n", batch_size,
+           PosePredictor::simd_available() ? HOLDER_SIMD_NAME : "unavailable");
+    scalar_time.report("predict_batch scalar");
+    simd_time.report("predict_batch simd");
+    printf("per pose: scalar %.1f ns, simd %.1f ns, max kernel difference %.2e\n",
+           scalar_time.percentile(50) / batch_size, simd_time.percentile(50) / batch_size, max_diff);
+
+    reader.close();
+    QVRServiceClient_Destroy(client);
+    return 0;
+}
+
+// Fills a PoseHistory for a few seconds, then times lookups spread over the
+// whole retention against GetHistoricalHeadTrackingData, which only reaches
+// back as far as the service ring.
+static int bench_history(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 3);
+    int lookups = arg_int(argc, argv, "-n", 100000);
+
+    qvrservice_client_helper_t* client = start_client();
+    if (client == NULL)
+        return 1;
+
+    PoseRingReader reader;
+    if (reader.open(client, RING_BUFFER_POSE) != QVR_SUCCESS)
+        return 1;
+
+    PoseHistory history;
+    int64_t deadline = now_ns() + (int64_t) seconds * 1000000000LL;
+    while (now_ns() < deadline) {
+        history.sync(reader);
+        usleep(20 * 1000);
+    }
+    history.sync(reader);
+
+    int64_t oldest = history.oldest_ts();
+    int64_t newest = history.newest_ts();
+    std::vector<int64_t> targets(lookups);
+    uint64_t seed = 88172645463325252ULL;
+    for (int64_t& t : targets) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        t = oldest + (int64_t) (seed % (uint64_t) (newest - oldest + 1));
+    }
+
+    HistoryPose pose;
+    size_t next = 0;
+    uint64_t misses = 0;
+    Samples local = time_batches(lookups / 100, 100, [&]() {
+        if (!history.lookup(targets[next++], &pose))
+            misses++;
+        do_not_optimize(pose);
+    });
+
+    // the service call can only be asked about its own ring window
+    int64_t ring_span = (int64_t) reader.capacity() * 1000000LL / 2;
+    qvrservice_head_tracking_data_t* p = NULL;
+    uint64_t api_misses = 0;
+    next = 0;
+    Samples api = time_batches(lookups / 1000, 100, [&]() {
+        int64_t t = newest - (targets[next++] - oldest) % ring_span;
+        if (QVRServiceClient_GetHistoricalHeadTrackingData(client, &p, t) != QVR_SUCCESS)
+            api_misses++;
+        do_not_optimize(p);
+    });
+
+    // exact sample timestamps must come back unchanged
+    uint64_t mismatches = 0;
+    qvrservice_head_tracking_data_t sample;
+    for (uint32_t back = 0; back < 32 && reader.read_back(back, &sample); back++) {
+        if ((int64_t) sample.ts > history.newest_ts())
+            continue;
+        if (!history.lookup((int64_t) sample.ts, &pose) || memcmp(pose.rotation, sample.rotation, sizeof(pose.rotation)))
+            mismatches++;
+    }
+
+    printf("history: %llu samples, %.2f s, %llu gaps\n", (unsigned long long) history.size(),
+           (newest - oldest) / 1e9, (unsigned long long) history.gaps());
+    local.report("PoseHistory::lookup");
+    api.report("GetHistoricalHeadTrackingData");
+    printf("lookup misses: %llu / %d, api misses: %llu, exact-sample mismatches: %llu\n",
+           (unsigned long long) misses, lookups, (unsigned long long) api_misses,
+           (unsigned long long) mismatches);
+
+    reader.close();
+    QVRServiceClient_Destroy(client);
+    return mismatches == 0 ? 0 : 1;
+}
+
+// ClockDomain against a mock offset drifting at --drift-ppb: fit error,
+// and an inline conversion vs. fetching and parsing the param every time.
+static int bench_clock(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 2);
+    int drift_ppb = arg_int(argc, argv, "--drift-ppb", 20000);
+    int interval_ms = arg_int(argc, argv, "--interval-ms", 50);
+
+    qvrservice_client_helper_t* client = start_client();
+    if (client == NULL)
+        return 1;
+    MOCK_FN(qvrmock_set_clock_drift_ppb)(drift_ppb);
+
+    ClockDomain clock;
+    clock.set_service_client(client);
+    Samples error;
+    int64_t deadline = now_ns() + (int64_t) seconds * 1000000000LL;
+    while (now_ns() < deadline) {
+        clock.sample();
+        usleep(interval_ms * 1000);
+        // how far the fit is off half an interval after its last sample
+        if (clock.samples() >= 4) {
+            int64_t fitted = clock.fit().offset_at(now_ns(CLOCK_BOOTTIME));
+            error.add((double) std::abs(fitted - MOCK_FN(qvrmock_tracker_android_offset)()));
+        }
+    }
+    if (!clock.valid())
+        return 1;
+
+    int64_t q = now_ns();
+    int64_t out = 0;
+    ClockFit fit = clock.fit();
+    Samples inline_cost = time_batches(1000, 1000, [&]() {
+        out += fit.qtimer_to_boot(q++);
+        do_not_optimize(out);
+    });
+    Samples param_cost = time_batches(100, 100, [&]() {
+        char value[32];
+        uint32_t len = sizeof(value);
+        if (QVRServiceClient_GetParam(client, QVRSERVICE_TRACKER_ANDROID_OFFSET_NS, &len, value) == QVR_SUCCESS)
+            out += q++ + strtoll(value, NULL, 10);
+        do_not_optimize(out);
+    });
+
+    printf("drift: set %.3f ppm, fitted %.3f ppm, residual %lld ns, %llu samples, %llu failed\n",
+           drift_ppb / 1000.0, clock.drift_ppm(), (long long) clock.max_residual_ns(),
+           (unsigned long long) clock.samples(), (unsigned long long) clock.failures());
+    error.report("fitted offset error");
+    inline_cost.report("ClockFit::qtimer_to_boot");
+    param_cost.report("GetParam + strtoll");
+
+    QVRServiceClient_Destroy(client);
+    return 0;
+}
+
+// stands in for a rate-limited logcat
+class SlowSink : public LogSink {
+public:
+    explicit SlowSink(int delay) : delay_us(delay), lines(0) {}
+    void write(int, const char*, const char* msg, int64_t) override
+    {
+        do_not_optimize(msg[0]);
+        if (delay_us > 0)
+            usleep(delay_us);
+        lines++;
+    }
+
+    int delay_us;
+    std::atomic<uint64_t> lines;
+};
+
+static SlowSink* sync_sink = NULL;
+
+static int sync_sink_print(int prio, const char* tag, const char* fmt, ...)
+{
+    char msg[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    sync_sink->write(prio, tag, msg, 0);
+    return 1;
+}
+
+// Cost of a __log_func call on the calling thread, synchronous vs. through
+// the AsyncLogger, with a sink that takes --sink-delay-us per line.
+static int bench_log(int argc, char** argv)
+{
+    int count = arg_int(argc, argv, "-n", 2000);
+    int delay_us = arg_int(argc, argv, "--sink-delay-us", 50);
+    int gap_us = arg_int(argc, argv, "--gap-us", 200);
+
+    auto run = [&](const char* name) {
+        Samples samples(count);
+        for (int i = 0; i < count; i++) {
+            int64_t t0 = now_ns();
+            __log_func(ANDROID_LOG_INFO, TAG, "restarts: %d | last recovery: %.3f ms | state %s",
+                       i, i * 0.001, i & 1 ? "STARTED" : "STOPPED");
+            samples.add((double) (now_ns() - t0));
+            if (gap_us > 0)
+                usleep(gap_us);
+        }
+        samples.report(name);
+    };
+
+    SlowSink direct(delay_us);
+    sync_sink = &direct;
+    __log_func = sync_sink_print;
+    run("sync __log_func");
+
+    AsyncLogger& logger = AsyncLogger::instance();
+    SlowSink* async_sink = new SlowSink(delay_us);
+    logger.clear_sinks();
+    logger.add_sink(std::unique_ptr<LogSink>(async_sink));
+    if (!logger.start())
+        return 1;
+    run("async __log_func");
+    logger.stop();
+
+    printf("async: %llu records, %llu dropped, %llu lines written\n", (unsigned long long) logger.records(),
+           (unsigned long long) logger.dropped(), (unsigned long long) async_sink->lines.load());
+    logger.clear_sinks();
+    __log_func = quiet_log;
+    return 0;
+}
+
+// Broker round trips from an app's point of view: a pause lease taken and
+// released (PauseVRMode / ResumeVRMode in the holder) against a stop lease
+// taken and released (StopVRMode / StartVRMode), each timed until the reply
+// reports VR mode in the wanted state. --start-latency-us stands in for the
+// tracking re-initialization a real StartVRMode pays.
+static int bench_broker(int argc, char** argv)
+{
+    int iterations = arg_int(argc, argv, "-n", 500);
+    int start_latency_us = arg_int(argc, argv, "--start-latency-us", 0);
+
+    char name[64];
+    snprintf(name, sizeof(name), "qvrbench-%d", (int) getpid());
+
+    EventLoop loop;
+    VrModeHolder holder(loop);
+    VrModeBroker broker(loop, holder);
+    if (!holder.start() || !broker.start(name))
+        return 1;
+    mock_lib = holder.client()->libHandle;
+
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    VrModeBrokerClient app;
+    if (!app.connect(name)) {
+        EventLoop::signal_event(quit_fd);
+        loop_thread.join();
+        return 1;
+    }
+
+    MOCK_FN(qvrmock_set_latency_us)(QVRMOCK_OP_START_VRMODE, start_latency_us);
+
+    Samples query(iterations), pause(iterations), resume(iterations), stop(iterations), restart(iterations);
+    uint64_t pending = 0;
+    auto round_trip = [&](Samples& samples, QVRHOLDER_BROKER_OP op) {
+        int64_t t0 = now_ns();
+        int32_t res = app.request(op);
+        // the holder retries on its own, poll until it got there
+        while (res == QVR_RESULT_PENDING) {
+            pending++;
+            res = app.request(QVRHOLDER_BROKER_OP_QUERY);
+        }
+        samples.add((double) (now_ns() - t0));
+        return res == QVR_SUCCESS;
+    };
+
+    bool ok = true;
+    for (int i = 0; i < iterations && ok; i++) {
+        ok = round_trip(query, QVRHOLDER_BROKER_OP_QUERY)
+                && round_trip(pause, QVRHOLDER_BROKER_OP_PAUSE)
+                && round_trip(resume, QVRHOLDER_BROKER_OP_RESUME)
+                && round_trip(stop, QVRHOLDER_BROKER_OP_STOP)
+                && round_trip(restart, QVRHOLDER_BROKER_OP_RESUME);
+    }
+    app.close();
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    if (!ok) {
+        fprintf(stderr, "broker request failed\n");
+        return 1;
+    }
+
+    query.report("query");
+    pause.report("pause lease -> paused");
+    resume.report("release pause -> started");
+    stop.report("stop lease -> stopped");
+    restart.report("release stop -> started");
+    printf("pending replies: %llu | holder restarts: %llu\n", (unsigned long long) pending,
+           (unsigned long long) holder.restart_count());
+    return 0;
+}
+
+// Time until 6DoF tracking is back after a fault, seen from an app reading
+// the pose ring: an external stop, a FATAL_ERROR tracking state the holder
+// has to restart tracking for, and a service disconnect that needs a new
+// client plus SetTrackingMode(POSITIONAL). --tracking-init-ms is how long
+// the mock's tracking stays uninitialized after each StartVRMode.
+static int bench_watchdog(int argc, char** argv)
+{
+    int iterations = arg_int(argc, argv, "-n", 20);
+    int init_ms = arg_int(argc, argv, "--tracking-init-ms", 0);
+
+    EventLoop loop;
+    VrModeHolder holder(loop);
+    if (!holder.start())
+        return 1;
+    mock_lib = holder.client()->libHandle;
+    MOCK_FN(qvrmock_set_tracking_init_ms)(init_ms);
+
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    // the ring mapping outlives the observer's connection
+    qvrservice_client_helper_t* observer = QVRServiceClient_Create();
+    PoseRingReader ring;
+    if (ring.open(observer, RING_BUFFER_POSE) != QVR_SUCCESS) {
+        fprintf(stderr, "pose ring unavailable\n");
+        EventLoop::signal_event(quit_fd);
+        loop_thread.join();
+        return 1;
+    }
+
+    auto tracking_since = [&](int64_t t0, int64_t timeout_ns) {
+        qvrservice_head_tracking_data_t pose;
+        while (now_ns() - t0 < timeout_ns) {
+            if (ring.read_latest(&pose) && (int64_t) pose.ts > t0 && (pose.tracking_state & 0x4)
+                    && !(pose.tracking_state & 0x8))
+                return true;
+            usleep(20);
+        }
+        return false;
+    };
+
+    struct Fault {
+        const char* name;
+        std::function<void()> inject;
+    };
+    const Fault faults[] = {
+        { "stop -> 6dof", [&]() { MOCK_FN(qvrmock_set_vrmode)(VRMODE_STOPPED); } },
+        { "fatal error -> 6dof", [&]() { MOCK_FN(qvrmock_set_tracking_state)(0x8, 0); } },
+        { "disconnect -> 6dof", [&]() { MOCK_FN(qvrmock_disconnect)(); } },
+    };
+
+    bool ok = true;
+    for (const Fault& f : faults) {
+        Samples samples(iterations);
+        for (int i = 0; i < iterations && ok; i++) {
+            // settle on healthy tracking first
+            ok = tracking_since(now_ns(), 10000000000LL);
+            usleep(30 * 1000);
+
+            int64_t t0 = now_ns();
+            f.inject();
+            ok = ok && tracking_since(t0, 10000000000LL);
+            samples.add((double) (now_ns() - t0));
+        }
+        if (!ok) {
+            fprintf(stderr, "%s: 6dof not restored within 10 s\n", f.name);
+            break;
+        }
+        samples.report(f.name);
+    }
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    QVRServiceClient_Destroy(observer);
+
+    printf("holder: %llu outages | time to 6dof %.3f ms max | %llu restarts | %llu tracking restarts | %llu reconnects\n",
+           (unsigned long long) holder.outage_count(), holder.max_time_to_6dof_ns() / 1e6,
+           (unsigned long long) holder.restart_count(), (unsigned long long) holder.tracking_restart_count(),
+           (unsigned long long) holder.reconnect_count());
+    return ok ? 0 : 1;
+}
+
+// One eye sample through GetEyeTrackingDataWithFlags vs. the mapped ring,
+// then a frame loop at --read-hz polling the stream with and without the
+// eye pose sync ctrl: the age of the newest sample at each read is what a
+// foveated renderer sees.
+static int bench_eye(int argc, char** argv)
+{
+    int batches = arg_int(argc, argv, "-n", 200);
+    int seconds = arg_int(argc, argv, "-s", 3);
+    int read_hz = arg_int(argc, argv, "--read-hz", 60);
+    int eye_hz = arg_int(argc, argv, "--eye-hz", 90);
+    const int ops = 1000;
+    // the mock needs a few reads to lock onto the cadence
+    const int warmup_frames = 30;
+
+    qvrservice_client_helper_t* client = start_client();
+    if (client == NULL)
+        return 1;
+    MOCK_FN(qvrmock_set_eye_rate)(eye_hz);
+    QVRServiceClient_SetEyeTrackingMode(client, QVRSERVICE_EYE_TRACKING_MODE_DUAL);
+    usleep(300 * 1000);
+
+    EyePoseStream stream;
+    if (stream.open(client, false) != QVR_SUCCESS || !stream.ring_mapped())
+        return 1;
+
+    GazeSample gaze;
+    qvr_capabilities_flags_t caps = stream.capabilities();
+    Samples api = time_batches(batches, ops, [&]() {
+        qvrservice_eye_tracking_data_t* d = NULL;
+        if (QVRServiceClient_GetEyeTrackingDataWithFlags(client, &d, 0, 0) == QVR_SUCCESS)
+            EyePoseStream::to_gaze(*d, caps, &gaze);
+        do_not_optimize(gaze);
+    });
+    Samples ring = time_batches(batches, ops, [&]() {
+        stream.read_latest(&gaze);
+        do_not_optimize(gaze);
+    });
+    api.report("GetEyeTrackingDataWithFlags");
+    ring.report("EyePoseStream::read_latest");
+
+    const int64_t period = 1000000000LL / read_hz;
+    for (int sync = 0; sync < 2; sync++) {
+        stream.open(client, sync != 0);
+        if (sync && !stream.synced()) {
+            fprintf(stderr, "no eye pose sync ctrl\n");
+            break;
+        }
+
+        Samples age(seconds * read_hz);
+        Samples poll_cost(seconds * read_hz);
+        uint64_t delivered = 0;
+        int empty = 0;
+        int frames = seconds * read_hz;
+        GazeSample buf[16];
+        int64_t next = now_ns();
+        for (int f = 0; f < warmup_frames + frames; f++) {
+            next += period;
+            struct timespec ts = { (time_t) (next / 1000000000LL), (long) (next % 1000000000LL) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+            int64_t t0 = now_ns();
+            uint32_t n = stream.read(buf, 16);
+            int64_t t1 = now_ns();
+            if (f < warmup_frames)
+                continue;
+            poll_cost.add((double) (t1 - t0));
+            delivered += n;
+            if (n == 0)
+                empty++;
+            else
+                age.add((double) (now_ns(CLOCK_BOOTTIME) - buf[n - 1].ts));
+        }
+
+        const char* mode = sync ? "synced" : "free running";
+        printf("%s: %.2f samples/frame, %d frames without a new sample, %llu dropped\n", mode,
+               (double) delivered / frames, empty, (unsigned long long) stream.dropped());
+        poll_cost.report(sync ? "read, synced" : "read, free running");
+        age.report(sync ? "gaze age, synced" : "gaze age, free running");
+    }
+
+    stream.close();
+    QVRServiceClient_Destroy(client);
+    return 0;
+}
+
+// Synthetic gaze with a known truth: 250 ms fixations on random targets
+// within +-15 deg, 40 ms saccades between them, gaussian tracker noise and a
+// 150 ms blink every 3 s. Compares raw and filtered fixation jitter, saccade
+// detection and the prediction error, then times both kernels.
+static int bench_gaze(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 20);
+    int rate_hz = arg_int(argc, argv, "--rate-hz", 90);
+    float noise_deg = (float) arg_int(argc, argv, "--noise-mdeg", 300) / 1000.0f;
+    int batch_size = arg_int(argc, argv, "--batch", 16);
+    int batches = arg_int(argc, argv, "-n", 2000);
+    if (rate_hz <= 0 || batch_size <= 0)
+        return 1;
+
+    const int64_t fixation_ns = 250000000LL;
+    const int64_t saccade_ns = 40000000LL;
+    const int64_t cycle_ns = fixation_ns + saccade_ns;
+    const double range = 15.0 * M_PI / 180.0;
+    auto target = [&](int64_t k, double* yaw, double* pitch) {
+        uint32_t h = (uint32_t) (k * 2654435761u) ^ 0x9e3779b9u;
+        h ^= h >> 13;
+        h *= 0x5bd1e995u;
+        h ^= h >> 15;
+        *yaw = ((h & 0xffff) / 32767.5 - 1.0) * range;
+        *pitch = ((h >> 16) / 32767.5 - 1.0) * range;
+    };
+    auto truth = [&](int64_t t, float dir[3]) {
+        int64_t k = t / cycle_ns, in = t % cycle_ns;
+        double yaw, pitch;
+        target(k, &yaw, &pitch);
+        if (in < saccade_ns) {
+            double py, pp;
+            target(k - 1, &py, &pp);
+            double a = (double) in / saccade_ns;
+            a = a * a * (3.0 - 2.0 * a);
+            yaw = py + (yaw - py) * a;
+            pitch = pp + (pitch - pp) * a;
+        }
+        dir[0] = (float) (sin(yaw) * cos(pitch));
+        dir[1] = (float) sin(pitch);
+        dir[2] = (float) (-cos(yaw) * cos(pitch));
+    };
+    auto angle_deg = [](const float a[3], const float b[3]) {
+        double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+        return acos(std::min(1.0, std::max(-1.0, dot))) * 180.0 / M_PI;
+    };
+
+    // xorshift + Box-Muller, reproducible
+    uint64_t rng = 88172645463325252ULL;
+    auto gauss = [&]() {
+        auto uniform = [&]() {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            return ((rng >> 11) + 0.5) / 9007199254740992.0;
+        };
+        return sqrt(-2.0 * log(uniform())) * cos(2.0 * M_PI * uniform());
+    };
+
+    size_t count = (size_t) seconds * rate_hz;
+    std::vector<GazeSample> in(count);
+    std::vector<FilteredGaze> out(count);
+    const int64_t period = 1000000000LL / rate_hz;
+    const double sigma = noise_deg * M_PI / 180.0;
+    for (size_t i = 0; i < count; i++) {
+        GazeSample& g = in[i];
+        int64_t t = (int64_t) i * period + saccade_ns;
+        memset(&g, 0, sizeof(g));
+        g.ts = t;
+        truth(t, g.direction);
+        float n[3] = { (float) (gauss() * sigma), (float) (gauss() * sigma), (float) (gauss() * sigma) };
+        float len = 0;
+        for (int a = 0; a < 3; a++) {
+            g.direction[a] += n[a];
+            len += g.direction[a] * g.direction[a];
+        }
+        for (int a = 0; a < 3; a++)
+            g.direction[a] /= sqrtf(len);
+        g.state = QVRSERVICE_FOVEATED_GAZE_TRACKING_STATE_TRACKING;
+        g.flags = GAZE_DIRECTION_VALID | GAZE_FOVEATED;
+        if (t % 3000000000LL > 2850000000LL)
+            g.flags |= GAZE_BLINK;
+    }
+
+    GazeFilter filter;
+    for (size_t i = 0; i < count; i += batch_size)
+        filter.process(&in[i], std::min((size_t) batch_size, count - i), &out[i]);
+
+    // fixation: from 50 ms after landing to the next saccade
+    double raw_err = 0, filt_err = 0, raw_jit = 0, filt_jit = 0;
+    size_t fix_n = 0, jit_n = 0;
+    double pred_err = 0, hold_err = 0, sac_pred_err = 0, sac_hold_err = 0;
+    size_t pred_n = 0, sac_n = 0;
+    Samples detect;
+    int64_t last_detected_cycle = -1;
+    for (size_t i = 1; i < count; i++) {
+        const FilteredGaze& o = out[i];
+        if (o.phase == GAZE_PHASE_BLINK || o.phase == GAZE_PHASE_LOST || out[i - 1].phase >= GAZE_PHASE_BLINK)
+            continue;
+        int64_t t = in[i].ts;
+        int64_t in_cycle = t % cycle_ns;
+        float truth_now[3], truth_ahead[3];
+        truth(t, truth_now);
+        truth(t + filter.config().horizon_ns, truth_ahead);
+
+        if (in_cycle > saccade_ns + 50000000LL && (t - period) % cycle_ns > saccade_ns + 50000000LL) {
+            raw_err += angle_deg(in[i].direction, truth_now);
+            filt_err += angle_deg(o.direction, truth_now);
+            raw_jit += angle_deg(in[i].direction, in[i - 1].direction);
+            filt_jit += angle_deg(o.direction, out[i - 1].direction);
+            fix_n++;
+            jit_n++;
+        }
+        pred_err += angle_deg(o.predicted, truth_ahead);
+        hold_err += angle_deg(o.direction, truth_ahead);
+        pred_n++;
+        if (o.phase == GAZE_PHASE_SACCADE) {
+            sac_pred_err += angle_deg(o.predicted, truth_ahead);
+            sac_hold_err += angle_deg(o.direction, truth_ahead);
+            sac_n++;
+        }
+
+        int64_t cycle = t / cycle_ns;
+        if (o.phase == GAZE_PHASE_SACCADE && out[i - 1].phase != GAZE_PHASE_SACCADE && cycle != last_detected_cycle &&
+                in_cycle < saccade_ns) {
+            detect.add((double) in_cycle);
+            last_detected_cycle = cycle;
+        }
+    }
+    int64_t true_saccades = (in[count - 1].ts - in[0].ts) / cycle_ns;
+
+    printf("%zu samples at %d Hz, noise %.2f deg, simd: %s\n", count, rate_hz, noise_deg,
+           GazeFilter::simd_available() ? HOLDER_SIMD_NAME : "unavailable");
+    printf("fixation error: raw %.3f deg, filtered %.3f deg\n", raw_err / fix_n, filt_err / fix_n);
+    printf("fixation jitter (sample to sample): raw %.3f deg, filtered %.3f deg\n", raw_jit / jit_n,
+           filt_jit / jit_n);
+    printf("saccades: %llu detected, %lld true, %zu detected within their 40 ms\n",
+           (unsigned long long) filter.saccade_count(), (long long) true_saccades, detect.size());
+    detect.report("saccade detection delay");
+    printf("error at +%.0f ms: predicted %.3f deg, filtered without prediction %.3f deg\n",
+           filter.config().horizon_ns / 1e6, pred_err / pred_n, hold_err / pred_n);
+    printf("  during detected saccades: predicted %.3f deg, without prediction %.3f deg\n",
+           sac_n ? sac_pred_err / sac_n : 0.0, sac_n ? sac_hold_err / sac_n : 0.0);
+
+    std::vector<FilteredGaze> batch_out(batch_size);
+    size_t span = count - count % batch_size;
+    size_t pos = 0;
+    GazeFilter timed;
+    timed.set_kernel(GazeFilter::KERNEL_SCALAR);
+    Samples scalar_time = time_batches(batches, 1, [&]() {
+        timed.process(&in[pos], batch_size, batch_out.data());
+        pos = (pos + batch_size) % span;
+        do_not_optimize(batch_out[0]);
+    });
+    timed.reset();
+    pos = 0;
+    timed.set_kernel(GazeFilter::KERNEL_SIMD);
+    Samples simd_time = time_batches(batches, 1, [&]() {
+        timed.process(&in[pos], batch_size, batch_out.data());
+        pos = (pos + batch_size) % span;
+        do_not_optimize(batch_out[0]);
+    });
+    scalar_time.report("process scalar");
+    simd_time.report("process simd");
+    printf("per sample (batch of %d): scalar %.1f ns, simd %.1f ns\n", batch_size,
+           scalar_time.percentile(50) / batch_size, simd_time.percentile(50) / batch_size);
+    return 0;
+}
+
+// All four mock cameras through one CameraPipeline, once reading with
+// blocking GetFrame calls and once synced. A consumer thread per camera
+// waits for frames, keeps the last --hold of them locked and spends
+// --work-us on each; reports drops, the GetFrame to consumer latency of a
+// callback and of wait(), and the frame age (since start of exposure) at
+// the consumer.
+static int bench_camera(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 5);
+    int hold = arg_int(argc, argv, "--hold", 1);
+    int work_us = arg_int(argc, argv, "--work-us", 2000);
+    const char* names[] = {
+        QVRSERVICE_CAMERA_NAME_TRACKING,
+        QVRSERVICE_CAMERA_NAME_RGB,
+        QVRSERVICE_CAMERA_NAME_DEPTH,
+        QVRSERVICE_CAMERA_NAME_EYE_TRACKING,
+    };
+    const int num_cameras = (int) (sizeof(names) / sizeof(names[0]));
+
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+
+    for (int sync = 0; sync < 2; sync++) {
+        CameraPipeline pipeline;
+        CameraPipeline::Config config;
+        config.sync = sync != 0;
+        config.max_held = (uint32_t) std::max(hold + 2, 2);
+        std::vector<Samples> callback_latency(num_cameras);
+        std::atomic<bool> measuring(false);
+        for (int i = 0; i < num_cameras; i++) {
+            int dev = pipeline.attach(client, names[i], config);
+            if (dev < 0)
+                return 1;
+            Samples* samples = &callback_latency[dev];
+            pipeline.add_consumer(dev, [samples, &measuring](const CameraPipeline::FrameHandle& h) {
+                if (measuring.load(std::memory_order_relaxed))
+                    samples->add((double) (now_ns() - h.acquired_ns()));
+            });
+        }
+        if (!pipeline.start())
+            return 1;
+
+        std::vector<Samples> latency(num_cameras);
+        std::vector<Samples> age(num_cameras);
+        std::atomic<bool> done(false);
+        std::vector<std::thread> consumers;
+        for (int dev = 0; dev < num_cameras; dev++) {
+            consumers.emplace_back([&, dev]() {
+                std::vector<CameraPipeline::FrameHandle> kept;
+                uint32_t last = 0;
+                while (!done.load()) {
+                    CameraPipeline::FrameHandle h = pipeline.wait(dev, last, 100000000LL);
+                    if (!h)
+                        continue;
+                    if (measuring.load(std::memory_order_relaxed)) {
+                        latency[dev].add((double) (now_ns() - h.acquired_ns()));
+                        age[dev].add((double) (now_ns(CLOCK_BOOTTIME) - (int64_t) h.frame().start_of_exposure_ts));
+                    }
+                    last = h.fn();
+                    int64_t until = now_ns() + work_us * 1000LL;
+                    while (now_ns() < until)
+                        do_not_optimize(h.data()[0]);
+                    kept.push_back(std::move(h));
+                    if ((int) kept.size() > hold)
+                        kept.erase(kept.begin());
+                }
+            });
+        }
+
+        // the sync framework needs a few reads to pull the sensors in
+        usleep(1000 * 1000);
+        std::vector<CameraPipeline::Stats> base(num_cameras);
+        for (int dev = 0; dev < num_cameras; dev++)
+            base[dev] = pipeline.stats(dev);
+        measuring.store(true);
+        usleep(seconds * 1000 * 1000);
+        done.store(true);
+        for (std::thread& t : consumers)
+            t.join();
+        // stop() gives the sync ctrls back
+        std::vector<bool> synced(num_cameras);
+        for (int dev = 0; dev < num_cameras; dev++)
+            synced[dev] = pipeline.synced(dev);
+        pipeline.stop();
+
+        printf("%s:\n", sync ? "synced (NON_BLOCKING_SYNC)" : "blocking");
+        for (int dev = 0; dev < num_cameras; dev++) {
+            CameraPipeline::Stats s = pipeline.stats(dev);
+            uint64_t frames = s.frames - base[dev].frames;
+            uint64_t dropped = s.dropped - base[dev].dropped;
+            printf("  %-12s %s %5llu frames, %4llu dropped (%.2f%%), %llu early reads, %llu stalls\n",
+                   names[dev], synced[dev] ? "synced " : "blocking", (unsigned long long) frames,
+                   (unsigned long long) dropped, frames + dropped ? 100.0 * dropped / (frames + dropped) : 0.0,
+                   (unsigned long long) (s.early_reads - base[dev].early_reads),
+                   (unsigned long long) (s.stalls - base[dev].stalls));
+            char name[64];
+            snprintf(name, sizeof(name), "  %s callback latency", names[dev]);
+            callback_latency[dev].report(name);
+            snprintf(name, sizeof(name), "  %s wait latency", names[dev]);
+            latency[dev].report(name);
+            snprintf(name, sizeof(name), "  %s frame age", names[dev]);
+            age[dev].report(name);
+        }
+        pipeline.close();
+    }
+
+    QVRCameraClient_Destroy(client);
+    return 0;
+}
+
+// RawUnpacker on synthetic RAW10 and RAW16 frames: a full frame per output
+// with both kernels, next to a memcpy of the same bytes in and out. The
+// outputs themselves are checked by qvrtest.
+static int bench_raw(int argc, char** argv)
+{
+    int width = arg_int(argc, argv, "--width", 1280);
+    int height = arg_int(argc, argv, "--height", 800);
+    int frames = arg_int(argc, argv, "-n", 200);
+    if (width <= 0 || height <= 0 || frames <= 0)
+        return 1;
+
+    // sensor values, 10 bit for RAW10, with a 12 bit copy for RAW16
+    std::vector<uint16_t> truth((size_t) width * height);
+    for (size_t i = 0; i < truth.size(); i++) {
+        uint32_t h = (uint32_t) i * 2654435761u;
+        h ^= h >> 15;
+        truth[i] = (uint16_t) (h & 0x3ff);
+    }
+    auto pack_raw10 = [](const uint16_t* v, uint32_t w, uint8_t* out) {
+        memset(out, 0, RawUnpacker::row_bytes(QVRCAMERA_FRAME_FORMAT_RAW10_MONO, w));
+        for (uint32_t x = 0; x < w; x++) {
+            uint8_t* g = out + x / 4 * 5;
+            g[x % 4] = (uint8_t) (v[x] >> 2);
+            g[4] |= (uint8_t) ((v[x] & 3) << (2 * (x % 4)));
+        }
+    };
+
+    // a single image with a padded stride
+    uint32_t rb = RawUnpacker::row_bytes(QVRCAMERA_FRAME_FORMAT_RAW10_MONO, width);
+    uint32_t stride = rb + 64;
+    std::vector<uint8_t> raw10((size_t) stride * height);
+    for (int y = 0; y < height; y++)
+        pack_raw10(&truth[(size_t) y * width], width, &raw10[(size_t) y * stride]);
+    std::vector<uint16_t> raw16(truth.size());
+    for (size_t i = 0; i < truth.size(); i++)
+        raw16[i] = (uint16_t) (truth[i] << 2 | (truth[i] >> 8));
+
+    qvrcamera_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.format = QVRCAMERA_FRAME_FORMAT_RAW10_MONO;
+    frame.width = width;
+    frame.height = height;
+    frame.stride = stride;
+    frame.buffer = raw10.data();
+    frame.len = (uint32_t) raw10.size();
+    qvrcamera_frame_t frame16 = frame;
+    frame16.format = QVRCAMERA_FRAME_FORMAT_RAW16_MONO;
+    frame16.stride = width * 2;
+    frame16.buffer = (uint8_t*) raw16.data();
+    frame16.len = (uint32_t) raw16.size() * 2;
+
+    const RawUnpacker::Kernel kernels[] = { RawUnpacker::KERNEL_SCALAR, RawUnpacker::KERNEL_SIMD };
+    std::vector<uint8_t> out((size_t) width * height * sizeof(float));
+    auto run = [&](const char* name, const qvrcamera_frame_t& f, RawUnpacker::Output o, float gamma) {
+        RawUnpacker::Config config;
+        config.output = o;
+        config.gamma = gamma;
+        config.raw16_bits = 12;
+        RawUnpacker unpacker(config);
+        RawUnpacker::Image img;
+        RawUnpacker::split(f, &img);
+        size_t pitch = img.width * RawUnpacker::output_size(o);
+        double bytes = (double) img.pitch * img.height + (double) pitch * img.height;
+        double ns[2];
+        for (int k = 0; k < 2; k++) {
+            unpacker.set_kernel(kernels[k]);
+            Samples t = time_batches(frames, 1, [&]() {
+                unpacker.unpack(img, out.data(), pitch);
+                do_not_optimize(out[0]);
+            });
+            ns[k] = t.percentile(50);
+        }
+        printf("%-16s scalar %8.1f us %6.2f GB/s   simd %8.1f us %6.2f GB/s\n", name, ns[0] / 1000,
+               bytes / ns[0], ns[1] / 1000, bytes / ns[1]);
+        return bytes;
+    };
+    printf("%dx%d, simd: %s, GB/s counts the bytes read and written:\n", width, height,
+           RawUnpacker::simd_available() ? HOLDER_SIMD_NAME : "unavailable");
+    double copy_bytes = 0;
+    copy_bytes = std::max(copy_bytes, run("raw10 -> y8", frame, RawUnpacker::OUTPUT_Y8, 1.0f));
+    copy_bytes = std::max(copy_bytes, run("raw10 -> y16", frame, RawUnpacker::OUTPUT_Y16, 1.0f));
+    copy_bytes = std::max(copy_bytes, run("raw10 -> float", frame, RawUnpacker::OUTPUT_FLOAT, 1.0f));
+    run("raw10 -> y8 gamma", frame, RawUnpacker::OUTPUT_Y8, 2.2f);
+    run("raw16 -> y8", frame16, RawUnpacker::OUTPUT_Y8, 1.0f);
+    run("raw16 -> float", frame16, RawUnpacker::OUTPUT_FLOAT, 1.0f);
+
+    // memcpy moves each byte once read and once written
+    std::vector<uint8_t> copy_src((size_t) (copy_bytes / 2));
+    std::vector<uint8_t> copy_dst(copy_src.size());
+    Samples copy_time = time_batches(frames, 1, [&]() {
+        memcpy(copy_dst.data(), copy_src.data(), copy_src.size());
+        do_not_optimize(copy_dst[0]);
+    });
+    printf("%-16s %8.1f us %6.2f GB/s (%.1f MB)\n", "memcpy", copy_time.percentile(50) / 1000,
+           2.0 * copy_src.size() / copy_time.percentile(50), copy_src.size() / 1e6);
+    return 0;
+}
+
+// YuvOps on a synthetic NV21 frame, 2560x720 by default like the merged
+// stereo RGB camera: each operation with the scalar kernel, the SIMD kernel
+// and the SIMD kernel tiled over --threads.
+static int bench_yuv(int argc, char** argv)
+{
+    int width = arg_int(argc, argv, "--width", 2560) & ~3;
+    int height = arg_int(argc, argv, "--height", 720) & ~3;
+    int threads = arg_int(argc, argv, "--threads", 4);
+    int frames = arg_int(argc, argv, "-n", 100);
+    if (width <= 0 || height <= 0 || threads <= 0 || frames <= 0)
+        return 1;
+
+    // 32 bytes of row padding, as camera strides often have
+    uint32_t pitch = width + 32;
+    std::vector<uint8_t> frame_buf((size_t) pitch * height * 3 / 2);
+    for (size_t i = 0; i < frame_buf.size(); i++) {
+        uint32_t h = (uint32_t) i * 2654435761u;
+        frame_buf[i] = (uint8_t) ((h >> 13) ^ (i / pitch));
+    }
+    qvrcamera_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.format = QVRCAMERA_FRAME_FORMAT_YUV420;
+    frame.width = width;
+    frame.height = height;
+    frame.stride = pitch;
+    frame.buffer = frame_buf.data();
+    frame.len = (uint32_t) frame_buf.size();
+    YuvImage src;
+    if (!YuvOps::from_frame(frame, QVRCAMERA_FRAME_FORMAT_YUV420_NV21, &src))
+        return 1;
+    Plane luma = { src.y, src.width, src.height, src.y_pitch };
+
+    struct Op {
+        const char* name;
+        size_t out_size;
+        std::function<void(YuvOps& ops, uint8_t* out)> run;
+    };
+    uint32_t w = width, h = height;
+    std::vector<uint8_t> nv12_buf;
+    const Op ops[] = {
+        { "deinterleave", (size_t) w * h / 2,
+          [&](YuvOps& o, uint8_t* out) {
+              Plane u = { out, w / 2, h / 2, w / 2 };
+              Plane v = { out + (size_t) w * h / 4, w / 2, h / 2, w / 2 };
+              o.deinterleave(src, u, v);
+          } },
+        { "nv21 -> nv12", (size_t) pitch * h / 2,
+          [&](YuvOps& o, uint8_t* out) {
+              // in place, on a copy of the chroma plane
+              YuvImage img = src;
+              img.uv = out;
+              memcpy(out, src.uv, (size_t) pitch * h / 2);
+              o.to_nv12(&img);
+          } },
+        { "y box 2x", (size_t) w * h / 4,
+          [&](YuvOps& o, uint8_t* out) {
+              Plane d = { out, w / 2, h / 2, w / 2 };
+              o.downscale(luma, d, 2, YuvOps::FILTER_BOX);
+          } },
+        { "y box 4x", (size_t) w * h / 16,
+          [&](YuvOps& o, uint8_t* out) {
+              Plane d = { out, w / 4, h / 4, w / 4 };
+              o.downscale(luma, d, 4, YuvOps::FILTER_BOX);
+          } },
+        { "y bilinear 4x", (size_t) w * h / 16,
+          [&](YuvOps& o, uint8_t* out) {
+              Plane d = { out, w / 4, h / 4, w / 4 };
+              o.downscale(luma, d, 4, YuvOps::FILTER_BILINEAR);
+          } },
+        { "rgba", (size_t) w * h * 4, [&](YuvOps& o, uint8_t* out) { o.to_rgba(src, out, (size_t) w * 4); } },
+    };
+
+    YuvOps single;
+    YuvOps tiled(threads);
+    std::vector<uint8_t> out;
+    printf("%dx%d NV21, %d threads, simd: %s\n", width, height, threads,
+           YuvOps::simd_available() ? HOLDER_SIMD_NAME : "unavailable");
+
+    for (const Op& op : ops) {
+        out.assign(op.out_size, 0);
+        double us[3];
+        for (int variant = 0; variant < 3; variant++) {
+            YuvOps& o = variant == 2 ? tiled : single;
+            o.set_kernel(variant == 0 ? YuvOps::KERNEL_SCALAR : YuvOps::KERNEL_SIMD);
+            Samples t = time_batches(frames, 1, [&]() {
+                op.run(o, out.data());
+                do_not_optimize(out[0]);
+            });
+            us[variant] = t.percentile(50) / 1000;
+        }
+        printf("%-16s scalar %8.1f us   simd %8.1f us   simd x%d %8.1f us\n", op.name, us[0], us[1], threads,
+               us[2]);
+    }
+    return 0;
+}
+
+// FrameViews on synthetic merged frames with row padding: splitting into
+// per camera views, and copying the views out one after the other against
+// the banded copy(); then views of the mock cameras' frames through
+// FrameToHardwareBuffer(). qvrtest checks where the views land.
+static int bench_frames(int argc, char** argv)
+{
+    int frames = arg_int(argc, argv, "-n", 200);
+    if (frames <= 0)
+        return 1;
+
+    struct Case {
+        const char* name;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        FrameViews::Layout layout;
+    };
+    const Case cases[] = {
+        { "y8 2x1280x720 horizontal", QVRCAMERA_FRAME_FORMAT_Y8, 2560, 720, { 2, false } },
+        { "y8 2x1280x720 vertical", QVRCAMERA_FRAME_FORMAT_Y8, 1280, 1440, { 2, true } },
+        { "yuv420 2x1280x720 horizontal", QVRCAMERA_FRAME_FORMAT_YUV420, 2560, 720, { 2, false } },
+        { "yuv420 2x1280x720 vertical", QVRCAMERA_FRAME_FORMAT_YUV420, 1280, 1440, { 2, true } },
+        { "raw10 2x1280x800 horizontal", QVRCAMERA_FRAME_FORMAT_RAW10_MONO, 2560, 800, { 2, false } },
+        { "depth16 4x320x240 vertical", QVRCAMERA_FRAME_FORMAT_DEPTH16, 320, 960, { 4, true } },
+    };
+
+    for (const Case& c : cases) {
+        // 64 bytes of row padding, as camera strides often have
+        uint32_t rb = FrameViews::row_bytes(c.format, c.width);
+        uint32_t pitch = rb + 64;
+        bool yuv = c.format == QVRCAMERA_FRAME_FORMAT_YUV420;
+        std::vector<uint8_t> buf((size_t) pitch * (yuv ? c.height * 3 / 2 : c.height));
+        for (size_t i = 0; i < buf.size(); i++)
+            buf[i] = (uint8_t) ((uint32_t) i * 2654435761u >> 13);
+        qvrcamera_frame_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.format = c.format;
+        frame.width = c.width;
+        frame.height = c.height;
+        frame.stride = pitch;
+        frame.buffer = buf.data();
+        frame.len = (uint32_t) buf.size();
+
+        FrameViews fv;
+        int n = fv.from_frame(frame, c.layout);
+        if (n != (int) c.layout.images) {
+            printf("%s: %d views\n", c.name, n);
+            return 1;
+        }
+        Samples split = time_batches(frames, 1000, [&]() {
+            fv.from_frame(frame, c.layout);
+            do_not_optimize(fv.view(0).data);
+        });
+
+        std::vector<ImageView> views;
+        std::vector<std::vector<uint8_t>> naive(n), banded(n);
+        std::vector<uint8_t*> dst(n);
+        for (int i = 0; i < n; i++) {
+            views.push_back(fv.view(i));
+            naive[i].assign(FrameViews::copy_size(views[i]), 0);
+            banded[i].assign(FrameViews::copy_size(views[i]), 1);
+            dst[i] = banded[i].data();
+        }
+        // one view after the other, a full pass over the frame each
+        auto copy_naive = [&]() {
+            for (int i = 0; i < n; i++) {
+                const ImageView& v = views[i];
+                uint32_t vrb = FrameViews::row_bytes(v.format, v.width);
+                for (uint32_t y = 0; y < v.height; y++)
+                    memcpy(naive[i].data() + (size_t) y * vrb, v.data + (size_t) y * v.pitch, vrb);
+                for (uint32_t y = 0; v.uv != NULL && y < v.height / 2; y++)
+                    memcpy(naive[i].data() + (size_t) (v.height + y) * vrb, v.uv + (size_t) y * v.uv_pitch, vrb);
+            }
+        };
+        Samples t_naive = time_batches(frames, 1, [&]() {
+            copy_naive();
+            do_not_optimize(naive[0][0]);
+        });
+        Samples t_banded = time_batches(frames, 1, [&]() {
+            FrameViews::copy(views.data(), n, dst.data());
+            do_not_optimize(banded[0][0]);
+        });
+        printf("%-30s split %6.1f ns   copy per view %8.1f us   banded %8.1f us\n", c.name,
+               split.percentile(50), t_naive.percentile(50) / 1000, t_banded.percentile(50) / 1000);
+    }
+
+    // views of the mock cameras' frames through FrameToHardwareBuffer()
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+    const char* names[] = {
+        QVRSERVICE_CAMERA_NAME_TRACKING,
+        QVRSERVICE_CAMERA_NAME_RGB,
+        QVRSERVICE_CAMERA_NAME_DEPTH,
+    };
+    int failures = 0;
+    for (const char* name : names) {
+        qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+        if (cam == NULL || QVRCameraDevice_Start(cam) != QVR_CAM_SUCCESS) {
+            printf("attach/start %s failed\n", name);
+            failures++;
+            continue;
+        }
+        FrameViews::Layout layout = FrameViews::query_layout(cam);
+        int32_t fn = 0;
+        qvrcamera_frame_t frame;
+        if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE,
+                                     &frame) == QVR_CAM_SUCCESS) {
+            FrameViews from_hw;
+            Samples t = time_batches(frames, 10, [&]() {
+                from_hw.from_hardware_buffers(cam, &frame, layout);
+                do_not_optimize(from_hw.view(0).data);
+            });
+            printf("%-12s %u image(s) %s, hardware buffer views %.1f ns\n", name, layout.images,
+                   layout.vertical ? "vertical" : "horizontal", t.percentile(50));
+            from_hw.reset();
+            QVRCameraDevice_ReleaseFrame(cam, fn);
+        } else {
+            failures++;
+        }
+        QVRCameraDevice_Stop(cam);
+        QVRCameraDevice_DetachCamera(cam);
+    }
+    QVRCameraClient_Destroy(client);
+    return failures != 0 ? 1 : 0;
+}
+
+// PartialFrameReader on the mock tracking and rgb cameras, with --bands row
+// bands per frame and with whole frames: start of exposure to each band
+// going out, and how long after their rows were due. qvrtest checks that
+// bands only hold rows of their own frame.
+static int bench_partial(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 3);
+    int num_bands = arg_int(argc, argv, "--bands", 4);
+    if (seconds <= 0 || num_bands <= 0 || num_bands > (int) PartialFrameReader::MAX_BANDS)
+        return 1;
+    const char* names[] = {
+        QVRSERVICE_CAMERA_NAME_TRACKING,
+        QVRSERVICE_CAMERA_NAME_RGB,
+    };
+
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+    mock_lib = client->libHandle;
+
+    int failures = 0;
+    for (const char* name : names) {
+        for (int partial = 1; partial >= 0; partial--) {
+            MOCK_FN(qvrcammock_set_partial_frame_read)(name, partial);
+            PartialFrameReader reader;
+            PartialFrameReader::Config config;
+            config.bands = (uint32_t) num_bands;
+            if (reader.attach(client, name, config) != QVR_CAM_SUCCESS)
+                return 1;
+
+            // start of exposure to each band going out
+            std::vector<Samples> sof_to_band(num_bands);
+            Samples past_due;
+            std::atomic<bool> measuring(false);
+            reader.set_callback([&](const PartialFrameReader::Band& b) {
+                if (!measuring.load(std::memory_order_relaxed))
+                    return;
+                int64_t boot_offset = now_ns(CLOCK_BOOTTIME) - now_ns();
+                sof_to_band[b.index].add((double) (b.delivered_ns - ((int64_t) b.sof_ns - boot_offset)));
+                past_due.add((double) (b.delivered_ns - b.due_ns));
+            });
+            if (!reader.start())
+                return 1;
+            // the sync framework needs a few reads to pull the sensor in
+            usleep(1000 * 1000);
+            PartialFrameReader::Stats base = reader.stats();
+            measuring.store(true);
+            usleep(seconds * 1000 * 1000);
+            measuring.store(false);
+            bool synced = reader.synced();
+            reader.close();
+
+            PartialFrameReader::Stats st = reader.stats();
+            printf("%s, %s%s: %llu frames, %llu dropped, %llu bands, %llu late, %llu complete\n",
+                   name, partial ? "partial" : "full frames", synced ? ", synced" : "",
+                   (unsigned long long) (st.frames - base.frames), (unsigned long long) (st.dropped - base.dropped),
+                   (unsigned long long) (st.bands - base.bands),
+                   (unsigned long long) (st.late_bands - base.late_bands),
+                   (unsigned long long) (st.complete_frames - base.complete_frames));
+            for (int b = 0; b < (partial ? num_bands : 1); b++) {
+                char label[64];
+                snprintf(label, sizeof(label), "  sof to band %d/%d", b + 1, partial ? num_bands : 1);
+                sof_to_band[b].report(label);
+            }
+            past_due.report("  past due");
+            if (st.errors != base.errors)
+                failures++;
+        }
+        MOCK_FN(qvrcammock_set_partial_frame_read)(name, 1);
+    }
+    QVRCameraClient_Destroy(client);
+    return failures != 0 ? 1 : 0;
+}
+
+// What a peer process of bench_share sends back through its pipe, followed
+// by the delivery latencies
+struct SharePeerResult {
+    uint64_t frames;
+    uint64_t lapped;
+    uint64_t errors;
+    uint64_t samples;
+};
+
+static void share_peer(const char* service, const char* camera, int seconds, int work_us, int out_fd)
+{
+    SharePeerResult r = {};
+    std::vector<double> latency;
+    FrameShareClient client;
+    // the holder side starts after the fork
+    int32_t res = QVR_ERROR;
+    for (int i = 0; i < 200 && res == QVR_ERROR; i++) {
+        res = client.connect(camera, service);
+        if (res == QVR_ERROR)
+            usleep(10 * 1000);
+    }
+    if (res != QVR_SUCCESS)
+        r.errors++;
+
+    FrameViews views;
+    int64_t end = now_ns() + seconds * 1000000000LL;
+    while (res == QVR_SUCCESS && now_ns() < end) {
+        FrameShareClient::Frame f;
+        int32_t got = client.next(&f, 100);
+        if (got == QVR_RESULT_PENDING)
+            continue;
+        if (got != QVR_SUCCESS) {
+            r.errors++;
+            break;
+        }
+        int64_t t = now_ns();
+        latency.push_back((double) (t - f.meta.acquired_ns));
+        FrameViews::Layout layout;
+        layout.images = f.meta.images;
+        layout.vertical = f.meta.vertical != 0;
+        if (views.from_buffers(f.buffers, f.num_buffers, f.meta.format, layout) == 0)
+            r.errors++;
+        while (now_ns() < t + work_us * 1000LL)
+            do_not_optimize(views.count());
+        views.reset();
+        client.release(f.lease);
+        r.frames++;
+    }
+    r.lapped = client.lapped();
+    r.samples = latency.size();
+    if (write(out_fd, &r, sizeof(r)) != (ssize_t) sizeof(r) ||
+        write(out_fd, latency.data(), latency.size() * sizeof(double)) != (ssize_t) (latency.size() * sizeof(double)))
+        _exit(1);
+    _exit(0);
+}
+
+// Frames of the mock tracking and rgb cameras shared by one holder pipeline
+// with --peers processes, alternating between the cameras. Every peer maps
+// the hardware buffers it gets and holds each frame for --work-us. Reports
+// holder-get to peer latency per peer and the frames peers missed while
+// holding all their leases.
+static int bench_share(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 3);
+    int num_peers = arg_int(argc, argv, "--peers", 4);
+    int work_us = arg_int(argc, argv, "--work-us", 2000);
+    if (seconds <= 0 || num_peers <= 0 || num_peers > FrameShareService::MAX_PEERS)
+        return 1;
+    const char* names[] = {
+        QVRSERVICE_CAMERA_NAME_TRACKING,
+        QVRSERVICE_CAMERA_NAME_RGB,
+    };
+    char service[64];
+    snprintf(service, sizeof(service), "qvrbench-frames-%d", (int) getpid());
+
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+
+    // the peers fork before the pipeline threads exist
+    fflush(stdout);
+    std::vector<pid_t> pids;
+    std::vector<int> pipes;
+    for (int i = 0; i < num_peers; i++) {
+        int fds[2];
+        if (pipe(fds) != 0)
+            return 1;
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            share_peer(service, names[i % 2], seconds + 1, work_us, fds[1]);
+        }
+        close(fds[1]);
+        pids.push_back(pid);
+        pipes.push_back(fds[0]);
+    }
+
+    EventLoop loop;
+    CameraPipeline pipeline;
+    CameraPipeline::Config config;
+    // two leases for every peer of a camera, plus the holder's own
+    config.max_held = (uint32_t) (2 * ((num_peers + 1) / 2) + 2);
+    FrameShareService share(loop, pipeline);
+    bool ok = true;
+    for (const char* name : names)
+        ok = ok && pipeline.attach(client, name, config) >= 0;
+    ok = ok && share.start(service) && pipeline.start();
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    std::vector<SharePeerResult> results(num_peers);
+    std::vector<Samples> latency(num_peers);
+    int failures = ok ? 0 : 1;
+    for (int i = 0; i < num_peers; i++) {
+        SharePeerResult& r = results[i];
+        std::vector<double> values;
+        bool got = read(pipes[i], &r, sizeof(r)) == (ssize_t) sizeof(r);
+        if (got) {
+            values.resize(r.samples);
+            size_t want = values.size() * sizeof(double), have = 0;
+            while (have < want) {
+                ssize_t n = read(pipes[i], (char*) values.data() + have, want - have);
+                if (n <= 0)
+                    break;
+                have += (size_t) n;
+            }
+            got = have == want;
+        }
+        close(pipes[i]);
+        int status = 0;
+        waitpid(pids[i], &status, 0);
+        if (!got || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "peer %d failed\n", i);
+            failures++;
+            continue;
+        }
+        for (double v : values)
+            latency[i].add(v);
+    }
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    std::vector<CameraPipeline::Stats> stats;
+    for (int dev = 0; dev < pipeline.device_count(); dev++)
+        stats.push_back(pipeline.stats(dev));
+    uint64_t published = share.frames_published(), skipped = share.frames_skipped();
+    uint64_t buffers = share.buffers_sent();
+    share.stop();
+    pipeline.close();
+    QVRCameraClient_Destroy(client);
+
+    for (int dev = 0; dev < (int) stats.size(); dev++)
+        printf("holder %-12s %llu frames, %llu dropped, %llu stalls\n", names[dev],
+               (unsigned long long) stats[dev].frames, (unsigned long long) stats[dev].dropped,
+               (unsigned long long) stats[dev].stalls);
+    printf("published %llu | skipped %llu (peers holding all leases) | buffers sent %llu\n",
+           (unsigned long long) published, (unsigned long long) skipped, (unsigned long long) buffers);
+    for (int i = 0; i < num_peers; i++) {
+        const SharePeerResult& r = results[i];
+        printf("peer %d %-12s %llu frames, %llu lapped, %llu errors\n", i, names[i % 2],
+               (unsigned long long) r.frames, (unsigned long long) r.lapped, (unsigned long long) r.errors);
+        latency[i].report("  holder get to peer");
+        if (r.frames == 0 || r.errors != 0)
+            failures++;
+    }
+    return failures != 0 ? 1 : 0;
+}
+
+// AutoExposure metering of synthetic frames with the scalar and vector
+// kernels, then the controller closing the loop on the mock tracking camera
+// through scene light steps: frames until the brightness is within 0.2 EV
+// of the target, updates sent, and the frame to frame brightness spread
+// under 100 Hz flicker with and without exposures of whole flicker periods.
+static int bench_exposure(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 2);
+    int frames = arg_int(argc, argv, "-n", 200);
+    if (seconds <= 0 || frames <= 0)
+        return 1;
+
+    struct Case {
+        const char* name;
+        uint32_t width;
+        uint32_t height;
+        uint32_t step;
+        float roi;
+    };
+    const Case cases[] = {
+        { "1280x480 step 4", 1280, 480, 4, 0.0f },
+        { "1280x480 step 2 roi", 1280, 480, 2, 0.1f },
+        { "1283x480 step 1 roi", 1283, 480, 1, 0.13f },
+        { "2560x720 step 4", 2560, 720, 4, 0.0f },
+        { "2560x720 step 3", 2560, 720, 3, 0.0f },
+    };
+    int failures = 0;
+    for (const Case& c : cases) {
+        uint32_t pitch = c.width + 64;
+        std::vector<uint8_t> buf((size_t) pitch * c.height);
+        for (size_t i = 0; i < buf.size(); i++)
+            buf[i] = (uint8_t) ((uint32_t) i * 2654435761u >> 13);
+        ImageView v;
+        memset(&v, 0, sizeof(v));
+        v.data = buf.data();
+        v.width = c.width;
+        v.height = c.height;
+        v.pitch = pitch;
+        v.format = QVRCAMERA_FRAME_FORMAT_Y8;
+
+        AutoExposure::Config config;
+        config.step_x = c.step;
+        config.roi_left = config.roi_top = c.roi;
+        config.roi_right = config.roi_bottom = 1.0f - c.roi;
+        // every process() meters and sends, no frames to wait for
+        config.settle_frames = 0;
+        AutoExposure ae(config);
+        AutoExposure::Histogram simd, scalar;
+        ae.set_kernel(AutoExposure::KERNEL_SCALAR);
+        Samples t_scalar = time_batches(frames, 1, [&]() {
+            ae.meter(&v, 1, &scalar);
+            do_not_optimize(scalar.count);
+        });
+        ae.set_kernel(AutoExposure::KERNEL_SIMD);
+        Samples t_simd = time_batches(frames, 1, [&]() {
+            ae.meter(&v, 1, &simd);
+            do_not_optimize(simd.count);
+        });
+        // the whole per frame step, without a camera to send to
+        Samples t_process = time_batches(frames, 1, [&]() { do_not_optimize(ae.process(&v, 1, 4000000, 100)); });
+        printf("%-22s %7u samples  scalar %7.1f us  %s %7.1f us  process %7.1f us\n", c.name, simd.count,
+               t_scalar.percentile(50) / 1000, HOLDER_SIMD_NAME, t_simd.percentile(50) / 1000,
+               t_process.percentile(50) / 1000);
+    }
+
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+    mock_lib = client->libHandle;
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    if (cam == NULL || QVRCameraDevice_Start(cam) != QVR_CAM_SUCCESS) {
+        fprintf(stderr, "attach/start %s failed\n", name);
+        return 1;
+    }
+    FrameViews::Layout layout = FrameViews::query_layout(cam);
+    auto set_light = MOCK_FN(qvrcammock_set_scene_light);
+
+    struct Phase {
+        const char* name;
+        uint32_t light_pct;
+        uint32_t flicker_pct;
+        uint32_t flicker_hz;
+        float max_gamma;
+    };
+    const Phase phases[] = {
+        { "light 100%", 100, 0, 100, 1.0f },
+        { "light 25%", 25, 0, 100, 1.0f },
+        { "light 400%", 400, 0, 100, 1.0f },
+        { "light 4%", 4, 0, 100, 1.0f },
+        { "light 25% flicker 30%", 25, 30, 0, 1.0f },
+        { "  whole flicker periods", 25, 30, 100, 1.0f },
+        { "light 1%", 1, 0, 100, 1.0f },
+        { "  gamma up to 2", 1, 0, 100, 2.0f },
+    };
+    AutoExposure ae;
+    Samples t_process, t_send;
+    int32_t next_fn = 0;
+    for (const Phase& ph : phases) {
+        AutoExposure::Config config = ae.config();
+        config.flicker_hz = ph.flicker_hz;
+        config.max_gamma = ph.max_gamma;
+        ae.set_config(config);
+        ae.attach(cam);
+        set_light(name, ph.light_pct, ph.flicker_pct, 50);
+
+        // frames until the error stays within 0.2 EV
+        int converged = 0;
+        int n = 0;
+        Samples brightness;
+        uint64_t exposure_ns = 0;
+        uint32_t gain = 0;
+        int64_t end = now_ns() + seconds * 1000000000LL;
+        while (now_ns() < end) {
+            int32_t fn = next_fn;
+            qvrcamera_frame_t frame;
+            if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE,
+                                         &frame) != QVR_CAM_SUCCESS) {
+                failures++;
+                break;
+            }
+            FrameViews views;
+            views.from_frame(frame, layout);
+            AutoExposure::Stats before = ae.stats();
+            // CPU time: on a loaded device the mock's frame writer and pose
+            // threads preempt process() at random; frames that sent settings
+            // also paid for the camera's round trip
+            int64_t t0 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+            if (ae.process(views, frame))
+                t_send.add((double) (now_ns(CLOCK_THREAD_CPUTIME_ID) - t0));
+            else
+                t_process.add((double) (now_ns(CLOCK_THREAD_CPUTIME_ID) - t0));
+            QVRCameraDevice_ReleaseFrame(cam, fn);
+            next_fn = fn + 1;
+            exposure_ns = frame.exposure;
+            gain = frame.gain;
+            n++;
+
+            const AutoExposure::Stats& st = ae.stats();
+            if (st.settling != before.settling || st.errors != before.errors)
+                continue;
+            if (fabsf(st.error_ev) >= 0.2f)
+                converged = n;
+            // the second half, settled
+            if (now_ns() > end - seconds * 500000000LL)
+                brightness.add(st.brightness);
+        }
+        const AutoExposure::Stats& st = ae.stats();
+        // flicker or the exposure and gain limits can keep it off the target
+        bool settled = converged < n / 2;
+        printf("%-24s %s %3d frames | %3llu updates, %3llu small | %6.2f ms x%5.2f gamma %.2f | brightness %5.1f,"
+               " spread %4.1f\n",
+               ph.name, settled ? "settled after" : "not settled  ", converged, (unsigned long long) st.updates,
+               (unsigned long long) st.small_changes, exposure_ns / 1e6, gain / 100.0, ae.settings().gamma,
+               brightness.percentile(50), brightness.percentile(95) - brightness.percentile(5));
+        if (st.errors != 0)
+            failures++;
+    }
+    t_process.report("process per frame (cpu)");
+    t_send.report("process + send (cpu)");
+    QVRCameraDevice_Stop(cam);
+    QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+    return failures != 0 ? 1 : 0;
+}
+
+// RoiScheduler packing of random region sets into crops, then regions of
+// the mock tracking camera read through hardware crops: one still region
+// and one sweeping across the left image. The frame bytes and the time to
+// read a whole frame buffer are set against whole frames.
+static int bench_roi(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 3);
+    int sets = arg_int(argc, argv, "-n", 2000);
+    if (seconds <= 0 || sets <= 0)
+        return 1;
+
+    RoiScheduler sched;
+    const uint32_t width = 2560, height = 720;
+    uint32_t seed = 1;
+    auto rnd = [&](uint32_t n) {
+        seed = seed * 1103515245u + 12345u;
+        return (seed >> 8) % n;
+    };
+    for (int count = 1; count <= 6; count++) {
+        double roi_area = 0, crop_area = 0;
+        int whole = 0;
+        std::vector<std::vector<RoiScheduler::Rect>> cases(sets);
+        for (auto& rois : cases) {
+            for (int i = 0; i < count; i++) {
+                uint32_t w = 32 + rnd(224), h = 32 + rnd(160);
+                rois.push_back({ rnd(width - w), rnd(height - h), w, h });
+            }
+        }
+        int64_t t0 = now_ns();
+        for (const auto& rois : cases) {
+            RoiScheduler::Rect crops[RoiScheduler::MAX_CROPS];
+            int n = sched.plan(rois.data(), count, width, height, crops);
+            for (const RoiScheduler::Rect& r : rois)
+                roi_area += (double) r.width * r.height;
+            for (int c = 0; c < n; c++)
+                crop_area += (double) crops[c].width * crops[c].height;
+            if (n == 0) {
+                crop_area += (double) width * height;
+                whole++;
+            }
+        }
+        double per_plan = (double) (now_ns() - t0) / sets;
+        printf("%d regions: crops %5.1f%% of the frame (regions %5.1f%%), whole frames %5.1f%%, plan %6.1f ns\n", count,
+               100.0 * crop_area / sets / (width * height), 100.0 * roi_area / sets / (width * height),
+               100.0 * whole / sets, per_plan);
+    }
+
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+    mock_lib = client->libHandle;
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    if (cam == NULL || QVRCameraDevice_Start(cam) != QVR_CAM_SUCCESS || sched.attach(cam) != QVR_CAM_SUCCESS) {
+        fprintf(stderr, "attach/start %s failed\n", name);
+        return 1;
+    }
+    FrameViews::Layout layout = FrameViews::query_layout(cam);
+
+    int failures = 0;
+    uint32_t image_w = 0;
+    int32_t next_fn = 0;
+    for (int phase = 0; phase < 2; phase++) {
+        bool cropping = phase == 1;
+        int still = -1, moving = -1;
+        RoiScheduler::Rect sweep = { 40, 120, 160, 120 };
+        if (cropping) {
+            still = sched.add({ 960, 300, 128, 96 });
+            moving = sched.add(sweep);
+        }
+        uint64_t frames = 0, missing = 0, bytes = 0;
+        RoiScheduler::Stats base = sched.stats();
+        Samples read;
+        int dx = 4;
+        int64_t end = now_ns() + seconds * 1000000000LL;
+        while (now_ns() < end) {
+            int32_t fn = next_fn;
+            qvrcamera_frame_t frame;
+            if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE,
+                                         &frame) != QVR_CAM_SUCCESS) {
+                failures++;
+                break;
+            }
+            next_fn = fn + 1;
+            RoiScheduler::Mapping m;
+            bool known = sched.on_frame(frame, &m);
+            if (known && image_w == 0 && m.num_crops == 0)
+                image_w = frame.width / layout.images;
+            if (known && frames++ > 0) {
+                // what a consumer pulling the whole buffer pays
+                uint64_t sum = 0;
+                int64_t t0 = now_ns();
+                for (uint32_t i = 0; i < frame.len; i += 8)
+                    sum += *(const uint64_t*) (frame.buffer + i);
+                read.add((double) (now_ns() - t0));
+                do_not_optimize(sum);
+                bytes += frame.len;
+            }
+            for (int id : { still, moving }) {
+                ImageView v;
+                if (id < 0)
+                    continue;
+                if (!known || !sched.roi_view(frame, m, id, &v))
+                    missing++;
+            }
+            QVRCameraDevice_ReleaseFrame(cam, fn);
+            if (moving >= 0) {
+                // back and forth across the left image
+                if (sweep.x + sweep.width + dx > image_w || (int) sweep.x + dx < 0)
+                    dx = -dx;
+                sweep.x += dx;
+                sched.move(moving, sweep);
+            }
+        }
+        RoiScheduler::Stats st = sched.stats();
+        printf("%-12s %4llu frames | %3llu crop updates, %llu unknown, %llu regions missing | %7.0f bytes/frame\n",
+               cropping ? "crops" : "whole frames", (unsigned long long) frames,
+               (unsigned long long) (st.updates - base.updates),
+               (unsigned long long) (st.unknown_frames - base.unknown_frames), (unsigned long long) missing,
+               frames > 1 ? (double) bytes / (frames - 1) : 0.0);
+        read.report("  read whole buffer");
+        if (st.errors != base.errors || image_w == 0)
+            failures++;
+        if (still >= 0)
+            sched.remove(still);
+        if (moving >= 0)
+            sched.remove(moving);
+    }
+    sched.detach();
+    QVRCameraDevice_Stop(cam);
+    QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+    return failures != 0 ? 1 : 0;
+}
+
+static int bench_streams(int argc, char** argv)
+{
+    int seconds = arg_int(argc, argv, "-s", 3);
+    int workers = arg_int(argc, argv, "--workers", 1);
+    if (seconds <= 0 || workers <= 0)
+        return 1;
+
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+    mock_lib = client->libHandle;
+    auto frames_lost = MOCK_FN(qvrcammock_frames_lost);
+
+    int failures = 0;
+    YuvOps yuv;
+    for (const char* name : { QVRSERVICE_CAMERA_NAME_TRACKING, QVRSERVICE_CAMERA_NAME_DEPTH }) {
+        CameraStreams::Config config;
+        config.workers = (uint32_t) workers;
+        CameraStreams streams(config);
+        if (streams.attach(client, name) != QVR_CAM_SUCCESS) {
+            fprintf(stderr, "attach %s failed\n", name);
+            failures++;
+            continue;
+        }
+        bool depth = strcmp(name, QVRSERVICE_CAMERA_NAME_DEPTH) == 0;
+        uint32_t qw = 0, qh = 0;
+        streams.frame_size(CameraStreams::RES_QUARTER, &qw, &qh);
+        uint32_t bpp = depth ? 2 : 1;
+
+        // the full frames downscaled on the CPU, as low res consumers did
+        std::vector<uint8_t> scaled((size_t) qw * qh * bpp);
+        Samples cpu;
+        uint64_t size_errors = 0;
+        streams.add_consumer(CameraStreams::RES_FULL, [&](const CameraStreams::FrameHandle& h) {
+            const qvrcamera_frame_t& f = h.frame();
+            if (f.width != qw * 2 || f.height != qh * 2) {
+                size_errors++;
+                return;
+            }
+            int64_t t0 = now_ns();
+            if (depth) {
+                // the top left sample of every 2x2 block
+                for (uint32_t y = 0; y < qh; y++) {
+                    const uint16_t* src = (const uint16_t*) (h.data() + (size_t) 2 * y * f.stride);
+                    uint16_t* dst = (uint16_t*) scaled.data() + (size_t) y * qw;
+                    for (uint32_t x = 0; x < qw; x++)
+                        dst[x] = src[2 * x];
+                }
+            } else {
+                Plane src = { (uint8_t*) h.data(), f.width, f.height, f.stride };
+                Plane dst = { scaled.data(), qw, qh, qw };
+                yuv.downscale(src, dst, 2, YuvOps::FILTER_BOX);
+            }
+            cpu.add((double) (now_ns() - t0));
+        });
+        streams.add_consumer(CameraStreams::RES_QUARTER, [&](const CameraStreams::FrameHandle& h) {
+            const qvrcamera_frame_t& f = h.frame();
+            if (f.width != qw || f.height != qh)
+                size_errors++;
+        });
+
+        uint64_t lost = frames_lost(name);
+        if (!streams.start()) {
+            fprintf(stderr, "start %s streams failed\n", name);
+            failures++;
+            continue;
+        }
+        usleep((useconds_t) seconds * 1000000);
+        streams.stop();
+        lost = frames_lost(name) - lost;
+
+        printf("%-9s %u workers, quarter %ux%u | %llu lost at the camera\n", name, (unsigned) workers, qw, qh,
+               (unsigned long long) lost);
+        for (int r = 0; r < CameraStreams::RES_COUNT; r++) {
+            CameraStreams::Resolution res = (CameraStreams::Resolution) r;
+            CameraStreams::Stats st = streams.stats(res);
+            printf("  %-8s %4llu frames, %5.2f%% dropped, %5.2f early polls/frame, %llu stalls, %llu errors\n",
+                   CameraStreams::resolution_name(res), (unsigned long long) st.frames, 100.0 * st.drop_rate(),
+                   st.frames ? (double) st.early_polls / st.frames : 0.0, (unsigned long long) st.stalls,
+                   (unsigned long long) st.errors);
+            if (st.errors != 0 || st.frames < (uint64_t) seconds * 20)
+                failures++;
+        }
+        cpu.report("  cpu 2x2 downscale of a full frame");
+        if (size_errors != 0)
+            failures++;
+        streams.close();
+    }
+    QVRCameraClient_Destroy(client);
+    return failures != 0 ? 1 : 0;
+}
+
+// DepthOps on depth frames of the mock: back projection with both kernels
+// and over --threads, hole filling and the temporal median. The outputs are
+// checked by qvrtest.
+static int bench_depth(int argc, char** argv)
+{
+    int frames = arg_int(argc, argv, "-n", 30);
+    int threads = arg_int(argc, argv, "--threads", 4);
+    if (frames < 5 || threads <= 0)
+        return 1;
+    int failures = 0;
+
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+
+    // depth frames off the mock, copied so they outlive the frame
+    const char* name = QVRSERVICE_CAMERA_NAME_DEPTH;
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    XrIntrinsicCalibrationQTI cal;
+    if (cam == NULL || QVRCameraDevice_Start(cam) != QVR_CAM_SUCCESS ||
+        LensModel::query(cam, 0, &cal) != QVR_CAM_SUCCESS) {
+        fprintf(stderr, "attach/start %s failed\n", name);
+        QVRCameraClient_Destroy(client);
+        return 1;
+    }
+    uint32_t w = 0, h = 0;
+    std::vector<std::vector<uint16_t>> depth;
+    int32_t next_fn = 0;
+    while ((int) depth.size() < frames) {
+        int32_t fn = next_fn;
+        qvrcamera_frame_t frame;
+        if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &frame) !=
+            QVR_CAM_SUCCESS)
+            break;
+        w = frame.width;
+        h = frame.height;
+        std::vector<uint16_t> d((size_t) w * h);
+        for (uint32_t y = 0; y < h; y++)
+            memcpy(&d[(size_t) y * w], (const uint8_t*) frame.buffer + (size_t) y * frame.stride, (size_t) w * 2);
+        depth.push_back(std::move(d));
+        QVRCameraDevice_ReleaseFrame(cam, fn);
+        next_fn = fn + 1;
+    }
+    QVRCameraDevice_Stop(cam);
+    QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+    if ((int) depth.size() < frames) {
+        fprintf(stderr, "%s GetFrame failed\n", name);
+        return 1;
+    }
+    auto view_of = [&](const std::vector<uint16_t>& d) {
+        ImageView v;
+        memset(&v, 0, sizeof(v));
+        v.data = (const uint8_t*) d.data();
+        v.width = w;
+        v.height = h;
+        v.pitch = w * 2;
+        v.format = QVRCAMERA_FRAME_FORMAT_DEPTH16;
+        return v;
+    };
+    LensModel lens = LensModel(cal).scaled(w, h);
+    printf("%-12s %ux%u model %d, %d frames\n", name, w, h, (int) cal.distortionModel, frames);
+
+    // back projection
+    struct Variant {
+        const char* name;
+        int threads;
+        DepthOps::Kernel kernel;
+    };
+    const Variant variants[] = {
+        { "back_project scalar", 1, DepthOps::KERNEL_SCALAR },
+        { "back_project simd", 1, DepthOps::KERNEL_SIMD },
+        { "back_project simd threads", threads, DepthOps::KERNEL_SIMD },
+    };
+    for (const Variant& var : variants) {
+        DepthOps ops(var.threads);
+        ops.set_kernel(var.kernel);
+        int64_t t0 = now_ns();
+        ops.set_lens(lens);
+        double rays_ms = (double) (now_ns() - t0) / 1e6;
+        std::vector<uint8_t> mem(DepthOps::cloud_size(w * h));
+        XrPointCloudQTI* cloud = (XrPointCloudQTI*) mem.data();
+        Samples t;
+        for (int i = 0; i < frames; i++) {
+            memset(mem.data(), 0, mem.size());
+            cloud->maxPoints = w * h;
+            int64_t t1 = now_ns();
+            if (!ops.back_project(view_of(depth[i]), cloud))
+                failures++;
+            t.add((double) (now_ns() - t1));
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "%s x%d", var.name, var.threads);
+        t.report(label);
+        printf("  %u points, rays %.1f ms\n", cloud->numPoints, rays_ms);
+    }
+
+    // hole filling
+    DepthOps one(1), pool(threads);
+    std::vector<uint16_t> filled((size_t) w * h);
+    Samples t_one, t_pool;
+    int64_t fills = 0;
+    for (int i = 0; i < frames; i++) {
+        int64_t t0 = now_ns();
+        fills += one.fill_holes(view_of(depth[i]), filled.data(), w * 2);
+        t_one.add((double) (now_ns() - t0));
+        t0 = now_ns();
+        pool.fill_holes(view_of(depth[i]), filled.data(), w * 2);
+        t_pool.add((double) (now_ns() - t0));
+    }
+    t_one.report("fill_holes x1");
+    char label[64];
+    snprintf(label, sizeof(label), "fill_holes x%d", threads);
+    t_pool.report(label);
+    printf("  %.0f holes filled per frame\n", (double) fills / frames);
+
+    // temporal median
+    for (uint32_t window : { 3u, 5u }) {
+        DepthOps::Config config;
+        config.median_frames = window;
+        DepthOps scalar(1, config), simd(threads, config);
+        scalar.set_kernel(DepthOps::KERNEL_SCALAR);
+        std::vector<uint16_t> out((size_t) w * h);
+        Samples t_scalar, t_simd;
+        for (int i = 0; i < frames; i++) {
+            int64_t t0 = now_ns();
+            scalar.median(view_of(depth[i]), out.data(), w * 2);
+            t_scalar.add((double) (now_ns() - t0));
+            t0 = now_ns();
+            simd.median(view_of(depth[i]), out.data(), w * 2);
+            t_simd.add((double) (now_ns() - t0));
+        }
+        snprintf(label, sizeof(label), "median%u scalar x1", window);
+        t_scalar.report(label);
+        snprintf(label, sizeof(label), "median%u simd x%d", window, threads);
+        t_simd.report(label);
+    }
+    return failures != 0 ? 1 : 0;
+}
+
+// UndistortMap builds for every distortion model, then UndistortCache on the
+// tracking camera: the first start against a later one that loads the maps,
+// and update() and remap() per frame with a recalibration half way. The maps
+// and the cache themselves are checked by qvrtest.
+static int bench_undistort(int argc, char** argv)
+{
+    int frames = arg_int(argc, argv, "-n", 60);
+    // the recalibration lands half way, after a few frames
+    if (frames < 10) {
+        fprintf(stderr, "undistort: -n needs at least 10 frames\n");
+        return 1;
+    }
+    int failures = 0;
+
+    const XrDistortionModelQTI models[] = {
+        XR_DISTORTION_MODEL_QTI_LINEAR,          XR_DISTORTION_MODEL_QTI_RADIAL_2_PARAMS,
+        XR_DISTORTION_MODEL_QTI_RADIAL_3_PARAMS, XR_DISTORTION_MODEL_QTI_RADIAL_6_PARAMS,
+        XR_DISTORTION_MODEL_QTI_FISHEYE_1_PARAM, XR_DISTORTION_MODEL_QTI_FISHEYE_4_PARAMS,
+    };
+    const double radial[][6] = {
+        {}, { -0.1, 0.02 }, { -0.12, 0.05, -0.01 }, { 0.3, 0.1, 0.01, 0.35, 0.12, 0.015 }, { 0.9 },
+        { 0.02, -0.005, 0.001, -0.0002 },
+    };
+    for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+        XrIntrinsicCalibrationQTI cal;
+        memset(&cal, 0, sizeof(cal));
+        cal.size.width = 640;
+        cal.size.height = 480;
+        cal.principalPoint.x = 319.5;
+        cal.principalPoint.y = 239.5;
+        cal.focalLength.x = 400.0;
+        cal.focalLength.y = 400.0;
+        memcpy(cal.radialDistortion, radial[i], sizeof(radial[i]));
+        cal.distortionModel = models[i];
+        UndistortMap m;
+        int64_t t0 = now_ns();
+        if (!m.build(LensModel(cal), UndistortMap::pinhole(cal, 1.0), NULL))
+            failures++;
+        printf("lens model %d: build %.1f ms, %u pixels off the lens\n", (int) models[i],
+               (double) (now_ns() - t0) / 1e6, m.outside());
+    }
+
+    char dir[] = "/tmp/qvrbench-undistort-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client == NULL) {
+        fprintf(stderr, "QVRCameraClient_Create failed, is the mock camera client on LD_LIBRARY_PATH?\n");
+        return 1;
+    }
+    mock_lib = client->libHandle;
+    auto set_calibration = MOCK_FN(qvrcammock_set_calibration);
+
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    if (cam == NULL || QVRCameraDevice_Start(cam) != QVR_CAM_SUCCESS) {
+        fprintf(stderr, "attach/start %s failed\n", name);
+        QVRCameraClient_Destroy(client);
+        return 1;
+    }
+
+    // the first start builds and saves the maps, later ones load them
+    UndistortCache::Config config;
+    config.dir = dir;
+    std::vector<uint64_t> keys;
+    double start_ms[2];
+    UndistortCache::Stats start_stats[2];
+    for (int run = 0; run < 2; run++) {
+        UndistortCache cache(config);
+        int64_t t0 = now_ns();
+        if (cache.attach(cam) != QVR_CAM_SUCCESS)
+            failures++;
+        for (uint32_t i = 0; i < cache.images(); i++) {
+            std::shared_ptr<const UndistortMap> m = cache.map(i);
+            if (m == NULL)
+                failures++;
+            else if (run == 0)
+                keys.push_back(m->key());
+        }
+        start_ms[run] = (double) (now_ns() - t0) / 1e6;
+        start_stats[run] = cache.stats();
+    }
+    printf("%-12s %zu images, first start %.1f ms (%llu built, %llu saved), next %.1f ms (%llu loaded, %llu built)\n",
+           name, keys.size(), start_ms[0], (unsigned long long) start_stats[0].builds,
+           (unsigned long long) start_stats[0].saves, start_ms[1], (unsigned long long) start_stats[1].loads,
+           (unsigned long long) start_stats[1].builds);
+    if (keys.empty())
+        failures++;
+
+    // frames through GetFrameEx() with their calibration; halfway the left
+    // lens gets recalibrated
+    UndistortCache cache(config);
+    cache.attach(cam);
+    XrCameraSensorCalibrationQTI calibrations[UndistortCache::MAX_IMAGES];
+    XrCameraFrameCalibrationInfoOutputQTI cal_out;
+    memset(&cal_out, 0, sizeof(cal_out));
+    cal_out.type = XR_TYPE_QTI_CAM_FRAME_CALIBRATION_INFO;
+    XrCameraFrameBufferOutputQTI buffer;
+    XrCameraFrameRequestInfoInputQTI in;
+    in.type = XR_TYPE_QTI_CAM_FRAME_REQ_INFO_INPUT;
+    in.next = NULL;
+    in.blockMode = XR_CAMERA_BLOCK_MODE_QTI_BLOCKING;
+    in.dropMode = XR_CAMERA_DROP_MODE_QTI_NEWER_IF_AVAILABLE;
+    XrIntrinsicCalibrationQTI recalibrated;
+    if (LensModel::query(cam, 0, &recalibrated) != QVR_CAM_SUCCESS)
+        failures++;
+    recalibrated.focalLength.x *= 1.02;
+    recalibrated.focalLength.y *= 1.02;
+    recalibrated.principalPoint.x += 3.0;
+
+    uint32_t images = cache.images();
+    std::vector<uint8_t> out_img;
+    Samples t_scalar, t_simd, t_update;
+    uint32_t next_fn = 0;
+    for (int n = 0; n < frames; n++) {
+        if (n == frames / 2)
+            set_calibration(name, 0, &recalibrated);
+        cal_out.calibrationCapacityIn = UndistortCache::MAX_IMAGES;
+        cal_out.calibrations = calibrations;
+        XrCameraFrameRequestInfoOutputQTI out;
+        memset(&out, 0, sizeof(out));
+        out.type = XR_TYPE_QTI_CAM_FRAME_REQ_INFO_OUTPUT;
+        out.next = (XrBaseStructQTI*) &cal_out;
+        out.bufferInfo.bufferCapacityIn = 1;
+        out.bufferInfo.buffers = &buffer;
+        in.frameNum = (int) next_fn;
+        if (QVRCameraDevice_GetFrameEx(cam, &in, &out) != QVR_CAM_SUCCESS) {
+            failures++;
+            break;
+        }
+        next_fn = out.frameNum + 1;
+
+        int64_t t0 = now_ns();
+        cache.update(cal_out);
+        t_update.add((double) (now_ns() - t0));
+
+        for (uint32_t i = 0; i < images; i++) {
+            std::shared_ptr<const UndistortMap> m = cache.map(i);
+            if (m == NULL) {
+                failures++;
+                continue;
+            }
+            uint32_t image_w = m->source_width(), image_h = m->source_height();
+            out_img.resize((size_t) image_w * image_h);
+            ImageView v;
+            memset(&v, 0, sizeof(v));
+            v.data = (const uint8_t*) buffer.bufVAddr + i * image_w;
+            v.width = image_w;
+            v.height = image_h;
+            v.pitch = buffer.stride;
+            v.format = buffer.format;
+            t0 = now_ns();
+            m->remap(v, out_img.data(), image_w, UndistortMap::KERNEL_SCALAR);
+            t_scalar.add((double) (now_ns() - t0));
+            t0 = now_ns();
+            m->remap(v, out_img.data(), image_w, UndistortMap::KERNEL_SIMD);
+            t_simd.add((double) (now_ns() - t0));
+        }
+        QVRCameraDevice_ReleaseFrame(cam, (int32_t) out.frameNum);
+    }
+    QVRCameraDevice_Stop(cam);
+    QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+
+    t_update.report("update() per frame");
+    t_scalar.report("remap scalar per image");
+    t_simd.report("remap simd per image");
+    printf("  %llu invalidations\n", (unsigned long long) cache.stats().invalidations);
+
+    // only the factory maps were saved
+    for (uint64_t key : keys)
+        unlink(cache.path_of(key).c_str());
+    rmdir(dir);
+    return failures != 0 ? 1 : 0;
+}
+
+// Clouds from the mock's growing map merged into a PointCloudMap, checked
+// against every position seen; a consumer copy kept by export_changes() has
+// to equal the map, and costs what it exports against re-copying the map
+// every cloud. export_voxels() is checked against a plain grouping.
+static int bench_pointcloud(int argc, char** argv)
+{
+    int clouds = arg_int(argc, argv, "-n", 200);
+    if (clouds <= 0) {
+        fprintf(stderr, "pointcloud: -n needs at least one cloud\n");
+        return 1;
+    }
+
+    qvrservice_client_helper_t* client = start_client();
+    if (client == NULL)
+        return 1;
+    MOCK_FN(qvrmock_set_point_cloud)(200, 2000, 20000);
+
+    PointCloudMap map;
+    const float min_move = map.config().min_move;
+    std::unordered_map<uint32_t, XrVector3fQTI> latest;
+    std::unordered_map<uint32_t, XrVector3fQTI> copy;
+    std::vector<XrMapPointQTI> changes;
+    Samples t_merge, t_export;
+    uint64_t since = 0, exported = 0, recopied = 0;
+    int failures = 0;
+    for (int n = 0; n < clouds; n++) {
+        XrPointCloudQTI* cloud = NULL;
+        if (QVRServiceClient_GetPointCloud(client, &cloud) != QVR_SUCCESS || cloud == NULL) {
+            failures++;
+            break;
+        }
+        int64_t t0 = now_ns();
+        map.merge(*cloud);
+        t_merge.add((double) (now_ns() - t0) / std::max(cloud->numPoints, 1u));
+        for (uint32_t i = 0; i < cloud->numPoints; i++)
+            latest[cloud->points[i].id] = cloud->points[i].position;
+        if (QVRServiceClient_ReleasePointCloud(client, cloud) != QVR_SUCCESS)
+            failures++;
+
+        changes.clear();
+        t0 = now_ns();
+        since = map.export_changes(since, &changes);
+        t_export.add((double) (now_ns() - t0));
+        for (const XrMapPointQTI& p : changes)
+            copy[p.id] = p.position;
+        exported += changes.size();
+        recopied += map.size();
+    }
+
+    // every id in the map, each within min_move of where it was seen last
+    uint32_t far = 0;
+    for (const std::pair<const uint32_t, XrVector3fQTI>& e : latest) {
+        XrVector3fQTI p;
+        if (!map.find(e.first, &p)) {
+            far++;
+            continue;
+        }
+        float dx = p.x - e.second.x, dy = p.y - e.second.y, dz = p.z - e.second.z;
+        if (sqrtf(dx * dx + dy * dy + dz * dz) > min_move * 1.001f)
+            far++;
+    }
+    uint32_t differ = 0;
+    double truth_error = 0.0;
+    for (const std::pair<const uint32_t, XrVector3fQTI>& e : copy) {
+        XrVector3fQTI p;
+        if (!map.find(e.first, &p) || p.x != e.second.x || p.y != e.second.y || p.z != e.second.z)
+            differ++;
+        float xyz[3];
+        MOCK_FN(qvrmock_map_point)(e.first, xyz);
+        truth_error += sqrt((double) (p.x - xyz[0]) * (p.x - xyz[0]) + (double) (p.y - xyz[1]) * (p.y - xyz[1]) +
+                            (double) (p.z - xyz[2]) * (p.z - xyz[2]));
+    }
+    if (!copy.empty())
+        truth_error /= (double) copy.size();
+
+    std::vector<XrMapPointQTI> voxels;
+    Samples t_voxels;
+    for (int i = 0; i < 20; i++) {
+        int64_t t0 = now_ns();
+        map.export_voxels(&voxels);
+        t_voxels.add((double) (now_ns() - t0));
+    }
+    std::unordered_map<uint64_t, uint32_t> cells;
+    const float inv_size = 1.0f / map.config().voxel_size;
+    for (const std::pair<const uint32_t, XrVector3fQTI>& e : copy) {
+        uint64_t kx = (uint64_t) (int64_t) floor((double) e.second.x * inv_size) & 0xfffff;
+        uint64_t ky = (uint64_t) (int64_t) floor((double) e.second.y * inv_size) & 0xfffff;
+        uint64_t kz = (uint64_t) (int64_t) floor((double) e.second.z * inv_size) & 0xfffff;
+        cells[kx | ky << 20 | kz << 40]++;
+    }
+
+    // the checks above are against the clouds merged so far; fetch() may
+    // bring points of a newer one
+    uint32_t points = map.size();
+    PointCloudMap::Stats st = map.stats();
+    int32_t fetched = map.fetch(client);
+    uint32_t held = MOCK_FN(qvrmock_point_clouds_held)();
+    QVRServiceClient_Destroy(client);
+
+    t_merge.report("merge() per point");
+    t_export.report("export_changes() per cloud");
+    t_voxels.report("export_voxels()");
+    printf("  %u points (%zu seen), %llu added %llu moved, %u off their last position, %u differ in the copy\n",
+           points, latest.size(), (unsigned long long) st.added, (unsigned long long) st.moved, far, differ);
+    printf("  exported %llu points vs %llu re-copying (%.1f%%), %zu voxels (%zu expected), error to truth %.4f m\n",
+           (unsigned long long) exported, (unsigned long long) recopied,
+           recopied != 0 ? 100.0 * (double) exported / (double) recopied : 0.0, voxels.size(), cells.size(),
+           truth_error);
+    printf("  fetch() %d, %u clouds held\n", fetched, held);
+    if (points != latest.size() || far != 0 || differ != 0 || copy.size() != points ||
+        voxels.size() != cells.size() || fetched != QVR_SUCCESS || held != 0 ||
+        map.stats().errors != 0)
+        failures++;
+    return failures != 0 ? 1 : 0;
+}
+
+struct Bench {
+    const char* name;
+    int (*run)(int argc, char** argv);
+    const char* usage;
+};
+
+static const Bench benches[] = {
+    { "recovery", bench_recovery, "[-n N] [--start-latency-us US] [--start-failures K]" },
+    { "pose-read", bench_pose_read, "[-n BATCHES]" },
+    { "late-latch", bench_late_latch, "[-s SECONDS] [--rate-hz HZ]" },
+    { "predict", bench_predict, "[-n BATCHES] [--batch TARGETS]" },
+    { "history", bench_history, "[-s SECONDS] [-n LOOKUPS]" },
+    { "clock", bench_clock, "[-s SECONDS] [--drift-ppb PPB] [--interval-ms MS]" },
+    { "log", bench_log, "[-n COUNT] [--sink-delay-us US] [--gap-us US]" },
+    { "broker", bench_broker, "[-n N] [--start-latency-us US]" },
+    { "watchdog", bench_watchdog, "[-n N] [--tracking-init-ms MS]" },
+    { "eye", bench_eye, "[-n BATCHES] [-s SECONDS] [--read-hz HZ] [--eye-hz HZ]" },
+    { "gaze", bench_gaze, "[-s SECONDS] [--rate-hz HZ] [--noise-mdeg MDEG] [--batch N] [-n BATCHES]" },
+    { "camera", bench_camera, "[-s SECONDS] [--hold FRAMES] [--work-us US]" },
+    { "raw", bench_raw, "[--width W] [--height H] [-n FRAMES]" },
+    { "yuv", bench_yuv, "[--width W] [--height H] [--threads N] [-n FRAMES]" },
+    { "frames", bench_frames, "[-n FRAMES]" },
+    { "partial", bench_partial, "[-s SECONDS] [--bands N]" },
+    { "share", bench_share, "[-s SECONDS] [--peers N] [--work-us US]" },
+    { "exposure", bench_exposure, "[-s SECONDS] [-n FRAMES]" },
+    { "roi", bench_roi, "[-s SECONDS] [-n SETS]" },
+    { "streams", bench_streams, "[-s SECONDS] [--workers N]" },
+    { "depth", bench_depth, "[-n FRAMES] [--threads N]" },
+    { "undistort", bench_undistort, "[-n FRAMES]" },
+    { "pointcloud", bench_pointcloud, "[-n CLOUDS]" },
+};
+
+int main(int argc, char** argv)
+{
+    if (argc >= 2) {
+        for (const Bench& b : benches) {
+            if (strcmp(argv[1], b.name) == 0) {
+                __log_func = quiet_log;
+                return b.run(argc - 2, argv + 2);
+            }
+        }
+    }
+
+    fprintf(stderr, "usage: %s <bench> [options]\n", argv[0]);
+    for (const Bench& b : benches)
+        fprintf(stderr, "  %-12s %s\n", b.name, b.usage);
+    return 1;
+}
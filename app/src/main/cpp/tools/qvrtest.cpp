@@ -0,0 +1,2399 @@
+// Correctness checks of the holder components, run by ctest against the mock
+// libqvrservice_client.so / libqvrcamera_client.so; nothing here is timed,
+// qvrbench has the numbers:
+//   LD_LIBRARY_PATH=<build dir> qvrtest [filter]
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "mock/qvrservice_mock.h"
+#include "mock/qvrcamera_mock.h"
+#include "tools/test_util.h"
+#include "holder_log.h"
+#include "async_log.h"
+#include "event_loop.h"
+#include "vrmode_holder.h"
+#include "vrmode_broker.h"
+#include "vrmode_broker_client.h"
+#include "clock_domain.h"
+#include "time_util.h"
+#include "pose/pose_log.h"
+#include "pose/pose_ring_reader.h"
+#include "pose/predicted_pose_reader.h"
+#include "pose/pose_predictor.h"
+#include "pose/pose_history.h"
+#include "pose/point_cloud_map.h"
+#include "eye/eye_pose_stream.h"
+#include "eye/gaze_filter.h"
+#include "camera/camera_pipeline.h"
+#include "camera/raw_unpacker.h"
+#include "camera/yuv_ops.h"
+#include "camera/frame_views.h"
+#include "camera/partial_frame_reader.h"
+#include "camera/frame_share_service.h"
+#include "camera/frame_share_client.h"
+#include "camera/auto_exposure.h"
+#include "camera/roi_scheduler.h"
+#include "camera/camera_streams.h"
+#include "camera/lens_model.h"
+#include "camera/depth_ops.h"
+#include "camera/undistort_map.h"
+#include "camera/undistort_cache.h"
+
+#define MOCK_FN(name) ((decltype(&name)) mock_symbol(#name))
+
+// the mock library of the client created last, service or camera
+static void* mock_lib = NULL;
+
+static void* mock_symbol(const char* name)
+{
+    void* sym = mock_lib != NULL ? dlsym(mock_lib, name) : NULL;
+    if (sym == NULL) {
+        fprintf(stderr, "%s not found, is the mock client library on LD_LIBRARY_PATH?\n", name);
+        exit(1);
+    }
+    return sym;
+}
+
+static int quiet_log(int prio, const char* tag, const char* fmt, ...)
+{
+    if (prio < ANDROID_LOG_WARN)
+        return 0;
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: ", tag);
+    int res = vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    return res;
+}
+
+// polls cond every millisecond until it holds, for up to timeout_ms
+template <typename Cond>
+static bool wait_for(Cond cond, int timeout_ms)
+{
+    for (int i = 0; i < timeout_ms; i++) {
+        if (cond())
+            return true;
+        usleep(1000);
+    }
+    return cond();
+}
+
+// a client with VR mode started and poses in the ring
+static qvrservice_client_helper_t* start_client()
+{
+    qvrservice_client_helper_t* client = QVRServiceClient_Create();
+    if (client == NULL)
+        return NULL;
+    mock_lib = client->libHandle;
+    QVRServiceClient_StartVRMode(client);
+    qvrservice_head_tracking_data_t* pose = NULL;
+    for (int i = 0; i < 2000; i++) {
+        if (QVRServiceClient_GetHeadTrackingData(client, &pose) == QVR_SUCCESS && pose != NULL && pose->ts != 0)
+            break;
+        usleep(1000);
+    }
+    return client;
+}
+
+static void make_pose(int64_t ts, double t, qvrservice_head_tracking_data_t* pose)
+{
+    memset(pose, 0, sizeof(*pose));
+    pose->ts = (uint64_t) ts;
+    // turning about y, moving along x
+    pose->rotation[1] = (float) sin(t * 0.25);
+    pose->rotation[3] = (float) cos(t * 0.25);
+    pose->translation[0] = (float) (0.1 * t);
+    pose->translation[2] = -0.5f;
+    pose->tracking_state = 2;
+}
+
+static std::string temp_path(const char* name)
+{
+    const char* dir = getenv("TMPDIR");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/qvrtest-%d-%s", dir != NULL ? dir : "/tmp", (int) getpid(), name);
+    return path;
+}
+
+// the holder starts VR mode again after another client stopped it, also
+// when its first StartVRMode calls fail
+TEST(VrModeHolder, RestartsAfterExternalStop)
+{
+    EventLoop loop;
+    VrModeHolder holder(loop);
+    ASSERT_TRUE(holder.start());
+    mock_lib = holder.client()->libHandle;
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    qvrservice_client_helper_t* observer = QVRServiceClient_Create();
+    auto started = [&]() { return observer != NULL && QVRServiceClient_GetVRMode(observer) == VRMODE_STARTED; };
+    EXPECT_TRUE(wait_for(started, 2000));
+    for (uint32_t failures : { 0u, 3u }) {
+        if (failures != 0)
+            MOCK_FN(qvrmock_fail_next)(QVRMOCK_OP_START_VRMODE, failures, QVR_ERROR);
+        MOCK_FN(qvrmock_set_vrmode)(VRMODE_STOPPED);
+        EXPECT_TRUE(wait_for(started, 2000));
+    }
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    EXPECT_EQ(holder.restart_count(), 2u);
+    if (observer != NULL)
+        QVRServiceClient_Destroy(observer);
+    holder.stop();
+}
+
+TEST(PoseRing, ReadsLatestAndBack)
+{
+    qvrservice_client_helper_t* client = start_client();
+    ASSERT_TRUE(client != NULL);
+    PoseRingReader reader;
+    ASSERT_EQ(reader.open(client, RING_BUFFER_POSE), QVR_SUCCESS);
+    EXPECT_EQ(reader.ring_id(), RING_BUFFER_POSE);
+    EXPECT_TRUE(reader.capacity() > 16);
+
+    // a still ring: every step back is the next older sample
+    EXPECT_TRUE(wait_for([&]() { return reader.latest_index() > 16; }, 2000));
+    MOCK_FN(qvrmock_set_pose_rate)(0);
+    usleep(10 * 1000);
+    qvrservice_head_tracking_data_t latest;
+    EXPECT_TRUE(reader.read_latest(&latest));
+    XrFramePoseQTI frame;
+    EXPECT_FALSE(reader.read_latest(&frame));
+    uint64_t prev_ts = latest.ts;
+    int walked = 0;
+    for (uint32_t back = 1; back < 16; back++) {
+        qvrservice_head_tracking_data_t pose;
+        if (!reader.read_back(back, &pose))
+            break;
+        EXPECT_TRUE(pose.ts < prev_ts);
+        prev_ts = pose.ts;
+        walked++;
+    }
+    EXPECT_EQ(walked, 15);
+    EXPECT_EQ(reader.torn_reads(), 0u);
+    MOCK_FN(qvrmock_set_pose_rate)(1000);
+
+    reader.close();
+    EXPECT_FALSE(reader.is_open());
+    QVRServiceClient_Destroy(client);
+}
+
+TEST(PoseRing, WalkBackFromSnapshot)
+{
+    qvrservice_client_helper_t* client = start_client();
+    ASSERT_TRUE(client != NULL);
+    PoseRingReader reader;
+    ASSERT_EQ(reader.open(client, RING_BUFFER_POSE), QVR_SUCCESS);
+
+    // one snapshot of the index while the writer runs: every step back is
+    // an older sample
+    uint32_t index = reader.latest_index();
+    uint64_t prev_ts = 0;
+    int walked = 0;
+    for (uint32_t back = 0; back < 16; back++) {
+        qvrservice_head_tracking_data_t pose;
+        if (!reader.read_back(index, back, &pose))
+            break;
+        if (back != 0)
+            EXPECT_TRUE(pose.ts < prev_ts);
+        prev_ts = pose.ts;
+        walked++;
+    }
+    EXPECT_TRUE(walked > 0);
+    qvrservice_head_tracking_data_t pose;
+    EXPECT_FALSE(reader.read_back(index, reader.capacity(), &pose));
+
+    reader.close();
+    QVRServiceClient_Destroy(client);
+}
+
+TEST(PredictedPose, ConsistentSlot)
+{
+    qvrservice_client_helper_t* client = start_client();
+    ASSERT_TRUE(client != NULL);
+    PredictedPoseReader reader;
+    ASSERT_EQ(reader.open(client), QVR_SUCCESS);
+
+    int16_t slot = -1;
+    ASSERT_EQ(reader.activate(&slot, now_ns() + 500000000LL), QVR_SUCCESS);
+    EXPECT_TRUE(slot >= 0);
+    usleep(20 * 1000);
+
+    qvrservice_predicted_head_tracking_data_t copy;
+    ASSERT_TRUE(reader.read(slot, &copy));
+    EXPECT_NE(copy.slot_status, QVRSERVICE_LATE_LATCHING_SLOT_UNUSED);
+    EXPECT_EQ(copy.start, copy.end);
+    // a rotation with no scale, and the last row of a rigid transform
+    const float* m = copy.curPredictedPoseMat44F;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            float dot = m[i * 4] * m[j * 4] + m[i * 4 + 1] * m[j * 4 + 1] + m[i * 4 + 2] * m[j * 4 + 2];
+            EXPECT_NEAR(dot, i == j ? 1.0 : 0.0, 1e-5);
+        }
+    }
+    EXPECT_EQ(m[15], 1.0f);
+
+    float mat[16];
+    EXPECT_TRUE(reader.read_pose(slot, mat));
+    EXPECT_FALSE(reader.read(-2, &copy));
+    EXPECT_FALSE(reader.read(30000, &copy));
+
+    reader.close();
+    QVRServiceClient_Destroy(client);
+}
+
+TEST(PosePredictor, KnownMotion)
+{
+    qvrservice_head_tracking_data_t pose;
+    memset(&pose, 0, sizeof(pose));
+    pose.ts = 5000000000ULL;
+    pose.rotation[3] = 1.0f;
+    pose.translation[2] = 1.0f;
+    // 1 rad/s about y, 2 m/s along x
+    pose.prediction_coff_s[1] = 1.0f;
+    pose.prediction_coff_ts[0] = 2.0f;
+
+    PosePredictor predictor;
+    EXPECT_FALSE(predictor.valid());
+    predictor.update(pose);
+    ASSERT_TRUE(predictor.valid());
+
+    PosePrediction p;
+    ASSERT_TRUE(predictor.predict((int64_t) pose.ts + 10000000LL, &p));
+    EXPECT_NEAR(p.rotation[0], 0.0, 1e-6);
+    EXPECT_NEAR(p.rotation[1], sin(0.005), 1e-6);
+    EXPECT_NEAR(p.rotation[2], 0.0, 1e-6);
+    EXPECT_NEAR(p.rotation[3], cos(0.005), 1e-6);
+    EXPECT_NEAR(p.translation[0], 0.02, 1e-6);
+    EXPECT_NEAR(p.translation[2], 1.0, 1e-6);
+
+    // past the horizon the prediction stops moving
+    PosePrediction at_horizon, beyond;
+    ASSERT_TRUE(predictor.predict((int64_t) pose.ts + PosePredictor::MAX_HORIZON_NS, &at_horizon));
+    ASSERT_TRUE(predictor.predict((int64_t) pose.ts + 10 * PosePredictor::MAX_HORIZON_NS, &beyond));
+    EXPECT_EQ(memcmp(&at_horizon, &beyond, sizeof(beyond)), 0);
+}
+
+TEST(PosePredictor, SimdMatchesScalar)
+{
+    qvrservice_head_tracking_data_t pose;
+    make_pose(2000000000LL, 1.0, &pose);
+    for (int i = 0; i < 3; i++) {
+        pose.prediction_coff_s[i] = 0.3f * (i + 1);
+        pose.prediction_coff_b[i] = -0.2f * i;
+        pose.prediction_coff_bdt[i] = 0.1f;
+        pose.prediction_coff_bdt2[i] = -0.05f;
+        pose.prediction_coff_ts[i] = 0.5f - i;
+        pose.prediction_coff_tb[i] = 0.25f * i;
+    }
+    PosePredictor predictor;
+    predictor.update(pose);
+
+    const int count = 19;
+    std::vector<int64_t> targets(count);
+    for (int i = 0; i < count; i++)
+        targets[i] = (int64_t) pose.ts + 60000000LL * i / count - 5000000LL;
+    std::vector<PosePrediction> scalar(count), simd(count);
+    predictor.set_kernel(PosePredictor::KERNEL_SCALAR);
+    ASSERT_TRUE(predictor.predict_batch(targets.data(), count, scalar.data()));
+    predictor.set_kernel(PosePredictor::KERNEL_SIMD);
+    ASSERT_TRUE(predictor.predict_batch(targets.data(), count, simd.data()));
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < 4; k++)
+            EXPECT_NEAR(scalar[i].rotation[k], simd[i].rotation[k], 1e-5);
+        for (int k = 0; k < 3; k++)
+            EXPECT_NEAR(scalar[i].translation[k], simd[i].translation[k], 1e-5);
+    }
+}
+
+TEST(PoseHistory, Lookup)
+{
+    PoseHistory history(64);
+    EXPECT_FALSE(history.lookup(0, NULL));
+    const int64_t t0 = 1000000000LL;
+    for (int i = 0; i < 40; i++) {
+        qvrservice_head_tracking_data_t pose;
+        make_pose(t0 + i * 1000000LL, i * 0.001, &pose);
+        history.append(pose);
+    }
+    // a gap longer than MAX_INTERP_GAP_NS
+    int64_t late = t0 + 39 * 1000000LL + 2 * PoseHistory::MAX_INTERP_GAP_NS;
+    qvrservice_head_tracking_data_t pose;
+    make_pose(late, 0.039, &pose);
+    history.append(pose);
+    // out of order samples are ignored
+    history.append(pose);
+    EXPECT_EQ(history.size(), 41u);
+
+    HistoryPose out;
+    make_pose(t0 + 10 * 1000000LL, 0.010, &pose);
+    ASSERT_TRUE(history.lookup((int64_t) pose.ts, &out));
+    EXPECT_EQ(memcmp(out.rotation, pose.rotation, sizeof(out.rotation)), 0);
+    EXPECT_EQ(memcmp(out.translation, pose.translation, sizeof(out.translation)), 0);
+
+    // halfway between two samples
+    ASSERT_TRUE(history.lookup(t0 + 10 * 1000000LL + 500000LL, &out));
+    EXPECT_NEAR(out.translation[0], 0.1 * 0.0105, 1e-6);
+    EXPECT_NEAR(out.rotation[1], sin(0.0105 * 0.25), 1e-6);
+
+    EXPECT_FALSE(history.lookup(t0 - 1, &out));
+    EXPECT_FALSE(history.lookup(late + 1, &out));
+    EXPECT_FALSE(history.lookup(late - PoseHistory::MAX_INTERP_GAP_NS, &out));
+    EXPECT_TRUE(history.lookup(late, &out));
+}
+
+TEST(PoseHistory, Wraps)
+{
+    PoseHistory history(16);
+    for (int i = 0; i < 40; i++) {
+        qvrservice_head_tracking_data_t pose;
+        make_pose(1000 + i * 1000, i * 0.001, &pose);
+        history.append(pose);
+    }
+    HistoryPose out;
+    EXPECT_EQ(history.newest_ts(), 1000 + 39 * 1000);
+    EXPECT_TRUE(history.oldest_ts() > 1000 + 20 * 1000);
+    EXPECT_FALSE(history.lookup(1000 + 20 * 1000, &out));
+    EXPECT_TRUE(history.lookup(history.oldest_ts(), &out));
+}
+
+TEST(ClockDomain, FitsOffset)
+{
+    // 20 ppm
+    ClockFit fit = { 1000000000LL, 5000, (int64_t) (20e-6 * 4294967296.0) + 1 };
+    EXPECT_EQ(fit.offset_at(1000000000LL), 5000);
+    EXPECT_EQ(fit.offset_at(2000000000LL), 5000 + 20000);
+    int64_t boot = 1500000000LL;
+    EXPECT_NEAR(fit.qtimer_to_boot(fit.boot_to_qtimer(boot)), boot, 1);
+
+    qvrservice_client_helper_t* client = start_client();
+    ASSERT_TRUE(client != NULL);
+    MOCK_FN(qvrmock_set_clock_drift_ppb)(0);
+    ClockDomain clock;
+    EXPECT_FALSE(clock.valid());
+    clock.set_service_client(client);
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(clock.sample());
+    ASSERT_TRUE(clock.valid());
+    EXPECT_EQ(clock.samples(), 4u);
+    EXPECT_EQ(clock.fit().offset_at(now_ns(CLOCK_BOOTTIME)), MOCK_FN(qvrmock_tracker_android_offset)());
+    EXPECT_NEAR(clock.drift_ppm(), 0.0, 1e-9);
+    QVRServiceClient_Destroy(client);
+}
+
+TEST(PoseLog, RoundTrip)
+{
+    std::string path = temp_path("pose.qplog");
+    const int count = 5000;
+    PoseLogWriter writer;
+    ASSERT_TRUE(writer.open(path.c_str()));
+    writer.write_tracking(POSE_LOG_CHANNEL_HEAD, 1000, 3, 1, 0.5f);
+    for (int i = 0; i < count; i++) {
+        qvrservice_head_tracking_data_t pose;
+        make_pose(1000000000LL + i * 1000000LL + (i % 3) * 1000, i * 0.001, &pose);
+        writer.write_pose(POSE_LOG_CHANNEL_HEAD, (int64_t) pose.ts, pose.rotation, pose.translation);
+    }
+    writer.write_dropped(POSE_LOG_CHANNEL_FRAME, 7);
+    writer.close();
+    EXPECT_EQ(writer.dropped_records(), 0u);
+
+    PoseLogReader reader;
+    ASSERT_TRUE(reader.open(path.c_str()));
+    PoseLogRecord r;
+    ASSERT_TRUE(reader.next(&r));
+    EXPECT_EQ(r.tag, POSE_LOG_TAG_TRACKING);
+    EXPECT_EQ(r.tracking_state, 3);
+    EXPECT_EQ(r.tracking_warning_flags, 1);
+    EXPECT_NEAR(r.pose_quality, 0.5, 1e-3);
+    int poses = 0;
+    double worst_rot = 0, worst_trans = 0;
+    while (reader.next(&r) && r.tag == POSE_LOG_TAG_HEAD_POSE) {
+        qvrservice_head_tracking_data_t pose;
+        make_pose(1000000000LL + poses * 1000000LL + (poses % 3) * 1000, poses * 0.001, &pose);
+        EXPECT_EQ(r.ts, (int64_t) pose.ts);
+        for (int k = 0; k < 4; k++)
+            worst_rot = std::max(worst_rot, fabs((double) r.rotation[k] - pose.rotation[k]));
+        for (int k = 0; k < 3; k++)
+            worst_trans = std::max(worst_trans, fabs((double) r.translation[k] - pose.translation[k]));
+        poses++;
+    }
+    EXPECT_EQ(poses, count);
+    EXPECT_LE(worst_rot, 2.0 / POSE_LOG_ROTATION_SCALE + 1e-7);
+    EXPECT_LE(worst_trans, 1.0 / POSE_LOG_TRANSLATION_SCALE + 1e-6);
+    EXPECT_EQ(r.tag, POSE_LOG_TAG_DROPPED);
+    EXPECT_EQ(r.channel, POSE_LOG_CHANNEL_FRAME);
+    EXPECT_EQ(r.dropped, 7u);
+    EXPECT_FALSE(reader.next(&r));
+    EXPECT_TRUE(reader.blocks() > 1);
+    EXPECT_EQ(reader.bad_blocks(), 0u);
+    reader.close();
+    unlink(path.c_str());
+}
+
+// a drop record cut off inside its count ends the block, without a count
+TEST(PoseLog, TruncatedDropRecord)
+{
+    std::vector<uint8_t> block(POSE_LOG_BLOCK_SIZE, 0);
+    const uint8_t payload[] = {
+        POSE_LOG_TAG_DROPPED, POSE_LOG_CHANNEL_HEAD, 5,
+        POSE_LOG_TAG_DROPPED, POSE_LOG_CHANNEL_HEAD, 0xff,
+    };
+    PoseLogBlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = POSE_LOG_MAGIC;
+    header.version = POSE_LOG_VERSION;
+    header.header_size = sizeof(header);
+    header.used = sizeof(payload);
+    header.record_count = 2;
+    memcpy(block.data(), &header, sizeof(header));
+    memcpy(block.data() + sizeof(header), payload, sizeof(payload));
+
+    std::string path = temp_path("truncated.qplog");
+    FILE* f = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(f != NULL);
+    fwrite(block.data(), 1, block.size(), f);
+    fclose(f);
+
+    PoseLogReader reader;
+    ASSERT_TRUE(reader.open(path.c_str()));
+    PoseLogRecord r;
+    ASSERT_TRUE(reader.next(&r));
+    EXPECT_EQ(r.tag, POSE_LOG_TAG_DROPPED);
+    EXPECT_EQ(r.dropped, 5u);
+    EXPECT_FALSE(reader.next(&r));
+    EXPECT_EQ(reader.bad_blocks(), 1u);
+    reader.close();
+    unlink(path.c_str());
+}
+
+// keeps the lines of one tag
+class CaptureSink : public LogSink {
+public:
+    explicit CaptureSink(const char* tag) : tag(tag) {}
+
+    void write(int prio, const char* t, const char* msg, int64_t realtime_ns) override
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if (strcmp(t, tag) == 0)
+            lines.push_back(msg);
+    }
+
+    std::mutex lock;
+    std::vector<std::string> lines;
+
+private:
+    const char* tag;
+};
+
+// two threads logging at once: every line arrives, each thread's in order,
+// with string arguments as they were at the call
+TEST(AsyncLog, KeepsPerThreadOrder)
+{
+    AsyncLogger& logger = AsyncLogger::instance();
+    ASSERT_TRUE(!logger.running());
+    CaptureSink* sink = new CaptureSink("qvrtest");
+    logger.clear_sinks();
+    logger.add_sink(std::unique_ptr<LogSink>(sink));
+    ASSERT_TRUE(logger.start());
+    uint64_t records = logger.records(), dropped = logger.dropped();
+
+    const int count = 200;
+    auto writer = [&](int t) {
+        for (int i = 0; i < count; i++) {
+            char word[16];
+            snprintf(word, sizeof(word), "w%d", i);
+            __log_func(ANDROID_LOG_INFO, "qvrtest", "thread %d line %d %s", t, i, word);
+            memset(word, 'x', sizeof(word) - 1);
+        }
+    };
+    std::thread a(writer, 0), b(writer, 1);
+    a.join();
+    b.join();
+    logger.stop();
+    __log_func = quiet_log;
+
+    EXPECT_EQ(logger.records() - records, 2u * count);
+    EXPECT_EQ(logger.dropped() - dropped, 0u);
+    int next[2] = { 0, 0 };
+    int bad = 0;
+    for (const std::string& line : sink->lines) {
+        int t, i;
+        char word[16], want[16];
+        if (sscanf(line.c_str(), "thread %d line %d %15s", &t, &i, word) != 3 || t < 0 || t > 1) {
+            bad++;
+            continue;
+        }
+        snprintf(want, sizeof(want), "w%d", i);
+        bad += i != next[t] || strcmp(word, want) != 0;
+        next[t] = i + 1;
+    }
+    EXPECT_EQ(bad, 0);
+    EXPECT_EQ(next[0], count);
+    EXPECT_EQ(next[1], count);
+    logger.clear_sinks();
+}
+
+// logs from its destructor, after the thread's ring is gone when it was
+// created first
+struct LogsOnExit {
+    ~LogsOnExit() { __log_func(ANDROID_LOG_INFO, "qvrtest", "thread exiting"); }
+};
+
+TEST(AsyncLog, ThreadExitFallsBackToSync)
+{
+    AsyncLogger& logger = AsyncLogger::instance();
+    ASSERT_TRUE(!logger.running());
+    CaptureSink* sink = new CaptureSink("qvrtest");
+    logger.clear_sinks();
+    logger.add_sink(std::unique_ptr<LogSink>(sink));
+    ASSERT_TRUE(logger.start());
+    uint64_t records = logger.records();
+
+    std::thread t([]() {
+        static thread_local LogsOnExit on_exit;
+        (void) on_exit;
+        __log_func(ANDROID_LOG_INFO, "qvrtest", "thread running");
+    });
+    t.join();
+    logger.stop();
+    __log_func = quiet_log;
+
+    // the exit line went to the synchronous logger, not the retired ring
+    EXPECT_EQ(logger.records() - records, 1u);
+    EXPECT_EQ(sink->lines.size(), 1u);
+    logger.clear_sinks();
+}
+
+// request() until the holder got VR mode where the lease wants it
+static int32_t settle(VrModeBrokerClient& app, QVRHOLDER_BROKER_OP op)
+{
+    int32_t res = app.request(op);
+    for (int i = 0; i < 5000 && res == QVR_RESULT_PENDING; i++) {
+        usleep(1000);
+        res = app.request(QVRHOLDER_BROKER_OP_QUERY);
+    }
+    return res;
+}
+
+static void broker_case(bool allow_stop)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "qvrtest-%d", (int) getpid());
+
+    EventLoop loop;
+    VrModeHolder holder(loop);
+    VrModeBroker broker(loop, holder);
+    if (!allow_stop)
+        broker.set_stop_uids(std::vector<uid_t>());
+    ASSERT_TRUE(holder.start());
+    ASSERT_TRUE(broker.start(name));
+    EXPECT_EQ(broker.may_stop(getuid()), allow_stop);
+
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    VrModeBrokerClient app;
+    qvrservice_client_helper_t* observer = QVRServiceClient_Create();
+    if (app.connect(name) && observer != NULL) {
+        EXPECT_EQ(settle(app, QVRHOLDER_BROKER_OP_QUERY), QVR_SUCCESS);
+        EXPECT_EQ(QVRServiceClient_GetVRMode(observer), VRMODE_STARTED);
+        EXPECT_EQ(settle(app, QVRHOLDER_BROKER_OP_PAUSE), QVR_SUCCESS);
+        EXPECT_EQ(QVRServiceClient_GetVRMode(observer), VRMODE_PAUSED);
+        if (allow_stop) {
+            EXPECT_EQ(settle(app, QVRHOLDER_BROKER_OP_STOP), QVR_SUCCESS);
+            EXPECT_EQ(QVRServiceClient_GetVRMode(observer), VRMODE_STOPPED);
+        } else {
+            // the pause lease stays, the stop never happens
+            EXPECT_EQ(app.request(QVRHOLDER_BROKER_OP_STOP), QVRHOLDER_BROKER_DENIED);
+            EXPECT_EQ(QVRServiceClient_GetVRMode(observer), VRMODE_PAUSED);
+        }
+        EXPECT_EQ(settle(app, QVRHOLDER_BROKER_OP_RESUME), QVR_SUCCESS);
+        EXPECT_EQ(QVRServiceClient_GetVRMode(observer), VRMODE_STARTED);
+    } else {
+        EXPECT_TRUE(false);
+    }
+    app.close();
+    if (observer != NULL)
+        QVRServiceClient_Destroy(observer);
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    EXPECT_EQ(broker.denied_count(), allow_stop ? 0u : 1u);
+    broker.stop();
+    holder.stop();
+}
+
+TEST(Broker, Leases)
+{
+    broker_case(true);
+}
+
+TEST(Broker, DeniesStopToOtherUids)
+{
+    broker_case(false);
+}
+
+// a newest pose newer than since with 6DoF tracking and no FATAL_ERROR,
+// within timeout_ms
+static bool tracking_6dof(PoseRingReader& ring, int64_t since, int timeout_ms)
+{
+    return wait_for(
+            [&]() {
+                qvrservice_head_tracking_data_t pose;
+                return ring.read_latest(&pose) && (int64_t) pose.ts > since && (pose.tracking_state & 0x4) &&
+                       !(pose.tracking_state & 0x8);
+            },
+            timeout_ms);
+}
+
+// a tracking FATAL_ERROR while VR mode stays started is found by the
+// watchdog, which restarts tracking until 6DoF is back
+TEST(Watchdog, RestartsFatalTracking)
+{
+    EventLoop loop;
+    VrModeHolder holder(loop);
+    ASSERT_TRUE(holder.start());
+    mock_lib = holder.client()->libHandle;
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    qvrservice_client_helper_t* observer = QVRServiceClient_Create();
+    PoseRingReader ring;
+    bool mapped = observer != NULL && ring.open(observer, RING_BUFFER_POSE) == QVR_SUCCESS;
+    EXPECT_TRUE(mapped);
+    if (mapped) {
+        EXPECT_TRUE(tracking_6dof(ring, now_ns(), 5000));
+        int64_t t0 = now_ns();
+        MOCK_FN(qvrmock_set_tracking_state)(0x8, 0);
+        EXPECT_TRUE(tracking_6dof(ring, t0, 10000));
+        // the outage ends with the holder's next check, 1 ms on while young
+        usleep(50 * 1000);
+    }
+    // StartVRMode cleared the fatal state in the mock; make it healthy for
+    // whatever comes next either way
+    MOCK_FN(qvrmock_set_tracking_state)(0x4, 0);
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    EXPECT_TRUE(holder.tracking_restart_count() >= 1);
+    EXPECT_TRUE(holder.outage_count() >= 1);
+    ring.close();
+    if (observer != NULL)
+        QVRServiceClient_Destroy(observer);
+    holder.stop();
+}
+
+// samples of the eye pose ring come out once each, in order, none dropped
+// by a reader that polls every 10 ms
+TEST(EyePoseStream, InOrder)
+{
+    qvrservice_client_helper_t* client = start_client();
+    ASSERT_TRUE(client != NULL);
+    MOCK_FN(qvrmock_set_eye_rate)(250);
+    QVRServiceClient_SetEyeTrackingMode(client, QVRSERVICE_EYE_TRACKING_MODE_DUAL);
+
+    EyePoseStream stream;
+    EXPECT_EQ(stream.open(client, false), QVR_SUCCESS);
+    EXPECT_TRUE(stream.ring_mapped());
+    GazeSample buf[64];
+    stream.read(buf, 64);
+    int64_t last_ts = 0;
+    uint32_t total = 0, invalid = 0, out_of_order = 0;
+    for (int i = 0; i < 20; i++) {
+        usleep(10 * 1000);
+        uint32_t n = stream.read(buf, 64);
+        for (uint32_t k = 0; k < n; k++) {
+            out_of_order += buf[k].ts <= last_ts;
+            invalid += !(buf[k].flags & GAZE_DIRECTION_VALID);
+            last_ts = buf[k].ts;
+        }
+        total += n;
+    }
+    // 200 ms at 250 Hz
+    EXPECT_TRUE(total > 25);
+    EXPECT_EQ(out_of_order, 0u);
+    EXPECT_EQ(invalid, 0u);
+    EXPECT_EQ(stream.dropped(), 0u);
+    GazeSample latest;
+    EXPECT_TRUE(stream.read_latest(&latest));
+    EXPECT_TRUE(latest.ts >= last_ts);
+
+    stream.close();
+    QVRServiceClient_SetEyeTrackingMode(client, QVRSERVICE_EYE_TRACKING_MODE_NONE);
+    MOCK_FN(qvrmock_set_eye_rate)(90);
+    QVRServiceClient_Destroy(client);
+}
+
+static double angle_deg(const float a[3], const float b[3])
+{
+    double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    return acos(std::min(1.0, std::max(-1.0, dot))) * 180.0 / M_PI;
+}
+
+// a fixation, one 10 degree saccade and a fixation at 90 Hz with tracker
+// noise: the filter is steadier than the raw gaze, finds the saccade once
+// and lands on the target; both kernels agree
+TEST(GazeFilter, SmoothsFixationsAndFindsSaccades)
+{
+    const int fixation = 90, saccade = 4;
+    const int count = 2 * fixation + saccade;
+    const int64_t period = 1000000000LL / 90;
+    const double sigma = 0.2 * M_PI / 180.0;
+    // xorshift + Box-Muller, reproducible
+    uint64_t rng = 88172645463325252ULL;
+    auto uniform = [&]() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return ((rng >> 11) + 0.5) / 9007199254740992.0;
+    };
+    std::vector<GazeSample> in(count);
+    for (int i = 0; i < count; i++) {
+        double a = std::min(1.0, std::max(0.0, (double) (i - fixation + 1) / (saccade + 1)));
+        double yaw = 10.0 * M_PI / 180.0 * a * a * (3.0 - 2.0 * a);
+        GazeSample& g = in[i];
+        memset(&g, 0, sizeof(g));
+        g.ts = 1000000000LL + i * period;
+        g.direction[0] = (float) sin(yaw);
+        g.direction[2] = (float) -cos(yaw);
+        float len = 0;
+        for (int k = 0; k < 3; k++) {
+            g.direction[k] += (float) (sqrt(-2.0 * log(uniform())) * cos(2.0 * M_PI * uniform()) * sigma);
+            len += g.direction[k] * g.direction[k];
+        }
+        for (int k = 0; k < 3; k++)
+            g.direction[k] /= sqrtf(len);
+        g.state = QVRSERVICE_FOVEATED_GAZE_TRACKING_STATE_TRACKING;
+        g.flags = GAZE_DIRECTION_VALID;
+    }
+
+    std::vector<FilteredGaze> scalar(count), simd(count);
+    GazeFilter a, b;
+    a.set_kernel(GazeFilter::KERNEL_SCALAR);
+    b.set_kernel(GazeFilter::KERNEL_SIMD);
+    for (int i = 0; i < count; i += 16) {
+        a.process(&in[i], std::min(16, count - i), &scalar[i]);
+        b.process(&in[i], std::min(16, count - i), &simd[i]);
+    }
+    float worst = 0;
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++)
+            worst = std::max(worst, fabsf(scalar[i].direction[k] - simd[i].direction[k]));
+    }
+    EXPECT_LE(worst, 1e-5f);
+    EXPECT_EQ(a.saccade_count(), 1u);
+    EXPECT_EQ(b.saccade_count(), 1u);
+
+    // sample to sample over the settled part of both fixations
+    double raw_jitter = 0, filtered_jitter = 0;
+    int n = 0;
+    for (int i = 1; i < count; i++) {
+        if ((i > 10 && i < fixation) || i > fixation + saccade + 30) {
+            raw_jitter += angle_deg(in[i].direction, in[i - 1].direction);
+            filtered_jitter += angle_deg(scalar[i].direction, scalar[i - 1].direction);
+            n++;
+        }
+    }
+    EXPECT_TRUE(filtered_jitter < raw_jitter / 2);
+    float target[3] = { (float) sin(10.0 * M_PI / 180.0), 0.0f, (float) -cos(10.0 * M_PI / 180.0) };
+    EXPECT_LE(angle_deg(scalar[count - 1].direction, target), 0.5);
+    EXPECT_TRUE(n > 0);
+}
+
+static qvrcamera_client_helper_t* camera_client()
+{
+    qvrcamera_client_helper_t* client = QVRCameraClient_Create();
+    if (client != NULL)
+        mock_lib = client->libHandle;
+    return client;
+}
+
+// frames reach wait() and the consumer callback in order, and every buffer
+// is back with the camera after close()
+TEST(CameraPipeline, DeliversInOrder)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    CameraPipeline pipeline;
+    int dev = pipeline.attach(client, name);
+    ASSERT_TRUE(dev >= 0);
+    // counted on the acquisition thread
+    std::atomic<uint32_t> last_fn(0), out_of_order(0);
+    std::atomic<uint64_t> delivered(0);
+    pipeline.add_consumer(dev, [&](const CameraPipeline::FrameHandle& h) {
+        if (delivered.load() != 0 && h.fn() <= last_fn.load())
+            out_of_order++;
+        last_fn.store(h.fn());
+        delivered++;
+    });
+    ASSERT_TRUE(pipeline.start());
+
+    uint32_t fn = 0;
+    int got = 0;
+    for (int i = 0; i < 10; i++) {
+        CameraPipeline::FrameHandle h = pipeline.wait(dev, fn, 1000000000LL);
+        if (!h)
+            break;
+        EXPECT_TRUE(i == 0 || h.fn() > fn);
+        EXPECT_TRUE(h.data() != NULL);
+        fn = h.fn();
+        got++;
+    }
+    EXPECT_EQ(got, 10);
+    pipeline.stop();
+    CameraPipeline::Stats st = pipeline.stats(dev);
+    EXPECT_TRUE(st.frames >= 10);
+    EXPECT_EQ(st.errors, 0u);
+    EXPECT_TRUE(delivered.load() >= 10);
+    EXPECT_EQ(out_of_order.load(), 0u);
+    pipeline.close();
+    EXPECT_EQ(MOCK_FN(qvrcammock_locked_buffers)(name), 0u);
+    QVRCameraClient_Destroy(client);
+}
+
+static void pack_raw10(const uint16_t* v, uint32_t w, uint8_t* out)
+{
+    memset(out, 0, RawUnpacker::row_bytes(QVRCAMERA_FRAME_FORMAT_RAW10_MONO, w));
+    for (uint32_t x = 0; x < w; x++) {
+        uint8_t* g = out + x / 4 * 5;
+        g[x % 4] = (uint8_t) (v[x] >> 2);
+        g[4] |= (uint8_t) ((v[x] & 3) << (2 * (x % 4)));
+    }
+}
+
+TEST(RawUnpacker, Raw10)
+{
+    const uint32_t width = 100, height = 6;
+    uint32_t stride = RawUnpacker::row_bytes(QVRCAMERA_FRAME_FORMAT_RAW10_MONO, width) + 12;
+    std::vector<uint16_t> truth(width * height);
+    std::vector<uint8_t> raw((size_t) stride * height);
+    for (size_t i = 0; i < truth.size(); i++)
+        truth[i] = (uint16_t) ((i * 2654435761u >> 7) & 0x3ff);
+    for (uint32_t y = 0; y < height; y++)
+        pack_raw10(&truth[y * width], width, &raw[(size_t) y * stride]);
+
+    qvrcamera_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.format = QVRCAMERA_FRAME_FORMAT_RAW10_MONO;
+    frame.width = width;
+    frame.height = height;
+    frame.stride = stride;
+    frame.buffer = raw.data();
+    frame.len = (uint32_t) raw.size();
+    RawUnpacker::Image images[RawUnpacker::MAX_IMAGES];
+    ASSERT_EQ(RawUnpacker::split(frame, images), 1);
+    EXPECT_EQ(images[0].pitch, stride);
+
+    RawUnpacker::Config config;
+    config.output = RawUnpacker::OUTPUT_Y16;
+    RawUnpacker y16(config);
+    config.output = RawUnpacker::OUTPUT_Y8;
+    RawUnpacker y8(config);
+    for (RawUnpacker::Kernel k : { RawUnpacker::KERNEL_SCALAR, RawUnpacker::KERNEL_SIMD }) {
+        std::vector<uint16_t> out16(width * height);
+        std::vector<uint8_t> out8(width * height);
+        y16.set_kernel(k);
+        y8.set_kernel(k);
+        ASSERT_TRUE(y16.unpack(images[0], out16.data(), width * 2));
+        ASSERT_TRUE(y8.unpack(images[0], out8.data(), width));
+        EXPECT_TRUE(out16 == truth);
+        uint32_t wrong = 0;
+        for (size_t i = 0; i < truth.size(); i++)
+            wrong += out8[i] != truth[i] >> 2;
+        EXPECT_EQ(wrong, 0u);
+    }
+
+    // a buffer shorter than the layout doesn't split; the padding of the
+    // last row may be missing
+    frame.len = stride * (height - 1) + RawUnpacker::row_bytes(QVRCAMERA_FRAME_FORMAT_RAW10_MONO, width);
+    EXPECT_EQ(RawUnpacker::split(frame, images), 1);
+    frame.len -= 1;
+    EXPECT_EQ(RawUnpacker::split(frame, images), 0);
+}
+
+// every output and gamma of both kernels against values computed from the
+// sensor values: a padded RAW10 frame, two RAW10 crops of half the width
+// back to back, and RAW16 with 12 bits
+TEST(RawUnpacker, AllOutputs)
+{
+    const uint32_t width = 200, height = 8;
+    std::vector<uint16_t> truth((size_t) width * height);
+    for (size_t i = 0; i < truth.size(); i++) {
+        uint32_t h = (uint32_t) i * 2654435761u;
+        h ^= h >> 15;
+        truth[i] = (uint16_t) (h & 0x3ff);
+    }
+    uint32_t stride = RawUnpacker::row_bytes(QVRCAMERA_FRAME_FORMAT_RAW10_MONO, width) + 64;
+    std::vector<uint8_t> raw10((size_t) stride * height);
+    for (uint32_t y = 0; y < height; y++)
+        pack_raw10(&truth[(size_t) y * width], width, &raw10[(size_t) y * stride]);
+    uint32_t crop_w = width / 2 + 2;
+    uint32_t crop_rb = RawUnpacker::row_bytes(QVRCAMERA_FRAME_FORMAT_RAW10_MONO, crop_w);
+    std::vector<uint8_t> dual((size_t) crop_rb * height * 2);
+    for (uint32_t c = 0; c < 2; c++) {
+        for (uint32_t y = 0; y < height; y++)
+            pack_raw10(&truth[(size_t) y * width + c * (width - crop_w)], crop_w,
+                       &dual[((size_t) c * height + y) * crop_rb]);
+    }
+    std::vector<uint16_t> raw16(truth.size());
+    for (size_t i = 0; i < truth.size(); i++)
+        raw16[i] = (uint16_t) (truth[i] << 2 | (truth[i] >> 8));
+
+    qvrcamera_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.format = QVRCAMERA_FRAME_FORMAT_RAW10_MONO;
+    frame.width = width;
+    frame.height = height;
+    frame.stride = stride;
+    frame.buffer = raw10.data();
+    frame.len = (uint32_t) raw10.size();
+    qvrcamera_frame_t dual_frame = frame;
+    dual_frame.width = dual_frame.secondary_width = crop_w;
+    dual_frame.height = dual_frame.secondary_height = height;
+    dual_frame.stride = crop_w * 2;
+    dual_frame.buffer = dual.data();
+    dual_frame.len = (uint32_t) dual.size();
+    qvrcamera_frame_t frame16 = frame;
+    frame16.format = QVRCAMERA_FRAME_FORMAT_RAW16_MONO;
+    frame16.stride = width * 2;
+    frame16.buffer = (uint8_t*) raw16.data();
+    frame16.len = (uint32_t) raw16.size() * 2;
+
+    // what pixel i of the sensor should come out as
+    auto expected = [&](const RawUnpacker::Config& c, bool is16, size_t i) {
+        uint16_t v = truth[i];
+        if (c.gamma != 1.0f) {
+            float g = powf((float) v / 1023.0f, 1.0f / c.gamma);
+            if (c.output == RawUnpacker::OUTPUT_Y8)
+                return (double) (uint8_t) (g * 255.0f + 0.5f);
+            if (c.output == RawUnpacker::OUTPUT_Y16)
+                return (double) (uint16_t) (g * 65535.0f + 0.5f);
+            return (double) g;
+        }
+        if (c.output == RawUnpacker::OUTPUT_Y8)
+            return (double) (v >> 2);
+        // RAW16 carries 12 bits, its scale differs
+        if (c.output == RawUnpacker::OUTPUT_Y16)
+            return (double) (is16 ? raw16[i] : v);
+        return is16 ? raw16[i] / 4095.0 : v / 1023.0;
+    };
+    auto read_out = [](RawUnpacker::Output o, const uint8_t* p, size_t i) {
+        if (o == RawUnpacker::OUTPUT_Y8)
+            return (double) p[i];
+        if (o == RawUnpacker::OUTPUT_Y16) {
+            uint16_t v;
+            memcpy(&v, p + 2 * i, 2);
+            return (double) v;
+        }
+        float v;
+        memcpy(&v, p + 4 * i, 4);
+        return (double) v;
+    };
+
+    std::vector<uint8_t> out((size_t) width * height * sizeof(float));
+    std::vector<uint8_t> scalar_out(out.size());
+    for (const qvrcamera_frame_t* f : { &frame, &dual_frame, &frame16 }) {
+        RawUnpacker::Image images[RawUnpacker::MAX_IMAGES];
+        int n = RawUnpacker::split(*f, images);
+        ASSERT_EQ(n, f == &dual_frame ? 2 : 1);
+        for (RawUnpacker::Output o : { RawUnpacker::OUTPUT_Y8, RawUnpacker::OUTPUT_Y16, RawUnpacker::OUTPUT_FLOAT }) {
+            for (float gamma : { 1.0f, 2.2f }) {
+                RawUnpacker::Config config;
+                config.output = o;
+                config.gamma = gamma;
+                config.raw16_bits = 12;
+                RawUnpacker unpacker(config);
+                for (int im = 0; im < n; im++) {
+                    const RawUnpacker::Image& img = images[im];
+                    size_t pitch = img.width * RawUnpacker::output_size(o);
+                    uint32_t x0 = im == 0 ? 0 : width - crop_w;
+                    for (RawUnpacker::Kernel k : { RawUnpacker::KERNEL_SCALAR, RawUnpacker::KERNEL_SIMD }) {
+                        unpacker.set_kernel(k);
+                        ASSERT_TRUE(unpacker.unpack(img, out.data(), pitch));
+                        double worst = 0;
+                        for (uint32_t y = 0; y < img.height; y++) {
+                            for (uint32_t x = 0; x < img.width; x++) {
+                                double e = expected(config, f == &frame16, (size_t) y * width + x0 + x);
+                                worst = std::max(worst, fabs(read_out(o, out.data() + y * pitch, x) - e));
+                            }
+                        }
+                        EXPECT_LE(worst, o == RawUnpacker::OUTPUT_FLOAT ? 1e-6 : 0.0);
+                        if (k == RawUnpacker::KERNEL_SCALAR)
+                            memcpy(scalar_out.data(), out.data(), pitch * img.height);
+                        else
+                            EXPECT_EQ(memcmp(scalar_out.data(), out.data(), pitch * img.height), 0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static YuvImage nv21_image(uint32_t width, uint32_t height, std::vector<uint8_t>* y, std::vector<uint8_t>* uv)
+{
+    y->resize(width * height);
+    uv->resize(width * height / 2);
+    for (size_t i = 0; i < y->size(); i++)
+        (*y)[i] = (uint8_t) (i * 2654435761u >> 11);
+    for (size_t i = 0; i < uv->size(); i++)
+        (*uv)[i] = (uint8_t) (i * 40503u >> 3);
+    YuvImage img = { y->data(), uv->data(), width, height, width, width, QVRCAMERA_FRAME_FORMAT_YUV420_NV21 };
+    return img;
+}
+
+TEST(YuvOps, KernelsAgree)
+{
+    const uint32_t width = 70, height = 20;
+    std::vector<uint8_t> y, uv;
+    YuvImage img = nv21_image(width, height, &y, &uv);
+
+    std::vector<std::vector<uint8_t>> outs;
+    YuvOps scalar, simd, threaded(3);
+    scalar.set_kernel(YuvOps::KERNEL_SCALAR);
+    for (YuvOps* ops : { &scalar, &simd, &threaded }) {
+        std::vector<uint8_t> out;
+        std::vector<uint8_t> u(width / 2 * height / 2), v(u.size());
+        Plane pu = { u.data(), width / 2, height / 2, width / 2 };
+        Plane pv = { v.data(), width / 2, height / 2, width / 2 };
+        ASSERT_TRUE(ops->deinterleave(img, pu, pv));
+        out.insert(out.end(), u.begin(), u.end());
+        out.insert(out.end(), v.begin(), v.end());
+
+        for (uint32_t factor : { 2u, 4u }) {
+            for (YuvOps::Filter f : { YuvOps::FILTER_BOX, YuvOps::FILTER_BILINEAR }) {
+                std::vector<uint8_t> small(width / factor * (height / factor));
+                Plane src = { y.data(), width, height, width };
+                Plane dst = { small.data(), width / factor, height / factor, width / factor };
+                ASSERT_TRUE(ops->downscale(src, dst, factor, f));
+                out.insert(out.end(), small.begin(), small.end());
+            }
+        }
+
+        std::vector<uint8_t> rgba(width * height * 4);
+        ASSERT_TRUE(ops->to_rgba(img, rgba.data(), width * 4));
+        out.insert(out.end(), rgba.begin(), rgba.end());
+
+        std::vector<uint8_t> swapped(uv);
+        YuvImage copy = img;
+        copy.uv = swapped.data();
+        ASSERT_TRUE(ops->to_nv12(&copy));
+        EXPECT_EQ(copy.arrangement, QVRCAMERA_FRAME_FORMAT_YUV420_NV12);
+        EXPECT_EQ(swapped[0], uv[1]);
+        EXPECT_EQ(swapped[1], uv[0]);
+        out.insert(out.end(), swapped.begin(), swapped.end());
+        outs.push_back(out);
+    }
+    EXPECT_TRUE(outs[1] == outs[0]);
+    EXPECT_TRUE(outs[2] == outs[0]);
+
+    // 2x box is the rounded mean of each 2x2 block
+    uint8_t small[1];
+    Plane src = { y.data(), 2, 2, width };
+    Plane dst = { small, 1, 1, 1 };
+    ASSERT_TRUE(scalar.downscale(src, dst, 2, YuvOps::FILTER_BOX));
+    EXPECT_EQ(small[0], (y[0] + y[1] + y[width] + y[width + 1] + 2) >> 2);
+}
+
+// the fixed point RGBA within 1 of the float BT.601 conversion
+TEST(YuvOps, RgbaMatchesBt601)
+{
+    const uint32_t width = 70, height = 20;
+    std::vector<uint8_t> y, uv;
+    YuvImage img = nv21_image(width, height, &y, &uv);
+    std::vector<uint8_t> rgba(width * height * 4);
+    YuvOps ops;
+    ops.set_kernel(YuvOps::KERNEL_SCALAR);
+    ASSERT_TRUE(ops.to_rgba(img, rgba.data(), width * 4));
+    int worst = 0;
+    for (uint32_t py = 0; py < height; py++) {
+        for (uint32_t px = 0; px < width; px++) {
+            const uint8_t* c2 = img.uv + (size_t) (py / 2) * img.uv_pitch + (px & ~1u);
+            double c = 1.164 * (img.y[(size_t) py * img.y_pitch + px] - 16);
+            double cb = c2[1] - 128.0, cr = c2[0] - 128.0;
+            double e[3] = { c + 1.596 * cr, c - 0.391 * cb - 0.813 * cr, c + 2.018 * cb };
+            for (int k = 0; k < 3; k++) {
+                int want = (int) std::min(255.0, std::max(0.0, floor(e[k] + 0.5)));
+                worst = std::max(worst, abs(rgba[((size_t) py * width + px) * 4 + k] - want));
+            }
+        }
+    }
+    EXPECT_LE(worst, 1);
+}
+
+static bool same_view(const ImageView& a, const ImageView& b)
+{
+    return a.data == b.data && a.uv == b.uv && a.width == b.width && a.height == b.height && a.pitch == b.pitch &&
+           (a.uv == NULL || a.uv_pitch == b.uv_pitch) && a.x == b.x && a.y == b.y;
+}
+
+TEST(FrameViews, SplitsMergedFrames)
+{
+    const uint32_t width = 64, height = 8, stride = 80;
+    std::vector<uint8_t> buf(stride * height);
+    qvrcamera_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.format = QVRCAMERA_FRAME_FORMAT_Y8;
+    frame.width = width;
+    frame.height = height;
+    frame.stride = stride;
+    frame.buffer = buf.data();
+    frame.len = (uint32_t) buf.size();
+
+    FrameViews views;
+    FrameViews::Layout side_by_side;
+    side_by_side.images = 2;
+    ASSERT_EQ(views.from_frame(frame, side_by_side), 2);
+    EXPECT_TRUE(views.view(0).data == buf.data());
+    EXPECT_TRUE(views.view(1).data == buf.data() + width / 2);
+    EXPECT_EQ(views.view(1).width, width / 2);
+    EXPECT_EQ(views.view(1).pitch, stride);
+    EXPECT_EQ(views.view(1).x, (int32_t) (width / 2));
+
+    FrameViews::Layout stacked;
+    stacked.images = 2;
+    stacked.vertical = true;
+    ASSERT_EQ(views.from_frame(frame, stacked), 2);
+    EXPECT_TRUE(views.view(1).data == buf.data() + (size_t) stride * height / 2);
+    EXPECT_EQ(views.view(1).height, height / 2);
+    EXPECT_EQ(views.view(1).y, (int32_t) (height / 2));
+
+    // too short for the last row
+    frame.len = stride * (height - 1);
+    EXPECT_EQ(views.from_frame(frame, stacked), 0);
+}
+
+// every format and arrangement: each view starts where its corner sits in
+// the merged frame, chroma included, and the banded copy gives what a copy
+// of one view after the other does
+TEST(FrameViews, ViewsAndBandedCopy)
+{
+    struct Case {
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        FrameViews::Layout layout;
+    };
+    const Case cases[] = {
+        { QVRCAMERA_FRAME_FORMAT_Y8, 256, 72, { 2, false } },
+        { QVRCAMERA_FRAME_FORMAT_Y8, 128, 144, { 2, true } },
+        { QVRCAMERA_FRAME_FORMAT_YUV420, 256, 72, { 2, false } },
+        { QVRCAMERA_FRAME_FORMAT_YUV420, 128, 144, { 2, true } },
+        { QVRCAMERA_FRAME_FORMAT_RAW10_MONO, 256, 80, { 2, false } },
+        { QVRCAMERA_FRAME_FORMAT_DEPTH16, 32, 96, { 4, true } },
+    };
+    for (const Case& c : cases) {
+        // row padding, as camera strides often have
+        uint32_t pitch = FrameViews::row_bytes(c.format, c.width) + 64;
+        bool yuv = c.format == QVRCAMERA_FRAME_FORMAT_YUV420;
+        std::vector<uint8_t> buf((size_t) pitch * (yuv ? c.height * 3 / 2 : c.height));
+        for (size_t i = 0; i < buf.size(); i++)
+            buf[i] = (uint8_t) ((uint32_t) i * 2654435761u >> 13);
+        qvrcamera_frame_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.format = c.format;
+        frame.width = c.width;
+        frame.height = c.height;
+        frame.stride = pitch;
+        frame.buffer = buf.data();
+        frame.len = (uint32_t) buf.size();
+
+        FrameViews fv;
+        int n = fv.from_frame(frame, c.layout);
+        ASSERT_EQ(n, (int) c.layout.images);
+        std::vector<ImageView> views;
+        std::vector<std::vector<uint8_t>> naive(n), banded(n);
+        std::vector<uint8_t*> dst(n);
+        for (int i = 0; i < n; i++) {
+            const ImageView& v = fv.view(i);
+            EXPECT_TRUE(v.data == buf.data() + (size_t) v.y * pitch + FrameViews::row_bytes(c.format, v.x));
+            EXPECT_EQ(v.pitch, pitch);
+            if (yuv)
+                EXPECT_TRUE(v.uv == buf.data() + (size_t) pitch * (c.height + v.y / 2) + v.x);
+            views.push_back(v);
+
+            uint32_t rb = FrameViews::row_bytes(v.format, v.width);
+            naive[i].assign(FrameViews::copy_size(v), 0);
+            for (uint32_t y = 0; y < v.height; y++)
+                memcpy(naive[i].data() + (size_t) y * rb, v.data + (size_t) y * v.pitch, rb);
+            for (uint32_t y = 0; v.uv != NULL && y < v.height / 2; y++)
+                memcpy(naive[i].data() + (size_t) (v.height + y) * rb, v.uv + (size_t) y * v.uv_pitch, rb);
+            banded[i].assign(FrameViews::copy_size(v), 1);
+            dst[i] = banded[i].data();
+        }
+        EXPECT_TRUE(FrameViews::copy(views.data(), n, dst.data()));
+        EXPECT_TRUE(naive == banded);
+    }
+}
+
+// views made from the hardware buffers of a mock frame are the ones the
+// GetFrame() split gives
+TEST(FrameViews, HardwareBuffersMatchSplit)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    for (const char* name : { QVRSERVICE_CAMERA_NAME_TRACKING, QVRSERVICE_CAMERA_NAME_RGB, QVRSERVICE_CAMERA_NAME_DEPTH }) {
+        qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+        EXPECT_TRUE(cam != NULL);
+        if (cam == NULL)
+            continue;
+        EXPECT_EQ(QVRCameraDevice_Start(cam), QVR_CAM_SUCCESS);
+        FrameViews::Layout layout = FrameViews::query_layout(cam);
+        int32_t fn = 0;
+        qvrcamera_frame_t frame;
+        if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &frame) ==
+            QVR_CAM_SUCCESS) {
+            FrameViews split, from_hw;
+            int n = split.from_frame(frame, layout);
+            EXPECT_EQ(n, (int) layout.images);
+            EXPECT_EQ(from_hw.from_hardware_buffers(cam, &frame, layout), n);
+            for (int i = 0; i < n && i < from_hw.count(); i++)
+                EXPECT_TRUE(same_view(split.view(i), from_hw.view(i)));
+            from_hw.reset();
+            QVRCameraDevice_ReleaseFrame(cam, fn);
+        } else {
+            EXPECT_TRUE(false);
+        }
+        QVRCameraDevice_Stop(cam);
+        QVRCameraDevice_DetachCamera(cam);
+    }
+    QVRCameraClient_Destroy(client);
+}
+
+// every row of a band holds the frame the band belongs to: the mock's bar
+// sits where it does in that frame, read partially and as whole frames
+TEST(PartialFrameReader, BandsHoldTheirFrame)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    auto bar_x = MOCK_FN(qvrcammock_bar_x);
+    auto set_partial = MOCK_FN(qvrcammock_set_partial_frame_read);
+    for (int partial = 1; partial >= 0; partial--) {
+        set_partial(name, partial);
+        PartialFrameReader reader;
+        EXPECT_EQ(reader.attach(client, name), QVR_CAM_SUCCESS);
+        // counted on the reader thread
+        std::atomic<uint64_t> bands(0), stale_rows(0);
+        reader.set_callback([&](const PartialFrameReader::Band& b) {
+            const ImageView& v = b.views->view(0);
+            uint32_t x = bar_x(name, b.fn) + 12;
+            uint64_t stale = 0;
+            for (uint32_t y = b.first_row; y < b.end_row; y++)
+                stale += v.data[(size_t) y * v.pitch + x] != 230;
+            stale_rows += stale;
+            bands++;
+        });
+        EXPECT_TRUE(reader.start());
+        usleep(500 * 1000);
+        reader.close();
+        EXPECT_TRUE(bands.load() > 0);
+        EXPECT_EQ(stale_rows.load(), 0u);
+        EXPECT_EQ(reader.stats().errors, 0u);
+    }
+    set_partial(name, 1);
+    QVRCameraClient_Destroy(client);
+}
+
+// a peer of the frame share maps the buffers of the frames it leases and
+// sees each frame's own content in them
+TEST(FrameShare, PeerSeesTheFrameItLeased)
+{
+    char service[64];
+    snprintf(service, sizeof(service), "qvrtest-frames-%d", (int) getpid());
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    auto bar_x = MOCK_FN(qvrcammock_bar_x);
+
+    EventLoop loop;
+    CameraPipeline pipeline;
+    FrameShareService share(loop, pipeline);
+    EXPECT_TRUE(pipeline.attach(client, name) >= 0);
+    EXPECT_TRUE(share.start(service));
+    EXPECT_TRUE(pipeline.start());
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    FrameShareClient peer;
+    EXPECT_EQ(peer.connect(name, service), QVR_SUCCESS);
+    int frames = 0;
+    uint32_t last_fn = 0;
+    uint64_t stale = 0;
+    for (int tries = 0; peer.is_connected() && frames < 10 && tries < 50; tries++) {
+        FrameShareClient::Frame f;
+        int32_t got = peer.next(&f, 200);
+        if (got == QVR_RESULT_PENDING)
+            continue;
+        EXPECT_EQ(got, QVR_SUCCESS);
+        if (got != QVR_SUCCESS)
+            break;
+        EXPECT_TRUE(frames == 0 || f.meta.fn > last_fn);
+        last_fn = f.meta.fn;
+        FrameViews views;
+        FrameViews::Layout layout;
+        layout.images = f.meta.images;
+        layout.vertical = f.meta.vertical != 0;
+        EXPECT_TRUE(views.from_buffers(f.buffers, f.num_buffers, f.meta.format, layout) > 0);
+        if (views.count() > 0) {
+            const ImageView& v = views.view(0);
+            uint32_t x = bar_x(name, f.meta.fn) + 12;
+            for (uint32_t y = 0; y < v.height; y += 16)
+                stale += v.data[(size_t) y * v.pitch + x] != 230;
+        }
+        views.reset();
+        peer.release(f.lease);
+        frames++;
+    }
+    EXPECT_EQ(frames, 10);
+    EXPECT_EQ(stale, 0u);
+    peer.close();
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    EXPECT_TRUE(share.frames_published() >= 10);
+    share.stop();
+    pipeline.close();
+    QVRCameraClient_Destroy(client);
+}
+
+TEST(FrameShare, RefusesUidsNotOnTheList)
+{
+    char service[64];
+    snprintf(service, sizeof(service), "qvrtest-frames-uid-%d", (int) getpid());
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+
+    EventLoop loop;
+    CameraPipeline pipeline;
+    FrameShareService share(loop, pipeline);
+    EXPECT_TRUE(share.may_subscribe(0));
+    EXPECT_TRUE(share.may_subscribe(getuid()));
+    EXPECT_FALSE(share.may_subscribe(12345));
+    // nobody on the list, the test's own uid included
+    share.set_uids(std::vector<uid_t>());
+    EXPECT_TRUE(pipeline.attach(client, name) >= 0);
+    EXPECT_TRUE(share.start(service));
+    EXPECT_TRUE(pipeline.start());
+    int quit_fd = loop.create_event([&]() { loop.quit(0); });
+    std::thread loop_thread([&]() { loop.run(); });
+
+    FrameShareClient peer;
+    EXPECT_EQ(peer.connect(name, service), QVRHOLDER_FRAMES_DENIED);
+    EXPECT_FALSE(peer.is_connected());
+
+    EventLoop::signal_event(quit_fd);
+    loop_thread.join();
+    EXPECT_EQ(share.refused_count(), 1u);
+    EXPECT_EQ(share.peer_count(), 0u);
+    EXPECT_EQ(share.lease_count(), 0u);
+    share.stop();
+    pipeline.close();
+    QVRCameraClient_Destroy(client);
+}
+
+TEST(AutoExposure, HistogramKernelsAgree)
+{
+    const uint32_t width = 1283, height = 97, pitch = width + 29;
+    std::vector<uint8_t> buf(pitch * height);
+    for (size_t i = 0; i < buf.size(); i++)
+        buf[i] = (uint8_t) ((uint32_t) i * 2654435761u >> 13);
+    ImageView v;
+    memset(&v, 0, sizeof(v));
+    v.data = buf.data();
+    v.width = width;
+    v.height = height;
+    v.pitch = pitch;
+    v.format = QVRCAMERA_FRAME_FORMAT_Y8;
+
+    for (uint32_t step : { 1u, 2u, 3u, 4u }) {
+        AutoExposure::Config config;
+        config.step_x = step;
+        config.step_y = 2;
+        config.roi_left = config.roi_top = 0.13f;
+        config.roi_right = config.roi_bottom = 0.87f;
+        AutoExposure ae(config);
+        AutoExposure::Histogram scalar, simd;
+        ae.set_kernel(AutoExposure::KERNEL_SCALAR);
+        ASSERT_TRUE(ae.meter(&v, 1, &scalar));
+        ae.set_kernel(AutoExposure::KERNEL_SIMD);
+        ASSERT_TRUE(ae.meter(&v, 1, &simd));
+        EXPECT_TRUE(scalar.count > 0);
+        EXPECT_EQ(scalar.count, simd.count);
+        EXPECT_EQ(scalar.sum, simd.sum);
+        EXPECT_EQ(memcmp(scalar.bins, simd.bins, sizeof(scalar.bins)), 0);
+    }
+}
+
+TEST(AutoExposure, BrightensDarkFrames)
+{
+    std::vector<uint8_t> buf(64 * 48, 30);
+    ImageView v;
+    memset(&v, 0, sizeof(v));
+    v.data = buf.data();
+    v.width = 64;
+    v.height = 48;
+    v.pitch = 64;
+    v.format = QVRCAMERA_FRAME_FORMAT_Y8;
+
+    AutoExposure ae;
+    AutoExposure::Histogram h;
+    ASSERT_TRUE(ae.meter(&v, 1, &h));
+    EXPECT_NEAR(h.mean(), 30.0, 1e-6);
+    AutoExposure::Settings s = ae.update(h, 1000000, 100);
+    EXPECT_TRUE((double) s.exposure_ns * s.gain > 1000000.0 * 100);
+
+    // and darkens clipped ones
+    memset(buf.data(), 255, buf.size());
+    ae.reset();
+    ASSERT_TRUE(ae.meter(&v, 1, &h));
+    s = ae.update(h, 1000000, 100);
+    EXPECT_TRUE((double) s.exposure_ns * s.gain < 1000000.0 * 100);
+}
+
+// the loop on the mock tracking camera brings the brightness back within
+// 0.2 EV in the first half of 2.5 s after the light drops to a quarter and
+// after it goes up to four times
+TEST(AutoExposure, SettlesAfterLightStep)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    auto set_light = MOCK_FN(qvrcammock_set_scene_light);
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    ASSERT_TRUE(cam != NULL);
+    EXPECT_EQ(QVRCameraDevice_Start(cam), QVR_CAM_SUCCESS);
+    FrameViews::Layout layout = FrameViews::query_layout(cam);
+
+    AutoExposure ae;
+    int32_t next_fn = 0;
+    uint32_t exposure = 0, gain = 0;
+    for (uint32_t light : { 25u, 400u }) {
+        EXPECT_EQ(ae.attach(cam), QVR_CAM_SUCCESS);
+        set_light(name, light, 0, 50);
+        // frames until the error stays within 0.2 EV
+        int converged = 0, n = 0;
+        int64_t end = now_ns() + 2500000000LL;
+        while (now_ns() < end) {
+            int32_t fn = next_fn;
+            qvrcamera_frame_t frame;
+            int32_t res = QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING,
+                                                   QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &frame);
+            EXPECT_EQ(res, QVR_CAM_SUCCESS);
+            if (res != QVR_CAM_SUCCESS)
+                break;
+            if (exposure == 0) {
+                exposure = frame.exposure;
+                gain = frame.gain;
+            }
+            FrameViews views;
+            views.from_frame(frame, layout);
+            AutoExposure::Stats before = ae.stats();
+            ae.process(views, frame);
+            QVRCameraDevice_ReleaseFrame(cam, fn);
+            next_fn = fn + 1;
+            n++;
+            const AutoExposure::Stats& st = ae.stats();
+            if (st.settling == before.settling && st.errors == before.errors && fabsf(st.error_ev) >= 0.2f)
+                converged = n;
+        }
+        EXPECT_TRUE(n > 10);
+        EXPECT_TRUE(converged < n / 2);
+        EXPECT_EQ(ae.stats().errors, 0u);
+    }
+
+    // the sensor as the other tests expect it, once the frames show it
+    ae.detach();
+    set_light(name, 100, 0, 50);
+    EXPECT_EQ(QVRCameraDevice_SetExposureAndGain(cam, exposure, (int) gain), QVR_CAM_SUCCESS);
+    auto restored = [&]() {
+        int32_t fn = next_fn;
+        qvrcamera_frame_t frame;
+        if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &frame) !=
+            QVR_CAM_SUCCESS)
+            return false;
+        QVRCameraDevice_ReleaseFrame(cam, fn);
+        next_fn = fn + 1;
+        return frame.exposure == exposure && frame.gain == gain;
+    };
+    EXPECT_TRUE(wait_for(restored, 100));
+    QVRCameraDevice_Stop(cam);
+    QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+}
+
+TEST(RoiScheduler, PlanCoversRegions)
+{
+    RoiScheduler sched;
+    const uint32_t width = 2560, height = 720;
+    uint32_t seed = 1;
+    auto rnd = [&](uint32_t n) {
+        seed = seed * 1103515245u + 12345u;
+        return (seed >> 8) % n;
+    };
+    for (int count = 1; count <= 6; count++) {
+        for (int n = 0; n < 200; n++) {
+            std::vector<RoiScheduler::Rect> rois;
+            for (int i = 0; i < count; i++) {
+                uint32_t w = 32 + rnd(224), h = 32 + rnd(160);
+                rois.push_back({ rnd(width - w), rnd(height - h), w, h });
+            }
+            RoiScheduler::Rect crops[RoiScheduler::MAX_CROPS];
+            int crop_count = sched.plan(rois.data(), count, width, height, crops);
+            EXPECT_LE(crop_count, RoiScheduler::MAX_CROPS);
+            for (int c = 0; c < crop_count; c++) {
+                EXPECT_EQ(crops[c].x % sched.config().align_x, 0u);
+                EXPECT_LE(crops[c].x + crops[c].width, width);
+                EXPECT_LE(crops[c].y + crops[c].height, height);
+            }
+            for (const RoiScheduler::Rect& r : rois) {
+                bool inside = crop_count == 0;
+                for (int c = 0; c < crop_count && !inside; c++)
+                    inside = r.x >= crops[c].x && r.y >= crops[c].y && r.x + r.width <= crops[c].x + crops[c].width &&
+                             r.y + r.height <= crops[c].y + crops[c].height;
+                EXPECT_TRUE(inside);
+            }
+        }
+    }
+
+    // one small region is one crop, a small part of the frame
+    RoiScheduler::Rect roi = { 100, 100, 64, 64 };
+    RoiScheduler::Rect crops[RoiScheduler::MAX_CROPS];
+    ASSERT_EQ(sched.plan(&roi, 1, width, height, crops), 1);
+    EXPECT_TRUE((uint64_t) crops[0].width * crops[0].height < (uint64_t) width * height / 10);
+}
+
+// two crops that move without resizing grow to be told apart, and never
+// into each other: the top crop can't grow down into the one below it
+TEST(RoiScheduler, MovedCropsStayDisjoint)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, QVRSERVICE_CAMERA_NAME_TRACKING);
+    ASSERT_TRUE(cam != NULL);
+    uint16_t width = 0, height = 0;
+    QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT16_CAMERA_FRAME_WIDTH, QVRCAMERA_PARAM_NUM_TYPE_UINT16,
+                                sizeof(width), (char*) &width);
+    QVRCameraDevice_GetParamNum(cam, QVR_CAMDEVICE_UINT16_CAMERA_FRAME_HEIGHT, QVRCAMERA_PARAM_NUM_TYPE_UINT16,
+                                sizeof(height), (char*) &height);
+    RoiScheduler sched;
+    EXPECT_EQ(QVRCameraDevice_Start(cam), QVR_CAM_SUCCESS);
+    EXPECT_EQ(sched.attach(cam), QVR_CAM_SUCCESS);
+
+    // frames of the sizes of m, the scheduler looks at nothing else
+    auto frame_of = [&](const RoiScheduler::Mapping& m) {
+        qvrcamera_frame_t f;
+        memset(&f, 0, sizeof(f));
+        f.width = m.num_crops > 0 ? m.crops[0].width : width;
+        f.height = m.num_crops > 0 ? m.crops[0].height : height;
+        f.secondary_width = m.num_crops > 1 ? m.crops[1].width : 0;
+        f.secondary_height = m.num_crops > 1 ? m.crops[1].height : 0;
+        return f;
+    };
+    auto disjoint = [](const RoiScheduler::Mapping& m) {
+        const RoiScheduler::Rect& a = m.crops[0];
+        const RoiScheduler::Rect& b = m.crops[1];
+        return !(a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height);
+    };
+
+    // crops { 0, 0, 64, 64 } and { 48, 64, 64, 48 } with the default margin
+    int a = sched.add({ 16, 16, 32, 32 });
+    int b = sched.add({ 64, 80, 32, 32 });
+    RoiScheduler::Mapping m = {};
+    sched.on_frame(frame_of(m), &m);
+    RoiScheduler::Mapping first = sched.sent_crops();
+    ASSERT_EQ(first.num_crops, 2u);
+    EXPECT_EQ(first.crops[0].y + first.crops[0].height, first.crops[1].y);
+    EXPECT_TRUE(disjoint(first));
+    EXPECT_TRUE(sched.on_frame(frame_of(first), &m));
+
+    // both a hysteresis to the right: the same sizes again
+    sched.move(a, { 64, 16, 32, 32 });
+    sched.move(b, { 112, 80, 32, 32 });
+    sched.on_frame(frame_of(first), &m);
+    RoiScheduler::Mapping moved = sched.sent_crops();
+    EXPECT_EQ(sched.stats().updates, 2u);
+    ASSERT_EQ(moved.num_crops, 2u);
+    EXPECT_TRUE(moved.crops[0].width != first.crops[0].width || moved.crops[0].height != first.crops[0].height ||
+                moved.crops[1].width != first.crops[1].width || moved.crops[1].height != first.crops[1].height);
+    EXPECT_TRUE(disjoint(moved));
+    EXPECT_EQ(sched.stats().errors, 0u);
+
+    // whole frames again for the other tests, once they show
+    sched.detach();
+    auto whole = [&]() {
+        int32_t fn = 0;
+        qvrcamera_frame_t frame;
+        if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &frame) !=
+            QVR_CAM_SUCCESS)
+            return false;
+        QVRCameraDevice_ReleaseFrame(cam, fn);
+        return frame.width == width && frame.height == height && frame.secondary_width == 0;
+    };
+    EXPECT_TRUE(wait_for(whole, 100));
+    QVRCameraDevice_Stop(cam);
+    QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+}
+
+// regions read through hardware crops of the mock tracking camera, one
+// still and one moving, hold the pixels a whole frame has there, the bar
+// of either frame aside
+TEST(RoiScheduler, CropViewsMatchWholeFrames)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    auto bar_x = MOCK_FN(qvrcammock_bar_x);
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    ASSERT_TRUE(cam != NULL);
+    RoiScheduler sched;
+    EXPECT_EQ(QVRCameraDevice_Start(cam), QVR_CAM_SUCCESS);
+    EXPECT_EQ(sched.attach(cam), QVR_CAM_SUCCESS);
+    FrameViews::Layout layout = FrameViews::query_layout(cam);
+
+    std::vector<uint8_t> ref;
+    uint32_t ref_pitch = 0, ref_fn = 0, ref_len = 0, image_w = 0;
+    int still = -1, moving = -1;
+    RoiScheduler::Rect sweep = { 40, 120, 160, 120 };
+    int32_t next_fn = 0;
+    uint64_t checked = 0, missing = 0, bad_pixels = 0, cropped = 0;
+    for (int n = 0; n < 40; n++) {
+        int32_t fn = next_fn;
+        qvrcamera_frame_t frame;
+        int32_t res = QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE,
+                                               &frame);
+        EXPECT_EQ(res, QVR_CAM_SUCCESS);
+        if (res != QVR_CAM_SUCCESS)
+            break;
+        next_fn = fn + 1;
+        RoiScheduler::Mapping m;
+        bool known = sched.on_frame(frame, &m);
+        if (ref.empty() && known && m.num_crops == 0) {
+            // the whole frame to check against, then the regions
+            ref_pitch = frame.stride;
+            ref_fn = frame.fn;
+            ref_len = frame.len;
+            image_w = frame.width / layout.images;
+            ref.assign((const uint8_t*) frame.buffer, (const uint8_t*) frame.buffer + frame.len);
+            still = sched.add({ 960, 300, 128, 96 });
+            moving = sched.add(sweep);
+        } else if (!ref.empty()) {
+            cropped += known && m.num_crops != 0;
+            for (int id : { still, moving }) {
+                ImageView v;
+                if (!known || !sched.roi_view(frame, m, id, &v)) {
+                    missing++;
+                    continue;
+                }
+                uint32_t bx = bar_x(name, frame.fn), ref_bx = bar_x(name, ref_fn);
+                for (uint32_t y = 0; y < v.height; y++) {
+                    for (uint32_t x = 0; x < v.width; x++) {
+                        uint32_t fx = v.x + x, fy = v.y + y;
+                        uint32_t ix = fx % image_w;
+                        bool bar = (ix >= bx && ix < bx + 24) || (ix >= ref_bx && ix < ref_bx + 24);
+                        if (!bar && v.data[(size_t) y * v.pitch + x] != ref[(size_t) fy * ref_pitch + fx])
+                            bad_pixels++;
+                    }
+                }
+                checked++;
+            }
+            sweep.x += 4;
+            sched.move(moving, sweep);
+        }
+        QVRCameraDevice_ReleaseFrame(cam, fn);
+    }
+    EXPECT_TRUE(checked > 0);
+    EXPECT_TRUE(cropped > 0);
+    // regions are missing only until crops that hold them show
+    EXPECT_TRUE(missing < checked / 2);
+    EXPECT_EQ(bad_pixels, 0u);
+    EXPECT_EQ(sched.stats().errors, 0u);
+
+    // whole frames again for the other tests, once they show
+    sched.detach();
+    auto whole = [&]() {
+        int32_t fn = next_fn;
+        qvrcamera_frame_t frame;
+        if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE, &frame) !=
+            QVR_CAM_SUCCESS)
+            return false;
+        QVRCameraDevice_ReleaseFrame(cam, fn);
+        next_fn = fn + 1;
+        return frame.len == ref_len;
+    };
+    EXPECT_TRUE(wait_for(whole, 100));
+    QVRCameraDevice_Stop(cam);
+    QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+}
+
+// the quarter stream of a camera holds its full frames downscaled 2x2: a
+// box filter for tracking, the top left sample of each block for depth
+TEST(CameraStreams, QuarterMatchesFull)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    for (const char* name : { QVRSERVICE_CAMERA_NAME_TRACKING, QVRSERVICE_CAMERA_NAME_DEPTH }) {
+        CameraStreams streams;
+        EXPECT_EQ(streams.attach(client, name), QVR_CAM_SUCCESS);
+        bool depth = strcmp(name, QVRSERVICE_CAMERA_NAME_DEPTH) == 0;
+        uint32_t qw = 0, qh = 0, bpp = depth ? 2 : 1;
+        EXPECT_TRUE(streams.frame_size(CameraStreams::RES_QUARTER, &qw, &qh));
+
+        // by frame number, filled on the stream threads
+        std::mutex lock;
+        std::map<uint32_t, std::vector<uint8_t>> full, quarter;
+        std::atomic<uint64_t> size_errors(0);
+        YuvOps yuv;
+        streams.add_consumer(CameraStreams::RES_FULL, [&](const CameraStreams::FrameHandle& h) {
+            const qvrcamera_frame_t& f = h.frame();
+            if (f.width != qw * 2 || f.height != qh * 2) {
+                size_errors++;
+                return;
+            }
+            std::vector<uint8_t> ref((size_t) qw * qh * bpp);
+            if (depth) {
+                for (uint32_t y = 0; y < qh; y++) {
+                    const uint16_t* src = (const uint16_t*) (h.data() + (size_t) 2 * y * f.stride);
+                    uint16_t* dst = (uint16_t*) ref.data() + (size_t) y * qw;
+                    for (uint32_t x = 0; x < qw; x++)
+                        dst[x] = src[2 * x];
+                }
+            } else {
+                Plane src = { (uint8_t*) h.data(), f.width, f.height, f.stride };
+                Plane dst = { ref.data(), qw, qh, qw };
+                yuv.downscale(src, dst, 2, YuvOps::FILTER_BOX);
+            }
+            std::lock_guard<std::mutex> l(lock);
+            full[f.fn] = std::move(ref);
+        });
+        streams.add_consumer(CameraStreams::RES_QUARTER, [&](const CameraStreams::FrameHandle& h) {
+            const qvrcamera_frame_t& f = h.frame();
+            if (f.width != qw || f.height != qh) {
+                size_errors++;
+                return;
+            }
+            std::vector<uint8_t> copy((size_t) qw * qh * bpp);
+            for (uint32_t y = 0; y < qh; y++)
+                memcpy(copy.data() + (size_t) y * qw * bpp, h.data() + (size_t) y * f.stride, qw * bpp);
+            std::lock_guard<std::mutex> l(lock);
+            quarter[f.fn] = std::move(copy);
+        });
+        EXPECT_TRUE(streams.start());
+        usleep(500 * 1000);
+        streams.stop();
+
+        uint64_t compared = 0, mismatched = 0;
+        for (const auto& q : quarter) {
+            auto it = full.find(q.first);
+            if (it == full.end())
+                continue;
+            compared++;
+            mismatched += q.second != it->second;
+        }
+        EXPECT_TRUE(compared > 0);
+        EXPECT_EQ(mismatched, 0u);
+        EXPECT_EQ(size_errors.load(), 0u);
+        EXPECT_EQ(streams.stats(CameraStreams::RES_FULL).errors, 0u);
+        EXPECT_EQ(streams.stats(CameraStreams::RES_QUARTER).errors, 0u);
+        streams.close();
+    }
+    QVRCameraClient_Destroy(client);
+}
+
+static XrIntrinsicCalibrationQTI calibration(XrDistortionModelQTI model, const double* radial, int n,
+                                             double p1, double p2, uint32_t width, uint32_t height)
+{
+    XrIntrinsicCalibrationQTI cal;
+    memset(&cal, 0, sizeof(cal));
+    cal.size.width = width;
+    cal.size.height = height;
+    cal.principalPoint.x = (width - 1) / 2.0;
+    cal.principalPoint.y = (height - 1) / 2.0;
+    cal.focalLength.x = width * 0.625;
+    cal.focalLength.y = width * 0.625;
+    for (int i = 0; i < n; i++)
+        cal.radialDistortion[i] = radial[i];
+    cal.tangentialDistortion[0] = p1;
+    cal.tangentialDistortion[1] = p2;
+    cal.distortionModel = model;
+    return cal;
+}
+
+// worst round trip error in pixels of unproject() then project() over a
+// grid of the lens' pixels, and how many of them didn't invert
+static double round_trip(const LensModel& lens, uint32_t step, uint32_t* failed)
+{
+    double worst = 0;
+    *failed = 0;
+    for (uint32_t v = 0; v < lens.height(); v += step) {
+        for (uint32_t u = 0; u < lens.width(); u += step) {
+            double x, y, pu, pv;
+            if (!lens.unproject(u, v, &x, &y) || !lens.project(x, y, &pu, &pv)) {
+                (*failed)++;
+                continue;
+            }
+            worst = std::max(worst, fabs(pu - u) + fabs(pv - v));
+        }
+    }
+    return worst;
+}
+
+TEST(LensModel, RoundTrips)
+{
+    struct Case {
+        XrDistortionModelQTI model;
+        double radial[6];
+        int n;
+        double p1, p2;
+    };
+    const Case cases[] = {
+        { XR_DISTORTION_MODEL_QTI_LINEAR, {}, 0, 0, 0 },
+        { XR_DISTORTION_MODEL_QTI_RADIAL_2_PARAMS, { -0.1, 0.02 }, 2, 0.001, -0.0005 },
+        { XR_DISTORTION_MODEL_QTI_RADIAL_3_PARAMS, { -0.12, 0.05, -0.01 }, 3, 0.001, -0.0005 },
+        { XR_DISTORTION_MODEL_QTI_RADIAL_6_PARAMS, { 0.3, 0.1, 0.01, 0.35, 0.12, 0.015 }, 6, 0.001, -0.0005 },
+        { XR_DISTORTION_MODEL_QTI_FISHEYE_1_PARAM, { 0.9 }, 1, 0, 0 },
+        { XR_DISTORTION_MODEL_QTI_FISHEYE_4_PARAMS, { 0.02, -0.005, 0.001, -0.0002 }, 4, 0, 0 },
+    };
+    for (const Case& c : cases) {
+        LensModel lens(calibration(c.model, c.radial, c.n, c.p1, c.p2, 160, 120));
+        ASSERT_TRUE(lens.valid());
+        uint32_t failed;
+        EXPECT_LE(round_trip(lens, 3, &failed), 1e-4);
+        EXPECT_EQ(failed, 0u);
+    }
+}
+
+// the factory calibrations of the mock cameras invert as well
+TEST(LensModel, MockCalibrations)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    for (const char* name :
+         { QVRSERVICE_CAMERA_NAME_TRACKING, QVRSERVICE_CAMERA_NAME_RGB, QVRSERVICE_CAMERA_NAME_EYE_TRACKING }) {
+        qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+        EXPECT_TRUE(cam != NULL);
+        if (cam == NULL)
+            continue;
+        XrIntrinsicCalibrationQTI cal;
+        EXPECT_EQ(LensModel::query(cam, 0, &cal), QVR_CAM_SUCCESS);
+        LensModel lens(cal);
+        EXPECT_TRUE(lens.valid());
+        uint32_t failed;
+        EXPECT_LE(round_trip(lens, 7, &failed), 1e-4);
+        EXPECT_EQ(failed, 0u);
+        QVRCameraDevice_DetachCamera(cam);
+    }
+    QVRCameraClient_Destroy(client);
+}
+
+static ImageView depth_view(const std::vector<uint16_t>& depth, uint32_t w, uint32_t h)
+{
+    ImageView view;
+    memset(&view, 0, sizeof(view));
+    view.data = (const uint8_t*) depth.data();
+    view.width = w;
+    view.height = h;
+    view.pitch = w * 2;
+    view.format = QVRCAMERA_FRAME_FORMAT_DEPTH16;
+    return view;
+}
+
+TEST(DepthOps, BackProjectKernelsAgree)
+{
+    const uint32_t w = 64, h = 48;
+    LensModel lens(calibration(XR_DISTORTION_MODEL_QTI_LINEAR, NULL, 0, 0, 0, w, h));
+    std::vector<uint16_t> depth(w * h);
+    uint32_t expected = 0;
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            depth[y * w + x] = (x + y) % 7 == 0 ? 0 : (uint16_t) (500 + 10 * x + y);
+            expected += depth[y * w + x] != 0;
+        }
+    }
+    ImageView view = depth_view(depth, w, h);
+
+    std::vector<std::vector<uint8_t>> clouds;
+    const struct {
+        int threads;
+        DepthOps::Kernel kernel;
+    } variants[] = {
+        { 1, DepthOps::KERNEL_SCALAR },
+        { 1, DepthOps::KERNEL_SIMD },
+        { 3, DepthOps::KERNEL_SIMD },
+    };
+    for (const auto& var : variants) {
+        DepthOps ops(var.threads);
+        ops.set_kernel(var.kernel);
+        ASSERT_TRUE(ops.set_lens(lens));
+        std::vector<uint8_t> mem(DepthOps::cloud_size(w * h), 0);
+        XrPointCloudQTI* cloud = (XrPointCloudQTI*) mem.data();
+        cloud->maxPoints = w * h;
+        ASSERT_TRUE(ops.back_project(view, cloud));
+        EXPECT_EQ(cloud->numPoints, expected);
+        mem.resize(DepthOps::cloud_size(cloud->numPoints));
+        cloud->maxPoints = 0;
+        clouds.push_back(mem);
+    }
+    EXPECT_TRUE(clouds[1] == clouds[0]);
+    EXPECT_TRUE(clouds[2] == clouds[0]);
+
+    // every point is its pixel's ray at its depth
+    const XrPointCloudQTI* cloud = (const XrPointCloudQTI*) clouds[0].data();
+    for (uint32_t i = 0; i < cloud->numPoints; i++) {
+        const XrMapPointQTI& p = cloud->points[i];
+        uint32_t x = p.id % w, y = p.id / w;
+        double u, v;
+        ASSERT_TRUE(lens.project(p.position.x / p.position.z, p.position.y / p.position.z, &u, &v));
+        EXPECT_NEAR(u, x, 1e-3);
+        EXPECT_NEAR(v, y, 1e-3);
+        EXPECT_NEAR(p.position.z, depth[p.id] * 0.001, 1e-6);
+    }
+}
+
+// count depth frames off the mock depth camera, copied out, and the left
+// edge of the bar in each
+static bool grab_depth(int count, std::vector<std::vector<uint16_t>>* frames, std::vector<uint32_t>* bars,
+                       uint32_t* w, uint32_t* h)
+{
+    qvrcamera_client_helper_t* client = camera_client();
+    if (client == NULL)
+        return false;
+    const char* name = QVRSERVICE_CAMERA_NAME_DEPTH;
+    auto bar_x = MOCK_FN(qvrcammock_bar_x);
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    if (cam != NULL && QVRCameraDevice_Start(cam) == QVR_CAM_SUCCESS) {
+        int32_t next_fn = 0;
+        while ((int) frames->size() < count) {
+            int32_t fn = next_fn;
+            qvrcamera_frame_t frame;
+            if (QVRCameraDevice_GetFrame(cam, &fn, QVRCAMERA_MODE_BLOCKING, QVRCAMERA_MODE_NEWER_IF_AVAILABLE,
+                                         &frame) != QVR_CAM_SUCCESS)
+                break;
+            *w = frame.width;
+            *h = frame.height;
+            std::vector<uint16_t> d((size_t) frame.width * frame.height);
+            for (uint32_t y = 0; y < frame.height; y++)
+                memcpy(&d[(size_t) y * frame.width], (const uint8_t*) frame.buffer + (size_t) y * frame.stride,
+                       (size_t) frame.width * 2);
+            frames->push_back(std::move(d));
+            bars->push_back(bar_x(name, frame.fn));
+            QVRCameraDevice_ReleaseFrame(cam, fn);
+            next_fn = fn + 1;
+        }
+        QVRCameraDevice_Stop(cam);
+    }
+    if (cam != NULL)
+        QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+    return (int) frames->size() == count;
+}
+
+// the mock renders a plane that drops 1500 mm over the frame, with holes:
+// every hole gets filled, away from the bar within what the window spans
+// of the plane, and a thread pool fills the same
+TEST(DepthOps, FillsHolesOnThePlane)
+{
+    std::vector<std::vector<uint16_t>> depth;
+    std::vector<uint32_t> bars;
+    uint32_t w = 0, h = 0;
+    ASSERT_TRUE(grab_depth(5, &depth, &bars, &w, &h));
+    DepthOps one(1), pool(3);
+    const uint32_t r = one.config().fill_radius;
+    std::vector<uint16_t> filled((size_t) w * h), filled_pool((size_t) w * h);
+    int64_t fills = 0;
+    uint64_t holes = 0, checked = 0;
+    double worst = 0;
+    for (size_t i = 0; i < depth.size(); i++) {
+        fills += one.fill_holes(depth_view(depth[i], w, h), filled.data(), w * 2);
+        pool.fill_holes(depth_view(depth[i], w, h), filled_pool.data(), w * 2);
+        EXPECT_TRUE(filled == filled_pool);
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                size_t k = (size_t) y * w + x;
+                if (depth[i][k] != 0)
+                    continue;
+                holes++;
+                if (x + r + 1 >= bars[i] && x <= bars[i] + 24 + r)
+                    continue;
+                worst = std::max(worst, fabs((double) filled[k] - (1500 + y * 1500 / h)));
+                checked++;
+            }
+        }
+    }
+    EXPECT_TRUE(checked > 0);
+    EXPECT_EQ(fills, (int64_t) holes);
+    EXPECT_LE(worst, 1500.0 * r / h + 1.0);
+}
+
+// the temporal median of both kernels against nth_element over the same
+// frames, and the input until the window is full
+TEST(DepthOps, MedianMatchesNthElement)
+{
+    std::vector<std::vector<uint16_t>> depth;
+    std::vector<uint32_t> bars;
+    uint32_t w = 0, h = 0;
+    ASSERT_TRUE(grab_depth(8, &depth, &bars, &w, &h));
+    for (uint32_t window : { 3u, 5u }) {
+        DepthOps::Config config;
+        config.median_frames = window;
+        DepthOps scalar(1, config), simd(3, config);
+        scalar.set_kernel(DepthOps::KERNEL_SCALAR);
+        std::vector<uint16_t> a((size_t) w * h), b((size_t) w * h);
+        uint64_t bad = 0;
+        for (size_t i = 0; i < depth.size(); i++) {
+            EXPECT_TRUE(scalar.median(depth_view(depth[i], w, h), a.data(), w * 2));
+            EXPECT_TRUE(simd.median(depth_view(depth[i], w, h), b.data(), w * 2));
+            for (size_t k = 0; k < a.size(); k++) {
+                uint16_t ref = depth[i][k];
+                if (i + 1 >= window) {
+                    uint16_t v[5];
+                    for (uint32_t j = 0; j < window; j++)
+                        v[j] = depth[i - j][k];
+                    std::nth_element(v, v + window / 2, v + window);
+                    ref = v[window / 2];
+                }
+                bad += (a[k] != ref) + (b[k] != ref);
+            }
+        }
+        EXPECT_EQ(bad, 0u);
+    }
+}
+
+TEST(UndistortMap, RemapAndPersist)
+{
+    const double radial[] = { -0.12, 0.05, -0.01 };
+    XrIntrinsicCalibrationQTI cal = calibration(XR_DISTORTION_MODEL_QTI_RADIAL_3_PARAMS, radial, 3, 0.001, 0, 97, 64);
+    XrIntrinsicCalibrationQTI target = UndistortMap::pinhole(cal, 1.0);
+    UndistortMap map;
+    ASSERT_TRUE(map.build(LensModel(cal), target, NULL));
+    EXPECT_EQ(map.width(), 97u);
+    EXPECT_EQ(map.key(), UndistortMap::key_of(cal, target, NULL));
+
+    std::vector<uint8_t> src(97 * 64);
+    for (size_t i = 0; i < src.size(); i++)
+        src[i] = (uint8_t) (i * 2654435761u >> 17);
+    ImageView view;
+    memset(&view, 0, sizeof(view));
+    view.data = src.data();
+    view.width = 97;
+    view.height = 64;
+    view.pitch = 97;
+    view.format = QVRCAMERA_FRAME_FORMAT_Y8;
+    std::vector<uint8_t> scalar(src.size()), simd(src.size());
+    ASSERT_TRUE(map.remap(view, scalar.data(), 97, UndistortMap::KERNEL_SCALAR, 7));
+    ASSERT_TRUE(map.remap(view, simd.data(), 97, UndistortMap::KERNEL_SIMD, 7));
+    EXPECT_TRUE(scalar == simd);
+
+    std::string path = temp_path("undistort.map");
+    ASSERT_TRUE(map.save(path.c_str()));
+    UndistortMap loaded;
+    EXPECT_FALSE(loaded.load(path.c_str(), map.key() + 1));
+    EXPECT_FALSE(loaded.valid());
+    ASSERT_TRUE(loaded.load(path.c_str(), map.key()));
+    EXPECT_TRUE(loaded == map);
+
+    // a flipped byte in the table doesn't check out
+    FILE* f = fopen(path.c_str(), "r+b");
+    ASSERT_TRUE(f != NULL);
+    fseek(f, -5, SEEK_END);
+    int c = fgetc(f);
+    fseek(f, -5, SEEK_END);
+    fputc(c ^ 0x40, f);
+    fclose(f);
+    UndistortMap corrupt;
+    EXPECT_FALSE(corrupt.load(path.c_str(), map.key()));
+    unlink(path.c_str());
+}
+
+// worst difference of a remapped Y8 image from bilinear sampling of src in
+// double precision at the exact source positions, over the pixels with one
+static int undistort_error(const ImageView& src, const XrIntrinsicCalibrationQTI& cal, const uint8_t* out,
+                           uint32_t out_pitch)
+{
+    LensModel lens(cal);
+    LensModel ideal(UndistortMap::pinhole(cal, 1.0));
+    int worst = 0;
+    for (uint32_t v = 0; v < ideal.height(); v++) {
+        for (uint32_t u = 0; u < ideal.width(); u++) {
+            double x, y, su, sv;
+            ideal.unproject(u, v, &x, &y);
+            if (!lens.project(x, y, &su, &sv) || su < 0.0 || sv < 0.0 || su >= src.width - 1.0 ||
+                sv >= src.height - 1.0)
+                continue;
+            uint32_t x0 = (uint32_t) su, y0 = (uint32_t) sv;
+            double fx = su - x0, fy = sv - y0;
+            const uint8_t* p = src.data + (size_t) y0 * src.pitch + x0;
+            double ref = (p[0] * (1 - fx) + p[1] * fx) * (1 - fy) + (p[src.pitch] * (1 - fx) + p[src.pitch + 1] * fx) * fy;
+            worst = std::max(worst, abs((int) out[(size_t) v * out_pitch + u] - (int) lround(ref)));
+        }
+    }
+    return worst;
+}
+
+// every distortion model on a gradient and checker: the kernels agree and
+// stay within 2 of the exact bilinear sample
+TEST(UndistortMap, MatchesBilinearReference)
+{
+    const uint32_t w = 320, h = 240;
+    const XrDistortionModelQTI models[] = {
+        XR_DISTORTION_MODEL_QTI_LINEAR,          XR_DISTORTION_MODEL_QTI_RADIAL_2_PARAMS,
+        XR_DISTORTION_MODEL_QTI_RADIAL_3_PARAMS, XR_DISTORTION_MODEL_QTI_RADIAL_6_PARAMS,
+        XR_DISTORTION_MODEL_QTI_FISHEYE_1_PARAM, XR_DISTORTION_MODEL_QTI_FISHEYE_4_PARAMS,
+    };
+    const double radial[][6] = {
+        {}, { -0.1, 0.02 }, { -0.12, 0.05, -0.01 }, { 0.3, 0.1, 0.01, 0.35, 0.12, 0.015 }, { 0.9 },
+        { 0.02, -0.005, 0.001, -0.0002 },
+    };
+    std::vector<uint8_t> pattern(w * h), a(w * h), b(w * h);
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++)
+            pattern[y * w + x] = (uint8_t) (x * 140 / w + ((((x / 20) ^ (y / 20)) & 1) ? 64 : 16));
+    }
+    ImageView pv;
+    memset(&pv, 0, sizeof(pv));
+    pv.data = pattern.data();
+    pv.width = w;
+    pv.height = h;
+    pv.pitch = w;
+    pv.format = QVRCAMERA_FRAME_FORMAT_Y8;
+    for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+        XrIntrinsicCalibrationQTI cal = calibration(models[i], radial[i], 6, 0, 0, w, h);
+        UndistortMap m;
+        ASSERT_TRUE(m.build(LensModel(cal), UndistortMap::pinhole(cal, 1.0), NULL));
+        ASSERT_TRUE(m.remap(pv, a.data(), w, UndistortMap::KERNEL_SCALAR));
+        ASSERT_TRUE(m.remap(pv, b.data(), w, UndistortMap::KERNEL_SIMD));
+        EXPECT_TRUE(a == b);
+        EXPECT_LE(undistort_error(pv, cal, b.data(), w), 2);
+    }
+}
+
+// on the mock tracking camera: the first start builds and saves the maps
+// and a later one loads them, a damaged file is rebuilt, and a calibration
+// that changes with the frames replaces the map without being saved
+TEST(UndistortCache, LoadsRebuildsAndRecalibrates)
+{
+    std::string dir = temp_path("undistort-XXXXXX");
+    ASSERT_TRUE(mkdtemp(&dir[0]) != NULL);
+    qvrcamera_client_helper_t* client = camera_client();
+    ASSERT_TRUE(client != NULL);
+    const char* name = QVRSERVICE_CAMERA_NAME_TRACKING;
+    auto set_calibration = MOCK_FN(qvrcammock_set_calibration);
+    qvrcamera_device_helper_t* cam = QVRCameraClient_AttachCamera(client, name);
+    ASSERT_TRUE(cam != NULL);
+    EXPECT_EQ(QVRCameraDevice_Start(cam), QVR_CAM_SUCCESS);
+
+    UndistortCache::Config config;
+    config.dir = dir;
+    std::vector<std::shared_ptr<const UndistortMap>> built;
+    UndistortCache::Stats runs[2];
+    for (int run = 0; run < 2; run++) {
+        UndistortCache cache(config);
+        EXPECT_EQ(cache.attach(cam), QVR_CAM_SUCCESS);
+        for (uint32_t i = 0; i < cache.images(); i++) {
+            std::shared_ptr<const UndistortMap> m = cache.map(i);
+            EXPECT_TRUE(m != NULL);
+            if (m != NULL && run == 0)
+                built.push_back(m);
+            else if (m != NULL)
+                EXPECT_TRUE(i < built.size() && *m == *built[i]);
+        }
+        runs[run] = cache.stats();
+    }
+    ASSERT_EQ(built.size(), 2u);
+    EXPECT_EQ(runs[0].saves, 2u);
+    EXPECT_EQ(runs[1].loads, 2u);
+    EXPECT_EQ(runs[1].builds, 0u);
+
+    UndistortCache cache(config);
+    cache.attach(cam);
+    std::string damaged = cache.path_of(built[0]->key());
+    EXPECT_EQ(truncate(damaged.c_str(), 1000), 0);
+    std::shared_ptr<const UndistortMap> rebuilt = cache.map(0);
+    EXPECT_TRUE(rebuilt != NULL && *rebuilt == *built[0]);
+    UndistortMap reloaded;
+    EXPECT_TRUE(reloaded.load(damaged.c_str(), built[0]->key()));
+    EXPECT_EQ(cache.stats().disk_errors, 1u);
+
+    // frames through GetFrameEx() with their calibration; half way the left
+    // lens gets recalibrated
+    XrIntrinsicCalibrationQTI factory, recalibrated;
+    EXPECT_EQ(LensModel::query(cam, 0, &factory), QVR_CAM_SUCCESS);
+    recalibrated = factory;
+    recalibrated.focalLength.x *= 1.02;
+    recalibrated.focalLength.y *= 1.02;
+    recalibrated.principalPoint.x += 3.0;
+    XrCameraSensorCalibrationQTI calibrations[UndistortCache::MAX_IMAGES];
+    XrCameraFrameCalibrationInfoOutputQTI cal_out;
+    memset(&cal_out, 0, sizeof(cal_out));
+    cal_out.type = XR_TYPE_QTI_CAM_FRAME_CALIBRATION_INFO;
+    XrCameraFrameBufferOutputQTI buffer;
+    XrCameraFrameRequestInfoInputQTI in;
+    in.type = XR_TYPE_QTI_CAM_FRAME_REQ_INFO_INPUT;
+    in.next = NULL;
+    in.blockMode = XR_CAMERA_BLOCK_MODE_QTI_BLOCKING;
+    in.dropMode = XR_CAMERA_DROP_MODE_QTI_NEWER_IF_AVAILABLE;
+    uint32_t image_w = built[0]->source_width(), image_h = built[0]->source_height();
+    std::vector<uint8_t> out((size_t) image_w * image_h);
+    uint64_t key_before = built[0]->key(), key_after = 0;
+    int worst = 0;
+    uint32_t next_fn = 0;
+    for (int n = 0; n < 10; n++) {
+        if (n == 5)
+            set_calibration(name, 0, &recalibrated);
+        cal_out.calibrationCapacityIn = UndistortCache::MAX_IMAGES;
+        cal_out.calibrations = calibrations;
+        XrCameraFrameRequestInfoOutputQTI req;
+        memset(&req, 0, sizeof(req));
+        req.type = XR_TYPE_QTI_CAM_FRAME_REQ_INFO_OUTPUT;
+        req.next = (XrBaseStructQTI*) &cal_out;
+        req.bufferInfo.bufferCapacityIn = 1;
+        req.bufferInfo.buffers = &buffer;
+        in.frameNum = (int) next_fn;
+        int32_t res = QVRCameraDevice_GetFrameEx(cam, &in, &req);
+        EXPECT_EQ(res, QVR_CAM_SUCCESS);
+        if (res != QVR_CAM_SUCCESS)
+            break;
+        next_fn = req.frameNum + 1;
+        EXPECT_EQ(cal_out.calibrationCount, 2u);
+        cache.update(cal_out);
+        std::shared_ptr<const UndistortMap> m = cache.map(0);
+        EXPECT_TRUE(m != NULL);
+        if (m != NULL) {
+            key_after = m->key();
+            // against the calibration the frame came with
+            ImageView v;
+            memset(&v, 0, sizeof(v));
+            v.data = (const uint8_t*) buffer.bufVAddr;
+            v.width = image_w;
+            v.height = image_h;
+            v.pitch = buffer.stride;
+            v.format = buffer.format;
+            m->remap(v, out.data(), image_w, UndistortMap::KERNEL_SIMD);
+            worst = std::max(worst, undistort_error(v, calibrations[0].intrinsics, out.data(), image_w));
+        }
+        QVRCameraDevice_ReleaseFrame(cam, (int32_t) req.frameNum);
+    }
+    set_calibration(name, 0, &factory);
+    QVRCameraDevice_Stop(cam);
+    QVRCameraDevice_DetachCamera(cam);
+    QVRCameraClient_Destroy(client);
+
+    EXPECT_LE(worst, 2);
+    EXPECT_EQ(cache.stats().invalidations, 1u);
+    EXPECT_NE(key_after, key_before);
+    // only the factory calibrations persist
+    EXPECT_NE(access(cache.path_of(key_after).c_str(), F_OK), 0);
+    for (const std::shared_ptr<const UndistortMap>& m : built) {
+        EXPECT_EQ(access(cache.path_of(m->key()).c_str(), F_OK), 0);
+        unlink(cache.path_of(m->key()).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+static std::vector<uint8_t> make_cloud(const std::vector<XrMapPointQTI>& points)
+{
+    std::vector<uint8_t> mem(sizeof(XrPointCloudQTI) + points.size() * sizeof(XrMapPointQTI));
+    XrPointCloudQTI* cloud = (XrPointCloudQTI*) mem.data();
+    cloud->timestamp = 1;
+    cloud->maxPoints = cloud->numPoints = (uint32_t) points.size();
+    memcpy(cloud->points, points.data(), points.size() * sizeof(XrMapPointQTI));
+    return mem;
+}
+
+TEST(PointCloudMap, MergeAndExport)
+{
+    PointCloudMap map;
+    std::vector<XrMapPointQTI> points;
+    for (uint32_t i = 0; i < 3000; i++) {
+        XrMapPointQTI p;
+        p.position.x = (float) (i % 30) * 0.1f;
+        p.position.y = (float) (i / 30 % 10) * 0.1f;
+        p.position.z = 1.0f + (float) (i / 300) * 0.1f;
+        p.id = i * 7 + 3;
+        points.push_back(p);
+    }
+    map.merge(*(XrPointCloudQTI*) make_cloud(points).data());
+    EXPECT_EQ(map.size(), 3000u);
+    uint64_t v1 = map.version();
+
+    std::vector<XrMapPointQTI> copy;
+    EXPECT_EQ(map.export_changes(0, &copy), v1);
+    EXPECT_EQ(copy.size(), 3000u);
+
+    // a refinement within min_move is no change, a real move is
+    std::vector<XrMapPointQTI> second = { points[10], points[20] };
+    second[0].position.x += map.config().min_move * 0.5f;
+    second[1].position.x += 0.5f;
+    map.merge(*(XrPointCloudQTI*) make_cloud(second).data());
+    EXPECT_EQ(map.size(), 3000u);
+    EXPECT_EQ(map.stats().moved, 1u);
+    copy.clear();
+    uint64_t v2 = map.export_changes(v1, &copy);
+    EXPECT_TRUE(v2 > v1);
+    ASSERT_EQ(copy.size(), 1u);
+    EXPECT_EQ(copy[0].id, points[20].id);
+    EXPECT_EQ(copy[0].position.x, second[1].position.x);
+    copy.clear();
+    EXPECT_EQ(map.export_changes(v2, &copy), v2);
+    EXPECT_TRUE(copy.empty());
+
+    XrVector3fQTI p;
+    ASSERT_TRUE(map.find(points[10].id, &p));
+    EXPECT_EQ(p.x, points[10].position.x);
+    EXPECT_FALSE(map.find(1, &p));
+
+    map.clear();
+    EXPECT_EQ(map.size(), 0u);
+    EXPECT_TRUE(map.version() > v2);
+}
+
+TEST(PointCloudMap, Voxels)
+{
+    PointCloudMap::Config config;
+    config.voxel_size = 1.0f;
+    PointCloudMap map(config);
+    std::vector<XrMapPointQTI> points = {
+        { { 0.2f, 0.2f, 0.2f }, 9 },
+        { { 0.4f, 0.6f, 0.8f }, 4 },
+        { { 1.5f, 0.5f, 0.5f }, 6 },
+        { { -0.5f, 0.5f, 0.5f }, 2 },
+    };
+    map.merge(*(XrPointCloudQTI*) make_cloud(points).data());
+    std::vector<XrMapPointQTI> voxels;
+    map.export_voxels(&voxels);
+    ASSERT_EQ(voxels.size(), 3u);
+    // in first come order, at the mean with the lowest id
+    EXPECT_EQ(voxels[0].id, 4u);
+    EXPECT_NEAR(voxels[0].position.x, 0.3, 1e-6);
+    EXPECT_NEAR(voxels[0].position.y, 0.4, 1e-6);
+    EXPECT_NEAR(voxels[0].position.z, 0.5, 1e-6);
+    EXPECT_EQ(voxels[1].id, 6u);
+    EXPECT_EQ(voxels[2].id, 2u);
+}
+
+// qvrtest [filter]: the tests whose Suite.Name contains filter
+int main(int argc, char** argv)
+{
+    __log_func = quiet_log;
+    return run_tests(argc >= 2 ? argv[1] : NULL);
+}
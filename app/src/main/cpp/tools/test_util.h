@@ -0,0 +1,92 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+// Just enough of gtest's TEST() / EXPECT_*() / ASSERT_*() for qvrtest, so
+// the host build has nothing to install. A failed EXPECT marks the test
+// failed and goes on, a failed ASSERT returns from it.
+
+struct TestCase {
+    const char* suite;
+    const char* name;
+    void (*fn)();
+};
+
+static inline std::vector<TestCase>& test_cases()
+{
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+// failed checks of the running test
+static inline int& test_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+static inline void test_fail(const char* file, int line, const char* what)
+{
+    printf("%s:%d: failed: %s\n", file, line, what);
+    test_failures()++;
+}
+
+struct TestRegistrar {
+    TestRegistrar(const char* suite, const char* name, void (*fn)())
+    {
+        test_cases().push_back({ suite, name, fn });
+    }
+};
+
+#define TEST(suite, name)                                                            \
+    static void test_##suite##_##name();                                             \
+    static TestRegistrar registrar_##suite##_##name(#suite, #name, test_##suite##_##name); \
+    static void test_##suite##_##name()
+
+#define TEST_CHECK(cond, what, on_fail)          \
+    do {                                         \
+        if (!(cond)) {                           \
+            test_fail(__FILE__, __LINE__, what); \
+            on_fail;                             \
+        }                                        \
+    } while (0)
+
+#define EXPECT_TRUE(c) TEST_CHECK((c), #c, (void) 0)
+#define EXPECT_FALSE(c) TEST_CHECK(!(c), "!(" #c ")", (void) 0)
+#define EXPECT_EQ(a, b) TEST_CHECK((a) == (b), #a " == " #b, (void) 0)
+#define EXPECT_NE(a, b) TEST_CHECK((a) != (b), #a " != " #b, (void) 0)
+#define EXPECT_LE(a, b) TEST_CHECK((a) <= (b), #a " <= " #b, (void) 0)
+#define EXPECT_NEAR(a, b, eps) TEST_CHECK(fabs((double) (a) - (double) (b)) <= (eps), #a " ~= " #b, (void) 0)
+#define ASSERT_TRUE(c) TEST_CHECK((c), #c, return)
+#define ASSERT_EQ(a, b) TEST_CHECK((a) == (b), #a " == " #b, return)
+
+// Runs the tests whose "suite.name" contains filter, all for NULL; 0 when
+// every one passed
+static inline int run_tests(const char* filter)
+{
+    int failed = 0, run = 0;
+    for (const TestCase& t : test_cases()) {
+        char full[128];
+        snprintf(full, sizeof(full), "%s.%s", t.suite, t.name);
+        if (filter != NULL && strstr(full, filter) == NULL)
+            continue;
+        printf("[ RUN      ] %s\n", full);
+        fflush(stdout);
+        test_failures() = 0;
+        t.fn();
+        run++;
+        if (test_failures() != 0) {
+            failed++;
+            printf("[  FAILED  ] %s\n", full);
+        } else {
+            printf("[       OK ] %s\n", full);
+        }
+        fflush(stdout);
+    }
+    printf("%d tests, %d failed\n", run, failed);
+    return failed == 0 && run > 0 ? 0 : 1;
+}
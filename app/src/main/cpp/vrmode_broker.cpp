@@ -0,0 +1,248 @@
+#include "vrmode_broker.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "holder_log.h"
+#include "vrmode_broker_client.h"
+
+// Android's AID_SYSTEM
+#define SYSTEM_UID 1000
+
+static const char* lease_name(uint16_t lease)
+{
+    switch (lease) {
+        case QVRHOLDER_BROKER_OP_PAUSE:
+            return "pause";
+        case QVRHOLDER_BROKER_OP_STOP:
+            return "stop";
+        default:
+            return "none";
+    }
+}
+
+VrModeBroker::VrModeBroker(EventLoop& loop, VrModeHolder& holder)
+    : loop(loop)
+    , holder(holder)
+    , listen_fd(-1)
+    , pause_leases(0)
+    , stop_leases(0)
+    , requests(0)
+    , denied(0)
+{
+    stop_uids.push_back(0);
+    stop_uids.push_back(SYSTEM_UID);
+    allow_stop_uid(getuid());
+}
+
+void VrModeBroker::allow_stop_uid(uid_t uid)
+{
+    if (!may_stop(uid))
+        stop_uids.push_back(uid);
+}
+
+bool VrModeBroker::may_stop(uid_t uid) const
+{
+    return std::find(stop_uids.begin(), stop_uids.end(), uid) != stop_uids.end();
+}
+
+VrModeBroker::~VrModeBroker()
+{
+    stop();
+}
+
+bool VrModeBroker::start(const char* name)
+{
+    if (listen_fd >= 0)
+        return false;
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "broker socket failed: %d", errno);
+        return false;
+    }
+
+    struct sockaddr_un addr;
+    socklen_t len = broker_address(name, &addr);
+    if (bind(listen_fd, (struct sockaddr*) &addr, len) != 0 || listen(listen_fd, 8) != 0) {
+        // most likely another holder already serves the name
+        __log_func(ANDROID_LOG_ERROR, TAG, "broker bind @%s failed: %d", name, errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    if (!loop.add_fd(listen_fd, EPOLLIN, [this](uint32_t) { on_accept(); })) {
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    __log_func(ANDROID_LOG_INFO, TAG, "vrmode broker listening on @%s", name);
+    return true;
+}
+
+void VrModeBroker::stop()
+{
+    if (listen_fd < 0)
+        return;
+    loop.destroy_fd(listen_fd);
+    listen_fd = -1;
+
+    for (auto& c : clients)
+        loop.destroy_fd(c.first);
+    clients.clear();
+    pause_leases = 0;
+    stop_leases = 0;
+    update_target();
+}
+
+void VrModeBroker::on_accept()
+{
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                __log_func(ANDROID_LOG_WARN, TAG, "broker accept failed: %d", errno);
+            return;
+        }
+        if ((int) clients.size() >= MAX_CLIENTS) {
+            __log_func(ANDROID_LOG_WARN, TAG, "broker full, refusing client");
+            close(fd);
+            continue;
+        }
+
+        Client c = {};
+        // without credentials nothing is allowed a stop lease
+        c.pid = -1;
+        c.uid = (uid_t) -1;
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0) {
+            c.pid = cred.pid;
+            c.uid = cred.uid;
+        }
+        if (!loop.add_fd(fd, EPOLLIN, [this, fd](uint32_t events) { on_client(fd, events); })) {
+            close(fd);
+            continue;
+        }
+        clients[fd] = c;
+        __log_func(ANDROID_LOG_VERBOSE, TAG, "broker client pid %d uid %d", (int) c.pid, (int) c.uid);
+    }
+}
+
+void VrModeBroker::on_client(int fd, uint32_t events)
+{
+    auto it = clients.find(fd);
+    if (it == clients.end())
+        return;
+    Client& c = it->second;
+
+    if (events & EPOLLIN) {
+        qvrholder_broker_request_t req;
+        ssize_t n;
+        while ((n = recv(fd, &req, sizeof(req), MSG_DONTWAIT)) > 0) {
+            qvrholder_broker_reply_t rep = {};
+            rep.seq = req.seq;
+            requests++;
+
+            if (n != (ssize_t) sizeof(req) || req.version != QVRHOLDER_BROKER_VERSION) {
+                rep.result = QVR_INVALID_PARAM;
+            } else if (req.op == QVRHOLDER_BROKER_OP_STOP && !may_stop(c.uid)) {
+                denied++;
+                __log_func(ANDROID_LOG_WARN, TAG, "broker: stop lease denied to pid %d uid %d", (int) c.pid,
+                           (int) c.uid);
+                rep.result = QVRHOLDER_BROKER_DENIED;
+            } else if (req.op == QVRHOLDER_BROKER_OP_PAUSE || req.op == QVRHOLDER_BROKER_OP_STOP) {
+                set_lease(c, req.op);
+            } else if (req.op == QVRHOLDER_BROKER_OP_RESUME) {
+                set_lease(c, 0);
+            } else if (req.op != QVRHOLDER_BROKER_OP_QUERY) {
+                rep.result = QVR_INVALID_PARAM;
+            }
+
+            QVRSERVICE_VRMODE_STATE vrstate = holder.vrmode();
+            if (rep.result == QVR_SUCCESS)
+                rep.result = target_result(vrstate);
+            rep.vrmode = (uint32_t) vrstate;
+            rep.pause_leases = (uint16_t) pause_leases;
+            rep.stop_leases = (uint16_t) stop_leases;
+            if (send(fd, &rep, sizeof(rep), MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) sizeof(rep)) {
+                // a client that doesn't read its replies loses its lease
+                drop_client(fd);
+                return;
+            }
+        }
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            drop_client(fd);
+            return;
+        }
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR))
+        drop_client(fd);
+}
+
+void VrModeBroker::drop_client(int fd)
+{
+    auto it = clients.find(fd);
+    if (it == clients.end())
+        return;
+    if (it->second.lease != 0)
+        set_lease(it->second, 0);
+    clients.erase(it);
+    loop.destroy_fd(fd);
+}
+
+void VrModeBroker::set_lease(Client& c, uint16_t lease)
+{
+    if (c.lease == lease)
+        return;
+
+    if (c.lease == QVRHOLDER_BROKER_OP_PAUSE)
+        pause_leases--;
+    else if (c.lease == QVRHOLDER_BROKER_OP_STOP)
+        stop_leases--;
+    if (lease == QVRHOLDER_BROKER_OP_PAUSE)
+        pause_leases++;
+    else if (lease == QVRHOLDER_BROKER_OP_STOP)
+        stop_leases++;
+
+    __log_func(ANDROID_LOG_INFO, TAG, "broker lease of pid %d uid %d: %s -> %s (%u pause, %u stop)",
+               (int) c.pid, (int) c.uid, lease_name(c.lease), lease_name(lease), pause_leases, stop_leases);
+    c.lease = lease;
+    update_target();
+}
+
+void VrModeBroker::log_leases() const
+{
+    for (const auto& c : clients) {
+        if (c.second.lease != 0)
+            __log_func(ANDROID_LOG_INFO, TAG, "broker: %s lease held by pid %d uid %d", lease_name(c.second.lease),
+                       (int) c.second.pid, (int) c.second.uid);
+    }
+}
+
+void VrModeBroker::update_target()
+{
+    if (stop_leases > 0)
+        holder.set_target(VrModeHolder::TARGET_STOPPED);
+    else if (pause_leases > 0)
+        holder.set_target(VrModeHolder::TARGET_PAUSED);
+    else
+        holder.set_target(VrModeHolder::TARGET_STARTED);
+}
+
+int32_t VrModeBroker::target_result(QVRSERVICE_VRMODE_STATE vrstate) const
+{
+    QVRSERVICE_VRMODE_STATE wanted = VRMODE_STARTED;
+    if (holder.target() == VrModeHolder::TARGET_PAUSED)
+        wanted = VRMODE_PAUSED;
+    else if (holder.target() == VrModeHolder::TARGET_STOPPED)
+        wanted = VRMODE_STOPPED;
+    return vrstate == wanted ? QVR_SUCCESS : QVR_RESULT_PENDING;
+}
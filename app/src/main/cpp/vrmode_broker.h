@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <vector>
+
+#include "event_loop.h"
+#include "vrmode_holder.h"
+#include "vrmode_broker_protocol.h"
+
+// Arbitrates VR mode between apps on behalf of the holder. Apps that used to
+// stop qvr themselves (and lose 6DoF for seconds on every launcher switch)
+// ask the broker for a lease instead; the holder, which owns the session,
+// pauses or stops it and puts it back when the last lease goes away. Runs
+// entirely on the holder's event loop.
+//
+// Any local process can reach the socket, so stop leases, which take 6DoF
+// away for as long as they are held, are only granted to the peer uids
+// (SO_PEERCRED) on the stop list: root, system and the holder's own uid,
+// plus launchers added with allow_stop_uid().
+class VrModeBroker {
+public:
+    static const int MAX_CLIENTS = 32;
+
+    VrModeBroker(EventLoop& loop, VrModeHolder& holder);
+    ~VrModeBroker();
+
+    bool start(const char* name = QVRHOLDER_BROKER_NAME);
+    void allow_stop_uid(uid_t uid);
+    void set_stop_uids(const std::vector<uid_t>& uids) { stop_uids = uids; }
+    bool may_stop(uid_t uid) const;
+    // drops every lease, the holder goes back to TARGET_STARTED
+    void stop();
+    bool running() const { return listen_fd >= 0; }
+
+    size_t client_count() const { return clients.size(); }
+    uint32_t pause_lease_count() const { return pause_leases; }
+    uint32_t stop_lease_count() const { return stop_leases; }
+    uint64_t request_count() const { return requests; }
+    uint64_t denied_count() const { return denied; }
+    // who holds the leases, to the log
+    void log_leases() const;
+
+private:
+    struct Client {
+        uint16_t lease;      // 0 or QVRHOLDER_BROKER_OP_PAUSE/STOP
+        pid_t pid;
+        uid_t uid;
+    };
+
+    void on_accept();
+    void on_client(int fd, uint32_t events);
+    void drop_client(int fd);
+    void set_lease(Client& c, uint16_t lease);
+    void update_target();
+    int32_t target_result(QVRSERVICE_VRMODE_STATE vrstate) const;
+
+    EventLoop& loop;
+    VrModeHolder& holder;
+    int listen_fd;
+    std::map<int, Client> clients;
+    std::vector<uid_t> stop_uids;
+    uint32_t pause_leases;
+    uint32_t stop_leases;
+    uint64_t requests;
+    uint64_t denied;
+};
@@ -0,0 +1,91 @@
+#include "vrmode_broker_client.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "qvr/inc/QVRTypes.h"
+#include "holder_log.h"
+
+socklen_t broker_address(const char* name, struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    // leading NUL: abstract namespace, nothing to unlink, gone with the holder
+    size_t len = strnlen(name, sizeof(addr->sun_path) - 1);
+    memcpy(addr->sun_path + 1, name, len);
+    return (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+
+VrModeBrokerClient::VrModeBrokerClient()
+    : fd(-1)
+    , seq(0)
+{
+}
+
+VrModeBrokerClient::~VrModeBrokerClient()
+{
+    close();
+}
+
+bool VrModeBrokerClient::connect(const char* name, int timeout_ms)
+{
+    close();
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_un addr;
+    socklen_t len = broker_address(name, &addr);
+    if (::connect(fd, (struct sockaddr*) &addr, len) != 0) {
+        __log_func(ANDROID_LOG_WARN, TAG, "connect to broker %s failed: %d", name, errno);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void VrModeBrokerClient::close()
+{
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+int32_t VrModeBrokerClient::request(QVRHOLDER_BROKER_OP op, qvrholder_broker_reply_t* reply)
+{
+    if (fd < 0)
+        return QVR_ERROR;
+
+    qvrholder_broker_request_t req = {};
+    req.version = QVRHOLDER_BROKER_VERSION;
+    req.op = (uint16_t) op;
+    req.seq = ++seq;
+    if (send(fd, &req, sizeof(req), MSG_NOSIGNAL) != (ssize_t) sizeof(req)) {
+        close();
+        return QVR_ERROR;
+    }
+
+    // a timeout drops the connection and with it the lease, so replies
+    // can never arrive out of order
+    qvrholder_broker_reply_t rep;
+    ssize_t n = recv(fd, &rep, sizeof(rep), 0);
+    if (n != (ssize_t) sizeof(rep) || rep.seq != req.seq) {
+        close();
+        return QVR_ERROR;
+    }
+
+    if (reply != NULL)
+        *reply = rep;
+    return rep.result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "vrmode_broker_protocol.h"
+
+// abstract address of the broker socket, returns the address length
+socklen_t broker_address(const char* name, struct sockaddr_un* addr);
+
+// Blocking client side of the broker, for native apps and the benchmarks.
+// The lease lives as long as the connection does.
+class VrModeBrokerClient {
+public:
+    static const int DEFAULT_TIMEOUT_MS = 1000;
+
+    VrModeBrokerClient();
+    ~VrModeBrokerClient();
+
+    bool connect(const char* name = QVRHOLDER_BROKER_NAME, int timeout_ms = DEFAULT_TIMEOUT_MS);
+    void close();
+    bool is_connected() const { return fd >= 0; }
+
+    // QVRHOLDER_BROKER_OP round trip, QVR_ERROR when the broker is gone
+    int32_t request(QVRHOLDER_BROKER_OP op, qvrholder_broker_reply_t* reply = NULL);
+
+    int32_t pause() { return request(QVRHOLDER_BROKER_OP_PAUSE); }
+    int32_t stop() { return request(QVRHOLDER_BROKER_OP_STOP); }
+    int32_t resume() { return request(QVRHOLDER_BROKER_OP_RESUME); }
+
+private:
+    int fd;
+    uint32_t seq;
+};
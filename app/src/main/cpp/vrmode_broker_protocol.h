@@ -0,0 +1,51 @@
+#pragma once
+
+// Wire format of the qvrholder VR mode broker. Apps connect a SOCK_SEQPACKET
+// socket to the abstract unix address "@qvrholder" and exchange fixed size
+// little endian messages, one request and one reply per packet.
+//
+// Every connection holds at most one lease. A new request replaces the
+// lease of its connection, closing the connection releases it. While any
+// stop lease exists the holder keeps VR mode stopped, otherwise while any
+// pause lease exists it keeps VR mode paused, otherwise started.
+
+#include <stdint.h>
+
+#define QVRHOLDER_BROKER_NAME "qvrholder"
+#define QVRHOLDER_BROKER_VERSION 1
+
+// result of a stop request from a uid the holder doesn't take stop leases
+// from; the connection keeps the lease it had
+#define QVRHOLDER_BROKER_DENIED (-100)
+
+enum QVRHOLDER_BROKER_OP {
+    // take a pause lease: VR mode is paused with PauseVRMode, tracking keeps
+    // its map and ResumeVRMode brings 6DoF back without re-initializing
+    QVRHOLDER_BROKER_OP_PAUSE = 1,
+    // take a stop lease, for apps that need the service fully stopped; only
+    // root, system and the uids the holder is started with may
+    QVRHOLDER_BROKER_OP_STOP = 2,
+    // release the lease of this connection
+    QVRHOLDER_BROKER_OP_RESUME = 3,
+    // no lease change, just the reply
+    QVRHOLDER_BROKER_OP_QUERY = 4,
+};
+
+struct qvrholder_broker_request_t {
+    uint16_t version;        // QVRHOLDER_BROKER_VERSION
+    uint16_t op;             // QVRHOLDER_BROKER_OP
+    uint32_t seq;            // echoed in the reply
+};
+
+struct qvrholder_broker_reply_t {
+    uint32_t seq;
+    // QVR_SUCCESS once VR mode is in the state the leases ask for,
+    // QVR_RESULT_PENDING while the holder is still getting there (the
+    // service refused or is mid transition, the holder retries),
+    // QVR_INVALID_PARAM for a malformed request, QVRHOLDER_BROKER_DENIED
+    // for a stop lease the uid may not take
+    int32_t result;
+    uint32_t vrmode;         // QVRSERVICE_VRMODE_STATE after the request
+    uint16_t pause_leases;
+    uint16_t stop_leases;
+};
@@ -0,0 +1,631 @@
+#include "vrmode_holder.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "holder_log.h"
+#include "time_util.h"
+
+// first retry of a refused call (StartVRMode is refused while the service is
+// still in VRMODE_STOPPING), doubled on every failure in a row
+#define RETRY_MIN_NS (500 * 1000LL)
+#define RETRY_MAX_NS (500 * 1000 * 1000LL)
+
+// tracking_state is polled from the pose ring; while an outage is young it
+// is polled fast so the time to 6DoF is measured to the millisecond. In
+// steady 6DoF stops, disconnects and subsystem errors come as notifications,
+// only a fatal tracking_state or a stalled pose stream needs the poll. No
+// notification carries tracking_state, so the idle poll bounds how late a
+// FATAL_ERROR is seen: 100 ms, one ring read ten times a second, instead of
+// the 20 ms of an outage.
+#define WATCH_IDLE_INTERVAL_NS (100 * 1000 * 1000LL)
+#define WATCH_INTERVAL_NS (20 * 1000 * 1000LL)
+#define WATCH_FAST_INTERVAL_NS (1000 * 1000LL)
+#define WATCH_FAST_WINDOW_NS (10 * 1000 * 1000 * 1000LL)
+
+// relocation and suspended tracking usually recover on their own, a fatal
+// error never does; restarting tracking re-initializes the map, so restarts
+// back off from seconds to a minute
+#define TRACKING_GRACE_NS (3 * 1000 * 1000 * 1000LL)
+#define POSE_STALE_NS (250 * 1000 * 1000LL)
+#define TRACKING_RESTART_MIN_NS (2 * 1000 * 1000 * 1000LL)
+#define TRACKING_RESTART_MAX_NS (60 * 1000 * 1000 * 1000LL)
+// on top of the recovery time a subsystem error announces
+#define SUBSYSTEM_MARGIN_NS (1000 * 1000 * 1000LL)
+
+// qvrservice_head_tracking_data_t::tracking_state bits
+#define TRACKING_STATE_RELOCATION_IN_PROGRESS 0x1
+#define TRACKING_STATE_TRACKING_SUSPENDED 0x2
+#define TRACKING_STATE_TRACKING 0x4
+#define TRACKING_STATE_FATAL_ERROR 0x8
+
+// subsystem_word: pending flag, announced seconds, subsystem type, state
+#define SUBSYSTEM_PENDING (1ULL << 63)
+#define SUBSYSTEM_PARAM_MAX ((1ULL << 40) - 1)
+
+VrModeHolder::VrModeHolder(EventLoop& loop)
+    : loop(loop)
+    , qvr_client(NULL)
+    , event_fd(-1)
+    , retry_timer_fd(-1)
+    , watchdog_timer_fd(-1)
+    , disconnected(false)
+    , stopped_ts(0)
+    , notified_state(VRMODE_UNSUPPORTED)
+    , subsystem_word(0)
+    , vr_target(TARGET_STARTED)
+    , self_paused(false)
+    , self_stopped(false)
+    , positional_checked(false)
+    , retry_backoff(RETRY_MIN_NS)
+    , health_state(HEALTH_VRMODE_DOWN)
+    , last_pose_ts(0)
+    , last_pose_change(0)
+    , lost_since(0)
+    , next_tracking_restart(0)
+    , tracking_restart_backoff(TRACKING_RESTART_MIN_NS)
+    , subsystem_recovering_until(0)
+    , unrecoverable(false)
+    , outage_start(0)
+    , outage_cause(HEALTH_VRMODE_DOWN)
+    , outage_pose_ts(0)
+    , restarts(0)
+    , last_recovery(0)
+    , outages(0)
+    , last_time_to_6dof(0)
+    , max_time_to_6dof(0)
+    , tracking_restarts(0)
+    , reconnects(0)
+{
+}
+
+VrModeHolder::~VrModeHolder()
+{
+    stop();
+}
+
+const char* VrModeHolder::health_name(Health health)
+{
+    switch (health) {
+        case HEALTH_6DOF:
+            return "6dof";
+        case HEALTH_HELD:
+            return "held";
+        case HEALTH_VRMODE_DOWN:
+            return "vrmode down";
+        case HEALTH_TRACKING_LOST:
+            return "tracking lost";
+        case HEALTH_SUBSYSTEM_RECOVERING:
+            return "subsystem recovering";
+        case HEALTH_UNRECOVERABLE:
+            return "unrecoverable";
+        case HEALTH_DISCONNECTED:
+            return "disconnected";
+    }
+    return "unknown";
+}
+
+void VrModeHolder::notification_callback(void* pCtx, QVRSERVICE_CLIENT_NOTIFICATION notification,
+                                         void* payload, uint32_t payload_length)
+{
+    VrModeHolder* me = (VrModeHolder*) pCtx;
+
+    switch (notification) {
+        case NOTIFICATION_STATE_CHANGED: {
+            if (payload == NULL || payload_length < sizeof(qvrservice_state_notify_payload_t))
+                return;
+            qvrservice_state_notify_payload_t* state = (qvrservice_state_notify_payload_t*) payload;
+            me->on_state_notified(state->new_state, state->previous_state);
+            break;
+        }
+        case NOTIFICATION_SUBSYSTEM_ERROR: {
+            if (payload == NULL || payload_length < sizeof(qvrservice_subsystem_error_notify_payload_t))
+                return;
+            qvrservice_subsystem_error_notify_payload_t* error =
+                    (qvrservice_subsystem_error_notify_payload_t*) payload;
+            uint64_t param = std::min<uint64_t>(error->param, SUBSYSTEM_PARAM_MAX);
+            // only the latest one matters, it supersedes whatever is pending
+            me->subsystem_word.store(SUBSYSTEM_PENDING | (param << 16)
+                                     | ((uint64_t) (error->subsystem_type & 0xff) << 8)
+                                     | (uint64_t) (error->error_state & 0xff));
+            EventLoop::signal_event(me->event_fd);
+            break;
+        }
+        case NOTIFICATION_DISCONNECTED:
+            __log_func(ANDROID_LOG_ERROR, TAG, "qvr service disconnected");
+            me->disconnected.store(true);
+            EventLoop::signal_event(me->event_fd);
+            break;
+        default:
+            break;
+    }
+}
+
+// arg2 : prev vrmode state
+// arg1 : new vrmode state
+void VrModeHolder::client_status_callback(void* pCtx, QVRSERVICE_CLIENT_STATUS status, uint32_t arg1, uint32_t arg2)
+{
+    VrModeHolder* me = (VrModeHolder*) pCtx;
+
+    if (status == STATUS_STATE_CHANGED) {
+        me->on_state_notified((QVRSERVICE_VRMODE_STATE) arg1, (QVRSERVICE_VRMODE_STATE) arg2);
+    } else if (status == STATUS_DISCONNECTED) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "qvr service disconnected");
+        me->disconnected.store(true);
+        EventLoop::signal_event(me->event_fd);
+    }
+}
+
+void VrModeHolder::on_state_notified(QVRSERVICE_VRMODE_STATE new_state, QVRSERVICE_VRMODE_STATE prev_state)
+{
+    __log_func(ANDROID_LOG_VERBOSE, TAG, "vrmode state: %s -> %s",
+               QVRServiceClient_StateToName(prev_state), QVRServiceClient_StateToName(new_state));
+
+    notified_state.store(new_state);
+    if (new_state == VRMODE_STOPPED) {
+        int64_t expected = 0;
+        stopped_ts.compare_exchange_strong(expected, now_ns());
+    }
+    // transitions are rare; the loop decides whether the target needs action
+    EventLoop::signal_event(event_fd);
+}
+
+bool VrModeHolder::start()
+{
+    event_fd = loop.create_event([this]() { on_vrmode_event(); });
+    retry_timer_fd = loop.create_timer([this]() { on_retry(); });
+    watchdog_timer_fd = loop.create_timer([this]() { check_health(); });
+    if (event_fd < 0 || retry_timer_fd < 0 || watchdog_timer_fd < 0) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "create holder event fds failed");
+        return false;
+    }
+
+    if (!connect())
+        return false;
+
+    assert_vrmode();
+    // the initial start is not a restart
+    restarts = 0;
+    QVRSERVICE_VRMODE_STATE vrstate = QVRServiceClient_GetVRMode(qvr_client);
+    __log_func(ANDROID_LOG_VERBOSE, TAG, "curr vrmode: %s", QVRServiceClient_StateToName(vrstate));
+
+    check_health();
+    return true;
+}
+
+void VrModeHolder::stop()
+{
+    // the callbacks signal event_fd from the client's binder threads, so
+    // they go, and the client with them, before the fds do
+    if (qvr_client != NULL) {
+        int32_t res = QVRServiceClient_RegisterForNotification(qvr_client, NOTIFICATION_STATE_CHANGED, NULL, NULL);
+        if (res == QVR_API_NOT_SUPPORTED) {
+            QVRServiceClient_SetClientStatusCallback(qvr_client, NULL, NULL);
+        } else {
+            QVRServiceClient_RegisterForNotification(qvr_client, NOTIFICATION_DISCONNECTED, NULL, NULL);
+            QVRServiceClient_RegisterForNotification(qvr_client, NOTIFICATION_SUBSYSTEM_ERROR, NULL, NULL);
+        }
+    }
+    pose_reader.close();
+    if (qvr_client != NULL) {
+        QVRServiceClient_Destroy(qvr_client);
+        qvr_client = NULL;
+    }
+    if (event_fd >= 0) {
+        loop.destroy_fd(event_fd);
+        event_fd = -1;
+    }
+    if (retry_timer_fd >= 0) {
+        loop.destroy_fd(retry_timer_fd);
+        retry_timer_fd = -1;
+    }
+    if (watchdog_timer_fd >= 0) {
+        loop.destroy_fd(watchdog_timer_fd);
+        watchdog_timer_fd = -1;
+    }
+}
+
+QVRSERVICE_VRMODE_STATE VrModeHolder::vrmode() const
+{
+    return qvr_client != NULL ? QVRServiceClient_GetVRMode(qvr_client) : VRMODE_UNSUPPORTED;
+}
+
+bool VrModeHolder::connect()
+{
+    disconnected.store(false);
+    qvr_client = QVRServiceClient_Create();
+    if (qvr_client == NULL) {
+        __log_func(ANDROID_LOG_ERROR, TAG, "create qvr service client failed !!!");
+        return false;
+    }
+    __log_func(ANDROID_LOG_VERBOSE, TAG, "api version: %d", qvr_client->client->api_version);
+
+    int32_t res = QVRServiceClient_RegisterForNotification(qvr_client, NOTIFICATION_STATE_CHANGED,
+                                                           notification_callback, this);
+    if (res == QVR_API_NOT_SUPPORTED) {
+        // api version 1/2 services only have the deprecated status callback
+        QVRServiceClient_SetClientStatusCallback(qvr_client, client_status_callback, this);
+    } else {
+        QVRServiceClient_RegisterForNotification(qvr_client, NOTIFICATION_DISCONNECTED,
+                                                 notification_callback, this);
+        QVRServiceClient_RegisterForNotification(qvr_client, NOTIFICATION_SUBSYSTEM_ERROR,
+                                                 notification_callback, this);
+    }
+
+    QVRSERVICE_VRMODE_STATE vrstate = QVRServiceClient_GetVRMode(qvr_client);
+    __log_func(ANDROID_LOG_VERBOSE, TAG, "vrmode state: %s", QVRServiceClient_StateToName(vrstate));
+    notified_state.store(vrstate);
+
+    // nothing of the previous session carries over
+    self_paused = false;
+    self_stopped = false;
+    positional_checked = false;
+    pose_reader.close();
+    return true;
+}
+
+// The old client is unusable after a disconnect; the service restarts (or
+// was restarted by init) and a new client gets a fresh session.
+void VrModeHolder::reconnect()
+{
+    int64_t now = now_ns();
+    // while the old ring is still mapped, for the last pose before the outage
+    set_health(HEALTH_DISCONNECTED, now);
+    if (qvr_client != NULL) {
+        if (client_listener)
+            client_listener(NULL);
+        pose_reader.close();
+        QVRServiceClient_Destroy(qvr_client);
+        qvr_client = NULL;
+    }
+
+    if (!connect()) {
+        retry_later();
+        return;
+    }
+    reconnects++;
+    retry_done();
+    __log_func(ANDROID_LOG_INFO, TAG, "reconnected to qvr service %.3f ms after disconnect",
+               ns_to_ms(now_ns() - outage_start));
+
+    if (client_listener)
+        client_listener(qvr_client);
+    assert_vrmode();
+    check_health();
+}
+
+void VrModeHolder::retry_later()
+{
+    loop.arm_timer(retry_timer_fd, retry_backoff);
+    retry_backoff = std::min<int64_t>(retry_backoff * 2, RETRY_MAX_NS);
+}
+
+void VrModeHolder::retry_done()
+{
+    loop.disarm_timer(retry_timer_fd);
+    retry_backoff = RETRY_MIN_NS;
+}
+
+void VrModeHolder::on_vrmode_event()
+{
+    if (disconnected.load()) {
+        reconnect();
+        return;
+    }
+
+    uint64_t word = subsystem_word.exchange(0);
+    if (word != 0)
+        on_subsystem_error(word);
+
+    assert_vrmode();
+    check_health();
+}
+
+void VrModeHolder::on_retry()
+{
+    if (qvr_client == NULL) {
+        reconnect();
+        return;
+    }
+    assert_vrmode();
+}
+
+void VrModeHolder::set_target(Target target)
+{
+    if (target == vr_target)
+        return;
+    vr_target = target;
+    // the way back from a lease counts as an outage of its own
+    if (qvr_client == NULL)
+        return;
+    if (target == TARGET_STARTED)
+        begin_outage(now_ns(), HEALTH_HELD);
+    assert_vrmode();
+    check_health();
+}
+
+// A service restarted after a disconnect may come back in its default
+// (rotational) tracking mode; 6DoF needs POSITIONAL set while stopped.
+bool VrModeHolder::ensure_positional()
+{
+    if (positional_checked)
+        return true;
+
+    QVRSERVICE_TRACKING_MODE mode = TRACKING_MODE_NONE;
+    uint32_t supported = 0;
+    int32_t res = QVRServiceClient_GetTrackingMode(qvr_client, &mode, &supported);
+    if (res != QVR_SUCCESS || mode == TRACKING_MODE_POSITIONAL || !(supported & TRACKING_MODE_POSITIONAL)) {
+        // nothing the holder can or needs to change
+        positional_checked = true;
+        return true;
+    }
+
+    res = QVRServiceClient_SetTrackingMode(qvr_client, TRACKING_MODE_POSITIONAL);
+    if (res != QVR_SUCCESS) {
+        __log_func(ANDROID_LOG_WARN, TAG, "set positional tracking mode failed: %d", res);
+        return false;
+    }
+    __log_func(ANDROID_LOG_INFO, TAG, "tracking mode %d -> positional", (int) mode);
+    positional_checked = true;
+    return true;
+}
+
+void VrModeHolder::assert_vrmode()
+{
+    QVRSERVICE_VRMODE_STATE vrstate = QVRServiceClient_GetVRMode(qvr_client);
+    int32_t res;
+
+    switch (vr_target) {
+        case TARGET_STOPPED:
+            self_paused = false;
+            // once stopped, a session some app starts under its own lease
+            // is not ours to stop
+            if (!self_stopped && (vrstate == VRMODE_STARTED || vrstate == VRMODE_PAUSED)) {
+                res = QVRServiceClient_StopVRMode(qvr_client);
+                if (res != QVR_SUCCESS) {
+                    __log_func(ANDROID_LOG_WARN, TAG, "stop vrmode for lease failed: %d", res);
+                    retry_later();
+                    return;
+                }
+                self_stopped = true;
+            }
+            retry_done();
+            return;
+
+        case TARGET_PAUSED:
+            if (vrstate == VRMODE_STARTED) {
+                res = QVRServiceClient_PauseVRMode(qvr_client);
+                if (res != QVR_SUCCESS) {
+                    __log_func(ANDROID_LOG_WARN, TAG, "pause vrmode for lease failed: %d", res);
+                    retry_later();
+                    return;
+                }
+                self_paused = true;
+                retry_done();
+                return;
+            }
+            // a stopped session is started first and paused once STARTED
+            // is notified
+            break;
+
+        case TARGET_STARTED:
+            if (vrstate == VRMODE_PAUSED && self_paused) {
+                res = QVRServiceClient_ResumeVRMode(qvr_client);
+                if (res != QVR_SUCCESS) {
+                    __log_func(ANDROID_LOG_WARN, TAG, "resume vrmode failed: %d", res);
+                    retry_later();
+                    return;
+                }
+                self_paused = false;
+                retry_done();
+                return;
+            }
+            break;
+    }
+
+    if (vrstate == VRMODE_STOPPED) {
+        if (!ensure_positional()) {
+            retry_later();
+            return;
+        }
+        res = QVRServiceClient_StartVRMode(qvr_client);
+        if (res == QVR_SUCCESS) {
+            int64_t since = stopped_ts.exchange(0);
+            if (self_stopped) {
+                // end of a stop lease or a tracking restart, not a recovery
+                self_stopped = false;
+            } else {
+                restarts++;
+                if (since != 0) {
+                    last_recovery = now_ns() - since;
+                    __log_func(ANDROID_LOG_INFO, TAG, "vrmode re-asserted %.3f ms after stop",
+                               ns_to_ms(last_recovery));
+                    // the outage began with the stop, not when it was noticed
+                    if (outage_start == 0 || since < outage_start)
+                        begin_outage(since, HEALTH_VRMODE_DOWN);
+                }
+            }
+            retry_done();
+            return;
+        }
+        __log_func(ANDROID_LOG_WARN, TAG, "restart vrmode failed: %d", res);
+    }
+
+    if (vrstate == VRMODE_STOPPED || vrstate == VRMODE_STOPPING) {
+        // transient or refused, check again after the backoff
+        retry_later();
+        return;
+    }
+
+    // started, paused or headless: nothing to do until the next notification
+    retry_done();
+    stopped_ts.store(0);
+}
+
+void VrModeHolder::on_subsystem_error(uint64_t word)
+{
+    QVRSERVICE_SUBSYSTEM_ERROR_STATE state = (QVRSERVICE_SUBSYSTEM_ERROR_STATE) (word & 0xff);
+    const char* subsystem = ((word >> 8) & 0xff) == QVRSERVICE_SUBSYSTEM_TYPE_SENSOR ? "sensor" : "tracking";
+    uint64_t seconds = (word >> 16) & SUBSYSTEM_PARAM_MAX;
+
+    switch (state) {
+        case QVRSERVICE_SUBSYSTEM_ERROR_STATE_RECOVERING:
+            // restarting tracking now would only fight the service
+            subsystem_recovering_until = now_ns() + (int64_t) seconds * 1000000000LL + SUBSYSTEM_MARGIN_NS;
+            __log_func(ANDROID_LOG_WARN, TAG, "%s subsystem error, service recovering within %llu s",
+                       subsystem, (unsigned long long) seconds);
+            break;
+        case QVRSERVICE_SUBSYSTEM_ERROR_STATE_RECOVERED:
+            subsystem_recovering_until = 0;
+            unrecoverable = false;
+            __log_func(ANDROID_LOG_INFO, TAG, "%s subsystem recovered", subsystem);
+            break;
+        case QVRSERVICE_SUBSYSTEM_ERROR_STATE_UNRECOVERABLE:
+            unrecoverable = true;
+            __log_func(ANDROID_LOG_ERROR, TAG, "%s subsystem unrecoverable, device restart required", subsystem);
+            break;
+        default:
+            break;
+    }
+}
+
+void VrModeHolder::check_health()
+{
+    if (qvr_client == NULL)
+        return;
+
+    int64_t now = now_ns();
+    if (vr_target != TARGET_STARTED) {
+        set_health(HEALTH_HELD, now);
+        // set_target() brings the watchdog back
+        loop.disarm_timer(watchdog_timer_fd);
+        return;
+    }
+
+    Health next;
+    uint16_t bits = 0;
+    bool stalled = false;
+    if (notified_state.load() != VRMODE_STARTED) {
+        next = HEALTH_VRMODE_DOWN;
+    } else {
+        qvrservice_head_tracking_data_t pose;
+        if (read_latest_pose(&pose)) {
+            bits = pose.tracking_state;
+            if (pose.ts != last_pose_ts) {
+                last_pose_ts = pose.ts;
+                last_pose_change = now;
+            }
+        }
+        stalled = now - last_pose_change > POSE_STALE_NS;
+
+        if (!(bits & TRACKING_STATE_TRACKING) || (bits & TRACKING_STATE_FATAL_ERROR) || stalled)
+            next = HEALTH_TRACKING_LOST;
+        else if (outage_start == 0 || last_pose_ts != outage_pose_ts)
+            next = HEALTH_6DOF;
+        else
+            // started, but the newest pose predates the outage
+            next = health_state == HEALTH_6DOF ? HEALTH_VRMODE_DOWN : health_state;
+    }
+    if (next != HEALTH_6DOF) {
+        if (now < subsystem_recovering_until)
+            next = HEALTH_SUBSYSTEM_RECOVERING;
+        else if (unrecoverable)
+            next = HEALTH_UNRECOVERABLE;
+    }
+    set_health(next, now);
+
+    if (next == HEALTH_TRACKING_LOST) {
+        if (lost_since == 0)
+            lost_since = now;
+        bool fatal = (bits & TRACKING_STATE_FATAL_ERROR) != 0;
+        if ((fatal || now - lost_since >= TRACKING_GRACE_NS) && now >= next_tracking_restart) {
+            char why[64];
+            snprintf(why, sizeof(why), "%s, tracking_state 0x%x",
+                     fatal ? "fatal error" : stalled ? "pose stream stalled" : "tracking lost", bits);
+            restart_tracking(now, why);
+        }
+    } else {
+        lost_since = 0;
+    }
+
+    // an unrecoverable subsystem waits for its RECOVERED notification
+    int64_t interval = WATCH_IDLE_INTERVAL_NS;
+    if (next != HEALTH_6DOF && next != HEALTH_UNRECOVERABLE)
+        interval = outage_start != 0 && now - outage_start < WATCH_FAST_WINDOW_NS ? WATCH_FAST_INTERVAL_NS
+                                                                                   : WATCH_INTERVAL_NS;
+    loop.arm_timer(watchdog_timer_fd, interval);
+}
+
+// the ring when the service exports it, a GetHeadTrackingData call otherwise
+bool VrModeHolder::read_latest_pose(qvrservice_head_tracking_data_t* out)
+{
+    if (!pose_reader.is_open())
+        pose_reader.open(qvr_client, RING_BUFFER_POSE);
+    if (pose_reader.is_open())
+        return pose_reader.read_latest(out);
+
+    qvrservice_head_tracking_data_t* latest = NULL;
+    if (QVRServiceClient_GetHeadTrackingData(qvr_client, &latest) != QVR_SUCCESS || latest == NULL)
+        return false;
+    *out = *latest;
+    return true;
+}
+
+void VrModeHolder::restart_tracking(int64_t now, const char* why)
+{
+    tracking_restarts++;
+    __log_func(ANDROID_LOG_WARN, TAG, "restarting tracking (%s)", why);
+
+    next_tracking_restart = now + tracking_restart_backoff;
+    tracking_restart_backoff = std::min<int64_t>(tracking_restart_backoff * 2, TRACKING_RESTART_MAX_NS);
+    lost_since = 0;
+    positional_checked = false;
+
+    // the STOPPED notification drives the rest: tracking mode, StartVRMode
+    int32_t res = QVRServiceClient_StopVRMode(qvr_client);
+    if (res != QVR_SUCCESS) {
+        __log_func(ANDROID_LOG_WARN, TAG, "stop vrmode for tracking restart failed: %d", res);
+        return;
+    }
+    self_stopped = true;
+}
+
+// Poses older than this don't count as 6DoF restored.
+void VrModeHolder::begin_outage(int64_t start, Health cause)
+{
+    qvrservice_head_tracking_data_t pose;
+    outage_start = start;
+    outage_cause = cause;
+    outage_pose_ts = qvr_client != NULL && read_latest_pose(&pose) ? pose.ts : 0;
+}
+
+void VrModeHolder::set_health(Health next, int64_t now)
+{
+    // an outage can begin and end between two checks
+    if (next == health_state && !(next == HEALTH_6DOF && outage_start != 0))
+        return;
+    if (next != health_state)
+        __log_func(ANDROID_LOG_INFO, TAG, "health: %s -> %s", health_name(health_state), health_name(next));
+    health_state = next;
+
+    if (next == HEALTH_6DOF) {
+        if (outage_start != 0) {
+            int64_t t = now - outage_start;
+            outages++;
+            last_time_to_6dof = t;
+            max_time_to_6dof = std::max(max_time_to_6dof, t);
+            __log_func(ANDROID_LOG_INFO, TAG, "6DoF restored %.3f ms after %s", ns_to_ms(t),
+                       health_name(outage_cause));
+            outage_start = 0;
+        }
+        tracking_restart_backoff = TRACKING_RESTART_MIN_NS;
+        next_tracking_restart = 0;
+        unrecoverable = false;
+    } else if (next == HEALTH_HELD) {
+        // not an outage, the apps asked for it
+        outage_start = 0;
+    } else if (outage_start == 0) {
+        begin_outage(now, next);
+    }
+}
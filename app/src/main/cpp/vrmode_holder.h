@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+
+#include "qvr/inc/QVRServiceClient.h"
+#include "event_loop.h"
+#include "pose/pose_ring_reader.h"
+
+// Owns the qvrservice client and keeps VR mode started. State changes arrive
+// on the client's callback thread and are forwarded to the event loop through
+// an eventfd, so the holder only runs when qvr actually changes state.
+//
+// The broker can move the target away from TARGET_STARTED while apps hold
+// leases; the holder then pauses or stops its own session instead of
+// re-starting it, and resumes once the target is back.
+//
+// On top of VR mode the holder watches 6DoF health: the tracking_state of
+// the newest head pose, subsystem error notifications and the connection
+// itself. Failed calls are retried with exponential backoff, tracking that
+// stays lost is restarted (StopVRMode, SetTrackingMode(POSITIONAL),
+// StartVRMode), and a lost connection gets a new client. Every outage ends
+// with the time until 6DoF tracking was back.
+class VrModeHolder {
+public:
+    enum Target {
+        TARGET_STARTED,
+        TARGET_PAUSED,
+        TARGET_STOPPED,
+    };
+
+    enum Health {
+        HEALTH_6DOF,
+        // paused or stopped for a broker lease
+        HEALTH_HELD,
+        HEALTH_VRMODE_DOWN,
+        // started, but tracking_state is not TRACKING or poses stalled
+        HEALTH_TRACKING_LOST,
+        // the service announced it is recovering a subsystem itself
+        HEALTH_SUBSYSTEM_RECOVERING,
+        HEALTH_UNRECOVERABLE,
+        HEALTH_DISCONNECTED,
+    };
+
+    // called on the loop thread with NULL before the client is destroyed and
+    // with the new one once a lost connection is re-established
+    typedef std::function<void(qvrservice_client_helper_t* client)> ClientListener;
+
+    explicit VrModeHolder(EventLoop& loop);
+    ~VrModeHolder();
+
+    bool start();
+    void stop();
+
+    qvrservice_client_helper_t* client() const { return qvr_client; }
+    void set_client_listener(ClientListener listener) { client_listener = listener; }
+    // VRMODE_UNSUPPORTED while there is no client
+    QVRSERVICE_VRMODE_STATE vrmode() const;
+
+    // loop thread only
+    void set_target(Target target);
+    Target target() const { return vr_target; }
+
+    Health health() const { return health_state; }
+    static const char* health_name(Health health);
+
+    uint64_t restart_count() const { return restarts; }
+    int64_t last_recovery_ns() const { return last_recovery; }
+
+    // outages that ended with 6DoF tracking restored, and how long they took
+    uint64_t outage_count() const { return outages; }
+    int64_t last_time_to_6dof_ns() const { return last_time_to_6dof; }
+    int64_t max_time_to_6dof_ns() const { return max_time_to_6dof; }
+    uint64_t tracking_restart_count() const { return tracking_restarts; }
+    uint64_t reconnect_count() const { return reconnects; }
+
+private:
+    static void notification_callback(void* pCtx, QVRSERVICE_CLIENT_NOTIFICATION notification,
+                                      void* payload, uint32_t payload_length);
+    static void client_status_callback(void* pCtx, QVRSERVICE_CLIENT_STATUS status,
+                                       uint32_t arg1, uint32_t arg2);
+
+    void on_state_notified(QVRSERVICE_VRMODE_STATE new_state, QVRSERVICE_VRMODE_STATE prev_state);
+    void on_vrmode_event();
+    void on_retry();
+    bool connect();
+    void reconnect();
+    void retry_later();
+    void retry_done();
+    bool ensure_positional();
+    void assert_vrmode();
+    void check_health();
+    bool read_latest_pose(qvrservice_head_tracking_data_t* out);
+    void on_subsystem_error(uint64_t word);
+    void restart_tracking(int64_t now, const char* why);
+    void begin_outage(int64_t start, Health cause);
+    void set_health(Health health, int64_t now);
+
+    EventLoop& loop;
+    qvrservice_client_helper_t* qvr_client;
+    int event_fd;
+    int retry_timer_fd;
+    int watchdog_timer_fd;
+    ClientListener client_listener;
+
+    std::atomic<bool> disconnected;
+    std::atomic<int64_t> stopped_ts;
+    std::atomic<int> notified_state;
+    // pending NOTIFICATION_SUBSYSTEM_ERROR, packed by notification_callback
+    std::atomic<uint64_t> subsystem_word;
+
+    Target vr_target;
+    // only a pause the holder made itself is resumed
+    bool self_paused;
+    // a stop made for a lease is not counted as a restart when undone
+    bool self_stopped;
+    // TRACKING_MODE_POSITIONAL verified since the client was created
+    bool positional_checked;
+    int64_t retry_backoff;
+
+    Health health_state;
+    PoseRingReader pose_reader;
+    uint64_t last_pose_ts;
+    int64_t last_pose_change;
+    int64_t lost_since;
+    int64_t next_tracking_restart;
+    int64_t tracking_restart_backoff;
+    int64_t subsystem_recovering_until;
+    bool unrecoverable;
+    int64_t outage_start;
+    Health outage_cause;
+    uint64_t outage_pose_ts;
+
+    uint64_t restarts;
+    int64_t last_recovery;
+    uint64_t outages;
+    int64_t last_time_to_6dof;
+    int64_t max_time_to_6dof;
+    uint64_t tracking_restarts;
+    uint64_t reconnects;
+};